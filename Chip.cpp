@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include "Chip.h"
+#include "Uf2Family.h"
+
+namespace kc1fsz {
+
+// REVISION is left out of DPIDR and TREVISION out of TARGETID
+static const uint32_t ID_MASK = 0x0fffffff;
+
+const Chip Chip::RP2040 = {
+    .name = "RP2040",
+    .targetSel = PioSWDDriver::RP2040_CORE0,
+    .apAddr = 0,
+    .dpidr = 0x0bc12477,
+    .part = 0x0002,
+    .family = Uf2Family::RP2040,
+    .secure = false,
+    .xipNoCacheBase = 0x13000000,
+    .resetsBase = 0x4000c000,
+    .resetsDma = 0x00000004,
+    .dmaSniffCtrl = 0x50000434,
+    .dmaChainToShift = 11,
+    .dmaTreqShift = 15,
+    .dmaSniffEn = 0x00800000,
+    .dmaBusy = 0x01000000
+};
+
+// The RP2350's DMA CTRL has the reversed increment bits in the middle,
+// which moves everything above them up by two
+const Chip Chip::RP2350 = {
+    .name = "RP2350",
+    .targetSel = PioSWDDriver::RP2350_DP,
+    .apAddr = PioSWDDriver::RP2350_CORE0_AP,
+    .dpidr = 0x0c013477,
+    .part = 0x0004,
+    .family = Uf2Family::RP2350_ARM_S,
+    .secure = true,
+    .xipNoCacheBase = 0x1c000000,
+    .resetsBase = 0x40020000,
+    .resetsDma = 0x00000004,
+    .dmaSniffCtrl = 0x50000454,
+    .dmaChainToShift = 13,
+    .dmaTreqShift = 17,
+    .dmaSniffEn = 0x02000000,
+    .dmaBusy = 0x04000000
+};
+
+static const Chip* const CHIPS[] = { &Chip::RP2040, &Chip::RP2350 };
+
+const Chip* Chip::connect(PioSWDDriver& swd) {
+    for (const Chip* chip : CHIPS) {
+        // A DP that isn't selected doesn't answer at all, so this
+        // fails quickly for the wrong chip
+        if (swd.connect(chip->targetSel, chip->apAddr) != 0)
+            continue;
+        if ((swd.getIDCODE() & ID_MASK) == chip->dpidr &&
+            (swd.getTARGETID() & ID_MASK) == (chip->targetSel & ID_MASK))
+            return chip;
+    }
+    return nullptr;
+}
+
+const Chip* Chip::forChipId(uint32_t chipId) {
+    // CHIP_ID is REVISION, PART and MANUFACTURER from the top down
+    const uint32_t part = (chipId >> 12) & 0xffff;
+    for (const Chip* chip : CHIPS)
+        if (chip->part == part)
+            return chip;
+    return nullptr;
+}
+
+}
@@ -0,0 +1,75 @@
+/**
+ * The target chips that the programmer knows how to drive.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "PioSWDDriver.h"
+
+namespace kc1fsz {
+
+/**
+ * Everything that depends on which chip is on the other end of the SWD
+ * link: how its DP and AP are reached, what it is called in a UF2 file,
+ * its debug architecture and where the peripherals that FlashLoader
+ * borrows for verifying live.
+ */
+struct Chip {
+
+    const char* name;
+    // Multi-drop TARGETSEL for core 0
+    uint32_t targetSel;
+    // Core 0's MEM-AP (see PioSWDDriver::connect())
+    uint32_t apAddr;
+    // DPIDR, less the REVISION field
+    uint32_t dpidr;
+    // The PART field of SYSINFO CHIP_ID
+    uint32_t part;
+    // UF2 family ID of images built for it
+    uint32_t family;
+    // ARMv8-M with the Security Extension. The core has a Secure state
+    // (see DSCSR) and the boot ROM's flash functions have to be called
+    // from it.
+    bool secure;
+    // The flash, bypassing the XIP cache (and on the RP2350 address
+    // translation too)
+    uint32_t xipNoCacheBase;
+    // RESETS, and the DMA bit in it
+    uint32_t resetsBase;
+    uint32_t resetsDma;
+    // DMA SNIFF_CTRL, with SNIFF_DATA in the next word
+    uint32_t dmaSniffCtrl;
+    // Where the DMA CTRL_TRIG fields that verify() uses are
+    uint8_t dmaChainToShift;
+    uint8_t dmaTreqShift;
+    uint32_t dmaSniffEn;
+    uint32_t dmaBusy;
+
+    // SYSINFO CHIP_ID, at the same address on both chips
+    static constexpr uint32_t CHIP_ID_ADDR = 0x40000000;
+
+    static const Chip RP2040;
+    static const Chip RP2350;
+
+    /**
+     * Tries the TARGETSEL of each known chip in turn and checks that
+     * DPIDR and TARGETID agree with the one that answers. The driver
+     * is left connected to core 0 of that chip.
+     *
+     * @returns nullptr if nothing recognizable answered.
+     */
+    static const Chip* connect(PioSWDDriver& swd);
+
+    /**
+     * The chip whose part number is in the PART field of a value read 
+     * from CHIP_ID_ADDR.
+     *
+     * @returns nullptr if the chip isn't recognized.
+     */
+    static const Chip* forChipId(uint32_t chipId);
+};
+
+}
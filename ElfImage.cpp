@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstring>
+#include <algorithm>
+
+#include "ElfImage.h"
+
+namespace kc1fsz {
+
+static const uint32_t PT_LOAD = 1;
+static const unsigned EHDR_SIZE = 52;
+static const unsigned PHDR_SIZE = 32;
+
+// The image may sit at any alignment
+static uint32_t get16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int ElfImage::parse(const uint8_t* elf, unsigned len, uint32_t flashBase, uint32_t flashSize) {
+
+    _segmentCount = 0;
+    _runCount = 0;
+
+    // ELFCLASS32, ELFDATA2LSB
+    if (len < EHDR_SIZE || memcmp(elf, "\x7f" "ELF", 4) != 0 || elf[4] != 1 || elf[5] != 1)
+        return -1;
+    const uint32_t phoff = get32(elf + 28);
+    const unsigned phentsize = get16(elf + 42);
+    const unsigned phnum = get16(elf + 44);
+    if (phentsize < PHDR_SIZE || phoff > len || phnum > (len - phoff) / phentsize)
+        return -1;
+
+    for (unsigned i = 0; i < phnum; i++) {
+        const uint8_t* ph = elf + phoff + i * phentsize;
+        const uint32_t fileOffset = get32(ph + 4);
+        const uint32_t paddr = get32(ph + 12);
+        const uint32_t filesz = get32(ph + 16);
+        if (get32(ph) != PT_LOAD || filesz == 0)
+            continue;
+        if (fileOffset > len || filesz > len - fileOffset)
+            return -1;
+        if (paddr < flashBase || paddr - flashBase > flashSize ||
+            filesz > flashSize - (paddr - flashBase))
+            return -1;
+        if (_segmentCount == MAX_SEGMENTS)
+            return -1;
+        // Kept in address order
+        Segment s = { paddr - flashBase, filesz, elf + fileOffset };
+        unsigned k = _segmentCount++;
+        for (; k > 0 && _segments[k - 1].offset > s.offset; k--)
+            _segments[k] = _segments[k - 1];
+        _segments[k] = s;
+    }
+
+    for (unsigned i = 0; i < _segmentCount; i++) {
+        const Segment& s = _segments[i];
+        if (i > 0 && s.offset < _segments[i - 1].offset + _segments[i - 1].len)
+            return -1;
+        const uint32_t start = s.offset & ~(PAGE_SIZE - 1);
+        const uint32_t end = (s.offset + s.len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        Run* last = _runCount > 0 ? &_runs[_runCount - 1] : nullptr;
+        if (last != nullptr && start <= last->offset + last->len)
+            last->len = std::max(last->offset + last->len, end) - last->offset;
+        else
+            _runs[_runCount++] = { start, end - start };
+    }
+    return 0;
+}
+
+void ElfImage::read(uint32_t offset, uint8_t* dst, unsigned len) const {
+    memset(dst, 0xff, len);
+    for (unsigned i = 0; i < _segmentCount; i++) {
+        const Segment& s = _segments[i];
+        const uint32_t start = std::max(offset, s.offset);
+        const uint32_t end = std::min(offset + len, s.offset + s.len);
+        if (start < end)
+            memcpy(dst + (start - offset), s.data + (start - s.offset), end - start);
+    }
+}
+
+}
@@ -0,0 +1,73 @@
+/**
+ * The flash contents described by an ELF file.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace kc1fsz {
+
+/**
+ * Reads the program headers of an ELF32 file in place (e.g. one linked
+ * into the programmer's own flash) and works out what needs to be
+ * written to the target's flash. The loadable segments are placed by
+ * their physical (load) address, so initialized data lands behind the
+ * code where the startup code copies it from. Segments that touch the
+ * same or neighbouring pages are merged into one run and each run is
+ * rounded out to whole pages; the gaps between runs are never sent.
+ *
+ * Nothing is copied. The image must stay put while this is in use.
+ */
+class ElfImage {
+public:
+
+    static constexpr unsigned MAX_SEGMENTS = 16;
+    static constexpr uint32_t PAGE_SIZE = 256;
+
+    /**
+     * A page-aligned range of flash, as an offset from the start of
+     * flash.
+     */
+    struct Run {
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    /**
+     * @param flashBase The address that flash appears at for the
+     *   target (FlashLoader::FLASH_XIP_BASE). Segments loaded anywhere
+     *   else are an error, unless they have no file contents (e.g. .bss).
+     * @param flashSize The largest offset a segment may reach.
+     * @returns 0 on success, -1 if the file isn't a little-endian ELF32
+     *   with loadable segments that fit in flash without overlapping.
+     */
+    int parse(const uint8_t* elf, unsigned len, uint32_t flashBase, uint32_t flashSize);
+
+    unsigned getRunCount() const { return _runCount; }
+    const Run& getRun(unsigned i) const { return _runs[i]; }
+
+    /**
+     * Copies the image's bytes for a range of flash, with 0xff where no
+     * segment has anything (which is what the flash holds after an
+     * erase).
+     */
+    void read(uint32_t offset, uint8_t* dst, unsigned len) const;
+
+private:
+
+    struct Segment {
+        // Offset from the start of flash
+        uint32_t offset;
+        uint32_t len;
+        const uint8_t* data;
+    };
+
+    Segment _segments[MAX_SEGMENTS];
+    unsigned _segmentCount = 0;
+    Run _runs[MAX_SEGMENTS];
+    unsigned _runCount = 0;
+};
+
+}
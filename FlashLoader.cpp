@@ -0,0 +1,895 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "pico/stdlib.h"
+
+#include "FlashLoader.h"
+#include "ElfImage.h"
+#include "RomTable.h"
+
+// loader.s, assembled
+#include "loader-bin.h"
+
+namespace kc1fsz {
+
+// A function address of 1 asks the stub to stop
+static const uint32_t STOP_CALL = 1;
+// Mailbox slot layout
+static const uint32_t SLOT_ARGS = 4;
+static const uint32_t SLOT_RESULT = 20;
+// Entry points in loader.s
+static const uint32_t LOADER_HASH = FlashLoader::LOADER_ADDR + 2;
+static const uint32_t LOADER_UNPACK = FlashLoader::LOADER_ADDR + 4;
+static const uint32_t LOADER_BLANK = FlashLoader::LOADER_ADDR + 6;
+// Per-sector header in a packed image
+static const unsigned PACKED_HEADER = 4;
+static const uint32_t FNV_OFFSET = 2166136261;
+static const uint32_t FNV_PRIME = 16777619;
+
+// The erase commands for whole 64K and 32K blocks. flash_range_erase() 
+// falls back to 4K sector erases for anything smaller than the block 
+// size it is given.
+static const uint32_t BLOCK_ERASE_CMD = 0xd8;
+static const uint32_t BLOCK32_ERASE_CMD = 0x52;
+static const unsigned SECTORS_PER_BLOCK = FlashLoader::BLOCK_SIZE / FlashLoader::SECTOR_SIZE;
+// Typical erase times, which the Winbond datasheets give the same for 
+// the W25Q16JV on the Pico and the W25Q128JV on larger boards: 4K 
+// sector, 32K block and 64K block
+static const unsigned SECTOR_ERASE_MS = 45;
+static const unsigned BLOCK32_ERASE_MS = 120;
+static const unsigned BLOCK64_ERASE_MS = 150;
+
+// ----- Peripherals used by verify(), see Chip for where they differ -----
+// These are the target's and are prefixed to stay clear of the SDK's 
+// register macros for our own (DMA_BASE etc.).
+static const uint32_t TARGET_RESETS_CLR_ALIAS = 0x3000;
+static const uint32_t TARGET_RESETS_RESET_DONE = 0x08;
+static const uint32_t TARGET_DMA_BASE = 0x50000000;
+static const uint32_t TARGET_DMA_CH_STRIDE = 0x40;
+static const uint32_t TARGET_DMA_READ_ADDR = 0x00;
+static const uint32_t TARGET_DMA_WRITE_ADDR = 0x04;
+static const uint32_t TARGET_DMA_TRANS_COUNT = 0x08;
+static const uint32_t TARGET_DMA_CTRL_TRIG = 0x0c;
+// CTRL: EN, 32-bit, increment read only. Unpaced, sniffed and a 
+// CHAIN_TO naming the channel itself (which disables chaining) are 
+// added at the chip's bit positions.
+static const uint32_t TARGET_DMA_CTRL = 0x00000001 | (2 << 2) | 0x00000010;
+static const uint32_t TARGET_DMA_TREQ_UNPACED = 0x3f;
+// SNIFF_CTRL (the same on both chips): EN, CRC-32 with bit reversed 
+// data, OUT_REV and OUT_INV. 
+// With a 0xffffffff seed this is the standard CRC-32, and since the 
+// input is reflected a little-endian word goes in the same as its 
+// four bytes would.
+static const uint32_t TARGET_SNIFF_CTRL = 0x00000001 | (FlashLoader::VERIFY_DMA_CHANNEL << 1) | 
+    (1 << 5) | 0x00000400 | 0x00000800;
+
+static constexpr std::array<uint32_t, 256> CRC32_TABLE = [] {
+    std::array<uint32_t, 256> t { };
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (unsigned k = 0; k < 8; k++)
+            c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+        t[i] = c;
+    }
+    return t;
+}();
+
+static constexpr uint32_t crc32_update(uint32_t crc, const uint8_t* data, unsigned len) {
+    for (unsigned i = 0; i < len; i++)
+        crc = CRC32_TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static constexpr uint8_t CRC32_CHECK[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+static_assert(~crc32_update(0xffffffff, CRC32_CHECK, 9) == 0xcbf43926);
+
+// DBGKEY plus C_DEBUGEN
+static const uint32_t DHCSR_RUN = 0xa05f0001;
+static const uint32_t DHCSR_S_HALT = 0x00020000;
+// DSCSR.CDS: the core is in Secure state
+static const uint32_t DSCSR_CDS = 0x00010000;
+// The target's bootrom_state_reset() flag for the calling core
+static const uint32_t TARGET_BOOTROM_STATE_RESET_CURRENT_CORE = 0x01;
+
+// One sector on its way to a target buffer. This is too big for the 
+// default 2K stack.
+static uint32_t staging[FlashLoader::SECTOR_SIZE / 4];
+// The compressed tokens of one sector
+static uint32_t tokens[FlashLoader::PACKED_SIZE / 4];
+// Flash sectors that need writing and that need erasing, one bit each
+static uint32_t dirty[FlashLoader::MAX_FLASH_SIZE / FlashLoader::SECTOR_SIZE / 32];
+static uint32_t erase[FlashLoader::MAX_FLASH_SIZE / FlashLoader::SECTOR_SIZE / 32];
+// The segments and runs of the ELF being programmed
+static ElfImage elf;
+
+static bool isSet(const uint32_t* bits, unsigned i) {
+    return (bits[i / 32] & (1u << (i % 32))) != 0;
+}
+
+static uint16_t blockBits(const uint32_t* bits, unsigned block) {
+    return bits[block / 2] >> ((block % 2) * SECTORS_PER_BLOCK);
+}
+// One sector read back from the target by verify()
+static uint32_t actual[FlashLoader::SECTOR_SIZE / 4];
+
+FlashLoader::FlashLoader(PioSWDDriver& swd)
+:   _swd(swd) {
+}
+
+uint32_t FlashLoader::hash(const uint32_t* data, unsigned words) {
+    uint32_t h = FNV_OFFSET;
+    for (unsigned i = 0; i < words; i++)
+        h = (h ^ data[i]) * FNV_PRIME;
+    return h;
+}
+
+uint32_t FlashLoader::crc32(const uint8_t* data, unsigned len, uint32_t crc) {
+    return ~crc32_update(~crc, data, len);
+}
+
+unsigned FlashLoader::unpack(const uint8_t* src, unsigned len, uint8_t* dst, unsigned dstSize) {
+    unsigned out = 0;
+    for (unsigned i = 0; i < len; ) {
+        const uint8_t c = src[i++];
+        if (c < 0x80) {
+            const unsigned n = c + 1;
+            if (out + n > dstSize || i + n > len)
+                return 0;
+            memcpy(dst + out, src + i, n);
+            i += n;
+            out += n;
+        }
+        else {
+            if (i + 2 > len)
+                return 0;
+            const unsigned dist = src[i] | (src[i + 1] << 8);
+            i += 2;
+            const unsigned n = (c & 0x7f) + 3;
+            if (dist == 0 || dist > out || out + n > dstSize)
+                return 0;
+            // Byte at a time, since the copy can overlap itself
+            for (unsigned k = 0; k < n; k++, out++)
+                dst[out] = dst[out - dist];
+        }
+    }
+    return out;
+}
+
+int FlashLoader::begin() {
+
+    memset(staging, 0, sizeof(staging));
+    memcpy(staging, loader_bin, loader_bin_len);
+    if (const int rc = _swd.writeBlockViaAP(LOADER_ADDR, staging, (loader_bin_len + 3) / 4); rc != 0)
+        return rc;
+    // All slots empty
+    memset(staging, 0, SLOT_COUNT * SLOT_SIZE);
+    if (const int rc = _swd.writeBlockViaAP(MAILBOX_ADDR, staging, SLOT_COUNT * SLOT_SIZE / 4); rc != 0)
+        return rc;
+
+    const struct {
+        char c1, c2;
+        uint32_t* func;
+    } funcs[] = {
+        { 'I', 'F', &_connectInternalFlash },
+        { 'E', 'X', &_flashExitXip },
+        { 'R', 'E', &_flashRangeErase },
+        { 'R', 'P', &_flashRangeProgram },
+        { 'F', 'C', &_flashFlushCache },
+        { 'C', 'X', &_flashEnterCmdXip }
+    };
+    const RomTable::Table* table = RomTable::get(_swd);
+    if (table == nullptr)
+        return -1;
+    for (const auto& f : funcs) {
+        if (const auto r = table->find(f.c1, f.c2); !r.has_value())
+            return -1;
+        else
+            *f.func = *r;
+    }
+    _bootromStateReset = table->find('S', 'R').value_or(0);
+    _flashResetAddressTrans = table->find('R', 'A').value_or(0);
+
+    // The ROM's flash functions can only be called from Secure state.
+    // That is where a reset leaves the core, but one halted in 
+    // Non-secure code is switched over.
+    if (_chip->secure) {
+        if (const auto r = _swd.readWordViaAP(PioSWDDriver::ARM_DSCSR); !r.has_value())
+            return -1;
+        else if (!(*r & DSCSR_CDS)) {
+            if (const int rc = _swd.writeWordViaAP(PioSWDDriver::ARM_DSCSR, *r | DSCSR_CDS); rc != 0)
+                return rc;
+        }
+    }
+
+    // The stub finds the mailbox in r4
+    PioSWDDriver::CoreRegisters regs;
+    regs.mask = (1 << (PioSWDDriver::REG_R0 + 4)) | (1 << PioSWDDriver::REG_MSP) |
+        (1 << PioSWDDriver::REG_PC) | (1 << PioSWDDriver::REG_XPSR);
+    regs.r[PioSWDDriver::REG_R0 + 4] = MAILBOX_ADDR;
+    regs.r[PioSWDDriver::REG_MSP] = STACK_TOP;
+    regs.r[PioSWDDriver::REG_PC] = LOADER_ADDR;
+    // Thumb
+    regs.r[PioSWDDriver::REG_XPSR] = 0x01000000;
+    if (const int rc = _swd.writeCoreRegisters(regs); rc != 0)
+        return rc;
+
+    _posted = 0;
+    _done = 0;
+    _bufferBusy[0] = 0;
+    _bufferBusy[1] = 0;
+    _nextBuffer = 0;
+    _unpackLen[0] = 0;
+    _unpackLen[1] = 0;
+
+    if (const int rc = _swd.writeWordViaAP(PioSWDDriver::ARM_DHCSR, DHCSR_RUN); rc != 0)
+        return rc;
+    if (_bootromStateReset != 0) {
+        if (const int rc = post(_bootromStateReset, TARGET_BOOTROM_STATE_RESET_CURRENT_CORE); rc != 0)
+            return rc;
+    }
+    if (const int rc = post(_connectInternalFlash); rc != 0)
+        return rc;
+    if (const int rc = post(_flashExitXip); rc != 0)
+        return rc;
+    // Flash offsets are then physical, whatever partition booted last
+    if (_flashResetAddressTrans != 0)
+        return post(_flashResetAddressTrans);
+    return 0;
+}
+
+template<typename F> int FlashLoader::_markRange(uint32_t flashOffset, unsigned sectors, 
+    bool skip, F stage, const uint32_t* hashes) {
+
+    if (flashOffset % SECTOR_SIZE != 0 || flashOffset + sectors * SECTOR_SIZE > MAX_FLASH_SIZE)
+        return -1;
+    if (sectors == 0)
+        return 0;
+
+    const unsigned first = flashOffset / SECTOR_SIZE;
+    memset(dirty, 0, sizeof(dirty));
+    Sector sector;
+    uint32_t list[SLOT_COUNT];
+    uint32_t results[SLOT_COUNT];
+    for (unsigned i = 0; i < sectors; i += SLOT_COUNT) {
+        const unsigned count = std::min(sectors - i, SLOT_COUNT);
+        if (skip) {
+            for (unsigned k = 0; k < count; k++)
+                list[k] = first + i + k;
+            if (const int rc = _sectorCalls(LOADER_HASH, list, count, results); rc != 0)
+                return rc;
+        }
+        for (unsigned k = 0; k < count; k++) {
+            if (skip) {
+                if (hashes == nullptr) {
+                    if (const int rc = stage(i + k, true, &sector); rc != 0)
+                        return rc;
+                }
+                const uint32_t h = hashes != nullptr ? hashes[i + k] : hash(staging, SECTOR_SIZE / 4);
+                if (h == results[k]) {
+                    _stats.sectorsSkipped++;
+                    continue;
+                }
+            }
+            const unsigned s = first + i + k;
+            dirty[s / 32] |= 1u << (s % 32);
+        }
+    }
+
+    // Everything that will be written gets erased, unless it's blank
+    memcpy(erase, dirty, sizeof(erase));
+    if (_blankCheck) {
+        unsigned count = 0;
+        for (unsigned s = first; s < first + sectors; s++) {
+            if (isSet(dirty, s))
+                list[count++] = s;
+            if (count == SLOT_COUNT || (count > 0 && s == first + sectors - 1)) {
+                if (const int rc = _sectorCalls(LOADER_BLANK, list, count, results); rc != 0)
+                    return rc;
+                for (unsigned k = 0; k < count; k++) {
+                    if (results[k] == 0xffffffff) {
+                        erase[list[k] / 32] &= ~(1u << (list[k] % 32));
+                        _stats.sectorsBlank++;
+                    }
+                }
+                count = 0;
+            }
+        }
+    }
+
+    _firstBlock = first / SECTORS_PER_BLOCK;
+    _lastBlock = (first + sectors - 1) / SECTORS_PER_BLOCK;
+    for (unsigned b = _firstBlock; b <= _lastBlock; b++)
+        _stats.eraseMsSaved += _planErase(blockBits(dirty, b)).ms - 
+            _planErase(blockBits(erase, b)).ms;
+
+    _erasedThrough = _firstBlock;
+    return _eraseBlock(_firstBlock * BLOCK_SIZE, blockBits(erase, _firstBlock));
+}
+
+int FlashLoader::_writeRangeSector(unsigned s, const Sector& sector) {
+    // The next block is erased while this block's data streams in
+    const unsigned next = std::min(s / SECTORS_PER_BLOCK + 1, _lastBlock);
+    while (_erasedThrough < next) {
+        _erasedThrough++;
+        if (const int rc = _eraseBlock(_erasedThrough * BLOCK_SIZE, 
+            blockBits(erase, _erasedThrough)); rc != 0)
+            return rc;
+    }
+    return _writeSector(s * SECTOR_SIZE, sector);
+}
+
+template<typename F> int FlashLoader::_programRange(uint32_t flashOffset, unsigned sectors, 
+    F stage, const uint32_t* hashes) {
+
+    if (const int rc = _markRange(flashOffset, sectors, _skipUnchanged, stage, hashes); rc != 0)
+        return rc;
+
+    const unsigned first = flashOffset / SECTOR_SIZE;
+    Sector sector;
+    for (unsigned s = first; s < first + sectors; s++) {
+        if (!isSet(dirty, s))
+            continue;
+        if (const int rc = stage(s - first, false, &sector); rc != 0)
+            return rc;
+        if (const int rc = _writeRangeSector(s, sector); rc != 0)
+            return rc;
+    }
+    return 0;
+}
+
+int FlashLoader::beginImage(uint32_t flashOffset, unsigned len) {
+    const unsigned sectors = (len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    // Without the data up front there is nothing to compare with
+    const auto noData = [](unsigned, bool, Sector*) { return -1; };
+    if (const int rc = _markRange(flashOffset, sectors, false, noData); rc != 0)
+        return rc;
+    _imageSector = flashOffset / SECTOR_SIZE;
+    _imageFill = 0;
+    _imageRemaining = len;
+    memset(staging, 0xff, SECTOR_SIZE);
+    return 0;
+}
+
+int FlashLoader::writeImage(const uint8_t* data, unsigned len) {
+    if (len > _imageRemaining)
+        return -1;
+    while (len > 0) {
+        const unsigned n = std::min(len, SECTOR_SIZE - _imageFill);
+        memcpy((uint8_t*)staging + _imageFill, data, n);
+        _imageFill += n;
+        _imageRemaining -= n;
+        data += n;
+        len -= n;
+        if (_imageFill == SECTOR_SIZE) {
+            if (const int rc = _flushImageSector(); rc != 0)
+                return rc;
+        }
+    }
+    return 0;
+}
+
+int FlashLoader::endImage() {
+    if (_imageRemaining != 0)
+        return -1;
+    if (_imageFill == 0)
+        return 0;
+    return _flushImageSector();
+}
+
+int FlashLoader::_flushImageSector() {
+    Sector sector;
+    sector.words = staging;
+    // flash_range_program() works in whole pages
+    sector.len = (_imageFill + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    sector.wordCount = sector.len / 4;
+    sector.packedLen = 0;
+    sector.offset = 0;
+    if (const int rc = _writeRangeSector(_imageSector, sector); rc != 0)
+        return rc;
+    _imageSector++;
+    _imageFill = 0;
+    memset(staging, 0xff, SECTOR_SIZE);
+    return 0;
+}
+
+int FlashLoader::program(uint32_t flashOffset, const uint8_t* data, unsigned len, 
+    const uint32_t* sectorHashes) {
+    const unsigned sectors = (len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    return _programRange(flashOffset, sectors, [&](unsigned i, bool raw, Sector* sector) {
+        const unsigned pos = i * SECTOR_SIZE;
+        const unsigned n = std::min(len - pos, (unsigned)SECTOR_SIZE);
+        // A whole, aligned sector (e.g. from ImageStore) goes straight 
+        // from where it is, without a copy
+        if (!raw && n == SECTOR_SIZE && (uintptr_t)(data + pos) % 4 == 0) {
+            sector->words = (const uint32_t*)(data + pos);
+        }
+        else {
+            // After the erase, the rest of the sector reads back as 0xff 
+            memset(staging, 0xff, SECTOR_SIZE);
+            memcpy(staging, data + pos, n);
+            sector->words = staging;
+        }
+        // flash_range_program() works in whole pages
+        sector->len = (n + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        sector->wordCount = sector->len / 4;
+        sector->packedLen = 0;
+        sector->offset = 0;
+        return 0;
+    }, sectorHashes);
+}
+
+int FlashLoader::programPacked(uint32_t flashOffset, const uint8_t* packed, unsigned packedLen) {
+
+    const auto tokenLenAt = [packed](unsigned pos) { 
+        return (unsigned)(packed[pos] | (packed[pos + 1] << 8)); 
+    };
+    const auto lenAt = [packed](unsigned pos) { 
+        return (unsigned)(packed[pos + 2] | (packed[pos + 3] << 8)); 
+    };
+
+    // Check the framing before anything is erased
+    unsigned sectors = 0;
+    unsigned pos = 0;
+    while (pos + PACKED_HEADER <= packedLen) {
+        const unsigned tokenLen = tokenLenAt(pos);
+        const unsigned len = lenAt(pos);
+        if (tokenLen == 0 || tokenLen > PACKED_SIZE || len == 0 || len > SECTOR_SIZE || 
+            len % PAGE_SIZE != 0)
+            return -1;
+        pos += PACKED_HEADER + ((tokenLen + 3) & ~3);
+        sectors++;
+    }
+    if (pos != packedLen)
+        return -1;
+
+    // Sectors are asked for in order, apart from going back to the start 
+    // after the skip-unchanged check
+    unsigned cursor = 0;
+    pos = 0;
+    return _programRange(flashOffset, sectors, [&](unsigned i, bool raw, Sector* sector) {
+        if (i < cursor) {
+            cursor = 0;
+            pos = 0;
+        }
+        for (; cursor < i; cursor++)
+            pos += PACKED_HEADER + ((tokenLenAt(pos) + 3) & ~3);
+        const unsigned tokenLen = tokenLenAt(pos);
+        const unsigned len = lenAt(pos);
+        const uint8_t* src = packed + pos + PACKED_HEADER;
+        if (raw) {
+            memset(staging, 0xff, SECTOR_SIZE);
+            return unpack(src, tokenLen, (uint8_t*)staging, SECTOR_SIZE) == len ? 0 : -1;
+        }
+        memcpy(tokens, src, tokenLen);
+        sector->words = tokens;
+        sector->wordCount = (tokenLen + 3) / 4;
+        sector->packedLen = tokenLen;
+        sector->offset = 0;
+        sector->len = len;
+        return 0;
+    });
+}
+
+int FlashLoader::programElf(const uint8_t* data, unsigned len) {
+
+    if (const int rc = elf.parse(data, len, FLASH_XIP_BASE, MAX_FLASH_SIZE); rc != 0)
+        return rc;
+
+    // Runs that share or abut a sector are programmed as one range, 
+    // since each sector can only be erased once
+    for (unsigned i = 0; i < elf.getRunCount(); ) {
+        const unsigned first = elf.getRun(i).offset / SECTOR_SIZE;
+        unsigned last = first;
+        unsigned j = i;
+        for (; j < elf.getRunCount() && elf.getRun(j).offset / SECTOR_SIZE <= last + 1; j++) {
+            const ElfImage::Run& run = elf.getRun(j);
+            last = (run.offset + run.len - 1) / SECTOR_SIZE;
+        }
+        const unsigned firstRun = i;
+        const unsigned endRun = j;
+        i = j;
+
+        const int rc = _programRange(first * SECTOR_SIZE, last - first + 1, 
+            [&](unsigned k, bool raw, Sector* sector) {
+            const uint32_t sectorOffset = (first + k) * SECTOR_SIZE;
+            if (raw) {
+                elf.read(sectorOffset, (uint8_t*)staging, SECTOR_SIZE);
+                return 0;
+            }
+            // Only the pages from the first to the last one with data, 
+            // and none of the gaps between runs
+            uint32_t start = SECTOR_SIZE, end = 0;
+            uint16_t pages = 0;
+            for (unsigned r = firstRun; r < endRun; r++) {
+                const ElfImage::Run& run = elf.getRun(r);
+                const uint32_t s = std::max(run.offset, sectorOffset);
+                const uint32_t e = std::min(run.offset + run.len, sectorOffset + SECTOR_SIZE);
+                if (s < e) {
+                    start = std::min(start, s - sectorOffset);
+                    end = std::max(end, e - sectorOffset);
+                    for (uint32_t p = s - sectorOffset; p < e - sectorOffset; p += PAGE_SIZE)
+                        pages |= 1 << (p / PAGE_SIZE);
+                }
+            }
+            if (start >= end)
+                return -1;
+            elf.read(sectorOffset + start, (uint8_t*)staging, end - start);
+            sector->words = staging;
+            sector->wordCount = (end - start) / 4;
+            sector->packedLen = 0;
+            sector->offset = start;
+            sector->len = end - start;
+            sector->skipPages = ~pages;
+            return 0;
+        });
+        if (rc != 0)
+            return rc;
+    }
+    return 0;
+}
+
+int FlashLoader::programPages(uint32_t flashOffset, const uint32_t* words, unsigned len, 
+    bool erase) {
+
+    const uint32_t sectorOffset = flashOffset & ~(SECTOR_SIZE - 1);
+    if (flashOffset % PAGE_SIZE != 0 || len == 0 || len % PAGE_SIZE != 0 || 
+        flashOffset - sectorOffset + len > SECTOR_SIZE || sectorOffset >= MAX_FLASH_SIZE)
+        return -1;
+
+    if (erase) {
+        const unsigned s = sectorOffset / SECTOR_SIZE;
+        if (const int rc = _eraseBlock(sectorOffset & ~(BLOCK_SIZE - 1), 
+            1 << (s % SECTORS_PER_BLOCK)); rc != 0)
+            return rc;
+    }
+
+    Sector sector;
+    sector.words = words;
+    sector.wordCount = len / 4;
+    sector.packedLen = 0;
+    sector.offset = flashOffset - sectorOffset;
+    sector.len = len;
+    return _writeSector(sectorOffset, sector);
+}
+
+FlashLoader::ErasePlan FlashLoader::_planErase(uint16_t mask) const {
+
+    ErasePlan plan = { };
+
+    // The cheapest way to do each 32K half on its own
+    unsigned halfMs[2];
+    for (unsigned h = 0; h < 2; h++) {
+        const uint8_t m = mask >> (h * 8);
+        const unsigned sectorsMs = __builtin_popcount(m) * SECTOR_ERASE_MS;
+        plan.halfWhole[h] = m == 0xff && BLOCK32_ERASE_MS < sectorsMs;
+        halfMs[h] = plan.halfWhole[h] ? BLOCK32_ERASE_MS : sectorsMs;
+    }
+
+    plan.whole = mask == 0xffff && BLOCK64_ERASE_MS <= halfMs[0] + halfMs[1];
+    plan.ms = plan.whole ? BLOCK64_ERASE_MS : halfMs[0] + halfMs[1];
+    return plan;
+}
+
+int FlashLoader::_eraseBlock(uint32_t blockOffset, uint16_t mask) {
+
+    if (mask == 0)
+        return 0;
+
+    const ErasePlan plan = _planErase(mask);
+    _stats.eraseMs += plan.ms;
+
+    if (plan.whole) {
+        _stats.block64Erases++;
+        return post(_flashRangeErase, blockOffset, BLOCK_SIZE, BLOCK_SIZE, BLOCK_ERASE_CMD);
+    }
+
+    for (unsigned h = 0; h < 2; h++) {
+        const uint32_t halfOffset = blockOffset + h * BLOCK32_SIZE;
+        if (plan.halfWhole[h]) {
+            _stats.block32Erases++;
+            if (const int rc = post(_flashRangeErase, halfOffset, BLOCK32_SIZE, BLOCK32_SIZE, 
+                BLOCK32_ERASE_CMD); rc != 0)
+                return rc;
+            continue;
+        }
+        // Each run of sectors is one call, made of sector erases
+        const uint8_t m = mask >> (h * 8);
+        for (unsigned i = 0; i < 8; ) {
+            if (!(m & (1 << i))) {
+                i++;
+                continue;
+            }
+            unsigned run = 0;
+            while (i + run < 8 && (m & (1 << (i + run))))
+                run++;
+            _stats.sectorErases += run;
+            if (const int rc = post(_flashRangeErase, halfOffset + i * SECTOR_SIZE, 
+                run * SECTOR_SIZE, BLOCK_SIZE, BLOCK_ERASE_CMD); rc != 0)
+                return rc;
+            i += run;
+        }
+    }
+    return 0;
+}
+
+int FlashLoader::_writeSector(uint32_t flashOffset, const Sector& sector) {
+
+    const unsigned b = _nextBuffer;
+    _nextBuffer ^= 1;
+    // The target may still be programming from this buffer
+    if (const int rc = _waitDone(_bufferBusy[b]); rc != 0)
+        return rc;
+
+    if (sector.packedLen != 0) {
+        if (const int rc = _swd.writeBlockViaAP(PACKED_ADDR[b], sector.words, sector.wordCount); rc != 0)
+            return rc;
+        if (const int rc = post(LOADER_UNPACK, PACKED_ADDR[b], BUFFER_ADDR[b], sector.packedLen); rc != 0)
+            return rc;
+        _unpackCall[b] = _posted - 1;
+        _unpackLen[b] = sector.len;
+        _stats.bytesSent += sector.wordCount * 4;
+    }
+
+    // Each run of pages between the skipped ones goes to the same place
+    // in the buffer and is programmed with its own call
+    const unsigned firstPage = sector.offset / PAGE_SIZE;
+    const unsigned endPage = (sector.offset + sector.len) / PAGE_SIZE;
+    for (unsigned p = firstPage; p < endPage; ) {
+        if (sector.skipPages & (1 << p)) {
+            p++;
+            continue;
+        }
+        unsigned q = p + 1;
+        while (q < endPage && !(sector.skipPages & (1 << q)))
+            q++;
+        const uint32_t start = (p - firstPage) * PAGE_SIZE;
+        const uint32_t len = (q - p) * PAGE_SIZE;
+        if (sector.packedLen == 0) {
+            if (const int rc = _swd.writeBlockViaAP(BUFFER_ADDR[b] + start, sector.words + start / 4, 
+                len / 4); rc != 0)
+                return rc;
+            _stats.bytesSent += len;
+        }
+        if (const int rc = post(_flashRangeProgram, flashOffset + sector.offset + start, 
+            BUFFER_ADDR[b] + start, len); rc != 0)
+            return rc;
+        _stats.bytesProgrammed += len;
+        p = q;
+    }
+    _bufferBusy[b] = _posted;
+
+    _stats.sectorsWritten++;
+    return 0;
+}
+
+int FlashLoader::end() {
+
+    if (const int rc = post(_flashFlushCache); rc != 0)
+        return rc;
+    if (const int rc = post(_flashEnterCmdXip); rc != 0)
+        return rc;
+    if (const int rc = post(STOP_CALL); rc != 0)
+        return rc;
+    if (const int rc = waitIdle(); rc != 0)
+        return rc;
+
+    // The stub clears the stop request just before the BKPT
+    const uint32_t start = time_us_32();
+    while (true) {
+        if (const auto r = _swd.readWordViaAP(PioSWDDriver::ARM_DHCSR); !r.has_value())
+            return -1;
+        else if (*r & DHCSR_S_HALT)
+            return 0;
+        if (time_us_32() - start > CALL_TIMEOUT_US)
+            return PioSWDDriver::ERR_TIMEOUT;
+    }
+}
+
+int FlashLoader::post(uint32_t func, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3) {
+
+    // The slot is free once the call that last used it has completed
+    if (_posted >= SLOT_COUNT) {
+        if (const int rc = _waitDone(_posted - SLOT_COUNT + 1); rc != 0)
+            return rc;
+    }
+
+    const uint32_t slot = _slotAddr(_posted);
+    const uint32_t args[4] = { r0, r1, r2, r3 };
+    if (const int rc = _swd.writeBlockViaAP(slot + SLOT_ARGS, args, 4); rc != 0)
+        return rc;
+    // The function address goes last since it hands the slot to the stub
+    if (const int rc = _swd.writeWordViaAP(slot, func); rc != 0)
+        return rc;
+    _posted++;
+    return 0;
+}
+
+int FlashLoader::waitIdle() {
+    return _waitDone(_posted);
+}
+
+int FlashLoader::_sectorCalls(uint32_t func, const uint32_t* sectors, unsigned count, 
+    uint32_t* results) {
+
+    // Anything programmed earlier may still be sitting in the XIP cache
+    if (const int rc = post(_flashFlushCache); rc != 0)
+        return rc;
+    if (const int rc = post(_flashEnterCmdXip); rc != 0)
+        return rc;
+    for (unsigned i = 0; i < count; i++) {
+        if (const int rc = post(func, FLASH_XIP_BASE + sectors[i] * SECTOR_SIZE, SECTOR_SIZE / 4); rc != 0)
+            return rc;
+    }
+    if (const int rc = waitIdle(); rc != 0)
+        return rc;
+
+    // These calls were the last ones posted, so their slots still hold 
+    // the results
+    for (unsigned i = 0; i < count; i++)
+        _swd.queueReadWordViaAP(_slotAddr(_posted - count + i) + SLOT_RESULT, &results[i]);
+    if (const int rc = _swd.flush(); rc != 0)
+        return rc;
+
+    return post(_flashExitXip);
+}
+
+int FlashLoader::verify(uint32_t flashOffset, const uint8_t* data, unsigned len) {
+    // The flash holds 0xff after the data up to the end of the page
+    const uint8_t pad[3] = { 0xff, 0xff, 0xff };
+    const uint32_t expected = crc32(pad, (4 - len % 4) % 4, crc32(data, len));
+    return _verify(flashOffset, len, expected, data);
+}
+
+int FlashLoader::verifyCrc(uint32_t flashOffset, unsigned len, uint32_t expected) {
+    return _verify(flashOffset, len, expected, nullptr);
+}
+
+int FlashLoader::verifyHashes(uint32_t flashOffset, const uint32_t* sectorHashes, 
+    unsigned sectors) {
+
+    if (flashOffset % SECTOR_SIZE != 0)
+        return -1;
+    const unsigned first = flashOffset / SECTOR_SIZE;
+    bool bad = false;
+    uint32_t list[SLOT_COUNT];
+    uint32_t results[SLOT_COUNT];
+    for (unsigned i = 0; i < sectors; i += SLOT_COUNT) {
+        const unsigned count = std::min(sectors - i, SLOT_COUNT);
+        for (unsigned k = 0; k < count; k++)
+            list[k] = first + i + k;
+        if (const int rc = _sectorCalls(LOADER_HASH, list, count, results); rc != 0)
+            return rc;
+        for (unsigned k = 0; k < count; k++) {
+            if (results[k] != sectorHashes[i + k]) {
+                if (!bad)
+                    _stats.firstBadOffset = (first + i + k) * SECTOR_SIZE;
+                _stats.sectorsBad++;
+                bad = true;
+            }
+        }
+    }
+    return bad ? ERR_VERIFY : 0;
+}
+
+int FlashLoader::_verify(uint32_t flashOffset, unsigned len, uint32_t expected, 
+    const uint8_t* data) {
+
+    const unsigned words = (len + 3) / 4;
+    if (const int rc = post(_flashEnterCmdXip); rc != 0)
+        return rc;
+    if (const int rc = waitIdle(); rc != 0)
+        return rc;
+
+    int rc = 0;
+    if (const auto crc = _sniffCrc(flashOffset, words); !crc.has_value())
+        rc = -1;
+    else if (*crc != expected)
+        rc = data != nullptr ? _readback(flashOffset, data, len) : ERR_VERIFY;
+
+    if (const int exitRc = post(_flashExitXip); rc == 0)
+        rc = exitRc;
+    return rc;
+}
+
+std::optional<uint32_t> FlashLoader::_sniffCrc(uint32_t flashOffset, unsigned words) {
+
+    // DMA may still be held in reset if the boot ROM hasn't run
+    if (_swd.writeWordViaAP(_chip->resetsBase + TARGET_RESETS_CLR_ALIAS, _chip->resetsDma) != 0)
+        return std::nullopt;
+    bool ready = false;
+    for (unsigned i = 0; i < 100 && !ready; i++) {
+        if (const auto r = _swd.readWordViaAP(_chip->resetsBase + TARGET_RESETS_RESET_DONE); !r.has_value())
+            return std::nullopt;
+        else
+            ready = (*r & _chip->resetsDma) != 0;
+    }
+    if (!ready)
+        return std::nullopt;
+
+    const uint32_t ch = TARGET_DMA_BASE + VERIFY_DMA_CHANNEL * TARGET_DMA_CH_STRIDE;
+    const uint32_t sniffData = _chip->dmaSniffCtrl + 4;
+    const uint32_t ctrl = TARGET_DMA_CTRL | (VERIFY_DMA_CHANNEL << _chip->dmaChainToShift) |
+        (TARGET_DMA_TREQ_UNPACED << _chip->dmaTreqShift) | _chip->dmaSniffEn;
+    _swd.queueWriteWordViaAP(sniffData, 0xffffffff);
+    _swd.queueWriteWordViaAP(_chip->dmaSniffCtrl, TARGET_SNIFF_CTRL);
+    _swd.queueWriteWordViaAP(ch + TARGET_DMA_READ_ADDR, _chip->xipNoCacheBase + flashOffset);
+    _swd.queueWriteWordViaAP(ch + TARGET_DMA_WRITE_ADDR, SCRATCH_ADDR);
+    _swd.queueWriteWordViaAP(ch + TARGET_DMA_TRANS_COUNT, words);
+    _swd.queueWriteWordViaAP(ch + TARGET_DMA_CTRL_TRIG, ctrl);
+    if (_swd.flush() != 0)
+        return std::nullopt;
+
+    const uint32_t start = time_us_32();
+    while (true) {
+        if (const auto r = _swd.readWordViaAP(ch + TARGET_DMA_CTRL_TRIG); !r.has_value())
+            return std::nullopt;
+        else if (!(*r & _chip->dmaBusy))
+            break;
+        if (time_us_32() - start > CALL_TIMEOUT_US)
+            return std::nullopt;
+    }
+    return _swd.readWordViaAP(sniffData);
+}
+
+int FlashLoader::_readback(uint32_t flashOffset, const uint8_t* data, unsigned len) {
+
+    bool bad = false;
+    for (unsigned pos = 0; pos < len; pos += SECTOR_SIZE) {
+        const unsigned n = std::min(len - pos, (unsigned)SECTOR_SIZE);
+        const unsigned words = (n + 3) / 4;
+        memset(staging, 0xff, words * 4);
+        memcpy(staging, data + pos, n);
+        if (const int readRc = _swd.readBlockViaAP(_chip->xipNoCacheBase + flashOffset + pos, 
+            actual, words); readRc != 0)
+            return readRc;
+        if (memcmp(staging, actual, words * 4) != 0) {
+            if (!bad)
+                _stats.firstBadOffset = flashOffset + pos;
+            _stats.sectorsBad++;
+            bad = true;
+        }
+    }
+    // The readback has the final say
+    return bad ? ERR_VERIFY : 0;
+}
+
+int FlashLoader::_waitDone(uint32_t count) {
+
+    if (count <= _done)
+        return 0;
+
+    const uint32_t slot = _slotAddr(count - 1);
+    const uint32_t start = time_us_32();
+    while (true) {
+        if (const auto r = _swd.readWordViaAP(slot); !r.has_value())
+            return -1;
+        else if (*r == 0) {
+            _done = count;
+            return _checkUnpacked();
+        }
+        if (time_us_32() - start > CALL_TIMEOUT_US)
+            return PioSWDDriver::ERR_TIMEOUT;
+    }
+}
+
+int FlashLoader::_checkUnpacked() {
+    for (unsigned b = 0; b < 2; b++) {
+        if (_unpackLen[b] == 0 || _unpackCall[b] >= _done)
+            continue;
+        const unsigned expected = _unpackLen[b];
+        _unpackLen[b] = 0;
+        // The program behind it has gone ahead regardless, so the sector
+        // is wrong too, but this stops the run
+        if (const auto r = _swd.readWordViaAP(_slotAddr(_unpackCall[b]) + SLOT_RESULT); !r.has_value())
+            return -1;
+        else if (*r != expected)
+            return ERR_UNPACK;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,412 @@
+/**
+ * Programs the flash of an RP2040 or RP2350 through a small stub 
+ * (loader.s) that runs in target RAM.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "PioSWDDriver.h"
+#include "Chip.h"
+
+namespace kc1fsz {
+
+/**
+ * The stub works through a ring of call slots in target RAM (see
+ * loader.s) with the core running. Image data goes through two sector
+ * sized RAM buffers: while the target erases and programs from one
+ * buffer the next sector is being written into the other one over SWD,
+ * so the SWD transfer time overlaps the flash program/erase time.
+ */
+class FlashLoader {
+public:
+
+    static constexpr uint32_t PAGE_SIZE = 256;
+    static constexpr uint32_t SECTOR_SIZE = 4096;
+    static constexpr uint32_t BLOCK32_SIZE = 32768;
+    static constexpr uint32_t BLOCK_SIZE = 65536;
+    // The largest flash that program() will plan for
+    static constexpr uint32_t MAX_FLASH_SIZE = 16 * 1024 * 1024;
+    // Where the target sees its flash. Not XIP_BASE, which is the SDK's
+    // macro for our own.
+    static constexpr uint32_t FLASH_XIP_BASE = 0x10000000;
+
+    // ----- Target RAM layout (main SRAM, free after a reset) -----
+    // The same on both chips.
+    static constexpr uint32_t LOADER_ADDR = 0x20000000;
+    static constexpr uint32_t MAILBOX_ADDR = 0x20000100;
+    static constexpr uint32_t BUFFER_ADDR[2] = { 0x20001000, 0x20002000 };
+    static constexpr uint32_t STACK_TOP = 0x20004000;
+    // Compressed sectors waiting to be unpacked into BUFFER_ADDR
+    static constexpr uint32_t PACKED_ADDR[2] = { 0x20004000, 0x20005100 };
+    // Room for a sector that doesn't compress at all
+    static constexpr uint32_t PACKED_SIZE = 0x1100;
+    // Where the verify DMA channel dumps what it reads
+    static constexpr uint32_t SCRATCH_ADDR = 0x20000200;
+
+    // The DMA channel used by verify()
+    static constexpr unsigned VERIFY_DMA_CHANNEL = 0;
+
+    // Mailbox geometry, matching loader.s
+    static constexpr unsigned SLOT_COUNT = 8;
+    static constexpr uint32_t SLOT_SIZE = 32;
+
+    // Longest wait for a single call (a 64K block erase can take ~1s)
+    static constexpr uint32_t CALL_TIMEOUT_US = 3000000;
+
+    // Returned by verify() when the flash doesn't match
+    static constexpr int ERR_VERIFY = 6;
+    // The stub unpacked a sector to a different length than its header 
+    // gave
+    static constexpr int ERR_UNPACK = 7;
+
+    struct Stats {
+        uint32_t sectorsWritten = 0;
+        // Sectors that already held the right data
+        uint32_t sectorsSkipped = 0;
+        // Sectors found to be wrong by the verify readback 
+        uint32_t sectorsBad = 0;
+        // Flash offset of the first bad sector
+        uint32_t firstBadOffset = 0;
+        // Bytes written into flash and bytes of image data sent over SWD
+        // to do it (less than written for a packed image)
+        uint32_t bytesProgrammed = 0;
+        uint32_t bytesSent = 0;
+        // Erase commands issued, by size
+        uint32_t sectorErases = 0;
+        uint32_t block32Erases = 0;
+        uint32_t block64Erases = 0;
+        // Total erase time going by the datasheet's typical figures
+        uint32_t eraseMs = 0;
+        // Sectors written without an erase because they were blank
+        uint32_t sectorsBlank = 0;
+        // Erase time that the blank check saved, by the same figures
+        uint32_t eraseMsSaved = 0;
+    };
+
+    FlashLoader(PioSWDDriver& swd);
+
+    /**
+     * The same hash that the hash entry point in loader.s computes on the target
+     * (FNV-1a, one word at a time).
+     */
+    static uint32_t hash(const uint32_t* data, unsigned words);
+
+    /**
+     * The standard (zlib) CRC-32. This is what verify() sets the DMA 
+     * sniffer up to compute.
+     */
+    static uint32_t crc32(const uint8_t* data, unsigned len, uint32_t crc = 0);
+
+    /**
+     * Expands the tokens of one packed sector (see pack-image.py), the 
+     * same way as the unpack entry point in loader.s.
+     *
+     * @returns The number of bytes written, or 0 if the tokens would 
+     *   run past the end of dst.
+     */
+    static unsigned unpack(const uint8_t* src, unsigned len, uint8_t* dst, unsigned dstSize);
+
+    /**
+     * Loads the stub, looks up the boot ROM flash functions (through 
+     * RomTable), starts the
+     * core in the stub and takes the flash out of XIP mode. The core must
+     * be halted, ideally straight out of reset.
+     *
+     * On an RP2350 the core is switched to Secure state first if it 
+     * isn't there already, and the boot ROM state and flash address 
+     * translation that a previous boot may have left behind are reset.
+     *
+     * @returns 0 on success.
+     */
+    int begin();
+
+    /**
+     * The chip on the other end (see Chip::connect()), which has to be
+     * set before begin(). The default is the RP2040.
+     */
+    void setChip(const Chip& chip) { _chip = &chip; }
+
+    /**
+     * Erases the sectors covering the range and programs the data, one
+     * sector at a time through the double buffer. Returns as soon as the
+     * last sector has been handed to the target.
+     *
+     * Erases are planned a 64K block at a time, using whichever mix of
+     * 64K, 32K and 4K erases is quickest by the flash's typical erase 
+     * times, without touching sectors outside of the range. 
+     * The next block's erases are posted ahead of the current block's
+     * data, so the target is erasing while the data is on its way.
+     *
+     * @param flashOffset Sector-aligned offset from the start of flash.
+     * @param sectorHashes Optional hash() of each sector of the data 
+     *   (padded with 0xff), made ahead of time (see image-header.py), 
+     *   which saves hashing the data here for the skip-unchanged check.
+     * @returns 0 on success.
+     */
+    int program(uint32_t flashOffset, const uint8_t* data, unsigned len, 
+        const uint32_t* sectorHashes = nullptr);
+
+    /**
+     * The same as program(), but for an image compressed by 
+     * pack-image.py. Only the compressed tokens go over SWD. The stub 
+     * unpacks each sector into a page buffer before it is programmed.
+     * The length the stub reports for each sector is checked once the
+     * call has completed.
+     *
+     * @returns 0 on success, -1 if the packed image is malformed, 
+     *   ERR_UNPACK if the stub didn't unpack a sector to its length.
+     */
+    int programPacked(uint32_t flashOffset, const uint8_t* packed, unsigned packedLen);
+
+    /**
+     * The same as program(), but straight from an ELF file (see 
+     * ElfImage), read in place. Only the pages that the load segments 
+     * cover are sent and programmed, and sectors that none of them 
+     * touch are left alone.
+     *
+     * @returns 0 on success, -1 if the ELF can't be used.
+     */
+    int programElf(const uint8_t* elf, unsigned len);
+
+    /**
+     * Programs pages within one sector, for callers that do their own
+     * buffering (see Uf2Decoder). The sector is 4K erased first if asked;
+     * otherwise the pages must still be blank.
+     *
+     * @param flashOffset Page-aligned offset from the start of flash.
+     * @param len A whole number of pages, not past the end of the sector.
+     * @returns 0 on success.
+     */
+    int programPages(uint32_t flashOffset, const uint32_t* words, unsigned len, bool erase);
+
+    /**
+     * Programs an image that arrives a piece at a time, e.g. over USB,
+     * without holding more than one sector of it. beginImage() plans the
+     * erases for the whole range (with the blank check if enabled, but 
+     * never skipping unchanged sectors since the data isn't known yet),
+     * writeImage() takes the data in order in pieces of any size and 
+     * endImage() sends the last partial sector.
+     *
+     * @returns 0 on success.
+     */
+    int beginImage(uint32_t flashOffset, unsigned len);
+    int writeImage(const uint8_t* data, unsigned len);
+    int endImage();
+
+    /**
+     * When enabled, program() and programPacked() first has the target hash the sectors it
+     * is about to write and only erases and programs the ones whose hash
+     * differs from that of the new data. 
+     */
+    void setSkipUnchanged(bool on) { _skipUnchanged = on; }
+
+    /**
+     * When enabled, the target checks each sector that is about to be 
+     * written for all 0xff (with the blank entry point in loader.s, 
+     * through XIP) and sectors that are already blank are not erased.
+     */
+    void setBlankCheck(bool on) { _blankCheck = on; }
+
+    /**
+     * Checks that the flash holds the data. The target's DMA sniffer
+     * computes a CRC-32 of the range through XIP at bus speed and only 
+     * that one word comes back over SWD. If it doesn't match the CRC of
+     * the data, the range is read back a sector at a time to find the 
+     * bad sectors (see getStats()).
+     *
+     * Must be called between begin() and end(). Waits for any 
+     * outstanding programming to finish first. Uses VERIFY_DMA_CHANNEL.
+     *
+     * @returns 0 if the flash matches, ERR_VERIFY if it doesn't.
+     */
+    int verify(uint32_t flashOffset, const uint8_t* data, unsigned len);
+
+    /**
+     * The same as verify() but against a CRC-32 worked out elsewhere, of
+     * the data padded with 0xff to a whole number of words. There is no
+     * readback on a mismatch.
+     */
+    int verifyCrc(uint32_t flashOffset, unsigned len, uint32_t expected);
+
+    /**
+     * Checks the flash a sector at a time against hash() values made 
+     * ahead of time (see image-header.py). The target hashes each sector
+     * and only the hashes come back, so this finds the bad sectors (see 
+     * getStats()) without the data or a readback.
+     *
+     * @returns 0 if the flash matches, ERR_VERIFY if it doesn't.
+     */
+    int verifyHashes(uint32_t flashOffset, const uint32_t* sectorHashes, unsigned sectors);
+
+    const Stats& getStats() const { return _stats; }
+    void resetStats() { _stats = Stats(); }
+
+    /**
+     * Waits for the outstanding work, flushes the XIP cache, puts the
+     * flash back into XIP mode and stops the stub. The core is left
+     * halted on the stub's BKPT.
+     *
+     * @returns 0 on success.
+     */
+    int end();
+
+    /**
+     * Posts a call to the stub without waiting for it to run. Blocks only
+     * if all of the slots are still in use.
+     *
+     * @returns 0 on success.
+     */
+    int post(uint32_t func, uint32_t r0 = 0, uint32_t r1 = 0, uint32_t r2 = 0, uint32_t r3 = 0);
+
+    /**
+     * Waits until every posted call has completed.
+     */
+    int waitIdle();
+
+private:
+
+    /**
+     * Waits until the first count calls have completed. The stub works
+     * in order, so this only needs to watch the slot of the last one.
+     */
+    int _waitDone(uint32_t count);
+    /**
+     * Checks the result of any unpack call that has completed since the
+     * last look. This has to happen before its slot is used again, which
+     * can't be without a _waitDone() first.
+     */
+    int _checkUnpacked();
+    /**
+     * Runs a loader.s function (hash or blank) over each of up to 
+     * SLOT_COUNT whole sectors and collects the results. Flash is 
+     * switched into XIP mode for the reads and back out again afterwards.
+     *
+     * @param sectors Sector numbers, counting from the start of flash.
+     */
+    int _sectorCalls(uint32_t func, const uint32_t* sectors, unsigned count, uint32_t* results);
+    /**
+     * One sector, ready to send to a target buffer.
+     */
+    struct Sector {
+        const uint32_t* words;
+        unsigned wordCount;
+        // Zero if the words are the page data itself, otherwise the 
+        // length of the compressed tokens they hold
+        unsigned packedLen;
+        // Where the pages start within the sector
+        unsigned offset;
+        // Bytes to program, a whole number of pages
+        unsigned len;
+        // Pages of the sector (bit n for page n) that hold nothing but
+        // padding, which are neither sent nor programmed
+        uint16_t skipPages = 0;
+    };
+
+    /**
+     * The common part of program() and programPacked(): works out which
+     * sectors need writing, then plans the erases and streams the data.
+     *
+     * @param stage Called as stage(i, raw, &sector). Fills the staging
+     *   buffer with the whole of sector i as it should read back after 
+     *   erase and program (raw = true, for the skip-unchanged check) or 
+     *   fills in sector for _writeSector() (raw = false).
+     */
+    template<typename F> int _programRange(uint32_t flashOffset, unsigned sectors, F stage,
+        const uint32_t* hashes = nullptr);
+    /**
+     * The first part of _programRange(): marks the sectors to write and
+     * to erase and posts the erases for the first block. The skip check
+     * uses the hashes if given, otherwise it stages each sector and 
+     * hashes it.
+     */
+    template<typename F> int _markRange(uint32_t flashOffset, unsigned sectors, bool skip, 
+        F stage, const uint32_t* hashes = nullptr);
+    /**
+     * Writes sector s of the range marked by _markRange(), first posting
+     * the erases for the block after it if that hasn't been done yet.
+     */
+    int _writeRangeSector(unsigned s, const Sector& sector);
+    int _flushImageSector();
+    /**
+     * The quickest set of erases that covers the marked sectors of one
+     * 64K block and nothing else.
+     */
+    struct ErasePlan {
+        bool whole;
+        // 32K halves that take a single erase
+        bool halfWhole[2];
+        unsigned ms;
+    };
+
+    /**
+     * @param mask Bit n set to erase sector n of the block.
+     */
+    ErasePlan _planErase(uint16_t mask) const;
+    /**
+     * Posts the erases of _planErase().
+     */
+    int _eraseBlock(uint32_t blockOffset, uint16_t mask);
+    /**
+     * Sends one sector to the next free buffer and posts its program, 
+     * one call for each run of pages that isn't skipped. The erase has
+     * to have been posted already.
+     */
+    int _writeSector(uint32_t flashOffset, const Sector& sector);
+    /**
+     * Runs the DMA sniffer over words of flash. The flash must be in XIP
+     * mode.
+     */
+    std::optional<uint32_t> _sniffCrc(uint32_t flashOffset, unsigned words);
+    int _readback(uint32_t flashOffset, const uint8_t* data, unsigned len);
+    int _verify(uint32_t flashOffset, unsigned len, uint32_t expected, const uint8_t* data);
+    uint32_t _slotAddr(uint32_t seq) const {
+        return MAILBOX_ADDR + (seq % SLOT_COUNT) * SLOT_SIZE;
+    }
+
+    PioSWDDriver& _swd;
+    const Chip* _chip = &Chip::RP2040;
+
+    // ROM flash functions
+    uint32_t _connectInternalFlash = 0;
+    uint32_t _flashExitXip = 0;
+    uint32_t _flashRangeErase = 0;
+    uint32_t _flashRangeProgram = 0;
+    uint32_t _flashFlushCache = 0;
+    uint32_t _flashEnterCmdXip = 0;
+    // RP2350 only, otherwise 0
+    uint32_t _bootromStateReset = 0;
+    uint32_t _flashResetAddressTrans = 0;
+
+    // Calls posted and calls known to be complete
+    uint32_t _posted = 0;
+    uint32_t _done = 0;
+    // How many calls must be complete before each buffer is free again
+    uint32_t _bufferBusy[2] = { 0, 0 };
+    unsigned _nextBuffer = 0;
+    // The unpack call into each buffer that hasn't been checked yet (its
+    // sequence number) and the length it should come to, 0 if none
+    uint32_t _unpackCall[2] = { 0, 0 };
+    unsigned _unpackLen[2] = { 0, 0 };
+
+    bool _skipUnchanged = false;
+    bool _blankCheck = false;
+
+    // The 64K blocks of the range being programmed and the last one 
+    // whose erases have been posted
+    unsigned _firstBlock = 0;
+    unsigned _lastBlock = 0;
+    unsigned _erasedThrough = 0;
+
+    // beginImage() state: the next sector, how much of it is staged and
+    // how much of the image is still to come
+    unsigned _imageSector = 0;
+    unsigned _imageFill = 0;
+    unsigned _imageRemaining = 0;
+    Stats _stats;
+};
+
+}
@@ -0,0 +1,174 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+
+#include "ImageReceiver.h"
+
+namespace kc1fsz {
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+ImageReceiver::ImageReceiver(FlashLoader& loader, Uf2Decoder& uf2, uint32_t uf2Family)
+:   _loader(loader),
+    _uf2(uf2),
+    _uf2Family(uf2Family) {
+}
+
+void ImageReceiver::reset() {
+    _state = SYNC0;
+    _started = false;
+    _isUf2 = false;
+    _received = 0;
+    _done = false;
+    _result = 0;
+}
+
+void ImageReceiver::put(const uint8_t* data, unsigned len) {
+    for (unsigned i = 0; i < len && !_done; i++) {
+        const uint8_t b = data[i];
+        switch (_state) {
+        case SYNC0:
+            if (b == SYNC_0)
+                _state = SYNC1;
+            break;
+        case SYNC1:
+            // A repeated first byte may still start a frame
+            if (b == SYNC_1) {
+                _state = HEADER;
+                _count = 0;
+            }
+            else if (b != SYNC_0)
+                _state = SYNC0;
+            break;
+        case HEADER:
+            _header[_count++] = b;
+            if (_count == sizeof(_header)) {
+                _payloadLen = _header[2] | (_header[3] << 8);
+                _count = 0;
+                if (_payloadLen > MAX_PAYLOAD) {
+                    _state = SYNC0;
+                    _oversized();
+                }
+                else
+                    _state = _payloadLen == 0 ? CRC : PAYLOAD;
+            }
+            break;
+        case PAYLOAD:
+            _payload[_count++] = b;
+            if (_count == _payloadLen) {
+                _count = 0;
+                _state = CRC;
+            }
+            break;
+        case CRC:
+            _crc = (_crc >> 8) | ((uint32_t)b << 24);
+            if (++_count == 4) {
+                _state = SYNC0;
+                _frame();
+            }
+            break;
+        }
+    }
+}
+
+void ImageReceiver::_oversized() {
+
+    const uint8_t type = _header[0];
+
+    // Anything left over from an earlier session is dropped quietly
+    if (!_started && type != TYPE_BEGIN && type != TYPE_UF2)
+        return;
+
+    // The payload can't be skipped without trusting the length, so the 
+    // sender is told rather than left waiting for a reply
+    _reply(_header[1], ERR_FRAME);
+}
+
+void ImageReceiver::_frame() {
+
+    const uint8_t type = _header[0];
+    const uint8_t seq = _header[1];
+
+    // Anything left over from an earlier session is dropped quietly
+    if (!_started && type != TYPE_BEGIN && type != TYPE_UF2)
+        return;
+
+    int rc = 0;
+    if (FlashLoader::crc32(_payload, _payloadLen, FlashLoader::crc32(_header, 4)) != _crc)
+        rc = ERR_CRC;
+    else if (_started && seq != _nextSeq)
+        rc = ERR_SEQ;
+    else
+        rc = _dispatch();
+
+    _reply(seq, rc);
+}
+
+void ImageReceiver::_reply(uint8_t seq, int rc) {
+    if (rc == 0) {
+        printf("OK %u\n", seq);
+        _nextSeq = seq + 1;
+    }
+    else {
+        printf("ERR %u %d\n", seq, rc);
+        _result = rc;
+        _done = true;
+    }
+}
+
+int ImageReceiver::_dispatch() {
+
+    const uint8_t type = _header[0];
+
+    if (type == TYPE_BEGIN) {
+        if (_started || _payloadLen != 12)
+            return ERR_FRAME;
+        _imageOffset = get32(_payload);
+        _imageLen = get32(_payload + 4);
+        _imageCrc = get32(_payload + 8);
+        _started = true;
+        return _loader.beginImage(_imageOffset, _imageLen);
+    }
+    else if (type == TYPE_UF2) {
+        if (_started || _payloadLen != 0)
+            return ERR_FRAME;
+        _started = true;
+        _isUf2 = true;
+        _uf2.begin(_uf2Family);
+        return 0;
+    }
+    else if (type == TYPE_DATA && _isUf2) {
+        if (_payloadLen % Uf2Decoder::BLOCK_SIZE != 0)
+            return ERR_FRAME;
+        _received += _payloadLen;
+        for (unsigned pos = 0; pos < _payloadLen; pos += Uf2Decoder::BLOCK_SIZE) {
+            if (const int rc = _uf2.put(_payload + pos); rc != 0)
+                return rc;
+        }
+        return 0;
+    }
+    else if (type == TYPE_DATA) {
+        _received += _payloadLen;
+        return _loader.writeImage(_payload, _payloadLen);
+    }
+    else if (type == TYPE_END && _isUf2) {
+        if (const int rc = _uf2.finish(); rc != 0)
+            return rc;
+        _done = true;
+        return 0;
+    }
+    else if (type == TYPE_END) {
+        if (const int rc = _loader.endImage(); rc != 0)
+            return rc;
+        if (const int rc = _loader.verifyCrc(_imageOffset, _imageLen, _imageCrc); rc != 0)
+            return rc;
+        _done = true;
+        return 0;
+    }
+    return ERR_FRAME;
+}
+
+}
@@ -0,0 +1,123 @@
+/**
+ * Programs a flash image that arrives in frames over a byte stream.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "FlashLoader.h"
+#include "Uf2Decoder.h"
+
+namespace kc1fsz {
+
+/**
+ * Takes the bytes of a send-image.py session in whatever pieces they
+ * arrive in and passes the image on to a FlashLoader one frame at a
+ * time, so nothing more than a frame is ever held here. Each frame is:
+ *
+ *   +0   0xa5, 0x5a
+ *   +2   Type
+ *   +3   Sequence number (8 bits, one more than the last frame)
+ *   +4   Payload length (16 bits, little-endian)
+ *   +6   Payload
+ *   +n   CRC-32 of the type through the payload (little-endian)
+ *
+ * A session is a BEGIN frame (flash offset, image length and image
+ * CRC-32, all 32 bits), DATA frames with the image in order and an END
+ * frame, which is only answered once the image has been verified. 
+ *
+ * A UF2 session starts with a UF2 frame instead (no payload) and the
+ * DATA frames hold whole 512-byte UF2 blocks, which go to a Uf2Decoder
+ * for the family given to the constructor (or setUf2Family()). There is no image CRC since
+ * each block says where it goes; the frame CRCs cover the transfer.
+ *
+ * Every frame is answered with a line of "OK <seq>" or 
+ * "ERR <seq> <code>" on stdout, a header with a payload length over 
+ * MAX_PAYLOAD with ERR_FRAME as soon as it is seen. Any error ends the
+ * session.
+ */
+class ImageReceiver {
+public:
+
+    static constexpr uint8_t SYNC_0 = 0xa5;
+    static constexpr uint8_t SYNC_1 = 0x5a;
+    static constexpr unsigned MAX_PAYLOAD = 1024;
+
+    static constexpr uint8_t TYPE_BEGIN = 'B';
+    static constexpr uint8_t TYPE_DATA = 'D';
+    static constexpr uint8_t TYPE_END = 'E';
+    static constexpr uint8_t TYPE_UF2 = 'U';
+
+    // Reply codes of the receiver itself, clear of the PioSWDDriver,
+    // FlashLoader and Uf2Decoder codes that are passed on as they are
+    static constexpr int ERR_CRC = 101;
+    static constexpr int ERR_SEQ = 102;
+    static constexpr int ERR_FRAME = 103;
+
+    ImageReceiver(FlashLoader& loader, Uf2Decoder& uf2, uint32_t uf2Family);
+
+    /**
+     * Changes the family taken from UF2 files, e.g. once the target chip
+     * is known. This applies from the next session.
+     */
+    void setUf2Family(uint32_t family) { _uf2Family = family; }
+
+    /**
+     * Forgets any session and waits for the next BEGIN or UF2 frame.
+     */
+    void reset();
+
+    void put(const uint8_t* data, unsigned len);
+
+    /**
+     * @returns true once the session has ended, either with the END frame
+     *   or an error.
+     */
+    bool isDone() const { return _done; }
+    /**
+     * @returns 0 if the image was programmed and verified.
+     */
+    int getResult() const { return _result; }
+    /**
+     * @returns The bytes of image (or UF2 file) received.
+     */
+    uint32_t getImageLength() const { return _received; }
+
+private:
+
+    void _frame();
+    /**
+     * A header with a payload length over MAX_PAYLOAD.
+     */
+    void _oversized();
+    int _dispatch();
+    void _reply(uint8_t seq, int rc);
+
+    enum State { SYNC0, SYNC1, HEADER, PAYLOAD, CRC };
+
+    FlashLoader& _loader;
+    Uf2Decoder& _uf2;
+    uint32_t _uf2Family;
+
+    State _state = SYNC0;
+    unsigned _count = 0;
+    // Type, sequence and length, as received
+    uint8_t _header[4];
+    uint8_t _payload[MAX_PAYLOAD];
+    unsigned _payloadLen = 0;
+    uint32_t _crc = 0;
+
+    bool _started = false;
+    bool _isUf2 = false;
+    uint32_t _received = 0;
+    bool _done = false;
+    int _result = 0;
+    uint8_t _nextSeq = 0;
+    uint32_t _imageOffset = 0;
+    uint32_t _imageLen = 0;
+    uint32_t _imageCrc = 0;
+};
+
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstring>
+
+#include "ImageStore.h"
+#include "Chip.h"
+#include "Uf2Family.h"
+
+// NOTE: These relate to the TARGET board, not the flashing board. Each 
+// header should only be included here. The RP2040 one is made from the 
+// blinky target by the build. The RP2350 one is checked in, since a 
+// build only makes blinky for its own PICO_PLATFORM (see README.md).
+#include "blinky-bin-rp2040.h"
+#include "blinky-bin-rp2350.h"
+
+// Fills in the fields that image-header.py makes for the named image
+#define IMAGE(name) name, name##_len, name##_crc
+#define MANIFEST(name) name##_sector_hashes, \
+    sizeof(name##_sector_hashes) / sizeof(name##_sector_hashes[0]), \
+    name##_segments, sizeof(name##_segments) / sizeof(name##_segments[0])
+
+namespace kc1fsz {
+
+static const ImageStore::Image IMAGES[] = {
+    { "blinky-rp2040", IMAGE(blinky_rp2040), Uf2Family::RP2040, 
+        blinky_rp2040_entry, MANIFEST(blinky_rp2040) },
+    { "blinky-rp2350", IMAGE(blinky_rp2350), Uf2Family::RP2350_ARM_S, 
+        blinky_rp2350_entry, MANIFEST(blinky_rp2350) }
+};
+
+unsigned ImageStore::getCount() {
+    return sizeof(IMAGES) / sizeof(IMAGES[0]);
+}
+
+const ImageStore::Image& ImageStore::get(unsigned i) {
+    return IMAGES[i];
+}
+
+const ImageStore::Image* ImageStore::find(const char* name) {
+    for (const Image& image : IMAGES)
+        if (strcmp(image.name, name) == 0)
+            return &image;
+    return nullptr;
+}
+
+const ImageStore::Image* ImageStore::findFamily(uint32_t family) {
+    for (const Image& image : IMAGES)
+        if (image.family == family)
+            return &image;
+    return nullptr;
+}
+
+uint32_t ImageStore::familyForChipId(uint32_t chipId) {
+    const Chip* chip = Chip::forChipId(chipId);
+    return chip != nullptr ? chip->family : 0;
+}
+
+}
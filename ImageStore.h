@@ -0,0 +1,66 @@
+/**
+ * The target images built into the programmer.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace kc1fsz {
+
+/**
+ * An index of target images, each a const array (see image-header.py) 
+ * that stays in the programmer's flash, along with a manifest worked 
+ * out when the header was made. Nothing is copied to RAM: the 
+ * data pointers are XIP addresses that FlashLoader sends from directly.
+ * Adding an image means generating its header and adding a line to the
+ * table in ImageStore.cpp.
+ */
+class ImageStore {
+public:
+
+    struct Image {
+        const char* name;
+        // Page-aligned, in flash
+        const uint8_t* data;
+        uint32_t len;
+        // CRC-32 of the data padded with 0xff to a whole number of 
+        // words, as FlashLoader::verifyCrc() wants it
+        uint32_t crc;
+        // UF2 family ID of the chip it is built for
+        uint32_t family;
+        // The reset handler
+        uint32_t entry;
+        // FlashLoader::hash() of each 4K sector, for skipping unchanged
+        // sectors and verifying without the data
+        const uint32_t* sectorHashes;
+        unsigned sectorCount;
+        // Flash offset and length of each load segment
+        const uint32_t (*segments)[2];
+        unsigned segmentCount;
+    };
+
+    static unsigned getCount();
+    static const Image& get(unsigned i);
+
+    /**
+     * @returns nullptr if there is no image with that name.
+     */
+    static const Image* find(const char* name);
+
+    /**
+     * @returns The first image for the family, or nullptr if none.
+     */
+    static const Image* findFamily(uint32_t family);
+
+    /**
+     * The UF2 family of a chip, going by the PART field of its CHIP_ID
+     * register (see Chip::forChipId()).
+     *
+     * @returns 0 if the chip isn't recognized.
+     */
+    static uint32_t familyForChipId(uint32_t chipId);
+};
+
+}
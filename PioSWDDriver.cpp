@@ -0,0 +1,959 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cmath>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "hardware/gpio.h"
+
+#include "swd.pio.h"
+
+#include "PioSWDDriver.h"
+
+namespace kc1fsz {
+
+// CSW: 32-bit transfers, HPROT privileged data access, master type debug.
+// On an AHB5-AP (the RP2350) bit 30 is HNONSEC, so this is also a Secure
+// access.
+static const uint32_t CSW_WORD = 0x23000002;
+// CSW.AddrInc: increment single
+static const uint32_t CSW_ADDRINC_SINGLE = 0x00000010;
+static const uint32_t CSW_ADDRINC_MASK = 0x00000030;
+// TAR auto-increment is only guaranteed within a 1K block
+static const uint32_t TAR_AUTOINC_MASK = 0x3ff;
+
+// DPIDR.VERSION: 2 is DPv2 (ADIv5.2, TARGETID and multi-drop), 3 is 
+// DPv3 (ADIv6, APs addressed by their base address)
+static const uint32_t DPIDR_VERSION_SHIFT = 12;
+static const uint32_t DPIDR_VERSION_MASK = 0xf;
+// DP SELECT.DPBANKSEL for TARGETID
+static const uint32_t DP_BANK_TARGETID = 2;
+// Where the MEM-AP registers start within an ADIv6 AP
+static const uint32_t ADIV6_MEMAP_REGS = 0xd00;
+
+// CTRL/STAT bits
+static const uint32_t CTRL_STAT_POWERUP = 0x50000000;
+static const uint32_t CTRL_STAT_POWERUP_ACK = 0xa0000000;
+static const uint32_t CTRL_STAT_ORUNDETECT = 0x00000001;
+static const uint32_t CTRL_STAT_STICKYORUN = 0x00000002;
+static const uint32_t CTRL_STAT_STICKYERR = 0x00000020;
+static const uint32_t CTRL_STAT_WDATAERR = 0x00000080;
+
+// DHCSR bits
+static const uint32_t DHCSR_S_REGRDY = 0x00010000;
+static const uint32_t DHCSR_S_HALT = 0x00020000;
+// DCRSR.REGWnR
+static const uint32_t DCRSR_WRITE = 0x00010000;
+// Runs of the fast register read and write used to judge REGRDY latency
+static const unsigned REGRDY_PROBES = 8;
+
+// How many times a streamed chunk is replayed before giving up
+static const unsigned STREAM_REPLAYS = 3;
+
+// The SWCLK rates that trainClock() steps through. The PIO needs four 
+// cycles per bit so the top rate depends on the system clock, and the
+// steps above it are skipped.
+static const unsigned CLOCK_STEPS_HZ[] = {
+    500000, 1000000, 2000000, 4000000, 6000000, 8000000, 10000000, 
+    12000000, 15000000, 20000000, 25000000
+};
+static const unsigned CLOCK_STEP_COUNT = sizeof(CLOCK_STEPS_HZ) / sizeof(CLOCK_STEPS_HZ[0]);
+
+// Runtime back-off: drop one clock step when this many wire errors, or
+// this many WAIT/FAULT responses, show up within a window of this many
+// packets.
+static const unsigned BACKOFF_WINDOW = 256;
+static const unsigned BACKOFF_ERRORS = 4;
+static const unsigned BACKOFF_STALLS = 64;
+
+// The selection alert sequence that takes an SWJ-DP out of dormant
+// state (ADIv5.2 B5.3.4), sent LSB first.
+static const uint32_t SELECTION_ALERT[4] = {
+    0x6209f392, 0x86852d95, 0xe3ddafe9, 0x19bc0ea2
+};
+// Activation code for SWD
+static const uint32_t ACTIVATION_SWD = 0x1a;
+
+using swd::parity;
+
+PioSWDDriver::PioSWDDriver(unsigned clkPin, unsigned dioPin, PIO pio, unsigned sm)
+:   _clkPin(clkPin),
+    _dioPin(dioPin),
+    _pio(pio),
+    _sm(sm) {
+}
+
+void PioSWDDriver::init(unsigned clockHz) {
+
+    _offset = pio_add_program(_pio, &swd_program);
+    const float div = _clkdiv(clockHz);
+    _clockHz = _achievedHz(div);
+
+    pio_sm_config c = swd_program_get_default_config(_offset);
+    sm_config_set_out_pins(&c, _dioPin, 1);
+    sm_config_set_in_pins(&c, _dioPin);
+    sm_config_set_sideset_pins(&c, _clkPin);
+    // Shift right (LSB first) in both directions, no auto push/pull
+    sm_config_set_out_shift(&c, true, false, 32);
+    sm_config_set_in_shift(&c, true, false, 32);
+    sm_config_set_clkdiv(&c, div);
+
+    pio_gpio_init(_pio, _clkPin);
+    pio_gpio_init(_pio, _dioPin);
+    // The line floats high during turnaround
+    gpio_pull_up(_dioPin);
+    pio_sm_set_pins_with_mask(_pio, _sm, 0, (1u << _clkPin) | (1u << _dioPin));
+    pio_sm_set_consecutive_pindirs(_pio, _sm, _clkPin, 1, true);
+    pio_sm_set_consecutive_pindirs(_pio, _sm, _dioPin, 1, true);
+
+    pio_sm_init(_pio, _sm, _offset + swd_offset_get_next_cmd, &c);
+    pio_sm_set_enabled(_pio, _sm, true);
+}
+
+float PioSWDDriver::_clkdiv(unsigned hz) {
+    // Each bit takes four PIO cycles
+    const float div = (float)clock_get_hz(clk_sys) / (4.0f * hz);
+    if (div < 1.0f)
+        return 1.0f;
+    // The divider has eight fractional bits. Rounding up keeps SWCLK at
+    // or below the rate asked for.
+    return ceilf(div * 256.0f) / 256.0f;
+}
+
+unsigned PioSWDDriver::_achievedHz(float div) {
+    return (unsigned)(clock_get_hz(clk_sys) / (4.0 * div) + 0.5);
+}
+
+void PioSWDDriver::setClockHz(unsigned hz) {
+    const float div = _clkdiv(hz);
+    _clockHz = _achievedHz(div);
+    // The packet time has changed
+    _regRdyChecked = false;
+    pio_sm_set_clkdiv(_pio, _sm, div);
+}
+
+uint32_t PioSWDDriver::_cmd(unsigned entry, unsigned count, bool output) const {
+    return ((count - 1) & 0xff) |
+        ((output ? 1 : 0) << 8) |
+        ((_offset + entry) << 9);
+}
+
+void PioSWDDriver::_writeBits(uint32_t data, unsigned count) {
+    pio_sm_put_blocking(_pio, _sm, _cmd(swd_offset_write_cmd, count, true));
+    pio_sm_put_blocking(_pio, _sm, data);
+}
+
+uint32_t PioSWDDriver::_readBits(unsigned count) {
+    pio_sm_put_blocking(_pio, _sm, _cmd(swd_offset_read_cmd, count, false));
+    return pio_sm_get_blocking(_pio, _sm) >> (32 - count);
+}
+
+void PioSWDDriver::_turnaround(unsigned count) {
+    pio_sm_put_blocking(_pio, _sm, _cmd(swd_offset_turnaround_cmd, count, false));
+}
+
+void PioSWDDriver::_lineReset() {
+    // At least 50 clocks with SWDIO high, followed by idle cycles
+    _writeBits(0xffffffff, 32);
+    _writeBits(0xffffffff, 32);
+    _writeBits(0, 8);
+}
+
+int PioSWDDriver::connect(uint32_t targetSel, uint32_t apAddr) {
+
+    _targetSel = targetSel;
+    _lastWritten.mask = 0;
+
+    // Dormant-to-SWD: at least 8 cycles high, the selection alert,
+    // 4 cycles low and the activation code.
+    _writeBits(0xff, 8);
+    for (unsigned i = 0; i < 4; i++)
+        _writeBits(SELECTION_ALERT[i], 32);
+    _writeBits(0, 4);
+    _writeBits(ACTIVATION_SWD, 8);
+    _lineReset();
+    // A line reset puts SELECT back to zero, but be conservative
+    _invalidateShadows();
+
+    _writeTargetSel(targetSel);
+
+    // A read of DPIDR is required to leave the reset state
+    if (const auto r = read<swd::DPReg<swd::DPIDR>>(); !r.has_value())
+        return -1;
+    else
+        _idcode = *r;
+
+    // An ADIv6 AP is picked by the upper bits of SELECT, in place of the
+    // ADIv5 APSEL byte. The RP2350's AP addresses are 32 bits so SELECT1
+    // stays at zero.
+    const uint32_t version = (_idcode >> DPIDR_VERSION_SHIFT) & DPIDR_VERSION_MASK;
+    _apSelect = version >= 3 ? apAddr | ADIV6_MEMAP_REGS : apAddr << 24;
+
+    if (_clearStickyErrors() != 0)
+        return -2;
+    _targetId = 0;
+    if (version >= 2) {
+        if (write<swd::DPReg<swd::SELECT>>(DP_BANK_TARGETID) != 0)
+            return -3;
+        if (const auto r = read<swd::DPReg<swd::TARGETID>>(); !r.has_value())
+            return -3;
+        else
+            _targetId = *r;
+    }
+    if (write<swd::DPReg<swd::SELECT>>(0) != 0)
+        return -3;
+
+    // Power up the debug and system domains
+    if (write<swd::DPReg<swd::CTRL_STAT>>(CTRL_STAT_POWERUP) != 0)
+        return -4;
+    bool powered = false;
+    for (unsigned i = 0; i < 100 && !powered; i++) {
+        if (const auto r = read<swd::DPReg<swd::CTRL_STAT>>(); !r.has_value())
+            return -5;
+        else
+            powered = (*r & CTRL_STAT_POWERUP_ACK) == CTRL_STAT_POWERUP_ACK;
+    }
+    if (!powered)
+        return -6;
+
+    if (const auto r = read<swd::APReg<swd::IDR>>(); !r.has_value())
+        return -7;
+    else
+        _apid = *r;
+
+    if (write<swd::APReg<swd::CSW>>(CSW_WORD) != 0)
+        return -8;
+
+    return 0;
+}
+
+void PioSWDDriver::_writeTargetSel(uint32_t targetSel) {
+    // The target never drives the ACK phase of a TARGETSEL write
+    _transferBlind(swd::DPReg<swd::TARGETSEL>::writeHeader, targetSel);
+}
+
+void PioSWDDriver::_transferBlind(uint8_t header, uint32_t data) {
+    _counters.packets++;
+    _writeBits(header, 8);
+    // Clock through the turnaround, the three ACK bits and the second 
+    // turnaround without looking at them.
+    _turnaround(5);
+    _writeBits(data, 32);
+    _writeBits(parity(data) ? 1 : 0, 3);
+}
+
+int PioSWDDriver::_transferOnce(uint8_t header, uint32_t* data) {
+
+    _counters.packets++;
+    _writeBits(header, 8);
+    _turnaround(1);
+    const uint32_t ack = _readBits(3);
+
+    if (ack == 0b001) {
+        if (swd::isRead(header)) {
+            const uint32_t d = _readBits(32);
+            const uint32_t dp = _readBits(1);
+            _turnaround(1);
+            if (parity(d) != (dp != 0)) {
+                _counters.parityErrors++;
+                return ERR_PARITY;
+            }
+            *data = d;
+        } else {
+            _turnaround(1);
+            _writeBits(*data, 32);
+            // Parity followed by two idle cycles
+            _writeBits(parity(*data) ? 1 : 0, 3);
+        }
+        return 0;
+    }
+    else if (ack == 0b010) {
+        _counters.waits++;
+        // With overrun detection on the data phase is always clocked
+        _turnaround(_orunDetect ? 1 + 33 : 1);
+        return ERR_WAIT;
+    }
+    else if (ack == 0b100) {
+        _counters.faults++;
+        _turnaround(_orunDetect ? 1 + 33 : 1);
+        return ERR_FAULT;
+    }
+    else {
+        _counters.protocolErrors++;
+        // Nobody is talking to us (or they are confused). Back off for
+        // the length of a data phase so that the target can resync.
+        _turnaround(33 + 1);
+        return ERR_PROTOCOL;
+    }
+}
+
+int PioSWDDriver::_transfer(uint8_t header, uint32_t* data) {
+
+    WaitStats& stats = *_waitStats;
+    stats.transfers++;
+
+    int rc = _transferOnce(header, data);
+    if (rc != ERR_WAIT)
+        return rc;
+
+    // Slow path: the target is stalled
+    const uint32_t start = time_us_32();
+    unsigned waits = 1;
+    unsigned delayUs = _waitPolicy.delayUs;
+    for (unsigned retry = 0; retry < _waitPolicy.maxRetries && rc == ERR_WAIT; retry++) {
+        if (delayUs) {
+            sleep_us(delayUs);
+            delayUs *= 2;
+            if (delayUs > _waitPolicy.maxDelayUs)
+                delayUs = _waitPolicy.maxDelayUs;
+        }
+        rc = _transferOnce(header, data);
+        if (rc == ERR_WAIT)
+            waits++;
+    }
+
+    stats.stalled++;
+    stats.waits += waits;
+    stats.stallUs += time_us_32() - start;
+    unsigned bucket = 0;
+    while (bucket < WaitStats::BUCKETS - 1 && (2u << bucket) <= waits)
+        bucket++;
+    stats.histogram[bucket]++;
+    if (rc == ERR_WAIT)
+        stats.exhausted++;
+
+    return rc;
+}
+
+PioSWDDriver::WaitScope::WaitScope(PioSWDDriver& swd, WaitStats& stats, 
+    const WaitPolicy& policy)
+:   _swd(swd),
+    _savedStats(swd._waitStats),
+    _savedPolicy(swd._waitPolicy) {
+    swd._waitStats = &stats;
+    swd._waitPolicy = policy;
+}
+
+PioSWDDriver::WaitScope::~WaitScope() {
+    _swd._waitStats = _savedStats;
+    _swd._waitPolicy = _savedPolicy;
+}
+
+std::optional<uint32_t> PioSWDDriver::readDP(uint8_t addr) {
+    uint32_t data = 0;
+    queueReadDP(addr, &data);
+    if (flush() != 0)
+        return std::nullopt;
+    return data;
+}
+
+int PioSWDDriver::writeDP(uint8_t addr, uint32_t data) {
+    queueWriteDP(addr, data);
+    return flush();
+}
+
+std::optional<uint32_t> PioSWDDriver::readAP(uint8_t addr) {
+    uint32_t data = 0;
+    queueReadAP(addr, &data);
+    if (flush() != 0)
+        return std::nullopt;
+    return data;
+}
+
+int PioSWDDriver::writeAP(uint8_t addr, uint32_t data) {
+    queueWriteAP(addr, data);
+    return flush();
+}
+
+std::optional<uint32_t> PioSWDDriver::readWordViaAP(uint32_t addr) {
+    uint32_t data = 0;
+    queueReadWordViaAP(addr, &data);
+    if (flush() != 0)
+        return std::nullopt;
+    return data;
+}
+
+int PioSWDDriver::writeWordViaAP(uint32_t addr, uint32_t data) {
+    queueWriteWordViaAP(addr, data);
+    return flush();
+}
+
+int PioSWDDriver::readBlockViaAP(uint32_t addr, uint32_t* data, unsigned count) {
+    // This leaves AP bank 0 selected. CSW, TAR and DRW all live there so 
+    // the rest of the block can skip SELECT. The CSW write is dropped at 
+    // flush time if the previous block already set it.
+    queueWrite<swd::APReg<swd::CSW>>(CSW_WORD | CSW_ADDRINC_SINGLE);
+    for (unsigned i = 0; i < count; i++, addr += 4) {
+        if (i == 0 || (addr & TAR_AUTOINC_MASK) == 0)
+            _queue(TAR_WRITE, AP_TAR, addr, nullptr);
+        _queue(DRW_READ, AP_DRW, 0, &data[i]);
+    }
+    return flush();
+}
+
+int PioSWDDriver::writeBlockViaAP(uint32_t addr, const uint32_t* data, unsigned count) {
+    if (_streamingWrites)
+        return _streamBlockViaAP(addr, data, count);
+    queueWrite<swd::APReg<swd::CSW>>(CSW_WORD | CSW_ADDRINC_SINGLE);
+    for (unsigned i = 0; i < count; i++, addr += 4) {
+        if (i == 0 || (addr & TAR_AUTOINC_MASK) == 0)
+            _queue(TAR_WRITE, AP_TAR, addr, nullptr);
+        _queue(DRW_WRITE, AP_DRW, data[i], nullptr);
+    }
+    return flush();
+}
+
+int PioSWDDriver::_streamBlockViaAP(uint32_t addr, const uint32_t* data, unsigned count) {
+
+    // Anything already queued goes first
+    if (const int rc = flush(); rc != 0)
+        return rc;
+
+    // With ORUNDETECT set the DP stops processing AP transactions after 
+    // the first WAIT or FAULT until the sticky flags are cleared, so it
+    // is safe to stream writes without looking at any of the ACKs.
+    _orunDetect = true;
+    int rc = write<swd::DPReg<swd::CTRL_STAT>>(CTRL_STAT_POWERUP | CTRL_STAT_ORUNDETECT);
+
+    // Work in chunks that end on a 1K TAR boundary. The start of the 
+    // current chunk is the last offset known to be good.
+    unsigned done = 0;
+    unsigned replays = 0;
+    while (rc == 0 && done < count) {
+
+        const uint32_t chunkAddr = addr + done * 4;
+        unsigned chunk = ((TAR_AUTOINC_MASK + 1) - (chunkAddr & TAR_AUTOINC_MASK)) / 4;
+        if (chunk > count - done)
+            chunk = count - done;
+
+        queueWrite<swd::APReg<swd::CSW>>(CSW_WORD | CSW_ADDRINC_SINGLE);
+        _queue(TAR_WRITE, AP_TAR, chunkAddr, nullptr);
+        int chunkRc = flush();
+        if (chunkRc == 0) {
+            for (unsigned i = 0; i < chunk; i++)
+                _transferBlind(DRW_WRITE, data[done + i]);
+            // TAR has moved on without us tracking it
+            _tarValid = false;
+            // An RDBUFF read stalls until the last write has completed
+            uint32_t ignored = 0;
+            queueRead<swd::DPReg<swd::RDBUFF>>(&ignored);
+            chunkRc = flush();
+        }
+
+        // CTRL/STAT can always be read, even with the sticky flags set
+        uint32_t stat = 0;
+        queueRead<swd::DPReg<swd::CTRL_STAT>>(&stat);
+        if (const int statRc = flush(); statRc != 0) {
+            rc = statRc;
+            break;
+        }
+
+        const uint32_t errors = CTRL_STAT_STICKYORUN | CTRL_STAT_STICKYERR | CTRL_STAT_WDATAERR;
+        if (chunkRc == 0 && (stat & errors) == 0) {
+            done += chunk;
+            replays = 0;
+        }
+        else {
+            _counters.overruns++;
+            _clearStickyErrors();
+            if (++replays > STREAM_REPLAYS)
+                rc = chunkRc != 0 ? chunkRc : ERR_FAULT;
+        }
+    }
+
+    _orunDetect = false;
+    if (const int offRc = write<swd::DPReg<swd::CTRL_STAT>>(CTRL_STAT_POWERUP); rc == 0)
+        rc = offRc;
+
+    return rc;
+}
+
+int PioSWDDriver::pollREGRDY(unsigned attempts) {
+    WaitScope scope(*this, _regRdyStats, _waitPolicy);
+    for (unsigned i = 0; i < attempts; i++) {
+        if (const auto r = readWordViaAP(ARM_DHCSR); !r.has_value())
+            return -1;
+        else if (*r & DHCSR_S_REGRDY)
+            return 0;
+    }
+    return ERR_TIMEOUT;
+}
+
+int PioSWDDriver::_checkREGRDYLatency() {
+    _regRdyImmediate = true;
+    for (unsigned i = 0; i < REGRDY_PROBES && _regRdyImmediate; i++) {
+
+        // The real value of a register, the slow way
+        uint32_t dhcsr = 0;
+        queueReadWordViaAP(ARM_DHCSR, &dhcsr);
+        queueWriteWordViaAP(ARM_DCRSR, REG_PC);
+        if (const int rc = flush(); rc != 0)
+            return rc;
+        if (!(dhcsr & DHCSR_S_HALT))
+            return -1;
+        if (const int rc = pollREGRDY(); rc != 0)
+            return rc;
+        uint32_t expected = 0;
+        if (const auto r = readWordViaAP(ARM_DCRDR); !r.has_value())
+            return -1;
+        else
+            expected = *r;
+
+        // Then exactly what the fast path sends: the DCRSR write with the
+        // DRW read of DCRDR right behind it. DCRDR is loaded with 
+        // something else first, so a read that gets there before the 
+        // transfer has finished shows up as the wrong value.
+        uint32_t fast = 0;
+        queueWriteWordViaAP(ARM_DCRDR, ~expected);
+        queueWrite<swd::APReg<swd::CSW>>(CSW_WORD | CSW_ADDRINC_SINGLE);
+        _queue(TAR_WRITE, AP_TAR, ARM_DCRSR, nullptr);
+        _queue(DRW_WRITE, AP_DRW, REG_PC, nullptr);
+        _queue(DRW_READ, AP_DRW, 0, &fast);
+        if (const int rc = flush(); rc != 0)
+            return rc;
+        _regRdyImmediate = fast == expected;
+
+        // And what writeCoreRegisters() sends: PC is written back with 
+        // its own value and the DRW write of the next register's value 
+        // into DCRDR follows the DCRSR write. If that lands before the 
+        // transfer has taken DCRDR, PC ends up with the wrong value.
+        queueWrite<swd::APReg<swd::CSW>>(CSW_WORD | CSW_ADDRINC_SINGLE);
+        _queue(TAR_WRITE, AP_TAR, ARM_DCRDR, nullptr);
+        _queue(DRW_WRITE, AP_DRW, expected, nullptr);
+        _queue(TAR_WRITE, AP_TAR, ARM_DCRSR, nullptr);
+        _queue(DRW_WRITE, AP_DRW, REG_PC | DCRSR_WRITE, nullptr);
+        _queue(DRW_WRITE, AP_DRW, ~expected, nullptr);
+        if (const int rc = flush(); rc != 0)
+            return rc;
+        if (const int rc = pollREGRDY(); rc != 0)
+            return rc;
+        if (const int rc = writeWordViaAP(ARM_DCRSR, REG_PC); rc != 0)
+            return rc;
+        if (const int rc = pollREGRDY(); rc != 0)
+            return rc;
+        if (const auto r = readWordViaAP(ARM_DCRDR); !r.has_value())
+            return -1;
+        else if (*r != expected) {
+            _regRdyImmediate = false;
+            // Put PC back
+            if (const int rc = writeWordViaAP(ARM_DCRDR, expected); rc != 0)
+                return rc;
+            if (const int rc = writeWordViaAP(ARM_DCRSR, REG_PC | DCRSR_WRITE); rc != 0)
+                return rc;
+            if (const int rc = pollREGRDY(); rc != 0)
+                return rc;
+        }
+    }
+    _regRdyChecked = true;
+    return 0;
+}
+
+std::optional<PioSWDDriver::CoreRegisters> PioSWDDriver::readCoreRegisters(uint32_t mask) {
+
+    if (!_regRdyChecked && _checkREGRDYLatency() != 0)
+        return std::nullopt;
+
+    CoreRegisters regs;
+    regs.mask = mask & CORE_REGS_ALL;
+
+    if (!_regRdyImmediate) {
+        for (unsigned i = 0; i < CORE_REG_COUNT; i++) {
+            if (!(regs.mask & (1u << i)))
+                continue;
+            if (writeWordViaAP(ARM_DCRSR, i) != 0)
+                return std::nullopt;
+            if (pollREGRDY() != 0)
+                return std::nullopt;
+            if (const auto r = readWordViaAP(ARM_DCRDR); !r.has_value())
+                return std::nullopt;
+            else
+                regs.r[i] = *r;
+        }
+        return regs;
+    }
+
+    uint32_t dhcsr = 0;
+    queueReadWordViaAP(ARM_DHCSR, &dhcsr);
+    // DCRDR follows DCRSR, so with auto-increment each register is a TAR
+    // write, a DCRSR write and a DCRDR read. 
+    queueWrite<swd::APReg<swd::CSW>>(CSW_WORD | CSW_ADDRINC_SINGLE);
+    for (unsigned i = 0; i < CORE_REG_COUNT; i++) {
+        if (!(regs.mask & (1u << i)))
+            continue;
+        _queue(TAR_WRITE, AP_TAR, ARM_DCRSR, nullptr);
+        _queue(DRW_WRITE, AP_DRW, i, nullptr);
+        _queue(DRW_READ, AP_DRW, 0, &regs.r[i]);
+    }
+    if (flush() != 0)
+        return std::nullopt;
+    // Nothing useful comes out of DCRDR on a running core
+    if (!(dhcsr & DHCSR_S_HALT))
+        return std::nullopt;
+    return regs;
+}
+
+int PioSWDDriver::writeCoreRegisters(const CoreRegisters& regs, bool minimal) {
+
+    if (!_regRdyChecked) {
+        if (const int rc = _checkREGRDYLatency(); rc != 0)
+            return rc;
+    }
+
+    uint32_t mask = regs.mask & CORE_REGS_ALL;
+    if (minimal) {
+        const uint32_t unchanged = mask & CORE_REGS_PRESERVED & _lastWritten.mask;
+        for (unsigned i = 0; i < CORE_REG_COUNT; i++)
+            if ((unchanged & (1u << i)) && _lastWritten.r[i] == regs.r[i])
+                mask &= ~(1u << i);
+    }
+
+    // Until this works out we don't know what is in the registers
+    const uint32_t written = regs.mask & CORE_REGS_ALL;
+    _lastWritten.mask &= ~written;
+
+    int rc = 0;
+    if (!_regRdyImmediate) {
+        for (unsigned i = 0; i < CORE_REG_COUNT && rc == 0; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+            rc = writeWordViaAP(ARM_DCRDR, regs.r[i]);
+            if (rc == 0)
+                rc = writeWordViaAP(ARM_DCRSR, i | DCRSR_WRITE);
+            if (rc == 0)
+                rc = pollREGRDY();
+        }
+    }
+    else {
+        // Each DCRDR write goes out right behind the DCRSR write for the
+        // register before it, which is only safe because the probe has 
+        // seen that transfer finish in time with this exact sequence.
+        // The DCRSR write leaves TAR pointing at DCRDR, so the shadow 
+        // drops the TAR write for every register after the first.
+        queueWrite<swd::APReg<swd::CSW>>(CSW_WORD | CSW_ADDRINC_SINGLE);
+        for (unsigned i = 0; i < CORE_REG_COUNT; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+            _queue(TAR_WRITE, AP_TAR, ARM_DCRDR, nullptr);
+            _queue(DRW_WRITE, AP_DRW, regs.r[i], nullptr);
+            _queue(TAR_WRITE, AP_TAR, ARM_DCRSR, nullptr);
+            _queue(DRW_WRITE, AP_DRW, i | DCRSR_WRITE, nullptr);
+        }
+        rc = flush();
+        if (rc == 0)
+            rc = pollREGRDY();
+    }
+    if (rc != 0)
+        return rc;
+
+    for (unsigned i = 0; i < CORE_REG_COUNT; i++)
+        if (written & (1u << i))
+            _lastWritten.r[i] = regs.r[i];
+    _lastWritten.mask |= written;
+    return 0;
+}
+
+// ----- Deferred transactions ------------------------------------------------
+
+void PioSWDDriver::_queue(uint8_t header, uint8_t addr, uint32_t data, uint32_t* result) {
+    if (_queueLen == QUEUE_SIZE) {
+        if (const int rc = flush(); rc != 0)
+            _queueError = rc;
+    }
+    // Once something has failed the rest of the batch is pointless
+    if (_queueError != 0)
+        return;
+    _queueOps[_queueLen++] = { header, addr, data, result };
+}
+
+// Register addresses that are only known at runtime take their header
+// from the precomputed table.
+
+void PioSWDDriver::queueReadDP(uint8_t addr, uint32_t* result) {
+    _queue(swd::lookupHeader(false, true, addr), addr, 0, result);
+}
+
+void PioSWDDriver::queueWriteDP(uint8_t addr, uint32_t data) {
+    _queue(swd::lookupHeader(false, false, addr), addr, data, nullptr);
+}
+
+void PioSWDDriver::queueReadAP(uint8_t addr, uint32_t* result) {
+    // The AP from connect(), bank from the upper nibble of the address
+    _queue(SELECT_WRITE, DP_SELECT, _apSelect | (addr & 0xf0), nullptr);
+    _queue(swd::lookupHeader(true, true, addr), addr, 0, result);
+}
+
+void PioSWDDriver::queueWriteAP(uint8_t addr, uint32_t data) {
+    _queue(SELECT_WRITE, DP_SELECT, _apSelect | (addr & 0xf0), nullptr);
+    _queue(swd::lookupHeader(true, false, addr), addr, data, nullptr);
+}
+
+// Single-word accesses state the full SELECT/CSW/TAR setup they need and 
+// leave it to the shadow registers to drop whatever is already in place.
+
+void PioSWDDriver::queueReadWordViaAP(uint32_t addr, uint32_t* result) {
+    queueWrite<swd::APReg<swd::CSW>>(CSW_WORD);
+    _queue(TAR_WRITE, AP_TAR, addr, nullptr);
+    _queue(DRW_READ, AP_DRW, 0, result);
+}
+
+void PioSWDDriver::queueWriteWordViaAP(uint32_t addr, uint32_t data) {
+    queueWrite<swd::APReg<swd::CSW>>(CSW_WORD);
+    _queue(TAR_WRITE, AP_TAR, addr, nullptr);
+    _queue(DRW_WRITE, AP_DRW, data, nullptr);
+}
+
+int PioSWDDriver::flush() {
+
+    // An error held from an implicit flush has already been dealt with
+    const int held = _queueError;
+    int rc = held;
+
+    // AP reads are posted: the data phase of an AP read returns the result 
+    // of the previous AP read and the last one in a run has to be collected
+    // from RDBUFF. So consecutive AP reads are pipelined and this points to
+    // where the result of the read that is still in flight should go.
+    uint32_t* posted = nullptr;
+
+    for (unsigned i = 0; i < _queueLen && rc == 0; i++) {
+        Op& op = _queueOps[i];
+        if (_isRedundant(op))
+            continue;
+        if (op.ap() && op.read()) {
+            uint32_t previous = 0;
+            rc = _transfer(op.header, &previous);
+            if (rc == 0 && posted)
+                *posted = previous;
+            posted = op.result;
+        }
+        else {
+            // Anything else ends the run
+            if (posted) {
+                rc = _transfer(RDBUFF_READ, posted);
+                posted = nullptr;
+                if (rc != 0)
+                    break;
+            }
+            if (op.read()) 
+                rc = _transfer(op.header, op.result);
+            else 
+                rc = _transfer(op.header, &op.data);
+        }
+        if (rc == 0)
+            _shadow(op);
+    }
+
+    if (rc == 0 && posted)
+        rc = _transfer(RDBUFF_READ, posted);
+
+    _queueLen = 0;
+    _queueError = 0;
+
+    if (rc != 0 && held == 0) {
+        // We can't be sure how far the failed operation got
+        _invalidateShadows();
+        if (rc == ERR_FAULT)
+            _clearStickyErrors();
+        else if (rc == ERR_PROTOCOL || rc == ERR_PARITY)
+            _recoverLine();
+    }
+
+    _checkErrorRate();
+
+    return rc;
+}
+
+bool PioSWDDriver::_isRedundant(const Op& op) {
+    if (op.read())
+        return false;
+    if (!op.ap()) {
+        if (op.addr == DP_SELECT && _selectValid && _select == op.data) {
+            _counters.skippedSelect++;
+            return true;
+        }
+    }
+    else if (op.addr == AP_CSW) {
+        if (_cswValid && _csw == op.data) {
+            _counters.skippedCsw++;
+            return true;
+        }
+    }
+    else if (op.addr == AP_TAR) {
+        if (_tarValid && _tar == op.data) {
+            _counters.skippedTar++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PioSWDDriver::_shadow(const Op& op) {
+    if (!op.ap()) {
+        if (!op.read() && op.addr == DP_SELECT) {
+            _select = op.data;
+            _selectValid = true;
+        }
+    }
+    else if (op.addr == AP_CSW) {
+        if (!op.read()) {
+            _csw = op.data;
+            _cswValid = true;
+        }
+    }
+    else if (op.addr == AP_TAR) {
+        if (!op.read()) {
+            _tar = op.data;
+            _tarValid = true;
+        }
+    }
+    else if (op.addr == AP_DRW) {
+        // Follow TAR auto-increment. What happens at a 1K boundary is 
+        // implementation defined so we stop tracking there.
+        if (!_cswValid) {
+            _tarValid = false;
+        }
+        else if ((_csw & CSW_ADDRINC_MASK) == CSW_ADDRINC_SINGLE) {
+            _tar += 4;
+            if ((_tar & TAR_AUTOINC_MASK) == 0)
+                _tarValid = false;
+        }
+        else if ((_csw & CSW_ADDRINC_MASK) != 0) {
+            _tarValid = false;
+        }
+    }
+}
+
+void PioSWDDriver::_invalidateShadows() {
+    _selectValid = false;
+    _cswValid = false;
+    _tarValid = false;
+}
+
+int PioSWDDriver::_clearStickyErrors() {
+    // Whatever caused the error may have left the AP in an unknown state
+    _invalidateShadows();
+    // STKCMPCLR, STKERRCLR, WDERRCLR, ORUNERRCLR. This goes straight to 
+    // the wire since it is used while cleaning up after a flush.
+    uint32_t data = 0x1e;
+    return _transfer(swd::DPReg<swd::ABORT>::writeHeader, &data);
+}
+
+// ----- Clock training -------------------------------------------------------
+
+int PioSWDDriver::_recoverLine() {
+    // A line reset leaves the DP deselected, so TARGETSEL has to be
+    // repeated before DPIDR can be read.
+    _lineReset();
+    _invalidateShadows();
+    _writeTargetSel(_targetSel);
+    uint32_t idcode = 0;
+    if (const int rc = _transfer(swd::DPReg<swd::DPIDR>::readHeader, &idcode); rc != 0)
+        return rc;
+    return _clearStickyErrors();
+}
+
+int PioSWDDriver::_stressTest(uint32_t ramAddr, unsigned words) {
+
+    const Counters before = _counters;
+
+    uint32_t out[STRESS_WORDS], in[STRESS_WORDS];
+    if (words > STRESS_WORDS)
+        words = STRESS_WORDS;
+
+    // Patterns that flip as many bits as possible between consecutive 
+    // words, plus walking ones/zeros to catch stuck or crossed bits.
+    for (unsigned i = 0; i < words; i++) {
+        switch (i % 4) {
+            case 0: out[i] = 0xaaaaaaaa; break;
+            case 1: out[i] = 0x55555555; break;
+            case 2: out[i] = 1u << (i % 32); break;
+            default: out[i] = ~(1u << (i % 32)); break;
+        }
+        out[i] ^= ramAddr + i * 4;
+    }
+
+    int rc = writeBlockViaAP(ramAddr, out, words);
+    if (rc == 0)
+        rc = readBlockViaAP(ramAddr, in, words);
+    if (rc == 0) {
+        for (unsigned i = 0; i < words; i++)
+            if (in[i] != out[i]) {
+                rc = ERR_PARITY;
+                break;
+            }
+    }
+    // A parity error that got retried by a higher level still counts
+    if (rc == 0 &&
+        (_counters.parityErrors != before.parityErrors ||
+         _counters.protocolErrors != before.protocolErrors))
+        rc = ERR_PARITY;
+    return rc;
+}
+
+int PioSWDDriver::trainClock(uint32_t ramAddr, unsigned maxHz, unsigned words) {
+
+    // Past this the divider is pinned at 1 and a step is the same rate
+    // as the one before
+    const unsigned topHz = _achievedHz(1.0f);
+    int best = -1;
+    for (unsigned i = 0; i < CLOCK_STEP_COUNT && CLOCK_STEPS_HZ[i] <= maxHz && 
+        CLOCK_STEPS_HZ[i] <= topHz; i++) {
+        setClockHz(CLOCK_STEPS_HZ[i]);
+        // Hammer each rate a few times since marginal links fail 
+        // intermittently
+        bool good = true;
+        for (unsigned pass = 0; pass < 4 && good; pass++)
+            good = _stressTest(ramAddr, words) == 0;
+        if (!good)
+            break;
+        best = i;
+    }
+
+    if (best < 0) {
+        setClockHz(CLOCK_STEPS_HZ[0]);
+        _recoverLine();
+        return ERR_PARITY;
+    }
+
+    // Margin: back off one step from the fastest rate that worked
+    if (best > 0)
+        best--;
+    setClockHz(CLOCK_STEPS_HZ[best]);
+    _backoffStart = _counters;
+    _trained = true;
+    return _recoverLine();
+}
+
+void PioSWDDriver::_checkErrorRate() {
+    // An untrained clock is whatever the caller asked for, and isn't 
+    // second-guessed
+    if (!_trained)
+        return;
+    const unsigned packets = _counters.packets - _backoffStart.packets;
+    if (packets < BACKOFF_WINDOW)
+        return;
+    // Errors on the wire say the link is marginal after a few. WAITs 
+    // are also the normal response while the target bus is stalled, and
+    // a FAULT can be a well-formed answer to a bad access, so those only
+    // count when they make up a good part of the window.
+    const unsigned errors = 
+        (_counters.parityErrors - _backoffStart.parityErrors) +
+        (_counters.protocolErrors - _backoffStart.protocolErrors);
+    const unsigned stalls = 
+        (_counters.waits - _backoffStart.waits) +
+        (_counters.faults - _backoffStart.faults);
+    if (errors >= BACKOFF_ERRORS || stalls >= BACKOFF_STALLS) {
+        // Step down to the next slower rate
+        for (int i = CLOCK_STEP_COUNT - 1; i >= 0; i--) {
+            if (CLOCK_STEPS_HZ[i] < _clockHz) {
+                setClockHz(CLOCK_STEPS_HZ[i]);
+                _counters.clockBackoffs++;
+                break;
+            }
+        }
+    }
+    _backoffStart = _counters;
+}
+
+}
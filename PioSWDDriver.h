@@ -0,0 +1,481 @@
+/**
+ * An SWD driver that uses a PIO state machine to generate the wire
+ * protocol. The CPU only pushes command/data words into the PIO FIFO
+ * and pulls the sampled bits back out.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "hardware/pio.h"
+
+#include "SWDProtocol.h"
+
+namespace kc1fsz {
+
+class PioSWDDriver {
+public:
+
+    // ----- DP registers (A[3:2]) -----
+    static constexpr uint8_t DP_DPIDR = swd::DPIDR;
+    static constexpr uint8_t DP_ABORT = swd::ABORT;
+    static constexpr uint8_t DP_CTRL_STAT = swd::CTRL_STAT;
+    static constexpr uint8_t DP_SELECT = swd::SELECT;
+    static constexpr uint8_t DP_RDBUFF = swd::RDBUFF;
+    static constexpr uint8_t DP_TARGETSEL = swd::TARGETSEL;
+
+    // ----- MEM-AP registers (bank in the upper nibble) -----
+    static constexpr uint8_t AP_CSW = swd::CSW;
+    static constexpr uint8_t AP_TAR = swd::TAR;
+    static constexpr uint8_t AP_DRW = swd::DRW;
+    static constexpr uint8_t AP_IDR = swd::IDR;
+
+    // ----- Cortex-M debug registers -----
+    static constexpr uint32_t ARM_AIRCR = 0xe000ed0c;
+    static constexpr uint32_t ARM_DHCSR = 0xe000edf0;
+    static constexpr uint32_t ARM_DCRSR = 0xe000edf4;
+    static constexpr uint32_t ARM_DCRDR = 0xe000edf8;
+    static constexpr uint32_t ARM_DEMCR = 0xe000edfc;
+    // ARMv8-M with the Security Extension only
+    static constexpr uint32_t ARM_DSCSR = 0xe000ee08;
+
+    // ----- Core registers (DCRSR.REGSEL) -----
+    static constexpr unsigned REG_R0 = 0;
+    static constexpr unsigned REG_R7 = 7;
+    static constexpr unsigned REG_SP = 13;
+    static constexpr unsigned REG_LR = 14;
+    // DebugReturnAddress
+    static constexpr unsigned REG_PC = 15;
+    static constexpr unsigned REG_XPSR = 16;
+    static constexpr unsigned REG_MSP = 17;
+    static constexpr unsigned REG_PSP = 18;
+    // CONTROL[31:24], FAULTMASK[23:16], BASEPRI[15:8], PRIMASK[7:0]
+    static constexpr unsigned REG_CONTROL = 20;
+    static constexpr unsigned CORE_REG_COUNT = 21;
+    // r0-r12, SP, LR, PC, xPSR, MSP, PSP and CONTROL/PRIMASK
+    static constexpr uint32_t CORE_REGS_ALL = 0x0017ffff;
+    // r4-r11, SP and xPSR: left alone by an AAPCS function (other than
+    // the condition flags) called through caller.s
+    static constexpr uint32_t CORE_REGS_PRESERVED = 0x00012ff0;
+
+    // Multi-drop TARGETSEL values for the two RP2040 cores
+    static constexpr uint32_t RP2040_CORE0 = 0x01002927;
+    static constexpr uint32_t RP2040_CORE1 = 0x11002927;
+    // The RP2350 has one DP for both cores, each with its own AP
+    static constexpr uint32_t RP2350_DP = 0x00040927;
+    static constexpr uint32_t RP2350_CORE0_AP = 0x00002000;
+    static constexpr uint32_t RP2350_CORE1_AP = 0x00004000;
+
+    // Return codes. Zero is always success.
+    static constexpr int ERR_WAIT = 1;
+    static constexpr int ERR_FAULT = 2;
+    static constexpr int ERR_PROTOCOL = 3;
+    static constexpr int ERR_PARITY = 4;
+    static constexpr int ERR_TIMEOUT = 5;
+
+    static constexpr unsigned DEFAULT_CLOCK_HZ = 1000000;
+
+    // Maximum number of deferred transactions held before an implicit flush
+    static constexpr unsigned QUEUE_SIZE = 64;
+
+    /**
+     * Controls how WAIT responses are retried.
+     */
+    struct WaitPolicy {
+        unsigned maxRetries = 100;
+        // Zero spins (retries immediately). Otherwise this is the first 
+        // delay between retries, doubled each time up to maxDelayUs.
+        unsigned delayUs = 0;
+        unsigned maxDelayUs = 1000;
+    };
+
+    /**
+     * WAIT statistics for one call site.
+     */
+    struct WaitStats {
+        static constexpr unsigned BUCKETS = 8;
+        // Transfers attempted 
+        uint32_t transfers = 0;
+        // Transfers that got at least one WAIT
+        uint32_t stalled = 0;
+        // Total WAIT responses
+        uint32_t waits = 0;
+        // Time from the first WAIT to the end of the transfer, summed
+        uint32_t stallUs = 0;
+        // Stalled transfers that ran out of retries
+        uint32_t exhausted = 0;
+        // Stalled transfers by number of WAITs: [0] = 1, [1] = 2-3, 
+        // [2] = 4-7 ... the last bucket catches everything longer.
+        uint32_t histogram[BUCKETS] = { };
+    };
+
+    /**
+     * Attributes WAIT statistics to a call site and (optionally) applies
+     * a different retry policy for as long as the scope lives.
+     */
+    class WaitScope {
+    public:
+        WaitScope(PioSWDDriver& swd, WaitStats& stats, const WaitPolicy& policy);
+        ~WaitScope();
+    private:
+        PioSWDDriver& _swd;
+        WaitStats* const _savedStats;
+        const WaitPolicy _savedPolicy;
+    };
+
+    // Most words written/read per clock training pass
+    static constexpr unsigned STRESS_WORDS = 64;
+
+    /**
+     * Running totals of what has gone out on the wire. 
+     */
+    struct Counters {
+        // Packets actually sent, including retries
+        uint32_t packets = 0;
+        uint32_t waits = 0;
+        uint32_t faults = 0;
+        uint32_t protocolErrors = 0;
+        uint32_t parityErrors = 0;
+        // Streamed chunks that had to be replayed
+        uint32_t overruns = 0;
+        // Automatic SWCLK reductions made at runtime
+        uint32_t clockBackoffs = 0;
+        // Writes dropped because the shadow copy showed no change
+        uint32_t skippedSelect = 0;
+        uint32_t skippedCsw = 0;
+        uint32_t skippedTar = 0;
+    };
+
+    /**
+     * A snapshot of core registers, indexed by DCRSR.REGSEL. Only the
+     * registers in the mask were read.
+     */
+    struct CoreRegisters {
+        uint32_t mask = 0;
+        uint32_t r[CORE_REG_COUNT] = { };
+    };
+
+    /**
+     * @param pio The PIO block that will run the SWD program.
+     * @param sm The state machine within that block.
+     */
+    PioSWDDriver(unsigned clkPin, unsigned dioPin, PIO pio = pio0, unsigned sm = 0);
+
+    /**
+     * Loads the PIO program and takes over the CLK/DIO pins.
+     */
+    void init(unsigned clockHz = DEFAULT_CLOCK_HZ);
+
+    /**
+     * Wakes the SW-DP out of dormant state, selects the target, powers
+     * up the debug domain and reads the AP ID.
+     *
+     * @param apAddr The MEM-AP that all of the AP accesses go to. On an 
+     *   ADIv5 DP (DPIDR.VERSION up to 2) this is the APSEL number, on an
+     *   ADIv6 DP the AP's base address. Which one applies is worked out
+     *   from DPIDR.
+     * @returns 0 on success.
+     */
+    int connect(uint32_t targetSel = RP2040_CORE0, uint32_t apAddr = 0);
+
+    /**
+     * Changes the SWCLK rate. This is safe to call between transactions.
+     */
+    void setClockHz(unsigned hz);
+    /**
+     * @returns The rate the PIO divider actually gives, which can be 
+     *   below the one asked for and is never above a quarter of the 
+     *   system clock.
+     */
+    unsigned getClockHz() const { return _clockHz; }
+
+    /**
+     * Steps SWCLK up through a table of rates, running a write/read-back
+     * pattern against target RAM at each one, and settles one step below 
+     * the fastest rate that produced no errors at all. Steps that the
+     * PIO can't reach from the system clock are skipped.
+     *
+     * Once trained, the driver also drops a step on its own if parity 
+     * errors or missing/garbled ACKs (protocol errors) start to show up,
+     * or if WAIT and FAULT responses make up a quarter of the packets.
+     * Until trainClock() has succeeded the clock is left alone.
+     *
+     * @param ramAddr Scratch target RAM that can be overwritten.
+     * @returns 0 on success.
+     */
+    int trainClock(uint32_t ramAddr, unsigned maxHz = 25000000, unsigned words = STRESS_WORDS);
+
+    /**
+     * The policy used outside of any WaitScope.
+     */
+    void setWaitPolicy(const WaitPolicy& policy) { _waitPolicy = policy; }
+    const WaitPolicy& getWaitPolicy() const { return _waitPolicy; }
+    /**
+     * Statistics for everything outside of a WaitScope.
+     */
+    const WaitStats& getWaitStats() const { return _defaultWaitStats; }
+    /**
+     * Statistics for the DHCSR reads made by pollREGRDY().
+     */
+    const WaitStats& getREGRDYWaitStats() const { return _regRdyStats; }
+
+    uint32_t getIDCODE() const { return _idcode; }
+    /**
+     * @returns The DP's TARGETID, or 0 if the DP is older than DPv2.
+     */
+    uint32_t getTARGETID() const { return _targetId; }
+    uint32_t getAPID() const { return _apid; }
+
+    const Counters& getCounters() const { return _counters; }
+    void resetCounters() { _counters = Counters(); _backoffStart = _counters; }
+
+    std::optional<uint32_t> readDP(uint8_t addr);
+    int writeDP(uint8_t addr, uint32_t data);
+
+    /**
+     * Register access by descriptor, e.g. read<swd::DPReg<swd::CTRL_STAT>>().
+     * The request headers (and for an AP register, the SELECT bank) are 
+     * all fixed at compile time.
+     */
+    template<typename R> std::optional<uint32_t> read() {
+        uint32_t data = 0;
+        queueRead<R>(&data);
+        if (flush() != 0)
+            return std::nullopt;
+        return data;
+    }
+
+    template<typename R> int write(uint32_t data) {
+        queueWrite<R>(data);
+        return flush();
+    }
+
+    /**
+     * Reads an AP register. The upper nibble of the address selects the
+     * AP register bank. The posted result is collected from RDBUFF.
+     */
+    std::optional<uint32_t> readAP(uint8_t addr);
+    int writeAP(uint8_t addr, uint32_t data);
+
+    std::optional<uint32_t> readWordViaAP(uint32_t addr);
+    int writeWordViaAP(uint32_t addr, uint32_t data);
+
+    /**
+     * Moves a block of words through the MEM-AP. CSW is switched to 
+     * single auto-increment for the duration of the block so each word 
+     * costs one DRW transfer. TAR is only rewritten at 1K boundaries since 
+     * that is as far as auto-increment is guaranteed to go (ADIv5 C2.2.2).
+     *
+     * @param addr Word-aligned target address.
+     */
+    int readBlockViaAP(uint32_t addr, uint32_t* data, unsigned count);
+    int writeBlockViaAP(uint32_t addr, const uint32_t* data, unsigned count);
+
+    /**
+     * When enabled, writeBlockViaAP() turns on CTRL/STAT.ORUNDETECT and 
+     * sends the DRW writes back-to-back without looking at the ACKs. The
+     * sticky flags are checked at the end of each 1K chunk and a chunk
+     * that hit an overrun or error is replayed from its start.
+     */
+    void setStreamingWrites(bool on) { _streamingWrites = on; }
+
+    /**
+     * Waits for DHCSR.S_REGRDY after a DCRSR write.
+     */
+    int pollREGRDY(unsigned attempts = 100);
+
+    /**
+     * Reads a set of core registers in one queued batch. The core must be
+     * halted. 
+     *
+     * The first call runs the fast path's own sequence, a DCRSR write 
+     * with the DCRDR read right behind it, against a register whose value
+     * was read the slow way and with something else left in DCRDR. If 
+     * the fast read always gets the real value (the register transfer 
+     * takes a few core clocks, a packet takes dozens of SWCLKs) REGRDY 
+     * isn't polled at all. Otherwise each register goes through 
+     * pollREGRDY(). The check is repeated whenever the clock changes.
+     *
+     * @param mask Bit n selects register n (see REG_*).
+     */
+    std::optional<CoreRegisters> readCoreRegisters(uint32_t mask = CORE_REGS_ALL);
+
+    /**
+     * Writes the registers in regs.mask in one queued batch and checks
+     * S_REGRDY once at the end. The core must be halted. Uses the same
+     * REGRDY latency check as readCoreRegisters(), which also runs the 
+     * write sequence (a DCRSR write with the next DCRDR write right 
+     * behind it) and only lets the batch through if PC survives it. 
+     * Otherwise S_REGRDY is polled after every register.
+     *
+     * @param minimal Skip any of CORE_REGS_PRESERVED that still hold the 
+     *   value last written here. Only safe when the core has run nothing
+     *   but an AAPCS function (e.g. through the caller.s trampoline) since
+     *   the last call.
+     * @returns 0 on success.
+     */
+    int writeCoreRegisters(const CoreRegisters& regs, bool minimal = false);
+
+    // ----- Deferred transactions --------------------------------------------
+    //
+    // The queue* calls only record a transaction. Nothing goes out on the
+    // wire until flush() is called, at which point the whole queue is run
+    // back-to-back. Read results are written through the pointer passed
+    // at queue time, so the pointed-to location must stay valid until the 
+    // flush. A queue that fills up is flushed implicitly and any error is
+    // held and reported by the next explicit flush().
+
+    void queueReadDP(uint8_t addr, uint32_t* result);
+    void queueWriteDP(uint8_t addr, uint32_t data);
+    void queueReadAP(uint8_t addr, uint32_t* result);
+    void queueWriteAP(uint8_t addr, uint32_t data);
+    void queueReadWordViaAP(uint32_t addr, uint32_t* result);
+    void queueWriteWordViaAP(uint32_t addr, uint32_t data);
+
+    template<typename R> void queueRead(uint32_t* result) {
+        if constexpr (R::ap)
+            _queue(SELECT_WRITE, swd::SELECT, _apSelect | R::bank, nullptr);
+        _queue(R::readHeader, R::addr, 0, result);
+    }
+
+    template<typename R> void queueWrite(uint32_t data) {
+        if constexpr (R::ap)
+            _queue(SELECT_WRITE, swd::SELECT, _apSelect | R::bank, nullptr);
+        _queue(R::writeHeader, R::addr, data, nullptr);
+    }
+
+    /**
+     * Runs all of the queued transactions. Processing stops at the first 
+     * failure and the rest of the queue is discarded. Runs of consecutive 
+     * AP reads are pipelined so that only the last one needs an RDBUFF read.
+     *
+     * @returns 0 on success, otherwise the code of the first failure.
+     */
+    int flush();
+
+private:
+
+    // The headers used on the hot paths
+    static constexpr uint8_t SELECT_WRITE = swd::DPReg<swd::SELECT>::writeHeader;
+    static constexpr uint8_t RDBUFF_READ = swd::DPReg<swd::RDBUFF>::readHeader;
+    static constexpr uint8_t CSW_WRITE = swd::APReg<swd::CSW>::writeHeader;
+    static constexpr uint8_t TAR_WRITE = swd::APReg<swd::TAR>::writeHeader;
+    static constexpr uint8_t DRW_READ = swd::APReg<swd::DRW>::readHeader;
+    static constexpr uint8_t DRW_WRITE = swd::APReg<swd::DRW>::writeHeader;
+
+    struct Op {
+        // The complete request header, ready to go on the wire
+        uint8_t header;
+        // The full register address, including the AP bank
+        uint8_t addr;
+        uint32_t data;
+        uint32_t* result;
+
+        bool ap() const { return swd::isAP(header); }
+        bool read() const { return swd::isRead(header); }
+    };
+
+    void _queue(uint8_t header, uint8_t addr, uint32_t data, uint32_t* result);
+
+    /**
+     * @returns true if the operation is a write that would leave SELECT, 
+     *   CSW or TAR unchanged.
+     */
+    bool _isRedundant(const Op& op);
+    /**
+     * Updates the shadow registers after an operation has completed.
+     */
+    void _shadow(const Op& op);
+    void _invalidateShadows();
+
+    /**
+     * Runs one complete SWD packet. WAIT responses are retried according
+     * to the current WaitPolicy.
+     *
+     * @param data For writes, the value to send. For reads, where the
+     *   result is stored.
+     */
+    int _transfer(uint8_t header, uint32_t* data);
+    /**
+     * Runs one packet without any retries.
+     */
+    int _transferOnce(uint8_t header, uint32_t* data);
+
+    /**
+     * Sends a write packet without looking at the ACK. This is only 
+     * safe for TARGETSEL or when overrun detection is enabled.
+     */
+    void _transferBlind(uint8_t header, uint32_t data);
+    int _streamBlockViaAP(uint32_t addr, const uint32_t* data, unsigned count);
+
+    void _writeBits(uint32_t data, unsigned count);
+    uint32_t _readBits(unsigned count);
+    void _turnaround(unsigned count);
+    void _lineReset();
+    void _writeTargetSel(uint32_t targetSel);
+    int _clearStickyErrors();
+
+    uint32_t _cmd(unsigned entry, unsigned count, bool output) const;
+    static float _clkdiv(unsigned hz);
+    static unsigned _achievedHz(float div);
+
+    /**
+     * Line reset, TARGETSEL and DPIDR read to get back in step with the 
+     * target after a protocol error.
+     */
+    int _recoverLine();
+    int _stressTest(uint32_t ramAddr, unsigned words);
+    int _checkREGRDYLatency();
+    void _checkErrorRate();
+
+    const unsigned _clkPin;
+    const unsigned _dioPin;
+    const PIO _pio;
+    const unsigned _sm;
+    unsigned _offset = 0;
+
+    unsigned _clockHz = DEFAULT_CLOCK_HZ;
+    uint32_t _targetSel = RP2040_CORE0;
+    uint32_t _idcode = 0;
+    uint32_t _targetId = 0;
+    uint32_t _apid = 0;
+    // The part of SELECT that picks the AP, or'ed into every bank select
+    uint32_t _apSelect = 0;
+
+    Op _queueOps[QUEUE_SIZE];
+    unsigned _queueLen = 0;
+    int _queueError = 0;
+
+    // Shadow copies of DP SELECT, AP CSW and AP TAR
+    bool _selectValid = false;
+    uint32_t _select = 0;
+    bool _cswValid = false;
+    uint32_t _csw = 0;
+    bool _tarValid = false;
+    uint32_t _tar = 0;
+
+    Counters _counters;
+    // Counters at the start of the current back-off window
+    Counters _backoffStart;
+    // trainClock() has picked the rate, so runtime back-off is on
+    bool _trained = false;
+
+    bool _streamingWrites = false;
+    bool _orunDetect = false;
+
+    WaitPolicy _waitPolicy;
+    WaitStats _defaultWaitStats;
+    WaitStats _regRdyStats;
+    WaitStats* _waitStats = &_defaultWaitStats;
+
+    bool _regRdyChecked = false;
+    // S_REGRDY has always been set by the time the next packet arrives
+    bool _regRdyImmediate = false;
+    // What writeCoreRegisters() last put into each register
+    CoreRegisters _lastWritten;
+};
+
+}
@@ -0,0 +1,101 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstring>
+
+#include "pico/stdlib.h"
+
+#include "RomCallBatch.h"
+
+// caller-batch.s, assembled
+#include "caller-batch-bin.h"
+
+namespace kc1fsz {
+
+// DBGKEY plus C_DEBUGEN
+static const uint32_t DHCSR_RUN = 0xa05f0001;
+static const uint32_t DHCSR_S_HALT = 0x00020000;
+
+static const unsigned CODE_WORDS = 10;
+static_assert(sizeof(caller_batch_bin) <= CODE_WORDS * 4);
+
+// The trampoline and a full table, as it goes over the wire
+static uint32_t image[CODE_WORDS + RomCallBatch::MAX_CALLS * RomCallBatch::ENTRY_SIZE / 4];
+
+RomCallBatch::RomCallBatch(uint32_t codeAddr, uint32_t stackTop)
+:   _codeAddr(codeAddr),
+    _stackTop(stackTop) {
+}
+
+bool RomCallBatch::add(uint32_t func, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3) {
+    if (_count == MAX_CALLS)
+        return false;
+    uint32_t* e = _entries[_count++];
+    e[0] = func;
+    e[1] = r0;
+    e[2] = r1;
+    e[3] = r2;
+    e[4] = r3;
+    e[5] = 0;
+    return true;
+}
+
+int RomCallBatch::run(PioSWDDriver& swd, uint32_t timeoutUs) {
+
+    _made = 0;
+    const uint32_t tableAddr = _codeAddr + CODE_WORDS * 4;
+    const unsigned tableWords = _count * ENTRY_SIZE / 4;
+
+    memset(image, 0, CODE_WORDS * 4);
+    memcpy(image, caller_batch_bin, caller_batch_bin_len);
+    memcpy(image + CODE_WORDS, _entries, tableWords * 4);
+    if (const int rc = swd.writeBlockViaAP(_codeAddr, image, CODE_WORDS + tableWords); rc != 0)
+        return rc;
+
+    // The trampoline finds the table in r4, the count in r5 and whether
+    // to stop on a failure in r8
+    PioSWDDriver::CoreRegisters regs;
+    regs.mask = (1 << (PioSWDDriver::REG_R0 + 4)) | (1 << (PioSWDDriver::REG_R0 + 5)) |
+        (1 << (PioSWDDriver::REG_R0 + 8)) | (1 << PioSWDDriver::REG_SP) | 
+        (1 << PioSWDDriver::REG_PC) | (1 << PioSWDDriver::REG_XPSR);
+    regs.r[PioSWDDriver::REG_R0 + 4] = tableAddr;
+    regs.r[PioSWDDriver::REG_R0 + 5] = _count;
+    regs.r[PioSWDDriver::REG_R0 + 8] = _stopOnFailure ? 1 : 0;
+    regs.r[PioSWDDriver::REG_SP] = _stackTop;
+    regs.r[PioSWDDriver::REG_PC] = _codeAddr;
+    // Thumb
+    regs.r[PioSWDDriver::REG_XPSR] = 0x01000000;
+    if (const int rc = swd.writeCoreRegisters(regs); rc != 0)
+        return rc;
+
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DHCSR, DHCSR_RUN); rc != 0)
+        return rc;
+    // Wait for the BKPT
+    const uint32_t start = time_us_32();
+    while (true) {
+        if (const auto r = swd.readWordViaAP(PioSWDDriver::ARM_DHCSR); !r.has_value())
+            return -1;
+        else if (*r & DHCSR_S_HALT)
+            break;
+        if (time_us_32() - start > timeoutUs)
+            return PioSWDDriver::ERR_TIMEOUT;
+    }
+
+    if (const int rc = swd.readBlockViaAP(tableAddr, &_entries[0][0], tableWords); rc != 0)
+        return rc;
+
+    // The trampoline stops straight after the failure, so there is no
+    // need to ask it how far it got
+    _made = _count;
+    if (_stopOnFailure) {
+        for (unsigned i = 0; i < _count; i++) {
+            if ((int32_t)_entries[i][5] < 0) {
+                _made = i + 1;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,80 @@
+/**
+ * Runs a batch of target function calls in one resume.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "PioSWDDriver.h"
+
+namespace kc1fsz {
+
+/**
+ * Builds a table of calls ({func, r0-r3}) and hands it to the
+ * caller-batch.s trampoline, which makes all of the calls and halts once
+ * at the end. The trampoline and the table go over in one block write
+ * and the results come back in one block read, so a batch costs a single
+ * halt/resume round trip however many calls it holds.
+ */
+class RomCallBatch {
+public:
+
+    static constexpr unsigned MAX_CALLS = 16;
+    // Table entry size, matching caller-batch.s
+    static constexpr uint32_t ENTRY_SIZE = 24;
+
+    /**
+     * @param codeAddr Target RAM for the trampoline, immediately
+     *   followed by the table.
+     * @param stackTop Initial SP for the calls.
+     */
+    RomCallBatch(uint32_t codeAddr, uint32_t stackTop);
+
+    void clear() { _count = 0; _made = 0; }
+    unsigned size() const { return _count; }
+
+    /**
+     * @returns false if the batch is full.
+     */
+    bool add(uint32_t func, uint32_t r0 = 0, uint32_t r1 = 0, uint32_t r2 = 0, uint32_t r3 = 0);
+
+    /**
+     * When set, a call that returns a negative value ends the batch and
+     * the calls after it are not made. Only for batches of functions
+     * that return a status, such as the RP2350 ROM's.
+     */
+    void setStopOnFailure(bool on) { _stopOnFailure = on; }
+
+    /**
+     * Loads the trampoline and the table, makes all of the calls and
+     * collects the results. The core must be halted and is left halted.
+     *
+     * @returns 0 on success.
+     */
+    int run(PioSWDDriver& swd, uint32_t timeoutUs = 1000000);
+
+    /**
+     * The r0 returned by call i of the last run().
+     */
+    uint32_t result(unsigned i) const { return _entries[i][5]; }
+
+    /**
+     * The number of calls the last run() made, which is less than size()
+     * only if it stopped on a failure.
+     */
+    unsigned made() const { return _made; }
+
+private:
+
+    const uint32_t _codeAddr;
+    const uint32_t _stackTop;
+    unsigned _count = 0;
+    bool _stopOnFailure = false;
+    unsigned _made = 0;
+    // Function, r0-r3, result
+    uint32_t _entries[MAX_CALLS][ENTRY_SIZE / 4];
+};
+
+}
@@ -0,0 +1,201 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+
+#include "RomTable.h"
+#include "Chip.h"
+
+namespace kc1fsz {
+
+// 'ROMT'
+static const uint32_t TABLE_MAGIC = 0x544d4f52;
+// The last sector of the programmer's own flash
+static const uint32_t PERSIST_OFFSET = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+// Enough words for a full table starting on an odd halfword
+static const unsigned TABLE_WORDS = RomTable::MAX_ENTRIES + 2;
+// The RP2350 table, with its extra halfwords, is read up to this much
+// at a time without running off the end of the 32K ROM
+static const unsigned FLAGGED_TABLE_WORDS = 192;
+static const uint32_t RP2350_ROM_SIZE = 0x8000;
+// Each persisted copy, padded out to whole pages
+static const unsigned PERSIST_SIZE = (sizeof(RomTable::Table) + FLASH_PAGE_SIZE - 1) &
+    ~(FLASH_PAGE_SIZE - 1);
+static_assert(RomTable::SLOTS * PERSIST_SIZE <= FLASH_SECTOR_SIZE);
+// How long the other core gets to park itself before the write is 
+// given up on
+static const uint32_t PERSIST_TIMEOUT_MS = 100;
+
+RomTable::Table RomTable::_cache[RomTable::SLOTS];
+bool RomTable::_cacheValid[RomTable::SLOTS] = { };
+unsigned RomTable::_walks = 0;
+unsigned RomTable::_persists = 0;
+
+/**
+ * The cache slot for a chip. Anything that isn't an RP2350 shares the
+ * RP2040's, where it at least can't push the RP2350's table out.
+ */
+static unsigned slotFor(uint32_t chipId) {
+    return Chip::forChipId(chipId) == &Chip::RP2350 ? 1 : 0;
+}
+
+static const RomTable::Table* persisted(unsigned slot) {
+    return (const RomTable::Table*)(uintptr_t)(XIP_BASE + PERSIST_OFFSET + slot * PERSIST_SIZE);
+}
+
+std::optional<uint32_t> RomTable::Table::find(char c1, char c2) const {
+    const uint16_t code = c1 | (c2 << 8);
+    for (unsigned i = 0; i < count; i++)
+        if (entries[i].code == code)
+            return entries[i].addr;
+    return std::nullopt;
+}
+
+const RomTable::Table* RomTable::get(PioSWDDriver& swd) {
+
+    uint32_t chipId = 0, romMagic = 0;
+    swd.queueReadWordViaAP(Chip::CHIP_ID_ADDR, &chipId);
+    swd.queueReadWordViaAP(ROM_MAGIC_ADDR, &romMagic);
+    if (swd.flush() != 0)
+        return nullptr;
+
+    const unsigned slot = slotFor(chipId);
+    Table& cache = _cache[slot];
+    if (_cacheValid[slot] && cache.chipId == chipId && cache.romMagic == romMagic)
+        return &cache;
+
+    const Table* saved = persisted(slot);
+    if (saved->magic == TABLE_MAGIC && saved->chipId == chipId &&
+        saved->romMagic == romMagic && saved->count <= MAX_ENTRIES) {
+        cache = *saved;
+        _cacheValid[slot] = true;
+        return &cache;
+    }
+
+    _cacheValid[slot] = false;
+    cache.magic = TABLE_MAGIC;
+    cache.chipId = chipId;
+    cache.romMagic = romMagic;
+    if (_read(swd, &cache) != 0)
+        return nullptr;
+    _cacheValid[slot] = true;
+    _persist(slot, cache);
+    return &cache;
+}
+
+std::optional<uint32_t> RomTable::lookup(PioSWDDriver& swd, char c1, char c2) {
+    if (const Table* t = get(swd); t == nullptr)
+        return std::nullopt;
+    else
+        return t->find(c1, c2);
+}
+
+int RomTable::_read(PioSWDDriver& swd, Table* table) {
+
+    _walks++;
+
+    uint32_t ptr = 0;
+    if (const auto r = swd.readWordViaAP(FUNC_TABLE_PTR); !r.has_value())
+        return -1;
+    else
+        ptr = *r & 0xffff;
+
+    if (((table->romMagic >> 16) & 0xff) == FORMAT_RP2350)
+        return _readFlagged(swd, ptr, table);
+
+    // The table is a list of (code, address) halfword pairs ending with
+    // a zero code, so it is read in one go and taken apart here
+    uint32_t words[TABLE_WORDS];
+    if (const int rc = swd.readBlockViaAP(ptr & ~3, words, TABLE_WORDS); rc != 0)
+        return rc;
+    const uint8_t* p = (const uint8_t*)words + (ptr & 3);
+
+    table->count = 0;
+    while (true) {
+        if (table->count == MAX_ENTRIES)
+            return -1;
+        Entry& e = table->entries[table->count];
+        e.code = p[0] | (p[1] << 8);
+        e.addr = p[2] | (p[3] << 8);
+        if (e.code == 0)
+            return 0;
+        table->count++;
+        p += 4;
+    }
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+int RomTable::_readFlagged(PioSWDDriver& swd, uint32_t ptr, Table* table) {
+
+    // Too big for the stack
+    static uint32_t words[FLAGGED_TABLE_WORDS];
+    const uint32_t base = ptr & ~3;
+    if (base >= RP2350_ROM_SIZE)
+        return -1;
+    const unsigned count = std::min(FLAGGED_TABLE_WORDS, (unsigned)(RP2350_ROM_SIZE - base) / 4);
+    if (const int rc = swd.readBlockViaAP(base, words, count); rc != 0)
+        return rc;
+    const uint8_t* p = (const uint8_t*)words + (ptr & 3);
+    const uint8_t* end = (const uint8_t*)words + count * 4;
+
+    // Each entry is a code, its flags and then one halfword for each 
+    // flag that is set, lowest flag first. A zero code ends the table.
+    table->count = 0;
+    while (true) {
+        if (p + 2 > end)
+            return -1;
+        const uint16_t code = get16(p);
+        if (code == 0)
+            return 0;
+        if (p + 4 > end)
+            return -1;
+        const uint16_t flags = get16(p + 2);
+        const uint8_t* values = p + 4;
+        p = values + 2 * __builtin_popcount(flags);
+        if (p > end)
+            return -1;
+        if (!(flags & FLAG_FUNC_ARM_SEC))
+            continue;
+        if (table->count == MAX_ENTRIES)
+            return -1;
+        Entry& e = table->entries[table->count++];
+        e.code = code;
+        e.addr = get16(values + 2 * __builtin_popcount(flags & (FLAG_FUNC_ARM_SEC - 1)));
+    }
+}
+
+// Runs with XIP unavailable, see _persist()
+static void writePersisted(void* pages) {
+    flash_range_erase(PERSIST_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(PERSIST_OFFSET, (const uint8_t*)pages, RomTable::SLOTS * PERSIST_SIZE);
+}
+
+void RomTable::_persist(unsigned slot, const Table& table) {
+
+    // The erase takes the other slots with it, so they go back as they 
+    // were
+    static uint8_t pages[SLOTS * PERSIST_SIZE];
+    memcpy(pages, persisted(0), sizeof(pages));
+    memset(pages + slot * PERSIST_SIZE, 0xff, PERSIST_SIZE);
+    memcpy(pages + slot * PERSIST_SIZE, &table, sizeof(table));
+
+    // Nothing may run from flash on either core while it is being 
+    // written. flash_safe_execute() disables interrupts and, if the 
+    // other core is running, parks it in RAM first. That only works if
+    // the other core has called flash_safe_execute_core_init(); when 
+    // it hasn't, the write is refused rather than risked, and since 
+    // this copy is only a cache the table is simply read again on the 
+    // next boot.
+    if (flash_safe_execute(writePersisted, pages, PERSIST_TIMEOUT_MS) == 0)
+        _persists++;
+}
+
+}
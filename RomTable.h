@@ -0,0 +1,104 @@
+/**
+ * A cache of the target's boot ROM function table.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "PioSWDDriver.h"
+
+namespace kc1fsz {
+
+/**
+ * The RP2040 table is a list of (code, address) pairs. The RP2350 one 
+ * has a flags halfword in each entry, saying which of the ARM Secure, 
+ * ARM Non-secure and RISC-V entry points (and data) follow, and only
+ * the ARM Secure functions are kept from it since that is the state 
+ * the programmer runs the target core in. Either way the table ends up
+ * as (code, address) pairs.
+ *
+ * The whole function table is fetched with one block read and kept,
+ * keyed by the target's CHIP_ID and boot ROM version, both in RAM for
+ * the rest of the session and in the last sector of the programmer's
+ * own flash. There is one slot for each kind of chip, so going back and
+ * forth between them doesn't rewrite the flash. A later connect to the
+ * same kind of chip only has to read those two words. The flash copy is written through flash_safe_execute(),
+ * so a program that runs anything on core 1 has to call 
+ * flash_safe_execute_core_init() there or the table is never persisted.
+ */
+class RomTable {
+public:
+
+    static constexpr unsigned MAX_ENTRIES = 64;
+    // Cached tables, one for each kind of chip
+    static constexpr unsigned SLOTS = 2;
+
+    // 'M', 'u', the table format and then the version byte
+    static constexpr uint32_t ROM_MAGIC_ADDR = 0x00000010;
+    static constexpr uint8_t FORMAT_RP2040 = 0x01;
+    static constexpr uint8_t FORMAT_RP2350 = 0x02;
+    // Halfword pointer to the function table, in either format
+    static constexpr uint32_t FUNC_TABLE_PTR = 0x00000014;
+    // The RP2350 entry flag for an ARM Secure function
+    static constexpr uint16_t FLAG_FUNC_ARM_SEC = 0x0004;
+
+    struct Entry {
+        uint16_t code;
+        uint16_t addr;
+    };
+
+    struct Table {
+        uint32_t magic;
+        uint32_t chipId;
+        // The word at ROM_MAGIC_ADDR, including the version
+        uint32_t romMagic;
+        uint32_t count;
+        Entry entries[MAX_ENTRIES];
+
+        /**
+         * @returns The address of the function, or nullopt if the ROM
+         *   doesn't have it.
+         */
+        std::optional<uint32_t> find(char c1, char c2) const;
+    };
+
+    /**
+     * Identifies the connected chip and returns its table, walking the
+     * ROM only if neither cache has it.
+     *
+     * @returns nullptr on failure.
+     */
+    static const Table* get(PioSWDDriver& swd);
+
+    /**
+     * Shorthand for get() and find().
+     */
+    static std::optional<uint32_t> lookup(PioSWDDriver& swd, char c1, char c2);
+
+    /**
+     * The number of times the table has been read from a target's ROM
+     * in this session.
+     */
+    static unsigned getWalks() { return _walks; }
+    /**
+     * The number of times the tables have been written to flash in this
+     * session.
+     */
+    static unsigned getPersists() { return _persists; }
+
+private:
+
+    static int _read(PioSWDDriver& swd, Table* table);
+    static int _readFlagged(PioSWDDriver& swd, uint32_t ptr, Table* table);
+    static void _persist(unsigned slot, const Table& table);
+
+    static Table _cache[SLOTS];
+    static bool _cacheValid[SLOTS];
+    static unsigned _walks;
+    static unsigned _persists;
+};
+
+}
@@ -0,0 +1,151 @@
+/**
+ * Compile-time encoding of SWD request headers and parity.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+#include <array>
+
+namespace kc1fsz::swd {
+
+// ----- DP registers (A[3:2]) -----
+enum DPAddr : uint8_t {
+    DPIDR = 0x0,
+    ABORT = 0x0,
+    CTRL_STAT = 0x4,
+    // In DP bank 2 (DPv2 and later)
+    TARGETID = 0x4,
+    SELECT = 0x8,
+    RESEND = 0x8,
+    RDBUFF = 0xc,
+    TARGETSEL = 0xc
+};
+
+// ----- MEM-AP registers (bank in the upper nibble) -----
+enum APAddr : uint8_t {
+    CSW = 0x00,
+    TAR = 0x04,
+    DRW = 0x0c,
+    IDR = 0xfc
+};
+
+// Request header bits, in the order they go out on the wire
+constexpr uint8_t HEADER_START = 0x01;
+constexpr uint8_t HEADER_APNDP = 0x02;
+constexpr uint8_t HEADER_RNW = 0x04;
+constexpr uint8_t HEADER_PARK = 0x80;
+
+/**
+ * Even parity of a 32-bit word. Folds down to a nibble and then uses
+ * 0x6996 as a 16-entry parity lookup, which is cheap on a Cortex-M0+
+ * (no popcount instruction) and works in constant expressions.
+ */
+constexpr bool parity(uint32_t v) {
+    v ^= v >> 16;
+    v ^= v >> 8;
+    v ^= v >> 4;
+    return (0x6996 >> (v & 0xf)) & 1;
+}
+
+static_assert(parity(0x00000000) == false);
+static_assert(parity(0x00000001) == true);
+static_assert(parity(0x80000000) == true);
+static_assert(parity(0xffffffff) == false);
+static_assert(parity(0x01002927) == false);
+static_assert(parity(0x7fffffff) == true);
+
+/**
+ * Start, APnDP, RnW, A[2:3], parity, stop, park.
+ */
+constexpr uint8_t header(bool apNdp, bool read, uint8_t addr) {
+    const uint8_t a2 = (addr >> 2) & 1;
+    const uint8_t a3 = (addr >> 3) & 1;
+    const uint8_t p = (apNdp ? 1 : 0) ^ (read ? 1 : 0) ^ a2 ^ a3;
+    return HEADER_START |
+        (apNdp ? HEADER_APNDP : 0) |
+        (read ? HEADER_RNW : 0) |
+        (a2 << 3) |
+        (a3 << 4) |
+        (p << 5) |
+        HEADER_PARK;
+}
+
+/**
+ * All 16 possible request headers, indexed by APnDP | RnW << 1 | A[3:2] << 2.
+ */
+constexpr std::array<uint8_t, 16> HEADERS = [] {
+    std::array<uint8_t, 16> t { };
+    for (unsigned i = 0; i < 16; i++)
+        t[i] = header(i & 1, i & 2, (i >> 2) << 2);
+    return t;
+}();
+
+constexpr unsigned headerIndex(bool apNdp, bool read, uint8_t addr) {
+    return (apNdp ? 1 : 0) | (read ? 2 : 0) | (addr & 0xc);
+}
+
+constexpr uint8_t lookupHeader(bool apNdp, bool read, uint8_t addr) {
+    return HEADERS[headerIndex(apNdp, read, addr)];
+}
+
+constexpr bool isAP(uint8_t h) { return h & HEADER_APNDP; }
+constexpr bool isRead(uint8_t h) { return h & HEADER_RNW; }
+
+// Well-known headers (ADIv5.2 B4.2)
+static_assert(header(false, true, DPIDR) == 0xa5);
+static_assert(header(false, false, ABORT) == 0x81);
+static_assert(header(false, true, CTRL_STAT) == 0x8d);
+static_assert(header(false, false, SELECT) == 0xb1);
+static_assert(header(false, true, RDBUFF) == 0xbd);
+static_assert(header(false, false, TARGETSEL) == 0x99);
+static_assert(header(true, true, DRW) == 0x9f);
+static_assert(header(true, false, DRW) == 0xbb);
+static_assert(header(true, false, TAR) == 0x8b);
+
+// Every table entry has even parity across bits 1..5 (APnDP, RnW, 
+// A[2:3] and the parity bit itself), a start bit, a zero stop bit and a
+// park bit
+static_assert([] {
+    for (unsigned i = 0; i < 16; i++) {
+        const uint8_t h = HEADERS[i];
+        if (!(h & HEADER_START) || (h & 0x40) || !(h & HEADER_PARK))
+            return false;
+        if (parity((h >> 1) & 0x1f))
+            return false;
+    }
+    return true;
+}());
+
+/**
+ * Describes a DP register. Everything the wire needs is fixed at
+ * compile time.
+ */
+template<DPAddr A> struct DPReg {
+    static constexpr bool ap = false;
+    static constexpr uint8_t addr = A;
+    static constexpr uint8_t readHeader = header(false, true, A);
+    static constexpr uint8_t writeHeader = header(false, false, A);
+};
+
+/**
+ * Describes a MEM-AP register. The bank is the value that has to be in
+ * DP SELECT[7:4] before the register can be reached. On an ADIv6 DP the
+ * rest of SELECT holds the address of the AP, with its MEM-AP registers
+ * at +0xd00, so the bank is the same either way.
+ */
+template<APAddr A> struct APReg {
+    static constexpr bool ap = true;
+    static constexpr uint8_t addr = A;
+    static constexpr uint8_t bank = A & 0xf0;
+    static constexpr uint8_t readHeader = header(true, true, A);
+    static constexpr uint8_t writeHeader = header(true, false, A);
+};
+
+static_assert(DPReg<CTRL_STAT>::readHeader == 0x8d);
+static_assert(APReg<DRW>::readHeader == 0x9f);
+static_assert(APReg<IDR>::bank == 0xf0);
+static_assert(APReg<IDR>::readHeader == header(true, true, 0xc));
+
+}
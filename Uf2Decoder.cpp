@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstring>
+
+#include "Uf2Decoder.h"
+
+namespace kc1fsz {
+
+static const uint32_t MAGIC_START0 = 0x0a324655;
+static const uint32_t MAGIC_START1 = 0x9e5d5157;
+static const uint32_t MAGIC_END = 0x0ab16f30;
+static const uint32_t FLAG_NOT_MAIN_FLASH = 0x00000001;
+static const uint32_t FLAG_FAMILY_ID = 0x00002000;
+static const unsigned PAYLOAD_OFFSET = 32;
+static const unsigned PAGES_PER_SECTOR = FlashLoader::SECTOR_SIZE / FlashLoader::PAGE_SIZE;
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool isSet(const uint32_t* bits, unsigned i) {
+    return (bits[i / 32] & (1u << (i % 32))) != 0;
+}
+
+static void set(uint32_t* bits, unsigned i) {
+    bits[i / 32] |= 1u << (i % 32);
+}
+
+Uf2Decoder::Uf2Decoder(FlashLoader& loader)
+:   _loader(loader) {
+}
+
+void Uf2Decoder::begin(uint32_t familyId) {
+    _familyId = familyId;
+    _numBlocks = 0;
+    _blocks = 0;
+    _skipped = 0;
+    for (Buffer& b : _buffers)
+        b.inUse = false;
+    memset(_seen, 0, sizeof(_seen));
+    memset(_erased, 0, sizeof(_erased));
+}
+
+int Uf2Decoder::put(const uint8_t* block) {
+
+    if (get32(block) != MAGIC_START0 || get32(block + 4) != MAGIC_START1 ||
+        get32(block + BLOCK_SIZE - 4) != MAGIC_END)
+        return ERR_MAGIC;
+
+    const uint32_t flags = get32(block + 8);
+    const uint32_t targetAddr = get32(block + 12);
+    const uint32_t payloadSize = get32(block + 16);
+    const uint32_t blockNo = get32(block + 20);
+    const uint32_t numBlocks = get32(block + 24);
+    const uint32_t familyId = get32(block + 28);
+
+    if ((flags & FLAG_NOT_MAIN_FLASH) || !(flags & FLAG_FAMILY_ID) || familyId != _familyId) {
+        _skipped++;
+        return 0;
+    }
+
+    // The RP2xxx tools always write one whole page per block
+    if (payloadSize != FlashLoader::PAGE_SIZE || numBlocks == 0 || numBlocks > MAX_BLOCKS ||
+        blockNo >= numBlocks || (_numBlocks != 0 && numBlocks != _numBlocks))
+        return ERR_BLOCK;
+    if (targetAddr % FlashLoader::PAGE_SIZE != 0 || targetAddr < FlashLoader::FLASH_XIP_BASE ||
+        targetAddr - FlashLoader::FLASH_XIP_BASE >= FlashLoader::MAX_FLASH_SIZE)
+        return ERR_ADDRESS;
+    _numBlocks = numBlocks;
+
+    // A repeat can't be programmed again
+    if (isSet(_seen, blockNo))
+        return 0;
+    set(_seen, blockNo);
+    _blocks++;
+
+    const uint32_t offset = targetAddr - FlashLoader::FLASH_XIP_BASE;
+    const unsigned sector = offset / FlashLoader::SECTOR_SIZE;
+    const unsigned page = (offset % FlashLoader::SECTOR_SIZE) / FlashLoader::PAGE_SIZE;
+    const uint8_t* payload = block + PAYLOAD_OFFSET;
+
+    // Too late to buffer, the sector has been erased already
+    if (isSet(_erased, sector)) {
+        memcpy(_page, payload, FlashLoader::PAGE_SIZE);
+        return _loader.programPages(offset, _page, FlashLoader::PAGE_SIZE, false);
+    }
+
+    Buffer* buffer = nullptr;
+    for (Buffer& b : _buffers) {
+        if (b.inUse && b.sector == sector)
+            buffer = &b;
+    }
+    if (buffer == nullptr) {
+        Buffer* fullest = nullptr;
+        for (Buffer& b : _buffers) {
+            if (!b.inUse) {
+                buffer = &b;
+                break;
+            }
+            if (fullest == nullptr || __builtin_popcount(b.pages) > __builtin_popcount(fullest->pages))
+                fullest = &b;
+        }
+        // Make room
+        if (buffer == nullptr) {
+            if (const int rc = _flush(*fullest); rc != 0)
+                return rc;
+            buffer = fullest;
+        }
+        buffer->inUse = true;
+        buffer->sector = sector;
+        buffer->pages = 0;
+        memset(buffer->words, 0xff, sizeof(buffer->words));
+    }
+
+    memcpy((uint8_t*)buffer->words + page * FlashLoader::PAGE_SIZE, payload,
+        FlashLoader::PAGE_SIZE);
+    buffer->pages |= 1 << page;
+    if (buffer->pages == (1 << PAGES_PER_SECTOR) - 1)
+        return _flush(*buffer);
+    return 0;
+}
+
+int Uf2Decoder::_flush(Buffer& buffer) {
+
+    buffer.inUse = false;
+    set(_erased, buffer.sector);
+
+    // Everything from the first page to the last, with any missing pages
+    // in between left as 0xff so that they can still be programmed later
+    const unsigned first = __builtin_ctz(buffer.pages);
+    const unsigned last = 31 - __builtin_clz(buffer.pages);
+    return _loader.programPages(buffer.sector * FlashLoader::SECTOR_SIZE +
+        first * FlashLoader::PAGE_SIZE, buffer.words + first * FlashLoader::PAGE_SIZE / 4,
+        (last - first + 1) * FlashLoader::PAGE_SIZE, true);
+}
+
+int Uf2Decoder::finish() {
+    for (Buffer& b : _buffers) {
+        if (b.inUse) {
+            if (const int rc = _flush(b); rc != 0)
+                return rc;
+        }
+    }
+    // Nothing at all for this family usually means a file for another chip
+    if (_numBlocks == 0 || _blocks != _numBlocks)
+        return ERR_MISSING;
+    return 0;
+}
+
+}
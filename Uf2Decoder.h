@@ -0,0 +1,94 @@
+/**
+ * Programs flash from the blocks of a UF2 file.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "FlashLoader.h"
+#include "Uf2Family.h"
+
+namespace kc1fsz {
+
+/**
+ * Takes the 512-byte blocks of a UF2 file in any order and gathers their
+ * 256-byte payloads into a few sector buffers. A sector is programmed as
+ * soon as all 16 of its pages are in. If every buffer is in use when a
+ * new sector turns up, the fullest one is programmed with what it has;
+ * the sector has been erased by then, so its missing pages can still be
+ * programmed one at a time as they arrive. Memory use doesn't depend on
+ * the size of the image.
+ *
+ * Blocks for other families (UF2 files may hold images for several
+ * chips) and blocks flagged as not for the main flash are skipped, as
+ * the UF2 spec asks.
+ */
+class Uf2Decoder {
+public:
+
+    static constexpr unsigned BLOCK_SIZE = 512;
+    static constexpr unsigned SECTOR_BUFFERS = 4;
+    // The largest numBlocks accepted, 2MB of 256-byte payloads
+    static constexpr unsigned MAX_BLOCKS = 8192;
+
+    // put() and finish() errors
+    static constexpr int ERR_MAGIC = -10;
+    static constexpr int ERR_BLOCK = -11;
+    static constexpr int ERR_ADDRESS = -12;
+    static constexpr int ERR_MISSING = -13;
+
+    Uf2Decoder(FlashLoader& loader);
+
+    /**
+     * Starts a new file, taking only the blocks for the given family.
+     */
+    void begin(uint32_t familyId);
+
+    /**
+     * @returns 0 on success, otherwise an ERR_ code or an error from
+     *   the FlashLoader.
+     */
+    int put(const uint8_t* block);
+
+    /**
+     * Programs whatever is still buffered and checks that every block
+     * of the family was seen.
+     */
+    int finish();
+
+    /**
+     * Blocks taken, and blocks skipped because of their family or flags.
+     */
+    unsigned getBlocks() const { return _blocks; }
+    unsigned getSkipped() const { return _skipped; }
+
+private:
+
+    struct Buffer {
+        // Sector number, counting from the start of flash
+        unsigned sector;
+        // One bit per page
+        uint16_t pages;
+        bool inUse;
+        uint32_t words[FlashLoader::SECTOR_SIZE / 4];
+    };
+
+    int _flush(Buffer& buffer);
+
+    FlashLoader& _loader;
+    uint32_t _familyId = Uf2Family::RP2040;
+    unsigned _numBlocks = 0;
+    unsigned _blocks = 0;
+    unsigned _skipped = 0;
+
+    Buffer _buffers[SECTOR_BUFFERS];
+    // A page for a sector that has already been programmed in part
+    uint32_t _page[FlashLoader::PAGE_SIZE / 4];
+    // Block numbers seen, and sectors erased and partly programmed
+    uint32_t _seen[MAX_BLOCKS / 32];
+    uint32_t _erased[FlashLoader::MAX_FLASH_SIZE / FlashLoader::SECTOR_SIZE / 32];
+};
+
+}
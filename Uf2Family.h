@@ -0,0 +1,21 @@
+/**
+ * UF2 family IDs. Kept out of Uf2Decoder.h so that code which only needs
+ * to name a family doesn't pull in FlashLoader and the PIO driver.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace kc1fsz {
+
+struct Uf2Family {
+    static constexpr uint32_t RP2040 = 0xe48bff56;
+    static constexpr uint32_t ABSOLUTE = 0xe48bff57;
+    static constexpr uint32_t RP2350_ARM_S = 0xe48bff59;
+    static constexpr uint32_t RP2350_RISCV = 0xe48bff5a;
+    static constexpr uint32_t RP2350_ARM_NS = 0xe48bff5b;
+};
+
+}
@@ -1,2830 +0,0 @@
-unsigned char blinky_bin[] = {
-  0x00, 0xb5, 0x32, 0x4b, 0x21, 0x20, 0x58, 0x60, 0x98, 0x68, 0x02, 0x21,
-  0x88, 0x43, 0x98, 0x60, 0xd8, 0x60, 0x18, 0x61, 0x58, 0x61, 0x2e, 0x4b,
-  0x00, 0x21, 0x99, 0x60, 0x02, 0x21, 0x59, 0x61, 0x01, 0x21, 0xf0, 0x22,
-  0x99, 0x50, 0x2b, 0x49, 0x19, 0x60, 0x01, 0x21, 0x99, 0x60, 0x35, 0x20,
-  0x00, 0xf0, 0x44, 0xf8, 0x02, 0x22, 0x90, 0x42, 0x14, 0xd0, 0x06, 0x21,
-  0x19, 0x66, 0x00, 0xf0, 0x34, 0xf8, 0x19, 0x6e, 0x01, 0x21, 0x19, 0x66,
-  0x00, 0x20, 0x18, 0x66, 0x1a, 0x66, 0x00, 0xf0, 0x2c, 0xf8, 0x19, 0x6e,
-  0x19, 0x6e, 0x19, 0x6e, 0x05, 0x20, 0x00, 0xf0, 0x2f, 0xf8, 0x01, 0x21,
-  0x08, 0x42, 0xf9, 0xd1, 0x00, 0x21, 0x99, 0x60, 0x1b, 0x49, 0x19, 0x60,
-  0x00, 0x21, 0x59, 0x60, 0x1a, 0x49, 0x1b, 0x48, 0x01, 0x60, 0x01, 0x21,
-  0x99, 0x60, 0xeb, 0x21, 0x19, 0x66, 0xa0, 0x21, 0x19, 0x66, 0x00, 0xf0,
-  0x12, 0xf8, 0x00, 0x21, 0x99, 0x60, 0x16, 0x49, 0x14, 0x48, 0x01, 0x60,
-  0x01, 0x21, 0x99, 0x60, 0x01, 0xbc, 0x00, 0x28, 0x00, 0xd0, 0x00, 0x47,
-  0x12, 0x48, 0x13, 0x49, 0x08, 0x60, 0x03, 0xc8, 0x80, 0xf3, 0x08, 0x88,
-  0x08, 0x47, 0x03, 0xb5, 0x99, 0x6a, 0x04, 0x20, 0x01, 0x42, 0xfb, 0xd0,
-  0x01, 0x20, 0x01, 0x42, 0xf8, 0xd1, 0x03, 0xbd, 0x02, 0xb5, 0x18, 0x66,
-  0x18, 0x66, 0xff, 0xf7, 0xf2, 0xff, 0x18, 0x6e, 0x18, 0x6e, 0x02, 0xbd,
-  0x00, 0x00, 0x02, 0x40, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x07, 0x00,
-  0x00, 0x03, 0x5f, 0x00, 0x21, 0x22, 0x00, 0x00, 0xf4, 0x00, 0x00, 0x18,
-  0x22, 0x20, 0x00, 0xa0, 0x00, 0x01, 0x00, 0x10, 0x08, 0xed, 0x00, 0xe0,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x74, 0xb2, 0x4e, 0x7a, 0x00, 0x20, 0x04, 0x20, 0xf7, 0x01, 0x00, 0x10,
-  0xc3, 0x01, 0x00, 0x10, 0xc5, 0x01, 0x00, 0x10, 0xc1, 0x01, 0x00, 0x10,
-  0xc1, 0x01, 0x00, 0x10, 0xc1, 0x01, 0x00, 0x10, 0xc1, 0x01, 0x00, 0x10,
-  0xc1, 0x01, 0x00, 0x10, 0xc1, 0x01, 0x00, 0x10, 0xc1, 0x01, 0x00, 0x10,
-  0xc7, 0x01, 0x00, 0x10, 0xc1, 0x01, 0x00, 0x10, 0xc1, 0x01, 0x00, 0x10,
-  0xc9, 0x01, 0x00, 0x10, 0xcb, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10, 0xcd, 0x01, 0x00, 0x10,
-  0xcd, 0x01, 0x00, 0x10, 0x00, 0xbe, 0x00, 0xbe, 0x00, 0xbe, 0x00, 0xbe,
-  0x00, 0xbe, 0x00, 0xbe, 0xef, 0xf3, 0x05, 0x80, 0x10, 0x38, 0x00, 0xbe,
-  0xf2, 0xeb, 0x88, 0x71, 0x90, 0x74, 0x00, 0x10, 0xb8, 0x74, 0x00, 0x10,
-  0x38, 0x02, 0x00, 0x10, 0x90, 0xa3, 0x1a, 0xe7, 0x1e, 0x48, 0x1f, 0x49,
-  0x08, 0x60, 0x06, 0xc8, 0x81, 0xf3, 0x08, 0x88, 0x10, 0x47, 0x1d, 0x48,
-  0x00, 0x68, 0x00, 0x28, 0x01, 0xd0, 0x19, 0x48, 0xf3, 0xe7, 0x0d, 0xa4,
-  0x0e, 0xcc, 0x00, 0x29, 0x02, 0xd0, 0x00, 0xf0, 0x12, 0xf8, 0xf9, 0xe7,
-  0x17, 0x49, 0x18, 0x4a, 0x00, 0x20, 0x00, 0xe0, 0x01, 0xc1, 0x91, 0x42,
-  0xfc, 0xd1, 0x16, 0x49, 0x88, 0x47, 0x16, 0x49, 0x88, 0x47, 0x16, 0x49,
-  0x88, 0x47, 0x00, 0xbe, 0xfd, 0xe7, 0x01, 0xc9, 0x01, 0xc2, 0x9a, 0x42,
-  0xfb, 0xd3, 0x70, 0x47, 0xb8, 0x74, 0x00, 0x10, 0xc0, 0x00, 0x00, 0x20,
-  0x88, 0x10, 0x00, 0x20, 0x80, 0x84, 0x00, 0x10, 0x00, 0x00, 0x04, 0x20,
-  0x00, 0x00, 0x04, 0x20, 0x80, 0x84, 0x00, 0x10, 0x00, 0x10, 0x04, 0x20,
-  0x00, 0x10, 0x04, 0x20, 0x00, 0x00, 0x00, 0x00, 0x70, 0x47, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x08, 0xed, 0x00, 0xe0, 0x00, 0x00, 0x00, 0xd0,
-  0x88, 0x10, 0x00, 0x20, 0x14, 0x21, 0x00, 0x20, 0xf9, 0x3e, 0x00, 0x10,
-  0x21, 0x03, 0x00, 0x10, 0xf1, 0x3e, 0x00, 0x10, 0xf8, 0xb5, 0xc0, 0x46,
-  0x04, 0x48, 0x05, 0x4b, 0x10, 0xb5, 0x83, 0x42, 0x03, 0xd0, 0x04, 0x4b,
-  0x00, 0x2b, 0x00, 0xd0, 0x98, 0x47, 0x10, 0xbd, 0x88, 0x10, 0x00, 0x20,
-  0x88, 0x10, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x06, 0x48, 0x07, 0x49,
-  0x09, 0x1a, 0x8b, 0x10, 0xc9, 0x0f, 0xc9, 0x18, 0x10, 0xb5, 0x49, 0x10,
-  0x03, 0xd0, 0x04, 0x4b, 0x00, 0x2b, 0x00, 0xd0, 0x98, 0x47, 0x10, 0xbd,
-  0x88, 0x10, 0x00, 0x20, 0x88, 0x10, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00,
-  0x10, 0xb5, 0x07, 0x4c, 0x23, 0x78, 0x00, 0x2b, 0x09, 0xd1, 0xff, 0xf7,
-  0xd5, 0xff, 0x05, 0x4b, 0x00, 0x2b, 0x02, 0xd0, 0x04, 0x48, 0x00, 0xe0,
-  0x00, 0xbf, 0x01, 0x23, 0x23, 0x70, 0x10, 0xbd, 0x10, 0x14, 0x00, 0x20,
-  0x00, 0x00, 0x00, 0x00, 0x2c, 0x6e, 0x00, 0x10, 0x05, 0x4b, 0x10, 0xb5,
-  0x00, 0x2b, 0x03, 0xd0, 0x04, 0x49, 0x05, 0x48, 0x00, 0xe0, 0x00, 0xbf,
-  0xff, 0xf7, 0xcc, 0xff, 0x10, 0xbd, 0xc0, 0x46, 0x00, 0x00, 0x00, 0x00,
-  0x14, 0x14, 0x00, 0x20, 0x2c, 0x6e, 0x00, 0x10, 0xf0, 0xb5, 0xc6, 0x46,
-  0x00, 0xb5, 0x03, 0xf0, 0x2d, 0xff, 0xd0, 0x25, 0x19, 0x20, 0x80, 0x26,
-  0x00, 0xf0, 0x42, 0xf8, 0xfa, 0x20, 0x2d, 0x06, 0xb6, 0x04, 0x6e, 0x62,
-  0x40, 0x00, 0x6e, 0x61, 0x00, 0xf0, 0xb2, 0xff, 0xfa, 0x20, 0xae, 0x61,
-  0x40, 0x00, 0x00, 0xf0, 0xad, 0xff, 0x0b, 0x48, 0x03, 0xf0, 0x6c, 0xff,
-  0x0a, 0x4b, 0x00, 0x24, 0x98, 0x46, 0xfa, 0x20, 0xae, 0x61, 0x40, 0x00,
-  0x00, 0xf0, 0xa2, 0xff, 0xfa, 0x20, 0x6e, 0x61, 0x40, 0x00, 0x00, 0xf0,
-  0x9d, 0xff, 0x67, 0x1c, 0x21, 0x00, 0x40, 0x46, 0x03, 0xf0, 0xe2, 0xff,
-  0x3c, 0x00, 0xee, 0xe7, 0x30, 0x6e, 0x00, 0x10, 0x3c, 0x6e, 0x00, 0x10,
-  0x09, 0x4a, 0x83, 0x00, 0x9a, 0x18, 0x10, 0xb5, 0x14, 0x68, 0x40, 0x22,
-  0x54, 0x40, 0x80, 0x32, 0x22, 0x40, 0x06, 0x4c, 0xc0, 0x00, 0xa4, 0x46,
-  0x63, 0x44, 0x1a, 0x60, 0x04, 0x4b, 0x9c, 0x46, 0x60, 0x44, 0x41, 0x60,
-  0x10, 0xbd, 0xc0, 0x46, 0x04, 0xc0, 0x01, 0x40, 0x04, 0xd0, 0x01, 0x40,
-  0x00, 0x40, 0x01, 0x40, 0x01, 0x23, 0xd0, 0x22, 0x83, 0x40, 0x12, 0x06,
-  0x93, 0x62, 0x93, 0x61, 0x09, 0x4a, 0x83, 0x00, 0x9a, 0x18, 0x11, 0x68,
-  0x40, 0x22, 0x51, 0x40, 0x80, 0x32, 0x0a, 0x40, 0x06, 0x49, 0xc0, 0x00,
-  0x8c, 0x46, 0x63, 0x44, 0x1a, 0x60, 0x05, 0x4b, 0x9c, 0x46, 0x05, 0x23,
-  0x60, 0x44, 0x43, 0x60, 0x70, 0x47, 0xc0, 0x46, 0x04, 0xc0, 0x01, 0x40,
-  0x04, 0xd0, 0x01, 0x40, 0x00, 0x40, 0x01, 0x40, 0x80, 0x23, 0xdb, 0x05,
-  0x18, 0x68, 0x00, 0x0f, 0x70, 0x47, 0xc0, 0x46, 0x0f, 0xb4, 0x00, 0xb5,
-  0x08, 0x48, 0x83, 0xb0, 0x03, 0xf0, 0x0e, 0xff, 0x04, 0x9b, 0x00, 0x2b,
-  0x07, 0xd0, 0x05, 0xa9, 0x18, 0x00, 0x01, 0x91, 0x03, 0xf0, 0x4e, 0xfd,
-  0x03, 0x48, 0x03, 0xf0, 0x03, 0xff, 0x01, 0x20, 0x03, 0xf0, 0x60, 0xfd,
-  0x48, 0x6e, 0x00, 0x10, 0x58, 0x6e, 0x00, 0x10, 0x70, 0xb5, 0xef, 0xf3,
-  0x10, 0x8c, 0x72, 0xb6, 0x0d, 0x4d, 0x2b, 0x68, 0x00, 0x2b, 0xfc, 0xd0,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x07, 0x24, 0xcb, 0x08, 0xc6, 0x18, 0xc0, 0x5c,
-  0x01, 0x23, 0x0c, 0x40, 0xa3, 0x40, 0x1c, 0x00, 0x04, 0x40, 0x03, 0x42,
-  0x07, 0xd1, 0x18, 0x43, 0x30, 0x70, 0xbf, 0xf3, 0x5f, 0x8f, 0x2c, 0x60,
-  0x8c, 0xf3, 0x10, 0x88, 0x70, 0xbd, 0x10, 0x00, 0xff, 0xf7, 0xc8, 0xff,
-  0x2c, 0x01, 0x00, 0xd0, 0xf8, 0xb5, 0x47, 0x46, 0xce, 0x46, 0x88, 0x46,
-  0x80, 0xb5, 0xef, 0xf3, 0x10, 0x8c, 0x72, 0xb6, 0x21, 0x4d, 0x2c, 0x68,
-  0x00, 0x2c, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x9a, 0x42, 0x2c, 0xd8,
-  0xd4, 0x08, 0x07, 0x27, 0x05, 0x5d, 0x06, 0x19, 0x01, 0x24, 0x17, 0x40,
-  0xbc, 0x40, 0x2c, 0x42, 0x1f, 0xd0, 0x07, 0x21, 0x01, 0x27, 0x89, 0x46,
-  0x09, 0xe0, 0xd4, 0x08, 0x05, 0x5d, 0x06, 0x19, 0x4c, 0x46, 0x39, 0x00,
-  0x14, 0x40, 0xa1, 0x40, 0x0c, 0x00, 0x29, 0x42, 0x11, 0xd0, 0x01, 0x32,
-  0x93, 0x42, 0xf2, 0xd2, 0x01, 0x20, 0x40, 0x42, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x00, 0x22, 0x0e, 0x4b, 0x1a, 0x60, 0x8c, 0xf3, 0x10, 0x88, 0x00, 0x28,
-  0x0f, 0xdb, 0xc0, 0xbc, 0xb9, 0x46, 0xb0, 0x46, 0xf8, 0xbd, 0x25, 0x43,
-  0x10, 0x00, 0x35, 0x70, 0xee, 0xe7, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x23,
-  0x2b, 0x60, 0x8c, 0xf3, 0x10, 0x88, 0x01, 0x20, 0x40, 0x42, 0x43, 0x46,
-  0x00, 0x2b, 0xec, 0xd0, 0x08, 0x98, 0xff, 0xf7, 0x7b, 0xff, 0xc0, 0x46,
-  0x2c, 0x01, 0x00, 0xd0, 0x04, 0x4a, 0x10, 0x78, 0x43, 0x1c, 0xdb, 0xb2,
-  0x17, 0x2b, 0x00, 0xd9, 0x10, 0x23, 0x13, 0x70, 0x70, 0x47, 0xc0, 0x46,
-  0xa0, 0x0f, 0x00, 0x20, 0x10, 0xb5, 0x06, 0x4b, 0x06, 0x4c, 0x82, 0xb0,
-  0x01, 0x00, 0x00, 0x93, 0x18, 0x22, 0x1f, 0x23, 0x20, 0x00, 0xff, 0xf7,
-  0x9b, 0xff, 0x02, 0xb0, 0x10, 0xbd, 0xc0, 0x46, 0x5c, 0x6e, 0x00, 0x10,
-  0x50, 0x1c, 0x00, 0x20, 0x00, 0x21, 0x04, 0x4b, 0x04, 0x4a, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x02, 0xc3, 0x93, 0x42, 0xfa, 0xd1, 0x70, 0x47, 0xc0, 0x46,
-  0x00, 0x01, 0x00, 0xd0, 0x80, 0x01, 0x00, 0xd0, 0x05, 0x4b, 0x06, 0x4a,
-  0x13, 0x60, 0x06, 0x4a, 0x13, 0x60, 0x53, 0x60, 0x93, 0x60, 0xd3, 0x60,
-  0x13, 0x61, 0x53, 0x61, 0x93, 0x61, 0x70, 0x47, 0x80, 0x80, 0x80, 0x80,
-  0x00, 0xe4, 0x00, 0xe0, 0x04, 0xe4, 0x00, 0xe0, 0x1f, 0x23, 0x18, 0x40,
-  0x1e, 0x3b, 0x83, 0x40, 0x00, 0x29, 0x05, 0xd0, 0xc0, 0x21, 0x04, 0x4a,
-  0x49, 0x00, 0x53, 0x50, 0x13, 0x60, 0x70, 0x47, 0x80, 0x22, 0x01, 0x49,
-  0x8b, 0x50, 0xfa, 0xe7, 0x00, 0xe1, 0x00, 0xe0, 0x01, 0x22, 0x82, 0x40,
-  0x03, 0x4b, 0x1b, 0x68, 0x13, 0x40, 0x5a, 0x1e, 0x93, 0x41, 0xd8, 0xb2,
-  0x70, 0x47, 0xc0, 0x46, 0x00, 0xe1, 0x00, 0xe0, 0x01, 0x23, 0x83, 0x40,
-  0x01, 0x4a, 0x13, 0x60, 0x70, 0x47, 0xc0, 0x46, 0x00, 0xe2, 0x00, 0xe0,
-  0x08, 0x4b, 0x10, 0x30, 0x9b, 0x68, 0x80, 0x00, 0xc3, 0x58, 0x00, 0x2b,
-  0x07, 0xd0, 0x06, 0x4a, 0x00, 0x20, 0x9b, 0x1a, 0x2f, 0x22, 0x9a, 0x42,
-  0x40, 0x41, 0xc0, 0xb2, 0x70, 0x47, 0x00, 0x20, 0xfc, 0xe7, 0xc0, 0x46,
-  0x00, 0xed, 0x00, 0xe0, 0xa4, 0x0f, 0x00, 0x20, 0x70, 0xb5, 0x0d, 0x00,
-  0xef, 0xf3, 0x10, 0x86, 0x72, 0xb6, 0x0f, 0x4a, 0x13, 0x68, 0x00, 0x2b,
-  0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x0d, 0x4b, 0x10, 0x30, 0x9b, 0x68,
-  0x84, 0x00, 0x1b, 0x59, 0x0b, 0x4a, 0x93, 0x42, 0x03, 0xd0, 0x9d, 0x42,
-  0x01, 0xd0, 0x01, 0xf0, 0xa9, 0xf9, 0x07, 0x4b, 0x9b, 0x68, 0x1d, 0x51,
-  0xbf, 0xf3, 0x5f, 0x8f, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x02, 0x4b,
-  0x1a, 0x60, 0x86, 0xf3, 0x10, 0x88, 0x70, 0xbd, 0x24, 0x01, 0x00, 0xd0,
-  0x00, 0xed, 0x00, 0xe0, 0xcd, 0x01, 0x00, 0x10, 0xf0, 0xb5, 0x57, 0x46,
-  0x4e, 0x46, 0xde, 0x46, 0x45, 0x46, 0xe0, 0xb5, 0x85, 0xb0, 0x06, 0x00,
-  0x00, 0x91, 0x17, 0x00, 0xef, 0xf3, 0x10, 0x8b, 0x72, 0xb6, 0x6a, 0x4a,
-  0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x25,
-  0x67, 0x4b, 0x5d, 0x57, 0x9a, 0x46, 0x00, 0x2d, 0x00, 0xda, 0x8b, 0xe0,
-  0x6b, 0x00, 0x65, 0x4c, 0x01, 0x93, 0x5b, 0x19, 0x9b, 0x00, 0x98, 0x46,
-  0xa1, 0x46, 0xc1, 0x44, 0x4b, 0x46, 0x52, 0x46, 0x9b, 0x79, 0x10, 0x36,
-  0x13, 0x70, 0x60, 0x4b, 0xb6, 0x00, 0x9b, 0x68, 0x99, 0x59, 0x0b, 0x1b,
-  0x2f, 0x2b, 0x33, 0xd9, 0x5d, 0x4b, 0x99, 0x42, 0x00, 0xd0, 0xac, 0xe0,
-  0x01, 0x9b, 0x42, 0x46, 0x9c, 0x46, 0x5b, 0x4b, 0x65, 0x44, 0xad, 0x00,
-  0x63, 0x53, 0x5a, 0x4b, 0x02, 0x32, 0xa2, 0x18, 0x04, 0x3b, 0x9b, 0x1a,
-  0x1b, 0x05, 0x58, 0x4a, 0x5b, 0x0d, 0x65, 0x19, 0x13, 0x43, 0x6b, 0x80,
-  0x56, 0x4b, 0x01, 0x21, 0xab, 0x80, 0xff, 0x23, 0xab, 0x71, 0x00, 0x9b,
-  0xef, 0x71, 0xab, 0x60, 0x4b, 0x46, 0x0b, 0x43, 0x19, 0x00, 0x4c, 0x4b,
-  0x9b, 0x68, 0x99, 0x51, 0xbf, 0xf3, 0x5f, 0x8f, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x00, 0x22, 0x45, 0x4b, 0x1a, 0x60, 0x8b, 0xf3, 0x10, 0x88, 0x05, 0xb0,
-  0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46, 0xf0, 0xbd,
-  0x01, 0x20, 0x0a, 0x00, 0x82, 0x43, 0xd3, 0x79, 0x8c, 0x46, 0xbb, 0x42,
-  0x31, 0xd8, 0x45, 0x46, 0x13, 0x00, 0x44, 0x49, 0x1b, 0x1b, 0x5b, 0x41,
-  0x59, 0x43, 0x09, 0x0d, 0x3d, 0x4b, 0x63, 0x53, 0x3d, 0x4b, 0x02, 0x35,
-  0x65, 0x19, 0x04, 0x3b, 0x5b, 0x1b, 0x1b, 0x05, 0x3b, 0x4d, 0x5b, 0x0d,
-  0x2b, 0x43, 0xaa, 0x46, 0x4d, 0x46, 0x6b, 0x80, 0x04, 0x25, 0xac, 0x46,
-  0x55, 0x46, 0xe0, 0x44, 0x13, 0x1f, 0x44, 0x44, 0x1b, 0x1b, 0x1b, 0x05,
-  0x5b, 0x0d, 0x1d, 0x43, 0x4b, 0x46, 0x99, 0x71, 0x00, 0x99, 0x9d, 0x80,
-  0x99, 0x60, 0x49, 0x46, 0xdf, 0x71, 0x33, 0x4b, 0x01, 0x43, 0x13, 0x60,
-  0xbb, 0xe7, 0x58, 0x00, 0xc0, 0x18, 0x80, 0x00, 0x20, 0x18, 0xc1, 0x79,
-  0xb9, 0x42, 0x11, 0xd9, 0x02, 0x00, 0x06, 0x23, 0xd3, 0x56, 0x00, 0x2b,
-  0xf3, 0xda, 0x02, 0x93, 0x13, 0x1d, 0x9a, 0x46, 0x2a, 0x4b, 0x61, 0x46,
-  0x03, 0x93, 0x19, 0xe0, 0x01, 0xf0, 0xee, 0xf8, 0x00, 0x25, 0x53, 0x46,
-  0x5d, 0x57, 0x6d, 0xe7, 0x90, 0x88, 0x02, 0x93, 0x40, 0x05, 0x13, 0x1d,
-  0x9a, 0x46, 0x03, 0x15, 0x61, 0x46, 0x9c, 0x46, 0x40, 0x46, 0xd4, 0x44,
-  0x63, 0x46, 0x04, 0x30, 0x20, 0x18, 0x18, 0x1a, 0xe0, 0x23, 0x00, 0x05,
-  0x40, 0x0d, 0x1b, 0x02, 0x18, 0x43, 0x03, 0x90, 0x04, 0x23, 0x5b, 0x42,
-  0x9c, 0x46, 0xe1, 0x44, 0x50, 0x46, 0x4b, 0x46, 0x1b, 0x1a, 0x1b, 0x05,
-  0x5b, 0x0d, 0x9c, 0x46, 0x12, 0x4b, 0x95, 0x71, 0x98, 0x46, 0x63, 0x46,
-  0x40, 0x46, 0x03, 0x43, 0x93, 0x80, 0x01, 0x9b, 0x5a, 0x19, 0x92, 0x00,
-  0x03, 0x9b, 0xa4, 0x18, 0xa3, 0x80, 0x02, 0x9b, 0x0e, 0x4a, 0xa3, 0x71,
-  0x00, 0x9b, 0x22, 0x60, 0xe7, 0x71, 0xa3, 0x60, 0x6f, 0xe7, 0x01, 0xf0,
-  0xb5, 0xf8, 0x4f, 0xe7, 0x24, 0x01, 0x00, 0xd0, 0x0d, 0x21, 0x00, 0x20,
-  0xa4, 0x0f, 0x00, 0x20, 0x00, 0xed, 0x00, 0xe0, 0xcd, 0x01, 0x00, 0x10,
-  0x00, 0xa1, 0xff, 0xff, 0xd4, 0x0f, 0x00, 0x20, 0x00, 0xe0, 0xff, 0xff,
-  0x01, 0xbd, 0xff, 0xff, 0xaa, 0xaa, 0x00, 0x00, 0x01, 0x48, 0x80, 0x47,
-  0x01, 0xbd, 0x00, 0x00, 0xf0, 0xb5, 0xde, 0x46, 0x57, 0x46, 0x4e, 0x46,
-  0x45, 0x46, 0xe0, 0xb5, 0x0c, 0x00, 0x83, 0xb0, 0xef, 0xf3, 0x10, 0x88,
-  0x72, 0xb6, 0x63, 0x4a, 0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x61, 0x4b, 0x61, 0x49, 0x9a, 0x68, 0x03, 0x00, 0x10, 0x33,
-  0x9f, 0x00, 0xd5, 0x59, 0x00, 0x93, 0x8d, 0x42, 0x43, 0xd0, 0xa5, 0x42,
-  0x54, 0xd0, 0x5d, 0x4e, 0xaa, 0x1b, 0x2f, 0x2a, 0x3d, 0xd8, 0x5c, 0x4b,
-  0x9c, 0x46, 0x1b, 0x68, 0x9a, 0x46, 0x01, 0x23, 0x1a, 0x00, 0x99, 0x46,
-  0x82, 0x40, 0x53, 0x46, 0x13, 0x40, 0x1f, 0x22, 0x01, 0x93, 0x4b, 0x46,
-  0x02, 0x40, 0x93, 0x40, 0x9a, 0x46, 0x80, 0x22, 0x63, 0x46, 0x50, 0x46,
-  0x98, 0x50, 0xbf, 0xf3, 0x5f, 0x8f, 0xef, 0xf3, 0x05, 0x83, 0x9b, 0x46,
-  0x00, 0x2b, 0x37, 0xd0, 0x00, 0x9b, 0x5b, 0x45, 0x01, 0xd0, 0x01, 0xf0,
-  0x5b, 0xf8, 0x2a, 0x00, 0x4b, 0x46, 0x9a, 0x43, 0x90, 0x68, 0x84, 0x42,
-  0x08, 0xd1, 0x77, 0xe0, 0x4b, 0x00, 0x5b, 0x18, 0x9b, 0x00, 0xf3, 0x18,
-  0x98, 0x68, 0x84, 0x42, 0x36, 0xd0, 0x1a, 0x00, 0x06, 0x21, 0x51, 0x56,
-  0x00, 0x29, 0xf3, 0xda, 0x84, 0x42, 0x55, 0xd0, 0x01, 0x9b, 0x00, 0x2b,
-  0x27, 0xd0, 0xc0, 0x22, 0x51, 0x46, 0x3f, 0x4b, 0x52, 0x00, 0x99, 0x50,
-  0x19, 0x60, 0x3a, 0x4b, 0x9b, 0x68, 0xdd, 0x51, 0xbf, 0xf3, 0x5f, 0x8f,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x35, 0x4b, 0x1a, 0x60, 0x88, 0xf3,
-  0x10, 0x88, 0x03, 0xb0, 0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46,
-  0xa0, 0x46, 0xf0, 0xbd, 0x0d, 0x00, 0xea, 0xe7, 0x2a, 0x00, 0x4b, 0x46,
-  0x9a, 0x43, 0x90, 0x68, 0x84, 0x42, 0xd5, 0xd1, 0x06, 0x20, 0x10, 0x56,
-  0x13, 0x00, 0x00, 0x28, 0x0a, 0xda, 0x0d, 0x00, 0x32, 0xe0, 0x80, 0x23,
-  0x51, 0x46, 0x2b, 0x4a, 0xd1, 0x50, 0xd8, 0xe7, 0x06, 0x20, 0x18, 0x56,
-  0x00, 0x28, 0x22, 0xdb, 0x42, 0x00, 0x11, 0x18, 0x89, 0x00, 0x74, 0x18,
-  0x89, 0x46, 0xa1, 0x68, 0x99, 0x60, 0xe1, 0x79, 0xd9, 0x71, 0x06, 0x21,
-  0x61, 0x56, 0x99, 0x71, 0x00, 0x29, 0x25, 0xdb, 0xa4, 0x88, 0xf1, 0x1a,
-  0x64, 0x05, 0x24, 0x15, 0x4c, 0x44, 0x09, 0x19, 0xe0, 0x24, 0x09, 0x05,
-  0x49, 0x0d, 0x24, 0x02, 0x21, 0x43, 0x99, 0x80, 0x13, 0x18, 0x1b, 0x4a,
-  0x9b, 0x00, 0x11, 0x78, 0xf3, 0x18, 0x99, 0x71, 0x10, 0x70, 0xa9, 0xe7,
-  0x13, 0x00, 0x59, 0x46, 0x00, 0x29, 0x14, 0xd1, 0xff, 0x31, 0x91, 0x71,
-  0x15, 0x49, 0x91, 0x80, 0x13, 0x49, 0x0a, 0x78, 0x9a, 0x71, 0x14, 0x4a,
-  0x9b, 0x1b, 0x5b, 0x41, 0x5a, 0x43, 0x12, 0x0d, 0x0a, 0x70, 0x97, 0xe7,
-  0x11, 0x49, 0xe2, 0xe7, 0x06, 0x20, 0x10, 0x56, 0x13, 0x00, 0x00, 0x28,
-  0xc4, 0xda, 0x0f, 0x4a, 0x0f, 0x49, 0xd2, 0x1a, 0x08, 0x3a, 0x50, 0x02,
-  0x40, 0x0d, 0x01, 0x43, 0x99, 0x80, 0x0d, 0x49, 0x52, 0x08, 0x0a, 0x43,
-  0xda, 0x80, 0x83, 0xe7, 0x24, 0x01, 0x00, 0xd0, 0x00, 0xed, 0x00, 0xe0,
-  0xcd, 0x01, 0x00, 0x10, 0xa4, 0x0f, 0x00, 0x20, 0x00, 0xe1, 0x00, 0xe0,
-  0x0d, 0x21, 0x00, 0x20, 0x01, 0xbd, 0xff, 0xff, 0xaa, 0xaa, 0x00, 0x00,
-  0x01, 0xbd, 0x00, 0x00, 0xde, 0x0f, 0x00, 0x20, 0x00, 0xf0, 0xff, 0xff,
-  0x00, 0xf8, 0xff, 0xff, 0x70, 0xb5, 0x01, 0x24, 0x04, 0x43, 0xef, 0xf3,
-  0x05, 0x81, 0xef, 0xf3, 0x10, 0x8c, 0x72, 0xb6, 0x21, 0x4a, 0x13, 0x68,
-  0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x1f, 0x4b, 0x05, 0x00,
-  0x1f, 0x4a, 0xed, 0x1a, 0x6d, 0x41, 0x6a, 0x43, 0x12, 0x0d, 0x1e, 0x4d,
-  0x89, 0x00, 0xae, 0x68, 0x52, 0xb2, 0x76, 0x58, 0xa6, 0x42, 0x1c, 0xd0,
-  0x06, 0x21, 0x59, 0x56, 0x91, 0x42, 0x1c, 0xd0, 0x12, 0x21, 0x59, 0x56,
-  0x91, 0x42, 0x22, 0xd0, 0x1e, 0x21, 0x59, 0x56, 0x91, 0x42, 0x20, 0xd0,
-  0x2a, 0x21, 0x59, 0x56, 0x03, 0x24, 0x91, 0x42, 0x10, 0xd0, 0x13, 0x4b,
-  0x19, 0x78, 0x1a, 0x70, 0x81, 0x71, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22,
-  0x0b, 0x4b, 0x1a, 0x60, 0x8c, 0xf3, 0x10, 0x88, 0x70, 0xbd, 0xab, 0x68,
-  0x0d, 0x4c, 0x5c, 0x50, 0xef, 0xe7, 0x00, 0x24, 0x61, 0x00, 0x09, 0x19,
-  0x89, 0x00, 0x5b, 0x18, 0xff, 0x21, 0x99, 0x71, 0x09, 0x49, 0x99, 0x80,
-  0xe5, 0xe7, 0x01, 0x24, 0xf4, 0xe7, 0x02, 0x24, 0xf2, 0xe7, 0xc0, 0x46,
-  0x24, 0x01, 0x00, 0xd0, 0xa4, 0x0f, 0x00, 0x20, 0xaa, 0xaa, 0x00, 0x00,
-  0x00, 0xed, 0x00, 0xe0, 0x0d, 0x21, 0x00, 0x20, 0xcd, 0x01, 0x00, 0x10,
-  0x01, 0xbd, 0xff, 0xff, 0x10, 0xb5, 0x08, 0x4b, 0x08, 0x4c, 0x82, 0xb0,
-  0x01, 0x00, 0x00, 0x93, 0x00, 0x22, 0x05, 0x23, 0x20, 0x00, 0xff, 0xf7,
-  0xc5, 0xfc, 0x00, 0x28, 0x01, 0xdb, 0x1f, 0x23, 0x18, 0x1a, 0x02, 0xb0,
-  0x10, 0xbd, 0xc0, 0x46, 0x78, 0x6e, 0x00, 0x10, 0x11, 0x21, 0x00, 0x20,
-  0x02, 0x4b, 0x9c, 0x46, 0x61, 0x44, 0x89, 0x00, 0x01, 0x60, 0x70, 0x47,
-  0x40, 0x00, 0x00, 0x34, 0xf8, 0xb5, 0x13, 0x4d, 0x13, 0x4e, 0x2c, 0x00,
-  0xff, 0x27, 0xb5, 0x42, 0x1e, 0xd2, 0x23, 0x68, 0x00, 0x2b, 0x0f, 0xd0,
-  0xff, 0xf7, 0xf4, 0xfc, 0x01, 0x00, 0x28, 0x00, 0xff, 0xf7, 0xe8, 0xff,
-  0xa7, 0x80, 0xbf, 0xf3, 0x5f, 0x8f, 0x08, 0x34, 0xb4, 0x42, 0x0f, 0xd2,
-  0x23, 0x68, 0x25, 0x00, 0x00, 0x2b, 0xef, 0xd1, 0xff, 0xf7, 0xe4, 0xfc,
-  0x01, 0x00, 0x28, 0x00, 0xff, 0xf7, 0xd8, 0xff, 0x27, 0x71, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x08, 0x34, 0xb4, 0x42, 0xef, 0xd3, 0xf8, 0xbd, 0xc0, 0x46,
-  0x80, 0x10, 0x00, 0x20, 0x88, 0x10, 0x00, 0x20, 0x10, 0xb5, 0x04, 0x00,
-  0xff, 0xf7, 0xd0, 0xfc, 0x01, 0x00, 0x20, 0x00, 0xff, 0xf7, 0xc4, 0xff,
-  0xff, 0x23, 0x23, 0x71, 0xbf, 0xf3, 0x5f, 0x8f, 0x10, 0xbd, 0xc0, 0x46,
-  0x10, 0xb5, 0x04, 0x00, 0x01, 0x20, 0xff, 0xf7, 0xcd, 0xfc, 0x03, 0x4b,
-  0xc3, 0x18, 0x9b, 0x00, 0x23, 0x60, 0xbf, 0xf3, 0x5f, 0x8f, 0x10, 0xbd,
-  0x40, 0x00, 0x00, 0x34, 0x03, 0x4b, 0x9c, 0x46, 0x61, 0x44, 0x89, 0x00,
-  0x01, 0x60, 0xbf, 0xf3, 0x5f, 0x8f, 0x70, 0x47, 0x40, 0x00, 0x00, 0x34,
-  0x0a, 0x4b, 0x19, 0x68, 0xef, 0xf3, 0x10, 0x80, 0x72, 0xb6, 0x0a, 0x68,
-  0x00, 0x2a, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x1b, 0x68, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60, 0x80, 0xf3, 0x10, 0x88, 0x40, 0xbf,
-  0x00, 0x20, 0x00, 0x21, 0x70, 0x47, 0xc0, 0x46, 0xe4, 0x20, 0x00, 0x20,
-  0xf0, 0xb5, 0xde, 0x46, 0x57, 0x46, 0x4e, 0x46, 0x45, 0x46, 0xe0, 0xb5,
-  0x85, 0xb0, 0xef, 0xf3, 0x05, 0x82, 0x03, 0x23, 0x13, 0x40, 0xb8, 0x4a,
-  0x99, 0x00, 0x57, 0x58, 0x01, 0x22, 0x9a, 0x40, 0xb6, 0x4b, 0x88, 0x46,
-  0x1a, 0x60, 0xb6, 0x4b, 0x93, 0x46, 0x02, 0x93, 0x2a, 0xe0, 0xbb, 0x88,
-  0x1b, 0xb2, 0x00, 0x2b, 0x00, 0xdb, 0xa2, 0xe0, 0xbb, 0x79, 0x00, 0x2b,
-  0x00, 0xd0, 0xe3, 0xe0, 0x08, 0x23, 0xf8, 0x5e, 0x00, 0x28, 0x00, 0xda,
-  0x13, 0xe1, 0x43, 0x00, 0x7a, 0x69, 0x1b, 0x18, 0xdb, 0x00, 0xd3, 0x18,
-  0x9d, 0x68, 0xdc, 0x68, 0x6b, 0x1c, 0x00, 0xd1, 0x00, 0xe1, 0xa9, 0x4b,
-  0x19, 0x00, 0x41, 0x44, 0x9a, 0x6a, 0x0b, 0x69, 0xa8, 0x1a, 0x9b, 0x1a,
-  0x98, 0x42, 0x00, 0xd2, 0x0d, 0x61, 0xa4, 0x48, 0x00, 0xf0, 0xba, 0xfb,
-  0x8c, 0x42, 0x00, 0xdd, 0xf9, 0xe0, 0x8c, 0x42, 0x00, 0xd1, 0x30, 0xe1,
-  0x5b, 0x46, 0x9f, 0x48, 0x43, 0x63, 0x08, 0x23, 0xfe, 0x5e, 0x00, 0x2e,
-  0xcd, 0xdb, 0x7a, 0x69, 0x73, 0x00, 0x91, 0x46, 0x9b, 0x19, 0xdb, 0x00,
-  0x99, 0x44, 0x4b, 0x46, 0x9c, 0x68, 0xdd, 0x68, 0x00, 0xf0, 0xa2, 0xfb,
-  0x8d, 0x42, 0xc0, 0xdc, 0x00, 0xd1, 0x08, 0xe1, 0x00, 0x2d, 0x00, 0xda,
-  0xed, 0xe0, 0x4b, 0x46, 0x02, 0x9a, 0x1b, 0x69, 0x93, 0x42, 0x00, 0xd1,
-  0xdf, 0xe0, 0x4a, 0x46, 0x52, 0x88, 0x49, 0x46, 0x94, 0x46, 0x08, 0x22,
-  0xb8, 0x5e, 0x62, 0x46, 0x00, 0x04, 0x49, 0x69, 0x10, 0x43, 0x98, 0x47,
-  0x00, 0x90, 0x01, 0x91, 0x00, 0x99, 0x01, 0x9a, 0x0b, 0x00, 0x10, 0x00,
-  0x13, 0x43, 0x00, 0xd1, 0xd3, 0xe0, 0x13, 0x00, 0x0a, 0x00, 0x00, 0x28,
-  0x00, 0xdb, 0xea, 0xe0, 0x20, 0x00, 0x29, 0x00, 0x80, 0x1a, 0x99, 0x41,
-  0x4b, 0x46, 0x98, 0x60, 0xd9, 0x60, 0x00, 0x22, 0x9a, 0x5e, 0x00, 0x2a,
-  0x91, 0xdb, 0x53, 0x00, 0x9c, 0x18, 0x7d, 0x69, 0xe4, 0x00, 0x2c, 0x19,
-  0x00, 0x93, 0xa3, 0x68, 0xe4, 0x68, 0x9a, 0x46, 0x8c, 0x42, 0x86, 0xdc,
-  0x02, 0xd1, 0x83, 0x42, 0x00, 0xd9, 0x82, 0xe7, 0x08, 0x23, 0x9c, 0x46,
-  0xbc, 0x44, 0x3a, 0x81, 0x03, 0x97, 0x67, 0x46, 0x00, 0x9b, 0xb4, 0x46,
-  0x3e, 0x00, 0x0e, 0xe0, 0x8c, 0x42, 0x00, 0xd1, 0xd5, 0xe0, 0x1e, 0x00,
-  0x00, 0x23, 0xf2, 0x5e, 0x00, 0x2a, 0x0b, 0xdb, 0x53, 0x00, 0x9c, 0x18,
-  0xe4, 0x00, 0x2c, 0x19, 0xa7, 0x68, 0xe4, 0x68, 0xba, 0x46, 0x9b, 0x18,
-  0xdb, 0x00, 0xeb, 0x18, 0x8c, 0x42, 0xeb, 0xdd, 0x33, 0x00, 0x66, 0x46,
-  0x9c, 0x46, 0x4b, 0x46, 0x1a, 0x80, 0x63, 0x46, 0x03, 0x9f, 0x1e, 0x80,
-  0xbb, 0x88, 0x1b, 0xb2, 0x00, 0x2b, 0x00, 0xda, 0x5c, 0xe7, 0x3a, 0x69,
-  0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6, 0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x01, 0x23, 0xbe, 0x88, 0x5b, 0x42, 0xbb, 0x80,
-  0x36, 0xb2, 0x3b, 0x69, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60,
-  0x81, 0xf3, 0x10, 0x88, 0x00, 0x2e, 0x00, 0xda, 0x44, 0xe7, 0x3b, 0x00,
-  0x08, 0x33, 0x3a, 0x00, 0x99, 0x46, 0x7d, 0x69, 0x73, 0x00, 0x9b, 0x19,
-  0xdb, 0x00, 0xeb, 0x18, 0x99, 0x68, 0xdc, 0x68, 0x8c, 0x46, 0x08, 0x20,
-  0x11, 0x5e, 0x48, 0x46, 0x00, 0x29, 0x10, 0xdb, 0x00, 0x93, 0x06, 0xe0,
-  0xa3, 0x42, 0x3f, 0xd0, 0x00, 0x23, 0xf9, 0x5e, 0x38, 0x00, 0x00, 0x29,
-  0x06, 0xdb, 0x4f, 0x00, 0x7f, 0x18, 0xff, 0x00, 0xef, 0x19, 0xfb, 0x68,
-  0xa3, 0x42, 0xf1, 0xdd, 0x00, 0x9b, 0x06, 0x80, 0x00, 0x20, 0x1e, 0x5e,
-  0x19, 0x80, 0x00, 0x2e, 0xdc, 0xda, 0x17, 0x00, 0xbb, 0x79, 0x00, 0x2b,
-  0x00, 0xd1, 0x1b, 0xe7, 0x00, 0x23, 0xbb, 0x71, 0x3d, 0x00, 0x08, 0x23,
-  0xf9, 0x5e, 0x08, 0x35, 0x4b, 0x1c, 0x2c, 0xd0, 0x7c, 0x69, 0x08, 0x00,
-  0xa4, 0x46, 0x03, 0xe0, 0x35, 0x00, 0x4b, 0x1c, 0x00, 0xd1, 0x0d, 0xe7,
-  0x4b, 0x00, 0x5b, 0x18, 0x0a, 0x00, 0x61, 0x46, 0xdb, 0x00, 0xce, 0x18,
-  0xc9, 0x5e, 0x73, 0x88, 0x1b, 0xb2, 0x00, 0x2b, 0xf0, 0xda, 0x01, 0x23,
-  0x5b, 0x42, 0xdc, 0x17, 0xb3, 0x60, 0xf4, 0x60, 0x82, 0x42, 0xea, 0xd0,
-  0x29, 0x80, 0x3b, 0x89, 0x10, 0x00, 0x33, 0x80, 0x3a, 0x81, 0xe4, 0xe7,
-  0xbb, 0x68, 0x63, 0x45, 0xbc, 0xd9, 0xc7, 0xe7, 0x63, 0x1c, 0x00, 0xd0,
-  0xfb, 0xe6, 0x27, 0x48, 0x00, 0xf0, 0xc0, 0xfa, 0x8c, 0x42, 0x00, 0xdc,
-  0x05, 0xe7, 0x40, 0xbf, 0x05, 0xb0, 0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46,
-  0xa9, 0x46, 0xa0, 0x46, 0xf0, 0xbd, 0x4b, 0x46, 0x5b, 0x69, 0x9a, 0x46,
-  0x1b, 0x69, 0x50, 0x46, 0x98, 0x47, 0x00, 0x28, 0x23, 0xd1, 0x4b, 0x46,
-  0x1b, 0x88, 0x3a, 0x69, 0x3b, 0x81, 0xef, 0xf3, 0x10, 0x83, 0x72, 0xb6,
-  0x11, 0x68, 0x00, 0x29, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x49, 0x46,
-  0x7a, 0x88, 0x0a, 0x80, 0x3a, 0x69, 0x7e, 0x80, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x00, 0x21, 0x11, 0x60, 0x83, 0xf3, 0x10, 0x88, 0xb5, 0xe6, 0x84, 0x42,
-  0x00, 0xd8, 0xf3, 0xe6, 0xb1, 0xe6, 0x0e, 0x48, 0x00, 0xf0, 0x8e, 0xfa,
-  0x00, 0x9b, 0x01, 0x9c, 0xc0, 0x18, 0x61, 0x41, 0x10, 0xe7, 0x53, 0x46,
-  0x1a, 0x68, 0x5b, 0x68, 0x00, 0x92, 0x01, 0x93, 0xfa, 0xe6, 0x85, 0x42,
-  0x00, 0xd8, 0xcb, 0xe6, 0xc1, 0xe7, 0x82, 0x45, 0x00, 0xd8, 0x26, 0xe7,
-  0x36, 0xe7, 0xc0, 0x46, 0xc8, 0x20, 0x00, 0x20, 0x3c, 0x70, 0x05, 0x40,
-  0xe9, 0x0b, 0x00, 0x10, 0x00, 0x40, 0x05, 0x40, 0x70, 0xb5, 0x2e, 0x4c,
-  0x25, 0x69, 0x00, 0x2d, 0x04, 0xd0, 0x0a, 0x21, 0x2c, 0x48, 0xff, 0xf7,
-  0x01, 0xfe, 0x70, 0xbd, 0x2b, 0x4e, 0x03, 0x21, 0x30, 0x00, 0x00, 0xf0,
-  0x59, 0xfa, 0xe6, 0x60, 0xff, 0xf7, 0x00, 0xfb, 0x28, 0x4b, 0x03, 0x22,
-  0x9c, 0x46, 0xd0, 0x23, 0x22, 0x70, 0x1b, 0x06, 0x1b, 0x68, 0x01, 0x21,
-  0x63, 0x70, 0x25, 0x4b, 0x60, 0x44, 0xa3, 0x60, 0x0f, 0x23, 0x80, 0x00,
-  0x20, 0x61, 0x02, 0x20, 0x63, 0x80, 0x63, 0x69, 0x49, 0x42, 0xa1, 0x80,
-  0x19, 0x80, 0x02, 0x31, 0x19, 0x86, 0x47, 0x31, 0x1d, 0x83, 0x58, 0x52,
-  0x18, 0x31, 0x5a, 0x52, 0x75, 0x32, 0x5c, 0x39, 0x99, 0x52, 0x18, 0x32,
-  0x01, 0x31, 0x99, 0x52, 0x18, 0x32, 0x01, 0x31, 0x99, 0x52, 0x18, 0x32,
-  0x01, 0x31, 0x99, 0x52, 0x08, 0x35, 0x18, 0x32, 0x9d, 0x52, 0x02, 0x31,
-  0x18, 0x32, 0x99, 0x52, 0x18, 0x32, 0x01, 0x31, 0x99, 0x52, 0x18, 0x32,
-  0x01, 0x31, 0x99, 0x52, 0x18, 0x32, 0x01, 0x31, 0x99, 0x52, 0x18, 0x32,
-  0x01, 0x31, 0x99, 0x52, 0x18, 0x32, 0x01, 0x31, 0x99, 0x52, 0x0c, 0x4b,
-  0x0c, 0x49, 0xdc, 0x60, 0x01, 0x30, 0x35, 0x62, 0xff, 0xf7, 0x36, 0xfb,
-  0x01, 0x21, 0x03, 0x20, 0xff, 0xf7, 0xf6, 0xfa, 0x08, 0x4b, 0x1d, 0x60,
-  0xa7, 0xe7, 0xc0, 0x46, 0xec, 0x0f, 0x00, 0x20, 0xe4, 0x20, 0x00, 0x20,
-  0x00, 0x40, 0x05, 0x40, 0x40, 0x00, 0x00, 0x34, 0xff, 0xff, 0x10, 0x00,
-  0xc8, 0x20, 0x00, 0x20, 0xe9, 0x0b, 0x00, 0x10, 0x38, 0x60, 0x05, 0x40,
-  0x00, 0x48, 0x70, 0x47, 0xec, 0x0f, 0x00, 0x20, 0xf8, 0xb5, 0x1f, 0x00,
-  0x08, 0xab, 0x1b, 0x78, 0x04, 0x00, 0x16, 0x00, 0x00, 0x2b, 0x08, 0xd1,
-  0x00, 0xf0, 0xfe, 0xf9, 0x32, 0x00, 0x3b, 0x00, 0x12, 0x1a, 0x8b, 0x41,
-  0x00, 0x2b, 0x00, 0xda, 0x53, 0xe0, 0x22, 0x69, 0xef, 0xf3, 0x10, 0x80,
-  0x72, 0xb6, 0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x02, 0x23, 0xe1, 0x5e, 0x63, 0x69, 0x4a, 0x00, 0x52, 0x18, 0xd2, 0x00,
-  0x9b, 0x18, 0x00, 0x29, 0x37, 0xdb, 0x1a, 0x88, 0x62, 0x80, 0x22, 0x69,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x25, 0x15, 0x60, 0x80, 0xf3, 0x10, 0x88,
-  0x06, 0x9a, 0x9e, 0x60, 0xdf, 0x60, 0x1a, 0x61, 0x07, 0x9a, 0x5a, 0x61,
-  0x5a, 0x88, 0x01, 0x32, 0x52, 0x04, 0x52, 0x0c, 0x10, 0x1c, 0x00, 0x2a,
-  0x1f, 0xd0, 0x82, 0xb2, 0x58, 0x80, 0x08, 0x04, 0x10, 0x43, 0x26, 0x69,
-  0xef, 0xf3, 0x10, 0x87, 0x72, 0xb6, 0x32, 0x68, 0x00, 0x2a, 0xfc, 0xd0,
-  0xbf, 0xf3, 0x5f, 0x8f, 0xa2, 0x88, 0x1a, 0x80, 0xa1, 0x80, 0x23, 0x69,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60, 0x87, 0xf3, 0x10, 0x88,
-  0x0b, 0x49, 0x23, 0x78, 0x8c, 0x46, 0x01, 0x32, 0x9a, 0x40, 0xe3, 0x68,
-  0x63, 0x44, 0x1a, 0x60, 0xf8, 0xbd, 0x01, 0x20, 0xdd, 0xe7, 0x23, 0x69,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60, 0x80, 0xf3, 0x10, 0x88,
-  0x01, 0x20, 0x40, 0x42, 0xf2, 0xe7, 0x00, 0x20, 0xf0, 0xe7, 0xc0, 0x46,
-  0x3c, 0x20, 0x00, 0x00, 0x70, 0xb5, 0x01, 0x00, 0x04, 0x69, 0xef, 0xf3,
-  0x10, 0x8c, 0x72, 0xb6, 0x20, 0x68, 0x00, 0x28, 0xfc, 0xd0, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x02, 0x20, 0x0d, 0x5e, 0x4c, 0x69, 0x68, 0x00, 0x40, 0x19,
-  0xc0, 0x00, 0x24, 0x18, 0x00, 0x2d, 0x37, 0xdb, 0x20, 0x88, 0x48, 0x80,
-  0x08, 0x69, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x26, 0x06, 0x60, 0x8c, 0xf3,
-  0x10, 0x88, 0xe3, 0x60, 0x63, 0x88, 0x04, 0x98, 0x01, 0x33, 0x20, 0x61,
-  0x5b, 0x04, 0x05, 0x98, 0x5b, 0x0c, 0xa2, 0x60, 0x60, 0x61, 0x1a, 0x1c,
-  0x00, 0x2b, 0x1f, 0xd0, 0x93, 0xb2, 0x28, 0x04, 0x62, 0x80, 0x18, 0x43,
-  0x0a, 0x69, 0xef, 0xf3, 0x10, 0x8c, 0x72, 0xb6, 0x13, 0x68, 0x00, 0x2b,
-  0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x8b, 0x88, 0x23, 0x80, 0x8d, 0x80,
-  0x0b, 0x69, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60, 0x8c, 0xf3,
-  0x10, 0x88, 0x0b, 0x78, 0x01, 0x32, 0x9a, 0x40, 0xcb, 0x68, 0x08, 0x49,
-  0x8c, 0x46, 0x63, 0x44, 0x1a, 0x60, 0x70, 0xbd, 0x01, 0x22, 0xdd, 0xe7,
-  0x0b, 0x69, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60, 0x8c, 0xf3,
-  0x10, 0x88, 0x01, 0x20, 0x40, 0x42, 0xf2, 0xe7, 0x3c, 0x20, 0x00, 0x00,
-  0x10, 0xb5, 0x43, 0x89, 0x0a, 0x14, 0x93, 0x42, 0x1a, 0xdd, 0x53, 0x00,
-  0x9b, 0x18, 0x42, 0x69, 0xdb, 0x00, 0xd3, 0x18, 0x04, 0x69, 0xef, 0xf3,
-  0x10, 0x8c, 0x72, 0xb6, 0x22, 0x68, 0x00, 0x2a, 0xfc, 0xd0, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x5a, 0x88, 0x09, 0x04, 0x94, 0xb2, 0x09, 0x0c, 0x8a, 0x42,
-  0x08, 0xd0, 0x03, 0x69, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60,
-  0x8c, 0xf3, 0x10, 0x88, 0x00, 0x20, 0x10, 0xbd, 0x80, 0x22, 0x12, 0x02,
-  0x14, 0x43, 0x5c, 0x80, 0x01, 0x23, 0x02, 0x69, 0x83, 0x71, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x00, 0x21, 0x11, 0x60, 0x8c, 0xf3, 0x10, 0x88, 0x04, 0x49,
-  0x02, 0x78, 0x8c, 0x46, 0x93, 0x40, 0xc2, 0x68, 0x01, 0x20, 0x62, 0x44,
-  0x13, 0x60, 0xe8, 0xe7, 0x3c, 0x20, 0x00, 0x00, 0x40, 0x78, 0x70, 0x47,
-  0xf0, 0xb5, 0x04, 0x00, 0x0d, 0x00, 0x06, 0x26, 0x76, 0x42, 0xf7, 0x17,
-  0xc6, 0x46, 0x36, 0x19, 0x6f, 0x41, 0x00, 0xb5, 0x82, 0xb0, 0x8f, 0x42,
-  0x14, 0xd8, 0x11, 0xd0, 0x00, 0xf0, 0xfa, 0xf8, 0x32, 0x00, 0x3b, 0x00,
-  0x12, 0x1a, 0x8b, 0x41, 0x00, 0x2b, 0x17, 0xdc, 0x00, 0x2b, 0x47, 0xd0,
-  0x20, 0x00, 0x29, 0x00, 0x00, 0xf0, 0x2c, 0xf9, 0x02, 0xb0, 0x80, 0xbc,
-  0xb8, 0x46, 0xf0, 0xbd, 0x86, 0x42, 0xeb, 0xd9, 0x00, 0x22, 0x00, 0x23,
-  0x16, 0x00, 0x1f, 0x00, 0x00, 0xf0, 0xe2, 0xf8, 0x32, 0x00, 0x3b, 0x00,
-  0x12, 0x1a, 0x8b, 0x41, 0x00, 0x2b, 0xe7, 0xdd, 0x00, 0xf0, 0xda, 0xf8,
-  0x32, 0x00, 0x3b, 0x00, 0x12, 0x1a, 0x8b, 0x41, 0x00, 0x2b, 0x0a, 0xdb,
-  0x00, 0x23, 0x01, 0x93, 0x15, 0x4b, 0x32, 0x00, 0x00, 0x93, 0x15, 0x48,
-  0x3b, 0x00, 0xff, 0xf7, 0x2d, 0xff, 0x00, 0x28, 0xd6, 0xdb, 0x00, 0x23,
-  0x9c, 0x46, 0xb0, 0x46, 0x11, 0x4a, 0x12, 0x4e, 0x73, 0x6a, 0x9f, 0x42,
-  0x04, 0xd8, 0xb1, 0x6a, 0x41, 0x45, 0xcb, 0xd2, 0x9f, 0x42, 0xc9, 0xd1,
-  0x11, 0x68, 0xef, 0xf3, 0x10, 0x80, 0x72, 0xb6, 0x0b, 0x68, 0x00, 0x2b,
-  0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x13, 0x68, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x61, 0x46, 0x19, 0x60, 0x80, 0xf3, 0x10, 0x88, 0x20, 0xbf, 0xe5, 0xe7,
-  0x00, 0x2a, 0xb5, 0xd0, 0xca, 0xe7, 0xc0, 0x46, 0xb9, 0x0b, 0x00, 0x10,
-  0xec, 0x0f, 0x00, 0x20, 0xe4, 0x20, 0x00, 0x20, 0x00, 0x40, 0x05, 0x40,
-  0x70, 0xb5, 0x06, 0x00, 0x00, 0xf0, 0x9a, 0xf8, 0xfa, 0x22, 0x04, 0x00,
-  0x0d, 0x00, 0x00, 0x23, 0x30, 0x00, 0x00, 0x21, 0x92, 0x00, 0x01, 0xf0,
-  0x85, 0xfa, 0x80, 0x23, 0x00, 0x19, 0x69, 0x41, 0x1b, 0x06, 0x99, 0x42,
-  0x02, 0xd3, 0x01, 0x20, 0x02, 0x49, 0x40, 0x42, 0xff, 0xf7, 0x7c, 0xff,
-  0x70, 0xbd, 0xc0, 0x46, 0xff, 0xff, 0xff, 0x7f, 0xf0, 0xb5, 0xce, 0x46,
-  0x47, 0x46, 0x80, 0xb5, 0x04, 0x00, 0x0d, 0x00, 0x83, 0xb0, 0xef, 0xf3,
-  0x05, 0x87, 0x00, 0x2f, 0x3b, 0xd1, 0x2f, 0x4e, 0x81, 0x46, 0x33, 0x78,
-  0xf1, 0x68, 0x04, 0x33, 0x9b, 0x00, 0x8a, 0x6a, 0x5b, 0x58, 0x81, 0x1a,
-  0x9b, 0x1a, 0x99, 0x42, 0x0e, 0xd3, 0x20, 0xbf, 0x29, 0x4a, 0x00, 0x20,
-  0x53, 0x6a, 0xab, 0x42, 0x03, 0xd3, 0x92, 0x6a, 0x01, 0x30, 0x91, 0x45,
-  0x3c, 0xd8, 0x03, 0xb0, 0xc0, 0xbc, 0xb9, 0x46, 0xb0, 0x46, 0xf0, 0xbd,
-  0x00, 0xf0, 0x5a, 0xf8, 0x22, 0x00, 0x2b, 0x00, 0x12, 0x1a, 0x8b, 0x41,
-  0x00, 0x2b, 0x26, 0xdb, 0x1f, 0x4b, 0x22, 0x00, 0x00, 0x93, 0x30, 0x00,
-  0x2b, 0x00, 0x01, 0x97, 0xff, 0xf7, 0xae, 0xfe, 0x01, 0x1e, 0x1c, 0xdd,
-  0x19, 0x4b, 0xa8, 0x46, 0x5a, 0x6a, 0x95, 0x42, 0x25, 0xd9, 0x20, 0xbf,
-  0x30, 0x00, 0xff, 0xf7, 0xfb, 0xfe, 0x15, 0x4a, 0x00, 0x20, 0x53, 0x6a,
-  0x98, 0x45, 0xda, 0xd8, 0xd5, 0xe7, 0x12, 0x4a, 0x00, 0x20, 0x53, 0x6a,
-  0x8b, 0x42, 0xd4, 0xd3, 0x92, 0x6a, 0x01, 0x30, 0xa2, 0x42, 0xd0, 0xd2,
-  0x5b, 0x1a, 0x5a, 0x1e, 0x93, 0x41, 0xd8, 0xb2, 0xcb, 0xe7, 0x0b, 0x4a,
-  0x00, 0x20, 0x53, 0x6a, 0xab, 0x42, 0xc6, 0xd3, 0x92, 0x6a, 0x01, 0x20,
-  0x91, 0x45, 0xc2, 0xd9, 0xeb, 0x1a, 0x5a, 0x1e, 0x93, 0x41, 0xd8, 0xb2,
-  0xbd, 0xe7, 0x9b, 0x6a, 0x9c, 0x42, 0xd7, 0xd9, 0x95, 0x42, 0xd5, 0xd1,
-  0xd3, 0xe7, 0xc0, 0x46, 0xec, 0x0f, 0x00, 0x20, 0x00, 0x40, 0x05, 0x40,
-  0xb9, 0x0b, 0x00, 0x10, 0x10, 0xb5, 0x02, 0x4a, 0x02, 0x48, 0xff, 0xf7,
-  0x35, 0xf8, 0x10, 0xbd, 0x94, 0x6e, 0x00, 0x10, 0x54, 0x1c, 0x00, 0x20,
-  0x03, 0x00, 0x41, 0x6a, 0x0a, 0x00, 0x98, 0x6a, 0x59, 0x6a, 0x8a, 0x42,
-  0xfa, 0xd1, 0x70, 0x47, 0x03, 0x4b, 0x59, 0x6a, 0x0a, 0x00, 0x98, 0x6a,
-  0x59, 0x6a, 0x91, 0x42, 0xfa, 0xd1, 0x70, 0x47, 0x00, 0x40, 0x05, 0x40,
-  0x70, 0xb5, 0x04, 0x00, 0x0d, 0x00, 0x17, 0x4a, 0x53, 0x6a, 0x19, 0x00,
-  0x96, 0x6a, 0x53, 0x6a, 0x8b, 0x42, 0xfa, 0xd1, 0x30, 0x00, 0x19, 0x00,
-  0x24, 0x18, 0x4d, 0x41, 0xab, 0x42, 0x16, 0xd8, 0x13, 0xd0, 0x10, 0x4b,
-  0x2a, 0x00, 0x5b, 0x6a, 0x9d, 0x42, 0x03, 0xd9, 0x0d, 0x49, 0x4b, 0x6a,
-  0x93, 0x42, 0xfc, 0xd3, 0x93, 0x42, 0x07, 0xd1, 0x0a, 0x4a, 0x02, 0xe0,
-  0x51, 0x6a, 0x99, 0x42, 0x02, 0xd1, 0x91, 0x6a, 0xa1, 0x42, 0xf9, 0xd3,
-  0x70, 0xbd, 0xa6, 0x42, 0xe9, 0xd9, 0x05, 0x4b, 0x5b, 0x6a, 0x1c, 0x00,
-  0x5a, 0x1c, 0xef, 0xd0, 0x01, 0x22, 0x01, 0x24, 0x64, 0x42, 0xe5, 0x17,
-  0x52, 0x42, 0xe3, 0xe7, 0x00, 0x40, 0x05, 0x40, 0x06, 0x4a, 0x53, 0x6a,
-  0x99, 0x42, 0xfc, 0xd8, 0x07, 0xd1, 0x04, 0x4b, 0x02, 0xe0, 0x5a, 0x6a,
-  0x91, 0x42, 0x02, 0xd1, 0x9a, 0x6a, 0x82, 0x42, 0xf9, 0xd3, 0x70, 0x47,
-  0x00, 0x40, 0x05, 0x40, 0xf8, 0xb5, 0x04, 0x00, 0x06, 0x20, 0x0d, 0x00,
-  0x00, 0xf0, 0x76, 0xf9, 0x00, 0x28, 0x42, 0xd0, 0x36, 0x4b, 0x37, 0x49,
-  0xe2, 0x18, 0x53, 0x42, 0x5a, 0x41, 0x80, 0x23, 0xdb, 0x03, 0x9c, 0x46,
-  0x92, 0x05, 0x34, 0x4b, 0x62, 0x44, 0x1a, 0x60, 0x33, 0x4b, 0x1a, 0x60,
-  0x10, 0x00, 0x0b, 0x68, 0x98, 0x43, 0xfb, 0xd1, 0x2d, 0x4b, 0x31, 0x4a,
-  0xe3, 0x18, 0x59, 0x42, 0x4b, 0x41, 0x80, 0x21, 0x5b, 0x00, 0x49, 0x00,
-  0x06, 0x20, 0x99, 0x52, 0x00, 0xf0, 0x56, 0xf9, 0x29, 0x00, 0xc0, 0x00,
-  0x00, 0xf0, 0x60, 0xfb, 0x01, 0x30, 0xc3, 0x09, 0x1e, 0xd1, 0x40, 0x27,
-  0x01, 0x22, 0x62, 0x62, 0xa3, 0x62, 0x26, 0x6b, 0xf3, 0x07, 0x22, 0xd4,
-  0xe3, 0x6a, 0x25, 0x4b, 0x06, 0x20, 0xe5, 0x18, 0x00, 0x23, 0x2b, 0x60,
-  0x26, 0x63, 0x00, 0xf0, 0x3f, 0xf9, 0x39, 0x00, 0x80, 0x00, 0x00, 0xf0,
-  0x49, 0xfb, 0x70, 0x23, 0xe2, 0x6a, 0x5a, 0x40, 0x0e, 0x33, 0x13, 0x40,
-  0x2b, 0x60, 0x1d, 0x4b, 0x23, 0x63, 0x03, 0x23, 0xa3, 0x64, 0xf8, 0xbd,
-  0x1b, 0x4a, 0x93, 0x42, 0x1e, 0xd9, 0x00, 0x23, 0x1a, 0x4a, 0x1b, 0x4f,
-  0x62, 0x62, 0xa3, 0x62, 0x26, 0x6b, 0xf3, 0x07, 0xdc, 0xd5, 0x19, 0x4b,
-  0x14, 0x4a, 0xe3, 0x18, 0x1a, 0x60, 0x65, 0x6a, 0xa3, 0x6a, 0x06, 0x20,
-  0xad, 0x01, 0xed, 0x18, 0x00, 0xf0, 0x1a, 0xf9, 0x14, 0x49, 0x00, 0xf0,
-  0x25, 0xfb, 0xad, 0x02, 0x01, 0x00, 0x28, 0x00, 0x00, 0xf0, 0x20, 0xfb,
-  0x00, 0x21, 0xff, 0xf7, 0x4f, 0xff, 0xc5, 0xe7, 0x40, 0x06, 0x80, 0x0e,
-  0x9f, 0x01, 0x1a, 0x00, 0x3f, 0x18, 0x03, 0x00, 0xb9, 0xe7, 0xc0, 0x46,
-  0x00, 0x80, 0xfc, 0xbf, 0x08, 0xc0, 0x00, 0x40, 0x00, 0xe0, 0x00, 0x40,
-  0x00, 0xf0, 0x00, 0x40, 0xf0, 0x20, 0x00, 0x20, 0x2c, 0x10, 0x00, 0x00,
-  0x01, 0x03, 0x00, 0x00, 0xfe, 0xff, 0x00, 0x00, 0xff, 0xff, 0x00, 0x00,
-  0xc0, 0xff, 0x3f, 0x00, 0x30, 0x30, 0x00, 0x00, 0x4e, 0x0e, 0x00, 0x00,
-  0xf8, 0xb5, 0xde, 0x46, 0x4e, 0x46, 0x57, 0x46, 0x45, 0x46, 0xe0, 0xb5,
-  0x8b, 0x46, 0x05, 0x00, 0x0a, 0x99, 0x18, 0x00, 0x16, 0x00, 0x00, 0xf0,
-  0xef, 0xfa, 0x0a, 0x9b, 0x6c, 0x00, 0x1f, 0x02, 0x32, 0x4b, 0x64, 0x19,
-  0x9c, 0x46, 0xa4, 0x00, 0x64, 0x44, 0x63, 0x68, 0x81, 0x46, 0x9f, 0x42,
-  0x00, 0xd9, 0x67, 0x60, 0x2b, 0x1f, 0xdb, 0xb2, 0x98, 0x46, 0x01, 0x2b,
-  0x30, 0xd9, 0xc0, 0x23, 0x80, 0x22, 0x9b, 0x01, 0xe3, 0x18, 0x12, 0x01,
-  0x1a, 0x60, 0x29, 0x4b, 0xad, 0x00, 0x59, 0x59, 0x9a, 0x46, 0x00, 0x29,
-  0x1b, 0xd1, 0x73, 0x01, 0xe0, 0x26, 0x22, 0x68, 0x53, 0x40, 0x1e, 0x40,
-  0x80, 0x23, 0x42, 0x46, 0x5b, 0x01, 0xe3, 0x18, 0x1e, 0x60, 0x01, 0x2a,
-  0x30, 0xd9, 0x80, 0x23, 0x80, 0x22, 0x9b, 0x01, 0xe3, 0x18, 0x12, 0x01,
-  0x1a, 0x60, 0x53, 0x46, 0x4a, 0x46, 0x67, 0x60, 0x5a, 0x51, 0xf0, 0xbc,
-  0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46, 0xf8, 0xbd, 0x58, 0x69,
-  0x00, 0xf0, 0xb2, 0xfa, 0x01, 0x30, 0x43, 0x00, 0x1b, 0x18, 0x03, 0x3b,
-  0xfd, 0xd2, 0xda, 0xe7, 0x5b, 0x46, 0x01, 0x2b, 0xcb, 0xd1, 0xc0, 0x23,
-  0x03, 0x22, 0x9b, 0x01, 0xe3, 0x18, 0x1a, 0x60, 0x02, 0x3a, 0xa3, 0x68,
-  0x1a, 0x42, 0xfc, 0xd0, 0x73, 0x01, 0xe0, 0x26, 0x22, 0x68, 0xad, 0x00,
-  0x53, 0x40, 0x1e, 0x40, 0x80, 0x23, 0x0a, 0x4a, 0x5b, 0x01, 0x92, 0x46,
-  0xe3, 0x18, 0x1e, 0x60, 0x5a, 0x46, 0x21, 0x68, 0x51, 0x40, 0x03, 0x22,
-  0x0a, 0x40, 0x1a, 0x60, 0x01, 0x22, 0x5b, 0x46, 0x9a, 0x40, 0xa3, 0x68,
-  0x1a, 0x42, 0xfc, 0xd0, 0xc1, 0xe7, 0xc0, 0x46, 0x00, 0x80, 0x00, 0x40,
-  0x58, 0x1c, 0x00, 0x20, 0xf0, 0xb5, 0x46, 0x46, 0x4f, 0x46, 0xd6, 0x46,
-  0xc0, 0xb5, 0x1f, 0x00, 0x34, 0x4b, 0x44, 0x00, 0x9c, 0x46, 0x24, 0x18,
-  0xa4, 0x00, 0x64, 0x44, 0x63, 0x68, 0x88, 0x46, 0x16, 0x00, 0xff, 0x2b,
-  0x02, 0xd8, 0x80, 0x23, 0x5b, 0x00, 0x63, 0x60, 0x03, 0x1f, 0xdb, 0xb2,
-  0x9a, 0x46, 0x01, 0x2b, 0x30, 0xd9, 0xc0, 0x23, 0x80, 0x22, 0x9b, 0x01,
-  0xe3, 0x18, 0x12, 0x01, 0x1a, 0x60, 0x29, 0x4b, 0x85, 0x00, 0x59, 0x59,
-  0x99, 0x46, 0x00, 0x29, 0x1b, 0xd1, 0x73, 0x01, 0xe0, 0x26, 0x22, 0x68,
-  0x53, 0x40, 0x1e, 0x40, 0x80, 0x23, 0x52, 0x46, 0x5b, 0x01, 0xe3, 0x18,
-  0x1e, 0x60, 0x01, 0x2a, 0x30, 0xd9, 0x80, 0x23, 0x80, 0x22, 0x9b, 0x01,
-  0xe3, 0x18, 0x12, 0x01, 0x1a, 0x60, 0x80, 0x23, 0x5b, 0x00, 0x63, 0x60,
-  0x4b, 0x46, 0x5f, 0x51, 0xe0, 0xbc, 0xba, 0x46, 0xb1, 0x46, 0xa8, 0x46,
-  0xf0, 0xbd, 0x58, 0x69, 0x00, 0xf0, 0x3e, 0xfa, 0x01, 0x30, 0x43, 0x00,
-  0x1b, 0x18, 0x03, 0x3b, 0xfd, 0xd2, 0xda, 0xe7, 0x43, 0x46, 0x01, 0x2b,
-  0xcb, 0xd1, 0xc0, 0x23, 0x03, 0x22, 0x9b, 0x01, 0xe3, 0x18, 0x1a, 0x60,
-  0x02, 0x3a, 0xa3, 0x68, 0x1a, 0x42, 0xfc, 0xd0, 0x73, 0x01, 0xe0, 0x26,
-  0x22, 0x68, 0x85, 0x00, 0x53, 0x40, 0x1e, 0x40, 0x80, 0x23, 0x0a, 0x4a,
-  0x5b, 0x01, 0x91, 0x46, 0xe3, 0x18, 0x1e, 0x60, 0x42, 0x46, 0x21, 0x68,
-  0x51, 0x40, 0x03, 0x22, 0x0a, 0x40, 0x1a, 0x60, 0x01, 0x23, 0x42, 0x46,
-  0x93, 0x40, 0xa2, 0x68, 0x13, 0x42, 0xfc, 0xd0, 0xc1, 0xe7, 0xc0, 0x46,
-  0x00, 0x80, 0x00, 0x40, 0x58, 0x1c, 0x00, 0x20, 0x01, 0x4b, 0x80, 0x00,
-  0xc0, 0x58, 0x70, 0x47, 0x58, 0x1c, 0x00, 0x20, 0xf8, 0xb5, 0x04, 0x00,
-  0x20, 0x48, 0x1d, 0x00, 0x17, 0x00, 0x0e, 0x00, 0x00, 0xf0, 0x00, 0xfa,
-  0x01, 0x00, 0x38, 0x00, 0x00, 0xf0, 0xfc, 0xf9, 0x06, 0x9b, 0x29, 0x04,
-  0x1b, 0x03, 0x19, 0x43, 0x23, 0x68, 0x00, 0x2b, 0x1e, 0xdb, 0x19, 0x4b,
-  0x19, 0x4d, 0xe2, 0x18, 0x53, 0x42, 0x5a, 0x41, 0x80, 0x23, 0x5b, 0x01,
-  0x9c, 0x46, 0x12, 0x03, 0x16, 0x4b, 0x62, 0x44, 0x1a, 0x60, 0x16, 0x4b,
-  0x1a, 0x60, 0x17, 0x00, 0x2b, 0x68, 0x9f, 0x43, 0xfb, 0xd1, 0x14, 0x4b,
-  0x26, 0x60, 0xe2, 0x18, 0x21, 0x23, 0xa0, 0x60, 0x13, 0x60, 0x23, 0x68,
-  0x00, 0x2b, 0xfc, 0xda, 0x08, 0x23, 0xe1, 0x60, 0x13, 0x60, 0xf8, 0xbd,
-  0x3f, 0x23, 0x22, 0x68, 0x13, 0x40, 0xb3, 0x42, 0xdb, 0xd1, 0xa3, 0x68,
-  0x1b, 0x05, 0x1b, 0x0d, 0x83, 0x42, 0xd6, 0xd1, 0xee, 0x22, 0xe3, 0x68,
-  0xd2, 0x02, 0x13, 0x40, 0x8b, 0x42, 0xd0, 0xd1, 0xed, 0xe7, 0xc0, 0x46,
-  0x00, 0x1b, 0xb7, 0x00, 0x00, 0x40, 0xfd, 0xbf, 0x08, 0xc0, 0x00, 0x40,
-  0x00, 0xe0, 0x00, 0x40, 0x00, 0xf0, 0x00, 0x40, 0x04, 0x30, 0x00, 0x00,
-  0x10, 0xb5, 0x80, 0x24, 0x1c, 0x4b, 0xe4, 0x05, 0x1c, 0x60, 0x00, 0x28,
-  0x1a, 0xd0, 0x01, 0x23, 0x1a, 0x4c, 0x18, 0x43, 0x1a, 0x4b, 0xdc, 0x61,
-  0x1a, 0x4c, 0x44, 0x40, 0x1c, 0x62, 0x59, 0x62, 0x98, 0x62, 0x80, 0x21,
-  0x14, 0x4b, 0xc9, 0x05, 0x19, 0x60, 0x17, 0x48, 0x17, 0x49, 0x08, 0x60,
-  0xe0, 0x21, 0xc9, 0x04, 0x19, 0x60, 0x00, 0x2a, 0x07, 0xd1, 0x80, 0x22,
-  0x14, 0x4b, 0x12, 0x06, 0x1a, 0x60, 0x10, 0xbd, 0x0e, 0x4b, 0xd8, 0x61,
-  0xeb, 0xe7, 0x53, 0x01, 0x9b, 0x1a, 0x9b, 0x00, 0x9a, 0x18, 0x80, 0x23,
-  0x12, 0x01, 0x5b, 0x04, 0x9a, 0x42, 0x09, 0xd2, 0x13, 0x00, 0x0d, 0x49,
-  0x0b, 0x60, 0x07, 0x4b, 0x5a, 0x60, 0x80, 0x22, 0x09, 0x4b, 0xd2, 0x05,
-  0x1a, 0x60, 0xe8, 0xe7, 0x09, 0x4b, 0x1a, 0x00, 0xf3, 0xe7, 0xc0, 0x46,
-  0x00, 0xb0, 0x05, 0x40, 0xd3, 0xc0, 0x07, 0xb0, 0x00, 0x80, 0x05, 0x40,
-  0x2d, 0x3f, 0xf8, 0x4f, 0xfc, 0xff, 0x01, 0x00, 0x08, 0x20, 0x01, 0x40,
-  0x00, 0xa0, 0x05, 0x40, 0xb8, 0x20, 0x00, 0x20, 0xff, 0xff, 0xff, 0x00,
-  0x80, 0x23, 0x02, 0x4a, 0x9b, 0x00, 0x0b, 0x43, 0xd3, 0x62, 0x70, 0x47,
-  0x00, 0x80, 0x05, 0x40, 0x14, 0x23, 0x10, 0xb5, 0x01, 0x00, 0x18, 0x88,
-  0x04, 0x33, 0x1b, 0x88, 0x98, 0x47, 0x10, 0xbd, 0x16, 0x23, 0x10, 0xb5,
-  0x01, 0x00, 0x18, 0x88, 0x02, 0x33, 0x1b, 0x88, 0x98, 0x47, 0x10, 0xbd,
-  0xf8, 0xb5, 0x47, 0x46, 0xce, 0x46, 0x80, 0xb5, 0x0f, 0x1e, 0x19, 0xd0,
-  0x14, 0x23, 0x99, 0x46, 0x04, 0x33, 0x04, 0x00, 0x00, 0x25, 0x01, 0x26,
-  0x98, 0x46, 0x4b, 0x46, 0x18, 0x88, 0x43, 0x46, 0x21, 0x68, 0x1b, 0x88,
-  0x98, 0x47, 0x01, 0xc4, 0x43, 0x1e, 0x98, 0x41, 0x01, 0x35, 0x40, 0x42,
-  0x06, 0x40, 0xaf, 0x42, 0xf1, 0xd1, 0x30, 0x00, 0xc0, 0xbc, 0xb9, 0x46,
-  0xb0, 0x46, 0xf8, 0xbd, 0x01, 0x26, 0xf8, 0xe7, 0x14, 0x23, 0x70, 0xb5,
-  0x04, 0x00, 0x18, 0x88, 0x04, 0x33, 0x1b, 0x88, 0x0d, 0x00, 0x05, 0x49,
-  0x98, 0x47, 0x03, 0x00, 0x00, 0x20, 0x00, 0x2c, 0x01, 0xdb, 0x01, 0x30,
-  0xa0, 0x40, 0x29, 0x00, 0x98, 0x47, 0xc0, 0x46, 0x55, 0x42, 0x00, 0x00,
-  0xaa, 0x23, 0x06, 0x4a, 0x1b, 0x01, 0x13, 0x60, 0x2f, 0x23, 0x05, 0x49,
-  0xd3, 0x60, 0x05, 0x4b, 0x19, 0x60, 0x53, 0x68, 0x00, 0x2b, 0xfc, 0xda,
-  0x70, 0x47, 0xc0, 0x46, 0x00, 0x40, 0x02, 0x40, 0x00, 0xb0, 0xfa, 0x00,
-  0x00, 0x60, 0x02, 0x40, 0x70, 0x47, 0xc0, 0x46, 0x10, 0xb5, 0x01, 0x48,
-  0xfe, 0xf7, 0x3a, 0xfd, 0xb8, 0x6e, 0x00, 0x10, 0x70, 0xb5, 0x07, 0x4d,
-  0x07, 0x4e, 0xb5, 0x42, 0x09, 0xd2, 0x00, 0x24, 0x01, 0x3e, 0x76, 0x1b,
-  0xb6, 0x08, 0x08, 0xcd, 0x98, 0x47, 0x23, 0x00, 0x01, 0x34, 0xb3, 0x42,
-  0xf9, 0xd1, 0x70, 0xbd, 0xe8, 0x6d, 0x00, 0x10, 0x24, 0x6e, 0x00, 0x10,
-  0x05, 0x4b, 0x06, 0x4a, 0x06, 0x49, 0x1a, 0x60, 0x06, 0x4a, 0x07, 0x4b,
-  0x1a, 0x60, 0x10, 0x00, 0x0b, 0x68, 0x98, 0x43, 0xfb, 0xd1, 0x70, 0x47,
-  0x00, 0xe0, 0x00, 0x40, 0xbf, 0xcd, 0xfb, 0xfe, 0x08, 0xc0, 0x00, 0x40,
-  0xfe, 0x7f, 0x3c, 0x00, 0x00, 0xf0, 0x00, 0x40, 0x04, 0x4b, 0xdb, 0x6c,
-  0x00, 0x2b, 0x03, 0xd1, 0x80, 0x22, 0x03, 0x4b, 0xd2, 0x02, 0x1a, 0x60,
-  0x70, 0x47, 0xc0, 0x46, 0x00, 0x00, 0x11, 0x50, 0x4c, 0x20, 0x11, 0x50,
-  0x04, 0x4a, 0x05, 0x4b, 0x1a, 0x60, 0x05, 0x4a, 0x13, 0x68, 0xdb, 0x01,
-  0x80, 0x33, 0xfb, 0xd1, 0x70, 0x47, 0xc0, 0x46, 0xff, 0xff, 0xff, 0x01,
-  0x00, 0xf0, 0x00, 0x40, 0x08, 0xc0, 0x00, 0x40, 0x40, 0x22, 0x03, 0x4b,
-  0x9a, 0x67, 0x5a, 0x67, 0x1a, 0x67, 0xda, 0x66, 0x70, 0x47, 0xc0, 0x46,
-  0x00, 0xf0, 0x01, 0x40, 0x10, 0xb5, 0xfe, 0xf7, 0x89, 0xfd, 0x10, 0xbd,
-  0x70, 0xb5, 0x04, 0x4d, 0x04, 0x4c, 0xa9, 0x68, 0xc0, 0x22, 0x20, 0x00,
-  0x00, 0xf0, 0x2e, 0xff, 0xac, 0x60, 0x70, 0xbd, 0x00, 0xed, 0x00, 0xe0,
-  0x00, 0x00, 0x00, 0x20, 0x00, 0x23, 0x10, 0xb5, 0x29, 0x4c, 0x82, 0xb0,
-  0xa3, 0x67, 0xff, 0xf7, 0x79, 0xff, 0x01, 0x22, 0x27, 0x4b, 0x1a, 0x60,
-  0x63, 0x6c, 0x01, 0x2b, 0xfc, 0xd1, 0x03, 0x22, 0x25, 0x4b, 0x1a, 0x60,
-  0x22, 0x4a, 0x93, 0x6b, 0x01, 0x2b, 0xfc, 0xd1, 0x01, 0x33, 0x00, 0x93,
-  0x01, 0x21, 0x22, 0x4a, 0x22, 0x48, 0x04, 0x33, 0xff, 0xf7, 0x78, 0xfe,
-  0x05, 0x23, 0x01, 0x21, 0x00, 0x93, 0x20, 0x4a, 0x20, 0x48, 0xff, 0xf7,
-  0x71, 0xfe, 0x00, 0x22, 0x02, 0x21, 0x04, 0x20, 0x1e, 0x4b, 0xff, 0xf7,
-  0xf1, 0xfd, 0x00, 0x22, 0x01, 0x21, 0x05, 0x20, 0x1c, 0x4b, 0xff, 0xf7,
-  0xeb, 0xfd, 0x00, 0x22, 0x00, 0x21, 0x07, 0x20, 0x1a, 0x4b, 0xff, 0xf7,
-  0xe5, 0xfd, 0x00, 0x22, 0x00, 0x21, 0x08, 0x20, 0x17, 0x4b, 0xff, 0xf7,
-  0xdf, 0xfd, 0x80, 0x23, 0xdb, 0x00, 0x00, 0x93, 0x00, 0x22, 0x00, 0x21,
-  0x09, 0x20, 0x13, 0x4b, 0xff, 0xf7, 0x5c, 0xfd, 0x00, 0x22, 0x10, 0x4b,
-  0x00, 0x21, 0x06, 0x20, 0xff, 0xf7, 0xd0, 0xfd, 0x04, 0x20, 0xff, 0xf7,
-  0x41, 0xfe, 0x0e, 0x49, 0x00, 0xf0, 0x4c, 0xf8, 0x01, 0x00, 0x00, 0x20,
-  0xff, 0xf7, 0xde, 0xfe, 0x02, 0xb0, 0x10, 0xbd, 0x00, 0x80, 0x00, 0x40,
-  0x3c, 0xb0, 0x00, 0x40, 0x30, 0xb0, 0x00, 0x40, 0x00, 0x2f, 0x68, 0x59,
-  0x00, 0x80, 0x02, 0x40, 0x00, 0x8c, 0x86, 0x47, 0x00, 0xc0, 0x02, 0x40,
-  0x00, 0x1b, 0xb7, 0x00, 0x40, 0x59, 0x73, 0x07, 0x00, 0x6c, 0xdc, 0x02,
-  0x40, 0x42, 0x0f, 0x00, 0x01, 0x48, 0x04, 0x21, 0x01, 0x4b, 0x18, 0x47,
-  0x10, 0x10, 0x00, 0x20, 0xf1, 0x18, 0x00, 0x10, 0x12, 0x4a, 0x93, 0x6f,
-  0x9b, 0x08, 0x15, 0xd2, 0x90, 0x66, 0xd1, 0x66, 0x00, 0x29, 0x05, 0xd0,
-  0xff, 0xe7, 0xff, 0xe7, 0xff, 0xe7, 0x51, 0x6f, 0x10, 0x6f, 0x70, 0x47,
-  0x04, 0xb5, 0x80, 0x21, 0x09, 0x06, 0xc2, 0x17, 0x51, 0x40, 0x00, 0x28,
-  0x00, 0xd0, 0xc8, 0x43, 0x05, 0xf0, 0xfa, 0xf8, 0x00, 0x21, 0x04, 0xbd,
-  0xf0, 0xb5, 0x14, 0x6e, 0x55, 0x6e, 0x57, 0x6f, 0x16, 0x6f, 0xff, 0xf7,
-  0xe3, 0xff, 0x14, 0x66, 0x55, 0x66, 0x57, 0x67, 0x16, 0x67, 0xf0, 0xbd,
-  0x00, 0x00, 0x00, 0xd0, 0x11, 0x4a, 0x93, 0x6f, 0x9b, 0x08, 0x13, 0xd2,
-  0x10, 0x66, 0x51, 0x66, 0x00, 0x29, 0x05, 0xd0, 0xff, 0xe7, 0xff, 0xe7,
-  0xff, 0xe7, 0x51, 0x6f, 0x10, 0x6f, 0x70, 0x47, 0x04, 0xb5, 0x00, 0x28,
-  0x01, 0xd0, 0x00, 0x20, 0xc0, 0x43, 0x05, 0xf0, 0xd5, 0xf8, 0x00, 0x21,
-  0x04, 0xbd, 0xc0, 0x46, 0xf0, 0xb5, 0x14, 0x6e, 0x55, 0x6e, 0x57, 0x6f,
-  0x16, 0x6f, 0xff, 0xf7, 0xe5, 0xff, 0x14, 0x66, 0x55, 0x66, 0x57, 0x67,
-  0x16, 0x67, 0xf0, 0xbd, 0x00, 0x00, 0x00, 0xd0, 0x94, 0x46, 0x4a, 0x4a,
-  0x92, 0x6f, 0x92, 0x08, 0x62, 0x46, 0x01, 0xd2, 0x28, 0xe0, 0xc0, 0x46,
-  0xf0, 0xb5, 0x46, 0x4e, 0x34, 0x6e, 0x75, 0x6e, 0x77, 0x6f, 0x36, 0x6f,
-  0x00, 0xf0, 0x20, 0xf8, 0x94, 0x46, 0x42, 0x4a, 0x14, 0x66, 0x55, 0x66,
-  0x57, 0x67, 0x16, 0x67, 0x62, 0x46, 0xf0, 0xbd, 0x94, 0x46, 0x3e, 0x4a,
-  0x92, 0x6f, 0x92, 0x08, 0x62, 0x46, 0x01, 0xd2, 0x54, 0xe0, 0xc0, 0x46,
-  0xf0, 0xb5, 0x3a, 0x4e, 0x34, 0x6e, 0x75, 0x6e, 0x77, 0x6f, 0x36, 0x6f,
-  0x00, 0xf0, 0x4c, 0xf8, 0x94, 0x46, 0x36, 0x4a, 0x14, 0x66, 0x55, 0x66,
-  0x57, 0x67, 0x16, 0x67, 0x62, 0x46, 0xf0, 0xbd, 0x00, 0x2b, 0x24, 0xdb,
-  0x11, 0xd0, 0x00, 0x29, 0x3e, 0xda, 0x00, 0xb5, 0xc9, 0x43, 0x40, 0x42,
-  0x00, 0xd1, 0x01, 0x31, 0x00, 0xf0, 0x38, 0xf8, 0xc9, 0x43, 0x40, 0x42,
-  0x00, 0xd1, 0x01, 0x31, 0xdb, 0x43, 0x52, 0x42, 0x00, 0xd1, 0x01, 0x33,
-  0x00, 0xbd, 0x00, 0x2a, 0xeb, 0xd1, 0x00, 0x28, 0x01, 0xd1, 0x00, 0x29,
-  0x05, 0xd0, 0x00, 0x20, 0xc9, 0x0f, 0xc9, 0x07, 0x01, 0xd1, 0xc0, 0x43,
-  0x41, 0x08, 0x00, 0xb5, 0x05, 0xf0, 0x60, 0xf8, 0x00, 0x22, 0x00, 0x23,
-  0x00, 0xbd, 0x00, 0xb5, 0x00, 0x29, 0x0a, 0xdb, 0xdb, 0x43, 0x52, 0x42,
-  0x00, 0xd1, 0x01, 0x33, 0x00, 0xf0, 0x14, 0xf8, 0xc9, 0x43, 0x40, 0x42,
-  0x00, 0xd1, 0x01, 0x31, 0x00, 0xbd, 0xc9, 0x43, 0x40, 0x42, 0x00, 0xd1,
-  0x01, 0x31, 0xdb, 0x43, 0x52, 0x42, 0x00, 0xd1, 0x01, 0x33, 0x00, 0xf0,
-  0x05, 0xf8, 0xdb, 0x43, 0x52, 0x42, 0x00, 0xd1, 0x01, 0x33, 0x00, 0xbd,
-  0x00, 0x29, 0x23, 0xd1, 0x00, 0x2b, 0x18, 0xd1, 0x00, 0x2a, 0x0c, 0xd0,
-  0xbc, 0x46, 0x0d, 0x4f, 0x38, 0x66, 0x7a, 0x66, 0x00, 0x21, 0x00, 0x23,
-  0xff, 0xe7, 0xff, 0xe7, 0xff, 0xe7, 0x7a, 0x6f, 0x38, 0x6f, 0x67, 0x46,
-  0x70, 0x47, 0x00, 0x28, 0x01, 0xd0, 0x07, 0x48, 0x01, 0x00, 0x00, 0xb5,
-  0x05, 0xf0, 0x26, 0xf8, 0x00, 0x22, 0x00, 0x23, 0x00, 0xbd, 0x02, 0x00,
-  0x0b, 0x00, 0x00, 0x20, 0x00, 0x21, 0x70, 0x47, 0x00, 0x00, 0x00, 0xd0,
-  0xff, 0xff, 0xff, 0xff, 0x00, 0x2b, 0x00, 0xd0, 0xbf, 0xe0, 0x13, 0x0c,
-  0x28, 0xd1, 0x00, 0x2a, 0xe7, 0xd0, 0x80, 0xb4, 0x11, 0x4f, 0x39, 0x66,
-  0x7a, 0x66, 0xff, 0xe7, 0xff, 0xe7, 0x30, 0xb4, 0x04, 0x0c, 0x7b, 0x6f,
-  0x39, 0x6f, 0x1b, 0x04, 0x23, 0x43, 0x3b, 0x66, 0x7a, 0x66, 0xff, 0xe7,
-  0xff, 0xe7, 0xff, 0xe7, 0xc0, 0x46, 0x84, 0xb2, 0x7b, 0x6f, 0x3d, 0x6f,
-  0x1b, 0x04, 0x23, 0x43, 0x3b, 0x66, 0x7a, 0x66, 0xff, 0xe7, 0xff, 0xe7,
-  0xc0, 0x46, 0x00, 0x23, 0x2c, 0x04, 0x2d, 0x0c, 0x7a, 0x6f, 0x38, 0x6f,
-  0x00, 0x19, 0x69, 0x41, 0xb0, 0xbc, 0x70, 0x47, 0x00, 0x00, 0x00, 0xd0,
-  0xf0, 0xb5, 0x94, 0x46, 0x00, 0x25, 0x14, 0x0e, 0x01, 0xd1, 0x12, 0x02,
-  0x08, 0x35, 0x14, 0x0f, 0x01, 0xd1, 0x12, 0x01, 0x04, 0x35, 0x94, 0x0f,
-  0x01, 0xd1, 0x92, 0x00, 0x02, 0x35, 0xd4, 0x0f, 0x01, 0xd1, 0x52, 0x00,
-  0x01, 0x35, 0xd4, 0x0b, 0x01, 0x34, 0x25, 0x4f, 0x7c, 0x66, 0x25, 0x4c,
-  0x3c, 0x66, 0x0e, 0x0c, 0x93, 0xb2, 0xff, 0xe7, 0xff, 0xe7, 0xff, 0xe7,
-  0x3c, 0x6f, 0x66, 0x43, 0x36, 0x0c, 0x77, 0x03, 0xbe, 0x46, 0x73, 0x43,
-  0xdf, 0x0b, 0x5b, 0x04, 0xc0, 0x1a, 0xb9, 0x41, 0x13, 0x0c, 0x73, 0x43,
-  0xdb, 0x18, 0xc9, 0x1a, 0xce, 0x08, 0x66, 0x43, 0x36, 0x0c, 0xb6, 0x44,
-  0x93, 0xb2, 0x73, 0x43, 0x1f, 0x0f, 0x1b, 0x01, 0xc0, 0x1a, 0xb9, 0x41,
-  0x13, 0x0c, 0x73, 0x43, 0x1f, 0x0b, 0x1b, 0x05, 0xc0, 0x1a, 0xb9, 0x41,
-  0x86, 0x0d, 0x8f, 0x02, 0x3e, 0x43, 0x66, 0x43, 0x36, 0x0c, 0x09, 0x2d,
-  0x24, 0xdb, 0x52, 0x0a, 0x72, 0x43, 0x80, 0x1a, 0x77, 0x03, 0x46, 0x0a,
-  0x66, 0x43, 0x36, 0x0c, 0x16, 0x23, 0x5b, 0x1b, 0xde, 0x40, 0xdf, 0x40,
-  0xbf, 0x19, 0x64, 0x46, 0x66, 0x43, 0x82, 0x1b, 0x70, 0x46, 0x04, 0x35,
-  0x06, 0x33, 0x01, 0x00, 0xd9, 0x40, 0xa8, 0x40, 0xc0, 0x19, 0x00, 0xd3,
-  0x01, 0x31, 0xa2, 0x42, 0x06, 0xd2, 0x00, 0x23, 0xf0, 0xbd, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0xd0, 0xff, 0xff, 0xff, 0xff, 0x12, 0x1b, 0x01, 0x30,
-  0xf3, 0xd3, 0xf1, 0xe7, 0x09, 0x27, 0x7f, 0x1b, 0xfe, 0x40, 0x64, 0x46,
-  0xa2, 0xb2, 0x72, 0x43, 0x80, 0x1a, 0x00, 0xd2, 0x01, 0x39, 0x22, 0x0c,
-  0x72, 0x43, 0x13, 0x0c, 0x12, 0x04, 0x82, 0x1a, 0x99, 0x41, 0x0b, 0x00,
-  0x70, 0x46, 0x04, 0x35, 0x13, 0x37, 0x01, 0x00, 0xf9, 0x40, 0xa8, 0x40,
-  0x80, 0x19, 0x00, 0xd3, 0x01, 0x31, 0x00, 0x2b, 0x02, 0xd1, 0xa2, 0x42,
-  0x0a, 0xd2, 0xf0, 0xbd, 0x01, 0x30, 0x00, 0xd3, 0x01, 0x31, 0x12, 0x1b,
-  0xfa, 0xd2, 0x01, 0x3b, 0xf8, 0xd1, 0xa2, 0x42, 0x00, 0xd2, 0xf0, 0xbd,
-  0x01, 0x30, 0x00, 0xd3, 0x01, 0x31, 0x12, 0x1b, 0xf7, 0xe7, 0xf0, 0xb5,
-  0x1c, 0x0c, 0x00, 0xd0, 0x80, 0xe0, 0x0c, 0xb4, 0x00, 0x25, 0x1c, 0x0a,
-  0x04, 0xd1, 0x1b, 0x02, 0x16, 0x0e, 0x33, 0x43, 0x12, 0x02, 0x08, 0x35,
-  0x1c, 0x0b, 0x04, 0xd1, 0x1b, 0x01, 0x16, 0x0f, 0x33, 0x43, 0x12, 0x01,
-  0x04, 0x35, 0x9c, 0x0b, 0x04, 0xd1, 0x9b, 0x00, 0x96, 0x0f, 0x33, 0x43,
-  0x92, 0x00, 0x02, 0x35, 0xdc, 0x0b, 0x02, 0xd1, 0x92, 0x18, 0x5b, 0x41,
-  0x01, 0x35, 0x1c, 0x00, 0x97, 0x18, 0x64, 0x41, 0x01, 0x34, 0x46, 0x4f,
-  0x7c, 0x66, 0x46, 0x4c, 0x3c, 0x66, 0x0e, 0x0c, 0xff, 0xe7, 0xff, 0xe7,
-  0xff, 0xe7, 0xc0, 0x46, 0x3c, 0x6f, 0x66, 0x43, 0x36, 0x0c, 0x77, 0x03,
-  0xbe, 0x46, 0x97, 0xb2, 0x77, 0x43, 0xc0, 0x1b, 0x00, 0xd2, 0x01, 0x39,
-  0xc0, 0x1b, 0x00, 0xd2, 0x01, 0x39, 0x9f, 0xb2, 0x77, 0x43, 0xc9, 0x1b,
-  0xc9, 0x1b, 0x17, 0x0c, 0x77, 0x43, 0x7e, 0x04, 0xff, 0x0b, 0x80, 0x1b,
-  0xb9, 0x41, 0xce, 0x08, 0x66, 0x43, 0x36, 0x0c, 0x0c, 0x2d, 0x33, 0xdb,
-  0xb6, 0x44, 0x12, 0x0b, 0x1f, 0x05, 0x3a, 0x43, 0x1b, 0x0b, 0x97, 0xb2,
-  0x77, 0x43, 0xc0, 0x1b, 0x00, 0xd2, 0x01, 0x39, 0x9f, 0xb2, 0x77, 0x43,
-  0xc9, 0x1b, 0x17, 0x0c, 0x77, 0x43, 0x3e, 0x04, 0x3f, 0x0c, 0x80, 0x1b,
-  0xb9, 0x41, 0x86, 0x0d, 0x8f, 0x02, 0x3e, 0x43, 0x66, 0x43, 0x29, 0x27,
-  0x7f, 0x1b, 0xfe, 0x40, 0x0c, 0x3d, 0x77, 0x46, 0xaf, 0x40, 0xbf, 0x19,
-  0x30, 0xbc, 0xa2, 0xb2, 0xab, 0xb2, 0x72, 0x43, 0x73, 0x43, 0x80, 0x1a,
-  0x99, 0x41, 0x22, 0x0c, 0x72, 0x43, 0x13, 0x0c, 0x12, 0x04, 0x80, 0x1a,
-  0x99, 0x41, 0x02, 0x00, 0x0b, 0x00, 0x01, 0x37, 0x00, 0x1b, 0xa9, 0x41,
-  0xf9, 0xd2, 0x78, 0x1e, 0x00, 0x21, 0xf0, 0xbd, 0x0c, 0x27, 0x7f, 0x1b,
-  0xfe, 0x40, 0x77, 0x46, 0x7f, 0x0b, 0xaf, 0x40, 0xff, 0x19, 0xe0, 0xe7,
-  0x00, 0x24, 0x5d, 0x1c, 0x07, 0xd0, 0x14, 0x4f, 0x7d, 0x66, 0x39, 0x66,
-  0xff, 0xe7, 0xff, 0xe7, 0xff, 0xe7, 0xff, 0xe7, 0x3c, 0x6f, 0x95, 0xb2,
-  0x9e, 0xb2, 0x65, 0x43, 0x66, 0x43, 0x40, 0x1b, 0xb1, 0x41, 0x15, 0x0c,
-  0x1e, 0x0c, 0x65, 0x43, 0x66, 0x43, 0x36, 0x04, 0x2f, 0x0c, 0x3e, 0x43,
-  0x2d, 0x04, 0x40, 0x1b, 0xb1, 0x41, 0x99, 0x42, 0x04, 0xd2, 0x02, 0x00,
-  0x0b, 0x00, 0x20, 0x00, 0x00, 0x21, 0xf0, 0xbd, 0x01, 0xd1, 0x90, 0x42,
-  0xf7, 0xd3, 0x80, 0x1a, 0x99, 0x41, 0x01, 0x34, 0x99, 0x42, 0xf2, 0xd3,
-  0xf6, 0xe7, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd0, 0xff, 0xff, 0xff, 0xff,
-  0x48, 0x40, 0x41, 0x40, 0x48, 0x40, 0x18, 0xb4, 0x1b, 0x4b, 0x5b, 0x68,
-  0xfc, 0x46, 0x01, 0x93, 0x08, 0xbd, 0x04, 0xdf, 0x9f, 0x22, 0x00, 0x10,
-  0x18, 0xb4, 0x17, 0x4b, 0x1b, 0x68, 0xfc, 0x46, 0x01, 0x93, 0x08, 0xbd,
-  0x00, 0xdf, 0xa9, 0x22, 0x00, 0x10, 0x94, 0x46, 0x13, 0x4a, 0x92, 0x6f,
-  0x92, 0x08, 0x09, 0xd2, 0x62, 0x46, 0x18, 0xb4, 0x0f, 0x4b, 0xdb, 0x68,
-  0xfc, 0x46, 0x01, 0x93, 0x08, 0xbd, 0x0c, 0xdf, 0x61, 0x25, 0x00, 0x10,
-  0x0c, 0x4a, 0xf0, 0xb5, 0x14, 0x6e, 0x55, 0x6e, 0x57, 0x6f, 0x16, 0x6f,
-  0x62, 0x46, 0xff, 0xf7, 0xee, 0xff, 0x08, 0x4a, 0x14, 0x66, 0x55, 0x66,
-  0x57, 0x67, 0x16, 0x67, 0xf0, 0xbd, 0x18, 0xb4, 0x03, 0x4b, 0x9b, 0x68,
-  0xfc, 0x46, 0x01, 0x93, 0x08, 0xbd, 0x08, 0xdf, 0x05, 0x24, 0x00, 0x10,
-  0x10, 0x12, 0x00, 0x20, 0x00, 0x00, 0x00, 0xd0, 0xff, 0xb5, 0x50, 0x40,
-  0x42, 0x40, 0x50, 0x40, 0x59, 0x40, 0x4b, 0x40, 0x59, 0x40, 0x00, 0xe0,
-  0xff, 0xb5, 0x15, 0x4f, 0x4c, 0x00, 0x64, 0x0d, 0x03, 0xd0, 0xbc, 0x42,
-  0x04, 0xd1, 0x0c, 0x03, 0x14, 0xd8, 0x00, 0x20, 0x09, 0x0d, 0x09, 0x05,
-  0x5c, 0x00, 0x64, 0x0d, 0x03, 0xd0, 0xbc, 0x42, 0x04, 0xd1, 0x1c, 0x03,
-  0x0a, 0xd8, 0x00, 0x22, 0x1b, 0x0d, 0x1b, 0x05, 0x01, 0x26, 0x4b, 0x40,
-  0x09, 0xd4, 0x4b, 0x40, 0x03, 0xd5, 0x8b, 0x42, 0x00, 0xd1, 0x82, 0x42,
-  0xff, 0xbd, 0x99, 0x42, 0xfc, 0xd1, 0x90, 0x42, 0xff, 0xbd, 0x0b, 0x43,
-  0xdb, 0x18, 0x03, 0x43, 0x13, 0x43, 0xf5, 0xd0, 0xc9, 0x43, 0x49, 0x18,
-  0xff, 0xbd, 0x00, 0x00, 0xff, 0x07, 0x00, 0x00, 0x00, 0xb5, 0xff, 0xf7,
-  0xcf, 0xff, 0x80, 0x41, 0x00, 0xbd, 0xc0, 0x46, 0x00, 0xb5, 0xff, 0xf7,
-  0xc1, 0xff, 0x01, 0xd9, 0x00, 0x20, 0x00, 0xbd, 0x01, 0x20, 0x00, 0xbd,
-  0x00, 0xb5, 0xff, 0xf7, 0xb9, 0xff, 0x80, 0x41, 0x00, 0xbd, 0x01, 0x20,
-  0x40, 0x05, 0x4a, 0x00, 0x12, 0x18, 0x04, 0xd8, 0x5a, 0x00, 0x12, 0x18,
-  0x01, 0xd8, 0x00, 0x20, 0x70, 0x47, 0x01, 0x20, 0x70, 0x47, 0x00, 0x00,
-  0x00, 0x21, 0x00, 0x28, 0x05, 0xd1, 0x70, 0x47, 0xc1, 0x17, 0x48, 0x40,
-  0x40, 0x1a, 0xfa, 0xd0, 0xc9, 0x07, 0x13, 0xb5, 0x06, 0x4b, 0x1b, 0x68,
-  0x98, 0x47, 0x0c, 0xbc, 0x44, 0x1c, 0xa2, 0x40, 0x10, 0x05, 0x12, 0x0b,
-  0x03, 0x49, 0x09, 0x1b, 0x09, 0x05, 0x19, 0x43, 0x11, 0x43, 0x10, 0xbd,
-  0xe0, 0x20, 0x00, 0x20, 0x1f, 0x04, 0x00, 0x00, 0x10, 0xb5, 0x4c, 0x00,
-  0x62, 0x0d, 0x80, 0x23, 0xd2, 0x18, 0xdb, 0x00, 0xd2, 0x1a, 0x5b, 0x05,
-  0x7e, 0x2a, 0x10, 0xdd, 0x9e, 0x3a, 0x13, 0xda, 0xcc, 0x17, 0x09, 0x03,
-  0x49, 0x08, 0x19, 0x43, 0x52, 0x42, 0xd1, 0x40, 0x64, 0x00, 0x01, 0x34,
-  0x15, 0x32, 0x20, 0x2a, 0x05, 0xda, 0xd0, 0x40, 0x08, 0x43, 0x60, 0x43,
-  0x10, 0xbd, 0x00, 0x20, 0x10, 0xbd, 0x08, 0x46, 0x60, 0x43, 0x10, 0xbd,
-  0xc8, 0x0f, 0xc0, 0x18, 0x01, 0x38, 0x10, 0xbd, 0x18, 0xb4, 0x04, 0x4b,
-  0x5b, 0x6a, 0xfc, 0x46, 0x01, 0x93, 0x08, 0xbd, 0x24, 0xdf, 0x11, 0x27,
-  0x00, 0x10, 0x00, 0x00, 0x10, 0x12, 0x00, 0x20, 0x13, 0x23, 0x70, 0xb5,
-  0x1d, 0x78, 0x01, 0x2d, 0x19, 0xd0, 0x14, 0xdd, 0x1f, 0x48, 0xff, 0xf7,
-  0x83, 0xfb, 0x06, 0x00, 0x1e, 0x48, 0xff, 0xf7, 0x7f, 0xfb, 0x1e, 0x4c,
-  0x80, 0x22, 0x31, 0x00, 0x20, 0x00, 0x00, 0xf0, 0x5f, 0xfb, 0x02, 0x2d,
-  0x2d, 0xd0, 0x1b, 0x48, 0xff, 0xf7, 0x6c, 0xfb, 0x1a, 0x4b, 0x18, 0x60,
-  0x70, 0xbd, 0x1a, 0x4b, 0x16, 0x4c, 0xa3, 0x64, 0xf5, 0xe7, 0x18, 0x4b,
-  0x14, 0x4c, 0x23, 0x60, 0x63, 0x60, 0xa3, 0x60, 0xe3, 0x60, 0x23, 0x61,
-  0x63, 0x61, 0xa3, 0x61, 0xe3, 0x61, 0x23, 0x62, 0x63, 0x62, 0xa3, 0x62,
-  0xe3, 0x62, 0x23, 0x63, 0x63, 0x63, 0xa3, 0x63, 0xe3, 0x63, 0x23, 0x64,
-  0x63, 0x64, 0xa3, 0x64, 0xe3, 0x64, 0x23, 0x65, 0x63, 0x65, 0xa3, 0x65,
-  0xe3, 0x65, 0x23, 0x66, 0x63, 0x66, 0xa3, 0x66, 0xe3, 0x66, 0x23, 0x67,
-  0x63, 0x67, 0xa3, 0x67, 0xe3, 0x67, 0xa3, 0x64, 0xd1, 0xe7, 0x06, 0x4b,
-  0xa3, 0x64, 0xce, 0xe7, 0x53, 0x44, 0x00, 0x00, 0x53, 0x46, 0x00, 0x00,
-  0x10, 0x12, 0x00, 0x20, 0x4c, 0x33, 0x00, 0x00, 0xe0, 0x20, 0x00, 0x20,
-  0x6d, 0x22, 0x00, 0x10, 0x07, 0xb5, 0x60, 0x46, 0x01, 0x88, 0x0a, 0x0a,
-  0x02, 0x30, 0xdf, 0x2a, 0xfa, 0xd1, 0xc9, 0xb2, 0x82, 0x08, 0x04, 0xd3,
-  0x02, 0x88, 0x40, 0x88, 0x00, 0x04, 0x10, 0x43, 0x00, 0xe0, 0x00, 0x68,
-  0x01, 0x4a, 0x50, 0x50, 0x03, 0x90, 0x07, 0xbd, 0x10, 0x12, 0x00, 0x20,
-  0x0f, 0xb4, 0x03, 0xbc, 0x0c, 0xbc, 0xf0, 0xb5, 0x01, 0x24, 0xe4, 0x07,
-  0x63, 0x40, 0x00, 0xe0, 0xf0, 0xb5, 0x0c, 0x0d, 0xcf, 0x0f, 0x66, 0x1e,
-  0x36, 0x05, 0x89, 0x1b, 0x64, 0x05, 0x03, 0xd3, 0xc9, 0x43, 0x40, 0x42,
-  0x00, 0xd3, 0x01, 0x31, 0x64, 0x0d, 0x03, 0xd0, 0x66, 0x1c, 0xf6, 0x0a,
-  0x07, 0xd0, 0xe4, 0x1b, 0x00, 0x20, 0x7f, 0x00, 0x79, 0x1c, 0x89, 0x07,
-  0x89, 0x12, 0x80, 0x3c, 0x24, 0x03, 0x1d, 0x0d, 0xdf, 0x0f, 0x6e, 0x1e,
-  0x36, 0x05, 0x9b, 0x1b, 0x6d, 0x05, 0x03, 0xd3, 0xdb, 0x43, 0x52, 0x42,
-  0x00, 0xd3, 0x01, 0x33, 0x6d, 0x0d, 0x03, 0xd0, 0x6e, 0x1c, 0xf6, 0x0a,
-  0x07, 0xd0, 0xed, 0x1b, 0x00, 0x22, 0x7f, 0x00, 0x7b, 0x1c, 0x9b, 0x07,
-  0x9b, 0x12, 0x80, 0x3d, 0x2d, 0x03, 0x2f, 0x1b, 0x66, 0x1b, 0x58, 0xd4,
-  0xa4, 0x46, 0x20, 0x2e, 0x46, 0xda, 0x20, 0x37, 0x14, 0x00, 0xbc, 0x40,
-  0x1d, 0x00, 0xbd, 0x40, 0xf2, 0x40, 0x33, 0x41, 0x2a, 0x43, 0x80, 0x18,
-  0x59, 0x41, 0xcb, 0x0f, 0x05, 0xd0, 0xc9, 0x43, 0xc0, 0x43, 0x00, 0x22,
-  0x64, 0x42, 0x50, 0x41, 0x51, 0x41, 0x62, 0x46, 0x4d, 0x0d, 0x28, 0xd1,
-  0x0d, 0x0d, 0x07, 0xd1, 0x00, 0x28, 0x1f, 0xd0, 0x24, 0x19, 0x40, 0x41,
-  0x49, 0x41, 0x01, 0x3a, 0x0d, 0x0d, 0xf9, 0xd0, 0x64, 0x00, 0x06, 0xd3,
-  0x01, 0x30, 0x00, 0xd3, 0x01, 0x31, 0x00, 0x2c, 0x01, 0xd1, 0x40, 0x08,
-  0x40, 0x00, 0x01, 0x3a, 0x0b, 0xd4, 0x94, 0x1c, 0xe4, 0x0a, 0x04, 0xd1,
-  0x12, 0x05, 0x11, 0x44, 0xdb, 0x07, 0x19, 0x44, 0xf0, 0xbd, 0xd9, 0x07,
-  0x20, 0x4b, 0x19, 0x43, 0x00, 0xe0, 0xd9, 0x07, 0x00, 0x20, 0xf0, 0xbd,
-  0x00, 0x29, 0xdd, 0xd1, 0x00, 0x2c, 0xdb, 0xd1, 0xf0, 0xbd, 0x01, 0x32,
-  0xc6, 0x07, 0x40, 0x08, 0xcd, 0x07, 0x28, 0x43, 0x49, 0x08, 0x00, 0x2e,
-  0xe1, 0xd0, 0xd9, 0xe7, 0x3c, 0x2e, 0x29, 0xda, 0x20, 0x3e, 0x40, 0x37,
-  0x14, 0x00, 0xbc, 0x40, 0x00, 0xd0, 0x01, 0x24, 0xf2, 0x40, 0x14, 0x43,
-  0x1a, 0x00, 0xbb, 0x40, 0x1c, 0x43, 0xd3, 0x17, 0xac, 0xe7, 0xac, 0x46,
-  0x20, 0x2f, 0x08, 0xda, 0x20, 0x36, 0x04, 0x00, 0xb4, 0x40, 0x0d, 0x00,
-  0xb5, 0x40, 0xf8, 0x40, 0x39, 0x41, 0x28, 0x43, 0xa5, 0xe7, 0x3c, 0x2f,
-  0x0c, 0xda, 0x20, 0x3f, 0x40, 0x36, 0x04, 0x00, 0xb4, 0x40, 0x00, 0xd0,
-  0x01, 0x24, 0xf8, 0x40, 0x04, 0x43, 0x08, 0x00, 0xb1, 0x40, 0x0c, 0x43,
-  0xc1, 0x17, 0xea, 0xe7, 0x10, 0x00, 0x19, 0x00, 0x00, 0x24, 0x94, 0xe7,
-  0x00, 0x00, 0xf0, 0x7f, 0xf0, 0xb5, 0x0c, 0x0d, 0x66, 0x1e, 0x36, 0x05,
-  0x89, 0x1b, 0xe6, 0x0a, 0x64, 0x05, 0x64, 0x0d, 0x02, 0xd0, 0x65, 0x1c,
-  0xed, 0x0a, 0x04, 0xd0, 0x00, 0x20, 0x01, 0x21, 0x09, 0x05, 0x80, 0x3c,
-  0x24, 0x03, 0xa4, 0x46, 0x1c, 0x0d, 0x67, 0x1e, 0x3f, 0x05, 0xdb, 0x1b,
-  0xe7, 0x0a, 0x64, 0x05, 0x64, 0x0d, 0x02, 0xd0, 0x65, 0x1c, 0xed, 0x0a,
-  0x04, 0xd0, 0x00, 0x22, 0x01, 0x23, 0x1b, 0x05, 0x80, 0x3c, 0x24, 0x03,
-  0x77, 0x40, 0x64, 0x44, 0x97, 0xb4, 0x84, 0xb2, 0x96, 0xb2, 0x74, 0x43,
-  0x07, 0x0c, 0x7e, 0x43, 0x15, 0x0c, 0x6f, 0x43, 0x80, 0xb2, 0x68, 0x43,
-  0x36, 0x18, 0x02, 0xd3, 0x01, 0x20, 0x00, 0x04, 0x3f, 0x18, 0x30, 0x04,
-  0x35, 0x0c, 0x00, 0x19, 0x7d, 0x41, 0x84, 0x46, 0x88, 0xb2, 0x9a, 0xb2,
-  0x50, 0x43, 0x0c, 0x0c, 0x62, 0x43, 0x1f, 0x0c, 0x7c, 0x43, 0x8e, 0xb2,
-  0x7e, 0x43, 0x92, 0x19, 0x02, 0xd3, 0x01, 0x26, 0x36, 0x04, 0xa4, 0x19,
-  0x16, 0x04, 0x17, 0x0c, 0x36, 0x18, 0x67, 0x41, 0x01, 0xbc, 0x81, 0xb2,
-  0x9a, 0xb2, 0x51, 0x43, 0x04, 0x0c, 0x62, 0x43, 0x1b, 0x0c, 0x5c, 0x43,
-  0x80, 0xb2, 0x58, 0x43, 0x12, 0x18, 0x02, 0xd3, 0x01, 0x20, 0x00, 0x04,
-  0x24, 0x18, 0x10, 0x04, 0x13, 0x0c, 0x40, 0x18, 0x63, 0x41, 0x2d, 0x18,
-  0x5e, 0x41, 0x00, 0x20, 0x47, 0x41, 0x06, 0xbc, 0x88, 0xb2, 0x93, 0xb2,
-  0x58, 0x43, 0x0c, 0x0c, 0x63, 0x43, 0x12, 0x0c, 0x54, 0x43, 0x89, 0xb2,
-  0x51, 0x43, 0x5b, 0x18, 0x02, 0xd3, 0x01, 0x21, 0x09, 0x04, 0x64, 0x18,
-  0x19, 0x04, 0x1a, 0x0c, 0x09, 0x18, 0x62, 0x41, 0x6d, 0x18, 0x56, 0x41,
-  0x00, 0x20, 0x47, 0x41, 0x18, 0xbc, 0xf9, 0x02, 0x72, 0x0d, 0x11, 0x43,
-  0xf0, 0x02, 0x6a, 0x0d, 0x10, 0x43, 0xed, 0x02, 0x0a, 0x0d, 0x03, 0xd1,
-  0x6d, 0x19, 0x40, 0x41, 0x49, 0x41, 0x01, 0x3b, 0x12, 0x4e, 0x9b, 0x1b,
-  0x76, 0x00, 0xb3, 0x42, 0x0e, 0xd2, 0x6d, 0x00, 0x07, 0xd3, 0x01, 0x30,
-  0x00, 0x26, 0x71, 0x41, 0x66, 0x46, 0x35, 0x43, 0x01, 0xd1, 0x40, 0x08,
-  0x40, 0x00, 0x1b, 0x05, 0xc9, 0x18, 0xe4, 0x07, 0x21, 0x44, 0xf0, 0xbd,
-  0x0b, 0xda, 0x01, 0x33, 0x06, 0xd1, 0x01, 0x30, 0x04, 0xd1, 0x01, 0x31,
-  0x4f, 0x0d, 0x01, 0xd0, 0x49, 0x08, 0xf2, 0xe7, 0xe1, 0x07, 0x00, 0x20,
-  0xf0, 0xbd, 0x01, 0x36, 0x31, 0x05, 0x00, 0x20, 0xeb, 0xe7, 0x00, 0x00,
-  0xff, 0x03, 0x00, 0x00, 0xf0, 0xb5, 0x1c, 0x0d, 0x67, 0x1e, 0x3f, 0x05,
-  0xdb, 0x1b, 0xe7, 0x0a, 0x64, 0x05, 0x64, 0x0d, 0x02, 0xd0, 0x66, 0x1c,
-  0xf6, 0x0a, 0x04, 0xd0, 0x00, 0x22, 0x01, 0x23, 0x1b, 0x05, 0x80, 0x3c,
-  0x24, 0x03, 0xd0, 0x25, 0x2d, 0x06, 0x00, 0x26, 0xf6, 0x43, 0x2e, 0x66,
-  0x1e, 0x09, 0x6e, 0x66, 0xce, 0x0f, 0xf6, 0x19, 0xb4, 0x46, 0x49, 0x00,
-  0x4f, 0x0d, 0x02, 0xd0, 0x7e, 0x1c, 0xf6, 0x0a, 0x03, 0xd0, 0x00, 0x20,
-  0x00, 0x21, 0x40, 0x3f, 0x3f, 0x03, 0x3e, 0x1b, 0xb6, 0x00, 0xb4, 0x44,
-  0x01, 0x3f, 0x7f, 0x05, 0xc9, 0x1b, 0x49, 0x08, 0x2e, 0x6f, 0x01, 0x36,
-  0x76, 0x08, 0x9c, 0x02, 0x95, 0x0d, 0x25, 0x43, 0x75, 0x43, 0xed, 0x13,
-  0x75, 0x43, 0xad, 0x13, 0x01, 0x35, 0x6d, 0x10, 0xf6, 0x03, 0x76, 0x1b,
-  0x0c, 0xb4, 0xcc, 0x02, 0x45, 0x0d, 0x2c, 0x43, 0xa2, 0xb2, 0xb3, 0xb2,
-  0x5a, 0x43, 0x27, 0x0c, 0x7b, 0x43, 0x35, 0x0c, 0x6f, 0x43, 0xa4, 0xb2,
-  0x6c, 0x43, 0x1b, 0x19, 0x02, 0xd3, 0x01, 0x24, 0x24, 0x04, 0x3f, 0x19,
-  0x1c, 0x04, 0x1d, 0x0c, 0xa4, 0x18, 0x7d, 0x41, 0x24, 0x19, 0x6d, 0x41,
-  0x00, 0x9a, 0x91, 0xb2, 0xac, 0xb2, 0x61, 0x43, 0x17, 0x0c, 0x7c, 0x43,
-  0x2b, 0x0c, 0x5f, 0x43, 0x92, 0xb2, 0x5a, 0x43, 0xa4, 0x18, 0x02, 0xd3,
-  0x01, 0x22, 0x12, 0x04, 0xbf, 0x18, 0x22, 0x04, 0x23, 0x0c, 0x52, 0x18,
-  0x7b, 0x41, 0x01, 0x9c, 0x6c, 0x43, 0x1b, 0x19, 0x52, 0x0e, 0xd9, 0x01,
-  0x0a, 0x43, 0x44, 0x01, 0xa0, 0x1a, 0x81, 0xb2, 0xb2, 0xb2, 0x51, 0x43,
-  0x03, 0x14, 0x5a, 0x43, 0x36, 0x0c, 0x73, 0x43, 0x87, 0xb2, 0x77, 0x43,
-  0xd6, 0x17, 0xd2, 0x19, 0x00, 0x27, 0x7e, 0x41, 0x36, 0x04, 0x9b, 0x19,
-  0x17, 0x04, 0x16, 0x0c, 0x7f, 0x18, 0x5e, 0x41, 0x73, 0x16, 0xed, 0x18,
-  0xf3, 0x01, 0x00, 0x26, 0x80, 0x33, 0x75, 0x41, 0xa9, 0x0f, 0x06, 0xd1,
-  0x64, 0x00, 0x69, 0x0a, 0xe8, 0x05, 0x5b, 0x0a, 0x18, 0x43, 0x09, 0xd2,
-  0x2f, 0xe0, 0x04, 0x22, 0x94, 0x44, 0x80, 0x33, 0x75, 0x41, 0xa9, 0x0a,
-  0xa8, 0x05, 0x9b, 0x0a, 0x18, 0x43, 0x26, 0xd3, 0x40, 0x41, 0x49, 0x41,
-  0x24, 0x04, 0x00, 0x9a, 0x01, 0x9b, 0x0d, 0x00, 0x55, 0x43, 0x64, 0x1b,
-  0x43, 0x43, 0xe4, 0x1a, 0x95, 0xb2, 0x86, 0xb2, 0x75, 0x43, 0x17, 0x0c,
-  0x7e, 0x43, 0x03, 0x0c, 0x5f, 0x43, 0x92, 0xb2, 0x5a, 0x43, 0xb6, 0x18,
-  0x02, 0xd3, 0x01, 0x22, 0x12, 0x04, 0xbf, 0x18, 0x32, 0x04, 0x33, 0x0c,
-  0x52, 0x19, 0x7b, 0x41, 0x52, 0x42, 0x9c, 0x41, 0x00, 0x2c, 0x02, 0xd4,
-  0x00, 0x22, 0x01, 0x30, 0x51, 0x41, 0x40, 0x08, 0xca, 0x07, 0x10, 0x43,
-  0x49, 0x08, 0x02, 0xb0, 0x62, 0x46, 0xd7, 0x07, 0x92, 0x10, 0x08, 0x4b,
-  0xd2, 0x18, 0x08, 0x4b, 0x9a, 0x42, 0x03, 0xd2, 0x12, 0x05, 0x89, 0x18,
-  0xc9, 0x19, 0xf0, 0xbd, 0x00, 0x20, 0x00, 0x2a, 0x01, 0xdc, 0x39, 0x00,
-  0xf0, 0xbd, 0x01, 0x33, 0x19, 0x05, 0xf5, 0xe7, 0xfd, 0x03, 0x00, 0x00,
-  0xfe, 0x07, 0x00, 0x00, 0x00, 0x22, 0x00, 0xb5, 0x20, 0x32, 0x00, 0xf0,
-  0x04, 0xf8, 0x08, 0x00, 0x00, 0xbd, 0x00, 0x00, 0x00, 0x22, 0x0b, 0x15,
-  0x0a, 0xd4, 0x10, 0xb5, 0x94, 0x46, 0x00, 0xf0, 0x31, 0xf8, 0x14, 0x14,
-  0x01, 0x34, 0x00, 0xda, 0x00, 0x21, 0xcb, 0x17, 0x14, 0x4c, 0x20, 0x47,
-  0x00, 0x20, 0x00, 0x21, 0x70, 0x47, 0x62, 0x44, 0x34, 0x3a, 0x0c, 0xd4,
-  0x0c, 0x2a, 0x07, 0xda, 0x04, 0x00, 0x91, 0x40, 0x90, 0x40, 0x52, 0x42,
-  0x20, 0x32, 0xd4, 0x40, 0x21, 0x43, 0x10, 0xbd, 0xd8, 0x43, 0xd9, 0x43,
-  0x10, 0xbd, 0x20, 0x32, 0x07, 0xd4, 0x0c, 0x46, 0x94, 0x40, 0x52, 0x42,
-  0x20, 0x32, 0x11, 0x41, 0xd0, 0x40, 0x20, 0x43, 0x10, 0xbd, 0x08, 0x00,
-  0xc9, 0x17, 0x20, 0x32, 0x03, 0xd4, 0x52, 0x42, 0x20, 0x32, 0x10, 0x41,
-  0x10, 0xbd, 0x18, 0x00, 0x19, 0x00, 0x10, 0xbd, 0x43, 0x27, 0x00, 0x10,
-  0x0a, 0x0d, 0xcc, 0x0f, 0x53, 0x1e, 0x1b, 0x05, 0xc9, 0x1a, 0x52, 0x05,
-  0x03, 0xd3, 0xc9, 0x43, 0x40, 0x42, 0x00, 0xd3, 0x01, 0x31, 0x52, 0x0d,
-  0x03, 0xd0, 0x53, 0x1c, 0xdb, 0x0a, 0x07, 0xd0, 0x12, 0x1b, 0x00, 0x20,
-  0x64, 0x00, 0x61, 0x1c, 0x89, 0x07, 0x89, 0x12, 0x80, 0x3a, 0x12, 0x03,
-  0x01, 0x4b, 0xd2, 0x1a, 0x70, 0x47, 0x00, 0x00, 0xff, 0x03, 0x00, 0x00,
-  0x51, 0x43, 0x43, 0x43, 0xc9, 0x18, 0x8c, 0x46, 0x11, 0x0c, 0x83, 0xb2,
-  0x4b, 0x43, 0x10, 0xb4, 0x04, 0x0c, 0x61, 0x43, 0x92, 0xb2, 0x80, 0xb2,
-  0x50, 0x43, 0x62, 0x43, 0x1c, 0x04, 0x1b, 0x0c, 0x00, 0x19, 0x10, 0xbc,
-  0x59, 0x41, 0x13, 0x04, 0x12, 0x0c, 0xc0, 0x18, 0x51, 0x41, 0x61, 0x44,
-  0x70, 0x47, 0x00, 0x00, 0x13, 0x23, 0x10, 0xb5, 0x12, 0x48, 0x1c, 0x78,
-  0xff, 0xf7, 0x6a, 0xf8, 0x01, 0x00, 0x01, 0x2c, 0x0a, 0xd0, 0x03, 0xdd,
-  0x80, 0x22, 0x0f, 0x48, 0x00, 0xf0, 0x48, 0xf8, 0x0e, 0x48, 0xff, 0xf7,
-  0x57, 0xf8, 0x0e, 0x4b, 0x18, 0x60, 0x10, 0xbd, 0x0a, 0x4c, 0x54, 0x22,
-  0x20, 0x00, 0x00, 0xf0, 0x3d, 0xf8, 0x0b, 0x4b, 0x63, 0x65, 0xa3, 0x65,
-  0xe3, 0x65, 0x23, 0x66, 0x63, 0x66, 0xa3, 0x66, 0xe3, 0x66, 0x23, 0x67,
-  0x63, 0x67, 0xa3, 0x67, 0xe3, 0x67, 0x23, 0x62, 0xe3, 0x61, 0xe5, 0xe7,
-  0x53, 0x46, 0x00, 0x00, 0x10, 0x13, 0x00, 0x20, 0x4c, 0x33, 0x00, 0x00,
-  0xe0, 0x20, 0x00, 0x20, 0x65, 0x28, 0x00, 0x10, 0x07, 0xb5, 0x60, 0x46,
-  0x01, 0x88, 0x0a, 0x0a, 0x02, 0x30, 0xdf, 0x2a, 0xfa, 0xd1, 0xc9, 0xb2,
-  0x82, 0x08, 0x04, 0xd3, 0x02, 0x88, 0x40, 0x88, 0x00, 0x04, 0x10, 0x43,
-  0x00, 0xe0, 0x00, 0x68, 0x01, 0x4a, 0x50, 0x50, 0x03, 0x90, 0x07, 0xbd,
-  0x10, 0x13, 0x00, 0x20, 0x01, 0x48, 0x04, 0x21, 0x01, 0x4b, 0x18, 0x47,
-  0x20, 0x10, 0x00, 0x20, 0xf1, 0x18, 0x00, 0x10, 0x01, 0x4b, 0x1b, 0x68,
-  0x18, 0x47, 0x00, 0x00, 0x20, 0x10, 0x00, 0x20, 0x01, 0x4b, 0x5b, 0x68,
-  0x18, 0x47, 0x00, 0x00, 0x20, 0x10, 0x00, 0x20, 0x70, 0x47, 0xc0, 0x46,
-  0xf8, 0xb5, 0x57, 0x46, 0x45, 0x46, 0xde, 0x46, 0x4e, 0x46, 0xe0, 0xb5,
-  0x98, 0x46, 0x0a, 0x9b, 0x06, 0x00, 0x9a, 0x46, 0x0d, 0x9b, 0x0f, 0x00,
-  0x93, 0x46, 0x15, 0x00, 0x9b, 0x07, 0x10, 0xd1, 0x0b, 0x9b, 0x0c, 0x9a,
-  0x93, 0x42, 0x0c, 0xd2, 0x13, 0x00, 0x5c, 0x46, 0x0b, 0x9a, 0x9d, 0x1a,
-  0x5d, 0x44, 0x22, 0x00, 0x43, 0x46, 0x01, 0x34, 0x39, 0x00, 0x20, 0x20,
-  0xb0, 0x47, 0xa5, 0x42, 0xf7, 0xd1, 0x0b, 0x9c, 0x63, 0x19, 0x00, 0x2c,
-  0x09, 0xd0, 0x1d, 0x00, 0x53, 0x46, 0x2a, 0x1b, 0x01, 0x3c, 0x18, 0x5d,
-  0x39, 0x00, 0x43, 0x46, 0xb0, 0x47, 0x00, 0x2c, 0xf6, 0xd1, 0x0d, 0x9b,
-  0x9b, 0x07, 0x0e, 0xd5, 0x5b, 0x46, 0xec, 0x1a, 0x0c, 0x9b, 0xa3, 0x42,
-  0x09, 0xd9, 0x99, 0x46, 0x2a, 0x00, 0x43, 0x46, 0x39, 0x00, 0x20, 0x20,
-  0x01, 0x34, 0xb0, 0x47, 0x01, 0x35, 0xa1, 0x45, 0xf6, 0xd8, 0x28, 0x00,
-  0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46, 0xf8, 0xbd,
-  0xf0, 0xb5, 0x4f, 0x46, 0x46, 0x46, 0xd6, 0x46, 0xc0, 0xb5, 0x84, 0xb0,
-  0x98, 0x46, 0x0e, 0xab, 0x1b, 0x78, 0x94, 0x46, 0x99, 0x46, 0x12, 0x9b,
-  0x0d, 0x9c, 0x10, 0x9f, 0x11, 0x9e, 0x9a, 0x07, 0x24, 0xd4, 0x00, 0x2e,
-  0x6a, 0xd1, 0xbc, 0x42, 0x20, 0xd2, 0x01, 0x22, 0x1a, 0x40, 0x92, 0x46,
-  0x20, 0x2c, 0x00, 0xd1, 0xcb, 0xe0, 0x0c, 0x9a, 0x55, 0x1e, 0x30, 0x22,
-  0x01, 0xe0, 0x20, 0x2c, 0x30, 0xd0, 0x01, 0x34, 0x2a, 0x55, 0xa7, 0x42,
-  0xf9, 0xd8, 0x52, 0x46, 0x00, 0x2a, 0x0d, 0xd0, 0xb4, 0x42, 0x0b, 0xd2,
-  0x0c, 0x9a, 0x55, 0x1e, 0x30, 0x22, 0x20, 0x2c, 0x02, 0xd1, 0x26, 0xe0,
-  0x20, 0x2c, 0x61, 0xd0, 0x01, 0x34, 0x2a, 0x55, 0xb4, 0x42, 0xf9, 0xd1,
-  0xda, 0x06, 0x34, 0xd5, 0x5a, 0x05, 0x62, 0xd4, 0x00, 0x2c, 0x5c, 0xd1,
-  0x0f, 0x9a, 0x10, 0x2a, 0x00, 0xd1, 0x91, 0xe0, 0x02, 0x2a, 0x00, 0xd1,
-  0xa1, 0xe0, 0x30, 0x22, 0x0c, 0x9c, 0x22, 0x70, 0x01, 0x24, 0x4a, 0x46,
-  0x00, 0x2a, 0x5c, 0xd1, 0x5a, 0x07, 0x00, 0xd4, 0x7d, 0xe0, 0x2b, 0x22,
-  0x0c, 0x9d, 0x2a, 0x55, 0x01, 0x34, 0x1c, 0xe0, 0x52, 0x46, 0x00, 0x2a,
-  0x02, 0xd0, 0x20, 0x2e, 0x3c, 0xd9, 0x20, 0x24, 0xda, 0x06, 0x14, 0xd5,
-  0x5a, 0x05, 0x12, 0xd4, 0x20, 0x2f, 0x00, 0xd1, 0x97, 0xe0, 0x20, 0x2e,
-  0x3b, 0xd1, 0x20, 0x26, 0x1f, 0x22, 0x34, 0x00, 0x0f, 0x9d, 0x10, 0x2d,
-  0x00, 0xd1, 0x81, 0xe0, 0x02, 0x2d, 0x4c, 0xd0, 0x30, 0x25, 0x0c, 0x9f,
-  0xbd, 0x54, 0x20, 0x2c, 0xd7, 0xd1, 0x03, 0x93, 0x0c, 0x9b, 0x62, 0x46,
-  0x00, 0x93, 0x02, 0x96, 0x43, 0x46, 0x01, 0x94, 0xff, 0xf7, 0x40, 0xff,
-  0x04, 0xb0, 0xe0, 0xbc, 0xba, 0x46, 0xb1, 0x46, 0xa8, 0x46, 0xf0, 0xbd,
-  0x01, 0x22, 0x15, 0x00, 0x1d, 0x40, 0xaa, 0x46, 0x1a, 0x42, 0x27, 0xd0,
-  0x4a, 0x46, 0x00, 0x2a, 0x33, 0xd1, 0x0c, 0x32, 0x1a, 0x42, 0x30, 0xd1,
-  0xbc, 0x42, 0x9b, 0xd2, 0x20, 0x2c, 0x00, 0xd0, 0x8b, 0xe7, 0x20, 0x2e,
-  0xc5, 0xd8, 0xda, 0x06, 0xa4, 0xd4, 0xda, 0xe7, 0x20, 0x24, 0xda, 0x06,
-  0xd7, 0xd5, 0x5a, 0x05, 0x03, 0xd4, 0xa7, 0x42, 0x21, 0xd0, 0xb4, 0x42,
-  0x1f, 0xd0, 0x0f, 0x9a, 0x10, 0x2a, 0x21, 0xd0, 0x02, 0x2a, 0x10, 0xd0,
-  0x20, 0x2c, 0xca, 0xd0, 0x22, 0x00, 0x01, 0x34, 0xc2, 0xe7, 0x2d, 0x22,
-  0x0c, 0x9d, 0x2a, 0x55, 0x01, 0x34, 0xc2, 0xe7, 0xbc, 0x42, 0x00, 0xd3,
-  0x86, 0xe7, 0x20, 0x2c, 0x00, 0xd0, 0x68, 0xe7, 0xe1, 0xe7, 0x20, 0x2c,
-  0xb9, 0xd0, 0x22, 0x00, 0x01, 0x34, 0x62, 0x25, 0x0c, 0x9f, 0xbd, 0x54,
-  0xe6, 0xe7, 0x01, 0x3e, 0xcc, 0xe7, 0x62, 0x1e, 0x01, 0x2c, 0x00, 0xd1,
-  0x7a, 0xe7, 0xa1, 0xe7, 0x9a, 0x06, 0x16, 0xd4, 0x20, 0x2c, 0xa8, 0xd0,
-  0x78, 0x22, 0x0c, 0x9d, 0x2a, 0x55, 0x01, 0x34, 0xd6, 0xe7, 0x1a, 0x07,
-  0xa1, 0xd5, 0x20, 0x22, 0x0c, 0x9d, 0x2a, 0x55, 0x01, 0x34, 0x9c, 0xe7,
-  0x9a, 0x06, 0x0e, 0xd4, 0x78, 0x22, 0x0c, 0x9c, 0x22, 0x70, 0x30, 0x22,
-  0x62, 0x70, 0x02, 0x24, 0x6b, 0xe7, 0x20, 0x2c, 0x91, 0xd0, 0x58, 0x25,
-  0x0c, 0x9a, 0x12, 0x19, 0x15, 0x70, 0x01, 0x34, 0xbe, 0xe7, 0x58, 0x22,
-  0xef, 0xe7, 0x62, 0x22, 0xed, 0xe7, 0x00, 0x2a, 0xa7, 0xd1, 0xaa, 0xe7,
-  0x02, 0x3c, 0x9d, 0x06, 0x04, 0xd4, 0x78, 0x25, 0x0c, 0x9f, 0x3d, 0x55,
-  0x14, 0x00, 0xb1, 0xe7, 0x58, 0x25, 0x0c, 0x9f, 0x3d, 0x55, 0x14, 0x00,
-  0xac, 0xe7, 0x1f, 0x22, 0x6a, 0xe7, 0xc0, 0x46, 0x10, 0xb5, 0x00, 0x28,
-  0x00, 0xd1, 0x10, 0xbd, 0x01, 0xf0, 0x24, 0xfb, 0xfb, 0xe7, 0xc0, 0x46,
-  0x0b, 0x00, 0x10, 0xb5, 0x00, 0x28, 0x02, 0xd0, 0x49, 0x68, 0x1b, 0x68,
-  0x98, 0x47, 0x10, 0xbd, 0xf0, 0xb5, 0x57, 0x46, 0x4e, 0x46, 0x45, 0x46,
-  0xde, 0x46, 0xe0, 0xb5, 0x99, 0xb0, 0x82, 0x46, 0x89, 0x46, 0x90, 0x46,
-  0x09, 0x93, 0x22, 0x9a, 0x23, 0x9b, 0x10, 0x00, 0x19, 0x00, 0xff, 0xf7,
-  0xca, 0xfa, 0x00, 0x28, 0x00, 0xd0, 0xc8, 0xe0, 0x22, 0x98, 0x23, 0x99,
-  0x01, 0x22, 0xd5, 0x4b, 0x52, 0x42, 0xff, 0xf7, 0xbb, 0xfa, 0x00, 0x28,
-  0x00, 0xd0, 0xbe, 0xe0, 0x22, 0x98, 0x23, 0x99, 0x01, 0x22, 0xd1, 0x4b,
-  0x52, 0x42, 0xff, 0xf7, 0xa3, 0xfa, 0x00, 0x28, 0x00, 0xd0, 0xb4, 0xe0,
-  0x22, 0x98, 0x23, 0x99, 0x00, 0x22, 0x00, 0x23, 0xff, 0xf7, 0x9a, 0xfa,
-  0x00, 0x28, 0x00, 0xd0, 0xe9, 0xe1, 0x22, 0x9e, 0x23, 0x9f, 0x80, 0x23,
-  0x26, 0x9a, 0xdb, 0x00, 0x1a, 0x40, 0x0d, 0x92, 0x26, 0x9a, 0x1a, 0x42,
-  0x01, 0xd1, 0x06, 0x23, 0x24, 0x93, 0x3b, 0x00, 0x33, 0x43, 0x00, 0xd0,
-  0xb4, 0xe0, 0x26, 0x9b, 0x1b, 0x05, 0x00, 0xd5, 0xbf, 0xe1, 0x00, 0x23,
-  0x00, 0x24, 0x0a, 0x93, 0x0b, 0x94, 0x00, 0x23, 0x04, 0x25, 0x0c, 0x93,
-  0x25, 0x9b, 0x00, 0x24, 0xab, 0x42, 0x00, 0xd9, 0x5c, 0x1b, 0x02, 0x23,
-  0x26, 0x9a, 0x1a, 0x40, 0x0d, 0x92, 0x26, 0x9a, 0x13, 0x42, 0x03, 0xd0,
-  0x6b, 0x42, 0x6b, 0x41, 0x5b, 0x42, 0x1c, 0x40, 0x0c, 0x9b, 0x00, 0x2b,
-  0x07, 0xd0, 0x0a, 0x9a, 0x0b, 0x9b, 0x30, 0x00, 0x39, 0x00, 0xff, 0xf7,
-  0x02, 0xfa, 0x06, 0x00, 0x0f, 0x00, 0x22, 0x98, 0x23, 0x99, 0x00, 0x22,
-  0x00, 0x23, 0xff, 0xf7, 0x5b, 0xfa, 0x00, 0x28, 0x03, 0xd0, 0x80, 0x21,
-  0x09, 0x06, 0x7b, 0x18, 0x1f, 0x00, 0x26, 0x9a, 0xa8, 0x4b, 0x00, 0x96,
-  0x01, 0x97, 0x13, 0x40, 0x09, 0x9e, 0x04, 0x93, 0x24, 0x9b, 0x03, 0x94,
-  0x02, 0x93, 0x42, 0x46, 0x33, 0x00, 0x49, 0x46, 0x50, 0x46, 0x00, 0xf0,
-  0xa7, 0xf9, 0x04, 0x00, 0x00, 0x2d, 0x67, 0xd0, 0x20, 0x20, 0x26, 0x9a,
-  0x49, 0x46, 0x02, 0x40, 0x13, 0x00, 0x5a, 0x42, 0x53, 0x41, 0x5b, 0x42,
-  0x62, 0x1c, 0x18, 0x40, 0x0a, 0x92, 0x33, 0x00, 0x22, 0x00, 0x45, 0x30,
-  0xd0, 0x47, 0x0c, 0x9a, 0x6f, 0x1e, 0xd3, 0x17, 0xd4, 0x18, 0x5c, 0x40,
-  0xd3, 0x0f, 0x9b, 0x46, 0x00, 0x25, 0x01, 0xe0, 0x20, 0x2d, 0x13, 0xd0,
-  0x08, 0xaa, 0x94, 0x46, 0x1f, 0x23, 0x20, 0x00, 0x63, 0x44, 0x0a, 0x21,
-  0x01, 0x35, 0x5e, 0x19, 0xfe, 0xf7, 0x70, 0xff, 0x30, 0x31, 0x31, 0x70,
-  0x20, 0x00, 0x0a, 0x21, 0xfe, 0xf7, 0x6a, 0xff, 0x26, 0x00, 0x04, 0x00,
-  0x09, 0x2e, 0xe9, 0xd8, 0x05, 0x23, 0x06, 0x93, 0x00, 0x23, 0x04, 0x93,
-  0x0a, 0x33, 0x03, 0x93, 0x5b, 0x46, 0x09, 0x9e, 0x02, 0x93, 0x10, 0xab,
-  0x0a, 0x9a, 0x00, 0x93, 0x49, 0x46, 0x33, 0x00, 0x50, 0x46, 0x05, 0x97,
-  0x01, 0x95, 0xff, 0xf7, 0x2f, 0xfe, 0x0d, 0x9a, 0x04, 0x00, 0x00, 0x2a,
-  0x22, 0xd0, 0x42, 0x46, 0x85, 0x1a, 0x25, 0x9a, 0xaa, 0x42, 0x1d, 0xd9,
-  0xb0, 0x46, 0x57, 0x46, 0x16, 0x00, 0x22, 0x00, 0x43, 0x46, 0x49, 0x46,
-  0x20, 0x20, 0x01, 0x35, 0xb8, 0x47, 0x01, 0x34, 0xae, 0x42, 0xf6, 0xd8,
-  0x10, 0xe0, 0x26, 0x9b, 0x42, 0x46, 0x04, 0x93, 0x25, 0x9b, 0x49, 0x46,
-  0x03, 0x93, 0x24, 0x9b, 0x50, 0x46, 0x02, 0x93, 0x22, 0x9b, 0x23, 0x9c,
-  0x00, 0x93, 0x01, 0x94, 0x09, 0x9b, 0x00, 0xf0, 0x3d, 0xf9, 0x04, 0x00,
-  0x20, 0x00, 0x19, 0xb0, 0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46,
-  0xa0, 0x46, 0xf0, 0xbd, 0x68, 0x4b, 0x78, 0x00, 0x9c, 0x46, 0x40, 0x0d,
-  0x60, 0x44, 0xff, 0xf7, 0xef, 0xf9, 0x66, 0x4a, 0x66, 0x4b, 0xff, 0xf7,
-  0x84, 0xf9, 0x66, 0x4a, 0x66, 0x4b, 0xff, 0xf7, 0x59, 0xf9, 0x66, 0x4a,
-  0x3b, 0x03, 0x1b, 0x0b, 0x1a, 0x43, 0x04, 0x00, 0x0d, 0x00, 0x64, 0x4b,
-  0x11, 0x00, 0x30, 0x00, 0x00, 0x22, 0xff, 0xf7, 0x44, 0xf9, 0x62, 0x4a,
-  0x62, 0x4b, 0xff, 0xf7, 0x70, 0xf9, 0x02, 0x00, 0x0b, 0x00, 0x20, 0x00,
-  0x29, 0x00, 0xff, 0xf7, 0x43, 0xf9, 0xff, 0xf7, 0xe7, 0xf9, 0x0c, 0x90,
-  0xff, 0xf7, 0xcc, 0xf9, 0x5c, 0x4a, 0x5d, 0x4b, 0x04, 0x00, 0x0d, 0x00,
-  0xff, 0xf7, 0x5f, 0xf9, 0x00, 0x22, 0x5b, 0x4b, 0xff, 0xf7, 0x34, 0xf9,
-  0xff, 0xf7, 0xd8, 0xf9, 0x59, 0x4a, 0x83, 0x46, 0x59, 0x4b, 0x20, 0x00,
-  0x29, 0x00, 0xff, 0xf7, 0x52, 0xf9, 0x04, 0x00, 0x58, 0x46, 0x0d, 0x00,
-  0xff, 0xf7, 0xb4, 0xf9, 0x55, 0x4a, 0x56, 0x4b, 0xff, 0xf7, 0x49, 0xf9,
-  0x02, 0x00, 0x0b, 0x00, 0x20, 0x00, 0x29, 0x00, 0xff, 0xf7, 0x13, 0xf9,
-  0x02, 0x00, 0x0b, 0x00, 0x0a, 0x90, 0x0b, 0x91, 0xff, 0xf7, 0x3d, 0xf9,
-  0x04, 0x00, 0x0d, 0x00, 0x0a, 0x98, 0x0b, 0x99, 0x02, 0x00, 0x0b, 0x00,
-  0xff, 0xf7, 0x0e, 0xf9, 0x00, 0x22, 0x0e, 0x90, 0x0f, 0x91, 0x4a, 0x4b,
-  0x20, 0x00, 0x29, 0x00, 0xff, 0xf7, 0x0f, 0xf9, 0x00, 0x22, 0x48, 0x4b,
-  0xff, 0xf7, 0x02, 0xf9, 0x02, 0x00, 0x0b, 0x00, 0x20, 0x00, 0x29, 0x00,
-  0xff, 0xf7, 0x05, 0xf9, 0x00, 0x22, 0x44, 0x4b, 0xff, 0xf7, 0xf8, 0xf8,
-  0x02, 0x00, 0x0b, 0x00, 0x20, 0x00, 0x29, 0x00, 0xff, 0xf7, 0xfb, 0xf8,
-  0x0a, 0x9a, 0x0b, 0x9b, 0x0d, 0x00, 0x80, 0x21, 0x04, 0x00, 0xc9, 0x05,
-  0x00, 0x20, 0xff, 0xf7, 0xe0, 0xf8, 0x02, 0x00, 0x0b, 0x00, 0x20, 0x00,
-  0x29, 0x00, 0xff, 0xf7, 0xe3, 0xf8, 0x39, 0x4c, 0x02, 0x00, 0x0b, 0x00,
-  0x0e, 0x98, 0x0f, 0x99, 0xff, 0xf7, 0xe5, 0xf8, 0x5c, 0x44, 0x00, 0x22,
-  0x26, 0x4b, 0xff, 0xf7, 0xd7, 0xf8, 0x23, 0x05, 0x00, 0x22, 0xff, 0xf7,
-  0xfa, 0xf8, 0x04, 0x00, 0x0d, 0x00, 0x02, 0x00, 0x0b, 0x00, 0x30, 0x00,
-  0x39, 0x00, 0x0a, 0x94, 0x0b, 0x95, 0xff, 0xf7, 0x33, 0xf9, 0x00, 0x28,
-  0x5e, 0xd1, 0x23, 0x00, 0x2a, 0x00, 0xc6, 0x25, 0x0c, 0x99, 0x63, 0x31,
-  0x8d, 0x42, 0xad, 0x41, 0x26, 0x99, 0x6d, 0x42, 0x04, 0x35, 0x09, 0x05,
-  0x00, 0xd4, 0xa7, 0xe6, 0x13, 0x43, 0x64, 0xd0, 0x30, 0x00, 0x39, 0x00,
-  0x23, 0x4a, 0x24, 0x4b, 0xff, 0xf7, 0x22, 0xf9, 0x00, 0x28, 0x07, 0xd0,
-  0x00, 0x22, 0x30, 0x00, 0x39, 0x00, 0x21, 0x4b, 0xff, 0xf7, 0x14, 0xf9,
-  0x00, 0x28, 0x54, 0xd1, 0x24, 0x9b, 0x00, 0x2b, 0x00, 0xd1, 0x91, 0xe6,
-  0x0d, 0x9b, 0x5a, 0x1e, 0x93, 0x41, 0x24, 0x9a, 0xd3, 0x1a, 0x24, 0x93,
-  0x8a, 0xe6, 0xc0, 0x46, 0xff, 0xff, 0xef, 0x7f, 0xff, 0xff, 0xef, 0xff,
-  0xff, 0xf7, 0xff, 0xff, 0x01, 0xfc, 0xff, 0xff, 0xfb, 0x79, 0x9f, 0x50,
-  0x13, 0x44, 0xd3, 0x3f, 0xb3, 0xc8, 0x60, 0x8b, 0x28, 0x8a, 0xc6, 0x3f,
-  0x00, 0x00, 0xf0, 0x3f, 0x00, 0x00, 0xf8, 0x3f, 0x61, 0x43, 0x6f, 0x63,
-  0xa7, 0x87, 0xd2, 0x3f, 0x71, 0xa3, 0x79, 0x09, 0x4f, 0x93, 0x0a, 0x40,
-  0x00, 0x00, 0xe0, 0x3f, 0x16, 0x55, 0xb5, 0xbb, 0xb1, 0x6b, 0x02, 0x40,
-  0xef, 0x39, 0xfa, 0xfe, 0x42, 0x2e, 0xe6, 0x3f, 0x00, 0x00, 0x2c, 0x40,
-  0x00, 0x00, 0x24, 0x40, 0x00, 0x00, 0x18, 0x40, 0xff, 0x03, 0x00, 0x00,
-  0x2d, 0x43, 0x1c, 0xeb, 0xe2, 0x36, 0x1a, 0x3f, 0x80, 0x84, 0x2e, 0x41,
-  0x0c, 0x9b, 0x00, 0x22, 0x01, 0x3b, 0x0c, 0x93, 0x20, 0x00, 0x16, 0x4b,
-  0x29, 0x00, 0xff, 0xf7, 0x68, 0xf8, 0x0a, 0x00, 0x01, 0x00, 0x03, 0x00,
-  0x0a, 0x91, 0x0b, 0x92, 0x93, 0xe7, 0x00, 0x23, 0x00, 0x24, 0x0a, 0x93,
-  0x0b, 0x94, 0x00, 0x23, 0x0c, 0x93, 0x24, 0x9a, 0x0c, 0x9b, 0x9a, 0x42,
-  0x14, 0xdd, 0xd3, 0x1a, 0x01, 0x3b, 0x24, 0x93, 0x80, 0x23, 0x26, 0x9a,
-  0xdb, 0x00, 0x1a, 0x43, 0x00, 0x23, 0x00, 0x25, 0x26, 0x92, 0x0c, 0x93,
-  0x30, 0xe6, 0x80, 0x22, 0x12, 0x06, 0x94, 0x46, 0x22, 0x9b, 0x1e, 0x00,
-  0x23, 0x9b, 0x63, 0x44, 0x1f, 0x00, 0x0e, 0xe6, 0x00, 0x23, 0x24, 0x93,
-  0xea, 0xe7, 0xc0, 0x46, 0x00, 0x00, 0x24, 0x40, 0xf0, 0xb5, 0x45, 0x46,
-  0xde, 0x46, 0x4e, 0x46, 0x57, 0x46, 0xe0, 0xb5, 0x95, 0xb0, 0x8b, 0x46,
-  0x90, 0x46, 0x99, 0x46, 0x1e, 0x9a, 0x1f, 0x9b, 0x0a, 0x90, 0x19, 0x00,
-  0x10, 0x00, 0x20, 0x9d, 0xff, 0xf7, 0x9f, 0xf8, 0x00, 0x28, 0x00, 0xd0,
-  0xb0, 0xe1, 0x1e, 0x98, 0x1f, 0x99, 0x01, 0x22, 0xc7, 0x4b, 0x52, 0x42,
-  0xff, 0xf7, 0x82, 0xf8, 0x00, 0x28, 0x00, 0xd0, 0x37, 0xe1, 0x1e, 0x98,
-  0x1f, 0x99, 0x01, 0x22, 0xc3, 0x4b, 0x52, 0x42, 0xff, 0xf7, 0x86, 0xf8,
-  0x00, 0x28, 0x00, 0xd0, 0xa7, 0xe0, 0x1e, 0x98, 0x1f, 0x99, 0x00, 0x22,
-  0xbf, 0x4b, 0xff, 0xf7, 0x7d, 0xf8, 0x00, 0x28, 0x00, 0xd0, 0x88, 0xe0,
-  0x1e, 0x98, 0x1f, 0x99, 0x00, 0x22, 0xbc, 0x4b, 0xff, 0xf7, 0x66, 0xf8,
-  0x00, 0x28, 0x00, 0xd0, 0x7f, 0xe0, 0x1e, 0x98, 0x1f, 0x99, 0x00, 0x22,
-  0x00, 0x23, 0xff, 0xf7, 0x5d, 0xf8, 0x00, 0x28, 0x00, 0xd0, 0xfa, 0xe0,
-  0x00, 0x23, 0x0b, 0x93, 0x80, 0x23, 0x22, 0x9c, 0x22, 0x9a, 0xdb, 0x00,
-  0x1c, 0x40, 0x1a, 0x42, 0x00, 0xd1, 0x02, 0xe1, 0x09, 0x2d, 0x00, 0xd8,
-  0x7e, 0xe1, 0x06, 0xa9, 0x8c, 0x46, 0x2c, 0x00, 0x17, 0x22, 0x00, 0x23,
-  0x30, 0x21, 0x09, 0x3c, 0x62, 0x44, 0x01, 0x33, 0xd1, 0x54, 0xef, 0x1a,
-  0x20, 0x2b, 0x00, 0xd1, 0x32, 0xe1, 0xa3, 0x42, 0xf7, 0xd1, 0x00, 0x22,
-  0xa4, 0x4b, 0x06, 0x92, 0x07, 0x93, 0x1e, 0x98, 0x1f, 0x99, 0xff, 0xf7,
-  0x71, 0xf8, 0x05, 0x00, 0xff, 0xf7, 0x56, 0xf8, 0x02, 0x00, 0x0b, 0x00,
-  0x1e, 0x98, 0x1f, 0x99, 0xfe, 0xf7, 0xb9, 0xff, 0x06, 0x9a, 0x07, 0x9b,
-  0xfe, 0xf7, 0xe5, 0xff, 0x08, 0x90, 0x09, 0x91, 0xff, 0xf7, 0x84, 0xf8,
-  0x06, 0x00, 0xff, 0xf7, 0x41, 0xf8, 0x02, 0x00, 0x0b, 0x00, 0x08, 0x98,
-  0x09, 0x99, 0xfe, 0xf7, 0xa8, 0xff, 0x00, 0x22, 0x95, 0x4b, 0x08, 0x90,
-  0x09, 0x91, 0xff, 0xf7, 0x23, 0xf8, 0x00, 0x28, 0x00, 0xd1, 0xd2, 0xe0,
-  0x01, 0x36, 0x30, 0x00, 0xff, 0xf7, 0x2e, 0xf8, 0x06, 0x9a, 0x07, 0x9b,
-  0xff, 0xf7, 0x10, 0xf8, 0x00, 0x28, 0x01, 0xd0, 0x00, 0x26, 0x01, 0x35,
-  0xaa, 0x46, 0x00, 0x2f, 0x00, 0xd0, 0x98, 0xe0, 0x28, 0x00, 0xff, 0xf7,
-  0x23, 0xf8, 0x02, 0x00, 0x0b, 0x00, 0x1e, 0x98, 0x1f, 0x99, 0xfe, 0xf7,
-  0x86, 0xff, 0x85, 0x4b, 0x00, 0x22, 0x06, 0x00, 0x0f, 0x00, 0xfe, 0xf7,
-  0xf3, 0xff, 0x0c, 0xab, 0x9a, 0x46, 0x00, 0x28, 0x45, 0xd1, 0x00, 0x22,
-  0x30, 0x00, 0x39, 0x00, 0x7e, 0x4b, 0xfe, 0xf7, 0xf7, 0xff, 0x00, 0x28,
-  0x3d, 0xd1, 0xeb, 0x07, 0x3b, 0xd5, 0x01, 0x35, 0x39, 0xe0, 0x22, 0x9b,
-  0x42, 0x46, 0x04, 0x93, 0x21, 0x9b, 0x59, 0x46, 0x03, 0x93, 0x0a, 0x98,
-  0x1e, 0x9b, 0x1f, 0x9c, 0x02, 0x95, 0x00, 0x93, 0x01, 0x94, 0x4b, 0x46,
-  0xff, 0xf7, 0x0c, 0xfd, 0x15, 0xb0, 0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46,
-  0xa9, 0x46, 0xa0, 0x46, 0xf0, 0xbd, 0x22, 0x9b, 0x5b, 0x07, 0x67, 0xd4,
-  0x03, 0x22, 0x6e, 0x4b, 0x22, 0x99, 0x01, 0x92, 0x03, 0x91, 0x21, 0x99,
-  0x02, 0x91, 0x00, 0x93, 0x42, 0x46, 0x4b, 0x46, 0x59, 0x46, 0x0a, 0x98,
-  0xff, 0xf7, 0xa2, 0xfb, 0xe6, 0xe7, 0x06, 0xaa, 0x94, 0x46, 0x17, 0x23,
-  0x28, 0x00, 0x63, 0x44, 0x0a, 0x21, 0x01, 0x34, 0x1e, 0x19, 0xfe, 0xf7,
-  0xdb, 0xfc, 0x30, 0x31, 0x28, 0x00, 0x31, 0x70, 0x0a, 0x21, 0xfe, 0xf7,
-  0xd5, 0xfc, 0x05, 0x1e, 0x76, 0xd0, 0x20, 0x2c, 0xeb, 0xd1, 0x03, 0x23,
-  0x22, 0x9a, 0x13, 0x40, 0x01, 0x2b, 0x1d, 0xd1, 0x21, 0x9b, 0x00, 0x2b,
-  0x1a, 0xd0, 0x0b, 0x9b, 0x00, 0x2b, 0x00, 0xd0, 0xbb, 0xe0, 0x22, 0x9a,
-  0x0c, 0x33, 0x13, 0x42, 0x00, 0xd0, 0xb6, 0xe0, 0x21, 0x9b, 0xa3, 0x42,
-  0x00, 0xd8, 0x87, 0xe0, 0x06, 0xab, 0x9c, 0x46, 0x17, 0x22, 0x30, 0x23,
-  0x62, 0x44, 0x04, 0xe0, 0x21, 0x99, 0x01, 0x34, 0x13, 0x55, 0x8c, 0x42,
-  0x59, 0xd0, 0x20, 0x2c, 0xf8, 0xd1, 0x20, 0x24, 0x22, 0x9b, 0x01, 0x94,
-  0x03, 0x93, 0x21, 0x9b, 0x02, 0x93, 0x53, 0x46, 0xb9, 0xe7, 0x06, 0xaa,
-  0x94, 0x46, 0x17, 0x23, 0x0a, 0x21, 0x63, 0x44, 0x30, 0x00, 0x01, 0x34,
-  0x1d, 0x19, 0xfe, 0xf7, 0xc5, 0xfc, 0x30, 0x31, 0x29, 0x70, 0x30, 0x00,
-  0x0a, 0x21, 0x01, 0x3f, 0xfe, 0xf7, 0xbe, 0xfc, 0x09, 0x2e, 0x46, 0xd9,
-  0x06, 0x00, 0x20, 0x2c, 0xe9, 0xd1, 0x55, 0x46, 0x0c, 0xab, 0x20, 0x24,
-  0x9a, 0x46, 0xb8, 0xe7, 0x04, 0x22, 0x3b, 0x4b, 0x96, 0xe7, 0x1e, 0x9a,
-  0x1f, 0x9b, 0x00, 0x20, 0x00, 0x21, 0xfe, 0xf7, 0xe6, 0xfe, 0x01, 0x23,
-  0x0b, 0x93, 0x80, 0x23, 0x22, 0x9c, 0x22, 0x9a, 0xdb, 0x00, 0x1e, 0x90,
-  0x1f, 0x91, 0x1c, 0x40, 0x1a, 0x42, 0x00, 0xd0, 0xfc, 0xe6, 0x00, 0x22,
-  0x31, 0x4b, 0x06, 0x27, 0x06, 0x92, 0x07, 0x93, 0x0d, 0xe7, 0x22, 0x9b,
-  0x03, 0x93, 0x21, 0x9b, 0x02, 0x93, 0x04, 0x23, 0x01, 0x93, 0x2d, 0x4b,
-  0x7b, 0xe7, 0x00, 0x22, 0x08, 0x98, 0x09, 0x99, 0x26, 0x4b, 0xfe, 0xf7,
-  0x39, 0xff, 0x00, 0x28, 0x00, 0xd0, 0x2f, 0xe7, 0x00, 0x2e, 0x4f, 0xd1,
-  0x01, 0x36, 0x2b, 0xe7, 0x03, 0x23, 0x22, 0x9a, 0x13, 0x40, 0x01, 0x2b,
-  0x68, 0xd0, 0x20, 0x2c, 0xa6, 0xd0, 0x0b, 0x9b, 0x00, 0x2b, 0x1f, 0xd0,
-  0x2d, 0x23, 0x52, 0x46, 0x13, 0x55, 0x01, 0x34, 0x9e, 0xe7, 0x55, 0x46,
-  0x20, 0x2c, 0xb9, 0xd0, 0x30, 0x22, 0x3b, 0x19, 0x00, 0x2f, 0x4b, 0xd0,
-  0x17, 0x20, 0x06, 0xa9, 0x01, 0x34, 0x09, 0x18, 0x0a, 0x55, 0x20, 0x2c,
-  0xae, 0xd0, 0x9c, 0x42, 0xf6, 0xd1, 0x0c, 0xaa, 0x92, 0x46, 0x2e, 0x22,
-  0x51, 0x46, 0x5c, 0x1c, 0xca, 0x54, 0x62, 0xe7, 0x20, 0x24, 0xcc, 0xe6,
-  0x20, 0x2c, 0x83, 0xd0, 0x22, 0x9b, 0x5b, 0x07, 0x08, 0xd4, 0x22, 0x9b,
-  0x1b, 0x07, 0x00, 0xd4, 0x7c, 0xe7, 0x20, 0x23, 0x52, 0x46, 0x13, 0x55,
-  0x01, 0x34, 0x77, 0xe7, 0x2b, 0x23, 0x52, 0x46, 0x13, 0x55, 0x01, 0x34,
-  0x72, 0xe7, 0xc0, 0x46, 0xff, 0xff, 0xef, 0xff, 0xff, 0xff, 0xef, 0x7f,
-  0x65, 0xcd, 0xcd, 0x41, 0x65, 0xcd, 0xcd, 0xc1, 0x00, 0x00, 0xe0, 0x3f,
-  0x48, 0x6f, 0x00, 0x10, 0x40, 0x6f, 0x00, 0x10, 0x80, 0x84, 0x2e, 0x41,
-  0x50, 0x6f, 0x00, 0x10, 0xf3, 0x07, 0x00, 0xd4, 0xda, 0xe6, 0x01, 0x36,
-  0xd8, 0xe6, 0x21, 0x9b, 0x01, 0x3b, 0x21, 0x93, 0xa3, 0x42, 0x00, 0xd9,
-  0x46, 0xe7, 0xaa, 0xe7, 0x22, 0x9b, 0x03, 0x93, 0x21, 0x9b, 0x02, 0x93,
-  0x03, 0x23, 0x01, 0x93, 0x08, 0x4b, 0x0c, 0xe7, 0x23, 0x00, 0xba, 0xe7,
-  0x07, 0x4b, 0xea, 0x00, 0x9b, 0x18, 0x5c, 0x68, 0x1b, 0x68, 0x2f, 0x00,
-  0x06, 0x93, 0x07, 0x94, 0x00, 0x24, 0x8a, 0xe6, 0x21, 0x9b, 0x00, 0x2b,
-  0x93, 0xd0, 0x20, 0xe7, 0x4c, 0x6f, 0x00, 0x10, 0xf8, 0x70, 0x00, 0x10,
-  0xf0, 0xb5, 0xde, 0x46, 0x57, 0x46, 0x4e, 0x46, 0x45, 0x46, 0xe0, 0xb5,
-  0x9f, 0xb0, 0x1c, 0x00, 0x28, 0x9b, 0x93, 0x46, 0x0a, 0x93, 0xcc, 0x4a,
-  0xcc, 0x4b, 0x8a, 0x46, 0x09, 0x90, 0x1a, 0x60, 0x00, 0x29, 0x00, 0xd1,
-  0x4d, 0xe1, 0x00, 0x23, 0x20, 0x78, 0x99, 0x46, 0x00, 0x28, 0x00, 0xd1,
-  0x4f, 0xe1, 0xc7, 0x4b, 0x4d, 0x46, 0x08, 0x93, 0xc6, 0x4b, 0x0d, 0x93,
-  0x0a, 0xe0, 0x2a, 0x00, 0x6e, 0x1c, 0x5b, 0x46, 0x09, 0x9d, 0x51, 0x46,
-  0xa8, 0x47, 0x35, 0x00, 0x01, 0x34, 0x20, 0x78, 0x00, 0x28, 0x72, 0xd0,
-  0x25, 0x28, 0xf2, 0xd1, 0x10, 0x23, 0x99, 0x46, 0x08, 0x3b, 0x98, 0x46,
-  0x04, 0x3b, 0x00, 0x21, 0x9c, 0x46, 0x02, 0x27, 0x01, 0x34, 0x20, 0x78,
-  0x26, 0x00, 0x03, 0x00, 0x20, 0x3b, 0xdb, 0xb2, 0x10, 0x2b, 0x03, 0xd8,
-  0x08, 0x9a, 0x9b, 0x00, 0xd3, 0x58, 0x9f, 0x46, 0x03, 0x00, 0x30, 0x3b,
-  0x09, 0x2b, 0x6e, 0xd9, 0x00, 0x27, 0x2a, 0x28, 0x00, 0xd1, 0x8a, 0xe0,
-  0x00, 0x23, 0x0b, 0x93, 0x2e, 0x28, 0x00, 0xd1, 0x76, 0xe0, 0x03, 0x00,
-  0x68, 0x3b, 0xdb, 0xb2, 0x12, 0x2b, 0x1b, 0xd8, 0xac, 0x4c, 0x9b, 0x00,
-  0xe3, 0x58, 0x9f, 0x46, 0x01, 0x23, 0x01, 0x34, 0x19, 0x43, 0xda, 0xe7,
-  0x39, 0x43, 0x01, 0x34, 0xd7, 0xe7, 0x63, 0x46, 0x01, 0x34, 0x19, 0x43,
-  0xd3, 0xe7, 0x4b, 0x46, 0x01, 0x34, 0x19, 0x43, 0xcf, 0xe7, 0x43, 0x46,
-  0x01, 0x34, 0x19, 0x43, 0xcb, 0xe7, 0x80, 0x23, 0x5b, 0x00, 0x70, 0x78,
-  0x19, 0x43, 0x01, 0x36, 0x67, 0x28, 0x0a, 0xd8, 0x24, 0x28, 0x1f, 0xd9,
-  0x03, 0x00, 0x25, 0x3b, 0xdb, 0xb2, 0x42, 0x2b, 0x1a, 0xd8, 0x0d, 0x9a,
-  0x9b, 0x00, 0xd3, 0x58, 0x9f, 0x46, 0x03, 0x00, 0x69, 0x3b, 0xdb, 0xb2,
-  0x0f, 0x2b, 0x11, 0xd8, 0x01, 0x24, 0x9c, 0x40, 0x95, 0x4a, 0xa4, 0x46,
-  0x90, 0x46, 0x14, 0x40, 0x0c, 0x94, 0x62, 0x46, 0x44, 0x46, 0x22, 0x42,
-  0x00, 0xd0, 0x25, 0xe2, 0x0a, 0x2b, 0x00, 0xd1, 0x01, 0xe1, 0x07, 0x2b,
-  0x00, 0xd1, 0xd8, 0xe0, 0x09, 0x9c, 0x2a, 0x00, 0x5b, 0x46, 0x51, 0x46,
-  0xa0, 0x47, 0x70, 0x78, 0x6f, 0x1c, 0x74, 0x1c, 0x3d, 0x00, 0x00, 0x28,
-  0x8c, 0xd1, 0xa9, 0x46, 0x2c, 0x00, 0xcb, 0x45, 0x03, 0xd8, 0x01, 0x23,
-  0x5b, 0x42, 0x5b, 0x44, 0x99, 0x46, 0x5b, 0x46, 0x4a, 0x46, 0x51, 0x46,
-  0x00, 0x20, 0x09, 0x9d, 0xa8, 0x47, 0x20, 0x00, 0x1f, 0xb0, 0xf0, 0xbc,
-  0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46, 0xf0, 0xbd, 0x00, 0x27,
-  0xbb, 0x00, 0xdf, 0x19, 0x01, 0x36, 0x7f, 0x00, 0x3f, 0x18, 0x30, 0x78,
-  0x30, 0x3f, 0x03, 0x00, 0x30, 0x3b, 0x09, 0x2b, 0xf4, 0xd9, 0x00, 0x23,
-  0x0b, 0x93, 0x2e, 0x28, 0x00, 0xd0, 0x88, 0xe7, 0x80, 0x23, 0x70, 0x78,
-  0xdb, 0x00, 0x19, 0x43, 0x03, 0x00, 0x30, 0x3b, 0x74, 0x1c, 0x09, 0x2b,
-  0x00, 0xd8, 0x2c, 0xe1, 0x2a, 0x28, 0x00, 0xd1, 0x38, 0xe1, 0x26, 0x00,
-  0x79, 0xe7, 0x0a, 0x9b, 0x80, 0xcb, 0x00, 0x2f, 0x03, 0xdb, 0x60, 0x78,
-  0x0a, 0x93, 0x66, 0x1c, 0x6c, 0xe7, 0x02, 0x22, 0x60, 0x78, 0x11, 0x43,
-  0x7f, 0x42, 0x0a, 0x93, 0x66, 0x1c, 0x65, 0xe7, 0x67, 0x28, 0x00, 0xd1,
-  0xc8, 0xe1, 0x47, 0x28, 0x00, 0xd1, 0x04, 0xe2, 0x45, 0x28, 0x00, 0xd1,
-  0x04, 0xe2, 0x07, 0x20, 0x0a, 0x9b, 0x04, 0x91, 0x07, 0x33, 0x83, 0x43,
-  0x19, 0x00, 0x0b, 0x9a, 0x03, 0x97, 0x02, 0x92, 0x0c, 0xc9, 0x09, 0x98,
-  0x00, 0x92, 0x01, 0x93, 0x0a, 0x91, 0x2a, 0x00, 0x5b, 0x46, 0x51, 0x46,
-  0xff, 0xf7, 0xf6, 0xfa, 0x74, 0x1c, 0x05, 0x00, 0x25, 0xe7, 0x70, 0x78,
-  0x6c, 0x28, 0x00, 0xd1, 0x0d, 0xe2, 0x80, 0x23, 0x5b, 0x00, 0x19, 0x43,
-  0x01, 0x36, 0x63, 0xe7, 0x80, 0x23, 0x9b, 0x00, 0x70, 0x78, 0x19, 0x43,
-  0x01, 0x36, 0x5d, 0xe7, 0x70, 0x78, 0x68, 0x28, 0x00, 0xd1, 0xf9, 0xe1,
-  0x80, 0x23, 0x01, 0x36, 0x19, 0x43, 0x55, 0xe7, 0x46, 0x28, 0x00, 0xd1,
-  0x8f, 0xe1, 0x07, 0x20, 0x0a, 0x9b, 0x04, 0x91, 0x07, 0x33, 0x83, 0x43,
-  0x19, 0x00, 0x0b, 0x9a, 0x03, 0x97, 0x02, 0x92, 0x0c, 0xc9, 0x09, 0x98,
-  0x00, 0x92, 0x01, 0x93, 0x0a, 0x91, 0x2a, 0x00, 0x5b, 0x46, 0x51, 0x46,
-  0xff, 0xf7, 0xf0, 0xfc, 0x74, 0x1c, 0x05, 0x00, 0xf5, 0xe6, 0x2a, 0x00,
-  0x09, 0x9c, 0x5b, 0x46, 0x51, 0x46, 0x25, 0x20, 0x6f, 0x1c, 0xa0, 0x47,
-  0x3d, 0x00, 0x74, 0x1c, 0xeb, 0xe6, 0x89, 0x07, 0x00, 0xd4, 0xde, 0xe1,
-  0x0a, 0x9b, 0x2a, 0x00, 0x98, 0x46, 0x6b, 0x1c, 0x99, 0x46, 0x43, 0x46,
-  0x01, 0xcb, 0x51, 0x46, 0x98, 0x46, 0x09, 0x9c, 0x5b, 0x46, 0xc0, 0xb2,
-  0xa0, 0x47, 0xed, 0x19, 0x01, 0x2f, 0x00, 0xd8, 0x93, 0xe2, 0x4c, 0x46,
-  0xb1, 0x46, 0x56, 0x46, 0x09, 0x9f, 0x22, 0x00, 0x5b, 0x46, 0x01, 0x34,
-  0x31, 0x00, 0x20, 0x20, 0xb8, 0x47, 0xac, 0x42, 0xf7, 0xd1, 0xb2, 0x46,
-  0x43, 0x46, 0x4e, 0x46, 0x0a, 0x93, 0x74, 0x1c, 0xc5, 0xe6, 0x27, 0x4b,
-  0x20, 0x78, 0x09, 0x93, 0x00, 0x23, 0x99, 0x46, 0x00, 0x28, 0x00, 0xd0,
-  0xaf, 0xe6, 0x00, 0x24, 0x33, 0xe7, 0x0a, 0x9b, 0x1a, 0x00, 0x08, 0xca,
-  0x90, 0x46, 0x00, 0x2b, 0x00, 0xd1, 0xa7, 0xe0, 0x21, 0x20, 0x08, 0x43,
-  0x0e, 0xa9, 0x8c, 0x46, 0x1f, 0x22, 0x62, 0x44, 0x0f, 0x27, 0xac, 0x46,
-  0x81, 0x46, 0x15, 0x00, 0x0c, 0x9c, 0x02, 0xe0, 0x20, 0x2c, 0x0c, 0xd0,
-  0x13, 0x00, 0x38, 0x00, 0x18, 0x40, 0x01, 0x00, 0x37, 0x31, 0x09, 0x28,
-  0x00, 0xd8, 0x07, 0x39, 0x01, 0x34, 0x29, 0x55, 0x1a, 0x09, 0x0f, 0x2b,
-  0xf0, 0xd8, 0x65, 0x46, 0x48, 0x46, 0x0c, 0x94, 0x94, 0xe0, 0x0a, 0x9b,
-  0x1a, 0x00, 0x08, 0xca, 0x12, 0x92, 0x0b, 0x9a, 0x00, 0x2a, 0x7b, 0xd1,
-  0x02, 0x24, 0x1a, 0x78, 0x64, 0x42, 0x00, 0x2a, 0x1d, 0xd0, 0x01, 0x34,
-  0x18, 0x19, 0x9c, 0x46, 0x1c, 0x00, 0x03, 0x00, 0x10, 0xe0, 0xc0, 0x46,
-  0x79, 0x33, 0x00, 0x10, 0xb4, 0x20, 0x00, 0x20, 0x58, 0x6f, 0x00, 0x10,
-  0xe8, 0x6f, 0x00, 0x10, 0x9c, 0x6f, 0x00, 0x10, 0x41, 0x90, 0x00, 0x00,
-  0xb9, 0x28, 0x00, 0x10, 0x9c, 0x42, 0x03, 0xd0, 0x60, 0x78, 0x01, 0x34,
-  0x00, 0x28, 0xf9, 0xd1, 0x63, 0x46, 0xe0, 0x1a, 0x0c, 0x90, 0x80, 0x20,
-  0xc0, 0x00, 0x84, 0x46, 0x08, 0x40, 0x80, 0x46, 0x60, 0x46, 0x01, 0x42,
-  0x04, 0xd0, 0x0b, 0x98, 0x0c, 0x9c, 0x84, 0x42, 0x00, 0xd9, 0x0c, 0x90,
-  0x02, 0x20, 0x84, 0x46, 0x08, 0x40, 0x0a, 0x90, 0x60, 0x46, 0x08, 0x42,
-  0x00, 0xd1, 0x89, 0xe1, 0x10, 0x1e, 0x00, 0xd1, 0x70, 0xe1, 0x42, 0x46,
-  0x00, 0x2a, 0x00, 0xd1, 0x1b, 0xe1, 0x0b, 0x9a, 0x5b, 0x1b, 0x90, 0x46,
-  0xa8, 0x44, 0x44, 0x46, 0x2a, 0x00, 0xb8, 0x46, 0x99, 0x46, 0x57, 0x46,
-  0xb2, 0x46, 0x09, 0x9e, 0x09, 0xe0, 0x5b, 0x46, 0x39, 0x00, 0x55, 0x1c,
-  0xb0, 0x47, 0x4b, 0x46, 0x58, 0x5d, 0x00, 0x28, 0x00, 0xd1, 0x2c, 0xe1,
-  0x2a, 0x00, 0x94, 0x42, 0xf3, 0xd1, 0x56, 0x46, 0x25, 0x00, 0xba, 0x46,
-  0x47, 0x46, 0x0a, 0x9b, 0x00, 0x2b, 0x00, 0xd0, 0x4c, 0xe1, 0x12, 0x9b,
-  0x74, 0x1c, 0x0a, 0x93, 0x2b, 0xe6, 0x00, 0x22, 0x93, 0x00, 0x9b, 0x18,
-  0x5b, 0x00, 0x01, 0x34, 0x1a, 0x18, 0x20, 0x78, 0x30, 0x3a, 0x03, 0x00,
-  0x30, 0x3b, 0x09, 0x2b, 0xf4, 0xd9, 0x26, 0x00, 0x0b, 0x92, 0x42, 0xe6,
-  0x0a, 0x9b, 0x02, 0x36, 0x04, 0xcb, 0xd0, 0x43, 0xc0, 0x17, 0x02, 0x40,
-  0x0b, 0x92, 0x30, 0x78, 0x0a, 0x93, 0x38, 0xe6, 0x1a, 0x78, 0x00, 0x2a,
-  0xa3, 0xd0, 0x0b, 0x98, 0x44, 0x1e, 0x82, 0xe7, 0x10, 0x23, 0x08, 0x00,
-  0x80, 0x27, 0x98, 0x43, 0x11, 0x33, 0x18, 0x43, 0x0b, 0x00, 0xff, 0x00,
-  0x3b, 0x40, 0x39, 0x42, 0x00, 0xd1, 0x4d, 0xe7, 0x08, 0x23, 0x05, 0x93,
-  0x0b, 0x9b, 0x2a, 0x00, 0x04, 0x93, 0x10, 0x23, 0x03, 0x93, 0x00, 0x23,
-  0x02, 0x93, 0x0c, 0x9b, 0x06, 0x90, 0x01, 0x93, 0x16, 0xab, 0x00, 0x93,
-  0x51, 0x46, 0x5b, 0x46, 0x09, 0x98, 0xff, 0xf7, 0xb1, 0xf8, 0x43, 0x46,
-  0x05, 0x00, 0x74, 0x1c, 0x0a, 0x93, 0xe8, 0xe5, 0x62, 0x28, 0x00, 0xd1,
-  0xa6, 0xe1, 0x58, 0x28, 0x00, 0xd1, 0xb1, 0xe1, 0x80, 0x23, 0x0a, 0x00,
-  0xdb, 0x00, 0x1a, 0x40, 0x90, 0x46, 0x19, 0x42, 0x00, 0xd1, 0x89, 0xe1,
-  0x11, 0x23, 0x99, 0x43, 0x8c, 0x46, 0x80, 0x23, 0x62, 0x46, 0x9b, 0x00,
-  0x1a, 0x40, 0x10, 0x00, 0x62, 0x46, 0x1a, 0x42, 0x00, 0xd0, 0x23, 0xe1,
-  0x80, 0x23, 0x64, 0x46, 0x5b, 0x00, 0x1c, 0x40, 0x1a, 0x42, 0x00, 0xd0,
-  0x32, 0xe2, 0x63, 0x46, 0x5b, 0x06, 0x00, 0xd5, 0x6b, 0xe1, 0x63, 0x46,
-  0x0a, 0x99, 0x1b, 0x06, 0x00, 0xd4, 0xdb, 0xe2, 0x08, 0xc9, 0x1b, 0xb2,
-  0xda, 0x17, 0x98, 0x18, 0x50, 0x40, 0x80, 0xb2, 0x0a, 0x91, 0xda, 0x0f,
-  0x0c, 0x92, 0x00, 0x2b, 0x00, 0xd1, 0x18, 0xe2, 0x80, 0x46, 0x0e, 0xaa,
-  0x91, 0x46, 0x1f, 0x23, 0x4b, 0x44, 0x13, 0x95, 0xe1, 0x46, 0x45, 0x46,
-  0x12, 0x97, 0xb0, 0x46, 0x1e, 0x00, 0x01, 0xe0, 0x20, 0x2c, 0x0f, 0xd0,
-  0x28, 0x00, 0x0a, 0x21, 0xfe, 0xf7, 0x88, 0xf9, 0x01, 0x34, 0x37, 0x19,
-  0x30, 0x31, 0x39, 0x70, 0x28, 0x00, 0x0a, 0x21, 0xfe, 0xf7, 0x80, 0xf9,
-  0x2f, 0x00, 0x05, 0x00, 0x09, 0x2f, 0xed, 0xd8, 0x46, 0x46, 0xcc, 0x46,
-  0x12, 0x9f, 0x13, 0x9d, 0x63, 0x46, 0x06, 0x93, 0x0b, 0x9b, 0x05, 0x97,
-  0x04, 0x93, 0x0a, 0x23, 0x03, 0x93, 0x0c, 0x9b, 0x02, 0x93, 0x16, 0xab,
-  0x2a, 0x00, 0x01, 0x94, 0x00, 0x93, 0x51, 0x46, 0x5b, 0x46, 0x09, 0x98,
-  0xff, 0xf7, 0x42, 0xf8, 0x74, 0x1c, 0x05, 0x00, 0x7b, 0xe5, 0x20, 0x23,
-  0x19, 0x43, 0x6c, 0xe6, 0x80, 0x23, 0x1b, 0x01, 0x19, 0x43, 0x38, 0xe6,
-  0x78, 0x28, 0x00, 0xd0, 0x7c, 0xe1, 0x80, 0x23, 0x0a, 0x00, 0xdb, 0x00,
-  0x1a, 0x40, 0x91, 0x46, 0x19, 0x42, 0x00, 0xd1, 0xa5, 0xe2, 0x0d, 0x23,
-  0x99, 0x43, 0x08, 0x00, 0x03, 0x33, 0x0c, 0x93, 0x80, 0x23, 0x02, 0x00,
-  0x9b, 0x00, 0x1a, 0x40, 0x90, 0x46, 0x18, 0x42, 0x00, 0xd0, 0x78, 0xe1,
-  0x80, 0x23, 0x04, 0x00, 0x5b, 0x00, 0x1c, 0x40, 0x18, 0x42, 0x00, 0xd0,
-  0x07, 0xe2, 0x43, 0x06, 0x00, 0xd4, 0x53, 0xe2, 0xff, 0x21, 0x0a, 0x9b,
-  0x04, 0xcb, 0x0a, 0x40, 0x90, 0x46, 0x0a, 0x93, 0x43, 0x46, 0x00, 0x2b,
-  0x00, 0xd0, 0x26, 0xe1, 0x10, 0x33, 0x98, 0x43, 0x4b, 0x46, 0x00, 0x2b,
-  0x00, 0xd1, 0x20, 0xe1, 0x00, 0x24, 0x0b, 0x9b, 0x06, 0x90, 0x04, 0x93,
-  0x0c, 0x9b, 0x05, 0x97, 0x03, 0x93, 0x00, 0x23, 0xb0, 0xe7, 0x80, 0x23,
-  0x1b, 0x01, 0x19, 0x43, 0x20, 0x23, 0x19, 0x43, 0xf7, 0xe5, 0x5b, 0x1b,
-  0x99, 0x46, 0x0c, 0x9b, 0x09, 0x9c, 0x98, 0x46, 0x5b, 0x46, 0xb3, 0x46,
-  0x56, 0x46, 0xba, 0x46, 0x1f, 0x00, 0x2a, 0x00, 0x3b, 0x00, 0x31, 0x00,
-  0xa0, 0x47, 0x4b, 0x46, 0x01, 0x35, 0x58, 0x5d, 0x00, 0x28, 0xf6, 0xd1,
-  0x43, 0x46, 0x0c, 0x93, 0x3b, 0x00, 0x57, 0x46, 0xb2, 0x46, 0x5e, 0x46,
-  0x9b, 0x46, 0xe4, 0xe6, 0xc0, 0x23, 0xb0, 0x78, 0x19, 0x43, 0x02, 0x36,
-  0x5a, 0xe5, 0xc0, 0x23, 0x9b, 0x00, 0xb0, 0x78, 0x19, 0x43, 0x02, 0x36,
-  0x54, 0xe5, 0x56, 0x46, 0xba, 0x46, 0x47, 0x46, 0xd5, 0xe6, 0x01, 0x2f,
-  0x00, 0xd8, 0x32, 0xe2, 0x6b, 0x1e, 0x98, 0x46, 0xb8, 0x44, 0x2c, 0x00,
-  0xa9, 0x46, 0x45, 0x46, 0xb8, 0x46, 0x57, 0x46, 0xb2, 0x46, 0x09, 0x9e,
-  0x22, 0x00, 0x5b, 0x46, 0x01, 0x34, 0x39, 0x00, 0x20, 0x20, 0xb0, 0x47,
-  0xac, 0x42, 0xf7, 0xd1, 0x0a, 0x9b, 0x56, 0x46, 0x01, 0xcb, 0xba, 0x46,
-  0x47, 0x46, 0x98, 0x46, 0x22, 0x00, 0x5b, 0x46, 0x09, 0x9c, 0x51, 0x46,
-  0xc0, 0xb2, 0xa0, 0x47, 0x4d, 0x46, 0x43, 0x46, 0xed, 0x19, 0x0a, 0x93,
-  0x74, 0x1c, 0xe2, 0xe4, 0x0c, 0x9b, 0xa8, 0x46, 0x9f, 0x42, 0x00, 0xd8,
-  0xad, 0xe6, 0x44, 0x46, 0xb0, 0x46, 0x56, 0x46, 0x7d, 0x19, 0x09, 0x9f,
-  0xed, 0x1a, 0x22, 0x00, 0x5b, 0x46, 0x01, 0x34, 0x31, 0x00, 0x20, 0x20,
-  0xb8, 0x47, 0xac, 0x42, 0xf7, 0xd1, 0xb2, 0x46, 0x46, 0x46, 0x9c, 0xe6,
-  0x0c, 0x98, 0x87, 0x42, 0x00, 0xd8, 0xf0, 0xe1, 0x42, 0x46, 0x98, 0x46,
-  0x79, 0x19, 0xb9, 0x46, 0x57, 0x46, 0xb2, 0x46, 0x09, 0x9e, 0x0c, 0x1a,
-  0x0c, 0x92, 0x2a, 0x00, 0x5b, 0x46, 0x01, 0x35, 0x39, 0x00, 0x20, 0x20,
-  0xb0, 0x47, 0xa5, 0x42, 0xf7, 0xd1, 0x56, 0x46, 0xba, 0x46, 0x4f, 0x46,
-  0x43, 0x46, 0x0c, 0x9a, 0x90, 0x46, 0x7a, 0x1c, 0x0c, 0x92, 0x1a, 0x78,
-  0x10, 0x1e, 0x00, 0xd0, 0x57, 0xe6, 0x7a, 0xe6, 0x08, 0x22, 0x07, 0x21,
-  0x91, 0x46, 0x0a, 0x9b, 0x07, 0x33, 0x8b, 0x43, 0x99, 0x44, 0x4a, 0x46,
-  0x0a, 0xcb, 0x0c, 0x00, 0x0a, 0x92, 0x1c, 0x43, 0xda, 0x0f, 0x00, 0x2c,
-  0x4e, 0xd0, 0xd8, 0x17, 0x04, 0x00, 0x10, 0x90, 0x4c, 0x40, 0x11, 0x90,
-  0x0e, 0x94, 0x10, 0x98, 0x11, 0x99, 0x0c, 0x00, 0x5c, 0x40, 0x0f, 0x94,
-  0x0e, 0x9b, 0x0f, 0x9c, 0x1b, 0x1a, 0x8c, 0x41, 0x0e, 0x93, 0x0f, 0x94,
-  0x0e, 0xa9, 0x88, 0x46, 0x1f, 0x23, 0x00, 0x24, 0x43, 0x44, 0x12, 0x97,
-  0xb0, 0x46, 0x27, 0x00, 0x13, 0x95, 0x1e, 0x00, 0x0e, 0x9c, 0x0f, 0x9d,
-  0xe1, 0x46, 0x0c, 0x92, 0x01, 0xe0, 0x20, 0x2f, 0x10, 0xd0, 0x20, 0x00,
-  0x29, 0x00, 0x0a, 0x22, 0x00, 0x23, 0xfe, 0xf7, 0x99, 0xf8, 0x01, 0x37,
-  0x30, 0x32, 0x2b, 0x00, 0xf2, 0x55, 0x0d, 0x00, 0x22, 0x00, 0x04, 0x00,
-  0x00, 0x2b, 0xee, 0xd1, 0x09, 0x2a, 0xec, 0xd8, 0x46, 0x46, 0xcc, 0x46,
-  0x0e, 0x94, 0x0f, 0x95, 0x0c, 0x9a, 0x3c, 0x00, 0x13, 0x9d, 0x12, 0x9f,
-  0x63, 0x46, 0x06, 0x93, 0x0b, 0x9b, 0x05, 0x97, 0x04, 0x93, 0x0a, 0x23,
-  0x02, 0x92, 0x03, 0x93, 0xcf, 0xe6, 0xff, 0x23, 0x0a, 0x99, 0x04, 0xc9,
-  0x13, 0x40, 0x18, 0x00, 0x0a, 0x91, 0x98, 0xe6, 0x10, 0x23, 0x99, 0x43,
-  0x8c, 0x46, 0x74, 0xe6, 0x43, 0x46, 0x00, 0x24, 0x00, 0x2b, 0xe7, 0xd1,
-  0x00, 0x23, 0x00, 0x24, 0x0e, 0x93, 0x0f, 0x94, 0xb8, 0xe7, 0x43, 0x46,
-  0x4d, 0x46, 0x0a, 0x93, 0x74, 0x1c, 0x3e, 0xe4, 0x80, 0x23, 0x0a, 0x00,
-  0xdb, 0x00, 0x1a, 0x40, 0x91, 0x46, 0x19, 0x42, 0x00, 0xd1, 0x40, 0xe1,
-  0x0d, 0x23, 0x99, 0x43, 0x0b, 0x3b, 0x08, 0x00, 0x0c, 0x93, 0xcb, 0xe6,
-  0x80, 0x23, 0x0a, 0x00, 0xdb, 0x00, 0x1a, 0x40, 0x91, 0x46, 0x19, 0x42,
-  0x00, 0xd1, 0x62, 0xe1, 0x0d, 0x23, 0x20, 0x20, 0x99, 0x43, 0x03, 0x33,
-  0x08, 0x43, 0x0c, 0x93, 0xbc, 0xe6, 0x61, 0x23, 0x81, 0x06, 0x00, 0xd5,
-  0x41, 0x23, 0x0e, 0xa9, 0x1f, 0x22, 0x8c, 0x46, 0xdb, 0xb2, 0x62, 0x44,
-  0x0a, 0x3b, 0x13, 0x97, 0x14, 0x95, 0x81, 0x46, 0x45, 0x46, 0x0c, 0x9f,
-  0xb0, 0x46, 0x12, 0x93, 0x16, 0x00, 0x08, 0xe0, 0x30, 0x33, 0xdb, 0xb2,
-  0x01, 0x34, 0x33, 0x55, 0xbd, 0x42, 0x0e, 0xd3, 0x20, 0x2c, 0x0c, 0xd0,
-  0x05, 0x00, 0x39, 0x00, 0x28, 0x00, 0xfd, 0xf7, 0xe9, 0xff, 0xcb, 0xb2,
-  0x09, 0x29, 0xef, 0xd9, 0x12, 0x9a, 0x94, 0x46, 0x63, 0x44, 0xdb, 0xb2,
-  0xec, 0xe7, 0x46, 0x46, 0x48, 0x46, 0x13, 0x9f, 0x14, 0x9d, 0xb2, 0xe6,
-  0x6f, 0x28, 0x00, 0xd0, 0x3c, 0xe1, 0x0c, 0x23, 0x08, 0x00, 0x98, 0x43,
-  0x80, 0x23, 0x0a, 0x00, 0xdb, 0x00, 0x1a, 0x40, 0x91, 0x46, 0x19, 0x42,
-  0x00, 0xd0, 0x2a, 0xe1, 0x08, 0x23, 0x0c, 0x93, 0x7e, 0xe6, 0x0a, 0x99,
-  0xfa, 0x3b, 0xff, 0x3b, 0x07, 0x31, 0x99, 0x43, 0x01, 0x33, 0x9c, 0x46,
-  0x8c, 0x44, 0x63, 0x46, 0x4a, 0x68, 0x0a, 0x93, 0x0b, 0x68, 0x90, 0x46,
-  0x9c, 0x46, 0x13, 0x43, 0x19, 0x1e, 0x06, 0xd1, 0x4b, 0x46, 0x10, 0x31,
-  0x00, 0x24, 0x88, 0x43, 0x00, 0x2b, 0x00, 0xd0, 0x89, 0xe6, 0x61, 0x21,
-  0x83, 0x06, 0x00, 0xd5, 0x41, 0x21, 0x0e, 0xaa, 0x91, 0x46, 0x1f, 0x23,
-  0x4b, 0x44, 0x99, 0x46, 0xc9, 0xb2, 0x0c, 0x9b, 0x0a, 0x39, 0x13, 0x97,
-  0x14, 0x95, 0x15, 0x96, 0x45, 0x46, 0x4e, 0x46, 0x00, 0x24, 0x67, 0x46,
-  0x98, 0x46, 0x81, 0x46, 0x12, 0x91, 0x0c, 0xe0, 0x30, 0x32, 0xd2, 0xb2,
-  0x00, 0x23, 0x01, 0x34, 0x32, 0x55, 0xab, 0x42, 0x00, 0xd1, 0xbc, 0xe0,
-  0x20, 0x2c, 0x00, 0xd1, 0xbc, 0xe0, 0x07, 0x00, 0x0d, 0x00, 0x42, 0x46,
-  0x00, 0x23, 0x38, 0x00, 0x29, 0x00, 0xfd, 0xf7, 0xc7, 0xff, 0xd2, 0xb2,
-  0x09, 0x2a, 0xe9, 0xd9, 0x12, 0x9b, 0x9c, 0x46, 0x62, 0x44, 0xd2, 0xb2,
-  0xe6, 0xe7, 0x43, 0x46, 0x00, 0x2b, 0x00, 0xd0, 0x04, 0xe6, 0xe2, 0xe5,
-  0x0a, 0x9c, 0x08, 0xcc, 0xda, 0x0f, 0x13, 0x92, 0x00, 0x2b, 0x00, 0xd1,
-  0xa5, 0xe0, 0xd9, 0x17, 0x5b, 0x18, 0x4b, 0x40, 0x98, 0x46, 0x0e, 0xaa,
-  0x91, 0x46, 0x1f, 0x23, 0x4b, 0x44, 0x0c, 0x95, 0xa1, 0x46, 0x45, 0x46,
-  0x12, 0x96, 0xe0, 0x46, 0x06, 0x00, 0x1c, 0x00, 0x0a, 0x97, 0x01, 0xe0,
-  0x20, 0x2e, 0x0f, 0xd0, 0x28, 0x00, 0x0a, 0x21, 0xfd, 0xf7, 0x5e, 0xff,
-  0x01, 0x36, 0xa7, 0x19, 0x30, 0x31, 0x39, 0x70, 0x28, 0x00, 0x0a, 0x21,
-  0xfd, 0xf7, 0x56, 0xff, 0x2f, 0x00, 0x05, 0x00, 0x09, 0x2f, 0xed, 0xd8,
-  0xc4, 0x46, 0x4c, 0x46, 0x30, 0x00, 0x0a, 0x9f, 0x0c, 0x9d, 0x12, 0x9e,
-  0x63, 0x46, 0x06, 0x93, 0x0b, 0x9b, 0x2a, 0x00, 0x04, 0x93, 0x0a, 0x23,
-  0x03, 0x93, 0x13, 0x9b, 0x01, 0x90, 0x02, 0x93, 0x16, 0xab, 0x00, 0x93,
-  0x51, 0x46, 0x5b, 0x46, 0x09, 0x98, 0x05, 0x97, 0xfe, 0xf7, 0x16, 0xfe,
-  0x0a, 0x94, 0x05, 0x00, 0x74, 0x1c, 0xff, 0xf7, 0x4e, 0xfb, 0x0a, 0x9b,
-  0x10, 0xcb, 0x14, 0x93, 0x00, 0x2c, 0x04, 0xd1, 0x10, 0x23, 0x98, 0x43,
-  0x4b, 0x46, 0x00, 0x2b, 0x2c, 0xd1, 0x61, 0x23, 0x81, 0x06, 0x00, 0xd5,
-  0x41, 0x23, 0x0e, 0xa9, 0x1f, 0x22, 0x8c, 0x46, 0xdb, 0xb2, 0x62, 0x44,
-  0x0a, 0x3b, 0x12, 0x97, 0x13, 0x95, 0x81, 0x46, 0x45, 0x46, 0x0c, 0x9f,
-  0xb0, 0x46, 0x0a, 0x93, 0x16, 0x00, 0x08, 0xe0, 0x30, 0x33, 0xdb, 0xb2,
-  0x01, 0x35, 0x73, 0x55, 0xbc, 0x42, 0x0e, 0xd3, 0x20, 0x2d, 0x0c, 0xd0,
-  0x04, 0x00, 0x39, 0x00, 0x20, 0x00, 0xfd, 0xf7, 0x0b, 0xff, 0xcb, 0xb2,
-  0x09, 0x29, 0xef, 0xd9, 0x0a, 0x9a, 0x94, 0x46, 0x63, 0x44, 0xdb, 0xb2,
-  0xec, 0xe7, 0x48, 0x46, 0x46, 0x46, 0x12, 0x9f, 0xa8, 0x46, 0x13, 0x9d,
-  0x0b, 0x9b, 0x2a, 0x00, 0x04, 0x93, 0x0c, 0x9b, 0x06, 0x90, 0x03, 0x93,
-  0x00, 0x23, 0x02, 0x93, 0x43, 0x46, 0x01, 0x93, 0x16, 0xab, 0x00, 0x93,
-  0x51, 0x46, 0x5b, 0x46, 0x09, 0x98, 0x05, 0x97, 0xfe, 0xf7, 0xc8, 0xfd,
-  0x14, 0x9b, 0x05, 0x00, 0x0a, 0x93, 0x74, 0x1c, 0xff, 0xf7, 0xff, 0xfa,
-  0x03, 0x06, 0x1f, 0xd5, 0x0a, 0x9b, 0x02, 0xcb, 0x09, 0x04, 0x0a, 0x0c,
-  0x90, 0x46, 0x0a, 0x93, 0xa8, 0xe5, 0x0c, 0x23, 0x99, 0x43, 0x0a, 0x3b,
-  0x08, 0x00, 0x0c, 0x93, 0x8a, 0xe5, 0xb8, 0x45, 0x00, 0xd8, 0x3f, 0xe7,
-  0x48, 0x46, 0x13, 0x9f, 0x14, 0x9d, 0x15, 0x9e, 0xa5, 0xe5, 0x43, 0x46,
-  0x00, 0x2b, 0x00, 0xd0, 0x7e, 0xe7, 0x58, 0xe7, 0x08, 0xc9, 0xda, 0x17,
-  0x98, 0x18, 0x50, 0x40, 0x0a, 0x91, 0x24, 0xe5, 0x0a, 0x9b, 0x04, 0xcb,
-  0x90, 0x46, 0x0a, 0x93, 0x8a, 0xe5, 0x01, 0x00, 0x01, 0x31, 0x0c, 0x91,
-  0x24, 0xe6, 0x0a, 0x9f, 0x6c, 0x1c, 0x01, 0xcf, 0x2a, 0x00, 0x5b, 0x46,
-  0x09, 0x9d, 0x51, 0x46, 0xc0, 0xb2, 0xa8, 0x47, 0x25, 0x00, 0x0a, 0x97,
-  0x74, 0x1c, 0xff, 0xf7, 0xc6, 0xfa, 0x20, 0x23, 0x19, 0x43, 0x0c, 0x23,
-  0x99, 0x43, 0x00, 0x23, 0x99, 0x46, 0x10, 0x33, 0x08, 0x00, 0x0c, 0x93,
-  0x56, 0xe5, 0x08, 0x23, 0x8c, 0x46, 0x0c, 0x93, 0x0d, 0x23, 0x60, 0x46,
-  0x98, 0x43, 0x4f, 0xe5, 0x10, 0x23, 0x0a, 0x00, 0x9a, 0x43, 0x94, 0x46,
-  0x69, 0x28, 0x08, 0xd1, 0x80, 0x23, 0x0a, 0x00, 0xdb, 0x00, 0x1a, 0x40,
-  0x90, 0x46, 0x19, 0x42, 0x00, 0xd1, 0xce, 0xe4, 0xca, 0xe4, 0x1c, 0x23,
-  0x08, 0x00, 0x98, 0x43, 0x80, 0x23, 0x0a, 0x00, 0xdb, 0x00, 0x1a, 0x40,
-  0x91, 0x46, 0x19, 0x42, 0x02, 0xd1, 0x0a, 0x23, 0x0c, 0x93, 0x33, 0xe5,
-  0x0a, 0x23, 0x0c, 0x93, 0xdc, 0xe7, 0xc0, 0x46, 0x00, 0xb5, 0x85, 0xb0,
-  0x03, 0x91, 0x01, 0x21, 0x02, 0x90, 0x00, 0x93, 0x03, 0x48, 0x13, 0x00,
-  0x4a, 0x42, 0x02, 0xa9, 0xff, 0xf7, 0x62, 0xfa, 0x05, 0xb0, 0x00, 0xbd,
-  0x51, 0x2b, 0x00, 0x10, 0x10, 0xb5, 0x09, 0x4a, 0x03, 0x00, 0x14, 0x68,
-  0x84, 0xb0, 0x00, 0x2c, 0x08, 0xd0, 0x01, 0x22, 0x00, 0x91, 0x06, 0x48,
-  0x52, 0x42, 0x03, 0xa9, 0xa0, 0x47, 0x01, 0x20, 0x04, 0xb0, 0x10, 0xbd,
-  0x00, 0xf0, 0xa6, 0xf9, 0x00, 0x20, 0xf9, 0xe7, 0xb4, 0x20, 0x00, 0x20,
-  0x41, 0x2b, 0x00, 0x10, 0x00, 0xbe, 0xfd, 0xe7, 0x10, 0xb5, 0xff, 0xf7,
-  0xfb, 0xff, 0xc0, 0x46, 0x70, 0xb5, 0xfd, 0xf7, 0x4b, 0xfd, 0x07, 0x4d,
-  0x07, 0x4e, 0xb5, 0x42, 0x09, 0xd2, 0x00, 0x24, 0x01, 0x3e, 0x76, 0x1b,
-  0xb6, 0x08, 0x08, 0xcd, 0x98, 0x47, 0x23, 0x00, 0x01, 0x34, 0xb3, 0x42,
-  0xf9, 0xd1, 0x70, 0xbd, 0x24, 0x6e, 0x00, 0x10, 0x2c, 0x6e, 0x00, 0x10,
-  0x03, 0x00, 0x10, 0xb5, 0x08, 0x00, 0x11, 0x00, 0x1b, 0x68, 0x98, 0x47,
-  0x10, 0xbd, 0xc0, 0x46, 0xf0, 0xb5, 0x46, 0x46, 0x4f, 0x46, 0xd6, 0x46,
-  0xc0, 0xb5, 0x43, 0x7d, 0x80, 0x46, 0x0e, 0x00, 0x17, 0x00, 0x00, 0x2b,
-  0x4b, 0xd0, 0x00, 0x2a, 0x32, 0xdd, 0x27, 0x4b, 0x01, 0x25, 0x9a, 0x46,
-  0x4b, 0x1e, 0x00, 0x24, 0x00, 0x20, 0x99, 0x46, 0x07, 0xe0, 0x33, 0x5d,
-  0x0a, 0x2b, 0x2c, 0xd0, 0x2b, 0x00, 0x01, 0x34, 0x01, 0x35, 0xbb, 0x42,
-  0x13, 0xda, 0x00, 0x2c, 0xf5, 0xd1, 0x33, 0x78, 0x0a, 0x2b, 0xf5, 0xd1,
-  0x43, 0x46, 0x1b, 0x7d, 0x00, 0x2b, 0xf1, 0xd1, 0x43, 0x46, 0x50, 0x46,
-  0x02, 0x21, 0x1b, 0x68, 0x98, 0x47, 0x28, 0x00, 0x2b, 0x00, 0x01, 0x34,
-  0x01, 0x35, 0xbb, 0x42, 0xeb, 0xdb, 0x87, 0x42, 0x04, 0xdd, 0x43, 0x46,
-  0x39, 0x1a, 0x1b, 0x68, 0x30, 0x18, 0x98, 0x47, 0xf6, 0x19, 0x01, 0x3e,
-  0x33, 0x78, 0x0d, 0x3b, 0x5a, 0x42, 0x53, 0x41, 0x42, 0x46, 0x13, 0x75,
-  0xe0, 0xbc, 0xba, 0x46, 0xb1, 0x46, 0xa8, 0x46, 0xf0, 0xbd, 0x4b, 0x46,
-  0x1b, 0x5d, 0x0d, 0x2b, 0xce, 0xd0, 0xa0, 0x42, 0xda, 0xda, 0x43, 0x46,
-  0x21, 0x1a, 0x1b, 0x68, 0x30, 0x18, 0x98, 0x47, 0x43, 0x46, 0x50, 0x46,
-  0x02, 0x21, 0x1b, 0x68, 0x98, 0x47, 0x28, 0x00, 0xd4, 0xe7, 0x03, 0x68,
-  0x11, 0x00, 0x30, 0x00, 0x98, 0x47, 0xe3, 0xe7, 0x48, 0x71, 0x00, 0x10,
-  0xf0, 0xb5, 0xc6, 0x46, 0x0b, 0x68, 0x06, 0x00, 0x0c, 0x00, 0x00, 0xb5,
-  0x80, 0x2b, 0x06, 0xd0, 0x5a, 0x1c, 0x22, 0x60, 0xe4, 0x18, 0x26, 0x71,
-  0x80, 0xbc, 0xb8, 0x46, 0xf0, 0xbd, 0x0f, 0x4b, 0x1d, 0x68, 0x00, 0x2d,
-  0x16, 0xd0, 0x0b, 0x1d, 0x98, 0x46, 0x0d, 0x4f, 0x02, 0xe0, 0x2d, 0x69,
-  0x00, 0x2d, 0x0f, 0xd0, 0x2b, 0x68, 0x00, 0x2b, 0xf9, 0xd0, 0x3b, 0x68,
-  0x00, 0x2b, 0x01, 0xd0, 0xab, 0x42, 0xf4, 0xd1, 0x28, 0x00, 0x41, 0x46,
-  0x22, 0x68, 0xff, 0xf7, 0x7b, 0xff, 0x2d, 0x69, 0x00, 0x2d, 0xef, 0xd1,
-  0x01, 0x22, 0x00, 0x23, 0xdb, 0xe7, 0xc0, 0x46, 0xa8, 0x1c, 0x00, 0x20,
-  0xb0, 0x1c, 0x00, 0x20, 0xf0, 0xb5, 0xde, 0x46, 0x57, 0x46, 0x4e, 0x46,
-  0x45, 0x46, 0xe0, 0xb5, 0x85, 0xb0, 0x17, 0x00, 0x1c, 0x00, 0x06, 0x00,
-  0x0d, 0x00, 0xfd, 0xf7, 0xbb, 0xf9, 0x00, 0x23, 0x31, 0x4a, 0x12, 0x18,
-  0x4b, 0x41, 0x80, 0x21, 0x09, 0x06, 0x8b, 0x42, 0x02, 0xd3, 0x01, 0x22,
-  0x2e, 0x4b, 0x52, 0x42, 0x2e, 0x49, 0x08, 0x00, 0x8a, 0x46, 0x02, 0xf0,
-  0x8d, 0xfe, 0x01, 0x90, 0x6b, 0x1c, 0x03, 0xd1, 0x30, 0x00, 0x02, 0xf0,
-  0x17, 0xfe, 0x05, 0x00, 0x00, 0x2c, 0x26, 0xd0, 0x28, 0x4b, 0x98, 0x46,
-  0x28, 0x4b, 0x1c, 0x68, 0x00, 0x2c, 0x15, 0xd0, 0x00, 0x2f, 0x21, 0xd1,
-  0x26, 0x4f, 0x02, 0xe0, 0x24, 0x69, 0x00, 0x2c, 0x0e, 0xd0, 0x23, 0x68,
-  0x00, 0x2b, 0xf9, 0xd0, 0x3b, 0x68, 0x00, 0x2b, 0x01, 0xd0, 0xa3, 0x42,
-  0xf4, 0xd1, 0x20, 0x00, 0x2a, 0x00, 0x31, 0x00, 0xc0, 0x47, 0x24, 0x69,
-  0x00, 0x2c, 0xf0, 0xd1, 0x01, 0x9b, 0x00, 0x2b, 0x28, 0xd1, 0x28, 0x00,
-  0x05, 0xb0, 0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46,
-  0xf0, 0xbd, 0x18, 0x4b, 0x98, 0x46, 0xd7, 0xe7, 0x15, 0x4b, 0x99, 0x46,
-  0x02, 0xab, 0xdf, 0x1d, 0x0a, 0x23, 0x9b, 0x46, 0x02, 0xe0, 0x24, 0x69,
-  0x00, 0x2c, 0xe7, 0xd0, 0x23, 0x68, 0x00, 0x2b, 0xf9, 0xd0, 0x4b, 0x46,
-  0x1b, 0x68, 0x00, 0x2b, 0x01, 0xd0, 0xa3, 0x42, 0xf3, 0xd1, 0x2a, 0x00,
-  0x31, 0x00, 0x20, 0x00, 0xc0, 0x47, 0x5b, 0x46, 0x01, 0x22, 0x39, 0x00,
-  0x20, 0x00, 0x3b, 0x70, 0xc0, 0x47, 0xe8, 0xe7, 0x50, 0x46, 0x02, 0xf0,
-  0x01, 0xfe, 0xd2, 0xe7, 0x40, 0x42, 0x0f, 0x00, 0xff, 0xff, 0xff, 0x7f,
-  0x80, 0x10, 0x00, 0x20, 0x35, 0x3f, 0x00, 0x10, 0xa8, 0x1c, 0x00, 0x20,
-  0xb0, 0x1c, 0x00, 0x20, 0x25, 0x3f, 0x00, 0x10, 0x0a, 0x4a, 0x13, 0x68,
-  0x00, 0x2b, 0x05, 0xd1, 0x0c, 0xe0, 0x1a, 0x00, 0x1b, 0x69, 0x10, 0x32,
-  0x00, 0x2b, 0x07, 0xd0, 0x98, 0x42, 0xf8, 0xd1, 0x00, 0x29, 0x02, 0xd1,
-  0x03, 0x69, 0x13, 0x60, 0x01, 0x61, 0x70, 0x47, 0x00, 0x29, 0xfc, 0xd0,
-  0x10, 0x60, 0xfa, 0xe7, 0xa8, 0x1c, 0x00, 0x20, 0x10, 0xb5, 0x00, 0xf0,
-  0xb9, 0xf9, 0x00, 0xf0, 0x01, 0xfc, 0x01, 0x20, 0x10, 0xbd, 0xc0, 0x46,
-  0xf0, 0xb5, 0xce, 0x46, 0x47, 0x46, 0x80, 0xb5, 0x83, 0xb0, 0x6b, 0x46,
-  0x06, 0x00, 0xdd, 0x1d, 0x28, 0x70, 0xfd, 0xf7, 0x1d, 0xf9, 0x00, 0x23,
-  0x1a, 0x4a, 0x12, 0x18, 0x4b, 0x41, 0x80, 0x21, 0x09, 0x06, 0x8b, 0x42,
-  0x02, 0xd3, 0x01, 0x22, 0x17, 0x4b, 0x52, 0x42, 0x17, 0x49, 0x08, 0x00,
-  0x88, 0x46, 0x02, 0xf0, 0xef, 0xfd, 0x16, 0x4b, 0x81, 0x46, 0x1c, 0x68,
-  0x00, 0x2c, 0x14, 0xd0, 0x14, 0x4f, 0x02, 0xe0, 0x24, 0x69, 0x00, 0x2c,
-  0x0f, 0xd0, 0x23, 0x68, 0x00, 0x2b, 0xf9, 0xd0, 0x3b, 0x68, 0x00, 0x2b,
-  0x01, 0xd0, 0xa3, 0x42, 0xf4, 0xd1, 0x20, 0x00, 0x01, 0x22, 0x29, 0x00,
-  0xff, 0xf7, 0x9e, 0xfe, 0x24, 0x69, 0x00, 0x2c, 0xef, 0xd1, 0x4b, 0x46,
-  0x00, 0x2b, 0x05, 0xd1, 0x30, 0x00, 0x03, 0xb0, 0xc0, 0xbc, 0xb9, 0x46,
-  0xb0, 0x46, 0xf0, 0xbd, 0x40, 0x46, 0x02, 0xf0, 0x91, 0xfd, 0xf5, 0xe7,
-  0x40, 0x42, 0x0f, 0x00, 0xff, 0xff, 0xff, 0x7f, 0x80, 0x10, 0x00, 0x20,
-  0xa8, 0x1c, 0x00, 0x20, 0xb0, 0x1c, 0x00, 0x20, 0x70, 0xb5, 0x04, 0x00,
-  0x02, 0xf0, 0x4a, 0xfd, 0x01, 0x23, 0x01, 0x00, 0x05, 0x00, 0x01, 0x22,
-  0x20, 0x00, 0xff, 0xf7, 0x09, 0xff, 0x08, 0x4b, 0x1c, 0x68, 0x00, 0x2c,
-  0x06, 0xd0, 0x63, 0x68, 0x00, 0x2b, 0x05, 0xd0, 0x98, 0x47, 0x24, 0x69,
-  0x00, 0x2c, 0xf8, 0xd1, 0x28, 0x00, 0x70, 0xbd, 0x24, 0x69, 0x00, 0x2c,
-  0xf3, 0xd1, 0xf9, 0xe7, 0xa8, 0x1c, 0x00, 0x20, 0xf0, 0xb5, 0xce, 0x46,
-  0x47, 0x46, 0x80, 0xb5, 0xa3, 0xb0, 0x04, 0x00, 0x0d, 0x00, 0xfd, 0xf7,
-  0xb5, 0xf8, 0x00, 0x23, 0x29, 0x4a, 0x12, 0x18, 0x4b, 0x41, 0x80, 0x21,
-  0x09, 0x06, 0x8b, 0x42, 0x02, 0xd3, 0x01, 0x22, 0x26, 0x4b, 0x52, 0x42,
-  0x26, 0x4f, 0x38, 0x00, 0x02, 0xf0, 0x88, 0xfd, 0x00, 0x23, 0x06, 0x00,
-  0x01, 0x93, 0x22, 0x00, 0x2b, 0x00, 0x23, 0x48, 0x01, 0xa9, 0xff, 0xf7,
-  0xf9, 0xfd, 0x01, 0x9b, 0x80, 0x46, 0x00, 0x2b, 0x14, 0xd1, 0x20, 0x4b,
-  0x1c, 0x68, 0x00, 0x2c, 0x06, 0xd0, 0x63, 0x68, 0x00, 0x2b, 0x0b, 0xd0,
-  0x98, 0x47, 0x24, 0x69, 0x00, 0x2c, 0xf8, 0xd1, 0x00, 0x2e, 0x25, 0xd1,
-  0x40, 0x46, 0x23, 0xb0, 0xc0, 0xbc, 0xb9, 0x46, 0xb0, 0x46, 0xf0, 0xbd,
-  0x24, 0x69, 0xec, 0xe7, 0x15, 0x4b, 0x1d, 0x68, 0x99, 0x46, 0x00, 0x2d,
-  0x1c, 0xd0, 0x14, 0x4c, 0x02, 0xe0, 0x2d, 0x69, 0x00, 0x2d, 0x0f, 0xd0,
-  0x2b, 0x68, 0x00, 0x2b, 0xf9, 0xd0, 0x23, 0x68, 0x00, 0x2b, 0x01, 0xd0,
-  0xab, 0x42, 0xf4, 0xd1, 0x28, 0x00, 0x01, 0x9a, 0x02, 0xa9, 0xff, 0xf7,
-  0x15, 0xfe, 0x2d, 0x69, 0x00, 0x2d, 0xef, 0xd1, 0x4b, 0x46, 0x01, 0x95,
-  0x1c, 0x68, 0xce, 0xe7, 0x38, 0x00, 0x02, 0xf0, 0x0d, 0xfd, 0xd5, 0xe7,
-  0x01, 0x95, 0xd1, 0xe7, 0x40, 0x42, 0x0f, 0x00, 0xff, 0xff, 0xff, 0x7f,
-  0x80, 0x10, 0x00, 0x20, 0xf1, 0x3f, 0x00, 0x10, 0xa8, 0x1c, 0x00, 0x20,
-  0xb0, 0x1c, 0x00, 0x20, 0x0f, 0xb4, 0x00, 0xb5, 0x83, 0xb0, 0x04, 0xa9,
-  0x01, 0xc9, 0x01, 0x91, 0xff, 0xf7, 0x8e, 0xff, 0x03, 0xb0, 0x08, 0xbc,
-  0x04, 0xb0, 0x18, 0x47, 0xf0, 0xb5, 0x00, 0x29, 0x15, 0xdd, 0x0e, 0x4b,
-  0x0d, 0x27, 0x1a, 0x68, 0x0d, 0x4b, 0x0e, 0x4c, 0xd3, 0x18, 0x5d, 0x42,
-  0x6b, 0x41, 0x45, 0x18, 0x20, 0x21, 0x5b, 0x00, 0x1e, 0x5f, 0x04, 0x78,
-  0xa6, 0x42, 0x07, 0xd0, 0x93, 0x69, 0x19, 0x42, 0xfc, 0xd1, 0x01, 0x30,
-  0x14, 0x60, 0xa8, 0x42, 0xf5, 0xd1, 0xf0, 0xbd, 0x93, 0x69, 0x19, 0x42,
-  0xfc, 0xd1, 0x17, 0x60, 0xf2, 0xe7, 0xc0, 0x46, 0xf4, 0x20, 0x00, 0x20,
-  0x00, 0x80, 0xfc, 0xbf, 0xf0, 0x20, 0x00, 0x20, 0x30, 0xb5, 0x04, 0x00,
-  0x0d, 0x1e, 0x2e, 0xdd, 0x00, 0x20, 0x10, 0x21, 0x1f, 0x4b, 0x01, 0x3c,
-  0x1a, 0x68, 0x93, 0x69, 0x19, 0x42, 0x16, 0xd1, 0x01, 0x30, 0x93, 0x69,
-  0x19, 0x42, 0xfc, 0xd1, 0x13, 0x68, 0x23, 0x54, 0x85, 0x42, 0xf4, 0xd1,
-  0x19, 0x4b, 0x1b, 0x68, 0x00, 0x2b, 0x08, 0xd0, 0x50, 0x23, 0x93, 0x63,
-  0x51, 0x6b, 0x18, 0x3b, 0x0b, 0x40, 0x16, 0x49, 0x8c, 0x46, 0x62, 0x44,
-  0x13, 0x60, 0x28, 0x00, 0x0e, 0xe0, 0x12, 0x4b, 0x1b, 0x68, 0x00, 0x2b,
-  0x08, 0xd0, 0x50, 0x23, 0x93, 0x63, 0x51, 0x6b, 0x18, 0x3b, 0x0b, 0x40,
-  0x0e, 0x49, 0x8c, 0x46, 0x62, 0x44, 0x13, 0x60, 0x00, 0x28, 0x0f, 0xd0,
-  0x30, 0xbd, 0x0a, 0x4b, 0x1b, 0x68, 0x00, 0x2b, 0x0a, 0xd0, 0x50, 0x22,
-  0x06, 0x4b, 0x1b, 0x68, 0x9a, 0x63, 0x59, 0x6b, 0x18, 0x3a, 0x0a, 0x40,
-  0x05, 0x49, 0x8c, 0x46, 0x63, 0x44, 0x1a, 0x60, 0x03, 0x20, 0x40, 0x42,
-  0xec, 0xe7, 0xc0, 0x46, 0xf4, 0x20, 0x00, 0x20, 0x40, 0x1c, 0x00, 0x20,
-  0x34, 0x10, 0x00, 0x00, 0x06, 0x4b, 0x10, 0xb5, 0x1b, 0x68, 0x00, 0x2b,
-  0x06, 0xd0, 0x00, 0x21, 0x04, 0x4a, 0x12, 0x68, 0x91, 0x63, 0x04, 0x4a,
-  0x10, 0x68, 0x98, 0x47, 0x10, 0xbd, 0xc0, 0x46, 0x40, 0x1c, 0x00, 0x20,
-  0xf4, 0x20, 0x00, 0x20, 0x48, 0x1c, 0x00, 0x20, 0x08, 0x22, 0x03, 0x4b,
-  0x19, 0x68, 0x8b, 0x69, 0x1a, 0x42, 0xfc, 0xd1, 0x70, 0x47, 0xc0, 0x46,
-  0xf4, 0x20, 0x00, 0x20, 0x70, 0xb5, 0x1b, 0x4e, 0x1b, 0x4b, 0x32, 0x68,
-  0x05, 0x00, 0xd3, 0x18, 0x58, 0x42, 0x43, 0x41, 0x14, 0x33, 0x1c, 0x00,
-  0x00, 0x2d, 0x04, 0xd0, 0x17, 0x4b, 0x1a, 0x68, 0x00, 0x2a, 0x11, 0xd0,
-  0x70, 0xbd, 0x15, 0x4e, 0x33, 0x68, 0x00, 0x2b, 0xfa, 0xd0, 0x00, 0x21,
-  0x20, 0x00, 0x95, 0x63, 0xfc, 0xf7, 0x74, 0xf8, 0x20, 0x00, 0x11, 0x49,
-  0xfc, 0xf7, 0xd0, 0xf9, 0x10, 0x4b, 0x35, 0x60, 0x1d, 0x60, 0xed, 0xe7,
-  0x1d, 0x60, 0x0e, 0x4b, 0x20, 0x00, 0x19, 0x60, 0x0b, 0x49, 0xfc, 0xf7,
-  0xa1, 0xf8, 0x01, 0x21, 0x20, 0x00, 0xfc, 0xf7, 0x61, 0xf8, 0x50, 0x22,
-  0x33, 0x68, 0x9a, 0x63, 0x59, 0x6b, 0x18, 0x3a, 0x0a, 0x40, 0x07, 0x49,
-  0x8c, 0x46, 0x63, 0x44, 0x1a, 0x60, 0xd7, 0xe7, 0xf4, 0x20, 0x00, 0x20,
-  0x00, 0x80, 0xfc, 0xbf, 0x40, 0x1c, 0x00, 0x20, 0x39, 0x44, 0x00, 0x10,
-  0x48, 0x1c, 0x00, 0x20, 0x34, 0x10, 0x00, 0x00, 0x0d, 0x4b, 0x10, 0xb5,
-  0x1b, 0x78, 0x0d, 0x4b, 0x0d, 0x4c, 0x1b, 0x78, 0x0d, 0x4b, 0x02, 0x21,
-  0x1b, 0x78, 0x0d, 0x4b, 0x00, 0x20, 0x23, 0x60, 0xfb, 0xf7, 0x36, 0xff,
-  0x02, 0x21, 0x01, 0x20, 0xfb, 0xf7, 0x32, 0xff, 0xe1, 0x21, 0x20, 0x68,
-  0x49, 0x02, 0xfc, 0xf7, 0xab, 0xff, 0x01, 0x21, 0x06, 0x48, 0xff, 0xf7,
-  0x11, 0xfe, 0x10, 0xbd, 0xb0, 0x74, 0x00, 0x10, 0xac, 0x74, 0x00, 0x10,
-  0xf4, 0x20, 0x00, 0x20, 0xa8, 0x74, 0x00, 0x10, 0x00, 0x40, 0x03, 0x40,
-  0x30, 0x10, 0x00, 0x20, 0x70, 0x47, 0xc0, 0x46, 0x00, 0x22, 0x01, 0x4b,
-  0x1a, 0x70, 0x70, 0x47, 0x0e, 0x21, 0x00, 0x20, 0x4b, 0x79, 0x00, 0x20,
-  0xff, 0x2b, 0x0b, 0xd1, 0x8b, 0x79, 0x00, 0x2b, 0x08, 0xd1, 0xcb, 0x79,
-  0x01, 0x2b, 0x05, 0xd1, 0x08, 0x2a, 0x03, 0xd9, 0x02, 0x4b, 0x8a, 0x78,
-  0x09, 0x30, 0x1a, 0x70, 0x70, 0x47, 0xc0, 0x46, 0x0e, 0x21, 0x00, 0x20,
-  0x01, 0x20, 0x70, 0x47, 0x10, 0xb5, 0x01, 0x29, 0x01, 0xd0, 0x01, 0x20,
-  0x10, 0xbd, 0x13, 0x49, 0x53, 0x79, 0x10, 0x79, 0x09, 0x78, 0x1b, 0x02,
-  0x03, 0x43, 0x00, 0x20, 0x99, 0x42, 0xf5, 0xd1, 0x53, 0x78, 0x01, 0x2b,
-  0x08, 0xd0, 0x02, 0x2b, 0xf0, 0xd1, 0x00, 0x20, 0x64, 0x22, 0x00, 0x21,
-  0xfd, 0xf7, 0x36, 0xf9, 0x01, 0x20, 0xe9, 0xe7, 0xd3, 0x78, 0x91, 0x78,
-  0x1b, 0x02, 0x19, 0x43, 0xdb, 0x05, 0x07, 0xd5, 0x4a, 0x0a, 0x10, 0x00,
-  0x01, 0x23, 0x1a, 0x40, 0x7e, 0x33, 0x19, 0x40, 0xfd, 0xf7, 0xae, 0xf9,
-  0x01, 0x20, 0x4a, 0x0a, 0x40, 0x42, 0xf5, 0xe7, 0x0e, 0x21, 0x00, 0x20,
-  0x00, 0x48, 0x70, 0x47, 0x5c, 0x72, 0x00, 0x10, 0x70, 0xb5, 0x05, 0x00,
-  0x14, 0x00, 0x01, 0x20, 0x01, 0x29, 0x09, 0xd1, 0x53, 0x78, 0x00, 0x20,
-  0x01, 0x2b, 0x05, 0xd1, 0x63, 0x79, 0x12, 0x79, 0x1b, 0x02, 0x13, 0x43,
-  0x07, 0x2b, 0x00, 0xd0, 0x70, 0xbd, 0x21, 0x00, 0x28, 0x00, 0x02, 0x4a,
-  0x9f, 0x33, 0x01, 0xf0, 0x51, 0xfa, 0xf7, 0xe7, 0xb4, 0x71, 0x00, 0x10,
-  0x01, 0x23, 0x03, 0x70, 0x00, 0x48, 0x70, 0x47, 0x94, 0x71, 0x00, 0x10,
-  0x4b, 0x78, 0x0a, 0x78, 0x1b, 0x02, 0x13, 0x43, 0x8a, 0x78, 0x10, 0xb5,
-  0x12, 0x04, 0x1a, 0x43, 0xcb, 0x78, 0x1b, 0x06, 0x13, 0x43, 0x96, 0x22,
-  0xd2, 0x00, 0x93, 0x42, 0x00, 0xd0, 0x10, 0xbd, 0x00, 0x22, 0x01, 0x20,
-  0x11, 0x00, 0x40, 0x42, 0xfd, 0xf7, 0x6e, 0xf9, 0x02, 0x4b, 0x18, 0x60,
-  0x02, 0x4b, 0x19, 0x60, 0x70, 0x47, 0xc0, 0x46, 0x44, 0x1c, 0x00, 0x20,
-  0x4c, 0x1c, 0x00, 0x20, 0x10, 0xb5, 0x02, 0x4b, 0x18, 0x78, 0xfb, 0xf7,
-  0xab, 0xff, 0x10, 0xbd, 0x0f, 0x21, 0x00, 0x20, 0x15, 0x4b, 0x70, 0xb5,
-  0x1a, 0x68, 0x00, 0x2a, 0x22, 0xd0, 0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6,
-  0x10, 0x68, 0x00, 0x28, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x20,
-  0x0f, 0x4a, 0x59, 0x60, 0x10, 0x70, 0x1b, 0x68, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x18, 0x60, 0x81, 0xf3, 0x10, 0x88, 0x00, 0x24, 0x00, 0x25, 0x0b, 0x4e,
-  0x30, 0x78, 0xfb, 0xf7, 0x7f, 0xff, 0x00, 0x28, 0x04, 0xd1, 0x00, 0x24,
-  0x00, 0x25, 0x29, 0x00, 0x20, 0x00, 0x70, 0xbd, 0x30, 0x78, 0xfb, 0xf7,
-  0x81, 0xff, 0xf8, 0xe7, 0xfa, 0x24, 0x00, 0x25, 0xa4, 0x00, 0xec, 0xe7,
-  0xc0, 0x20, 0x00, 0x20, 0x10, 0x21, 0x00, 0x20, 0x0f, 0x21, 0x00, 0x20,
-  0x70, 0xb5, 0x04, 0x00, 0x00, 0x20, 0x0e, 0x00, 0x01, 0xf0, 0x00, 0xfb,
-  0x00, 0x28, 0x36, 0xd0, 0x00, 0x20, 0x01, 0xf0, 0x13, 0xfb, 0x00, 0x28,
-  0x31, 0xd0, 0xfc, 0xf7, 0x73, 0xfe, 0x00, 0x23, 0x18, 0x4a, 0x12, 0x18,
-  0x4b, 0x41, 0x80, 0x21, 0x09, 0x06, 0x8b, 0x42, 0x16, 0xd2, 0x16, 0x4d,
-  0x28, 0x00, 0x02, 0xf0, 0x49, 0xfb, 0x00, 0x28, 0x21, 0xd0, 0x00, 0x20,
-  0x01, 0xf0, 0xe6, 0xfa, 0x00, 0x28, 0x0f, 0xd1, 0x01, 0x20, 0x00, 0x21,
-  0x40, 0x42, 0x00, 0xf0, 0xf7, 0xfc, 0x03, 0x24, 0x64, 0x42, 0x28, 0x00,
-  0x02, 0xf0, 0x00, 0xfb, 0x20, 0x00, 0x70, 0xbd, 0x01, 0x22, 0x0b, 0x4b,
-  0x52, 0x42, 0xe4, 0xe7, 0x00, 0x20, 0x01, 0xf0, 0xe9, 0xfa, 0x00, 0x28,
-  0xea, 0xd0, 0x21, 0x00, 0x32, 0x00, 0x00, 0x20, 0x01, 0xf0, 0xee, 0xfa,
-  0x04, 0x1e, 0xea, 0xd1, 0xe7, 0xe7, 0x03, 0x24, 0x64, 0x42, 0xe9, 0xe7,
-  0x40, 0x42, 0x0f, 0x00, 0xe8, 0x20, 0x00, 0x20, 0xff, 0xff, 0xff, 0x7f,
-  0x10, 0xb5, 0xfc, 0xf7, 0x37, 0xfe, 0x00, 0x23, 0x0e, 0x4a, 0x12, 0x18,
-  0x4b, 0x41, 0x80, 0x21, 0x09, 0x06, 0x8b, 0x42, 0x02, 0xd3, 0x01, 0x22,
-  0x0b, 0x4b, 0x52, 0x42, 0x0b, 0x4c, 0x20, 0x00, 0x02, 0xf0, 0x0a, 0xfb,
-  0x00, 0x28, 0x0c, 0xd0, 0x01, 0x20, 0x00, 0x21, 0x40, 0x42, 0x00, 0xf0,
-  0xbd, 0xfc, 0x00, 0x20, 0x01, 0xf0, 0x12, 0xfb, 0x00, 0x28, 0xf5, 0xd1,
-  0x20, 0x00, 0x02, 0xf0, 0xc3, 0xfa, 0x10, 0xbd, 0x40, 0x42, 0x0f, 0x00,
-  0xff, 0xff, 0xff, 0x7f, 0xe8, 0x20, 0x00, 0x20, 0xf8, 0xb5, 0xde, 0x46,
-  0x57, 0x46, 0x80, 0xb5, 0x05, 0x00, 0x0c, 0x00, 0xfc, 0xf7, 0x0a, 0xfe,
-  0x00, 0x23, 0x37, 0x4a, 0x12, 0x18, 0x4b, 0x41, 0x80, 0x21, 0x09, 0x06,
-  0x8b, 0x42, 0x02, 0xd3, 0x01, 0x22, 0x34, 0x4b, 0x52, 0x42, 0x34, 0x49,
-  0x08, 0x00, 0x8a, 0x46, 0x02, 0xf0, 0xdc, 0xfa, 0x00, 0x28, 0x03, 0xd1,
-  0xc0, 0xbc, 0xbb, 0x46, 0xb2, 0x46, 0xf8, 0xbd, 0x00, 0x20, 0x01, 0xf0,
-  0x75, 0xfa, 0x00, 0x28, 0x4a, 0xd0, 0x00, 0x26, 0x00, 0x2c, 0x43, 0xdd,
-  0x2b, 0x4b, 0x9b, 0x46, 0x14, 0xe0, 0xa9, 0x19, 0x00, 0x20, 0x01, 0xf0,
-  0x15, 0xfb, 0x07, 0x00, 0x01, 0x20, 0x00, 0x21, 0x40, 0x42, 0x00, 0xf0,
-  0x7b, 0xfc, 0x00, 0x20, 0x01, 0xf0, 0xd0, 0xfa, 0xfc, 0xf7, 0xda, 0xfd,
-  0x22, 0x4b, 0xf6, 0x19, 0x18, 0x60, 0x59, 0x60, 0xb4, 0x42, 0x2b, 0xdd,
-  0x00, 0x20, 0x01, 0xf0, 0x21, 0xfb, 0xa7, 0x1b, 0x02, 0x00, 0xb8, 0x42,
-  0x00, 0xdd, 0x3a, 0x00, 0x00, 0x2a, 0xe0, 0xd1, 0x01, 0x20, 0x00, 0x21,
-  0x40, 0x42, 0x00, 0xf0, 0x61, 0xfc, 0x00, 0x20, 0x01, 0xf0, 0xb6, 0xfa,
-  0x00, 0x20, 0x01, 0xf0, 0x43, 0xfa, 0x00, 0x28, 0x14, 0xd0, 0x00, 0x20,
-  0x01, 0xf0, 0x0a, 0xfb, 0x00, 0x28, 0xe1, 0xd1, 0xfc, 0xf7, 0xb6, 0xfd,
-  0x5b, 0x46, 0x0f, 0x00, 0x1a, 0x68, 0x5b, 0x68, 0x00, 0x21, 0x84, 0x46,
-  0x0e, 0x48, 0x12, 0x18, 0x4b, 0x41, 0x9f, 0x42, 0x02, 0xd8, 0xd3, 0xd1,
-  0x94, 0x45, 0xd1, 0xd9, 0x50, 0x46, 0x02, 0xf0, 0x4f, 0xfa, 0xab, 0xe7,
-  0x00, 0x20, 0x00, 0x21, 0x06, 0x4b, 0x18, 0x60, 0x59, 0x60, 0x50, 0x46,
-  0x02, 0xf0, 0x46, 0xfa, 0xa2, 0xe7, 0xc0, 0x46, 0x40, 0x42, 0x0f, 0x00,
-  0xff, 0xff, 0xff, 0x7f, 0xe8, 0x20, 0x00, 0x20, 0x08, 0x12, 0x00, 0x20,
-  0x20, 0xa1, 0x07, 0x00, 0x30, 0xb5, 0x2b, 0x4c, 0x85, 0xb0, 0x00, 0x21,
-  0x20, 0x00, 0x02, 0xf0, 0x5b, 0xfa, 0x00, 0x28, 0x1c, 0xd1, 0x28, 0x4b,
-  0x1a, 0x68, 0x00, 0x2a, 0x16, 0xd0, 0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6,
-  0x10, 0x68, 0x00, 0x28, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x01, 0x24,
-  0x22, 0x48, 0x59, 0x60, 0x02, 0x78, 0x1b, 0x68, 0xd2, 0xb2, 0x04, 0x70,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x20, 0x18, 0x60, 0x81, 0xf3, 0x10, 0x88,
-  0x00, 0x2a, 0x17, 0xd0, 0x05, 0xb0, 0x30, 0xbd, 0x01, 0x20, 0x00, 0x21,
-  0x40, 0x42, 0x00, 0xf0, 0x01, 0xfc, 0x00, 0x20, 0x01, 0xf0, 0xfe, 0xf9,
-  0x05, 0x00, 0x20, 0x00, 0x02, 0xf0, 0x08, 0xfa, 0x00, 0x2d, 0xef, 0xd0,
-  0x14, 0x4b, 0x1b, 0x68, 0x00, 0x2b, 0xeb, 0xd0, 0x13, 0x4a, 0x10, 0x68,
-  0x98, 0x47, 0xe7, 0xe7, 0xfc, 0xf7, 0x46, 0xfb, 0x04, 0x00, 0xfc, 0xf7,
-  0x4f, 0xfd, 0xfa, 0x22, 0x00, 0x23, 0x92, 0x00, 0x12, 0x18, 0x4b, 0x41,
-  0x80, 0x21, 0x09, 0x06, 0x8b, 0x42, 0x02, 0xd3, 0x01, 0x22, 0x0b, 0x4b,
-  0x52, 0x42, 0x01, 0x21, 0x02, 0x91, 0x00, 0x21, 0x01, 0x91, 0x09, 0x49,
-  0x20, 0x00, 0x00, 0x91, 0xfc, 0xf7, 0x32, 0xfb, 0xcc, 0xe7, 0xc0, 0x46,
-  0xe8, 0x20, 0x00, 0x20, 0xc0, 0x20, 0x00, 0x20, 0x10, 0x21, 0x00, 0x20,
-  0x44, 0x1c, 0x00, 0x20, 0x4c, 0x1c, 0x00, 0x20, 0xff, 0xff, 0xff, 0x7f,
-  0x7d, 0x46, 0x00, 0x10, 0xd0, 0x23, 0x10, 0xb5, 0x1b, 0x06, 0x84, 0xb0,
-  0x1c, 0x68, 0xfc, 0xf7, 0x17, 0xfb, 0xfc, 0xf7, 0x15, 0xfc, 0xa0, 0x42,
-  0x02, 0xd0, 0x00, 0x20, 0x04, 0xb0, 0x10, 0xbd, 0x29, 0x4b, 0x1b, 0x78,
-  0x01, 0xf0, 0x70, 0xfd, 0x28, 0x48, 0x03, 0x68, 0x00, 0x2b, 0x47, 0xd0,
-  0x01, 0x20, 0xfc, 0xf7, 0x8b, 0xf8, 0xff, 0x23, 0x25, 0x4c, 0x26, 0x49,
-  0x20, 0x70, 0x18, 0x40, 0xfb, 0xf7, 0x1c, 0xfe, 0x20, 0x78, 0x01, 0x21,
-  0xfb, 0xf7, 0xdc, 0xfd, 0x05, 0x20, 0xfb, 0xf7, 0xff, 0xfd, 0x00, 0x28,
-  0x26, 0xd1, 0x08, 0x22, 0x00, 0x21, 0x1f, 0x48, 0xfd, 0xf7, 0x5a, 0xff,
-  0xfc, 0xf7, 0xee, 0xfa, 0x04, 0x00, 0xfc, 0xf7, 0xf7, 0xfc, 0xfa, 0x22,
-  0x00, 0x23, 0x92, 0x00, 0x12, 0x18, 0x4b, 0x41, 0x80, 0x21, 0x09, 0x06,
-  0x8b, 0x42, 0x02, 0xd3, 0x01, 0x22, 0x17, 0x4b, 0x52, 0x42, 0x01, 0x21,
-  0x02, 0x91, 0x00, 0x21, 0x01, 0x91, 0x15, 0x49, 0x20, 0x00, 0x00, 0x91,
-  0xfc, 0xf7, 0xda, 0xfa, 0x00, 0x28, 0xc0, 0xdb, 0x12, 0x48, 0x01, 0x21,
-  0xff, 0xf7, 0x94, 0xfb, 0x01, 0x20, 0xbb, 0xe7, 0x01, 0x20, 0xfb, 0xf7,
-  0x7b, 0xfd, 0x0b, 0x4b, 0x01, 0x00, 0x18, 0x00, 0xfc, 0xf7, 0xb2, 0xf8,
-  0x00, 0x22, 0x05, 0x20, 0x0b, 0x49, 0xfb, 0xf7, 0x09, 0xfe, 0xeb, 0xe7,
-  0xfc, 0xf7, 0x8e, 0xf8, 0xb4, 0xe7, 0xc0, 0x46, 0xb4, 0x74, 0x00, 0x10,
-  0xe8, 0x20, 0x00, 0x20, 0x0f, 0x21, 0x00, 0x20, 0xc5, 0x48, 0x00, 0x10,
-  0xc0, 0x20, 0x00, 0x20, 0xff, 0xff, 0xff, 0x7f, 0x7d, 0x46, 0x00, 0x10,
-  0x48, 0x10, 0x00, 0x20, 0x6d, 0x46, 0x00, 0x10, 0x00, 0x48, 0x70, 0x47,
-  0x38, 0x73, 0x00, 0x10, 0x00, 0x48, 0x70, 0x47, 0xe4, 0x72, 0x00, 0x10,
-  0x10, 0xb5, 0x04, 0x00, 0x17, 0x48, 0x03, 0x78, 0x00, 0x2b, 0x20, 0xd0,
-  0x00, 0x2c, 0x06, 0xd1, 0x15, 0x4b, 0x16, 0x48, 0x43, 0x80, 0x06, 0x3b,
-  0xff, 0x3b, 0x03, 0x80, 0x10, 0xbd, 0x05, 0x2c, 0x19, 0xd8, 0x13, 0x4b,
-  0xa4, 0x00, 0xe0, 0x58, 0x12, 0x49, 0x00, 0x23, 0x04, 0xe0, 0x01, 0x33,
-  0x0a, 0x80, 0x02, 0x31, 0x13, 0x2b, 0x10, 0xd0, 0xc2, 0x5c, 0x00, 0x2a,
-  0xf7, 0xd1, 0xc0, 0x22, 0x01, 0x33, 0xdb, 0xb2, 0x5b, 0x00, 0x92, 0x00,
-  0x08, 0x48, 0x13, 0x43, 0xe5, 0xe7, 0x11, 0x21, 0x00, 0xf0, 0x1a, 0xf8,
-  0xda, 0xe7, 0x00, 0x20, 0xe0, 0xe7, 0xca, 0x23, 0x03, 0x48, 0x9b, 0x00,
-  0xdb, 0xe7, 0xc0, 0x46, 0xf8, 0x20, 0x00, 0x20, 0x09, 0x04, 0x00, 0x00,
-  0x80, 0x1c, 0x00, 0x20, 0xcc, 0x72, 0x00, 0x10, 0x82, 0x1c, 0x00, 0x20,
-  0x10, 0xb5, 0x02, 0x48, 0x00, 0xf0, 0xd8, 0xf8, 0x10, 0xbd, 0xc0, 0x46,
-  0xd8, 0x20, 0x00, 0x20, 0x30, 0xb5, 0x4b, 0x1e, 0x01, 0x29, 0x00, 0xd1,
-  0xa7, 0xe0, 0x66, 0x4a, 0x11, 0x78, 0x0d, 0x11, 0x2c, 0x00, 0x30, 0x34,
-  0x9f, 0x29, 0x00, 0xd9, 0xa2, 0xe0, 0x04, 0x70, 0x01, 0x2b, 0x00, 0xd1,
-  0xbe, 0xe0, 0x0f, 0x21, 0x14, 0x78, 0x21, 0x40, 0x0c, 0x00, 0x30, 0x34,
-  0x09, 0x29, 0x00, 0xd9, 0x98, 0xe0, 0x44, 0x70, 0x02, 0x2b, 0x00, 0xd1,
-  0xb2, 0xe0, 0x54, 0x78, 0x25, 0x11, 0x29, 0x00, 0x30, 0x31, 0x9f, 0x2c,
-  0x00, 0xd9, 0x90, 0xe0, 0x81, 0x70, 0x03, 0x2b, 0x00, 0xd1, 0xa7, 0xe0,
-  0x0f, 0x21, 0x21, 0x40, 0x0c, 0x00, 0x30, 0x34, 0x09, 0x29, 0x00, 0xd9,
-  0x87, 0xe0, 0xc4, 0x70, 0x04, 0x2b, 0x00, 0xd1, 0x9c, 0xe0, 0x94, 0x78,
-  0x25, 0x11, 0x29, 0x00, 0x30, 0x31, 0x9f, 0x2c, 0x00, 0xd9, 0x7f, 0xe0,
-  0x01, 0x71, 0x05, 0x2b, 0x00, 0xd1, 0x91, 0xe0, 0x0f, 0x21, 0x21, 0x40,
-  0x0c, 0x00, 0x30, 0x34, 0x09, 0x29, 0x00, 0xd9, 0x76, 0xe0, 0x44, 0x71,
-  0x06, 0x2b, 0x00, 0xd1, 0x86, 0xe0, 0xd4, 0x78, 0x25, 0x11, 0x29, 0x00,
-  0x30, 0x31, 0x9f, 0x2c, 0x00, 0xd9, 0x6e, 0xe0, 0x81, 0x71, 0x07, 0x2b,
-  0x00, 0xd1, 0x7b, 0xe0, 0x0f, 0x21, 0x21, 0x40, 0x0c, 0x00, 0x30, 0x34,
-  0x09, 0x29, 0x66, 0xd8, 0xc4, 0x71, 0x08, 0x2b, 0x00, 0xd1, 0x71, 0xe0,
-  0x14, 0x79, 0x25, 0x11, 0x29, 0x00, 0x30, 0x31, 0x9f, 0x2c, 0x5f, 0xd8,
-  0x01, 0x72, 0x09, 0x2b, 0x68, 0xd0, 0x0f, 0x21, 0x21, 0x40, 0x0c, 0x00,
-  0x30, 0x34, 0x09, 0x29, 0x58, 0xd8, 0x44, 0x72, 0x0a, 0x2b, 0x5f, 0xd0,
-  0x54, 0x79, 0x25, 0x11, 0x29, 0x00, 0x30, 0x31, 0x9f, 0x2c, 0x52, 0xd8,
-  0x81, 0x72, 0x0b, 0x2b, 0x56, 0xd0, 0x0f, 0x21, 0x21, 0x40, 0x0c, 0x00,
-  0x30, 0x34, 0x09, 0x29, 0x4b, 0xd8, 0xc4, 0x72, 0x0c, 0x2b, 0x4d, 0xd0,
-  0x94, 0x79, 0x25, 0x11, 0x29, 0x00, 0x30, 0x31, 0x9f, 0x2c, 0x00, 0xd9,
-  0x07, 0x31, 0x01, 0x73, 0x0d, 0x2b, 0x43, 0xd0, 0x0f, 0x21, 0x21, 0x40,
-  0x0c, 0x00, 0x30, 0x34, 0x09, 0x29, 0x01, 0xd9, 0x37, 0x31, 0x0c, 0x00,
-  0x44, 0x73, 0x0e, 0x2b, 0x38, 0xd0, 0xd1, 0x79, 0x0c, 0x11, 0x22, 0x00,
-  0x30, 0x32, 0x9f, 0x29, 0x00, 0xd9, 0x07, 0x32, 0x82, 0x73, 0x0f, 0x2b,
-  0x2e, 0xd0, 0x0f, 0x22, 0x0a, 0x40, 0x11, 0x00, 0x37, 0x31, 0x09, 0x2a,
-  0x01, 0xd8, 0x30, 0x32, 0x11, 0x00, 0xc1, 0x73, 0x10, 0x2b, 0x23, 0xd0,
-  0x10, 0x30, 0x00, 0x23, 0x03, 0x70, 0x30, 0xbd, 0x07, 0x34, 0x5a, 0xe7,
-  0x37, 0x31, 0x0c, 0x00, 0x63, 0xe7, 0x07, 0x31, 0x6c, 0xe7, 0x37, 0x31,
-  0x0c, 0x00, 0x74, 0xe7, 0x07, 0x31, 0x7d, 0xe7, 0x37, 0x31, 0x0c, 0x00,
-  0x85, 0xe7, 0x07, 0x31, 0x8e, 0xe7, 0x37, 0x31, 0x0c, 0x00, 0x95, 0xe7,
-  0x07, 0x31, 0x9d, 0xe7, 0x37, 0x31, 0x0c, 0x00, 0xa3, 0xe7, 0x07, 0x31,
-  0xaa, 0xe7, 0x37, 0x31, 0x0c, 0x00, 0xc4, 0x72, 0x0c, 0x2b, 0xb1, 0xd1,
-  0xc0, 0x18, 0xda, 0xe7, 0xd8, 0x20, 0x00, 0x20, 0x30, 0xb5, 0x00, 0x25,
-  0x89, 0xb0, 0x04, 0x00, 0x09, 0x22, 0x00, 0x21, 0x01, 0xa8, 0x00, 0x95,
-  0xfd, 0xf7, 0xea, 0xfd, 0x09, 0x22, 0x00, 0x21, 0x05, 0xa8, 0x04, 0x95,
-  0xfd, 0xf7, 0xe4, 0xfd, 0x4b, 0x23, 0x6a, 0x46, 0x68, 0x46, 0x13, 0x70,
-  0x04, 0xa9, 0x0d, 0x22, 0x02, 0xf0, 0x20, 0xf8, 0x15, 0x21, 0x08, 0x22,
-  0x20, 0x00, 0x69, 0x44, 0xfd, 0xf7, 0xdc, 0xfd, 0x09, 0xb0, 0x30, 0xbd,
-  0xf8, 0xb5, 0x00, 0xf0, 0x3d, 0xf9, 0x0c, 0x23, 0x18, 0x4d, 0xff, 0x22,
-  0xab, 0x67, 0x05, 0x20, 0x17, 0x49, 0xfb, 0xf7, 0xa7, 0xfc, 0x17, 0x4c,
-  0x40, 0x22, 0x00, 0x21, 0x20, 0x00, 0xfd, 0xf7, 0xc3, 0xfd, 0x40, 0x27,
-  0x00, 0x23, 0x01, 0x26, 0x21, 0x21, 0x13, 0x4a, 0x66, 0x70, 0x27, 0x83,
-  0xa2, 0x60, 0x13, 0x60, 0x63, 0x54, 0x5f, 0x31, 0x61, 0x84, 0x45, 0x39,
-  0x63, 0x54, 0x0f, 0x4a, 0x0f, 0x49, 0x63, 0x60, 0xe2, 0x60, 0x27, 0x87,
-  0xa1, 0x62, 0x0b, 0x60, 0x63, 0x62, 0xe2, 0x62, 0x02, 0xf0, 0x06, 0xf8,
-  0x80, 0x23, 0x9b, 0x05, 0x2e, 0x64, 0xeb, 0x64, 0x90, 0x23, 0x09, 0x4a,
-  0xea, 0x50, 0x80, 0x22, 0x08, 0x4b, 0x52, 0x02, 0xda, 0x64, 0xf8, 0xbd,
-  0x00, 0x00, 0x11, 0x50, 0x9d, 0x04, 0x00, 0x20, 0xb4, 0x1c, 0x00, 0x20,
-  0x84, 0x00, 0x10, 0x50, 0x00, 0x01, 0x10, 0x50, 0x80, 0x00, 0x10, 0x50,
-  0x10, 0xd0, 0x01, 0x00, 0x00, 0x20, 0x11, 0x50, 0x10, 0xb5, 0x01, 0x21,
-  0x05, 0x20, 0xfb, 0xf7, 0x01, 0xfc, 0x10, 0xbd, 0x10, 0xb5, 0x00, 0x22,
-  0x00, 0x21, 0x02, 0x48, 0x00, 0xf0, 0x0e, 0xf9, 0x10, 0xbd, 0xc0, 0x46,
-  0xd4, 0x1c, 0x00, 0x20, 0x04, 0x4b, 0x19, 0x70, 0x00, 0x29, 0x04, 0xd0,
-  0x80, 0x21, 0x90, 0x23, 0x02, 0x4a, 0x89, 0x02, 0xd1, 0x50, 0x70, 0x47,
-  0x0a, 0x21, 0x00, 0x20, 0x00, 0x20, 0x11, 0x50, 0x0b, 0x78, 0x5b, 0x06,
-  0x02, 0xd1, 0x4b, 0x78, 0x05, 0x2b, 0x00, 0xd0, 0x70, 0x47, 0x8a, 0x78,
-  0x01, 0x4b, 0x1a, 0x60, 0xfa, 0xe7, 0xc0, 0x46, 0x00, 0x00, 0x11, 0x50,
-  0xf0, 0xb5, 0xc6, 0x46, 0x00, 0xb5, 0xcc, 0x78, 0x88, 0x78, 0x0a, 0x79,
-  0x4b, 0x79, 0x7f, 0x21, 0xa4, 0x07, 0x01, 0x40, 0x1b, 0x02, 0xc5, 0x09,
-  0x13, 0x43, 0x4f, 0x00, 0xa2, 0x0f, 0x14, 0x00, 0x32, 0x4e, 0x7a, 0x19,
-  0x52, 0x01, 0xb2, 0x18, 0x90, 0x70, 0x01, 0x20, 0x68, 0x40, 0x50, 0x70,
-  0x00, 0x20, 0x5b, 0x05, 0x5b, 0x0d, 0xd0, 0x70, 0x13, 0x83, 0xd4, 0x76,
-  0x80, 0x46, 0xca, 0x00, 0x01, 0x2d, 0x33, 0xd0, 0x2a, 0x48, 0x84, 0x46,
-  0x88, 0x01, 0x62, 0x44, 0x84, 0x46, 0xb4, 0x44, 0x60, 0x46, 0x82, 0x60,
-  0x40, 0x46, 0x10, 0x60, 0x00, 0x29, 0x33, 0xd0, 0x25, 0x4a, 0xc9, 0x00,
-  0x90, 0x46, 0x62, 0x46, 0x41, 0x44, 0x51, 0x60, 0x3f, 0x22, 0x3f, 0x33,
-  0x93, 0x43, 0x02, 0x2c, 0x00, 0xd1, 0x5b, 0x00, 0x20, 0x48, 0x7a, 0x19,
-  0x01, 0x68, 0x52, 0x01, 0xb2, 0x18, 0xd1, 0x60, 0x1e, 0x4a, 0xcb, 0x18,
-  0x03, 0x60, 0x51, 0x40, 0x5a, 0x40, 0x80, 0x23, 0x88, 0x46, 0x5b, 0x01,
-  0x9a, 0x42, 0x28, 0xd8, 0x43, 0x46, 0xa4, 0x06, 0x1c, 0x43, 0x80, 0x23,
-  0x7f, 0x19, 0x7f, 0x01, 0xf6, 0x19, 0x72, 0x68, 0x1b, 0x06, 0x23, 0x43,
-  0x13, 0x60, 0x11, 0xe0, 0x14, 0x48, 0x84, 0x46, 0x88, 0x01, 0x62, 0x44,
-  0x84, 0x46, 0xb4, 0x44, 0x60, 0x46, 0x82, 0x62, 0x40, 0x46, 0x10, 0x60,
-  0x00, 0x29, 0x09, 0xd1, 0x00, 0x23, 0x6d, 0x01, 0x75, 0x19, 0x6b, 0x60,
-  0x0d, 0x4b, 0xeb, 0x60, 0x01, 0x20, 0x80, 0xbc, 0xb8, 0x46, 0xf0, 0xbd,
-  0x08, 0x4a, 0xc9, 0x00, 0x90, 0x46, 0x62, 0x46, 0x41, 0x44, 0x51, 0x62,
-  0xc0, 0xe7, 0xfc, 0xf7, 0x61, 0xfd, 0xd3, 0xe7, 0xb4, 0x1c, 0x00, 0x20,
-  0x84, 0x00, 0x10, 0x50, 0x04, 0x00, 0x10, 0x50, 0xbc, 0x20, 0x00, 0x20,
-  0x00, 0x00, 0x10, 0x50, 0x80, 0x00, 0x10, 0x50, 0x00, 0x01, 0x10, 0x50,
-  0x10, 0xb5, 0x01, 0xf0, 0x37, 0xff, 0x10, 0xbd, 0x10, 0xb5, 0x7f, 0x20,
-  0x0c, 0x00, 0x20, 0x40, 0x40, 0x00, 0xe4, 0x09, 0x11, 0x00, 0x00, 0x19,
-  0x1a, 0x00, 0x03, 0x4b, 0x40, 0x01, 0xc0, 0x18, 0x00, 0xf0, 0x58, 0xf8,
-  0x01, 0x20, 0x10, 0xbd, 0xb4, 0x1c, 0x00, 0x20, 0x7f, 0x23, 0x18, 0x00,
-  0x10, 0xb5, 0x08, 0x40, 0x0b, 0x42, 0x0b, 0xd0, 0xc9, 0x09, 0x80, 0x22,
-  0x40, 0x00, 0x07, 0x4b, 0x40, 0x18, 0x40, 0x01, 0x00, 0x21, 0xc0, 0x18,
-  0x12, 0x01, 0x01, 0xf0, 0x53, 0xff, 0x10, 0xbd, 0x02, 0x23, 0x03, 0x4a,
-  0xc9, 0x09, 0x5b, 0x1a, 0x93, 0x66, 0xee, 0xe7, 0xb4, 0x1c, 0x00, 0x20,
-  0x00, 0x20, 0x11, 0x50, 0x7f, 0x22, 0x13, 0x00, 0x10, 0xb5, 0x0b, 0x40,
-  0x0a, 0x42, 0x00, 0xd1, 0x10, 0xbd, 0xc9, 0x09, 0x5b, 0x00, 0x5b, 0x18,
-  0x04, 0x48, 0x5b, 0x01, 0xc0, 0x18, 0x00, 0x23, 0x00, 0x22, 0x03, 0x49,
-  0xc3, 0x70, 0x01, 0xf0, 0x35, 0xff, 0xf1, 0xe7, 0xb4, 0x1c, 0x00, 0x20,
-  0xff, 0xf7, 0xff, 0xff, 0x80, 0x22, 0x0a, 0x4b, 0x52, 0x04, 0x10, 0xb5,
-  0x1a, 0x60, 0x09, 0x4b, 0x09, 0x49, 0x1a, 0x60, 0x10, 0x00, 0x0b, 0x68,
-  0x98, 0x43, 0xfb, 0xd1, 0x80, 0x22, 0x00, 0x21, 0x52, 0x01, 0x06, 0x48,
-  0xfd, 0xf7, 0x82, 0xfc, 0x09, 0x22, 0x05, 0x4b, 0x5a, 0x67, 0x10, 0xbd,
-  0x00, 0xe0, 0x00, 0x40, 0x00, 0xf0, 0x00, 0x40, 0x08, 0xc0, 0x00, 0x40,
-  0x00, 0x00, 0x10, 0x50, 0x00, 0x00, 0x11, 0x50, 0x00, 0x23, 0x10, 0xb5,
-  0xc3, 0x82, 0x01, 0x33, 0x82, 0x82, 0x83, 0x76, 0x01, 0x61, 0x04, 0x00,
-  0x01, 0xf0, 0xd6, 0xfe, 0x00, 0x28, 0x04, 0xd0, 0x80, 0x21, 0x90, 0x23,
-  0x07, 0x4a, 0x89, 0x02, 0xd1, 0x50, 0x20, 0x00, 0x01, 0xf0, 0xf4, 0xfe,
-  0x00, 0x28, 0x02, 0xd0, 0x01, 0x23, 0x23, 0x77, 0x10, 0xbd, 0x20, 0x00,
-  0x01, 0xf0, 0xe4, 0xfe, 0xfa, 0xe7, 0xc0, 0x46, 0x00, 0x20, 0x11, 0x50,
-  0x70, 0x47, 0xc0, 0x46, 0x70, 0x47, 0xc0, 0x46, 0x00, 0x20, 0x70, 0x47,
-  0x00, 0x20, 0x70, 0x47, 0x70, 0x47, 0xc0, 0x46, 0x70, 0x47, 0xc0, 0x46,
-  0x70, 0x47, 0xc0, 0x46, 0x70, 0x47, 0xc0, 0x46, 0x02, 0x4b, 0x58, 0x78,
-  0x43, 0x1e, 0x98, 0x41, 0xc0, 0xb2, 0x70, 0x47, 0x58, 0x17, 0x00, 0x20,
-  0x02, 0x4b, 0x18, 0x78, 0x40, 0x07, 0xc0, 0x0f, 0x70, 0x47, 0xc0, 0x46,
-  0x58, 0x17, 0x00, 0x20, 0xf8, 0xb5, 0x47, 0x46, 0xce, 0x46, 0x80, 0xb5,
-  0x2b, 0x4f, 0x06, 0x00, 0x3b, 0x78, 0xff, 0x2b, 0x04, 0xd0, 0x01, 0x20,
-  0xc0, 0xbc, 0xb9, 0x46, 0xb0, 0x46, 0xf8, 0xbd, 0x00, 0x21, 0x54, 0x22,
-  0x26, 0x48, 0xfd, 0xf7, 0x21, 0xfc, 0x00, 0x22, 0x25, 0x4c, 0x26, 0x4b,
-  0x20, 0x00, 0x1a, 0x70, 0xfb, 0xf7, 0x80, 0xfd, 0x24, 0x4b, 0x1c, 0x60,
-  0x24, 0x4c, 0x20, 0x00, 0x14, 0x3c, 0xfb, 0xf7, 0x87, 0xfd, 0x20, 0x00,
-  0x01, 0xf0, 0xe0, 0xfd, 0x21, 0x4b, 0x22, 0x4d, 0x1c, 0x60, 0x22, 0x4b,
-  0x00, 0x2b, 0x27, 0xd0, 0x28, 0x00, 0xff, 0xf7, 0xc7, 0xfa, 0x20, 0x4b,
-  0x2a, 0x78, 0x18, 0x60, 0x1f, 0x49, 0x00, 0x24, 0x89, 0x46, 0x1d, 0x49,
-  0x00, 0x23, 0x88, 0x46, 0x10, 0xe0, 0x43, 0x46, 0x1b, 0x68, 0x62, 0x01,
-  0x9b, 0x18, 0x00, 0x2b, 0x12, 0xd0, 0x5b, 0x68, 0x00, 0x2b, 0x0f, 0xd0,
-  0x98, 0x47, 0x2a, 0x78, 0x01, 0x34, 0xe4, 0xb2, 0x51, 0x1c, 0x23, 0x00,
-  0xa1, 0x42, 0x0b, 0xdb, 0xa2, 0x42, 0xec, 0xd8, 0x9b, 0x1a, 0x5b, 0x01,
-  0x4b, 0x44, 0x5b, 0x68, 0x00, 0x2b, 0xef, 0xd1, 0x00, 0x20, 0xb7, 0xe7,
-  0x2a, 0x78, 0xdb, 0xe7, 0x30, 0x00, 0x3e, 0x70, 0xff, 0xf7, 0x08, 0xfe,
-  0x30, 0x00, 0xff, 0xf7, 0x4b, 0xfe, 0xac, 0xe7, 0x7c, 0x10, 0x00, 0x20,
-  0x58, 0x17, 0x00, 0x20, 0x10, 0x17, 0x00, 0x20, 0x0b, 0x21, 0x00, 0x20,
-  0xac, 0x17, 0x00, 0x20, 0x74, 0x10, 0x00, 0x20, 0xb0, 0x17, 0x00, 0x20,
-  0x09, 0x21, 0x00, 0x20, 0x21, 0x46, 0x00, 0x10, 0x2c, 0x14, 0x00, 0x20,
-  0x50, 0x74, 0x00, 0x10, 0xf0, 0xb5, 0xde, 0x46, 0x57, 0x46, 0x4e, 0x46,
-  0x45, 0x46, 0xe0, 0xb5, 0xce, 0x4b, 0x91, 0xb0, 0x02, 0x93, 0x1b, 0x78,
-  0xff, 0x2b, 0x00, 0xd1, 0x38, 0xe1, 0xcc, 0x4b, 0xcc, 0x4e, 0x9b, 0x46,
-  0x5f, 0x46, 0xcc, 0x4b, 0x0d, 0xac, 0x01, 0x93, 0xcb, 0x4b, 0x00, 0x93,
-  0x35, 0x68, 0x6a, 0x69, 0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6, 0x13, 0x68,
-  0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0xa9, 0x61, 0x28, 0x00,
-  0x21, 0x00, 0x01, 0xf0, 0xaf, 0xfb, 0x6a, 0x69, 0xab, 0x69, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x00, 0x21, 0x11, 0x60, 0x83, 0xf3, 0x10, 0x88, 0x00, 0x28,
-  0x00, 0xd1, 0x15, 0xe1, 0x63, 0x78, 0x08, 0x2b, 0xe2, 0xd8, 0x9b, 0x00,
-  0xfb, 0x58, 0x9f, 0x46, 0x63, 0x68, 0x00, 0x2b, 0xdc, 0xd0, 0xa0, 0x68,
-  0x98, 0x47, 0xd9, 0xe7, 0x7f, 0x22, 0x21, 0x79, 0xb5, 0x4d, 0x0a, 0x40,
-  0x53, 0x00, 0xeb, 0x18, 0x98, 0x46, 0xc8, 0x09, 0x80, 0x44, 0x40, 0x46,
-  0x01, 0x23, 0x30, 0x30, 0x05, 0x79, 0x9d, 0x43, 0x05, 0x71, 0x05, 0x79,
-  0x03, 0x33, 0x9d, 0x43, 0x05, 0x71, 0x00, 0x2a, 0x00, 0xd1, 0xfa, 0xe0,
-  0x43, 0x46, 0xad, 0x4a, 0x1b, 0x7d, 0x12, 0x78, 0x93, 0x42, 0x00, 0xd3,
-  0xe9, 0xe0, 0xab, 0x4a, 0x5b, 0x01, 0x15, 0x68, 0xed, 0x18, 0x00, 0x2d,
-  0x00, 0xd1, 0xe5, 0xe0, 0xa3, 0x68, 0x62, 0x79, 0x20, 0x78, 0xad, 0x69,
-  0xa8, 0x47, 0xaf, 0xe7, 0xa5, 0x4a, 0x13, 0x78, 0x00, 0x2b, 0x00, 0xd1,
-  0xda, 0xe0, 0x13, 0x78, 0x01, 0x3b, 0xdb, 0xb2, 0x13, 0x70, 0x13, 0x78,
-  0x00, 0x2b, 0xa3, 0xd1, 0x01, 0x22, 0x9b, 0x4d, 0x01, 0x21, 0x2b, 0x78,
-  0x04, 0x20, 0x13, 0x43, 0x2b, 0x70, 0x34, 0x23, 0xea, 0x5c, 0x8a, 0x43,
-  0xea, 0x54, 0xea, 0x5c, 0x82, 0x43, 0xea, 0x54, 0x01, 0x33, 0xea, 0x5c,
-  0x8a, 0x43, 0xea, 0x54, 0xea, 0x5c, 0x82, 0x43, 0xea, 0x54, 0x23, 0x78,
-  0x00, 0x20, 0x9b, 0x46, 0x00, 0xf0, 0xa4, 0xfc, 0x60, 0x22, 0x23, 0x79,
-  0x1a, 0x40, 0x60, 0x2a, 0x0d, 0xd0, 0x40, 0x2a, 0x00, 0xd1, 0xca, 0xe0,
-  0xdb, 0x06, 0xdb, 0x0e, 0x01, 0x2b, 0x00, 0xd1, 0x20, 0xe1, 0x02, 0x2b,
-  0x00, 0xd1, 0xdc, 0xe0, 0x00, 0x2b, 0x00, 0xd1, 0xcb, 0xe0, 0x20, 0x78,
-  0x00, 0x21, 0xff, 0xf7, 0x57, 0xfe, 0x80, 0x21, 0x20, 0x78, 0xff, 0xf7,
-  0x53, 0xfe, 0x6d, 0xe7, 0x80, 0x4d, 0x2b, 0x78, 0xdb, 0x07, 0x00, 0xd4,
-  0x68, 0xe7, 0xff, 0xf7, 0xcd, 0xfe, 0x65, 0xe7, 0x01, 0x9b, 0xdb, 0x78,
-  0xdb, 0x07, 0x00, 0xd4, 0x60, 0xe7, 0x60, 0x68, 0xff, 0xf7, 0xb8, 0xfe,
-  0x5c, 0xe7, 0x78, 0x4d, 0x2b, 0x78, 0xdb, 0x07, 0x00, 0xd4, 0x57, 0xe7,
-  0x28, 0x78, 0x00, 0x07, 0xc0, 0x0f, 0xff, 0xf7, 0xb7, 0xfe, 0x51, 0xe7,
-  0x23, 0x78, 0x73, 0x49, 0x99, 0x46, 0x8b, 0x46, 0x72, 0x4b, 0x73, 0x49,
-  0x98, 0x46, 0x8a, 0x46, 0x39, 0x00, 0x1a, 0x78, 0x47, 0x46, 0x00, 0x23,
-  0xb0, 0x46, 0x00, 0x25, 0x4e, 0x46, 0x89, 0x46, 0x10, 0xe0, 0x53, 0x46,
-  0x1b, 0x68, 0x6a, 0x01, 0x9b, 0x18, 0x00, 0x2b, 0x00, 0xd1, 0x76, 0xe0,
-  0xdb, 0x68, 0x30, 0x00, 0x98, 0x47, 0x3a, 0x78, 0x01, 0x35, 0xed, 0xb2,
-  0x51, 0x1c, 0x2b, 0x00, 0x8d, 0x42, 0x44, 0xdc, 0xaa, 0x42, 0xec, 0xd8,
-  0x9b, 0x1a, 0x5b, 0x01, 0x5b, 0x44, 0xef, 0xe7, 0x23, 0x78, 0x61, 0x49,
-  0x99, 0x46, 0x5f, 0x4b, 0x8a, 0x46, 0x98, 0x46, 0x31, 0x00, 0xbb, 0x46,
-  0x4e, 0x46, 0x1a, 0x78, 0x00, 0x25, 0x00, 0x23, 0x47, 0x46, 0x89, 0x46,
-  0x0f, 0xe0, 0x53, 0x46, 0x1b, 0x68, 0x6a, 0x01, 0x9b, 0x18, 0x00, 0x2b,
-  0x55, 0xd0, 0xdb, 0x68, 0x30, 0x00, 0x98, 0x47, 0x3a, 0x78, 0x01, 0x35,
-  0xed, 0xb2, 0x51, 0x1c, 0x2b, 0x00, 0x8d, 0x42, 0x07, 0xdc, 0x95, 0x42,
-  0xed, 0xd3, 0x9b, 0x1a, 0x00, 0x9a, 0x5b, 0x01, 0x94, 0x46, 0x63, 0x44,
-  0xed, 0xe7, 0x01, 0x9d, 0x54, 0x22, 0x00, 0x21, 0x28, 0x00, 0xfd, 0xf7,
-  0xa9, 0xfa, 0x10, 0x22, 0xff, 0x21, 0x4c, 0x48, 0xfd, 0xf7, 0xa4, 0xfa,
-  0x28, 0x00, 0x20, 0x22, 0xff, 0x21, 0x14, 0x30, 0x4e, 0x46, 0x5f, 0x46,
-  0xfd, 0xf7, 0x9c, 0xfa, 0x00, 0xf0, 0xfe, 0xfb, 0xff, 0xf7, 0x4e, 0xfe,
-  0xea, 0xe6, 0x3f, 0x4d, 0x54, 0x22, 0x00, 0x21, 0x28, 0x00, 0xfd, 0xf7,
-  0x91, 0xfa, 0x10, 0x22, 0xff, 0x21, 0x28, 0x1d, 0xfd, 0xf7, 0x8c, 0xfa,
-  0x28, 0x00, 0x20, 0x22, 0xff, 0x21, 0x14, 0x30, 0x46, 0x46, 0x4f, 0x46,
-  0xfd, 0xf7, 0x84, 0xfa, 0x00, 0xf0, 0xe6, 0xfb, 0x23, 0x79, 0xab, 0x70,
-  0xd2, 0xe6, 0x50, 0x1c, 0x98, 0x42, 0x13, 0xda, 0x11, 0xb0, 0xf0, 0xbc,
-  0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46, 0xf0, 0xbd, 0xa3, 0x68,
-  0x62, 0x79, 0x20, 0x78, 0x00, 0xf0, 0xf2, 0xfb, 0xc2, 0xe6, 0x46, 0x46,
-  0x4f, 0x46, 0x2a, 0x4d, 0xe6, 0xe7, 0x4e, 0x46, 0x5f, 0x46, 0xcb, 0xe7,
-  0x28, 0x4d, 0x9b, 0x1a, 0x5b, 0x01, 0x5d, 0x19, 0x00, 0xe7, 0x2b, 0x48,
-  0x00, 0xf0, 0xce, 0xfb, 0x01, 0x21, 0x58, 0x46, 0x0e, 0xaa, 0xff, 0xf7,
-  0x01, 0xf9, 0x00, 0x28, 0x00, 0xd0, 0xab, 0xe6, 0x33, 0xe7, 0x20, 0x2a,
-  0x00, 0xd1, 0x56, 0xe1, 0x00, 0x2a, 0x00, 0xd0, 0x2d, 0xe7, 0x63, 0x79,
-  0x09, 0x2b, 0x00, 0xd9, 0x29, 0xe7, 0x21, 0x4a, 0x9b, 0x00, 0xd3, 0x58,
-  0x9f, 0x46, 0x70, 0x23, 0x21, 0x7a, 0x0b, 0x42, 0x00, 0xd0, 0x20, 0xe7,
-  0xc8, 0x09, 0x82, 0x46, 0x0f, 0x33, 0x0b, 0x40, 0x5b, 0x00, 0x98, 0x46,
-  0x14, 0x48, 0xeb, 0x18, 0x53, 0x44, 0x1b, 0x7d, 0x00, 0x78, 0x99, 0x46,
-  0x83, 0x42, 0x61, 0xd3, 0x43, 0x1c, 0x4b, 0x45, 0x00, 0xda, 0x4e, 0xe1,
-  0x4b, 0x46, 0x1b, 0x1a, 0x5b, 0x01, 0x99, 0x46, 0x0b, 0x48, 0x81, 0x44,
-  0x00, 0x2a, 0x00, 0xd1, 0x4a, 0xe1, 0x4b, 0x46, 0x58, 0x69, 0x00, 0xf0,
-  0x93, 0xfb, 0x4b, 0x46, 0x01, 0x21, 0x58, 0x46, 0x5b, 0x69, 0x0e, 0xaa,
-  0x98, 0x47, 0xc2, 0xe7, 0x7c, 0x10, 0x00, 0x20, 0xa8, 0x73, 0x00, 0x10,
-  0xb0, 0x17, 0x00, 0x20, 0x58, 0x17, 0x00, 0x20, 0x50, 0x74, 0x00, 0x10,
-  0x09, 0x21, 0x00, 0x20, 0x2c, 0x14, 0x00, 0x20, 0x0b, 0x21, 0x00, 0x20,
-  0x5c, 0x17, 0x00, 0x20, 0xed, 0x45, 0x00, 0x10, 0xcc, 0x73, 0x00, 0x10,
-  0x23, 0x7a, 0x0f, 0x2b, 0x00, 0xd9, 0xe0, 0xe6, 0xd7, 0x4a, 0xeb, 0x18,
-  0x1b, 0x79, 0x15, 0x78, 0xab, 0x42, 0x36, 0xd3, 0x69, 0x1c, 0x99, 0x42,
-  0x00, 0xda, 0xd6, 0xe6, 0x5d, 0x1b, 0xd3, 0x4b, 0x6d, 0x01, 0xed, 0x18,
-  0x68, 0x69, 0x00, 0xf0, 0x61, 0xfb, 0x01, 0x21, 0x58, 0x46, 0x6b, 0x69,
-  0x0e, 0xaa, 0x98, 0x47, 0x00, 0x28, 0x00, 0xd0, 0x3e, 0xe6, 0x60, 0x22,
-  0x15, 0x00, 0x23, 0x79, 0x1d, 0x40, 0x1a, 0x42, 0x00, 0xd0, 0xc0, 0xe6,
-  0x63, 0x79, 0x0a, 0x3b, 0x01, 0x2b, 0x00, 0xd9, 0xbb, 0xe6, 0x00, 0xf0,
-  0x4b, 0xfb, 0x63, 0x79, 0x0a, 0x2b, 0x00, 0xd1, 0x8e, 0xe1, 0x58, 0x46,
-  0x0e, 0xa9, 0x00, 0xf0, 0xcd, 0xfa, 0x27, 0xe6, 0xc1, 0x48, 0x5b, 0x01,
-  0x00, 0x68, 0x81, 0x46, 0x99, 0x44, 0x00, 0x2a, 0x00, 0xd1, 0xed, 0xe0,
-  0x4b, 0x46, 0x00, 0x2b, 0x00, 0xd1, 0xa4, 0xe6, 0x9d, 0xe7, 0xbb, 0x4a,
-  0x5b, 0x01, 0x15, 0x68, 0xed, 0x18, 0x00, 0x2d, 0xca, 0xd1, 0x9c, 0xe6,
-  0xa3, 0x79, 0x99, 0x46, 0x6b, 0x78, 0x99, 0x45, 0xe1, 0xd0, 0x6b, 0x78,
-  0x00, 0x2b, 0x00, 0xd0, 0x34, 0xe1, 0x4b, 0x46, 0x6b, 0x70, 0x00, 0x2b,
-  0x00, 0xd1, 0x2c, 0xe1, 0x48, 0x46, 0x01, 0x38, 0xc0, 0xb2, 0xff, 0xf7,
-  0x9d, 0xfa, 0x00, 0x28, 0x00, 0xd1, 0x7e, 0xe1, 0x43, 0x78, 0x07, 0x93,
-  0x02, 0x2b, 0x00, 0xd0, 0x79, 0xe1, 0x01, 0x22, 0xc1, 0x79, 0xb1, 0x46,
-  0x8b, 0x11, 0x49, 0x11, 0x13, 0x40, 0x0a, 0x40, 0x30, 0x21, 0x12, 0x01,
-  0x5b, 0x01, 0x13, 0x43, 0x2a, 0x78, 0xa8, 0x46, 0x8a, 0x43, 0x13, 0x43,
-  0x2b, 0x70, 0x09, 0x23, 0x9a, 0x46, 0x82, 0x44, 0x56, 0x46, 0xba, 0x46,
-  0xc3, 0x78, 0x82, 0x78, 0x1b, 0x02, 0x13, 0x43, 0xc3, 0x18, 0x05, 0x93,
-  0x9a, 0x4b, 0x04, 0x93, 0x9a, 0x4b, 0x08, 0x93, 0x9a, 0x4b, 0x09, 0x93,
-  0x9a, 0x4b, 0x0a, 0x93, 0x05, 0x9b, 0xb3, 0x42, 0x00, 0xd8, 0x55, 0xe1,
-  0x73, 0x78, 0x01, 0x22, 0x0b, 0x2b, 0x03, 0xd1, 0x33, 0x78, 0xf2, 0x78,
-  0xf6, 0x18, 0x73, 0x78, 0x04, 0x2b, 0x00, 0xd0, 0x44, 0xe1, 0x05, 0x9b,
-  0x00, 0x27, 0x9b, 0x1b, 0x9b, 0xb2, 0x06, 0x93, 0x04, 0x9b, 0x0b, 0x92,
-  0x1d, 0x78, 0x00, 0x23, 0x03, 0x93, 0x1b, 0xe0, 0x09, 0x9a, 0x7b, 0x01,
-  0x15, 0x68, 0xed, 0x18, 0x00, 0x2d, 0x00, 0xd1, 0x32, 0xe1, 0x31, 0x00,
-  0x58, 0x46, 0x2b, 0x69, 0x06, 0x9a, 0x98, 0x47, 0x84, 0x46, 0x08, 0x28,
-  0x03, 0xd9, 0x06, 0x9a, 0x82, 0x42, 0x00, 0xd3, 0x13, 0xe1, 0x04, 0x9b,
-  0x01, 0x37, 0x1d, 0x78, 0xff, 0xb2, 0x6b, 0x1c, 0x03, 0x97, 0x9f, 0x42,
-  0x00, 0xdd, 0x1d, 0xe1, 0xaf, 0x42, 0xe1, 0xd3, 0x03, 0x9b, 0x5d, 0x1b,
-  0x08, 0x9b, 0x6d, 0x01, 0x9c, 0x46, 0x65, 0x44, 0xe1, 0xe7, 0x6b, 0x78,
-  0x0c, 0xaa, 0x02, 0x32, 0x13, 0x70, 0x58, 0x46, 0x01, 0x23, 0x0e, 0xa9,
-  0x00, 0xf0, 0x48, 0xfa, 0x8c, 0xe5, 0xe3, 0x88, 0x1a, 0x0a, 0xd8, 0xb2,
-  0x0f, 0x2a, 0x00, 0xd9, 0x0f, 0xe6, 0x73, 0x49, 0x93, 0x00, 0xcb, 0x58,
-  0x9f, 0x46, 0x0e, 0xa8, 0x00, 0xf0, 0xa0, 0xfa, 0x58, 0x46, 0xa1, 0x79,
-  0xff, 0xf7, 0xa0, 0xfb, 0x02, 0x22, 0x2b, 0x78, 0x13, 0x43, 0x2b, 0x70,
-  0x76, 0xe5, 0xe3, 0x88, 0x01, 0x2b, 0x00, 0xd0, 0xfb, 0xe5, 0x08, 0x22,
-  0x2b, 0x78, 0x58, 0x46, 0x93, 0x43, 0x0e, 0xa9, 0x2b, 0x70, 0x00, 0xf0,
-  0x0f, 0xfa, 0x69, 0xe5, 0x02, 0x20, 0x29, 0x78, 0x0c, 0xab, 0x9a, 0x1c,
-  0x8b, 0x06, 0x89, 0x08, 0xdb, 0x0f, 0x01, 0x40, 0x0b, 0x43, 0x13, 0x80,
-  0x58, 0x46, 0x02, 0x23, 0x0e, 0xa9, 0x00, 0xf0, 0x15, 0xfa, 0x59, 0xe5,
-  0xe3, 0x88, 0x01, 0x2b, 0x00, 0xd0, 0xde, 0xe5, 0x08, 0x22, 0x2b, 0x78,
-  0x13, 0x43, 0x2b, 0x70, 0x23, 0xe7, 0x23, 0x7a, 0x0f, 0x2b, 0x00, 0xd9,
-  0xd5, 0xe5, 0xeb, 0x18, 0x1d, 0x79, 0x51, 0x4b, 0x1b, 0x78, 0x9d, 0x42,
-  0x28, 0xd2, 0x51, 0x4b, 0x6d, 0x01, 0x1b, 0x68, 0x5d, 0x19, 0x00, 0x2d,
-  0x00, 0xd1, 0xc8, 0xe5, 0x68, 0x69, 0x00, 0xf0, 0x57, 0xfa, 0x01, 0x21,
-  0x58, 0x46, 0x6b, 0x69, 0x0e, 0xaa, 0x98, 0x47, 0x87, 0xe6, 0x00, 0x2a,
-  0x00, 0xd0, 0xbc, 0xe5, 0x00, 0x23, 0x99, 0x46, 0x62, 0x79, 0x02, 0x20,
-  0x13, 0x00, 0x03, 0x92, 0x83, 0x43, 0x01, 0x2b, 0x15, 0xd0, 0x00, 0x2a,
-  0x00, 0xd0, 0xb0, 0xe5, 0x2b, 0x00, 0x43, 0x44, 0x53, 0x44, 0x30, 0x33,
-  0x1b, 0x79, 0x0c, 0xaa, 0x9b, 0x07, 0xdb, 0x0f, 0x02, 0x32, 0xbc, 0xe7,
-  0x5a, 0x1c, 0xaa, 0x42, 0x00, 0xda, 0xa2, 0xe5, 0xed, 0x1a, 0x39, 0x4b,
-  0x6d, 0x01, 0xed, 0x18, 0xd4, 0xe7, 0xe3, 0x88, 0x00, 0x2b, 0x11, 0xd1,
-  0x01, 0x2a, 0x25, 0xd0, 0x02, 0x9b, 0x18, 0x78, 0xff, 0xf7, 0xf0, 0xfb,
-  0x43, 0x46, 0x02, 0x21, 0xeb, 0x18, 0x53, 0x44, 0x30, 0x33, 0x1a, 0x79,
-  0x0a, 0x43, 0x01, 0x21, 0x1a, 0x71, 0x1a, 0x79, 0x0a, 0x43, 0x1a, 0x71,
-  0x4b, 0x46, 0x00, 0x2b, 0x00, 0xd1, 0xfb, 0xe4, 0x58, 0x69, 0x00, 0xf0,
-  0x13, 0xfa, 0x4b, 0x46, 0x01, 0x21, 0x5b, 0x69, 0x0e, 0xaa, 0x58, 0x46,
-  0x98, 0x47, 0x00, 0x20, 0x00, 0xf0, 0x0a, 0xfa, 0x35, 0x23, 0xeb, 0x5c,
-  0xdb, 0x07, 0x00, 0xd5, 0xea, 0xe4, 0xbc, 0xe6, 0x02, 0x9b, 0x18, 0x78,
-  0xff, 0xf7, 0xe6, 0xfb, 0x43, 0x46, 0x02, 0x21, 0xeb, 0x18, 0x53, 0x44,
-  0x30, 0x33, 0x1a, 0x79, 0x8a, 0x43, 0x1a, 0x71, 0x1a, 0x79, 0x03, 0x99,
-  0x8a, 0x43, 0x1a, 0x71, 0xd8, 0xe7, 0xff, 0xf7, 0x39, 0xfc, 0xa8, 0xe6,
-  0x00, 0x21, 0x58, 0x46, 0xff, 0xf7, 0x00, 0xfb, 0x58, 0x46, 0xff, 0xf7,
-  0x9d, 0xfb, 0xab, 0x78, 0x13, 0x49, 0x03, 0x93, 0x04, 0x91, 0x11, 0x4b,
-  0x12, 0x49, 0x98, 0x46, 0x1a, 0x78, 0x05, 0x91, 0x00, 0x23, 0x29, 0x00,
-  0x1d, 0x00, 0x8a, 0x46, 0x10, 0xe0, 0x05, 0x9b, 0x6a, 0x01, 0x1b, 0x68,
-  0x9b, 0x18, 0x00, 0x2b, 0x57, 0xd0, 0xdb, 0x68, 0x58, 0x46, 0x98, 0x47,
-  0x43, 0x46, 0x1a, 0x78, 0x01, 0x35, 0xed, 0xb2, 0x51, 0x1c, 0x2b, 0x00,
-  0x8d, 0x42, 0x38, 0xdc, 0x95, 0x42, 0xec, 0xd3, 0x9b, 0x1a, 0x04, 0x9a,
-  0x5b, 0x01, 0x94, 0x46, 0x63, 0x44, 0xec, 0xe7, 0x09, 0x21, 0x00, 0x20,
-  0x50, 0x74, 0x00, 0x10, 0x2c, 0x14, 0x00, 0x20, 0x6c, 0x17, 0x00, 0x20,
-  0xf4, 0x73, 0x00, 0x10, 0x0c, 0xab, 0x9a, 0x1c, 0x58, 0x46, 0x01, 0x23,
-  0x0e, 0xa9, 0x15, 0x70, 0x00, 0xf0, 0x50, 0xf9, 0x94, 0xe4, 0x0b, 0x9a,
-  0x01, 0x2a, 0x4f, 0xd0, 0x00, 0x2a, 0x3c, 0xd0, 0x00, 0x23, 0xb0, 0x78,
-  0x04, 0xe0, 0x01, 0x33, 0xdb, 0xb2, 0x0f, 0x71, 0x93, 0x42, 0x34, 0xd2,
-  0x19, 0x18, 0xc9, 0xb2, 0x41, 0x44, 0x0d, 0x79, 0xff, 0x2d, 0xf4, 0xd0,
-  0x4e, 0x46, 0x45, 0x46, 0x57, 0x46, 0x00, 0x23, 0x6b, 0x70, 0x04, 0xe5,
-  0x4e, 0x46, 0x57, 0x46, 0xff, 0xf7, 0xd8, 0xfb, 0x49, 0xe6, 0x55, 0x46,
-  0x54, 0x22, 0x00, 0x21, 0x28, 0x00, 0xfd, 0xf7, 0x1d, 0xf8, 0x10, 0x22,
-  0xff, 0x21, 0x28, 0x1d, 0xfd, 0xf7, 0x18, 0xf8, 0x28, 0x00, 0x20, 0x22,
-  0xff, 0x21, 0x14, 0x30, 0xfd, 0xf7, 0x12, 0xf8, 0x03, 0x9b, 0xab, 0x70,
-  0x57, 0xe6, 0x55, 0x46, 0xfa, 0xe7, 0xfe, 0xf7, 0xad, 0xfe, 0x02, 0x1e,
-  0x00, 0xd1, 0xe4, 0xe4, 0xd3, 0x78, 0x91, 0x78, 0x1b, 0x02, 0x0b, 0x43,
-  0x58, 0x46, 0x0e, 0xa9, 0x00, 0xf0, 0x0e, 0xf9, 0xa3, 0xe5, 0x65, 0x46,
-  0x3b, 0x00, 0x2a, 0x00, 0x31, 0x00, 0x0a, 0x98, 0x00, 0xf0, 0x7a, 0xfe,
-  0xac, 0x46, 0x04, 0x9b, 0x03, 0x9a, 0x1b, 0x78, 0x66, 0x44, 0x01, 0x33,
-  0x93, 0x42, 0x00, 0xdb, 0x6c, 0xe6, 0xbf, 0xe7, 0x16, 0x4b, 0x29, 0x69,
-  0x99, 0x42, 0xad, 0xd1, 0x07, 0x9a, 0xab, 0xe7, 0xff, 0xf7, 0x96, 0xfb,
-  0x02, 0x1e, 0x00, 0xd1, 0xbf, 0xe4, 0x58, 0x46, 0x13, 0x78, 0x0e, 0xa9,
-  0x00, 0xf0, 0xec, 0xf8, 0x81, 0xe5, 0x21, 0x89, 0xff, 0xf7, 0xce, 0xf8,
-  0x02, 0x1e, 0xf4, 0xd1, 0xb3, 0xe4, 0x02, 0x2a, 0x0f, 0xd0, 0xff, 0xf7,
-  0x85, 0xfb, 0x02, 0x1e, 0xc8, 0xd1, 0xac, 0xe4, 0xff, 0xf7, 0xba, 0xf8,
-  0x02, 0x1e, 0x00, 0xd1, 0xa7, 0xe4, 0x12, 0x23, 0x58, 0x46, 0x0e, 0xa9,
-  0x00, 0xf0, 0xd4, 0xf8, 0x69, 0xe5, 0xff, 0xf7, 0xb3, 0xf8, 0x02, 0x1e,
-  0xb8, 0xd1, 0x9c, 0xe4, 0x95, 0x5f, 0x00, 0x10, 0xf8, 0xb5, 0x57, 0x46,
-  0x4e, 0x46, 0xde, 0x46, 0x45, 0x46, 0x0c, 0x00, 0xe0, 0xb5, 0x16, 0x00,
-  0x1f, 0x00, 0x00, 0x2a, 0x3c, 0xd0, 0x1f, 0x4b, 0x00, 0x25, 0x9a, 0x46,
-  0x70, 0x23, 0x99, 0x46, 0x1d, 0x4b, 0x9b, 0x46, 0x17, 0xe0, 0x5b, 0x46,
-  0x20, 0x00, 0x99, 0x78, 0x00, 0xf0, 0xea, 0xfd, 0x00, 0x28, 0x1f, 0xd0,
-  0x21, 0x00, 0x40, 0x46, 0xff, 0xf7, 0x3e, 0xfa, 0x00, 0x28, 0x19, 0xd0,
-  0xa3, 0x78, 0xda, 0x09, 0x01, 0x2a, 0x1c, 0xd0, 0x0a, 0x9a, 0x01, 0x35,
-  0x13, 0x70, 0x23, 0x78, 0xe4, 0x18, 0xb5, 0x42, 0x1c, 0xda, 0x63, 0x78,
-  0x05, 0x2b, 0x0b, 0xd1, 0xe3, 0x78, 0x9b, 0x07, 0x9b, 0x0f, 0xbb, 0x42,
-  0x06, 0xd1, 0x53, 0x46, 0x4a, 0x46, 0x1b, 0x78, 0x98, 0x46, 0xa3, 0x78,
-  0x1a, 0x42, 0xd8, 0xd0, 0x00, 0x20, 0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46,
-  0xa9, 0x46, 0xa0, 0x46, 0xf8, 0xbd, 0x0b, 0x9a, 0x01, 0x35, 0x13, 0x70,
-  0x23, 0x78, 0xe4, 0x18, 0xb5, 0x42, 0xe2, 0xdb, 0x01, 0x20, 0xf0, 0xe7,
-  0x7c, 0x10, 0x00, 0x20, 0x58, 0x17, 0x00, 0x20, 0x70, 0x22, 0x70, 0xb5,
-  0x09, 0x4b, 0x0c, 0x00, 0x1d, 0x78, 0x8b, 0x78, 0x1a, 0x42, 0x01, 0xd0,
-  0x00, 0x20, 0x70, 0xbd, 0x06, 0x4b, 0x20, 0x00, 0x99, 0x78, 0x00, 0xf0,
-  0xa5, 0xfd, 0x00, 0x28, 0xf6, 0xd0, 0x21, 0x00, 0x28, 0x00, 0xff, 0xf7,
-  0xf9, 0xf9, 0xf2, 0xe7, 0x7c, 0x10, 0x00, 0x20, 0x58, 0x17, 0x00, 0x20,
-  0x0b, 0x00, 0x7f, 0x20, 0x10, 0xb5, 0x18, 0x40, 0xdb, 0x09, 0x34, 0x33,
-  0x40, 0x00, 0x04, 0x4a, 0xc0, 0x18, 0x04, 0x4b, 0x11, 0x68, 0xc0, 0x18,
-  0x00, 0xf0, 0x48, 0xfd, 0x10, 0xbd, 0xc0, 0x46, 0xac, 0x17, 0x00, 0x20,
-  0x58, 0x17, 0x00, 0x20, 0x0b, 0x00, 0x7f, 0x20, 0x10, 0xb5, 0x18, 0x40,
-  0xdb, 0x09, 0x34, 0x33, 0x40, 0x00, 0x04, 0x4a, 0xc0, 0x18, 0x04, 0x4b,
-  0x11, 0x68, 0xc0, 0x18, 0x00, 0xf0, 0x5c, 0xfd, 0x10, 0xbd, 0xc0, 0x46,
-  0xac, 0x17, 0x00, 0x20, 0x58, 0x17, 0x00, 0x20, 0x70, 0xb5, 0x7f, 0x24,
-  0x0f, 0x48, 0x0c, 0x40, 0x64, 0x00, 0x04, 0x19, 0xcd, 0x09, 0x64, 0x19,
-  0x30, 0x34, 0x20, 0x79, 0xc0, 0x07, 0x01, 0xd5, 0x00, 0x20, 0x70, 0xbd,
-  0x01, 0x26, 0x25, 0x79, 0x09, 0x48, 0x35, 0x43, 0x00, 0x78, 0x25, 0x71,
-  0xff, 0xf7, 0x3e, 0xfa, 0x00, 0x28, 0xf4, 0xd1, 0x01, 0x22, 0x23, 0x79,
-  0x93, 0x43, 0x23, 0x71, 0x23, 0x79, 0x03, 0x32, 0x93, 0x43, 0x23, 0x71,
-  0xea, 0xe7, 0xc0, 0x46, 0x58, 0x17, 0x00, 0x20, 0x7c, 0x10, 0x00, 0x20,
-  0x70, 0xb5, 0x09, 0x4c, 0x06, 0x00, 0x08, 0x22, 0x20, 0x00, 0x0d, 0x00,
-  0xfc, 0xf7, 0x06, 0xff, 0x00, 0x23, 0x80, 0x21, 0xe3, 0x60, 0xa3, 0x60,
-  0x2b, 0x78, 0x30, 0x00, 0x99, 0x43, 0x00, 0x22, 0x00, 0x23, 0xff, 0xf7,
-  0xc7, 0xff, 0x70, 0xbd, 0xfc, 0x16, 0x00, 0x20, 0xf8, 0xb5, 0xce, 0x46,
-  0x47, 0x46, 0x90, 0x46, 0x26, 0x4e, 0x80, 0xb5, 0x81, 0x46, 0x08, 0x22,
-  0x30, 0x00, 0x0d, 0x00, 0x1f, 0x00, 0xfc, 0xf7, 0xeb, 0xfe, 0x43, 0x46,
-  0xb3, 0x60, 0x00, 0x23, 0xf3, 0x81, 0xec, 0x79, 0xab, 0x79, 0x24, 0x02,
-  0x1c, 0x43, 0x23, 0x1c, 0xbc, 0x42, 0x00, 0xd9, 0x3b, 0x1c, 0x9f, 0xb2,
-  0xb3, 0x81, 0x00, 0x2c, 0x0e, 0xd0, 0x00, 0x2f, 0x18, 0xd0, 0x43, 0x46,
-  0x00, 0x2b, 0x2c, 0xd0, 0x3b, 0x1c, 0x40, 0x2f, 0x1b, 0xd8, 0x9f, 0xb2,
-  0x33, 0x78, 0x7f, 0x2b, 0x1c, 0xd8, 0x00, 0x21, 0x14, 0x4a, 0x0f, 0xe0,
-  0x80, 0x21, 0x2b, 0x78, 0x00, 0x22, 0x99, 0x43, 0x48, 0x46, 0x00, 0x23,
-  0xff, 0xf7, 0x90, 0xff, 0xc0, 0xbc, 0xb9, 0x46, 0xb0, 0x46, 0xf8, 0xbd,
-  0x7f, 0x23, 0x00, 0x22, 0x31, 0x78, 0x99, 0x43, 0x3b, 0x00, 0x48, 0x46,
-  0xff, 0xf7, 0x84, 0xff, 0xf2, 0xe7, 0x40, 0x23, 0x9f, 0xb2, 0x33, 0x78,
-  0x7f, 0x2b, 0xe2, 0xd9, 0x06, 0x4c, 0x3a, 0x00, 0x41, 0x46, 0x20, 0x00,
-  0xfc, 0xf7, 0xac, 0xfe, 0x80, 0x21, 0x22, 0x00, 0xec, 0xe7, 0x00, 0x20,
-  0xe2, 0xe7, 0xc0, 0x46, 0xfc, 0x16, 0x00, 0x20, 0x18, 0x17, 0x00, 0x20,
-  0x10, 0xb5, 0x14, 0x22, 0x00, 0x21, 0x02, 0x48, 0xfc, 0xf7, 0x96, 0xfe,
-  0x10, 0xbd, 0xc0, 0x46, 0xfc, 0x16, 0x00, 0x20, 0x01, 0x4b, 0x18, 0x61,
-  0x70, 0x47, 0xc0, 0x46, 0xfc, 0x16, 0x00, 0x20, 0x10, 0xb5, 0x05, 0x4c,
-  0x01, 0x00, 0x08, 0x22, 0x20, 0x00, 0xfc, 0xf7, 0x8b, 0xfe, 0x00, 0x23,
-  0xa3, 0x60, 0xe3, 0x60, 0x10, 0xbd, 0xc0, 0x46, 0xfc, 0x16, 0x00, 0x20,
-  0x70, 0xb5, 0x38, 0x4c, 0x1d, 0x00, 0x23, 0x78, 0x06, 0x00, 0xda, 0x09,
-  0xc9, 0x09, 0x8a, 0x42, 0x10, 0xd0, 0x00, 0x20, 0x00, 0x2d, 0x00, 0xd0,
-  0x70, 0xbd, 0x21, 0x00, 0x30, 0x00, 0xff, 0xf7, 0xfd, 0xf8, 0x23, 0x69,
-  0x00, 0x2b, 0x03, 0xd0, 0x22, 0x00, 0x03, 0x21, 0x30, 0x00, 0x98, 0x47,
-  0x01, 0x20, 0xf1, 0xe7, 0x7f, 0x2b, 0x06, 0xd8, 0xa0, 0x68, 0x00, 0x28,
-  0x34, 0xd0, 0x2a, 0x00, 0x29, 0x49, 0xfc, 0xf7, 0x61, 0xfe, 0xe2, 0x89,
-  0xa1, 0x68, 0x52, 0x19, 0xe3, 0x88, 0x92, 0xb2, 0x49, 0x19, 0xe2, 0x81,
-  0xa1, 0x60, 0x93, 0x42, 0x14, 0xd0, 0x3f, 0x2d, 0x12, 0xd9, 0xa3, 0x89,
-  0x98, 0x1a, 0x05, 0x1c, 0x80, 0xb2, 0x40, 0x28, 0x2a, 0xd8, 0x20, 0x78,
-  0xad, 0xb2, 0x7f, 0x28, 0x28, 0xd8, 0x00, 0x21, 0x9a, 0x42, 0x32, 0xd0,
-  0x1b, 0x4a, 0x2b, 0x00, 0x30, 0x00, 0xff, 0xf7, 0x0f, 0xff, 0xc9, 0xe7,
-  0x23, 0x69, 0x00, 0x2b, 0x05, 0xd0, 0x22, 0x00, 0x02, 0x21, 0x30, 0x00,
-  0x98, 0x47, 0x00, 0x28, 0x0a, 0xd0, 0x80, 0x21, 0x23, 0x78, 0x00, 0x22,
-  0x99, 0x43, 0x30, 0x00, 0x00, 0x23, 0xff, 0xf7, 0xfd, 0xfe, 0xb7, 0xe7,
-  0x00, 0x20, 0xb5, 0xe7, 0x00, 0x21, 0x30, 0x00, 0xff, 0xf7, 0x5c, 0xf9,
-  0x30, 0x00, 0x80, 0x21, 0xff, 0xf7, 0x58, 0xf9, 0x01, 0x20, 0xab, 0xe7,
-  0x40, 0x25, 0xd2, 0xe7, 0x9a, 0x42, 0x07, 0xd0, 0x07, 0x4c, 0x2a, 0x00,
-  0x20, 0x00, 0xfc, 0xf7, 0x1b, 0xfe, 0x80, 0x21, 0x22, 0x00, 0xd0, 0xe7,
-  0x80, 0x21, 0x00, 0x22, 0xcd, 0xe7, 0x00, 0x22, 0xcb, 0xe7, 0xc0, 0x46,
-  0xfc, 0x16, 0x00, 0x20, 0x18, 0x17, 0x00, 0x20, 0x70, 0xb5, 0x04, 0x00,
-  0xff, 0xf7, 0xc0, 0xf9, 0x00, 0x28, 0x00, 0xd1, 0x70, 0xbd, 0xff, 0xf7,
-  0xc3, 0xf9, 0x00, 0x28, 0xfa, 0xd1, 0xe3, 0x78, 0x00, 0x2b, 0xf7, 0xd0,
-  0x25, 0x00, 0x10, 0x35, 0x28, 0x00, 0x00, 0xf0, 0xf1, 0xfd, 0x3f, 0x28,
-  0xf0, 0xd9, 0x00, 0x20, 0xe1, 0x78, 0xff, 0xf7, 0x99, 0xfe, 0x00, 0x28,
-  0xea, 0xd0, 0x28, 0x00, 0x00, 0xf0, 0xe6, 0xfd, 0x3f, 0x28, 0x08, 0xd9,
-  0x92, 0x23, 0x9b, 0x00, 0xe2, 0x18, 0xe1, 0x78, 0x40, 0x23, 0x00, 0x20,
-  0xff, 0xf7, 0xb2, 0xfe, 0xdc, 0xe7, 0xe1, 0x78, 0x00, 0x20, 0xff, 0xf7,
-  0x99, 0xfe, 0xd7, 0xe7, 0x10, 0xb5, 0x04, 0x00, 0xff, 0xf7, 0x92, 0xf9,
-  0x00, 0x28, 0x01, 0xd1, 0x00, 0x20, 0x10, 0xbd, 0xff, 0xf7, 0x94, 0xf9,
-  0x00, 0x28, 0xf9, 0xd1, 0xb2, 0x22, 0x92, 0x00, 0x62, 0x43, 0x03, 0x4b,
-  0x01, 0x30, 0x9b, 0x18, 0x1b, 0x79, 0x18, 0x40, 0xf1, 0xe7, 0xc0, 0x46,
-  0x34, 0x14, 0x00, 0x20, 0xb2, 0x23, 0x9b, 0x00, 0x43, 0x43, 0x10, 0xb5,
-  0x02, 0x48, 0x18, 0x18, 0x00, 0xf0, 0x98, 0xfd, 0x10, 0xbd, 0xc0, 0x46,
-  0x44, 0x14, 0x00, 0x20, 0xf0, 0xb5, 0xb2, 0x26, 0xb6, 0x00, 0x46, 0x43,
-  0x35, 0x00, 0xc6, 0x46, 0x80, 0x23, 0x20, 0x4f, 0x10, 0x35, 0x04, 0x00,
-  0x00, 0xb5, 0x7d, 0x19, 0x5b, 0x02, 0x9a, 0x42, 0x00, 0xd3, 0x1d, 0x4a,
-  0x28, 0x00, 0x92, 0xb2, 0x00, 0xf0, 0x02, 0xfe, 0x80, 0x46, 0xff, 0xf7,
-  0x5b, 0xf9, 0x00, 0x28, 0x03, 0xd1, 0x40, 0x46, 0x80, 0xbc, 0xb8, 0x46,
-  0xf0, 0xbd, 0xff, 0xf7, 0x5b, 0xf9, 0x00, 0x28, 0xf7, 0xd1, 0xb2, 0x23,
-  0x9b, 0x00, 0x5c, 0x43, 0x3c, 0x19, 0xe3, 0x78, 0x00, 0x2b, 0xf0, 0xd0,
-  0x28, 0x00, 0x00, 0xf0, 0x87, 0xfd, 0x3f, 0x28, 0xeb, 0xd9, 0x00, 0x20,
-  0xe1, 0x78, 0xff, 0xf7, 0x2f, 0xfe, 0x00, 0x28, 0xe5, 0xd0, 0x28, 0x00,
-  0x00, 0xf0, 0x7c, 0xfd, 0x3f, 0x28, 0x0a, 0xd9, 0x92, 0x23, 0x9b, 0x00,
-  0x9c, 0x46, 0x66, 0x44, 0x40, 0x23, 0xe1, 0x78, 0xba, 0x19, 0x00, 0x20,
-  0xff, 0xf7, 0x46, 0xfe, 0xd5, 0xe7, 0xe1, 0x78, 0x00, 0x20, 0xff, 0xf7,
-  0x2d, 0xfe, 0xd0, 0xe7, 0x34, 0x14, 0x00, 0x20, 0xff, 0xff, 0x00, 0x00,
-  0xf8, 0xb5, 0x04, 0x00, 0xff, 0xf7, 0x22, 0xf9, 0x00, 0x28, 0x01, 0xd1,
-  0x00, 0x20, 0xf8, 0xbd, 0xff, 0xf7, 0x24, 0xf9, 0x00, 0x28, 0xf9, 0xd1,
-  0xb2, 0x23, 0x9b, 0x00, 0x5c, 0x43, 0x25, 0x00, 0x14, 0x4e, 0x24, 0x35,
-  0xad, 0x19, 0x28, 0x00, 0x00, 0xf0, 0x32, 0xfd, 0x00, 0x28, 0xed, 0xd0,
-  0x37, 0x19, 0x00, 0x20, 0xb9, 0x78, 0xff, 0xf7, 0xf7, 0xfd, 0x00, 0x28,
-  0xe6, 0xd0, 0xa2, 0x23, 0x9b, 0x00, 0x9c, 0x46, 0x64, 0x44, 0xa4, 0x19,
-  0x21, 0x00, 0x28, 0x00, 0x40, 0x22, 0x00, 0xf0, 0xa1, 0xfd, 0xb9, 0x78,
-  0x05, 0x1e, 0x08, 0xd0, 0x03, 0x00, 0x22, 0x00, 0x00, 0x20, 0xff, 0xf7,
-  0x0b, 0xfe, 0x00, 0x28, 0xd2, 0xd0, 0x28, 0x00, 0xd1, 0xe7, 0x00, 0x20,
-  0xff, 0xf7, 0xf0, 0xfd, 0xcc, 0xe7, 0xc0, 0x46, 0x34, 0x14, 0x00, 0x20,
-  0x70, 0xb5, 0xb2, 0x24, 0xa4, 0x00, 0x44, 0x43, 0x0b, 0x4b, 0x05, 0x00,
-  0xe4, 0x18, 0x80, 0x23, 0x5b, 0x02, 0x9a, 0x42, 0x00, 0xd3, 0x09, 0x4a,
-  0x20, 0x00, 0x92, 0xb2, 0x00, 0xf0, 0x36, 0xfe, 0x06, 0x00, 0x20, 0x00,
-  0x00, 0xf0, 0xf8, 0xfc, 0x3f, 0x28, 0x01, 0xd8, 0x30, 0x00, 0x70, 0xbd,
-  0x28, 0x00, 0xff, 0xf7, 0xa9, 0xff, 0xf9, 0xe7, 0x58, 0x14, 0x00, 0x20,
-  0xff, 0xff, 0x00, 0x00, 0xb2, 0x23, 0x9b, 0x00, 0x43, 0x43, 0x10, 0xb5,
-  0x02, 0x48, 0x18, 0x18, 0x00, 0xf0, 0x02, 0xfd, 0x10, 0xbd, 0xc0, 0x46,
-  0x58, 0x14, 0x00, 0x20, 0xb2, 0x22, 0xf0, 0xb5, 0x00, 0x25, 0x1b, 0x4c,
-  0x83, 0xb0, 0x00, 0x21, 0x20, 0x00, 0x92, 0x00, 0xfc, 0xf7, 0xf8, 0xfc,
-  0x18, 0x4b, 0x80, 0x26, 0x1d, 0x70, 0xff, 0x23, 0x63, 0x71, 0xe1, 0x23,
-  0x5b, 0x02, 0xa3, 0x60, 0x21, 0x00, 0x08, 0x23, 0x20, 0x00, 0x76, 0x00,
-  0xa3, 0x73, 0x32, 0x00, 0x38, 0x31, 0x00, 0x95, 0x07, 0x3b, 0x10, 0x30,
-  0x00, 0xf0, 0x8c, 0xfc, 0x21, 0x00, 0x01, 0x23, 0x20, 0x00, 0x39, 0x31,
-  0x32, 0x00, 0xff, 0x31, 0x00, 0x93, 0x24, 0x30, 0x00, 0xf0, 0x82, 0xfc,
-  0x8e, 0x23, 0x9b, 0x00, 0xe7, 0x18, 0x38, 0x00, 0xfa, 0xf7, 0x3a, 0xfe,
-  0x90, 0x23, 0x9b, 0x00, 0xe6, 0x18, 0x30, 0x00, 0xfa, 0xf7, 0x34, 0xfe,
-  0xe5, 0x61, 0x27, 0x62, 0x26, 0x63, 0x65, 0x63, 0x03, 0xb0, 0xf0, 0xbd,
-  0x34, 0x14, 0x00, 0x20, 0x30, 0x14, 0x00, 0x20, 0x0a, 0x4b, 0x19, 0x6b,
-  0x1a, 0x6a, 0x00, 0x29, 0x09, 0xd0, 0x00, 0x2a, 0x0c, 0xd0, 0x00, 0x22,
-  0x1a, 0x62, 0x1a, 0x63, 0xda, 0x61, 0x00, 0x22, 0x5a, 0x63, 0x01, 0x20,
-  0x70, 0x47, 0x00, 0x2a, 0xfb, 0xd0, 0xd9, 0x61, 0x19, 0x62, 0xf8, 0xe7,
-  0x1a, 0x63, 0xf4, 0xe7, 0x34, 0x14, 0x00, 0x20, 0x70, 0xb5, 0x0f, 0x4c,
-  0x05, 0x22, 0x00, 0x21, 0x20, 0x00, 0xfc, 0xf7, 0xa5, 0xfc, 0x0d, 0x4d,
-  0x2b, 0x78, 0xda, 0x07, 0x07, 0xd5, 0x0c, 0x4c, 0x9b, 0x07, 0x0c, 0xd5,
-  0x01, 0x21, 0x20, 0x00, 0x00, 0xf0, 0x8a, 0xfe, 0x70, 0xbd, 0x20, 0x00,
-  0x10, 0x30, 0x00, 0xf0, 0x65, 0xfe, 0x2b, 0x78, 0x05, 0x4c, 0x9b, 0x07,
-  0xf2, 0xd4, 0x20, 0x00, 0x00, 0xf0, 0x5e, 0xfe, 0xee, 0xe7, 0xc0, 0x46,
-  0x34, 0x14, 0x00, 0x20, 0x30, 0x14, 0x00, 0x20, 0x58, 0x14, 0x00, 0x20,
-  0xf0, 0xb5, 0xc6, 0x46, 0x00, 0xb5, 0x4b, 0x79, 0x06, 0x00, 0x82, 0xb0,
-  0x02, 0x2b, 0x02, 0xd1, 0x8b, 0x79, 0x02, 0x2b, 0x05, 0xd0, 0x00, 0x25,
-  0x28, 0x00, 0x02, 0xb0, 0x80, 0xbc, 0xb8, 0x46, 0xf0, 0xbd, 0x21, 0x4f,
-  0xbb, 0x78, 0x00, 0x2b, 0xf5, 0xd1, 0x8b, 0x78, 0x09, 0x25, 0x3b, 0x70,
-  0x0c, 0x78, 0x0c, 0x19, 0x63, 0x78, 0x24, 0x2b, 0x0b, 0xd1, 0x08, 0x2a,
-  0x02, 0xd8, 0x21, 0xe0, 0xaa, 0x42, 0x1f, 0xd3, 0x23, 0x78, 0xe4, 0x18,
-  0x5d, 0x19, 0x63, 0x78, 0xad, 0xb2, 0x24, 0x2b, 0xf6, 0xd0, 0x05, 0x2b,
-  0x1a, 0xd0, 0x04, 0x2b, 0x14, 0xd1, 0x63, 0x79, 0x0a, 0x2b, 0x11, 0xd1,
-  0x23, 0x78, 0x21, 0x00, 0x98, 0x46, 0x11, 0x4b, 0x02, 0x22, 0x01, 0x93,
-  0x01, 0x33, 0x00, 0x93, 0x30, 0x00, 0x02, 0x23, 0x41, 0x44, 0xff, 0xf7,
-  0x8b, 0xfc, 0x00, 0x28, 0xcb, 0xd0, 0x0e, 0x35, 0x45, 0x44, 0xad, 0xb2,
-  0x38, 0x00, 0xff, 0xf7, 0x39, 0xfe, 0xc5, 0xe7, 0x21, 0x00, 0x30, 0x00,
-  0xff, 0xf7, 0xcc, 0xfc, 0x00, 0x28, 0xbe, 0xd0, 0xa3, 0x78, 0x7b, 0x70,
-  0x23, 0x78, 0x5d, 0x19, 0xe4, 0x18, 0x63, 0x78, 0xad, 0xb2, 0xd6, 0xe7,
-  0x34, 0x14, 0x00, 0x20, 0x36, 0x14, 0x00, 0x20, 0xf8, 0xb5, 0x60, 0x23,
-  0x14, 0x00, 0x12, 0x78, 0x05, 0x00, 0x13, 0x40, 0x00, 0x20, 0x20, 0x2b,
-  0x12, 0xd1, 0x2f, 0x4a, 0x63, 0x79, 0x27, 0x79, 0x16, 0x78, 0x1b, 0x02,
-  0x3b, 0x43, 0x9e, 0x42, 0x0a, 0xd1, 0x63, 0x78, 0x22, 0x2b, 0x28, 0xd0,
-  0x07, 0xd8, 0x20, 0x2b, 0x17, 0xd0, 0x21, 0x2b, 0x02, 0xd1, 0x01, 0x29,
-  0x3e, 0xd0, 0x01, 0x20, 0xf8, 0xbd, 0x23, 0x2b, 0xfc, 0xd1, 0x01, 0x29,
-  0x40, 0xd0, 0x03, 0x29, 0xf7, 0xd1, 0x23, 0x4b, 0x00, 0x2b, 0xf4, 0xd0,
-  0xe1, 0x78, 0xa3, 0x78, 0x09, 0x02, 0x00, 0x20, 0x19, 0x43, 0x00, 0xe0,
-  0x00, 0xbf, 0x01, 0x20, 0xec, 0xe7, 0x01, 0x29, 0x28, 0xd0, 0x03, 0x29,
-  0xe7, 0xd1, 0x1c, 0x4b, 0x00, 0x2b, 0xe4, 0xd0, 0x08, 0x32, 0x00, 0x20,
-  0x11, 0x00, 0xfe, 0xf7, 0xb9, 0xfa, 0x01, 0x20, 0xde, 0xe7, 0x01, 0x29,
-  0x22, 0xd0, 0x03, 0x29, 0xd9, 0xd1, 0x01, 0x25, 0x2e, 0x00, 0xa3, 0x78,
-  0xe4, 0x78, 0x02, 0x39, 0x24, 0x02, 0x1c, 0x43, 0x14, 0x71, 0x26, 0x40,
-  0x24, 0x32, 0x10, 0x00, 0x71, 0x40, 0x00, 0xf0, 0xcf, 0xfd, 0x0f, 0x4b,
-  0x00, 0x2b, 0xc8, 0xd0, 0x62, 0x08, 0x00, 0x20, 0x31, 0x00, 0x2a, 0x40,
-  0x00, 0xe0, 0x00, 0xbf, 0x01, 0x20, 0xc1, 0xe7, 0x07, 0x23, 0x21, 0x00,
-  0x28, 0x00, 0x09, 0x4a, 0xff, 0xf7, 0xdc, 0xfc, 0x01, 0x20, 0xb9, 0xe7,
-  0x21, 0x00, 0x28, 0x00, 0xff, 0xf7, 0xc0, 0xfc, 0x01, 0x20, 0xb3, 0xe7,
-  0x34, 0x14, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x2d, 0x46, 0x00, 0x10,
-  0x00, 0x00, 0x00, 0x00, 0x3c, 0x14, 0x00, 0x20, 0xf0, 0xb5, 0x4f, 0x46,
-  0x46, 0x46, 0xd6, 0x46, 0x37, 0x4d, 0xc0, 0xb5, 0xea, 0x78, 0x1f, 0x00,
-  0x80, 0x46, 0x0c, 0x00, 0xab, 0x78, 0x8a, 0x42, 0x3b, 0xd0, 0x8b, 0x42,
-  0x10, 0xd0, 0x00, 0x20, 0xe0, 0xbc, 0xba, 0x46, 0xb1, 0x46, 0xa8, 0x46,
-  0xf0, 0xbd, 0x30, 0x4b, 0x00, 0x2b, 0x04, 0xd0, 0x2f, 0x48, 0x00, 0xf0,
-  0x95, 0xfb, 0x00, 0x28, 0x53, 0xd0, 0x28, 0x00, 0xff, 0xf7, 0x94, 0xfd,
-  0xab, 0x78, 0xa3, 0x42, 0x01, 0xd0, 0x01, 0x20, 0xea, 0xe7, 0x2a, 0x4b,
-  0x00, 0x2b, 0x02, 0xd0, 0x00, 0x20, 0x00, 0xe0, 0x00, 0xbf, 0x00, 0x20,
-  0xff, 0xf7, 0x24, 0xfe, 0x00, 0x28, 0xf2, 0xd1, 0x25, 0x4c, 0x20, 0x00,
-  0x00, 0xf0, 0x66, 0xfb, 0x00, 0x28, 0xec, 0xd1, 0x00, 0x2f, 0xea, 0xd0,
-  0xbf, 0x06, 0xe8, 0xd1, 0x24, 0x3c, 0x40, 0x46, 0xa1, 0x78, 0xff, 0xf7,
-  0x27, 0xfc, 0x00, 0x28, 0xe1, 0xd0, 0x00, 0x23, 0x00, 0x22, 0x40, 0x46,
-  0xa1, 0x78, 0xff, 0xf7, 0x47, 0xfc, 0x01, 0x20, 0xc6, 0xe7, 0x92, 0x23,
-  0x9b, 0x00, 0xee, 0x18, 0x10, 0x23, 0x9a, 0x46, 0xaa, 0x44, 0x31, 0x00,
-  0x50, 0x46, 0xba, 0xb2, 0x00, 0xf0, 0x80, 0xfc, 0x14, 0x4b, 0x00, 0x2b,
-  0xbd, 0xd0, 0x6b, 0x79, 0xff, 0x2b, 0xba, 0xd0, 0x00, 0x2f, 0xb8, 0xd0,
-  0xf2, 0x19, 0x91, 0x46, 0x03, 0xe0, 0x01, 0x36, 0xb1, 0x45, 0xb2, 0xd0,
-  0x6b, 0x79, 0x32, 0x78, 0x9a, 0x42, 0xf8, 0xd1, 0x50, 0x46, 0x00, 0xf0,
-  0x47, 0xfb, 0x00, 0x28, 0xf3, 0xd1, 0x53, 0x46, 0x10, 0x3b, 0x59, 0x79,
-  0x00, 0xe0, 0x00, 0xbf, 0xed, 0xe7, 0x00, 0xe0, 0x00, 0xbf, 0xa8, 0xe7,
-  0x34, 0x14, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x44, 0x14, 0x00, 0x20,
-  0x00, 0x00, 0x00, 0x00, 0x58, 0x14, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00,
-  0xb3, 0x22, 0x70, 0xb5, 0x14, 0x4c, 0x84, 0xb0, 0x00, 0x21, 0x20, 0x00,
-  0x92, 0x00, 0xfc, 0xf7, 0x33, 0xfb, 0x23, 0x1d, 0x02, 0x93, 0x23, 0x00,
-  0x20, 0x00, 0x80, 0x25, 0x40, 0x26, 0xcd, 0x33, 0x6d, 0x00, 0xff, 0x33,
-  0xa9, 0x30, 0x00, 0x93, 0x00, 0x22, 0x00, 0x23, 0x00, 0x21, 0x03, 0x96,
-  0x01, 0x95, 0xff, 0x30, 0x00, 0xf0, 0xbc, 0xf9, 0x23, 0x00, 0x20, 0x00,
-  0x44, 0x33, 0xa8, 0x34, 0x02, 0x93, 0x01, 0x22, 0x00, 0x23, 0x00, 0x21,
-  0x03, 0x96, 0x01, 0x95, 0x00, 0x94, 0x84, 0x30, 0x00, 0xf0, 0xae, 0xf9,
-  0x04, 0xb0, 0x70, 0xbd, 0x74, 0x18, 0x00, 0x20, 0x10, 0xb5, 0x05, 0x4c,
-  0x20, 0x00, 0x00, 0xf0, 0xdb, 0xf9, 0x20, 0x00, 0x25, 0x38, 0xff, 0x38,
-  0x00, 0xf0, 0xd6, 0xf9, 0x01, 0x20, 0x10, 0xbd, 0x1c, 0x1a, 0x00, 0x20,
-  0x10, 0xb5, 0x06, 0x4c, 0x00, 0x23, 0x20, 0x00, 0xb1, 0x30, 0xff, 0x30,
-  0x23, 0x70, 0x00, 0xf0, 0xc7, 0xfc, 0x20, 0x00, 0x8c, 0x30, 0x00, 0xf0,
-  0xc3, 0xfc, 0x10, 0xbd, 0x74, 0x18, 0x00, 0x20, 0xf0, 0xb5, 0x57, 0x46,
-  0x45, 0x46, 0xde, 0x46, 0x4e, 0x46, 0xe0, 0xb5, 0x4b, 0x79, 0x80, 0x46,
-  0x0f, 0x00, 0x83, 0xb0, 0xff, 0x2b, 0x28, 0xd1, 0x45, 0x4b, 0x0c, 0x78,
-  0x99, 0x46, 0xaa, 0x23, 0x49, 0x46, 0xff, 0x33, 0xcb, 0x5c, 0x00, 0x2b,
-  0x1f, 0xd1, 0x85, 0x33, 0xce, 0x5c, 0x00, 0x2e, 0x1b, 0xd1, 0xbb, 0x78,
-  0x3c, 0x19, 0x0b, 0x70, 0x3b, 0x79, 0x00, 0x2b, 0x12, 0xd0, 0xd8, 0x23,
-  0x5b, 0x00, 0x4b, 0x44, 0x9a, 0x46, 0x8c, 0x23, 0x4b, 0x44, 0x9b, 0x46,
-  0xa5, 0x18, 0x63, 0x78, 0x05, 0x2b, 0x05, 0xd1, 0x11, 0xe0, 0x23, 0x78,
-  0xe4, 0x18, 0x63, 0x78, 0x05, 0x2b, 0x0c, 0xd0, 0xac, 0x42, 0xf8, 0xd3,
-  0xe0, 0x1b, 0x80, 0xb2, 0x00, 0xe0, 0x00, 0x20, 0x03, 0xb0, 0xf0, 0xbc,
-  0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46, 0xf0, 0xbd, 0xa5, 0x42,
-  0xf2, 0xd9, 0x21, 0x00, 0x40, 0x46, 0xff, 0xf7, 0x3d, 0xfb, 0x00, 0x28,
-  0xef, 0xd0, 0xa3, 0x78, 0x01, 0x36, 0xf6, 0xb2, 0xdb, 0x09, 0x01, 0x2b,
-  0x29, 0xd0, 0x50, 0x46, 0x00, 0xf0, 0x72, 0xfc, 0xaa, 0x23, 0x49, 0x46,
-  0xa2, 0x78, 0xff, 0x33, 0xca, 0x54, 0x63, 0x79, 0x22, 0x79, 0x1b, 0x02,
-  0x13, 0x43, 0x21, 0x4a, 0x5b, 0x05, 0x94, 0x46, 0x5b, 0x0d, 0xd4, 0x21,
-  0x63, 0x44, 0x5a, 0x42, 0x53, 0x41, 0x4a, 0x46, 0x02, 0x20, 0x49, 0x00,
-  0x52, 0x5c, 0x5b, 0x00, 0x82, 0x43, 0x13, 0x43, 0x4a, 0x46, 0x53, 0x54,
-  0x51, 0x46, 0x40, 0x46, 0x08, 0x39, 0x00, 0xf0, 0xbd, 0xf9, 0x00, 0x28,
-  0xc5, 0xd0, 0x23, 0x78, 0xe4, 0x18, 0x3b, 0x79, 0xb3, 0x42, 0xb2, 0xd8,
-  0xbc, 0xe7, 0x58, 0x46, 0x00, 0xf0, 0x48, 0xfc, 0x5a, 0x46, 0x85, 0x23,
-  0xa1, 0x78, 0x8c, 0x3a, 0xd1, 0x54, 0x63, 0x79, 0x21, 0x79, 0x1b, 0x02,
-  0x0b, 0x43, 0x0c, 0x49, 0x5b, 0x05, 0x8c, 0x46, 0x5b, 0x0d, 0x63, 0x44,
-  0x59, 0x42, 0x4b, 0x41, 0x84, 0x21, 0x5b, 0x00, 0x01, 0x93, 0x02, 0x23,
-  0x50, 0x5c, 0x98, 0x43, 0x01, 0x9b, 0x03, 0x43, 0x53, 0x54, 0x59, 0x46,
-  0x00, 0x20, 0x08, 0x39, 0x00, 0xf0, 0x62, 0xf9, 0xd7, 0xe7, 0xc0, 0x46,
-  0x74, 0x18, 0x00, 0x20, 0x00, 0xfe, 0xff, 0xff, 0xf8, 0xb5, 0xaa, 0x25,
-  0x06, 0x00, 0x1f, 0x48, 0xff, 0x35, 0x45, 0x5d, 0x1f, 0x00, 0x8d, 0x42,
-  0x15, 0xd0, 0x85, 0x23, 0xc3, 0x5c, 0x00, 0x20, 0x8b, 0x42, 0x0f, 0xd1,
-  0x1a, 0x4b, 0x00, 0x2b, 0x04, 0xd0, 0x39, 0x04, 0x00, 0x20, 0x09, 0x0c,
-  0x00, 0xe0, 0x00, 0xbf, 0x17, 0x4c, 0x30, 0x00, 0x21, 0x00, 0x00, 0xf0,
-  0x41, 0xf9, 0x00, 0x28, 0x14, 0xd0, 0x01, 0x20, 0xf8, 0xbd, 0xda, 0x23,
-  0x5b, 0x00, 0xc3, 0x5a, 0x00, 0x2b, 0x14, 0xd1, 0x11, 0x4b, 0x00, 0x2b,
-  0x04, 0xd0, 0x00, 0x20, 0x10, 0x49, 0xba, 0xb2, 0x00, 0xe0, 0x00, 0xbf,
-  0x30, 0x00, 0x0f, 0x49, 0x00, 0xf0, 0x5e, 0xf9, 0x01, 0x20, 0xeb, 0xe7,
-  0x3a, 0x00, 0x21, 0x00, 0x30, 0x00, 0x00, 0xf0, 0xf1, 0xf8, 0x01, 0x20,
-  0xe4, 0xe7, 0xd6, 0x23, 0x5b, 0x00, 0xc1, 0x58, 0xb1, 0x30, 0xba, 0xb2,
-  0xff, 0x30, 0x00, 0xf0, 0x2b, 0xfb, 0xe1, 0xe7, 0x74, 0x18, 0x00, 0x20,
-  0x00, 0x00, 0x00, 0x00, 0xf8, 0x18, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00,
-  0x78, 0x18, 0x00, 0x20, 0x1c, 0x1a, 0x00, 0x20, 0x10, 0xb5, 0x00, 0x20,
-  0xfe, 0xf7, 0xce, 0xfd, 0x10, 0xbd, 0xc0, 0x46, 0x03, 0x78, 0x70, 0xb5,
-  0xdb, 0x07, 0x04, 0x00, 0x0e, 0x00, 0xdd, 0x0f, 0x00, 0x2b, 0x17, 0xd1,
-  0x03, 0x78, 0x5b, 0x07, 0x01, 0xd5, 0x28, 0x00, 0x70, 0xbd, 0x01, 0x21,
-  0x30, 0x00, 0x49, 0x42, 0x00, 0xf0, 0x6a, 0xfc, 0x23, 0x78, 0xdb, 0x07,
-  0xdd, 0x0f, 0x00, 0x2b, 0x0a, 0xd1, 0x23, 0x78, 0x5b, 0x07, 0x08, 0xd4,
-  0x04, 0x22, 0x23, 0x78, 0x01, 0x25, 0x13, 0x43, 0x23, 0x70, 0x02, 0xe0,
-  0x00, 0x25, 0xe8, 0xe7, 0x00, 0x25, 0x30, 0x00, 0x00, 0xf0, 0x26, 0xfc,
-  0xe3, 0xe7, 0xc0, 0x46, 0x70, 0xb5, 0x0c, 0x00, 0x01, 0x21, 0x06, 0x00,
-  0x49, 0x42, 0x20, 0x00, 0x00, 0xf0, 0x4c, 0xfc, 0x33, 0x78, 0x5b, 0x07,
-  0xdd, 0x0f, 0x00, 0x2b, 0x04, 0xdb, 0x20, 0x00, 0x00, 0xf0, 0x14, 0xfc,
-  0x28, 0x00, 0x70, 0xbd, 0x33, 0x78, 0xdb, 0x07, 0x04, 0xd4, 0x04, 0x22,
-  0x33, 0x78, 0x93, 0x43, 0x33, 0x70, 0xf2, 0xe7, 0x00, 0x25, 0xf0, 0xe7,
-  0x43, 0x79, 0x02, 0x79, 0x1b, 0x02, 0x13, 0x43, 0x5b, 0x05, 0x5a, 0x0d,
-  0xc3, 0x78, 0x9b, 0x07, 0x9b, 0x0f, 0x02, 0x2b, 0x05, 0xd0, 0x03, 0x2b,
-  0x15, 0xd0, 0x00, 0x20, 0x01, 0x2b, 0x08, 0xd0, 0x70, 0x47, 0x02, 0x29,
-  0x1e, 0xd0, 0x00, 0x20, 0x40, 0x23, 0x93, 0x42, 0x40, 0x41, 0xc0, 0xb2,
-  0xf6, 0xe7, 0x02, 0x39, 0x4b, 0x42, 0x59, 0x41, 0x0d, 0x4b, 0x9c, 0x46,
-  0x61, 0x44, 0x91, 0x42, 0x40, 0x41, 0xc0, 0xb2, 0xec, 0xe7, 0x02, 0x39,
-  0x4b, 0x1e, 0x99, 0x41, 0x09, 0x4b, 0x49, 0x42, 0x19, 0x40, 0x80, 0x23,
-  0xdb, 0x00, 0x9c, 0x46, 0x00, 0x20, 0x61, 0x44, 0x91, 0x42, 0x40, 0x41,
-  0xc0, 0xb2, 0xdd, 0xe7, 0x04, 0x4b, 0xd0, 0x18, 0x43, 0x42, 0x58, 0x41,
-  0xc0, 0xb2, 0xd7, 0xe7, 0xff, 0x03, 0x00, 0x00, 0x40, 0xfc, 0xff, 0xff,
-  0x00, 0xfe, 0xff, 0xff, 0x8a, 0x18, 0x70, 0xb5, 0x91, 0x42, 0x07, 0xd2,
-  0x7f, 0x26, 0x4c, 0x78, 0x05, 0x2c, 0x04, 0xd0, 0x0c, 0x78, 0x09, 0x19,
-  0x8a, 0x42, 0xf8, 0xd8, 0x70, 0xbd, 0x34, 0x00, 0x8d, 0x78, 0x2c, 0x40,
-  0x64, 0x00, 0x04, 0x19, 0xed, 0x09, 0x63, 0x55, 0x0c, 0x78, 0x09, 0x19,
-  0x8a, 0x42, 0xec, 0xd8, 0xf2, 0xe7, 0xc0, 0x46, 0xf0, 0xb5, 0xc6, 0x46,
-  0x00, 0xb5, 0x82, 0xb0, 0x15, 0x00, 0x08, 0xaa, 0x40, 0xca, 0x04, 0x00,
-  0x17, 0x88, 0x0b, 0xaa, 0x12, 0x88, 0x01, 0x20, 0x90, 0x46, 0x0a, 0x00,
-  0x21, 0x78, 0x02, 0x40, 0x81, 0x43, 0x20, 0x00, 0x11, 0x43, 0x21, 0x70,
-  0x3a, 0x00, 0x00, 0x93, 0x31, 0x00, 0x01, 0x23, 0x08, 0x30, 0x00, 0xf0,
-  0xf1, 0xf8, 0x00, 0x2e, 0x01, 0xd0, 0x00, 0x2f, 0x08, 0xd1, 0x0a, 0x9b,
-  0x01, 0x20, 0x63, 0x60, 0x43, 0x46, 0x63, 0x80, 0x02, 0xb0, 0x80, 0xbc,
-  0xb8, 0x46, 0xf0, 0xbd, 0x26, 0x00, 0x1c, 0x36, 0x30, 0x00, 0xfa, 0xf7,
-  0x9d, 0xfa, 0x00, 0x23, 0x00, 0x2d, 0x01, 0xd0, 0x33, 0x00, 0x00, 0x26,
-  0x63, 0x61, 0xa6, 0x61, 0xe9, 0xe7, 0xc0, 0x46, 0x01, 0x20, 0x70, 0x47,
-  0xf8, 0xb5, 0x02, 0x24, 0x0b, 0x78, 0x07, 0x00, 0x1c, 0x40, 0x63, 0x42,
-  0x5c, 0x41, 0x14, 0x4b, 0x64, 0x42, 0x1c, 0x40, 0x13, 0x4b, 0x08, 0x00,
-  0x9c, 0x46, 0x08, 0x30, 0x0d, 0x00, 0x16, 0x00, 0x64, 0x44, 0x00, 0xf0,
-  0xf7, 0xf8, 0x00, 0x28, 0x07, 0xd1, 0x00, 0x2e, 0x05, 0xd0, 0x34, 0x42,
-  0x03, 0xd1, 0x01, 0x24, 0x2b, 0x78, 0x1c, 0x42, 0x01, 0xd0, 0x00, 0x20,
-  0xf8, 0xbd, 0x38, 0x00, 0x69, 0x78, 0xff, 0xf7, 0xb3, 0xf9, 0x00, 0x28,
-  0xf7, 0xd0, 0x2b, 0x78, 0x1c, 0x42, 0xf4, 0xd1, 0x00, 0x23, 0x00, 0x22,
-  0x38, 0x00, 0x69, 0x78, 0xff, 0xf7, 0xd0, 0xf9, 0xee, 0xe7, 0xc0, 0x46,
-  0x40, 0xfe, 0xff, 0xff, 0xff, 0x01, 0x00, 0x00, 0xf8, 0xb5, 0x0d, 0x00,
-  0x08, 0x35, 0x06, 0x00, 0x28, 0x00, 0x0c, 0x00, 0x00, 0xf0, 0xce, 0xf8,
-  0x00, 0x28, 0x03, 0xd0, 0x01, 0x27, 0x23, 0x78, 0x1f, 0x42, 0x01, 0xd0,
-  0x00, 0x20, 0xf8, 0xbd, 0x30, 0x00, 0x61, 0x78, 0xff, 0xf7, 0x8e, 0xf9,
-  0x00, 0x28, 0xf7, 0xd0, 0x28, 0x00, 0x62, 0x88, 0x61, 0x68, 0x00, 0xf0,
-  0x3d, 0xf9, 0x23, 0x78, 0x05, 0x1e, 0x0b, 0xd0, 0x1f, 0x42, 0xed, 0xd1,
-  0x03, 0x00, 0x62, 0x68, 0x30, 0x00, 0x61, 0x78, 0xff, 0xf7, 0xa4, 0xf9,
-  0x00, 0x28, 0xe5, 0xd0, 0x28, 0x00, 0xe4, 0xe7, 0x1f, 0x42, 0xe1, 0xd1,
-  0x30, 0x00, 0x61, 0x78, 0xff, 0xf7, 0x86, 0xf9, 0xdc, 0xe7, 0xc0, 0x46,
-  0xf8, 0xb5, 0xce, 0x46, 0x47, 0x46, 0x80, 0xb5, 0x8b, 0x89, 0x05, 0x00,
-  0x0c, 0x00, 0x00, 0x2b, 0x08, 0xd1, 0x01, 0x26, 0x0b, 0x78, 0x1e, 0x42,
-  0x40, 0xd0, 0x00, 0x20, 0xc0, 0xbc, 0xb9, 0x46, 0xb0, 0x46, 0xf8, 0xbd,
-  0x0b, 0x78, 0x9b, 0x07, 0x34, 0xd5, 0xfe, 0x23, 0x80, 0x26, 0x1b, 0x02,
-  0x99, 0x46, 0xb6, 0x00, 0x27, 0x00, 0x08, 0x37, 0x38, 0x00, 0x00, 0xf0,
-  0xa3, 0xf8, 0x86, 0x42, 0xeb, 0xd8, 0x01, 0x22, 0x23, 0x78, 0x90, 0x46,
-  0x1a, 0x42, 0xe6, 0xd1, 0x28, 0x00, 0x61, 0x78, 0xff, 0xf7, 0x46, 0xf9,
-  0x00, 0x28, 0xe0, 0xd0, 0x38, 0x00, 0x00, 0xf0, 0x93, 0xf8, 0x86, 0x42,
-  0x31, 0xd8, 0x41, 0x46, 0x23, 0x78, 0x62, 0x88, 0x19, 0x42, 0xd6, 0xd1,
-  0x4b, 0x46, 0x03, 0x40, 0x1e, 0x1c, 0x93, 0x42, 0x00, 0xd9, 0x16, 0x1c,
-  0xb6, 0xb2, 0x00, 0x22, 0x61, 0x78, 0x00, 0x2e, 0x00, 0xd0, 0x62, 0x68,
-  0x33, 0x00, 0x28, 0x00, 0xff, 0xf7, 0x52, 0xf9, 0x00, 0x28, 0xc4, 0xd0,
-  0x30, 0x00, 0xc3, 0xe7, 0x10, 0x4b, 0x40, 0x26, 0x99, 0x46, 0xcb, 0xe7,
-  0x49, 0x78, 0xff, 0xf7, 0x1f, 0xf9, 0x00, 0x28, 0xb9, 0xd0, 0x22, 0x78,
-  0x63, 0x88, 0x16, 0x42, 0xb5, 0xd1, 0x00, 0x22, 0x61, 0x78, 0x00, 0x2b,
-  0x00, 0xd0, 0x62, 0x68, 0x28, 0x00, 0xff, 0xf7, 0x39, 0xf9, 0x00, 0x28,
-  0xab, 0xd0, 0x60, 0x88, 0xaa, 0xe7, 0x42, 0x46, 0x23, 0x78, 0x1a, 0x42,
-  0xa5, 0xd1, 0x28, 0x00, 0x61, 0x78, 0xff, 0xf7, 0x19, 0xf9, 0xa0, 0xe7,
-  0xc0, 0xff, 0x00, 0x00, 0xf0, 0xb5, 0xc6, 0x46, 0x00, 0xb5, 0x04, 0x00,
-  0x06, 0xa8, 0x05, 0x78, 0x80, 0x20, 0x88, 0x46, 0x17, 0x00, 0x1e, 0x00,
-  0x00, 0x02, 0x82, 0x42, 0x26, 0xd8, 0xe0, 0x68, 0x00, 0x28, 0x03, 0xd0,
-  0x01, 0x21, 0x49, 0x42, 0x00, 0xf0, 0xc0, 0xfa, 0x20, 0x69, 0x00, 0x28,
-  0x03, 0xd0, 0x01, 0x21, 0x49, 0x42, 0x00, 0xf0, 0xb9, 0xfa, 0x43, 0x46,
-  0x23, 0x60, 0x73, 0x04, 0x5b, 0x0c, 0xed, 0x03, 0x1d, 0x43, 0x00, 0x23,
-  0xe0, 0x68, 0x63, 0x81, 0xa7, 0x80, 0xe5, 0x80, 0x23, 0x81, 0x00, 0x28,
-  0x01, 0xd0, 0x00, 0xf0, 0x79, 0xfa, 0x20, 0x69, 0x00, 0x28, 0x01, 0xd0,
-  0x00, 0xf0, 0x74, 0xfa, 0x01, 0x20, 0x80, 0xbc, 0xb8, 0x46, 0xf0, 0xbd,
-  0x00, 0x20, 0xfa, 0xe7, 0x10, 0xb5, 0x04, 0x89, 0x41, 0x89, 0x82, 0x88,
-  0xa3, 0xb2, 0x88, 0xb2, 0x8c, 0x42, 0x07, 0xd3, 0x1b, 0x1a, 0x9b, 0xb2,
-  0x10, 0x1c, 0x9a, 0x42, 0x00, 0xd9, 0x18, 0x1c, 0x80, 0xb2, 0x10, 0xbd,
-  0x51, 0x00, 0x09, 0x1a, 0x5b, 0x18, 0x9b, 0xb2, 0xf4, 0xe7, 0xc0, 0x46,
-  0x03, 0x89, 0x40, 0x89, 0x18, 0x1a, 0x43, 0x42, 0x58, 0x41, 0xc0, 0xb2,
-  0x70, 0x47, 0xc0, 0x46, 0x10, 0xb5, 0x04, 0x89, 0x41, 0x89, 0x82, 0x88,
-  0xa3, 0xb2, 0x88, 0xb2, 0x8c, 0x42, 0x07, 0xd3, 0x1b, 0x1a, 0x9b, 0xb2,
-  0x00, 0x20, 0x9a, 0x42, 0x01, 0xd9, 0xd2, 0x1a, 0x90, 0xb2, 0x10, 0xbd,
-  0x51, 0x00, 0x09, 0x1a, 0x5b, 0x18, 0x9b, 0xb2, 0xf4, 0xe7, 0xc0, 0x46,
-  0x70, 0xb5, 0x04, 0x00, 0x00, 0x69, 0x0e, 0x00, 0x00, 0x28, 0x03, 0xd0,
-  0x01, 0x21, 0x49, 0x42, 0x00, 0xf0, 0x60, 0xfa, 0x25, 0x89, 0x60, 0x89,
-  0xa2, 0x88, 0xa9, 0xb2, 0x83, 0xb2, 0x85, 0x42, 0x2b, 0xd3, 0xcd, 0x1a,
-  0xad, 0xb2, 0x00, 0x2d, 0x2d, 0xd0, 0xaa, 0x42, 0x08, 0xd2, 0x91, 0x42,
-  0x2f, 0xd3, 0x89, 0x1a, 0x8b, 0xb2, 0x63, 0x81, 0x9a, 0x42, 0x03, 0xd8,
-  0x9b, 0x1a, 0x9b, 0xb2, 0x9a, 0x42, 0xfb, 0xd9, 0xe2, 0x88, 0x21, 0x68,
-  0x52, 0x04, 0x52, 0x0c, 0x53, 0x43, 0x30, 0x00, 0xc9, 0x18, 0xfb, 0xf7,
-  0xc9, 0xff, 0x63, 0x89, 0x01, 0x25, 0x59, 0x1c, 0x89, 0xb2, 0xa2, 0x88,
-  0x8b, 0x42, 0x12, 0xd9, 0x52, 0x00, 0x89, 0x1a, 0x89, 0xb2, 0x20, 0x69,
-  0x61, 0x81, 0x00, 0x28, 0x01, 0xd0, 0x00, 0xf0, 0xff, 0xf9, 0x28, 0x00,
-  0x70, 0xbd, 0x55, 0x00, 0xed, 0x1a, 0x4d, 0x19, 0xad, 0xb2, 0x00, 0x2d,
-  0xd1, 0xd1, 0x61, 0x89, 0x89, 0xb2, 0x52, 0x00, 0x91, 0x42, 0xec, 0xdb,
-  0xe9, 0xe7, 0x89, 0x18, 0x8b, 0xb2, 0x63, 0x81, 0xce, 0xe7, 0xc0, 0x46,
-  0xf0, 0xb5, 0x46, 0x46, 0x4f, 0x46, 0xd6, 0x46, 0xc0, 0xb5, 0x06, 0x00,
-  0x00, 0x69, 0x89, 0x46, 0x90, 0x46, 0x00, 0x28, 0x03, 0xd0, 0x01, 0x21,
-  0x49, 0x42, 0x00, 0xf0, 0x0d, 0xfa, 0x31, 0x89, 0x72, 0x89, 0xb5, 0x88,
-  0x8b, 0xb2, 0x94, 0xb2, 0x91, 0x42, 0x54, 0xd3, 0x1f, 0x1b, 0xbf, 0xb2,
-  0x00, 0x2f, 0x4a, 0xd0, 0xbd, 0x42, 0x05, 0xd2, 0xab, 0x42, 0x51, 0xd2,
-  0x5b, 0x19, 0x9c, 0xb2, 0x2f, 0x00, 0x74, 0x81, 0x43, 0x46, 0xb8, 0x45,
-  0x3d, 0xd8, 0x9f, 0xb2, 0xa5, 0x42, 0x03, 0xd8, 0x64, 0x1b, 0xa4, 0xb2,
-  0xa5, 0x42, 0xfb, 0xd9, 0xf2, 0x88, 0x31, 0x68, 0x52, 0x04, 0x52, 0x0c,
-  0x90, 0x46, 0x62, 0x43, 0x2b, 0x1b, 0x9b, 0xb2, 0x89, 0x18, 0x42, 0x46,
-  0x9f, 0x42, 0x25, 0xd9, 0x53, 0x43, 0x9b, 0xb2, 0x1a, 0x00, 0x48, 0x46,
-  0x9a, 0x46, 0xfb, 0xf7, 0x67, 0xff, 0x43, 0x46, 0x48, 0x46, 0x7d, 0x1b,
-  0x64, 0x19, 0x5c, 0x43, 0x31, 0x68, 0x50, 0x44, 0xa2, 0xb2, 0xfb, 0xf7,
-  0x5d, 0xff, 0x71, 0x89, 0xb5, 0x88, 0xcb, 0x19, 0x9b, 0xb2, 0x6a, 0x00,
-  0x99, 0x42, 0x16, 0xd9, 0x9b, 0x1a, 0x9b, 0xb2, 0x30, 0x69, 0x73, 0x81,
-  0x00, 0x28, 0x01, 0xd0, 0x00, 0xf0, 0x94, 0xf9, 0x38, 0x00, 0xe0, 0xbc,
-  0xba, 0x46, 0xb1, 0x46, 0xa8, 0x46, 0xf0, 0xbd, 0x48, 0x46, 0x7a, 0x43,
-  0xfb, 0xf7, 0x44, 0xff, 0xe5, 0xe7, 0x3b, 0x1c, 0xbf, 0xe7, 0x73, 0x89,
-  0x9b, 0xb2, 0x6a, 0x00, 0x93, 0x42, 0xe7, 0xdb, 0xe4, 0xe7, 0x6f, 0x00,
-  0x3f, 0x1b, 0xdf, 0x19, 0xbf, 0xb2, 0xa7, 0xe7, 0x5b, 0x1b, 0x9c, 0xb2,
-  0xac, 0xe7, 0xc0, 0x46, 0xf8, 0xb5, 0x04, 0x00, 0xc0, 0x68, 0x0e, 0x00,
-  0x00, 0x28, 0x03, 0xd0, 0x01, 0x21, 0x49, 0x42, 0x00, 0xf0, 0x9e, 0xf9,
-  0x25, 0x89, 0x20, 0x89, 0x61, 0x89, 0xa2, 0x88, 0xad, 0xb2, 0x83, 0xb2,
-  0x8f, 0xb2, 0x88, 0x42, 0x28, 0xd3, 0xdb, 0x1b, 0x9b, 0xb2, 0x9a, 0x42,
-  0x09, 0xd8, 0xe7, 0x79, 0xff, 0x09, 0x06, 0xd1, 0xe0, 0x68, 0x00, 0x28,
-  0x01, 0xd0, 0x00, 0xf0, 0x59, 0xf9, 0x38, 0x00, 0xf8, 0xbd, 0x2b, 0x00,
-  0x95, 0x42, 0x03, 0xd3, 0x9b, 0x1a, 0x9b, 0xb2, 0x93, 0x42, 0xfb, 0xd2,
-  0xe2, 0x88, 0x20, 0x68, 0x52, 0x04, 0x52, 0x0c, 0x53, 0x43, 0x31, 0x00,
-  0xc0, 0x18, 0xfb, 0xf7, 0x01, 0xff, 0xa2, 0x88, 0x6b, 0x1c, 0x9b, 0xb2,
-  0x52, 0x00, 0x9d, 0x42, 0x09, 0xd9, 0x9b, 0x1a, 0x9b, 0xb2, 0x01, 0x27,
-  0x23, 0x81, 0xdd, 0xe7, 0x51, 0x00, 0xc9, 0x1b, 0x5b, 0x18, 0x9b, 0xb2,
-  0xd3, 0xe7, 0x93, 0x42, 0xf5, 0xdb, 0xf2, 0xe7, 0xf0, 0xb5, 0x45, 0x46,
-  0xde, 0x46, 0x57, 0x46, 0x4e, 0x46, 0xe0, 0xb5, 0x88, 0x46, 0x05, 0x00,
-  0x14, 0x00, 0x83, 0xb0, 0x00, 0x2a, 0x6f, 0xd0, 0xc0, 0x68, 0x00, 0x28,
-  0x03, 0xd0, 0x01, 0x21, 0x49, 0x42, 0x00, 0xf0, 0x51, 0xf9, 0x2e, 0x89,
-  0xeb, 0x79, 0x6a, 0x89, 0xb6, 0xb2, 0x92, 0xb2, 0xdb, 0x09, 0x40, 0xd1,
-  0xab, 0x88, 0x96, 0x42, 0x67, 0xd2, 0x59, 0x00, 0x8a, 0x1a, 0xb2, 0x18,
-  0x92, 0xb2, 0x00, 0x27, 0x93, 0x42, 0x30, 0xd9, 0x9a, 0x1a, 0x17, 0x1c,
-  0x92, 0xb2, 0xa2, 0x42, 0x00, 0xd9, 0x27, 0x1c, 0xea, 0x88, 0xbf, 0xb2,
-  0x52, 0x04, 0x52, 0x0c, 0x91, 0x46, 0xf2, 0x19, 0x92, 0xb2, 0x92, 0x46,
-  0xfa, 0x1a, 0x92, 0xb2, 0x93, 0x46, 0x34, 0x00, 0x9e, 0x42, 0x03, 0xd3,
-  0xe4, 0x1a, 0xa4, 0xb2, 0x9c, 0x42, 0xfb, 0xd2, 0x4a, 0x46, 0x62, 0x43,
-  0x28, 0x68, 0x1b, 0x1b, 0x9b, 0xb2, 0x80, 0x18, 0x4a, 0x46, 0xbb, 0x42,
-  0x53, 0xd3, 0x41, 0x46, 0x7a, 0x43, 0xfb, 0xf7, 0xa5, 0xfe, 0xab, 0x88,
-  0x5b, 0x00, 0x56, 0x45, 0x01, 0xd8, 0x9a, 0x45, 0x03, 0xdb, 0x52, 0x46,
-  0xd3, 0x1a, 0x9b, 0xb2, 0x9a, 0x46, 0x53, 0x46, 0x2b, 0x81, 0xe8, 0x68,
-  0x00, 0x28, 0x24, 0xd0, 0x00, 0xf0, 0xda, 0xf8, 0x21, 0xe0, 0xaf, 0x88,
-  0xbc, 0x42, 0x29, 0xd2, 0x96, 0x42, 0x4a, 0xd3, 0xb3, 0x1a, 0x9b, 0xb2,
-  0x79, 0x00, 0x1b, 0x19, 0x8b, 0x42, 0x08, 0xdb, 0xd3, 0x19, 0x9b, 0xb2,
-  0x1e, 0x1b, 0xb6, 0xb2, 0x9a, 0x46, 0xb2, 0x42, 0x42, 0xd9, 0x76, 0x1a,
-  0xb6, 0xb2, 0xeb, 0x88, 0x5b, 0x04, 0x5b, 0x0c, 0x99, 0x46, 0xa3, 0x19,
-  0x9b, 0xb2, 0x9a, 0x46, 0xe3, 0x1b, 0x9b, 0xb2, 0x9b, 0x46, 0x3b, 0x00,
-  0x27, 0x00, 0xb8, 0xe7, 0x00, 0x27, 0x38, 0x00, 0x03, 0xb0, 0xf0, 0xbc,
-  0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46, 0xf0, 0xbd, 0xb2, 0x1a,
-  0x92, 0xb2, 0x98, 0xe7, 0x00, 0x2f, 0xca, 0xd0, 0xeb, 0x88, 0xe4, 0x1b,
-  0x5b, 0x04, 0x5b, 0x0c, 0x5c, 0x43, 0x99, 0x46, 0x16, 0x00, 0xd3, 0x19,
-  0x00, 0x22, 0x9b, 0xb2, 0x9a, 0x46, 0x93, 0x46, 0x3b, 0x00, 0xa0, 0x44,
-  0x9b, 0xe7, 0x53, 0x43, 0x99, 0xb2, 0x0a, 0x00, 0x01, 0x91, 0x5c, 0x44,
-  0x41, 0x46, 0xfb, 0xf7, 0x4d, 0xfe, 0x22, 0x00, 0x4b, 0x46, 0x5a, 0x43,
-  0x01, 0x99, 0x28, 0x68, 0x92, 0xb2, 0x41, 0x44, 0xfb, 0xf7, 0x44, 0xfe,
-  0x9d, 0xe7, 0x79, 0x00, 0x8b, 0x1a, 0xf3, 0x18, 0x9b, 0xb2, 0xb2, 0xe7,
-  0xb1, 0x42, 0xba, 0xdd, 0xeb, 0x88, 0x5b, 0x04, 0x5b, 0x0c, 0x99, 0x46,
-  0xbe, 0xe7, 0xc0, 0x46, 0x10, 0xb5, 0x04, 0x00, 0xc0, 0x68, 0x00, 0x28,
-  0x03, 0xd0, 0x01, 0x21, 0x49, 0x42, 0x00, 0xf0, 0xa3, 0xf8, 0x20, 0x69,
-  0x00, 0x28, 0x03, 0xd0, 0x01, 0x21, 0x49, 0x42, 0x00, 0xf0, 0x9c, 0xf8,
-  0x00, 0x23, 0xe0, 0x68, 0x63, 0x81, 0x23, 0x81, 0x00, 0x28, 0x01, 0xd0,
-  0x00, 0xf0, 0x64, 0xf8, 0x20, 0x69, 0x00, 0x28, 0x01, 0xd0, 0x00, 0xf0,
-  0x5f, 0xf8, 0x01, 0x20, 0x10, 0xbd, 0xc0, 0x46, 0x70, 0xb5, 0x04, 0x00,
-  0xc0, 0x68, 0x0d, 0x00, 0x00, 0x28, 0x03, 0xd0, 0x01, 0x21, 0x49, 0x42,
-  0x00, 0xf0, 0x82, 0xf8, 0x20, 0x69, 0x00, 0x28, 0x03, 0xd0, 0x01, 0x21,
-  0x49, 0x42, 0x00, 0xf0, 0x7b, 0xf8, 0x7f, 0x21, 0xe3, 0x79, 0xed, 0x01,
-  0x19, 0x40, 0xe0, 0x68, 0x29, 0x43, 0xe1, 0x71, 0x00, 0x28, 0x01, 0xd0,
-  0x00, 0xf0, 0x40, 0xf8, 0x20, 0x69, 0x00, 0x28, 0x01, 0xd0, 0x00, 0xf0,
-  0x3b, 0xf8, 0x01, 0x20, 0x70, 0xbd, 0xc0, 0x46, 0x10, 0xb5, 0x83, 0x07,
-  0x0a, 0xd0, 0x03, 0x00, 0x03, 0x21, 0x02, 0xe0, 0x01, 0x33, 0x0b, 0x42,
-  0x05, 0xd0, 0x1a, 0x78, 0x00, 0x2a, 0xf9, 0xd1, 0x18, 0x1a, 0x10, 0xbd,
-  0x03, 0x00, 0x19, 0x68, 0x0c, 0x4a, 0x0d, 0x4c, 0x8a, 0x18, 0x8a, 0x43,
-  0x22, 0x42, 0x0f, 0xd1, 0x59, 0x68, 0x09, 0x4a, 0x04, 0x33, 0x8a, 0x18,
-  0x8a, 0x43, 0x22, 0x42, 0x08, 0xd1, 0x59, 0x68, 0x05, 0x4a, 0x04, 0x33,
-  0x8a, 0x18, 0x8a, 0x43, 0x22, 0x42, 0xf1, 0xd0, 0x00, 0xe0, 0x01, 0x33,
-  0x1a, 0x78, 0x00, 0x2a, 0xfb, 0xd1, 0xe1, 0xe7, 0xff, 0xfe, 0xfe, 0xfe,
-  0x80, 0x80, 0x80, 0x80, 0xf8, 0xb5, 0xc0, 0x46, 0x01, 0xb4, 0x02, 0x48,
-  0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf, 0xc9, 0x02, 0x00, 0x20,
-  0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf,
-  0x2d, 0x02, 0x00, 0x20, 0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc,
-  0x60, 0x47, 0x00, 0xbf, 0x19, 0x0f, 0x00, 0x20, 0x01, 0xb4, 0x02, 0x48,
-  0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf, 0x89, 0x03, 0x00, 0x20,
-  0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf,
-  0x19, 0x0f, 0x00, 0x20, 0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc,
-  0x60, 0x47, 0x00, 0xbf, 0xd1, 0x0b, 0x00, 0x20, 0x01, 0xb4, 0x02, 0x48,
-  0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf, 0xc1, 0x00, 0x00, 0x20,
-  0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf,
-  0x9d, 0x01, 0x00, 0x20, 0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc,
-  0x60, 0x47, 0x00, 0xbf, 0x01, 0x01, 0x00, 0x20, 0x01, 0xb4, 0x02, 0x48,
-  0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf, 0x89, 0x0c, 0x00, 0x20,
-  0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf,
-  0xf9, 0x0b, 0x00, 0x20, 0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc,
-  0x60, 0x47, 0x00, 0xbf, 0x39, 0x0c, 0x00, 0x20, 0xbd, 0x19, 0x00, 0x10,
-  0xe9, 0x19, 0x00, 0x10, 0x35, 0x1b, 0x00, 0x10, 0x91, 0x28, 0x00, 0x10,
-  0xc9, 0x21, 0x00, 0x10, 0x01, 0x28, 0x00, 0x10, 0x5d, 0x1a, 0x00, 0x10,
-  0x05, 0x1a, 0x00, 0x10, 0x25, 0x1a, 0x00, 0x10, 0x39, 0x1a, 0x00, 0x10,
-  0x15, 0x0b, 0x00, 0x10, 0x41, 0x1a, 0x00, 0x10, 0xf1, 0x0e, 0x00, 0x10,
-  0x85, 0x19, 0x00, 0x10, 0x6d, 0x05, 0x00, 0x10, 0xfd, 0x02, 0x00, 0x10,
-  0x01, 0x4b, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x48, 0x65, 0x6c, 0x6c,
-  0x6f, 0x20, 0x57, 0x6f, 0x72, 0x6c, 0x64, 0x00, 0x4c, 0x6f, 0x6f, 0x70,
-  0x20, 0x32, 0x20, 0x25, 0x75, 0x0a, 0x00, 0x00, 0x0a, 0x2a, 0x2a, 0x2a,
-  0x20, 0x50, 0x41, 0x4e, 0x49, 0x43, 0x20, 0x2a, 0x2a, 0x2a, 0x0a, 0x00,
-  0x0a, 0x00, 0x00, 0x00, 0x4e, 0x6f, 0x20, 0x73, 0x70, 0x69, 0x6e, 0x6c,
-  0x6f, 0x63, 0x6b, 0x73, 0x20, 0x61, 0x72, 0x65, 0x20, 0x61, 0x76, 0x61,
-  0x69, 0x6c, 0x61, 0x62, 0x6c, 0x65, 0x00, 0x00, 0x4e, 0x6f, 0x20, 0x75,
-  0x73, 0x65, 0x72, 0x20, 0x49, 0x52, 0x51, 0x73, 0x20, 0x61, 0x72, 0x65,
-  0x20, 0x61, 0x76, 0x61, 0x69, 0x6c, 0x61, 0x62, 0x6c, 0x65, 0x00, 0x00,
-  0x48, 0x61, 0x72, 0x64, 0x77, 0x61, 0x72, 0x65, 0x20, 0x61, 0x6c, 0x61,
-  0x72, 0x6d, 0x20, 0x25, 0x64, 0x20, 0x61, 0x6c, 0x72, 0x65, 0x61, 0x64,
-  0x79, 0x20, 0x63, 0x6c, 0x61, 0x69, 0x6d, 0x65, 0x64, 0x00, 0x00, 0x00,
-  0x48, 0x61, 0x72, 0x64, 0x20, 0x61, 0x73, 0x73, 0x65, 0x72, 0x74, 0x00,
-  0x52, 0x65, 0x6c, 0x65, 0x61, 0x73, 0x65, 0x00, 0x62, 0x6f, 0x6f, 0x74,
-  0x32, 0x5f, 0x77, 0x32, 0x35, 0x71, 0x30, 0x38, 0x30, 0x00, 0x00, 0x00,
-  0x32, 0x2e, 0x31, 0x2e, 0x30, 0x00, 0x00, 0x00, 0x70, 0x69, 0x63, 0x6f,
-  0x00, 0x00, 0x00, 0x00, 0x41, 0x70, 0x72, 0x20, 0x31, 0x35, 0x20, 0x32,
-  0x30, 0x32, 0x35, 0x00, 0x06, 0x00, 0x52, 0x50, 0xd3, 0xf0, 0x75, 0x42,
-  0xc4, 0x6e, 0x00, 0x10, 0x06, 0x00, 0x52, 0x50, 0xe1, 0x82, 0x88, 0x7f,
-  0xcc, 0x6e, 0x00, 0x10, 0x06, 0x00, 0x52, 0x50, 0xab, 0xb3, 0x60, 0x53,
-  0xdc, 0x6e, 0x00, 0x10, 0x06, 0x00, 0x52, 0x50, 0xbb, 0xff, 0x3c, 0xb6,
-  0xe4, 0x6e, 0x00, 0x10, 0x06, 0x00, 0x52, 0x50, 0x54, 0x22, 0xa2, 0x9d,
-  0xec, 0x6e, 0x00, 0x10, 0x05, 0x00, 0x52, 0x50, 0xde, 0x65, 0xf4, 0x68,
-  0x80, 0x84, 0x00, 0x10, 0x66, 0x6e, 0x69, 0x2b, 0x00, 0x00, 0x00, 0x00,
-  0x66, 0x6e, 0x69, 0x00, 0x6e, 0x61, 0x6e, 0x00, 0x66, 0x6e, 0x69, 0x2d,
-  0x00, 0x00, 0x00, 0x00, 0x42, 0x34, 0x00, 0x10, 0xf8, 0x33, 0x00, 0x10,
-  0xf8, 0x33, 0x00, 0x10, 0x3a, 0x34, 0x00, 0x10, 0xf8, 0x33, 0x00, 0x10,
-  0xf8, 0x33, 0x00, 0x10, 0xf8, 0x33, 0x00, 0x10, 0xf8, 0x33, 0x00, 0x10,
-  0xf8, 0x33, 0x00, 0x10, 0xf8, 0x33, 0x00, 0x10, 0xf8, 0x33, 0x00, 0x10,
-  0x32, 0x34, 0x00, 0x10, 0xf8, 0x33, 0x00, 0x10, 0x2c, 0x34, 0x00, 0x10,
-  0xf8, 0x33, 0x00, 0x10, 0xf8, 0x33, 0x00, 0x10, 0x24, 0x34, 0x00, 0x10,
-  0x98, 0x35, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10, 0x8c, 0x35, 0x00, 0x10,
-  0x54, 0x34, 0x00, 0x10, 0x7a, 0x35, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10,
-  0x54, 0x34, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10,
-  0x54, 0x34, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10,
-  0x4a, 0x34, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10,
-  0x54, 0x34, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10, 0x54, 0x34, 0x00, 0x10,
-  0x4a, 0x34, 0x00, 0x10, 0xda, 0x35, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x3c, 0x35, 0x00, 0x10, 0xa8, 0x35, 0x00, 0x10, 0x3c, 0x35, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0xf4, 0x37, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10,
-  0x9c, 0x34, 0x00, 0x10, 0x9c, 0x34, 0x00, 0x10, 0xf4, 0x37, 0x00, 0x10,
-  0xee, 0x35, 0x00, 0x10, 0xf4, 0x37, 0x00, 0x10, 0x3c, 0x35, 0x00, 0x10,
-  0xa8, 0x35, 0x00, 0x10, 0x3c, 0x35, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf0, 0x3f, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x24, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x59, 0x40,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x8f, 0x40, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x88, 0xc3, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x6a, 0xf8, 0x40,
-  0x00, 0x00, 0x00, 0x00, 0x80, 0x84, 0x2e, 0x41, 0x00, 0x00, 0x00, 0x00,
-  0xd0, 0x12, 0x63, 0x41, 0x00, 0x00, 0x00, 0x00, 0x84, 0xd7, 0x97, 0x41,
-  0x00, 0x00, 0x00, 0x00, 0x65, 0xcd, 0xcd, 0x41, 0x0d, 0x0a, 0x00, 0x00,
-  0x55, 0x41, 0x52, 0x54, 0x20, 0x73, 0x74, 0x64, 0x69, 0x6e, 0x00, 0x00,
-  0x55, 0x41, 0x52, 0x54, 0x20, 0x73, 0x74, 0x64, 0x6f, 0x75, 0x74, 0x00,
-  0x55, 0x41, 0x52, 0x54, 0x20, 0x73, 0x74, 0x64, 0x69, 0x6e, 0x20, 0x2f,
-  0x20, 0x73, 0x74, 0x64, 0x6f, 0x75, 0x74, 0x00, 0x06, 0x00, 0x52, 0x50,
-  0x53, 0xb4, 0xf4, 0xa1, 0x64, 0x71, 0x00, 0x10, 0x08, 0x00, 0x52, 0x50,
-  0x12, 0x00, 0x00, 0x00, 0x08, 0x00, 0x52, 0x50, 0x92, 0x10, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x4d, 0x45, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00,
-  0x51, 0x45, 0x00, 0x10, 0x5d, 0x45, 0x00, 0x10, 0x89, 0x45, 0x00, 0x10,
-  0x85, 0x45, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x03, 0x06, 0xa6, 0x00, 0x08, 0x00, 0x02, 0x00, 0x02, 0x00,
-  0x9c, 0x00, 0x14, 0x00, 0x03, 0x00, 0x57, 0x49, 0x4e, 0x55, 0x53, 0x42,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00,
-  0x04, 0x00, 0x01, 0x00, 0x28, 0x00, 0x44, 0x00, 0x65, 0x00, 0x76, 0x00,
-  0x69, 0x00, 0x63, 0x00, 0x65, 0x00, 0x49, 0x00, 0x6e, 0x00, 0x74, 0x00,
-  0x65, 0x00, 0x72, 0x00, 0x66, 0x00, 0x61, 0x00, 0x63, 0x00, 0x65, 0x00,
-  0x47, 0x00, 0x55, 0x00, 0x49, 0x00, 0x44, 0x00, 0x00, 0x00, 0x4e, 0x00,
-  0x7b, 0x00, 0x62, 0x00, 0x63, 0x00, 0x37, 0x00, 0x33, 0x00, 0x39, 0x00,
-  0x38, 0x00, 0x63, 0x00, 0x31, 0x00, 0x2d, 0x00, 0x37, 0x00, 0x33, 0x00,
-  0x63, 0x00, 0x64, 0x00, 0x2d, 0x00, 0x34, 0x00, 0x63, 0x00, 0x62, 0x00,
-  0x37, 0x00, 0x2d, 0x00, 0x39, 0x00, 0x38, 0x00, 0x62, 0x00, 0x38, 0x00,
-  0x2d, 0x00, 0x39, 0x00, 0x31, 0x00, 0x33, 0x00, 0x61, 0x00, 0x38, 0x00,
-  0x66, 0x00, 0x63, 0x00, 0x61, 0x00, 0x37, 0x00, 0x62, 0x00, 0x66, 0x00,
-  0x36, 0x00, 0x7d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x0f, 0x21, 0x00,
-  0x01, 0x1c, 0x10, 0x05, 0x00, 0xdf, 0x60, 0xdd, 0xd8, 0x89, 0x45, 0xc7,
-  0x4c, 0x9c, 0xd2, 0x65, 0x9d, 0x9e, 0x64, 0x8a, 0x9f, 0x00, 0x00, 0x03,
-  0x06, 0xa6, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x55, 0x53, 0x42, 0x20,
-  0x73, 0x74, 0x64, 0x69, 0x6e, 0x20, 0x2f, 0x20, 0x73, 0x74, 0x64, 0x6f,
-  0x75, 0x74, 0x00, 0x00, 0x06, 0x00, 0x52, 0x50, 0x53, 0xb4, 0xf4, 0xa1,
-  0x80, 0x72, 0x00, 0x10, 0x52, 0x61, 0x73, 0x70, 0x62, 0x65, 0x72, 0x72,
-  0x79, 0x20, 0x50, 0x69, 0x00, 0x00, 0x00, 0x00, 0x50, 0x69, 0x63, 0x6f,
-  0x00, 0x00, 0x00, 0x00, 0x42, 0x6f, 0x61, 0x72, 0x64, 0x20, 0x43, 0x44,
-  0x43, 0x00, 0x00, 0x00, 0x52, 0x65, 0x73, 0x65, 0x74, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0xa0, 0x72, 0x00, 0x10, 0xb0, 0x72, 0x00, 0x10,
-  0xf8, 0x20, 0x00, 0x20, 0xb8, 0x72, 0x00, 0x10, 0xc4, 0x72, 0x00, 0x10,
-  0x09, 0x02, 0x54, 0x00, 0x03, 0x01, 0x00, 0x80, 0x7d, 0x08, 0x0b, 0x00,
-  0x02, 0x02, 0x02, 0x00, 0x00, 0x09, 0x04, 0x00, 0x00, 0x01, 0x02, 0x02,
-  0x00, 0x04, 0x05, 0x24, 0x00, 0x20, 0x01, 0x05, 0x24, 0x01, 0x00, 0x01,
-  0x04, 0x24, 0x02, 0x06, 0x05, 0x24, 0x06, 0x00, 0x01, 0x07, 0x05, 0x81,
-  0x03, 0x08, 0x00, 0x10, 0x09, 0x04, 0x01, 0x00, 0x02, 0x0a, 0x00, 0x00,
-  0x00, 0x07, 0x05, 0x02, 0x02, 0x40, 0x00, 0x00, 0x07, 0x05, 0x82, 0x02,
-  0x40, 0x00, 0x00, 0x09, 0x04, 0x02, 0x00, 0x00, 0xff, 0x00, 0x01, 0x05,
-  0x12, 0x01, 0x10, 0x02, 0xef, 0x02, 0x01, 0x40, 0x8a, 0x2e, 0x0a, 0x00,
-  0x00, 0x01, 0x01, 0x02, 0x03, 0x01, 0x00, 0x00, 0x55, 0x6e, 0x68, 0x61,
-  0x6e, 0x64, 0x6c, 0x65, 0x64, 0x20, 0x49, 0x52, 0x51, 0x20, 0x30, 0x78,
-  0x25, 0x78, 0x0a, 0x00, 0x65, 0x70, 0x20, 0x25, 0x30, 0x32, 0x58, 0x20,
-  0x77, 0x61, 0x73, 0x20, 0x61, 0x6c, 0x72, 0x65, 0x61, 0x64, 0x79, 0x20,
-  0x61, 0x76, 0x61, 0x69, 0x6c, 0x61, 0x62, 0x6c, 0x65, 0x00, 0x00, 0x00,
-  0x43, 0x61, 0x6e, 0x27, 0x74, 0x20, 0x63, 0x6f, 0x6e, 0x74, 0x69, 0x6e,
-  0x75, 0x65, 0x20, 0x78, 0x66, 0x65, 0x72, 0x20, 0x6f, 0x6e, 0x20, 0x69,
-  0x6e, 0x61, 0x63, 0x74, 0x69, 0x76, 0x65, 0x20, 0x65, 0x70, 0x20, 0x25,
-  0x30, 0x32, 0x58, 0x00, 0x48, 0x51, 0x00, 0x10, 0xa4, 0x52, 0x00, 0x10,
-  0xf4, 0x52, 0x00, 0x10, 0x7c, 0x52, 0x00, 0x10, 0x8e, 0x52, 0x00, 0x10,
-  0x6c, 0x52, 0x00, 0x10, 0xe8, 0x51, 0x00, 0x10, 0x94, 0x51, 0x00, 0x10,
-  0x88, 0x51, 0x00, 0x10, 0x74, 0x56, 0x00, 0x10, 0x5a, 0x56, 0x00, 0x10,
-  0x5a, 0x52, 0x00, 0x10, 0x94, 0x56, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10,
-  0x42, 0x56, 0x00, 0x10, 0x2e, 0x56, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10,
-  0x1a, 0x56, 0x00, 0x10, 0x20, 0x55, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10,
-  0x00, 0x59, 0x00, 0x10, 0xf2, 0x58, 0x00, 0x10, 0xe6, 0x58, 0x00, 0x10,
-  0x5a, 0x52, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10, 0xd0, 0x58, 0x00, 0x10,
-  0xf2, 0x58, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10,
-  0x5a, 0x52, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10,
-  0x5a, 0x52, 0x00, 0x10, 0x5a, 0x52, 0x00, 0x10, 0x86, 0x58, 0x00, 0x10,
-  0x5a, 0x0d, 0x00, 0x20, 0x5a, 0x0d, 0x00, 0x20, 0xa4, 0x0d, 0x00, 0x20,
-  0xc4, 0x0d, 0x00, 0x20, 0x08, 0x0e, 0x00, 0x20, 0x1a, 0x0e, 0x00, 0x20,
-  0x50, 0x0d, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x9d, 0x5e, 0x00, 0x10,
-  0x19, 0x5f, 0x00, 0x10, 0x49, 0x5f, 0x00, 0x10, 0x95, 0x5f, 0x00, 0x10,
-  0x45, 0x60, 0x00, 0x10, 0x29, 0x61, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x29, 0x62, 0x00, 0x10, 0x85, 0x62, 0x00, 0x10,
-  0xa1, 0x62, 0x00, 0x10, 0xc1, 0x62, 0x00, 0x10, 0xed, 0x45, 0x00, 0x10,
-  0xf9, 0x63, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0xf8, 0x6e, 0x00, 0x10,
-  0x04, 0x6f, 0x00, 0x10, 0x10, 0x6f, 0x00, 0x10, 0x1c, 0x6f, 0x00, 0x10,
-  0x28, 0x6f, 0x00, 0x10, 0x34, 0x6f, 0x00, 0x10, 0x8c, 0x71, 0x00, 0x10,
-  0x84, 0x71, 0x00, 0x10, 0x78, 0x71, 0x00, 0x10, 0x94, 0x72, 0x00, 0x10,
-  0x03, 0x00, 0x00, 0x68, 0xef, 0xf3, 0x10, 0x8c, 0x72, 0xb6, 0x02, 0x68,
-  0x00, 0x2a, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x04, 0x22, 0x9a, 0x56,
-  0x00, 0x2a, 0x04, 0xdb, 0x00, 0x29, 0x00, 0xd0, 0x0a, 0x60, 0x00, 0x20,
-  0x04, 0xe0, 0xd0, 0x22, 0x01, 0x20, 0x12, 0x06, 0x12, 0x68, 0x1a, 0x71,
-  0x1b, 0x68, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60, 0x8c, 0xf3,
-  0x10, 0x88, 0x70, 0x47, 0xf0, 0xb5, 0xc6, 0x46, 0x15, 0x00, 0x00, 0xb5,
-  0x04, 0x00, 0x1e, 0x00, 0x02, 0x68, 0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6,
-  0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x04, 0x23,
-  0xe3, 0x56, 0x00, 0x2b, 0x2d, 0xdb, 0x22, 0x68, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x00, 0x20, 0x10, 0x60, 0x81, 0xf3, 0x10, 0x88, 0xd0, 0x22, 0x12, 0x06,
-  0x12, 0x78, 0x52, 0xb2, 0x90, 0x46, 0x9a, 0x42, 0x03, 0xd1, 0x00, 0x20,
-  0x80, 0xbc, 0xb8, 0x46, 0xf0, 0xbd, 0x00, 0x27, 0x0b, 0xe0, 0x23, 0x68,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x1f, 0x60, 0x81, 0xf3, 0x10, 0x88, 0x28, 0x00,
-  0x31, 0x00, 0x00, 0xf0, 0xef, 0xfe, 0x00, 0x28, 0xed, 0xd1, 0x22, 0x68,
-  0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6, 0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x23, 0x79, 0x7f, 0x2b, 0xe7, 0xd9, 0x43, 0x46,
-  0x02, 0xe0, 0xd0, 0x23, 0x1b, 0x06, 0x1b, 0x68, 0x23, 0x71, 0x23, 0x68,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60, 0x81, 0xf3, 0x10, 0x88,
-  0x01, 0x20, 0xd3, 0xe7, 0xf0, 0xb5, 0xc6, 0x46, 0x00, 0xb5, 0x0d, 0x00,
-  0x04, 0x00, 0x00, 0xf0, 0xf3, 0xfe, 0xfa, 0x22, 0x06, 0x00, 0x0f, 0x00,
-  0x00, 0x23, 0x28, 0x00, 0x00, 0x21, 0x92, 0x00, 0x00, 0xf0, 0xca, 0xfe,
-  0x80, 0x23, 0x36, 0x18, 0x4f, 0x41, 0x1b, 0x06, 0x9f, 0x42, 0x02, 0xd3,
-  0x01, 0x26, 0x17, 0x4f, 0x76, 0x42, 0xd0, 0x23, 0x1b, 0x06, 0x1b, 0x68,
-  0x00, 0x25, 0x98, 0x46, 0x0b, 0xe0, 0x23, 0x68, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x1d, 0x60, 0x81, 0xf3, 0x10, 0x88, 0x30, 0x00, 0x39, 0x00, 0x00, 0xf0,
-  0xa9, 0xfe, 0x00, 0x28, 0x18, 0xd1, 0x22, 0x68, 0xef, 0xf3, 0x10, 0x81,
-  0x72, 0xb6, 0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f,
-  0x23, 0x79, 0x7f, 0x2b, 0xe7, 0xd9, 0x43, 0x46, 0x23, 0x71, 0x23, 0x68,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60, 0x81, 0xf3, 0x10, 0x88,
-  0x01, 0x20, 0x80, 0xbc, 0xb8, 0x46, 0xf0, 0xbd, 0x00, 0x20, 0xfa, 0xe7,
-  0xff, 0xff, 0xff, 0x7f, 0x02, 0x68, 0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6,
-  0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0xff, 0x23,
-  0x03, 0x71, 0x03, 0x68, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x22, 0x1a, 0x60,
-  0x81, 0xf3, 0x10, 0x88, 0x40, 0xbf, 0x70, 0x47, 0x10, 0xb5, 0x08, 0x4c,
-  0x23, 0x78, 0x00, 0x2b, 0x0a, 0xd1, 0x80, 0x23, 0x06, 0x48, 0x07, 0x49,
-  0x5b, 0x05, 0x1a, 0x68, 0xc2, 0x50, 0x04, 0x33, 0x8b, 0x42, 0xfa, 0xd1,
-  0x01, 0x23, 0x23, 0x70, 0x10, 0xbd, 0xc0, 0x46, 0x0c, 0x21, 0x00, 0x20,
-  0x40, 0x1b, 0x00, 0x10, 0x00, 0x01, 0x00, 0x10, 0x10, 0xb5, 0x01, 0x4b,
-  0x98, 0x47, 0x10, 0xbd, 0x41, 0x1b, 0x00, 0x20, 0x03, 0x4b, 0x1a, 0x68,
-  0xc0, 0x23, 0x9b, 0x00, 0x93, 0x43, 0x02, 0x4a, 0x13, 0x60, 0x70, 0x47,
-  0x0c, 0x80, 0x01, 0x40, 0x0c, 0x90, 0x01, 0x40, 0x05, 0x4b, 0x1a, 0x68,
-  0x80, 0x23, 0x9b, 0x00, 0x53, 0x40, 0xc0, 0x22, 0x92, 0x00, 0x13, 0x40,
-  0x02, 0x4a, 0x13, 0x60, 0x70, 0x47, 0xc0, 0x46, 0x0c, 0x80, 0x01, 0x40,
-  0x0c, 0x90, 0x01, 0x40, 0x14, 0x23, 0xf0, 0xb5, 0xd6, 0x46, 0x4f, 0x46,
-  0x46, 0x46, 0x9a, 0x46, 0x81, 0x46, 0x18, 0x88, 0x04, 0x33, 0xc0, 0xb5,
-  0x98, 0x46, 0x0e, 0x00, 0x1b, 0x88, 0x26, 0x49, 0x14, 0x00, 0x98, 0x47,
-  0x53, 0x46, 0x07, 0x00, 0x18, 0x88, 0x43, 0x46, 0x23, 0x49, 0x1b, 0x88,
-  0x98, 0x47, 0x53, 0x46, 0x05, 0x00, 0x18, 0x88, 0x43, 0x46, 0x21, 0x49,
-  0x1b, 0x88, 0x98, 0x47, 0x80, 0x46, 0xff, 0xf7, 0xa5, 0xff, 0xb8, 0x47,
-  0xa8, 0x47, 0xff, 0xf7, 0xcb, 0xff, 0x22, 0x1e, 0x20, 0xd0, 0xc0, 0x21,
-  0x08, 0x27, 0x02, 0x20, 0x49, 0x05, 0x11, 0xe0, 0x00, 0x2c, 0x14, 0xd0,
-  0x13, 0x1b, 0x0d, 0x2b, 0x20, 0xd9, 0x00, 0x2d, 0x0a, 0xd0, 0x23, 0x00,
-  0x00, 0x2a, 0x05, 0xd0, 0x0b, 0x6e, 0x01, 0x3a, 0x33, 0x70, 0x13, 0x00,
-  0x01, 0x36, 0x23, 0x43, 0x00, 0x2b, 0x09, 0xd0, 0x3d, 0x00, 0x8b, 0x6a,
-  0x1d, 0x40, 0x18, 0x42, 0xe8, 0xd1, 0x00, 0x2d, 0xed, 0xd1, 0x23, 0x00,
-  0x13, 0x43, 0xf5, 0xd1, 0xff, 0xf7, 0x9a, 0xff, 0xc0, 0x47, 0xff, 0xf7,
-  0x91, 0xff, 0xe0, 0xbc, 0xba, 0x46, 0xb1, 0x46, 0xa8, 0x46, 0xf0, 0xbd,
-  0x4b, 0x46, 0x1b, 0x78, 0x01, 0x3c, 0x0b, 0x66, 0x01, 0x23, 0x9c, 0x46,
-  0xe1, 0x44, 0xe8, 0xe7, 0x49, 0x46, 0x00, 0x00, 0x45, 0x58, 0x00, 0x00,
-  0x46, 0x43, 0x00, 0x00, 0x00, 0x22, 0x15, 0x4b, 0x10, 0xb5, 0x9a, 0x60,
-  0xda, 0x60, 0x1a, 0x61, 0x5a, 0x61, 0x9a, 0x61, 0xda, 0x61, 0x1a, 0x62,
-  0x5a, 0x62, 0x9a, 0x62, 0xda, 0x62, 0x1a, 0x63, 0x5a, 0x63, 0x9a, 0x63,
-  0xda, 0x63, 0x1a, 0x64, 0x5a, 0x64, 0x9a, 0x64, 0xda, 0x64, 0x1a, 0x65,
-  0x5a, 0x65, 0x9a, 0x65, 0xda, 0x65, 0x1a, 0x66, 0x5a, 0x66, 0x9a, 0x66,
-  0xda, 0x66, 0x1a, 0x67, 0x5a, 0x67, 0x9a, 0x67, 0xda, 0x67, 0xf0, 0x32,
-  0x92, 0x00, 0x00, 0x21, 0x04, 0x48, 0x00, 0xf0, 0xcd, 0xfd, 0x04, 0x4b,
-  0x04, 0x4a, 0x1a, 0x60, 0x10, 0xbd, 0xc0, 0x46, 0x00, 0x00, 0x10, 0x50,
-  0xf4, 0x1c, 0x00, 0x20, 0xbc, 0x20, 0x00, 0x20, 0x80, 0x01, 0x10, 0x50,
-  0xf0, 0xb5, 0x57, 0x46, 0xde, 0x46, 0x4e, 0x46, 0x45, 0x46, 0xe0, 0xb5,
-  0x24, 0x4b, 0x87, 0xb0, 0x9f, 0x6d, 0x00, 0x2f, 0x23, 0xd0, 0x23, 0x4b,
-  0x00, 0x24, 0x99, 0x46, 0x01, 0x23, 0x98, 0x46, 0x21, 0x4b, 0x01, 0x26,
-  0x9a, 0x46, 0x04, 0xe0, 0x01, 0x34, 0x76, 0x00, 0xe4, 0xb2, 0x20, 0x2c,
-  0x15, 0xd0, 0x3e, 0x42, 0xf8, 0xd0, 0x4b, 0x46, 0x9e, 0x65, 0x43, 0x46,
-  0x65, 0x08, 0x6d, 0x00, 0xa3, 0x43, 0xed, 0x18, 0x6d, 0x01, 0x55, 0x44,
-  0x28, 0x00, 0x00, 0xf0, 0x5b, 0xfc, 0x00, 0x28, 0x0c, 0xd1, 0x01, 0x34,
-  0xb7, 0x43, 0xe4, 0xb2, 0x76, 0x00, 0x00, 0x2f, 0xe7, 0xd1, 0x07, 0xb0,
-  0xf0, 0xbc, 0xbb, 0x46, 0xb2, 0x46, 0xa9, 0x46, 0xa0, 0x46, 0xf0, 0xbd,
-  0xab, 0x78, 0x02, 0xa8, 0x9b, 0x46, 0xeb, 0x8a, 0x06, 0x22, 0x00, 0x21,
-  0x06, 0x30, 0x01, 0x93, 0x00, 0xf0, 0x80, 0xfd, 0xe0, 0x23, 0x59, 0x46,
-  0x02, 0xaa, 0xdb, 0x00, 0x93, 0x80, 0x01, 0x9b, 0x11, 0x72, 0x03, 0xa8,
-  0x01, 0x21, 0x05, 0x93, 0x00, 0xf0, 0x56, 0xfc, 0x28, 0x00, 0x00, 0xf0,
-  0xcf, 0xfb, 0xd8, 0xe7, 0x00, 0x00, 0x11, 0x50, 0x00, 0x30, 0x11, 0x50,
-  0xb4, 0x1c, 0x00, 0x20, 0x98, 0x23, 0xf0, 0xb5, 0xc6, 0x46, 0xca, 0x4a,
-  0x00, 0xb5, 0xd5, 0x58, 0x80, 0x23, 0x2c, 0x00, 0x9b, 0x02, 0x10, 0x26,
-  0x84, 0xb0, 0x1c, 0x40, 0x1d, 0x42, 0x7a, 0xd0, 0xc5, 0x4b, 0xc6, 0x4c,
-  0x9a, 0x6a, 0xc6, 0x4b, 0x00, 0x26, 0x1a, 0x60, 0x3b, 0x23, 0xe3, 0x5c,
-  0x02, 0x2b, 0x00, 0xd1, 0x0f, 0xe1, 0x7b, 0x23, 0xe3, 0x5c, 0x02, 0x2b,
-  0x00, 0xd1, 0xf1, 0xe1, 0xbb, 0x23, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1,
-  0xe1, 0xe1, 0xfb, 0x23, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0xd1, 0xe1,
-  0x3c, 0x23, 0xff, 0x33, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0xbf, 0xe1,
-  0x7c, 0x23, 0xff, 0x33, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0xad, 0xe1,
-  0xbc, 0x23, 0xff, 0x33, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0x9a, 0xe1,
-  0xfc, 0x23, 0xff, 0x33, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0x87, 0xe1,
-  0xaf, 0x4b, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0x46, 0xe1, 0xae, 0x4b,
-  0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0x35, 0xe1, 0xac, 0x4b, 0xe3, 0x5c,
-  0x02, 0x2b, 0x00, 0xd1, 0x24, 0xe1, 0xab, 0x4b, 0xe3, 0x5c, 0x02, 0x2b,
-  0x00, 0xd1, 0x13, 0xe1, 0xa9, 0x4b, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1,
-  0x02, 0xe1, 0xa8, 0x4b, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0xe3, 0xe0,
-  0xa6, 0x4b, 0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0xb7, 0xe1, 0xa5, 0x4b,
-  0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd1, 0xce, 0xe1, 0x00, 0x2e, 0x08, 0xd1,
-  0xa2, 0x4b, 0x1b, 0x78, 0x00, 0x2b, 0x04, 0xd1, 0x80, 0x21, 0xa1, 0x4a,
-  0x90, 0x33, 0x89, 0x02, 0xd1, 0x50, 0x92, 0x4b, 0x0a, 0x22, 0x9c, 0x6c,
-  0x6b, 0x46, 0x00, 0x21, 0x98, 0x1d, 0x00, 0xf0, 0xef, 0xfc, 0xc0, 0x23,
-  0x64, 0x05, 0x01, 0xae, 0x9b, 0x00, 0x64, 0x0d, 0x33, 0x80, 0x30, 0x00,
-  0x02, 0x94, 0x01, 0x21, 0x80, 0x24, 0x00, 0xf0, 0xc5, 0xfb, 0x96, 0x4e,
-  0xa4, 0x02, 0xeb, 0x06, 0x00, 0xd5, 0x98, 0xe0, 0x80, 0x23, 0x5b, 0x02,
-  0x1d, 0x42, 0x1d, 0xd0, 0x85, 0x4f, 0x1c, 0x43, 0xbb, 0x7e, 0x00, 0x2b,
-  0x2b, 0xd1, 0x01, 0x33, 0xfb, 0x70, 0x20, 0x37, 0x01, 0x23, 0x98, 0x46,
-  0xbb, 0x7e, 0x01, 0x26, 0x00, 0x2b, 0x25, 0xd1, 0xfe, 0x70, 0xc0, 0x23,
-  0x8a, 0x4a, 0xdb, 0x00, 0x01, 0x93, 0x02, 0xab, 0x03, 0xca, 0x03, 0xc3,
-  0x01, 0x21, 0x01, 0xa8, 0x00, 0xf0, 0xa2, 0xfb, 0x80, 0x22, 0x83, 0x4b,
-  0x92, 0x02, 0x1a, 0x65, 0x80, 0x23, 0x5b, 0x01, 0x1d, 0x42, 0x2c, 0xd1,
-  0x80, 0x23, 0xdb, 0x01, 0x1d, 0x42, 0x44, 0xd1, 0x80, 0x23, 0x1b, 0x02,
-  0x1d, 0x42, 0x56, 0xd1, 0xac, 0x42, 0x00, 0xd0, 0xf6, 0xe1, 0x04, 0xb0,
-  0x80, 0xbc, 0xb8, 0x46, 0xf0, 0xbd, 0x00, 0x23, 0x02, 0x26, 0x98, 0x46,
-  0x00, 0xf0, 0x9c, 0xfc, 0x01, 0x28, 0x71, 0xd8, 0xc0, 0x22, 0x00, 0x21,
-  0x38, 0x00, 0x92, 0x01, 0x00, 0xf0, 0x00, 0xfb, 0x38, 0x00, 0x00, 0xf0,
-  0xf7, 0xfa, 0x00, 0xf0, 0x8f, 0xfc, 0x01, 0x28, 0x02, 0xd9, 0x6e, 0x4b,
-  0x5e, 0x66, 0x1e, 0x66, 0x01, 0x23, 0xfb, 0x70, 0x43, 0x46, 0x01, 0x2b,
-  0xc1, 0xd0, 0x20, 0x37, 0xb8, 0xe7, 0x00, 0x22, 0x1c, 0x43, 0x5b, 0x4b,
-  0x01, 0xae, 0x1a, 0x60, 0xff, 0xf7, 0x90, 0xfe, 0x6b, 0x46, 0x0a, 0x22,
-  0x00, 0x21, 0x98, 0x1d, 0x00, 0xf0, 0x7e, 0xfc, 0x80, 0x23, 0x5b, 0x00,
-  0x33, 0x80, 0x01, 0x21, 0x30, 0x00, 0x00, 0xf0, 0x59, 0xfb, 0x80, 0x22,
-  0x5e, 0x4b, 0x12, 0x03, 0x1a, 0x65, 0x80, 0x23, 0xdb, 0x01, 0x1d, 0x42,
-  0xba, 0xd0, 0x1c, 0x43, 0x6b, 0x46, 0x0a, 0x22, 0x00, 0x21, 0x98, 0x1d,
-  0x00, 0xf0, 0x68, 0xfc, 0x80, 0x23, 0x01, 0xae, 0xdb, 0x00, 0x33, 0x80,
-  0x01, 0x21, 0x30, 0x00, 0x00, 0xf0, 0x42, 0xfb, 0x10, 0x22, 0x53, 0x4b,
-  0x1a, 0x65, 0x80, 0x23, 0x1b, 0x02, 0x1d, 0x42, 0xa8, 0xd0, 0x1c, 0x43,
-  0x6b, 0x46, 0x0a, 0x22, 0x00, 0x21, 0x98, 0x1d, 0x00, 0xf0, 0x52, 0xfc,
-  0xa0, 0x23, 0x01, 0xae, 0xdb, 0x00, 0x33, 0x80, 0x01, 0x21, 0x30, 0x00,
-  0x00, 0xf0, 0x2c, 0xfb, 0x80, 0x22, 0x48, 0x4b, 0x12, 0x01, 0x1a, 0x65,
-  0x94, 0xe7, 0xff, 0xf7, 0x83, 0xfe, 0x34, 0x00, 0x62, 0xe7, 0x38, 0x33,
-  0xe6, 0x5c, 0x00, 0x2e, 0x00, 0xd1, 0xea, 0xe6, 0x02, 0x33, 0xe2, 0x5c,
-  0x00, 0x2a, 0x00, 0xd1, 0xe5, 0xe6, 0x20, 0x00, 0x00, 0x22, 0x20, 0x30,
-  0xe2, 0x54, 0x00, 0xf0, 0xbd, 0xfa, 0xde, 0xe6, 0x3e, 0x4b, 0x2e, 0x4a,
-  0x1e, 0x66, 0x53, 0x6e, 0x33, 0x40, 0x9e, 0x42, 0xfb, 0xd1, 0x85, 0xe7,
-  0x3b, 0x4b, 0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1, 0x16, 0xe7, 0x02, 0x33,
-  0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd0, 0x60, 0xe1, 0x2f, 0x4b, 0xe3, 0x5c,
-  0x02, 0x2b, 0x00, 0xd1, 0xdb, 0xe0, 0x2e, 0x4b, 0xe3, 0x5c, 0x02, 0x2b,
-  0x00, 0xd0, 0x1c, 0xe7, 0x32, 0x4b, 0xe3, 0x5c, 0x00, 0x2b, 0x00, 0xd0,
-  0xe0, 0xe0, 0x16, 0xe7, 0x30, 0x4b, 0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1,
-  0xf7, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd0, 0x3e, 0xe1,
-  0x3e, 0x00, 0xf0, 0xe6, 0x2b, 0x4b, 0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1,
-  0xe6, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd0, 0x2a, 0xe1,
-  0x3e, 0x00, 0xdf, 0xe6, 0x26, 0x4b, 0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1,
-  0xd5, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd0, 0x16, 0xe1,
-  0x3e, 0x00, 0xce, 0xe6, 0x21, 0x4b, 0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1,
-  0xc4, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd0, 0x02, 0xe1,
-  0x3e, 0x00, 0xbd, 0xe6, 0x1c, 0x4b, 0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1,
-  0xb3, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd0, 0xee, 0xe0,
-  0x3e, 0x00, 0xac, 0xe6, 0x00, 0x00, 0x11, 0x50, 0x00, 0x40, 0x05, 0x40,
-  0xb4, 0x1c, 0x00, 0x20, 0xac, 0x1c, 0x00, 0x20, 0x3b, 0x02, 0x00, 0x00,
-  0x7b, 0x02, 0x00, 0x00, 0xbb, 0x02, 0x00, 0x00, 0xfb, 0x02, 0x00, 0x00,
-  0x3b, 0x03, 0x00, 0x00, 0x7b, 0x03, 0x00, 0x00, 0xbb, 0x03, 0x00, 0x00,
-  0xfb, 0x03, 0x00, 0x00, 0x0a, 0x21, 0x00, 0x20, 0x00, 0x30, 0x11, 0x50,
-  0x10, 0x00, 0x02, 0x00, 0x00, 0x00, 0x10, 0x50, 0x00, 0x20, 0x11, 0x50,
-  0x7a, 0x03, 0x00, 0x00, 0xfa, 0x03, 0x00, 0x00, 0x3a, 0x03, 0x00, 0x00,
-  0xfa, 0x02, 0x00, 0x00, 0xba, 0x02, 0x00, 0x00, 0x7a, 0x02, 0x00, 0x00,
-  0x3a, 0x02, 0x00, 0x00, 0xf9, 0x33, 0xff, 0x33, 0xe7, 0x5c, 0x00, 0x2f,
-  0x00, 0xd1, 0x71, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd0,
-  0xa8, 0xe0, 0x3e, 0x00, 0x6a, 0xe6, 0xb9, 0x33, 0xff, 0x33, 0xe7, 0x5c,
-  0x00, 0x2f, 0x00, 0xd1, 0x5e, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a,
-  0x00, 0xd0, 0x92, 0xe0, 0x3e, 0x00, 0x57, 0xe6, 0x79, 0x33, 0xff, 0x33,
-  0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1, 0x4b, 0xe6, 0x02, 0x33, 0xe2, 0x5c,
-  0x00, 0x2a, 0x7d, 0xd1, 0x3e, 0x00, 0x45, 0xe6, 0x39, 0x33, 0xff, 0x33,
-  0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1, 0x39, 0xe6, 0x02, 0x33, 0xe2, 0x5c,
-  0x00, 0x2a, 0x68, 0xd1, 0x3e, 0x00, 0x33, 0xe6, 0xf8, 0x33, 0xe7, 0x5c,
-  0x00, 0x2f, 0x00, 0xd1, 0x28, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a,
-  0x55, 0xd1, 0x3e, 0x00, 0x22, 0xe6, 0xb8, 0x33, 0xe7, 0x5c, 0x00, 0x2f,
-  0x00, 0xd1, 0x18, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a, 0x42, 0xd1,
-  0x3e, 0x00, 0x12, 0xe6, 0x78, 0x33, 0xe7, 0x5c, 0x00, 0x2f, 0x00, 0xd1,
-  0x08, 0xe6, 0x02, 0x33, 0xe2, 0x5c, 0x00, 0x2a, 0x2f, 0xd1, 0x3e, 0x00,
-  0x02, 0xe6, 0x4f, 0x4b, 0xe3, 0x5c, 0x00, 0x2b, 0x00, 0xd1, 0x42, 0xe6,
-  0xef, 0x23, 0x9b, 0x00, 0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd1, 0x2a, 0xe7,
-  0x00, 0x22, 0xe2, 0x54, 0x1c, 0x3b, 0xe0, 0x18, 0x00, 0xf0, 0xca, 0xf9,
-  0x23, 0xe7, 0x46, 0x4b, 0xe3, 0x5c, 0x00, 0x2b, 0xee, 0xd1, 0x45, 0x4b,
-  0xe3, 0x5c, 0x02, 0x2b, 0x00, 0xd0, 0x3c, 0xe6, 0x3e, 0x00, 0x43, 0x4b,
-  0xe3, 0x5c, 0x00, 0x2b, 0x00, 0xd1, 0x2b, 0xe6, 0xff, 0x23, 0x9b, 0x00,
-  0xe2, 0x5c, 0x00, 0x2a, 0x00, 0xd1, 0x30, 0xe6, 0x00, 0x22, 0xe2, 0x54,
-  0x1c, 0x3b, 0xe0, 0x18, 0x00, 0xf0, 0xae, 0xf9, 0x29, 0xe6, 0x20, 0x00,
-  0x00, 0x22, 0x60, 0x30, 0xe2, 0x54, 0x3e, 0x00, 0x00, 0xf0, 0xa6, 0xf9,
-  0xcc, 0xe5, 0x20, 0x00, 0x00, 0x22, 0xa0, 0x30, 0xe2, 0x54, 0x3e, 0x00,
-  0x00, 0xf0, 0x9e, 0xf9, 0xc9, 0xe5, 0x20, 0x00, 0x00, 0x22, 0xe0, 0x30,
-  0xe2, 0x54, 0x3e, 0x00, 0x00, 0xf0, 0x96, 0xf9, 0xc6, 0xe5, 0x20, 0x00,
-  0x00, 0x22, 0x21, 0x30, 0xff, 0x30, 0xe2, 0x54, 0x3e, 0x00, 0x00, 0xf0,
-  0x8d, 0xf9, 0xc3, 0xe5, 0x20, 0x00, 0x00, 0x22, 0x61, 0x30, 0xff, 0x30,
-  0xe2, 0x54, 0x3e, 0x00, 0x00, 0xf0, 0x84, 0xf9, 0xc0, 0xe5, 0x20, 0x00,
-  0x00, 0x22, 0xa1, 0x30, 0xff, 0x30, 0xe2, 0x54, 0x3e, 0x00, 0x00, 0xf0,
-  0x7b, 0xf9, 0xbd, 0xe5, 0x20, 0x00, 0x00, 0x22, 0xe1, 0x30, 0xff, 0x30,
-  0xe2, 0x54, 0x3e, 0x00, 0x00, 0xf0, 0x72, 0xf9, 0xba, 0xe5, 0x00, 0x22,
-  0xe2, 0x54, 0x1c, 0x3b, 0xe0, 0x18, 0x00, 0xf0, 0x6b, 0xf9, 0x3e, 0x00,
-  0xb7, 0xe5, 0x00, 0x22, 0xe2, 0x54, 0x1c, 0x3b, 0xe0, 0x18, 0x00, 0xf0,
-  0x63, 0xf9, 0x3e, 0x00, 0xb4, 0xe5, 0x00, 0x22, 0xe2, 0x54, 0x1c, 0x3b,
-  0xe0, 0x18, 0x00, 0xf0, 0x5b, 0xf9, 0x3e, 0x00, 0xb1, 0xe5, 0x00, 0x22,
-  0xe2, 0x54, 0x1c, 0x3b, 0xe0, 0x18, 0x00, 0xf0, 0x53, 0xf9, 0x3e, 0x00,
-  0xae, 0xe5, 0x00, 0x22, 0xe2, 0x54, 0x1c, 0x3b, 0xe0, 0x18, 0x00, 0xf0,
-  0x4b, 0xf9, 0x3e, 0x00, 0xab, 0xe5, 0x00, 0x22, 0xe2, 0x54, 0x1c, 0x3b,
-  0xe0, 0x18, 0x00, 0xf0, 0x43, 0xf9, 0x97, 0xe6, 0x21, 0x00, 0x05, 0x48,
-  0x69, 0x40, 0x00, 0xf0, 0xb9, 0xfa, 0xc0, 0x46, 0xba, 0x03, 0x00, 0x00,
-  0xfb, 0x03, 0x00, 0x00, 0xfa, 0x03, 0x00, 0x00, 0x4c, 0x73, 0x00, 0x10,
-  0xf0, 0xb5, 0xd6, 0x46, 0x4f, 0x46, 0x46, 0x46, 0xc0, 0xb5, 0x02, 0x00,
-  0x83, 0x8a, 0x00, 0x8b, 0x8a, 0x46, 0x04, 0x1c, 0x98, 0x42, 0x00, 0xd9,
-  0x1c, 0x1c, 0xd5, 0x78, 0x80, 0x26, 0x28, 0x00, 0x47, 0x1e, 0xb8, 0x41,
-  0xa4, 0xb2, 0xf6, 0x00, 0x26, 0x43, 0x40, 0x03, 0x30, 0x43, 0x01, 0x26,
-  0x75, 0x40, 0x1b, 0x1b, 0xd5, 0x70, 0x55, 0x78, 0x9b, 0xb2, 0x93, 0x82,
-  0x00, 0x2d, 0x37, 0xd1, 0x51, 0x46, 0xd6, 0x68, 0x8d, 0x01, 0x61, 0x1e,
-  0x76, 0x19, 0x88, 0x46, 0x15, 0x69, 0x00, 0x2c, 0x29, 0xd0, 0x06, 0x29,
-  0x3a, 0xd9, 0x2b, 0x00, 0x33, 0x43, 0x9b, 0x07, 0x36, 0xd1, 0x6b, 0x1c,
-  0xf3, 0x1a, 0x02, 0x2b, 0x32, 0xd9, 0x23, 0x1f, 0x9b, 0x08, 0x01, 0x33,
-  0x9c, 0x46, 0x00, 0x27, 0x00, 0x23, 0xe9, 0x58, 0x01, 0x37, 0xf1, 0x50,
-  0x04, 0x33, 0xbc, 0x45, 0xf9, 0xd8, 0x63, 0x46, 0x41, 0x46, 0x9b, 0x00,
-  0xed, 0x18, 0xf6, 0x18, 0xcf, 0x1a, 0x9c, 0x42, 0x09, 0xd0, 0x2b, 0x78,
-  0x33, 0x70, 0x00, 0x2f, 0x05, 0xd0, 0x6b, 0x78, 0x73, 0x70, 0x01, 0x2f,
-  0x01, 0xd0, 0xab, 0x78, 0xb3, 0x70, 0x15, 0x69, 0x93, 0x8a, 0x2d, 0x19,
-  0x15, 0x61, 0x80, 0x22, 0x12, 0x02, 0x10, 0x43, 0x00, 0x2b, 0x02, 0xd1,
-  0x80, 0x23, 0xdb, 0x01, 0x18, 0x43, 0x53, 0x46, 0x00, 0x2b, 0x00, 0xd0,
-  0x00, 0x04, 0xe0, 0xbc, 0xba, 0x46, 0xb1, 0x46, 0xa8, 0x46, 0xf0, 0xbd,
-  0x00, 0x23, 0xef, 0x5c, 0xf7, 0x54, 0x01, 0x33, 0x9c, 0x42, 0xfa, 0xd1,
-  0x15, 0x69, 0x93, 0x8a, 0xe3, 0xe7, 0xc0, 0x46, 0x83, 0x68, 0xf0, 0xb5,
-  0x1b, 0x68, 0x05, 0x00, 0x00, 0x29, 0x00, 0xd0, 0x1b, 0x0c, 0x9b, 0x05,
-  0x98, 0x0d, 0x6b, 0x78, 0x00, 0x2b, 0x08, 0xd1, 0xeb, 0x8a, 0xc3, 0x18,
-  0xeb, 0x82, 0x2b, 0x8b, 0x83, 0x42, 0x01, 0xd9, 0x00, 0x23, 0xab, 0x82,
-  0xf0, 0xbd, 0xeb, 0x68, 0x89, 0x01, 0x46, 0x1e, 0xb4, 0x46, 0x2a, 0x69,
-  0x5c, 0x18, 0x00, 0x28, 0x27, 0xd0, 0x06, 0x2e, 0x2b, 0xd9, 0x01, 0x31,
-  0x5b, 0x18, 0xd3, 0x1a, 0x02, 0x2b, 0x26, 0xd9, 0x13, 0x00, 0x23, 0x43,
-  0x9b, 0x07, 0x22, 0xd1, 0x00, 0x23, 0x00, 0x21, 0x06, 0x1f, 0xb6, 0x08,
-  0x01, 0x36, 0xe7, 0x58, 0x01, 0x31, 0xd7, 0x50, 0x04, 0x33, 0x8e, 0x42,
-  0xf9, 0xd8, 0x63, 0x46, 0xb6, 0x00, 0xa4, 0x19, 0x92, 0x19, 0x9f, 0x1b,
-  0xb0, 0x42, 0x09, 0xd0, 0x23, 0x78, 0x13, 0x70, 0x00, 0x2f, 0x05, 0xd0,
-  0x63, 0x78, 0x53, 0x70, 0x01, 0x2f, 0x01, 0xd0, 0xa3, 0x78, 0x93, 0x70,
-  0x2a, 0x69, 0xeb, 0x8a, 0x12, 0x18, 0xc3, 0x18, 0xeb, 0x82, 0x2a, 0x61,
-  0xc3, 0xe7, 0x00, 0x23, 0xe1, 0x5c, 0xd1, 0x54, 0x01, 0x33, 0x98, 0x42,
-  0xfa, 0xd1, 0x2a, 0x69, 0xf1, 0xe7, 0xc0, 0x46, 0x10, 0xb5, 0x04, 0x00,
-  0x83, 0x68, 0x00, 0x21, 0x1b, 0x68, 0xff, 0xf7, 0xa5, 0xff, 0x63, 0x68,
-  0x1b, 0x68, 0x5b, 0x00, 0x02, 0xd5, 0x23, 0x8b, 0x83, 0x42, 0x00, 0xd0,
-  0x10, 0xbd, 0x01, 0x21, 0x20, 0x00, 0xff, 0xf7, 0x99, 0xff, 0xf9, 0xe7,
-  0x08, 0x4a, 0x03, 0x00, 0x12, 0x6c, 0x00, 0x20, 0x92, 0x07, 0x03, 0xd4,
-  0x9a, 0x78, 0xd2, 0x09, 0x01, 0x2a, 0x00, 0xd0, 0x70, 0x47, 0xd8, 0x7e,
-  0x02, 0x38, 0x43, 0x42, 0x58, 0x41, 0xc0, 0xb2, 0xf8, 0xe7, 0xc0, 0x46,
-  0x00, 0x00, 0x11, 0x50, 0x10, 0xb5, 0xff, 0xf7, 0xe9, 0xff, 0x00, 0x28,
-  0x0c, 0xd0, 0x07, 0x49, 0x07, 0x4b, 0x8c, 0x46, 0x07, 0x4a, 0x9b, 0x6a,
-  0x12, 0x68, 0x63, 0x44, 0x9b, 0x1a, 0x00, 0x20, 0xc6, 0x22, 0x9a, 0x42,
-  0x40, 0x41, 0xc0, 0xb2, 0x10, 0xbd, 0xc0, 0x46, 0xe0, 0xfc, 0xff, 0xff,
-  0x00, 0x40, 0x05, 0x40, 0xac, 0x1c, 0x00, 0x20, 0x00, 0x23, 0x83, 0x76,
-  0x43, 0x61, 0x03, 0x61, 0x70, 0x47, 0xc0, 0x46, 0x10, 0xb5, 0x83, 0x68,
-  0x00, 0x29, 0x01, 0xd0, 0x1c, 0x68, 0x21, 0x40, 0x00, 0x2a, 0x12, 0xd0,
-  0x80, 0x24, 0xe4, 0x00, 0x11, 0x43, 0x22, 0x42, 0x0d, 0xd0, 0x1a, 0x68,
-  0x22, 0x42, 0x0c, 0xd1, 0x08, 0x4a, 0x0a, 0x40, 0x1a, 0x60, 0x08, 0x4a,
-  0x12, 0x6c, 0x92, 0x07, 0x03, 0xd4, 0x0c, 0x23, 0x03, 0x3b, 0xfd, 0xd2,
-  0x83, 0x68, 0x19, 0x60, 0x10, 0xbd, 0x81, 0x78, 0x03, 0x48, 0x00, 0xf0,
-  0x83, 0xf9, 0xc0, 0x46, 0xff, 0xfb, 0xff, 0xff, 0x00, 0x00, 0x11, 0x50,
-  0x60, 0x73, 0x00, 0x10, 0x43, 0x68, 0x70, 0xb5, 0x00, 0x21, 0x80, 0x25,
-  0x1e, 0x68, 0x04, 0x00, 0xff, 0xf7, 0xc4, 0xfe, 0x13, 0x4b, 0x6d, 0x01,
-  0x1b, 0x6c, 0x05, 0x43, 0x9b, 0x07, 0x0f, 0xd5, 0xa3, 0x78, 0x5b, 0x06,
-  0x0f, 0xd0, 0x10, 0x4b, 0x1e, 0x40, 0x80, 0x23, 0x9b, 0x05, 0x33, 0x43,
-  0x62, 0x68, 0x00, 0x21, 0x13, 0x60, 0x20, 0x00, 0x2a, 0x00, 0xff, 0xf7,
-  0xbb, 0xff, 0x70, 0xbd, 0xa3, 0x78, 0xdb, 0x09, 0xef, 0xd0, 0xa3, 0x8a,
-  0x00, 0x2b, 0xec, 0xd0, 0x01, 0x21, 0x20, 0x00, 0xff, 0xf7, 0xa4, 0xfe,
-  0xa0, 0x23, 0x05, 0x4a, 0xdb, 0x05, 0x32, 0x40, 0x05, 0x43, 0x13, 0x43,
-  0xe6, 0xe7, 0xc0, 0x46, 0x00, 0x00, 0x11, 0x50, 0xff, 0xff, 0xff, 0xaf,
-  0xff, 0xff, 0xff, 0xdf, 0x70, 0xb5, 0x85, 0x7e, 0x04, 0x00, 0x00, 0x2d,
-  0x14, 0xd0, 0xff, 0xf7, 0x53, 0xff, 0xa3, 0x8a, 0x00, 0x2b, 0x01, 0xd1,
-  0x28, 0x00, 0x70, 0xbd, 0x20, 0x00, 0xff, 0xf7, 0x73, 0xff, 0x00, 0x28,
-  0x03, 0xd0, 0x01, 0x23, 0x00, 0x25, 0x23, 0x77, 0xf4, 0xe7, 0x20, 0x00,
-  0xff, 0xf7, 0xb2, 0xff, 0x00, 0x25, 0xef, 0xe7, 0x81, 0x78, 0x01, 0x48,
-  0x00, 0xf0, 0x28, 0xf9, 0x80, 0x73, 0x00, 0x10, 0xf0, 0xb5, 0xce, 0x46,
-  0x47, 0x46, 0x80, 0xb5, 0x43, 0x78, 0x05, 0x00, 0x0e, 0x00, 0x85, 0xb0,
-  0x06, 0x2b, 0x08, 0xd8, 0x6c, 0x4a, 0x9b, 0x00, 0xd3, 0x58, 0x9f, 0x46,
-  0x6b, 0x4a, 0x13, 0x78, 0x01, 0x33, 0xdb, 0xb2, 0x13, 0x70, 0x6a, 0x4b,
-  0x1c, 0x68, 0x62, 0x69, 0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6, 0x13, 0x68,
-  0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0xa1, 0x61, 0x20, 0x00,
-  0x29, 0x00, 0x00, 0xf0, 0xdb, 0xf8, 0x62, 0x69, 0xa3, 0x69, 0xbf, 0xf3,
-  0x5f, 0x8f, 0x00, 0x21, 0x11, 0x60, 0x83, 0xf3, 0x10, 0x88, 0x00, 0x28,
-  0x04, 0xd1, 0x05, 0xb0, 0xc0, 0xbc, 0xb9, 0x46, 0xb0, 0x46, 0xf0, 0xbd,
-  0x32, 0x00, 0x69, 0x78, 0x28, 0x78, 0x00, 0xf0, 0xbf, 0xf8, 0xf4, 0xe7,
-  0x01, 0x21, 0x58, 0x4b, 0x1a, 0x78, 0x8a, 0x43, 0x1a, 0x70, 0x1a, 0x78,
-  0x01, 0x31, 0x8a, 0x43, 0x1a, 0x70, 0x00, 0x22, 0x5a, 0x70, 0x1a, 0x78,
-  0x02, 0x31, 0x8a, 0x43, 0x1a, 0x70, 0xca, 0xe7, 0x51, 0x49, 0x52, 0x4f,
-  0x89, 0x46, 0x52, 0x49, 0x00, 0x24, 0x00, 0x23, 0x88, 0x46, 0x3a, 0x78,
-  0x12, 0xe0, 0x43, 0x46, 0x1b, 0x68, 0x61, 0x01, 0x5b, 0x18, 0x00, 0x2b,
-  0x06, 0xd0, 0xdb, 0x69, 0x00, 0x2b, 0x03, 0xd0, 0x69, 0x68, 0x28, 0x78,
-  0x98, 0x47, 0x3a, 0x78, 0x01, 0x34, 0xe4, 0xb2, 0x51, 0x1c, 0x23, 0x00,
-  0xa1, 0x42, 0x17, 0xdb, 0x94, 0x42, 0xea, 0xd3, 0x9b, 0x1a, 0x5b, 0x01,
-  0x4b, 0x44, 0xec, 0xe7, 0x3f, 0x4b, 0x1a, 0x78, 0xd2, 0x07, 0xbe, 0xd5,
-  0x04, 0x21, 0x1a, 0x78, 0x0a, 0x43, 0x1a, 0x70, 0x9f, 0xe7, 0x3b, 0x4b,
-  0x1a, 0x78, 0xd2, 0x07, 0xb5, 0xd5, 0x04, 0x21, 0x1a, 0x78, 0x8a, 0x43,
-  0x1a, 0x70, 0x96, 0xe7, 0x36, 0x4f, 0x3b, 0x78, 0x5b, 0x07, 0x2b, 0xd5,
-  0x04, 0x22, 0x3b, 0x78, 0x00, 0x21, 0x93, 0x43, 0x3b, 0x70, 0x6b, 0x46,
-  0x06, 0x32, 0x98, 0x1d, 0x00, 0xf0, 0x94, 0xf8, 0x2b, 0x78, 0x01, 0xac,
-  0x23, 0x70, 0x05, 0x23, 0x63, 0x70, 0x2c, 0x4b, 0x1b, 0x68, 0x98, 0x46,
-  0x5a, 0x69, 0xef, 0xf3, 0x10, 0x81, 0x72, 0xb6, 0x13, 0x68, 0x00, 0x2b,
-  0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f, 0x43, 0x46, 0x40, 0x46, 0x99, 0x61,
-  0x21, 0x00, 0x00, 0xf0, 0x5d, 0xf8, 0x43, 0x46, 0x5a, 0x69, 0x9b, 0x69,
-  0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x21, 0x11, 0x60, 0x83, 0xf3, 0x10, 0x88,
-  0x00, 0x28, 0x31, 0xd1, 0xfb, 0x78, 0xdb, 0x07, 0x00, 0xd4, 0x7c, 0xe7,
-  0x6b, 0x46, 0x0a, 0x22, 0x00, 0x21, 0x98, 0x1d, 0x00, 0xf0, 0x68, 0xf8,
-  0x2b, 0x78, 0x01, 0xac, 0x23, 0x70, 0x03, 0x23, 0x63, 0x70, 0x6b, 0x68,
-  0x63, 0x60, 0x15, 0x4b, 0x1d, 0x68, 0x6a, 0x69, 0xef, 0xf3, 0x10, 0x81,
-  0x72, 0xb6, 0x13, 0x68, 0x00, 0x2b, 0xfc, 0xd0, 0xbf, 0xf3, 0x5f, 0x8f,
-  0xa9, 0x61, 0x28, 0x00, 0x21, 0x00, 0x00, 0xf0, 0x31, 0xf8, 0x6a, 0x69,
-  0xab, 0x69, 0xbf, 0xf3, 0x5f, 0x8f, 0x00, 0x21, 0x11, 0x60, 0x83, 0xf3,
-  0x10, 0x88, 0x00, 0x28, 0x00, 0xd1, 0x54, 0xe7, 0x32, 0x00, 0x61, 0x78,
-  0x20, 0x78, 0x00, 0xf0, 0x19, 0xf8, 0x4e, 0xe7, 0x32, 0x00, 0x61, 0x78,
-  0x20, 0x78, 0x00, 0xf0, 0x13, 0xf8, 0xc7, 0xe7, 0x34, 0x74, 0x00, 0x10,
-  0x0b, 0x21, 0x00, 0x20, 0xb0, 0x17, 0x00, 0x20, 0x58, 0x17, 0x00, 0x20,
-  0x50, 0x74, 0x00, 0x10, 0x09, 0x21, 0x00, 0x20, 0x2c, 0x14, 0x00, 0x20,
-  0x70, 0x47, 0xc0, 0x46, 0x00, 0x00, 0x00, 0x00, 0x01, 0xb4, 0x02, 0x48,
-  0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf, 0xf9, 0x4f, 0x00, 0x10,
-  0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf,
-  0x49, 0x6a, 0x00, 0x10, 0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc,
-  0x60, 0x47, 0x00, 0xbf, 0xe1, 0x12, 0x00, 0x10, 0x01, 0xb4, 0x02, 0x48,
-  0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf, 0xcd, 0x27, 0x00, 0x10,
-  0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf,
-  0xf9, 0x03, 0x00, 0x10, 0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc,
-  0x60, 0x47, 0x00, 0xbf, 0xa1, 0x28, 0x00, 0x10, 0x01, 0xb4, 0x02, 0x48,
-  0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf, 0x05, 0x04, 0x00, 0x10,
-  0x01, 0xb4, 0x02, 0x48, 0x84, 0x46, 0x01, 0xbc, 0x60, 0x47, 0x00, 0xbf,
-  0xe5, 0x13, 0x00, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xb5, 0x48, 0x68,
-  0x01, 0x31, 0x8e, 0x46, 0x00, 0x47, 0x70, 0x46, 0x09, 0x38, 0x01, 0x49,
-  0x88, 0x47, 0x01, 0xbd, 0x25, 0x0a, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x88, 0x10, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x50, 0x33, 0x00, 0x00,
-  0x4c, 0x33, 0x00, 0x00, 0x54, 0x33, 0x00, 0x00, 0x52, 0x33, 0x00, 0x00,
-  0x4d, 0x53, 0x00, 0x00, 0x4d, 0x43, 0x00, 0x00, 0x53, 0x34, 0x00, 0x00,
-  0x43, 0x34, 0x00, 0x00, 0x55, 0x43, 0x00, 0x10, 0x61, 0x44, 0x00, 0x10,
-  0xa1, 0x43, 0x00, 0x10, 0x75, 0x44, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x01, 0x00, 0x00, 0xc1, 0x47, 0x00, 0x10, 0x71, 0x47, 0x00, 0x10,
-  0xe1, 0x46, 0x00, 0x10, 0x59, 0x46, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x01, 0x00, 0x00, 0xb4, 0x17, 0x00, 0x20, 0x10, 0x00, 0x0c, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-unsigned int blinky_bin_len = 33920;
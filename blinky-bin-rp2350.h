@@ -1,4 +1,7 @@
-unsigned char blinky_bin[] = {
+// blinky.bin for the RP2350, made by image-header.py
+#pragma once
+#include <cstdint>
+alignas(256) const unsigned char blinky_rp2350[] = {
   0x00, 0x20, 0x08, 0x20, 0x5d, 0x01, 0x00, 0x10, 0x13, 0x01, 0x00, 0x10,
   0x15, 0x01, 0x00, 0x10, 0x11, 0x01, 0x00, 0x10, 0x11, 0x01, 0x00, 0x10,
   0x11, 0x01, 0x00, 0x10, 0x11, 0x01, 0x00, 0x10, 0x11, 0x01, 0x00, 0x10,
@@ -2547,6 +2550,26 @@ unsigned char blinky_bin[] = {
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   0xd3, 0xde, 0xff, 0xff, 0xfe, 0x01, 0x00, 0x00, 0xff, 0x01, 0x00, 0x00,
-  0xd4, 0x89, 0xff, 0xff, 0x79, 0x35, 0x12, 0xab
+  0xd4, 0x89, 0xff, 0xff, 0x79, 0x35, 0x12, 0xab, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+const unsigned int blinky_rp2350_len = 30720;
+const uint32_t blinky_rp2350_crc = 0xdbd1d495;
+const uint32_t blinky_rp2350_entry = 0x1000015d;
+const uint32_t blinky_rp2350_sector_hashes[] = {
+  0xbd9bdb55, 0x6867d685, 0xbdd5cbc3, 0x3bfcbc85, 0x3c461601, 0xf16c19f4,
+  0x960ae1ce, 0xd89ecd98
+};
+const uint32_t blinky_rp2350_segments[][2] = {
+  { 0x00000000, 30584 }
 };
-unsigned int blinky_bin_len = 30584;
@@ -0,0 +1,7 @@
+const unsigned char caller_batch_bin[] = {
+  0x00, 0x2d, 0x0f, 0xd0, 0x27, 0x68, 0x60, 0x68, 0xa1, 0x68, 0xe2, 0x68,
+  0x23, 0x69, 0x01, 0x26, 0x37, 0x43, 0xb8, 0x47, 0x60, 0x61, 0x18, 0x34,
+  0x6d, 0x1e, 0x46, 0x46, 0x00, 0x2e, 0xef, 0xd0, 0x00, 0x28, 0xed, 0xda,
+  0x00, 0xbe, 0xeb, 0xe7
+};
+const unsigned int caller_batch_bin_len = 40;
@@ -0,0 +1,53 @@
+# ARM Thumb instructions needed to run a batch of function calls
+# on an RP2040 in one resume (see RomCallBatch).
+#
+# r4 points to a table of r5 entries of 24 bytes:
+#
+#   +0   Function address
+#   +4   r0
+#   +8   r1
+#   +12  r2
+#   +16  r3
+#   +20  Return value (r0)
+#
+# Each function is called in turn and its result stored, then the core
+# halts on a BKPT. If r8 is not zero, a negative result halts the core
+# straight after it is stored and the calls after it are not made. r4, 
+# r5 and r8 are callee-saved so they survive the calls.
+#
+# llvm-mc -triple=thumbv6m-none-eabi -mcpu=cortex-m0plus -filetype=obj ../caller-batch.s -o caller-batch.obj
+# (or arm-none-eabi-as --warn --fatal-warnings -mcpu=cortex-m0plus ../caller-batch.s -o caller-batch.obj)
+# llvm-objcopy -O binary caller-batch.obj caller-batch.bin
+# xxd -i caller-batch.bin | sed 's/^unsigned/const unsigned/' > ../caller-batch-bin.h
+    .syntax unified
+    .cpu cortex-m0plus
+    .thumb
+    .section .text
+    .align 2
+    .thumb_func
+    .global batch_start
+batch_start:
+next_call:
+    cmp r5, #0
+    beq batch_done
+    ldr r7, [r4, #0]
+    ldr r0, [r4, #4]
+    ldr r1, [r4, #8]
+    ldr r2, [r4, #12]
+    ldr r3, [r4, #16]
+# Make sure that the LSB is set (i.e. thumb mode)
+    movs r6, #1
+    orrs r7, r7, r6
+    blx r7
+    str r0, [r4, #20]
+    adds r4, r4, #24
+    subs r5, r5, #1
+    mov r6, r8
+    cmp r6, #0
+    beq next_call
+    cmp r0, #0
+    bge next_call
+# Halt on return
+batch_done:
+    bkpt #0
+    b next_call
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+#
+# Writes a target flash image out as a C header for ImageStore. The array
+# is const and page-aligned so that it stays in the programmer's flash
+# and FlashLoader can send it straight from XIP. The image is padded with
+# 0xff to a whole number of pages, which is what the flash holds there
+# after an erase anyway.
+#
+# Along with the data goes a manifest, worked out here so that the
+# programmer doesn't have to:
+#
+#   _len            The padded length
+#   _crc            CRC-32 of the image, as FlashLoader::verifyCrc()
+#                   wants it
+#   _entry          The reset vector
+#   _sector_hashes  FlashLoader::hash() of each 4K sector, padded with
+#                   0xff, as the loader stub computes it from the flash
+#   _segments       Flash offset and length of each load segment
+#
+# The input is either a raw binary, which is one segment at the start of
+# flash, or an ELF file, whose load segments are placed by their physical
+# address (so no objcopy step is needed). CMakeLists.txt runs this on the
+# blinky build.
+#
+# python3 ../image-header.py blinky.elf blinky_rp2040 rp2040 > ../blinky-bin-rp2040.h
+#
+import struct
+import sys
+import zlib
+
+PAGE_SIZE = 256
+SECTOR_SIZE = 4096
+XIP_BASE = 0x10000000
+MAX_FLASH_SIZE = 16 * 1024 * 1024
+PT_LOAD = 1
+FNV_OFFSET = 2166136261
+FNV_PRIME = 16777619
+
+# Where the reset vector is: behind the 256-byte boot2 on the RP2040,
+# at the very start of the image on the RP2350
+RESET_VECTOR = { 'rp2040': 0x104, 'rp2350': 0x004 }
+
+def elf_segments(elf):
+    if elf[4] != 1 or elf[5] != 1:
+        raise ValueError("not a little-endian ELF32 file")
+    phoff, = struct.unpack_from('<I', elf, 28)
+    phentsize, phnum = struct.unpack_from('<HH', elf, 42)
+    segments = []
+    for i in range(phnum):
+        type, offset, vaddr, paddr, filesz = struct.unpack_from('<5I', elf, phoff + i * phentsize)
+        if type != PT_LOAD or filesz == 0:
+            continue
+        if paddr < XIP_BASE or paddr + filesz > XIP_BASE + MAX_FLASH_SIZE:
+            raise ValueError("segment at %08x is outside of flash" % paddr)
+        segments.append((paddr - XIP_BASE, elf[offset:offset + filesz]))
+    return sorted(segments)
+
+def fnv(data):
+    h = FNV_OFFSET
+    for (w,) in struct.iter_unpack('<I', data):
+        h = ((h ^ w) * FNV_PRIME) & 0xffffffff
+    return h
+
+def main():
+    if len(sys.argv) != 4 or sys.argv[3] not in RESET_VECTOR:
+        print("usage: image-header.py <image.bin|image.elf> <name> rp2040|rp2350", file=sys.stderr)
+        sys.exit(1)
+    with open(sys.argv[1], 'rb') as f:
+        file = f.read()
+    name = sys.argv[2]
+    chip = sys.argv[3]
+
+    segments = elf_segments(file) if file.startswith(b'\x7fELF') else [(0, file)]
+    image = bytearray()
+    for offset, data in segments:
+        image.extend(b'\xff' * (offset - len(image)))
+        image[offset:offset + len(data)] = data
+    image.extend(b'\xff' * (-len(image) % PAGE_SIZE))
+
+    crc = zlib.crc32(image)
+    v = RESET_VECTOR[chip]
+    entry = int.from_bytes(image[v:v + 4], 'little')
+    hashes = []
+    for pos in range(0, len(image), SECTOR_SIZE):
+        sector = image[pos:pos + SECTOR_SIZE]
+        hashes.append(fnv(sector + b'\xff' * (SECTOR_SIZE - len(sector))))
+
+    print("// %s for the %s, made by image-header.py" % (sys.argv[1].split('/')[-1], chip.upper()))
+    print("#pragma once")
+    print("#include <cstdint>")
+    print("alignas(256) const unsigned char %s[] = {" % name)
+    for i in range(0, len(image), 12):
+        line = ", ".join("0x%02x" % b for b in image[i:i + 12])
+        print("  " + line + ("," if i + 12 < len(image) else ""))
+    print("};")
+    print("const unsigned int %s_len = %u;" % (name, len(image)))
+    print("const uint32_t %s_crc = 0x%08x;" % (name, crc))
+    print("const uint32_t %s_entry = 0x%08x;" % (name, entry))
+    print("const uint32_t %s_sector_hashes[] = {" % name)
+    for i in range(0, len(hashes), 6):
+        line = ", ".join("0x%08x" % h for h in hashes[i:i + 6])
+        print("  " + line + ("," if i + 6 < len(hashes) else ""))
+    print("};")
+    print("const uint32_t %s_segments[][2] = {" % name)
+    print(",\n".join("  { 0x%08x, %u }" % (offset, len(data)) for offset, data in segments))
+    print("};")
+
+if __name__ == "__main__":
+    main()
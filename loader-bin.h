@@ -0,0 +1,18 @@
+const unsigned char loader_bin[] = {
+  0x3b, 0xe0, 0x01, 0xe0, 0x10, 0xe0, 0x30, 0xe0, 0x10, 0xb4, 0x05, 0x4a,
+  0x05, 0x4b, 0x10, 0xc8, 0x62, 0x40, 0x5a, 0x43, 0x49, 0x1e, 0xfa, 0xd1,
+  0x10, 0x46, 0x10, 0xbc, 0x70, 0x47, 0x00, 0x00, 0xc5, 0x9d, 0x1c, 0x81,
+  0x93, 0x01, 0x00, 0x01, 0x70, 0xb5, 0x82, 0x18, 0x0e, 0x46, 0x90, 0x42,
+  0x19, 0xd2, 0x03, 0x78, 0x40, 0x1c, 0x80, 0x2b, 0x07, 0xd2, 0x5b, 0x1c,
+  0x04, 0x78, 0x40, 0x1c, 0x0c, 0x70, 0x49, 0x1c, 0x5b, 0x1e, 0xf9, 0xd1,
+  0xf1, 0xe7, 0x7d, 0x3b, 0x04, 0x78, 0x45, 0x78, 0x80, 0x1c, 0x2d, 0x02,
+  0x2c, 0x43, 0x0c, 0x1b, 0x25, 0x78, 0x64, 0x1c, 0x0d, 0x70, 0x49, 0x1c,
+  0x5b, 0x1e, 0xf9, 0xd1, 0xe3, 0xe7, 0x88, 0x1b, 0x70, 0xbd, 0x00, 0x23,
+  0xdb, 0x43, 0x04, 0xc8, 0x13, 0x40, 0x49, 0x1e, 0xfb, 0xd1, 0x18, 0x46,
+  0x70, 0x47, 0x25, 0x46, 0x2f, 0x68, 0x00, 0x2f, 0xfc, 0xd0, 0x01, 0x2f,
+  0x0f, 0xd0, 0x68, 0x68, 0xa9, 0x68, 0xea, 0x68, 0x2b, 0x69, 0x01, 0x26,
+  0x37, 0x43, 0xb8, 0x47, 0x68, 0x61, 0x00, 0x20, 0x28, 0x60, 0x20, 0x35,
+  0x28, 0x46, 0x00, 0x1b, 0x00, 0x0a, 0xeb, 0xd0, 0xe9, 0xe7, 0x00, 0x20,
+  0x28, 0x60, 0x00, 0xbe, 0xe5, 0xe7
+};
+const unsigned int loader_bin_len = 174;
@@ -0,0 +1,154 @@
+# A RAM-resident stub that calls target functions on behalf of the
+# programmer without halting between calls.
+#
+# r4 points to a mailbox, which is a ring of 8 call slots of 32 bytes:
+#
+#   +0   Function address (0 = slot empty, 1 = stop)
+#   +4   r0
+#   +8   r1
+#   +12  r2
+#   +16  r3
+#   +20  Return value (r0)
+#   +24  Unused
+#
+# The stub works through the slots in order. It waits for a non-zero
+# function address, makes the call, stores the result and then clears
+# the function address to hand the slot back. A stop request clears
+# its slot and halts with a BKPT. Resuming starts again from the first
+# slot.
+#
+# The programmer fills in the arguments before the function address,
+# and can keep posting calls (and filling data buffers) while the core
+# is busy with earlier ones.
+#
+# Entry points (offsets from the load address), which stay put as the
+# code behind them changes:
+#
+#   +0   The mailbox loop (r4 = mailbox)
+#   +2   hash(addr, words): returns an FNV-1a hash of the words at 
+#        addr, e.g. a sector of flash through XIP
+#   +4   unpack(src, dst, len): expands len bytes of compressed data 
+#        (see pack-image.py) and returns the number of bytes written
+#   +6   blank(addr, words): returns the AND of the words at addr, 
+#        which is 0xffffffff for erased flash
+#
+# llvm-mc -triple=thumbv6m-none-eabi -mcpu=cortex-m0plus -filetype=obj ../loader.s -o loader.obj
+# (or arm-none-eabi-as --warn --fatal-warnings -mcpu=cortex-m0plus ../loader.s -o loader.obj)
+# llvm-objcopy -O binary loader.obj loader.bin
+# xxd -i loader.bin | sed 's/^unsigned/const unsigned/' > ../loader-bin.h
+    .syntax unified
+    .cpu cortex-m0plus
+    .thumb
+    .section .text
+    .align 2
+    .thumb_func
+    .global loader_start
+loader_start:
+# (branches go to the local labels so that no relocation is needed)
+    b first_slot
+    b hash
+    b unpack
+    b blank
+    .align 2
+hash:
+    push {r4}
+    ldr r2, =2166136261
+    ldr r3, =16777619
+hash_loop:
+    ldm r0!, {r4}
+    eors r2, r2, r4
+    muls r2, r3, r2
+    subs r1, r1, #1
+    bne hash_loop
+    mov r0, r2
+    pop {r4}
+    bx lr
+    .ltorg
+# Tokens are a control byte c followed by:
+#   c < 0x80   c + 1 literal bytes
+#   c >= 0x80  a 16-bit little-endian distance back into the output;
+#              (c & 0x7f) + 3 bytes are copied from there, one at a 
+#              time so that the copy can overlap itself (runs)
+unpack:
+    push {r4, r5, r6, lr}
+# r2 = end of the input, r6 = start of the output
+    adds r2, r0, r2
+    mov r6, r1
+unpack_next:
+    cmp r0, r2
+    bhs unpack_done
+    ldrb r3, [r0]
+    adds r0, r0, #1
+    cmp r3, #0x80
+    bhs unpack_match
+    adds r3, r3, #1
+unpack_literal:
+    ldrb r4, [r0]
+    adds r0, r0, #1
+    strb r4, [r1]
+    adds r1, r1, #1
+    subs r3, r3, #1
+    bne unpack_literal
+    b unpack_next
+unpack_match:
+# (c - 0x80) + 3
+    subs r3, r3, #0x7d
+    ldrb r4, [r0]
+    ldrb r5, [r0, #1]
+    adds r0, r0, #2
+    lsls r5, r5, #8
+    orrs r4, r4, r5
+    subs r4, r1, r4
+unpack_copy:
+    ldrb r5, [r4]
+    adds r4, r4, #1
+    strb r5, [r1]
+    adds r1, r1, #1
+    subs r3, r3, #1
+    bne unpack_copy
+    b unpack_next
+unpack_done:
+    subs r0, r1, r6
+    pop {r4, r5, r6, pc}
+blank:
+    movs r3, #0
+    mvns r3, r3
+blank_loop:
+    ldm r0!, {r2}
+    ands r3, r3, r2
+    subs r1, r1, #1
+    bne blank_loop
+    mov r0, r3
+    bx lr
+first_slot:
+    mov r5, r4
+wait:
+    ldr r7, [r5, #0]
+    cmp r7, #0
+    beq wait
+    cmp r7, #1
+    beq stop
+    ldr r0, [r5, #4]
+    ldr r1, [r5, #8]
+    ldr r2, [r5, #12]
+    ldr r3, [r5, #16]
+# Make sure that the LSB is set (i.e. thumb mode)
+    movs r6, #1
+    orrs r7, r7, r6
+    blx r7
+    str r0, [r5, #20]
+    movs r0, #0
+    str r0, [r5, #0]
+# Next slot, wrapping after 256 bytes. r4 and r5 are callee-saved so
+# they survive the call.
+    adds r5, r5, #32
+    mov r0, r5
+    subs r0, r0, r4
+    lsrs r0, r0, #8
+    beq wait
+    b first_slot
+stop:
+    movs r0, #0
+    str r0, [r5, #0]
+    bkpt #0
+    b first_slot
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+#
+# Compresses a flash image for FlashLoader::programPacked() and writes
+# it out as a C header, in the same style as xxd -i.
+#
+# Each 4K sector is compressed on its own so that sectors can be
+# unpacked (and skipped) independently. For each sector the stream
+# holds:
+#
+#   +0   Compressed length (16 bits, little-endian)
+#   +2   Unpacked length (16 bits), a whole number of 256-byte pages
+#   +4   The compressed tokens, zero-padded to a multiple of 4 bytes
+#
+# The token format is decoded by unpack in loader.s:
+#
+#   c < 0x80   c + 1 literal bytes follow
+#   c >= 0x80  a 16-bit little-endian distance follows and
+#              (c & 0x7f) + 3 bytes are copied from that far back
+#              in the output (the copy may overlap itself)
+#
+# python3 ../pack-image.py blinky.bin blinky_lz > ../blinky-lz-rp2040.h
+#
+import sys
+
+SECTOR_SIZE = 4096
+PAGE_SIZE = 256
+MIN_MATCH = 3
+MAX_MATCH = 0x7f + MIN_MATCH
+MAX_LITERALS = 0x80
+# How many earlier positions with the same 3-byte prefix are tried
+MAX_CHAIN = 64
+
+def compress(data):
+    out = bytearray()
+    literals = bytearray()
+    chains = {}
+
+    def flush_literals():
+        while literals:
+            run = literals[:MAX_LITERALS]
+            out.append(len(run) - 1)
+            out.extend(run)
+            del literals[:MAX_LITERALS]
+
+    def remember(pos):
+        if pos + MIN_MATCH <= len(data):
+            chains.setdefault(bytes(data[pos:pos + MIN_MATCH]), []).append(pos)
+
+    pos = 0
+    while pos < len(data):
+        best_len = 0
+        best_dist = 0
+        for cand in reversed(chains.get(bytes(data[pos:pos + MIN_MATCH]), [])[-MAX_CHAIN:]):
+            n = 0
+            while n < MAX_MATCH and pos + n < len(data) and data[cand + n] == data[pos + n]:
+                n += 1
+            if n > best_len:
+                best_len = n
+                best_dist = pos - cand
+                if n == MAX_MATCH:
+                    break
+        if best_len >= MIN_MATCH:
+            flush_literals()
+            out.append(0x80 | (best_len - MIN_MATCH))
+            out.append(best_dist & 0xff)
+            out.append(best_dist >> 8)
+            for i in range(best_len):
+                remember(pos + i)
+            pos += best_len
+        else:
+            literals.append(data[pos])
+            remember(pos)
+            pos += 1
+    flush_literals()
+    return out
+
+def unpack(src):
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        c = src[i]
+        i += 1
+        if c < 0x80:
+            out.extend(src[i:i + c + 1])
+            i += c + 1
+        else:
+            dist = src[i] | (src[i + 1] << 8)
+            i += 2
+            for _ in range((c & 0x7f) + MIN_MATCH):
+                out.append(out[-dist])
+    return out
+
+def pack(image):
+    stream = bytearray()
+    for pos in range(0, len(image), SECTOR_SIZE):
+        sector = bytearray(image[pos:pos + SECTOR_SIZE])
+        # flash_range_program() works in whole pages
+        sector.extend(b'\xff' * (-len(sector) % PAGE_SIZE))
+        tokens = compress(sector)
+        assert unpack(tokens) == sector
+        stream.extend(len(tokens).to_bytes(2, 'little'))
+        stream.extend(len(sector).to_bytes(2, 'little'))
+        stream.extend(tokens)
+        stream.extend(b'\x00' * (-len(tokens) % 4))
+    return stream
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage: pack-image.py <image.bin> <name>", file=sys.stderr)
+        sys.exit(1)
+    with open(sys.argv[1], 'rb') as f:
+        image = f.read()
+    name = sys.argv[2]
+    stream = pack(image)
+    print("// %s, %u bytes packed to %u" % (sys.argv[1].split('/')[-1], len(image), len(stream)))
+    # const, so that it stays in the programmer's flash
+    print("alignas(4) const unsigned char %s[] = {" % name)
+    for i in range(0, len(stream), 12):
+        line = ", ".join("0x%02x" % b for b in stream[i:i + 12])
+        print("  " + line + ("," if i + 12 < len(stream) else ""))
+    print("};")
+    print("const unsigned int %s_len = %u;" % (name, len(stream)))
+
+if __name__ == "__main__":
+    main()
@@ -14,9 +14,9 @@
 #include "hardware/gpio.h"
 #include "hardware/i2c.h"
 
-// NOTE: These relate to the TARGET board, not the flashing board.
-#include "blinky-bin-rp2040.h"
-//#include "blinky-bin-rp2350.h"
+// NOTE: The images relate to the TARGET board, not the flashing board.
+#include "ImageStore.h"
+#include "Chip.h"
 
 #include "kc1fsz-tools/SWDUtils.h"
 #include "kc1fsz-tools/rp2040/SWDDriver.h"
@@ -166,7 +166,17 @@ int prog_1() {
         return -200 + rc;
     }
     
-    if (const int rc = flash_and_verify(swd, 0, blinky_bin, blinky_bin_len); rc != 0) {
+    // The image is picked to suit the chip on the other end
+    const auto chipId = swd.readWordViaAP(Chip::CHIP_ID_ADDR);
+    const ImageStore::Image* image = !chipId.has_value() ? nullptr :
+        ImageStore::findFamily(ImageStore::familyForChipId(*chipId));
+    if (image == nullptr) {
+        printf("No image for this chip\n");
+        return -400;
+    }
+    printf("Flashing %s\n", image->name);
+
+    if (const int rc = flash_and_verify(swd, 0, image->data, image->len); rc != 0) {
         printf("Flashed failed\n");
         return -100 + rc;
     }
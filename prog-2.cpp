@@ -0,0 +1,424 @@
+/**
+ * A demonstration program that talks to an RP2040 or RP2350 via the SWD
+ * port using the PIO-based SWD driver.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+
+#include "hardware/gpio.h"
+
+#include "PioSWDDriver.h"
+#include "Chip.h"
+#include "FlashLoader.h"
+#include "RomTable.h"
+#include "RomCallBatch.h"
+#include "ImageStore.h"
+
+// NOTE: This relates to the TARGET board, not the flashing board. The 
+// plain images are in ImageStore.
+#include "blinky-lz-rp2040.h"
+// Optional, see the README
+#if __has_include("blinky-elf-rp2040.h")
+#include "blinky-elf-rp2040.h"
+#define HAVE_BLINKY_ELF
+#endif
+
+using namespace kc1fsz;
+
+const uint LED_PIN = 25;
+
+#define CLK_PIN (16)
+#define DIO_PIN (17)
+
+// DBGKEY plus C_DEBUGEN, with and without C_HALT (and without either)
+#define DHCSR_HALT (0xa05f0003)
+#define DHCSR_RUN (0xa05f0001)
+#define DHCSR_OFF (0xa05f0000)
+#define DHCSR_S_HALT (0x00020000)
+// DEMCR.VC_CORERESET
+#define DEMCR_VC_CORERESET (0x00000001)
+
+// caller.s, assembled. Sets the Thumb bit on r7, calls it and halts.
+static const uint32_t CALLER_BIN[] = { 0x43372601, 0xbe0047b8, 0x0000e7fa };
+// In the upper half of SRAM4, clear of the clock training area at its 
+// start. SRAM5 would be simpler, but it holds core 0's stack in a Pico 
+// SDK build (blinky's included) and the core is halted in the middle of
+// blinky when these run. SRAM4 is core 1's stack and blinky never 
+// starts core 1.
+#define CALLER_ADDR (0x20040800)
+// caller-batch.s and its table (at most 0x1a8 bytes), behind caller.s
+#define BATCH_ADDR (0x20040900)
+// The stack grows down from the top of SRAM4 towards the batch table
+#define STACK_TOP (0x20041000)
+
+void display_status(PioSWDDriver& swd) {
+
+    const uint32_t mask = (1 << PioSWDDriver::REG_PC) | (1 << PioSWDDriver::REG_LR) |
+        (1 << PioSWDDriver::REG_MSP) | (1 << PioSWDDriver::REG_XPSR) | 
+        (1 << PioSWDDriver::REG_CONTROL) | (1 << PioSWDDriver::REG_R0) | 
+        (1 << PioSWDDriver::REG_R7);
+    if (const auto r = swd.readCoreRegisters(mask); !r.has_value()) {
+        printf("Register read failed\n");
+        return;
+    } else {
+        printf("PC=%08X, LR=%08X, MSP=%08X\n", r->r[PioSWDDriver::REG_PC], 
+            r->r[PioSWDDriver::REG_LR], r->r[PioSWDDriver::REG_MSP]);
+        printf("XSPR  %08X\n", r->r[PioSWDDriver::REG_XPSR]);
+        printf("CTL/PRIMASK  %08X\n", r->r[PioSWDDriver::REG_CONTROL]);
+        printf("r0=%08X, r7=%08X\n", r->r[PioSWDDriver::REG_R0], r->r[PioSWDDriver::REG_R7]);
+    }
+
+    // Everything is queued and then run in one go
+    uint32_t aircr = 0, icsr = 0, icpr = 0, dhcsr = 0, dfsr = 0, demcr = 0;
+    swd.queueReadWordViaAP(PioSWDDriver::ARM_AIRCR, &aircr);
+    swd.queueReadWordViaAP(0xe000ed04, &icsr);
+    swd.queueReadWordViaAP(0xe000e280, &icpr);
+    swd.queueReadWordViaAP(PioSWDDriver::ARM_DHCSR, &dhcsr);
+    swd.queueReadWordViaAP(0xe000ed30, &dfsr);
+    swd.queueReadWordViaAP(PioSWDDriver::ARM_DEMCR, &demcr);
+    if (const int rc = swd.flush(); rc != 0) {
+        printf("Status read failed %d\n", rc);
+        return;
+    }
+
+    printf("AIRCR %08X\n", aircr);
+    printf("ICSR  %08X\n", icsr);
+    if (icsr & 0x00400000)
+        printf("  ISRPENDING set\n");
+    printf("ICPR  %08X\n", icpr);
+    printf("DHCSR %08X\n", dhcsr);
+    printf("DFSR  %08X\n", dfsr);
+    printf("DEMCR %08X\n", demcr);
+}
+
+void print_wait_stats(const char* name, const PioSWDDriver::WaitStats& s) {
+    printf("%s: transfers %u, stalled %u, WAITs %u, stall %u us, exhausted %u\n",
+        name, s.transfers, s.stalled, s.waits, s.stallUs, s.exhausted);
+    printf("  histogram:");
+    for (unsigned i = 0; i < PioSWDDriver::WaitStats::BUCKETS; i++)
+        printf(" %u", s.histogram[i]);
+    printf("\n");
+}
+
+void dump_memory(PioSWDDriver& swd, uint32_t addr, unsigned words) {
+    uint32_t buf[64];
+    if (words > 64)
+        words = 64;
+    if (const int rc = swd.readBlockViaAP(addr, buf, words); rc != 0) {
+        printf("Memory read failed %d\n", rc);
+        return;
+    }
+    for (unsigned i = 0; i < words; i++) {
+        if (i % 4 == 0)
+            printf("%08X:", addr + i * 4);
+        printf(" %08X", buf[i]);
+        if (i % 4 == 3 || i == words - 1)
+            printf("\n");
+    }
+}
+
+/**
+ * Runs a target function through the caller.s trampoline, which must 
+ * already be loaded at CALLER_ADDR. The core must be halted.
+ */
+int call_function(PioSWDDriver& swd, uint32_t func, uint32_t arg, bool minimal, 
+    uint32_t* result) {
+
+    PioSWDDriver::CoreRegisters regs;
+    regs.mask = (1 << PioSWDDriver::REG_R0) | (1 << PioSWDDriver::REG_R7) | 
+        (1 << PioSWDDriver::REG_SP) | (1 << PioSWDDriver::REG_PC) | 
+        (1 << PioSWDDriver::REG_XPSR);
+    regs.r[PioSWDDriver::REG_R0] = arg;
+    regs.r[PioSWDDriver::REG_R7] = func;
+    regs.r[PioSWDDriver::REG_SP] = STACK_TOP;
+    regs.r[PioSWDDriver::REG_PC] = CALLER_ADDR;
+    // Thumb
+    regs.r[PioSWDDriver::REG_XPSR] = 0x01000000;
+    if (const int rc = swd.writeCoreRegisters(regs, minimal); rc != 0)
+        return rc;
+
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DHCSR, DHCSR_RUN); rc != 0)
+        return rc;
+    // Wait for the BKPT
+    bool halted = false;
+    for (unsigned i = 0; i < 1000 && !halted; i++) {
+        if (const auto r = swd.readWordViaAP(PioSWDDriver::ARM_DHCSR); !r.has_value())
+            return -1;
+        else 
+            halted = (*r & DHCSR_S_HALT) != 0;
+    }
+    if (!halted)
+        return -2;
+
+    if (const auto r = swd.readCoreRegisters(1 << PioSWDDriver::REG_R0); !r.has_value())
+        return -3;
+    else
+        *result = r->r[PioSWDDriver::REG_R0];
+    return 0;
+}
+
+void call_demo(PioSWDDriver& swd) {
+
+    if (const int rc = swd.writeBlockViaAP(CALLER_ADDR, CALLER_BIN, 3); rc != 0) {
+        printf("Trampoline load failed %d\n", rc);
+        return;
+    }
+    // reverse32()
+    const auto func = RomTable::lookup(swd, 'R', '3');
+    if (!func.has_value()) {
+        printf("ROM lookup failed\n");
+        return;
+    }
+    printf("reverse32 at %08X\n", *func);
+
+    // The second call only needs r0 and PC
+    const uint32_t args[2] = { 0x00000001, 0x12345678 };
+    for (unsigned i = 0; i < 2; i++) {
+        const uint32_t before = swd.getCounters().packets;
+        uint32_t result = 0;
+        if (const int rc = call_function(swd, *func, args[i], i > 0, &result); rc != 0) {
+            printf("Call failed %d\n", rc);
+            return;
+        }
+        printf("reverse32(%08X) = %08X, %u packets\n", args[i], result, 
+            swd.getCounters().packets - before);
+    }
+}
+
+void batch_demo(PioSWDDriver& swd) {
+
+    // reverse32(), popcount32(), clz32() and ctz32() in one resume
+    const char* codes[] = { "R3", "P3", "L3", "T3" };
+    const uint32_t arg = 0x00f0f000;
+    RomCallBatch batch(BATCH_ADDR, STACK_TOP);
+    for (const char* code : codes) {
+        if (const auto func = RomTable::lookup(swd, code[0], code[1]); !func.has_value()) {
+            printf("ROM lookup failed\n");
+            return;
+        }
+        else
+            batch.add(*func, arg);
+    }
+
+    const uint32_t before = swd.getCounters().packets;
+    if (const int rc = batch.run(swd); rc != 0) {
+        printf("Batch failed %d\n", rc);
+        return;
+    }
+    for (unsigned i = 0; i < batch.size(); i++)
+        printf("%s(%08X) = %08X\n", codes[i], arg, batch.result(i));
+    printf("%u calls, %u packets\n", batch.size(), swd.getCounters().packets - before);
+}
+
+/**
+ * Resets the target and catches the core on its first instruction, 
+ * before the boot ROM has touched the flash.
+ */
+int reset_halt(PioSWDDriver& swd) {
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DHCSR, DHCSR_HALT); rc != 0)
+        return rc;
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DEMCR, DEMCR_VC_CORERESET); rc != 0)
+        return rc;
+    // SYSRESETREQ
+    swd.writeWordViaAP(PioSWDDriver::ARM_AIRCR, 0x05fa0004);
+    bool halted = false;
+    for (unsigned i = 0; i < 1000 && !halted; i++) {
+        if (const auto r = swd.readWordViaAP(PioSWDDriver::ARM_DHCSR); r.has_value())
+            halted = (*r & DHCSR_S_HALT) != 0;
+    }
+    if (!halted)
+        return -1;
+    return swd.writeWordViaAP(PioSWDDriver::ARM_DEMCR, 0);
+}
+
+void print_pass(const char* name, const FlashLoader::Stats& s, uint32_t us) {
+    printf("%s: written %u, skipped %u sectors, %u ms\n", name, s.sectorsWritten, 
+        s.sectorsSkipped, us / 1000);
+    printf("  erases: 64K %u, 32K %u, 4K %u, about %u ms\n", s.block64Erases, s.block32Erases,
+        s.sectorErases, s.eraseMs);
+    printf("  blank %u sectors, about %u ms of erase saved\n", s.sectorsBlank, s.eraseMsSaved);
+    if (s.bytesSent != 0 && us != 0)
+        printf("  %u bytes for %u, ratio %.2f, %.0f bytes/s\n", s.bytesSent, s.bytesProgrammed, 
+            (float)s.bytesProgrammed / s.bytesSent, s.bytesProgrammed * 1e6f / us);
+}
+
+void flash_demo(PioSWDDriver& swd, const Chip& chip) {
+
+    // The image is picked to suit the chip on the other end
+    const ImageStore::Image* image = ImageStore::findFamily(chip.family);
+    if (image == nullptr) {
+        printf("No image for this chip\n");
+        return;
+    }
+    printf("Image %s, %u bytes, CRC %08X, entry %08X\n", image->name, image->len, image->crc,
+        image->entry);
+
+    if (const int rc = reset_halt(swd); rc != 0) {
+        printf("Reset failed %d\n", rc);
+        return;
+    }
+
+    FlashLoader loader(swd);
+    loader.setChip(chip);
+    loader.setBlankCheck(true);
+    if (const int rc = loader.begin(); rc != 0) {
+        printf("Loader start failed %d\n", rc);
+        return;
+    }
+
+    // The same image three ways: raw, compressed and then again with 
+    // unchanged sectors skipped (which should be all of them). There is
+    // only a compressed copy of the RP2040 image.
+    int rc = 0;
+    for (unsigned pass = 0; pass < 3 && rc == 0; pass++) {
+        if (pass == 1 && &chip != &Chip::RP2040)
+            continue;
+        loader.resetStats();
+        loader.setSkipUnchanged(pass == 2);
+        const uint32_t start = time_us_32();
+        rc = pass == 1 ? 
+            loader.programPacked(0, blinky_lz, blinky_lz_len) :
+            loader.program(0, image->data, image->len, image->sectorHashes);
+        // Count the time spent on the last sectors too
+        if (rc == 0)
+            rc = loader.waitIdle();
+        if (rc != 0) {
+            printf("Programming failed %d\n", rc);
+            break;
+        }
+        const char* names[] = { "raw", "packed", "unchanged" };
+        print_pass(names[pass], loader.getStats(), time_us_32() - start);
+    }
+
+    // Against the manifest, so nothing has to be worked out here. The 
+    // sector hashes find any bad sectors without a readback.
+    if (rc == 0) {
+        rc = loader.verifyCrc(0, image->len, image->crc);
+        if (rc != 0) {
+            loader.verifyHashes(0, image->sectorHashes, image->sectorCount);
+            printf("Verify failed %d, %u bad sectors from %08X\n", rc, 
+                loader.getStats().sectorsBad, loader.getStats().firstBadOffset);
+        }
+    }
+
+    // Whatever happened, the stub is stopped and the flash put back 
+    // into XIP mode
+    if (const int endRc = loader.end(); endRc != 0) {
+        printf("Loader stop failed %d\n", endRc);
+        return;
+    }
+    if (rc == 0)
+        printf("Verified %u bytes\n", image->len);
+}
+
+#ifdef HAVE_BLINKY_ELF
+void elf_demo(PioSWDDriver& swd, const Chip& chip) {
+
+    if (const int rc = reset_halt(swd); rc != 0) {
+        printf("Reset failed %d\n", rc);
+        return;
+    }
+
+    FlashLoader loader(swd);
+    loader.setChip(chip);
+    loader.setBlankCheck(true);
+    if (const int rc = loader.begin(); rc != 0) {
+        printf("Loader start failed %d\n", rc);
+        return;
+    }
+
+    // Straight from the ELF, which stays where it is in this program's
+    // flash
+    const uint32_t start = time_us_32();
+    int rc = loader.programElf(blinky_elf, blinky_elf_len);
+    if (rc == 0)
+        rc = loader.waitIdle();
+    if (rc != 0)
+        printf("ELF programming failed %d\n", rc);
+    else
+        print_pass("elf", loader.getStats(), time_us_32() - start);
+
+    if (const int endRc = loader.end(); endRc != 0)
+        printf("Loader stop failed %d\n", endRc);
+}
+#endif
+
+int prog_2() {
+
+    PioSWDDriver swd(CLK_PIN, DIO_PIN);
+
+    swd.init();
+    const Chip* chip = Chip::connect(swd);
+    if (chip == nullptr)
+        return -1;
+
+    printf("Connect is good to an %s with IDCODE %08X, TARGETID %08X, APID %08X\n", 
+        chip->name, swd.getIDCODE(), swd.getTARGETID(), swd.getAPID());
+
+    // SRAM4 is only used by core 1, which blinky never starts
+    if (const int rc = swd.trainClock(0x20040000); rc != 0)
+        printf("Clock training failed %d\n", rc);
+    printf("SWCLK %u Hz\n", swd.getClockHz());
+
+    // The core registers can only be read while halted
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DHCSR, DHCSR_HALT); rc != 0)
+        return -2;
+    display_status(swd);
+    // The bit manipulation functions are only in the RP2040 ROM, and
+    // the blinky ELF is built for the RP2040
+    if (chip == &Chip::RP2040) {
+        call_demo(swd);
+        batch_demo(swd);
+    }
+    flash_demo(swd, *chip);
+#ifdef HAVE_BLINKY_ELF
+    if (chip == &Chip::RP2040)
+        elf_demo(swd, *chip);
+#endif
+    // The core is now parked in a BKPT, so turn off halting debug and 
+    // start blinky again from the top with SYSRESETREQ
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DHCSR, DHCSR_OFF); rc != 0)
+        return -3;
+    swd.writeWordViaAP(PioSWDDriver::ARM_AIRCR, 0x05fa0004);
+
+    // The start of the boot ROM
+    dump_memory(swd, 0x00000000, 16);
+
+    const PioSWDDriver::Counters& c = swd.getCounters();
+    printf("Packets %u, skipped SELECT %u, CSW %u, TAR %u\n", 
+        c.packets, c.skippedSelect, c.skippedCsw, c.skippedTar);
+    printf("WAIT %u, FAULT %u, protocol %u, parity %u, backoffs %u\n", 
+        c.waits, c.faults, c.protocolErrors, c.parityErrors, c.clockBackoffs);
+    print_wait_stats("default", swd.getWaitStats());
+    printf("ROM table walks %u\n", RomTable::getWalks());
+
+    return 0;
+}
+
+int main(int, const char**) {
+
+    stdio_init_all();
+
+    gpio_init(LED_PIN);
+    gpio_set_dir(LED_PIN, GPIO_OUT);
+
+    gpio_put(LED_PIN, 1);
+    sleep_ms(500);
+    gpio_put(LED_PIN, 0);
+    sleep_ms(500);
+
+    printf("PIO SWD Demonstration 2\n");
+
+    int rc = prog_2();
+    if (rc != 0)
+        printf("Failed %d\n", rc);
+    else
+        printf("Succeeded\n");
+
+    while (true) {
+    }
+}
@@ -0,0 +1,170 @@
+/**
+ * A programmer that takes target images over its USB CDC port (see
+ * send-image.py) rather than having them compiled in.
+ *
+ * Core 1 does nothing but move bytes from USB into a small ring of
+ * chunks while core 0 feeds the chunks through an ImageReceiver, so the
+ * next piece of the image is arriving while the last one is going out
+ * over SWD. The whole image is never held here.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#include "pico/util/queue.h"
+
+#include "PioSWDDriver.h"
+#include "Chip.h"
+#include "FlashLoader.h"
+#include "Uf2Decoder.h"
+#include "ImageReceiver.h"
+
+using namespace kc1fsz;
+
+#define CLK_PIN (16)
+#define DIO_PIN (17)
+
+// DBGKEY plus C_DEBUGEN, with and without C_HALT (and without either)
+#define DHCSR_HALT (0xa05f0003)
+#define DHCSR_OFF (0xa05f0000)
+#define DHCSR_S_HALT (0x00020000)
+// DEMCR.VC_CORERESET
+#define DEMCR_VC_CORERESET (0x00000001)
+
+#define CHUNK_COUNT (4)
+#define CHUNK_SIZE (1024)
+// A pause this long hands over a partly filled chunk
+#define CHUNK_GAP_US (500)
+
+struct Chunk {
+    uint8_t index;
+    uint16_t len;
+};
+
+static uint8_t chunks[CHUNK_COUNT][CHUNK_SIZE];
+// Chunks waiting for core 0, and chunks that core 1 may fill
+static queue_t fullQueue;
+static queue_t freeQueue;
+
+// Too big for the 2K stack
+static PioSWDDriver swdDriver(CLK_PIN, DIO_PIN);
+static FlashLoader loader(swdDriver);
+static Uf2Decoder uf2(loader);
+// The UF2 family is set for each target once it is known
+static ImageReceiver rx(loader, uf2, Uf2Family::RP2040);
+
+static void core1_main() {
+    // RomTable writes to our flash when it sees a new kind of chip,
+    // which happens in FlashLoader::begin() for each target and so long
+    // after this core is running from XIP. This lets that write park
+    // the core in RAM for its duration.
+    flash_safe_execute_core_init();
+    while (true) {
+        Chunk chunk;
+        queue_remove_blocking(&freeQueue, &chunk.index);
+        chunk.len = 0;
+        while (chunk.len < CHUNK_SIZE) {
+            const int c = getchar_timeout_us(chunk.len == 0 ? 1000000 : CHUNK_GAP_US);
+            if (c >= 0)
+                chunks[chunk.index][chunk.len++] = c;
+            else if (chunk.len > 0)
+                break;
+        }
+        queue_add_blocking(&fullQueue, &chunk);
+    }
+}
+
+/**
+ * Resets the target and catches the core on its first instruction,
+ * before the boot ROM has touched the flash.
+ */
+static int reset_halt(PioSWDDriver& swd) {
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DHCSR, DHCSR_HALT); rc != 0)
+        return rc;
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DEMCR, DEMCR_VC_CORERESET); rc != 0)
+        return rc;
+    // SYSRESETREQ
+    swd.writeWordViaAP(PioSWDDriver::ARM_AIRCR, 0x05fa0004);
+    bool halted = false;
+    for (unsigned i = 0; i < 1000 && !halted; i++) {
+        if (const auto r = swd.readWordViaAP(PioSWDDriver::ARM_DHCSR); r.has_value())
+            halted = (*r & DHCSR_S_HALT) != 0;
+    }
+    if (!halted)
+        return -1;
+    return swd.writeWordViaAP(PioSWDDriver::ARM_DEMCR, 0);
+}
+
+/**
+ * Takes one image from the host and programs it.
+ */
+static int receive_image(PioSWDDriver& swd, FlashLoader& loader, ImageReceiver& rx) {
+
+    if (const int rc = reset_halt(swd); rc != 0)
+        return rc;
+    if (const int rc = loader.begin(); rc != 0)
+        return rc;
+
+    loader.resetStats();
+    rx.reset();
+    uint32_t start = 0;
+    while (!rx.isDone()) {
+        Chunk chunk;
+        queue_remove_blocking(&fullQueue, &chunk);
+        if (start == 0)
+            start = time_us_32();
+        rx.put(chunks[chunk.index], chunk.len);
+        queue_add_blocking(&freeQueue, &chunk.index);
+    }
+    if (const int rc = rx.getResult(); rc != 0)
+        return rc;
+    if (const int rc = loader.end(); rc != 0)
+        return rc;
+
+    const FlashLoader::Stats& s = loader.getStats();
+    const uint32_t us = time_us_32() - start;
+    printf("# %u bytes in %u ms, %.0f bytes/s\n", rx.getImageLength(), us / 1000,
+        rx.getImageLength() * 1e6f / us);
+    printf("# erases: 64K %u, 32K %u, 4K %u, blank %u sectors\n", s.block64Erases,
+        s.block32Erases, s.sectorErases, s.sectorsBlank);
+
+    // Start the new image from the top
+    if (const int rc = swd.writeWordViaAP(PioSWDDriver::ARM_DHCSR, DHCSR_OFF); rc != 0)
+        return rc;
+    swd.writeWordViaAP(PioSWDDriver::ARM_AIRCR, 0x05fa0004);
+    return 0;
+}
+
+int main(int, const char**) {
+
+    stdio_init_all();
+
+    queue_init(&fullQueue, sizeof(Chunk), CHUNK_COUNT);
+    queue_init(&freeQueue, sizeof(uint8_t), CHUNK_COUNT);
+    for (uint8_t i = 0; i < CHUNK_COUNT; i++)
+        queue_add_blocking(&freeQueue, &i);
+    multicore_launch_core1(core1_main);
+
+    swdDriver.init();
+    loader.setBlankCheck(true);
+
+    // Lines starting with # are ignored by send-image.py
+    while (true) {
+        const Chip* chip = Chip::connect(swdDriver);
+        if (chip == nullptr) {
+            printf("# Connect failed\n");
+            sleep_ms(1000);
+            continue;
+        }
+        loader.setChip(*chip);
+        rx.setUf2Family(chip->family);
+        printf("# Target is an %s\n", chip->name);
+        if (const int rc = receive_image(swdDriver, loader, rx); rc != 0)
+            printf("# Failed %d\n", rc);
+        else
+            printf("# Succeeded\n");
+    }
+}
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# Sends a flash image to prog-3 over its USB CDC port. See ImageReceiver.h
+# for the framing. A .uf2 file (recognized by its first block) is sent as
+# it is and the programmer places each block itself, so no offset is 
+# needed.
+#
+# The port is put into raw mode directly with termios, so anything that
+# looks like a serial port (including a pty) will do.
+#
+# python3 send-image.py /dev/ttyACM0 blinky.bin [offset]
+# python3 send-image.py /dev/ttyACM0 blinky.uf2
+#
+import os
+import select
+import sys
+import termios
+import time
+import tty
+import zlib
+
+MAX_PAYLOAD = 1024
+UF2_BLOCK_SIZE = 512
+UF2_MAGIC = b'UF2\n\x57\x51\x5d\x9e'
+# Frames sent ahead of the last reply, which keeps the next frame
+# arriving while the programmer works on the last one
+WINDOW = 2
+# The END reply waits for the last sectors and the verify
+TIMEOUT = 10
+# The reply codes: ImageReceiver's own, and those of the PioSWDDriver,
+# FlashLoader and Uf2Decoder that it passes on
+ERRORS = {
+    '101': 'ERR_CRC', '102': 'ERR_SEQ', '103': 'ERR_FRAME',
+    '1': 'SWD WAIT', '2': 'SWD FAULT', '3': 'SWD protocol error', 
+    '4': 'SWD parity error', '5': 'SWD timeout',
+    '-1': 'programming failed', '6': 'verify failed', '7': 'bad unpacked length',
+    '-10': 'bad UF2 magic', '-11': 'bad UF2 block', '-12': 'bad UF2 address',
+    '-13': 'UF2 blocks missing'
+}
+
+def frame(type, seq, payload):
+    body = bytes([ord(type), seq & 0xff]) + len(payload).to_bytes(2, 'little') + payload
+    return b'\xa5\x5a' + body + zlib.crc32(body).to_bytes(4, 'little')
+
+class Port:
+
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+        self.pending = b''
+
+    def write(self, data):
+        while data:
+            data = data[os.write(self.fd, data):]
+
+    def read_line(self, timeout):
+        end = time.monotonic() + timeout
+        while b'\n' not in self.pending:
+            if time.monotonic() > end:
+                raise TimeoutError("no reply")
+            if select.select([self.fd], [], [], 0.1)[0]:
+                self.pending += os.read(self.fd, 256)
+        line, self.pending = self.pending.split(b'\n', 1)
+        return line.decode(errors='replace').strip()
+
+    def reply(self, timeout=TIMEOUT):
+        while True:
+            line = self.read_line(timeout)
+            # Anything else is the programmer talking to a person
+            if line.startswith('#') or not line:
+                print(line)
+                continue
+            words = line.split()
+            if words[0] == 'OK':
+                return int(words[1])
+            if words[0] == 'ERR':
+                raise RuntimeError("frame %s failed with %s" % (words[1], 
+                    ERRORS.get(words[2], words[2])))
+
+def send(port, image, offset):
+    if image.startswith(UF2_MAGIC):
+        if len(image) % UF2_BLOCK_SIZE != 0:
+            raise RuntimeError("not a whole number of UF2 blocks")
+        frames = [frame('U', 0, b'')]
+    else:
+        # The programmer checks the flash against the image padded with 
+        # 0xff to a whole number of words
+        crc = zlib.crc32(image + b'\xff' * (-len(image) % 4))
+        frames = [frame('B', 0, offset.to_bytes(4, 'little') + 
+            len(image).to_bytes(4, 'little') + crc.to_bytes(4, 'little'))]
+    for pos in range(0, len(image), MAX_PAYLOAD):
+        frames.append(frame('D', len(frames), image[pos:pos + MAX_PAYLOAD]))
+    frames.append(frame('E', len(frames), b''))
+
+    start = time.monotonic()
+    acked = 0
+    sent = 0
+    while acked < len(frames):
+        while sent < len(frames) and sent - acked < WINDOW:
+            port.write(frames[sent])
+            sent += 1
+        seq = port.reply()
+        if seq != acked & 0xff:
+            raise RuntimeError("reply for frame %d, expected %d" % (seq, acked & 0xff))
+        acked += 1
+    elapsed = time.monotonic() - start
+    print("%u bytes in %.2f s, %.0f bytes/s" % (len(image), elapsed, len(image) / elapsed))
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        print("usage: send-image.py <port> <image.bin> [offset]", file=sys.stderr)
+        sys.exit(1)
+    with open(sys.argv[2], 'rb') as f:
+        image = f.read()
+    offset = int(sys.argv[3], 0) if len(sys.argv) == 4 else 0
+    port = Port(sys.argv[1])
+    try:
+        send(port, image, offset)
+    except (RuntimeError, TimeoutError) as e:
+        print(e, file=sys.stderr)
+        sys.exit(1)
+    # The programmer's summary
+    try:
+        while True:
+            print(port.read_line(0.5))
+    except TimeoutError:
+        pass
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,82 @@
+/**
+ * The driver wired to a model target through the PIO model, for the
+ * host tests.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <string>
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+
+namespace kc1fsz {
+
+struct Bench {
+
+    static constexpr unsigned CLK_PIN = 2;
+    static constexpr unsigned DIO_PIN = 3;
+    static constexpr uint32_t RAM_BASE = 0x20000000;
+
+    RamBus ram;
+    SwdTarget swdTarget;
+    PioSWDDriver swd;
+    std::string edges;
+
+    /**
+     * The driver is initialized but not connected.
+     */
+    Bench(const SwdTarget::Config& config = SwdTarget::RP2040_CORE0, uint32_t ramSize = 0x1000)
+    :   ram(RAM_BASE, ramSize),
+        swdTarget(config, ram),
+        swd(CLK_PIN, DIO_PIN) {
+        PioModel::get().reset();
+        PioModel::get().attach(&swdTarget);
+        swd.init();
+    }
+
+    ~Bench() {
+        PioModel::get().traceEdges(nullptr);
+        PioModel::get().traceCycles(nullptr, nullptr);
+        PioModel::get().attach(nullptr);
+    }
+
+    /**
+     * Lets the state machine finish what the driver has handed it. The
+     * model only runs while the driver waits on it, so the tail of the
+     * last packet can still be in the TX FIFO when a call returns.
+     */
+    void settle() {
+        PioModel::get().drain();
+    }
+
+    /**
+     * A word of target RAM, once the wire has settled.
+     */
+    uint32_t& word(uint32_t addr) {
+        settle();
+        return ram.at(addr);
+    }
+
+    /**
+     * Records the edges from here on, see take().
+     */
+    void trace() {
+        PioModel::get().traceEdges(&edges);
+    }
+
+    /**
+     * @returns The edges recorded since the last call, after everything
+     *   the driver has sent is on the wire.
+     */
+    std::string take() {
+        settle();
+        std::string s = edges;
+        edges.clear();
+        return s;
+    }
+};
+
+}
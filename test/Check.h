@@ -0,0 +1,52 @@
+/**
+ * The few checks the host tests need. A failed check is reported with
+ * its location and the test carries on, main() returns check::result().
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+namespace kc1fsz::check {
+
+inline unsigned failures = 0;
+
+inline int result() {
+    if (failures == 0)
+        printf("PASS\n");
+    else
+        printf("FAIL (%u)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
+
+}
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        kc1fsz::check::failures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    const auto _a = (a); \
+    const auto _b = (b); \
+    if (!(_a == _b)) { \
+        printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld (%llx != %llx)\n", \
+            __FILE__, __LINE__, #a, #b, (long long)_a, (long long)_b, \
+            (unsigned long long)_a, (unsigned long long)_b); \
+        kc1fsz::check::failures++; \
+    } \
+} while (0)
+
+#define CHECK_STR(a, b) do { \
+    const std::string _a = (a); \
+    const std::string _b = (b); \
+    if (_a != _b) { \
+        printf("%s:%d: CHECK_STR(%s, %s) failed:\n  got      %s\n  expected %s\n", \
+            __FILE__, __LINE__, #a, #b, _a.c_str(), _b.c_str()); \
+        kc1fsz::check::failures++; \
+    } \
+} while (0)
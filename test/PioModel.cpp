@@ -0,0 +1,515 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <cstdlib>
+
+#include "hardware/clocks.h"
+
+#include "PioModel.h"
+#include "SimClock.h"
+
+struct pio_hw_t {
+    unsigned index;
+};
+
+static pio_hw_t pio0Instance = { 0 };
+pio_hw_t* const pio0_hw = &pio0Instance;
+
+namespace kc1fsz {
+
+static const unsigned OP_JMP = 0;
+static const unsigned OP_WAIT = 1;
+static const unsigned OP_IN = 2;
+static const unsigned OP_OUT = 3;
+static const unsigned OP_PUSH_PULL = 4;
+static const unsigned OP_MOV = 5;
+static const unsigned OP_IRQ = 6;
+static const unsigned OP_SET = 7;
+
+// Sources and destinations, where they are the same in each instruction
+static const unsigned SRC_PINS = 0;
+static const unsigned SRC_X = 1;
+static const unsigned SRC_Y = 2;
+static const unsigned SRC_NULL = 3;
+static const unsigned SRC_ISR = 6;
+static const unsigned SRC_OSR = 7;
+static const unsigned OUT_PINDIRS = 4;
+static const unsigned OUT_PC = 5;
+static const unsigned MOV_PC = 5;
+
+static uint32_t mask(unsigned bits) {
+    return bits >= 32 ? 0xffffffff : (1u << bits) - 1;
+}
+
+static uint32_t reverse(uint32_t v) {
+    uint32_t r = 0;
+    for (unsigned i = 0; i < 32; i++)
+        r |= ((v >> i) & 1) << (31 - i);
+    return r;
+}
+
+PioModel& PioModel::get() {
+    static PioModel model;
+    return model;
+}
+
+void PioModel::reset() {
+    WireTarget* target = _target;
+    *this = PioModel();
+    _target = target;
+}
+
+void PioModel::_fail(const char* what) const {
+    fprintf(stderr, "PIO model: %s (pc %u, cycle %llu)\n", what, _pc,
+        (unsigned long long)_cycles);
+    abort();
+}
+
+unsigned PioModel::addProgram(const pio_program_t& program) {
+    // The SDK allocates from the top of instruction memory down
+    const uint32_t need = mask(program.length);
+    int offset = program.origin >= 0 ? program.origin : (int)(INSTR_COUNT - program.length);
+    for (; offset >= 0; offset--) {
+        if (((need << offset) & _used) == 0)
+            break;
+        if (program.origin >= 0)
+            offset = -1;
+    }
+    if (offset < 0)
+        _fail("no room for the program");
+    for (unsigned i = 0; i < program.length; i++) {
+        uint16_t instr = program.instructions[i];
+        // JMP targets are relocated as the program is loaded
+        if ((instr >> 13) == OP_JMP)
+            instr += offset;
+        _instr[offset + i] = instr;
+    }
+    _used |= need << offset;
+    return offset;
+}
+
+void PioModel::setPins(uint32_t values, uint32_t pinMask) {
+    _pinValues = (_pinValues & ~pinMask) | (values & pinMask);
+}
+
+void PioModel::setPindirs(unsigned base, unsigned count, bool out) {
+    const uint32_t m = mask(count) << base;
+    _pinDirs = out ? _pinDirs | m : _pinDirs & ~m;
+}
+
+void PioModel::init(unsigned pc, const pio_sm_config& config) {
+    if (config.autopull || config.autopush)
+        _fail("autopull/autopush aren't modelled");
+    _config = config;
+    _clkdiv = config.clkdiv;
+    _enabled = false;
+    _pc = pc;
+    _delay = 0;
+    _x = 0;
+    _y = 0;
+    _osr = 0;
+    _osrCount = 32;
+    _isr = 0;
+    _isrCount = 0;
+    _txCount = 0;
+    _rxCount = 0;
+}
+
+void PioModel::setClkdiv(float div) {
+    if (div < 1.0f || div >= 65536.0f)
+        _fail("clock divider out of range");
+    _clkdiv = div;
+}
+
+void PioModel::putTx(uint32_t data) {
+    // A stall with commands waiting can only be a PUSH that the driver
+    // isn't collecting
+    while (_txCount == FIFO_DEPTH) {
+        if (!_step())
+            _fail("TX FIFO full and the state machine is stalled");
+    }
+    _tx[_txCount++] = data;
+}
+
+uint32_t PioModel::getRx() {
+    while (_rxCount == 0) {
+        if (!_step())
+            _fail("the driver waits for data but the state machine waits for a command");
+    }
+    const uint32_t data = _rx[0];
+    for (unsigned i = 1; i < _rxCount; i++)
+        _rx[i - 1] = _rx[i];
+    _rxCount--;
+    return data;
+}
+
+void PioModel::drain() {
+    while (_enabled && _step()) { }
+}
+
+void PioModel::runUntil(double ns) {
+    while (_enabled && sim::nowNs() < ns && _step()) { }
+}
+
+bool PioModel::_pin(unsigned pin) const {
+    if (_pinDirs & (1u << pin))
+        return (_pinValues >> pin) & 1;
+    bool level = false;
+    if (pin == _config.out_base && _target != nullptr && _target->driving(level))
+        return level;
+    if (!(_pullUps & (1u << pin)))
+        _fail("sampling a floating pin");
+    return true;
+}
+
+bool PioModel::_line(bool& hostDriving, bool& targetDriving) const {
+    const unsigned dio = _config.out_base;
+    bool level = false;
+    hostDriving = (_pinDirs >> dio) & 1;
+    targetDriving = _target != nullptr && _target->driving(level);
+    if (hostDriving)
+        return (_pinValues >> dio) & 1;
+    return targetDriving ? level : true;
+}
+
+static char lineChar(bool line, bool host, bool target) {
+    if (host && target)
+        return 'X';
+    if (host)
+        return line ? '1' : '0';
+    if (target)
+        return line ? 'H' : 'L';
+    return 'z';
+}
+
+bool PioModel::_step() {
+
+    if (!_enabled)
+        _fail("state machine not enabled");
+
+    const unsigned clk = _config.sideset_base;
+    const bool clkBefore = (_pinValues >> clk) & 1;
+    bool hostBefore, targetBefore;
+    const bool lineBefore = _line(hostBefore, targetBefore);
+
+    bool progressed = true;
+    if (_delay > 0) {
+        _delay--;
+    }
+    else {
+        const uint16_t instr = _instr[_pc];
+        const unsigned sideBits = _config.sideset_bit_count;
+        const unsigned delayBits = 5 - sideBits;
+        const unsigned field = (instr >> 8) & 0x1f;
+        // Side-set takes effect on the first cycle, even if the
+        // instruction then stalls
+        if (sideBits > 0 && (!_config.sideset_optional || (field & 0x10))) {
+            const unsigned valueBits = sideBits - (_config.sideset_optional ? 1 : 0);
+            setPins(((field >> delayBits) & mask(valueBits)) << clk, mask(valueBits) << clk);
+        }
+        bool jumped = false;
+        if (_execute(instr, jumped)) {
+            _delay = field & mask(delayBits);
+            if (!jumped)
+                _pc = _pc == _config.wrap ? _config.wrap_target : (_pc + 1) % INSTR_COUNT;
+        }
+        else {
+            progressed = false;
+        }
+    }
+
+    const bool clkAfter = (_pinValues >> clk) & 1;
+    if (!clkBefore && clkAfter) {
+        _risingEdges++;
+        if (_edges != nullptr)
+            *_edges += lineChar(lineBefore, hostBefore, targetBefore);
+        if (_target != nullptr)
+            _target->risingEdge(lineBefore, hostBefore);
+    }
+
+    bool host, target;
+    const bool line = _line(host, target);
+    if (host && target)
+        _contention++;
+    if (_clkTrace != nullptr)
+        *_clkTrace += clkAfter ? '^' : '_';
+    if (_dioTrace != nullptr)
+        *_dioTrace += lineChar(line, host, target);
+
+    _cycles++;
+    sim::advanceNs(_clkdiv * 1e9 / SYS_CLOCK_HZ);
+
+    return progressed;
+}
+
+bool PioModel::_execute(uint16_t instr, bool& jumped) {
+
+    const unsigned op = instr >> 13;
+    const unsigned a = (instr >> 5) & 7;
+    const unsigned b = instr & 0x1f;
+    const unsigned count = b == 0 ? 32 : b;
+
+    switch (op) {
+    case OP_JMP: {
+        bool take = false;
+        switch (a) {
+        case 0: take = true; break;
+        case 1: take = _x == 0; break;
+        case 2: take = _x != 0; _x--; break;
+        case 3: take = _y == 0; break;
+        case 4: take = _y != 0; _y--; break;
+        case 5: take = _x != _y; break;
+        case 7: take = _osrCount < (_config.pull_threshold == 0 ? 32 : _config.pull_threshold); break;
+        default: _fail("JMP PIN isn't modelled");
+        }
+        if (take) {
+            _pc = b;
+            jumped = true;
+        }
+        return true;
+    }
+    case OP_IN: {
+        uint32_t data = 0;
+        switch (a) {
+        case SRC_PINS:
+            for (unsigned i = 0; i < count; i++)
+                data |= (_pin((_config.in_base + i) % 32) ? 1u : 0u) << i;
+            break;
+        case SRC_X: data = _x; break;
+        case SRC_Y: data = _y; break;
+        case SRC_NULL: data = 0; break;
+        case SRC_ISR: data = _isr; break;
+        case SRC_OSR: data = _osr; break;
+        default: _fail("bad IN source");
+        }
+        data &= mask(count);
+        if (_config.in_shift_right)
+            _isr = count == 32 ? data : (_isr >> count) | (data << (32 - count));
+        else
+            _isr = count == 32 ? data : (_isr << count) | data;
+        _isrCount = _isrCount + count > 32 ? 32 : _isrCount + count;
+        return true;
+    }
+    case OP_OUT: {
+        uint32_t data;
+        if (_config.out_shift_right) {
+            data = _osr & mask(count);
+            _osr = count == 32 ? 0 : _osr >> count;
+        }
+        else {
+            data = count == 32 ? _osr : _osr >> (32 - count);
+            _osr = count == 32 ? 0 : _osr << count;
+        }
+        _osrCount = _osrCount + count > 32 ? 32 : _osrCount + count;
+        switch (a) {
+        case SRC_PINS:
+            setPins(data << _config.out_base, mask(_config.out_count) << _config.out_base);
+            break;
+        case SRC_X: _x = data; break;
+        case SRC_Y: _y = data; break;
+        case SRC_NULL: break;
+        case OUT_PINDIRS: {
+            const uint32_t m = mask(_config.out_count) << _config.out_base;
+            _pinDirs = (_pinDirs & ~m) | ((data << _config.out_base) & m);
+            break;
+        }
+        case OUT_PC: _pc = data & 0x1f; jumped = true; break;
+        case SRC_ISR: _isr = data; _isrCount = count; break;
+        default: _fail("OUT EXEC isn't modelled");
+        }
+        return true;
+    }
+    case OP_PUSH_PULL: {
+        const bool pull = (instr >> 7) & 1;
+        const bool ifFlag = (instr >> 6) & 1;
+        const bool block = (instr >> 5) & 1;
+        if (pull) {
+            if (ifFlag && _osrCount < (_config.pull_threshold == 0 ? 32 : _config.pull_threshold))
+                return true;
+            if (_txCount == 0) {
+                if (block)
+                    return false;
+                _osr = _x;
+            }
+            else {
+                _osr = _tx[0];
+                for (unsigned i = 1; i < _txCount; i++)
+                    _tx[i - 1] = _tx[i];
+                _txCount--;
+            }
+            _osrCount = 0;
+        }
+        else {
+            if (ifFlag && _isrCount < (_config.push_threshold == 0 ? 32 : _config.push_threshold))
+                return true;
+            if (_rxCount == FIFO_DEPTH) {
+                if (block)
+                    return false;
+            }
+            else {
+                _rx[_rxCount++] = _isr;
+            }
+            _isr = 0;
+            _isrCount = 0;
+        }
+        return true;
+    }
+    case OP_MOV: {
+        const unsigned src = b & 7;
+        const unsigned movOp = (b >> 3) & 3;
+        uint32_t data = 0;
+        switch (src) {
+        case SRC_PINS:
+            for (unsigned i = 0; i < 32; i++)
+                data |= (_pin((_config.in_base + i) % 32) ? 1u : 0u) << i;
+            break;
+        case SRC_X: data = _x; break;
+        case SRC_Y: data = _y; break;
+        case SRC_NULL: data = 0; break;
+        case SRC_ISR: data = _isr; break;
+        case SRC_OSR: data = _osr; break;
+        default: _fail("MOV STATUS isn't modelled");
+        }
+        if (movOp == 1)
+            data = ~data;
+        else if (movOp == 2)
+            data = reverse(data);
+        switch (a) {
+        case SRC_PINS:
+            setPins(data << _config.out_base, mask(_config.out_count) << _config.out_base);
+            break;
+        case SRC_X: _x = data; break;
+        case SRC_Y: _y = data; break;
+        case MOV_PC: _pc = data & 0x1f; jumped = true; break;
+        case SRC_ISR: _isr = data; _isrCount = 0; break;
+        case SRC_OSR: _osr = data; _osrCount = 0; break;
+        default: _fail("MOV EXEC isn't modelled");
+        }
+        return true;
+    }
+    case OP_SET:
+        if (a == SRC_X)
+            _x = b;
+        else if (a == SRC_Y)
+            _y = b;
+        else
+            _fail("SET PINS/PINDIRS aren't modelled");
+        return true;
+    case OP_WAIT:
+        _fail("WAIT isn't modelled");
+        return false;
+    case OP_IRQ:
+    default:
+        _fail("IRQ isn't modelled");
+        return false;
+    }
+}
+
+}
+
+// ----- The SDK calls ------------------------------------------------------
+
+using kc1fsz::PioModel;
+
+static PioModel& model(PIO pio, uint sm) {
+    if (pio != pio0 || sm != 0) {
+        fprintf(stderr, "PIO model: only pio0 state machine 0 is modelled\n");
+        abort();
+    }
+    return PioModel::get();
+}
+
+extern "C" {
+
+pio_sm_config pio_get_default_sm_config(void) {
+    pio_sm_config c = { };
+    c.clkdiv = 1.0f;
+    c.wrap_target = 0;
+    c.wrap = 31;
+    c.out_count = 32;
+    c.out_shift_right = true;
+    c.in_shift_right = true;
+    return c;
+}
+
+void sm_config_set_wrap(pio_sm_config* c, uint wrap_target, uint wrap) {
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+void sm_config_set_sideset(pio_sm_config* c, uint bit_count, bool optional, bool pindirs) {
+    c->sideset_bit_count = bit_count;
+    c->sideset_optional = optional;
+    c->sideset_pindirs = pindirs;
+}
+
+void sm_config_set_sideset_pins(pio_sm_config* c, uint sideset_base) {
+    c->sideset_base = sideset_base;
+}
+
+void sm_config_set_out_pins(pio_sm_config* c, uint out_base, uint out_count) {
+    c->out_base = out_base;
+    c->out_count = out_count;
+}
+
+void sm_config_set_in_pins(pio_sm_config* c, uint in_base) {
+    c->in_base = in_base;
+}
+
+void sm_config_set_out_shift(pio_sm_config* c, bool shift_right, bool autopull, uint pull_threshold) {
+    c->out_shift_right = shift_right;
+    c->autopull = autopull;
+    c->pull_threshold = pull_threshold;
+}
+
+void sm_config_set_in_shift(pio_sm_config* c, bool shift_right, bool autopush, uint push_threshold) {
+    c->in_shift_right = shift_right;
+    c->autopush = autopush;
+    c->push_threshold = push_threshold;
+}
+
+void sm_config_set_clkdiv(pio_sm_config* c, float div) {
+    c->clkdiv = div;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t* program) {
+    return model(pio, 0).addProgram(*program);
+}
+
+void pio_gpio_init(PIO, uint) {
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask) {
+    model(pio, sm).setPins(pin_values, pin_mask);
+}
+
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out) {
+    model(pio, sm).setPindirs(pin_base, pin_count, is_out);
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config* config) {
+    model(pio, sm).init(initial_pc, *config);
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    model(pio, sm).setEnabled(enabled);
+}
+
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div) {
+    model(pio, sm).setClkdiv(div);
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    model(pio, sm).putTx(data);
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+    return model(pio, sm).getRx();
+}
+
+uint32_t clock_get_hz(enum clock_index) {
+    return PioModel::SYS_CLOCK_HZ;
+}
+
+}
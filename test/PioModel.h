@@ -0,0 +1,176 @@
+/**
+ * A host model of an RP2040 PIO state machine, for running swd.pio
+ * without hardware.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "hardware/pio.h"
+
+namespace kc1fsz {
+
+/**
+ * Whatever is on the other end of SWCLK/SWDIO (see SwdTarget).
+ */
+class WireTarget {
+public:
+
+    virtual ~WireTarget() = default;
+
+    /**
+     * SWCLK has gone high.
+     *
+     * @param line The level of SWDIO going into the edge.
+     * @param hostDriving The PIO was driving SWDIO, rather than the
+     *   target or the pull-up.
+     */
+    virtual void risingEdge(bool line, bool hostDriving) = 0;
+
+    /**
+     * @returns true if the target is driving SWDIO, with the level in
+     *   level.
+     */
+    virtual bool driving(bool& level) const = 0;
+};
+
+/**
+ * Executes the instructions that the program (as assembled by pioasm, or
+ * test/pioasm.py) loads, one PIO cycle at a time, at the clock divider
+ * the driver sets. Only what swd.pio needs is modelled: one state
+ * machine, side-set, delays, FIFOs four deep, no autopush/autopull, and
+ * JMP, IN, OUT, PUSH, PULL, MOV and SET other than to pins. Anything else
+ * stops the test.
+ *
+ * The state machine only runs when the driver blocks on it, as it would
+ * while the CPU waits on a FIFO, when the code under test sleeps, or
+ * through drain(). The SDK's pio0/sm calls all end up here.
+ */
+class PioModel {
+public:
+
+    static constexpr unsigned SYS_CLOCK_HZ = 125000000;
+    static constexpr unsigned FIFO_DEPTH = 4;
+    static constexpr unsigned INSTR_COUNT = 32;
+
+    /**
+     * The state machine behind pio0.
+     */
+    static PioModel& get();
+
+    /**
+     * Unloads the program and puts the state machine, pins and counters
+     * back to how they were at power-up, for the next driver.
+     */
+    void reset();
+
+    /**
+     * Connects the far end of the wire. SWCLK is the side-set pin and
+     * SWDIO the OUT/IN pin, whichever the driver picks.
+     */
+    void attach(WireTarget* target) { _target = target; }
+
+    /**
+     * Records, from now on, one character per rising SWCLK edge for what
+     * SWDIO carried into it: 0/1 driven by the PIO, L/H driven by the
+     * target, z by nobody (the pull-up, reads as 1) and X by both.
+     */
+    void traceEdges(std::string* edges) { _edges = edges; }
+
+    /**
+     * Records one character per PIO cycle for each pin: SWCLK as _ or ^,
+     * SWDIO as for traceEdges().
+     */
+    void traceCycles(std::string* clk, std::string* dio) { _clkTrace = clk; _dioTrace = dio; }
+
+    /**
+     * Runs until the state machine is waiting for its next command.
+     */
+    void drain();
+
+    /**
+     * Runs until simulated time ns, or until the state machine is
+     * waiting for a command, whichever comes first.
+     */
+    void runUntil(double ns);
+
+    uint64_t getCycles() const { return _cycles; }
+    uint64_t getRisingEdges() const { return _risingEdges; }
+    /**
+     * PIO cycles in which both ends drove SWDIO.
+     */
+    uint64_t getContention() const { return _contention; }
+    /**
+     * The nominal SWCLK rate, from the clock divider (four cycles a bit).
+     */
+    double getSwclkHz() const { return SYS_CLOCK_HZ / (4.0 * _clkdiv); }
+
+    // ----- The SDK calls -----
+
+    unsigned addProgram(const pio_program_t& program);
+    void pullUp(unsigned pin) { _pullUps |= 1u << pin; }
+    void setPins(uint32_t values, uint32_t mask);
+    void setPindirs(unsigned base, unsigned count, bool out);
+    void init(unsigned pc, const pio_sm_config& config);
+    void setEnabled(bool enabled) { _enabled = enabled; }
+    void setClkdiv(float div);
+    void putTx(uint32_t data);
+    uint32_t getRx();
+
+private:
+
+    /**
+     * Runs one PIO cycle.
+     *
+     * @returns false if the state machine stalled, i.e. it is waiting 
+     *   for the driver to putTx() or getRx().
+     */
+    bool _step();
+    /**
+     * @returns true if the instruction completed, false if it stalled.
+     */
+    bool _execute(uint16_t instr, bool& jumped);
+    bool _pin(unsigned pin) const;
+    bool _line(bool& hostDriving, bool& targetDriving) const;
+    void _fail(const char* what) const;
+
+    WireTarget* _target = nullptr;
+    std::string* _edges = nullptr;
+    std::string* _clkTrace = nullptr;
+    std::string* _dioTrace = nullptr;
+
+    uint16_t _instr[INSTR_COUNT] = { };
+    uint32_t _used = 0;
+
+    pio_sm_config _config = { };
+    bool _enabled = false;
+    float _clkdiv = 1.0f;
+
+    // The state machine
+    unsigned _pc = 0;
+    unsigned _delay = 0;
+    uint32_t _x = 0;
+    uint32_t _y = 0;
+    uint32_t _osr = 0;
+    unsigned _osrCount = 32;
+    uint32_t _isr = 0;
+    unsigned _isrCount = 0;
+    uint32_t _tx[FIFO_DEPTH] = { };
+    unsigned _txCount = 0;
+    uint32_t _rx[FIFO_DEPTH] = { };
+    unsigned _rxCount = 0;
+
+    // What the state machine drives onto the pins
+    uint32_t _pinValues = 0;
+    uint32_t _pinDirs = 0;
+    uint32_t _pullUps = 0;
+
+    uint64_t _cycles = 0;
+    uint64_t _risingEdges = 0;
+    uint64_t _contention = 0;
+};
+
+}
@@ -0,0 +1,21 @@
+/**
+ * Simulated time for the host tests.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace kc1fsz::sim {
+
+/**
+ * Nothing on the host side takes any time. The clock only moves when
+ * the PIO model runs (at the SWCLK rate the driver has asked for) or
+ * when the code under test sleeps, so time_us_32() and anything timed
+ * with it come out as they would on the wire.
+ */
+double nowNs();
+void advanceNs(double ns);
+
+}
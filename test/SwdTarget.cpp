@@ -0,0 +1,566 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+
+#include "SwdTarget.h"
+
+namespace kc1fsz {
+
+// ACK values, LSB first on the wire
+static const uint8_t ACK_OK = 0b001;
+static const uint8_t ACK_WAIT = 0b010;
+static const uint8_t ACK_FAULT = 0b100;
+
+// Host-driven ones that make a line reset
+static const unsigned LINE_RESET_ONES = 50;
+
+// The selection alert (ADIv5.2 B5.3.4), LSB first, and what follows it
+static const uint32_t SELECTION_ALERT[4] = {
+    0x6209f392, 0x86852d95, 0xe3ddafe9, 0x19bc0ea2
+};
+static const unsigned ACTIVATION_BITS = 4 + 8;
+static const uint32_t ACTIVATION_SWD = 0x1a << 4;
+
+// DP register addresses (A[3:2])
+static const unsigned DP_DPIDR = 0x0;
+static const unsigned DP_CTRL_STAT = 0x4;
+static const unsigned DP_SELECT = 0x8;
+static const unsigned DP_RDBUFF = 0xc;
+// DP SELECT.DPBANKSEL for A = 0x4
+static const unsigned DP_BANK_CTRL_STAT = 0;
+static const unsigned DP_BANK_TARGETID = 2;
+static const unsigned DP_BANK_DLPIDR = 3;
+
+static const uint32_t CTRL_STAT_ORUNDETECT = 0x00000001;
+static const uint32_t CTRL_STAT_STICKYORUN = 0x00000002;
+static const uint32_t CTRL_STAT_STICKYCMP = 0x00000010;
+static const uint32_t CTRL_STAT_STICKYERR = 0x00000020;
+static const uint32_t CTRL_STAT_WDATAERR = 0x00000080;
+static const uint32_t CTRL_STAT_STICKY = CTRL_STAT_STICKYORUN | CTRL_STAT_STICKYCMP |
+    CTRL_STAT_STICKYERR | CTRL_STAT_WDATAERR;
+static const uint32_t CTRL_STAT_CDBGPWRUPREQ = 0x10000000;
+static const uint32_t CTRL_STAT_CSYSPWRUPREQ = 0x40000000;
+// Everything that a write can set (the rest is either read-only or
+// not modelled)
+static const uint32_t CTRL_STAT_WRITABLE = CTRL_STAT_CDBGPWRUPREQ |
+    CTRL_STAT_CSYSPWRUPREQ | CTRL_STAT_ORUNDETECT;
+
+static const uint32_t ABORT_STKCMPCLR = 0x02;
+static const uint32_t ABORT_STKERRCLR = 0x04;
+static const uint32_t ABORT_WDERRCLR = 0x08;
+static const uint32_t ABORT_ORUNERRCLR = 0x10;
+
+// MEM-AP registers, relative to the start of the MEM-AP register block
+static const uint32_t AP_CSW = 0x00;
+static const uint32_t AP_TAR = 0x04;
+static const uint32_t AP_DRW = 0x0c;
+static const uint32_t AP_BD0 = 0x10;
+static const uint32_t AP_BD3 = 0x1c;
+static const uint32_t AP_IDR = 0xfc;
+// Where the MEM-AP registers start within an ADIv6 AP
+static const uint32_t ADIV6_MEMAP_REGS = 0xd00;
+static const uint32_t ADIV6_AP_SIZE = 0x1000;
+
+static const uint32_t CSW_SIZE_MASK = 0x00000007;
+static const uint32_t CSW_SIZE_WORD = 0x00000002;
+static const uint32_t CSW_ADDRINC_MASK = 0x00000030;
+static const uint32_t CSW_ADDRINC_SINGLE = 0x00000010;
+static const uint32_t CSW_DEVICEEN = 0x00000040;
+static const uint32_t TAR_AUTOINC_MASK = 0x3ff;
+
+const SwdTarget::Config SwdTarget::RP2040_CORE0 = {
+    .targetSel = 0x01002927,
+    .dpidr = 0x0bc12477,
+    .targetId = 0x01002927,
+    .apAddr = 0,
+    .apIdr = 0x04770031
+};
+
+const SwdTarget::Config SwdTarget::RP2350 = {
+    .targetSel = 0x00040927,
+    .dpidr = 0x4c013477,
+    .targetId = 0x00040927,
+    .apAddr = 0x2000,
+    .apIdr = 0x34770008
+};
+
+static bool parity(uint32_t v) {
+    return __builtin_parity(v) != 0;
+}
+
+bool RamBus::read(uint32_t addr, uint32_t& data) {
+    if (addr < _base || addr - _base >= _words.size() * 4)
+        return false;
+    data = at(addr);
+    return true;
+}
+
+bool RamBus::write(uint32_t addr, uint32_t data) {
+    if (addr < _base || addr - _base >= _words.size() * 4)
+        return false;
+    at(addr) = data;
+    return true;
+}
+
+SwdTarget::SwdTarget(const Config& config, MemoryBus& bus)
+:   _config(config),
+    _bus(bus),
+    _version((config.dpidr >> 12) & 0xf) {
+}
+
+bool SwdTarget::driving(bool& level) const {
+    level = _level;
+    return _driving;
+}
+
+void SwdTarget::_error(const std::string& what) {
+    _errors.push_back(what);
+}
+
+void SwdTarget::risingEdge(bool line, bool hostDriving) {
+
+    _bus.clock();
+
+    if (_phase == Phase::DORMANT) {
+        _dormant(line);
+        return;
+    }
+
+    // A line reset works from anywhere, even in the middle of a packet
+    _ones = hostDriving && line ? _ones + 1 : 0;
+    if (_ones == LINE_RESET_ONES) {
+        _lineReset();
+        return;
+    }
+
+    switch (_phase) {
+    case Phase::DORMANT:
+    case Phase::LOCKOUT:
+        break;
+    case Phase::RESET:
+        if (!line)
+            _phase = Phase::IDLE;
+        break;
+    case Phase::IDLE:
+        // Idle cycles are zeros and the start bit is a one
+        if (line) {
+            _headerBits = 1;
+            _count = 1;
+            _phase = Phase::HEADER;
+        }
+        break;
+    case Phase::HEADER:
+        _headerBits |= (line ? 1 : 0) << _count;
+        if (++_count == 8)
+            _header();
+        break;
+    case Phase::TURNAROUND:
+        _drive(_ack & 1);
+        _count = 1;
+        _phase = Phase::ACK;
+        break;
+    case Phase::ACK:
+        if (_count < 3) {
+            _drive((_ack >> _count) & 1);
+            _count++;
+        }
+        else if (_ack == ACK_OK && _read) {
+            _data = _readRegister();
+            _parity = parity(_data);
+            if (_injectParity > 0) {
+                _injectParity--;
+                _parity = !_parity;
+            }
+            else if (_maxClockHz > 0 && PioModel::get().getSwclkHz() > _maxClockHz)
+                _parity = !_parity;
+            _drive(_data & 1);
+            _count = 1;
+            _phase = Phase::READ_DATA;
+        }
+        else {
+            _release();
+            _count = 0;
+            _data = 0;
+            if (_ack == ACK_OK) {
+                _skip = 1;
+                _afterSkip = Phase::WRITE_DATA;
+            }
+            else {
+                // With overrun detection on the data phase is always there
+                _skip = (_ctrlStat & CTRL_STAT_ORUNDETECT) ? 1 + 33 : 1;
+                _afterSkip = Phase::IDLE;
+            }
+            _phase = Phase::SKIP;
+        }
+        break;
+    case Phase::READ_DATA:
+        if (_count < 32)
+            _drive((_data >> _count) & 1);
+        else
+            _drive(_parity);
+        if (++_count == 33)
+            _phase = Phase::READ_END;
+        break;
+    case Phase::READ_END:
+        _release();
+        _skip = 1;
+        _afterSkip = Phase::IDLE;
+        _phase = Phase::SKIP;
+        break;
+    case Phase::WRITE_DATA:
+        if (_count < 32) {
+            _data |= (line ? 1u : 0u) << _count;
+            _count++;
+            break;
+        }
+        _phase = Phase::IDLE;
+        if (line != parity(_data)) {
+            if (_targetSel) {
+                _phase = Phase::LOCKOUT;
+                _selected = false;
+            }
+            else {
+                _ctrlStat |= CTRL_STAT_WDATAERR;
+            }
+            _error("write data parity");
+            break;
+        }
+        _writeRegister(_data);
+        break;
+    case Phase::SKIP:
+        if (--_skip == 0) {
+            _count = 0;
+            _phase = _afterSkip;
+        }
+        break;
+    }
+}
+
+void SwdTarget::_dormant(bool line) {
+
+    if (_alertBits > 0) {
+        // Collecting the four zeros and the activation code
+        _data |= (line ? 1u : 0u) << (_alertBits - 1);
+        if (++_alertBits <= ACTIVATION_BITS)
+            return;
+        _alertBits = 0;
+        if (_data == ACTIVATION_SWD) {
+            // Awake, but nothing happens until a line reset
+            _phase = Phase::LOCKOUT;
+            _ones = 0;
+        }
+        return;
+    }
+
+    for (unsigned i = 0; i < 3; i++)
+        _alertWindow[i] = (_alertWindow[i] >> 1) | (_alertWindow[i + 1] << 31);
+    _alertWindow[3] = (_alertWindow[3] >> 1) | ((line ? 1u : 0u) << 31);
+
+    bool match = true;
+    for (unsigned i = 0; i < 4; i++)
+        match = match && _alertWindow[i] == SELECTION_ALERT[i];
+    if (match) {
+        _alertBits = 1;
+        _data = 0;
+        for (unsigned i = 0; i < 4; i++)
+            _alertWindow[i] = 0;
+    }
+}
+
+void SwdTarget::_lineReset() {
+    _stats.lineResets++;
+    _release();
+    _phase = Phase::RESET;
+    _resetState = true;
+    // Selected until a TARGETSEL says otherwise
+    _selected = true;
+    _select = 0;
+}
+
+void SwdTarget::_header() {
+
+    _stats.packets++;
+    _ap = (_headerBits >> 1) & 1;
+    _read = (_headerBits >> 2) & 1;
+    _a = ((_headerBits >> 3) & 3) << 2;
+    _targetSel = false;
+
+    const bool goodParity = ((_headerBits >> 5) & 1) == parity((_headerBits >> 1) & 0xf);
+    const bool goodFraming = ((_headerBits >> 6) & 1) == 0 && ((_headerBits >> 7) & 1) == 1;
+    if (!goodParity || !goodFraming) {
+        // All ones is the start of a line reset, which can come at any
+        // time
+        if (_headerBits != 0xff)
+            _error("bad request header");
+        _stats.noAcks++;
+        _phase = Phase::LOCKOUT;
+        return;
+    }
+
+    // TARGETSEL is the one write that is never acknowledged
+    if (!_ap && !_read && _a == DP_RDBUFF) {
+        if (!_resetState)
+            _error("TARGETSEL outside of the reset state");
+        _targetSel = true;
+        _data = 0;
+        _count = 0;
+        _skip = 5;
+        _afterSkip = Phase::WRITE_DATA;
+        _phase = Phase::SKIP;
+        return;
+    }
+
+    if (!_selected) {
+        _stats.noAcks++;
+        _phase = Phase::LOCKOUT;
+        return;
+    }
+    if (_resetState) {
+        if (_ap || !_read || _a != DP_DPIDR) {
+            _error("the first packet after a line reset isn't a DPIDR read");
+            _stats.noAcks++;
+            _phase = Phase::LOCKOUT;
+            return;
+        }
+        _resetState = false;
+    }
+    if (_injectNoAcks > 0) {
+        _injectNoAcks--;
+        _stats.noAcks++;
+        _phase = Phase::LOCKOUT;
+        return;
+    }
+
+    _ack = _respond();
+    if (_ack == ACK_WAIT)
+        _stats.waits++;
+    else if (_ack == ACK_FAULT)
+        _stats.faults++;
+    if (_ack != ACK_OK) {
+        if (_ctrlStat & CTRL_STAT_ORUNDETECT)
+            _ctrlStat |= CTRL_STAT_STICKYORUN;
+        if (_log != nullptr)
+            _log->push_back({ _ap, _read, _apRegister(), 0, _ack });
+    }
+    _phase = Phase::TURNAROUND;
+}
+
+uint8_t SwdTarget::_respond() {
+
+    // Only these get through while a sticky flag is set
+    const bool dpidrRead = !_ap && _read && _a == DP_DPIDR;
+    const bool ctrlStatRead = !_ap && _read && _a == DP_CTRL_STAT;
+    const bool abortWrite = !_ap && !_read && _a == DP_DPIDR;
+    if (dpidrRead || ctrlStatRead || abortWrite)
+        return ACK_OK;
+    if (_ap && _injectFault) {
+        if (_faultAfter > 0)
+            _faultAfter--;
+        else {
+            _injectFault = false;
+            _ctrlStat |= CTRL_STAT_STICKYERR;
+        }
+    }
+    if (_ctrlStat & CTRL_STAT_STICKY)
+        return ACK_FAULT;
+
+    // A stalled AP holds up the AP accesses and the RDBUFF reads that
+    // collect their results
+    const bool rdbuffRead = !_ap && _read && _a == DP_RDBUFF;
+    if ((_ap || rdbuffRead) && _injectWaits > 0) {
+        if (_waitsAfter > 0) {
+            _waitsAfter--;
+            return ACK_OK;
+        }
+        _injectWaits--;
+        return ACK_WAIT;
+    }
+    return ACK_OK;
+}
+
+uint32_t SwdTarget::_apRegister() const {
+    if (!_ap)
+        return _a == DP_CTRL_STAT ? _a | ((_select & 0xf) << 4) : _a;
+    if (_version >= 3)
+        return (_select & ~0xfu) - _config.apAddr - ADIV6_MEMAP_REGS + _a;
+    return (_select & 0xf0) | _a;
+}
+
+bool SwdTarget::_apSelected() const {
+    if (_version >= 3) {
+        const uint32_t addr = _select & ~0xfu;
+        return addr >= _config.apAddr + ADIV6_MEMAP_REGS &&
+            addr < _config.apAddr + ADIV6_AP_SIZE;
+    }
+    return (_select >> 24) == _config.apAddr;
+}
+
+uint32_t SwdTarget::_readRegister() {
+
+    uint32_t data = 0;
+    if (_ap) {
+        _stats.apReads++;
+        // Posted: this read's result shows up in the next one
+        data = _readBuffer;
+        uint32_t result = 0;
+        if (_apRead(_apRegister(), result))
+            _readBuffer = result;
+        else
+            _ctrlStat |= CTRL_STAT_STICKYERR;
+    }
+    else {
+        _stats.dpReads++;
+        switch (_a) {
+        case DP_DPIDR:
+            data = _config.dpidr;
+            break;
+        case DP_CTRL_STAT:
+            switch (_select & 0xf) {
+            case DP_BANK_CTRL_STAT:
+                // The power-up ACKs follow the requests straight away
+                data = _ctrlStat | ((_ctrlStat & (CTRL_STAT_CDBGPWRUPREQ |
+                    CTRL_STAT_CSYSPWRUPREQ)) << 1);
+                break;
+            case DP_BANK_TARGETID:
+                data = _config.targetId;
+                break;
+            case DP_BANK_DLPIDR:
+                data = (_config.targetSel & 0xf0000000) | 1;
+                break;
+            default:
+                _error("read of an unmodelled DP register bank");
+                break;
+            }
+            break;
+        case DP_RDBUFF:
+            _stats.rdbuffReads++;
+            data = _readBuffer;
+            break;
+        default:
+            _error("RESEND isn't modelled");
+            break;
+        }
+    }
+
+    if (_log != nullptr)
+        _log->push_back({ _ap, true, _apRegister(), data, ACK_OK });
+    return data;
+}
+
+void SwdTarget::_writeRegister(uint32_t data) {
+
+    if (_targetSel) {
+        // Any other target drops off the wire until the next line reset
+        _selected = data == _config.targetSel;
+        if (!_selected)
+            _phase = Phase::LOCKOUT;
+        return;
+    }
+
+    if (_log != nullptr)
+        _log->push_back({ _ap, false, _apRegister(), data, ACK_OK });
+
+    if (_ap) {
+        _stats.apWrites++;
+        _apWrite(_apRegister(), data);
+        return;
+    }
+
+    _stats.dpWrites++;
+    switch (_a) {
+    case DP_DPIDR:
+        // ABORT
+        if (data & ABORT_STKCMPCLR)
+            _ctrlStat &= ~CTRL_STAT_STICKYCMP;
+        if (data & ABORT_STKERRCLR)
+            _ctrlStat &= ~CTRL_STAT_STICKYERR;
+        if (data & ABORT_WDERRCLR)
+            _ctrlStat &= ~CTRL_STAT_WDATAERR;
+        if (data & ABORT_ORUNERRCLR)
+            _ctrlStat &= ~CTRL_STAT_STICKYORUN;
+        break;
+    case DP_CTRL_STAT:
+        if ((_select & 0xf) != DP_BANK_CTRL_STAT) {
+            _error("write to a read-only DP register bank");
+            break;
+        }
+        if (data & ~CTRL_STAT_WRITABLE)
+            _error("CTRL/STAT write sets bits that aren't modelled");
+        _ctrlStat = (_ctrlStat & CTRL_STAT_STICKY) | (data & CTRL_STAT_WRITABLE);
+        break;
+    case DP_SELECT:
+        _select = data;
+        break;
+    }
+}
+
+bool SwdTarget::_apRead(uint32_t reg, uint32_t& data) {
+
+    if (!_apSelected()) {
+        _error("read from an AP that isn't there");
+        data = 0;
+        return true;
+    }
+
+    switch (reg) {
+    case AP_CSW:
+        data = _csw | CSW_DEVICEEN;
+        return true;
+    case AP_TAR:
+        data = _tar;
+        return true;
+    case AP_DRW: {
+        const bool ok = _bus.read(_tar, data);
+        if ((_csw & CSW_ADDRINC_MASK) == CSW_ADDRINC_SINGLE)
+            _tar = (_tar & ~TAR_AUTOINC_MASK) | ((_tar + 4) & TAR_AUTOINC_MASK);
+        return ok;
+    }
+    case AP_IDR:
+        data = _config.apIdr;
+        return true;
+    default:
+        if (reg >= AP_BD0 && reg <= AP_BD3)
+            return _bus.read((_tar & ~0xfu) | (reg - AP_BD0), data);
+        _error("read of an unmodelled AP register");
+        data = 0;
+        return true;
+    }
+}
+
+void SwdTarget::_apWrite(uint32_t reg, uint32_t data) {
+
+    if (!_apSelected()) {
+        _error("write to an AP that isn't there");
+        return;
+    }
+
+    bool ok = true;
+    switch (reg) {
+    case AP_CSW:
+        if ((data & CSW_SIZE_MASK) != CSW_SIZE_WORD)
+            _error("only 32-bit MEM-AP accesses are modelled");
+        if ((data & CSW_ADDRINC_MASK) != 0 && (data & CSW_ADDRINC_MASK) != CSW_ADDRINC_SINGLE)
+            _error("packed auto-increment isn't modelled");
+        _csw = data;
+        break;
+    case AP_TAR:
+        _tar = data;
+        break;
+    case AP_DRW:
+        ok = _bus.write(_tar, data);
+        if ((_csw & CSW_ADDRINC_MASK) == CSW_ADDRINC_SINGLE)
+            _tar = (_tar & ~TAR_AUTOINC_MASK) | ((_tar + 4) & TAR_AUTOINC_MASK);
+        break;
+    default:
+        if (reg >= AP_BD0 && reg <= AP_BD3)
+            ok = _bus.write((_tar & ~0xfu) | (reg - AP_BD0), data);
+        else
+            _error("write to an unmodelled or read-only AP register");
+        break;
+    }
+    if (!ok)
+        _ctrlStat |= CTRL_STAT_STICKYERR;
+}
+
+}
@@ -0,0 +1,255 @@
+/**
+ * A bit-level model of an SW-DP with one MEM-AP, the far end of the
+ * wire for the PIO model.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "PioModel.h"
+
+namespace kc1fsz {
+
+/**
+ * What the MEM-AP reaches.
+ */
+class MemoryBus {
+public:
+
+    virtual ~MemoryBus() = default;
+
+    /**
+     * @returns false for a bus error.
+     */
+    virtual bool read(uint32_t addr, uint32_t& data) = 0;
+    virtual bool write(uint32_t addr, uint32_t data) = 0;
+
+    /**
+     * One SWCLK has gone by, for anything on the target side that takes
+     * time (e.g. a core register transfer).
+     */
+    virtual void clock() { }
+};
+
+/**
+ * A block of RAM, and bus errors everywhere else.
+ */
+class RamBus : public MemoryBus {
+public:
+
+    RamBus(uint32_t base, uint32_t size) : _base(base), _words(size / 4, 0) { }
+
+    bool read(uint32_t addr, uint32_t& data) override;
+    bool write(uint32_t addr, uint32_t data) override;
+
+    uint32_t& at(uint32_t addr) { return _words[(addr - _base) / 4]; }
+
+private:
+
+    const uint32_t _base;
+    std::vector<uint32_t> _words;
+};
+
+/**
+ * Follows the host clock by clock and answers the way ADIv5.2/ADIv6 say
+ * an SW-DP does (the timing is in PioSWDDriver's packet functions):
+ *
+ * - It starts out dormant and only wakes up for the selection alert and
+ *   the SWD activation code, followed by a line reset.
+ * - After a line reset only a TARGETSEL write (which gets no ACK) or a
+ *   DPIDR read will do. A TARGETSEL for some other target, a bad header
+ *   or any other packet gets no answer at all until the next line reset.
+ * - AP reads are posted: the data phase carries the previous AP read's
+ *   result and RDBUFF holds the last one. AP accesses are done at the
+ *   points in the packet that a real DP would start them.
+ * - A bus error or a WAIT/FAULT with ORUNDETECT set leaves a sticky flag
+ *   behind, and until ABORT clears it everything but DPIDR and
+ *   CTRL/STAT reads and ABORT writes gets FAULT.
+ * - The MEM-AP only does 32-bit accesses and TAR auto-increment wraps
+ *   within 1K, which is all that ADIv5 promises.
+ *
+ * Host mistakes (anything a correct driver should never do) are noted
+ * in getErrors().
+ */
+class SwdTarget : public WireTarget {
+public:
+
+    struct Config {
+        // The TARGETSEL that selects this DP
+        uint32_t targetSel;
+        uint32_t dpidr;
+        uint32_t targetId;
+        // APSEL (DPIDR.VERSION up to 2) or AP base address (ADIv6)
+        uint32_t apAddr;
+        uint32_t apIdr;
+    };
+
+    static const Config RP2040_CORE0;
+    static const Config RP2350;
+
+    /**
+     * One packet as the target saw it.
+     */
+    struct Transfer {
+        bool ap;
+        bool read;
+        // A[3:2], or the AP register address with the bank (ADIv5) or
+        // the full ADIv6 AP register address
+        uint32_t addr;
+        uint32_t data;
+        // 1 OK, 2 WAIT, 4 FAULT, 0 none
+        uint8_t ack;
+    };
+
+    struct Stats {
+        uint32_t packets = 0;
+        uint32_t dpReads = 0;
+        uint32_t dpWrites = 0;
+        uint32_t apReads = 0;
+        uint32_t apWrites = 0;
+        uint32_t rdbuffReads = 0;
+        uint32_t waits = 0;
+        uint32_t faults = 0;
+        uint32_t noAcks = 0;
+        uint32_t lineResets = 0;
+    };
+
+    SwdTarget(const Config& config, MemoryBus& bus);
+
+    void risingEdge(bool line, bool hostDriving) override;
+    bool driving(bool& level) const override;
+
+    /**
+     * The next n AP accesses (and RDBUFF reads) get WAIT, as they would
+     * with the AP stalled on a slow bus.
+     *
+     * @param after How many AP accesses go through before the first WAIT.
+     */
+    void injectWaits(unsigned n, unsigned after = 0) { _injectWaits = n; _waitsAfter = after; }
+    /**
+     * The next n read data phases go out with the wrong parity bit, as
+     * if the line had glitched.
+     */
+    void injectParityErrors(unsigned n) { _injectParity = n; }
+    /**
+     * The next n packets get no answer, as if the header had been
+     * garbled. The DP stays locked out until a line reset.
+     */
+    void injectNoAcks(unsigned n) { _injectNoAcks = n; }
+    /**
+     * An AP access fails on the bus, setting STICKYERR, so that it and
+     * everything after it gets FAULT until ABORT clears the flag.
+     *
+     * @param after How many AP accesses go through before the failure.
+     */
+    void injectFault(unsigned after = 0) { _injectFault = true; _faultAfter = after; }
+    /**
+     * Above this SWCLK rate every read data phase goes out with the 
+     * wrong parity bit, as on a link that can't keep up. Zero for no
+     * limit.
+     */
+    void setMaxClockHz(double hz) { _maxClockHz = hz; }
+
+    /**
+     * When set, every packet from now on is appended.
+     */
+    void setLog(std::vector<Transfer>* log) { _log = log; }
+
+    const Stats& getStats() const { return _stats; }
+    void resetStats() { _stats = Stats(); }
+    const std::vector<std::string>& getErrors() const { return _errors; }
+
+    uint32_t getCtrlStat() const { return _ctrlStat; }
+    uint32_t getSelect() const { return _select; }
+
+private:
+
+    enum class Phase {
+        DORMANT,
+        // Waiting for a line reset
+        LOCKOUT,
+        // The ones at the end of a line reset
+        RESET,
+        IDLE,
+        HEADER,
+        // The turnaround before the ACK
+        TURNAROUND,
+        ACK,
+        READ_DATA,
+        // After the read parity bit
+        READ_END,
+        WRITE_DATA,
+        // Clocks the target ignores: the no-ACK part of TARGETSEL, the
+        // turnaround before write data, a WAIT/FAULT data phase
+        SKIP
+    };
+
+    void _dormant(bool line);
+    void _lineReset();
+    void _header();
+    uint8_t _respond();
+    uint32_t _readRegister();
+    void _writeRegister(uint32_t data);
+    bool _apRead(uint32_t reg, uint32_t& data);
+    void _apWrite(uint32_t reg, uint32_t data);
+    uint32_t _apRegister() const;
+    bool _apSelected() const;
+    void _error(const std::string& what);
+    void _drive(bool level) { _driving = true; _level = level; }
+    void _release() { _driving = false; }
+
+    const Config _config;
+    MemoryBus& _bus;
+    const unsigned _version;
+
+    Phase _phase = Phase::DORMANT;
+    unsigned _count = 0;
+    unsigned _skip = 0;
+    Phase _afterSkip = Phase::IDLE;
+    bool _driving = false;
+    bool _level = false;
+    // Consecutive host-driven ones
+    unsigned _ones = 0;
+    // The last 128 bits seen while dormant
+    uint32_t _alertWindow[4] = { };
+    unsigned _alertBits = 0;
+
+    // The packet in progress
+    uint8_t _headerBits = 0;
+    bool _ap = false;
+    bool _read = false;
+    unsigned _a = 0;
+    uint8_t _ack = 0;
+    bool _targetSel = false;
+    uint32_t _data = 0;
+    bool _parity = false;
+
+    // DP state
+    bool _resetState = false;
+    bool _selected = false;
+    uint32_t _ctrlStat = 0;
+    uint32_t _select = 0;
+    uint32_t _readBuffer = 0;
+
+    // MEM-AP state
+    uint32_t _csw = 0;
+    uint32_t _tar = 0;
+
+    unsigned _injectWaits = 0;
+    unsigned _waitsAfter = 0;
+    unsigned _injectParity = 0;
+    unsigned _injectNoAcks = 0;
+    bool _injectFault = false;
+    unsigned _faultAfter = 0;
+    double _maxClockHz = 0;
+
+    Stats _stats;
+    std::vector<Transfer>* _log = nullptr;
+    std::vector<std::string> _errors;
+};
+
+}
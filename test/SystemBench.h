@@ -0,0 +1,52 @@
+/**
+ * The driver wired through the PIO model to a model chip (see 
+ * TargetSystem), for the host tests of the code that drives a whole
+ * target.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+#include "TargetSystem.h"
+
+namespace kc1fsz {
+
+struct SystemBench {
+
+    static constexpr unsigned CLK_PIN = 2;
+    static constexpr unsigned DIO_PIN = 3;
+
+    TargetSystem system;
+    SwdTarget swdTarget;
+    PioSWDDriver swd;
+
+    /**
+     * The driver is initialized but not connected.
+     */
+    SystemBench(const TargetSystem::Config& config = TargetSystem::RP2040,
+        const SwdTarget::Config& dp = SwdTarget::RP2040_CORE0, unsigned clockHz = 10000000)
+    :   system(config),
+        swdTarget(dp, system),
+        swd(CLK_PIN, DIO_PIN) {
+        PioModel::get().reset();
+        PioModel::get().attach(&swdTarget);
+        swd.init(clockHz);
+    }
+
+    ~SystemBench() {
+        PioModel::get().attach(nullptr);
+    }
+
+    /**
+     * Lets the state machine finish what the driver has handed it (see
+     * Bench::settle()).
+     */
+    void settle() {
+        PioModel::get().drain();
+    }
+};
+
+}
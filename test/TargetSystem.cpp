@@ -0,0 +1,882 @@
+/**
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <cstring>
+
+#include "TargetSystem.h"
+#include "SimClock.h"
+
+// loader.s and caller-batch.s, assembled, to recognize them when the
+// core is started
+#include "loader-bin.h"
+#include "caller-batch-bin.h"
+
+namespace kc1fsz {
+
+static const uint32_t ROM_MAGIC_ADDR = 0x10;
+static const uint32_t ROM_FUNC_TABLE_PTR = 0x14;
+static const uint32_t ROM_FUNC_TABLE = 0x100;
+static const uint32_t SYSINFO_CHIP_ID = 0x40000000;
+static const uint32_t DMA_BASE_ADDR = 0x50000000;
+static const uint32_t SCS_BASE = 0xe000e000;
+static const uint32_t SCS_SIZE = 0x1000;
+
+// Where the ROM functions are, as far as the model is concerned. Calls
+// are recognized by these addresses.
+static const uint32_t ROM_CONNECT_INTERNAL_FLASH = 0x0201;
+static const uint32_t ROM_FLASH_EXIT_XIP = 0x0211;
+static const uint32_t ROM_FLASH_RANGE_ERASE = 0x0221;
+static const uint32_t ROM_FLASH_RANGE_PROGRAM = 0x0231;
+static const uint32_t ROM_FLASH_FLUSH_CACHE = 0x0241;
+static const uint32_t ROM_FLASH_ENTER_CMD_XIP = 0x0251;
+// Only in the RP2040's table
+static const uint32_t ROM_REVERSE32 = 0x0301;
+static const uint32_t ROM_POPCOUNT32 = 0x0311;
+static const uint32_t ROM_CLZ32 = 0x0321;
+static const uint32_t ROM_CTZ32 = 0x0331;
+// Only in the RP2350's table
+static const uint32_t ROM_BOOTROM_STATE_RESET = 0x0261;
+static const uint32_t ROM_FLASH_RESET_ADDRESS_TRANS = 0x0271;
+
+static const struct {
+    char c1, c2;
+    uint32_t addr;
+} ROM_FUNCS[] = {
+    { 'I', 'F', ROM_CONNECT_INTERNAL_FLASH },
+    { 'E', 'X', ROM_FLASH_EXIT_XIP },
+    { 'R', 'E', ROM_FLASH_RANGE_ERASE },
+    { 'R', 'P', ROM_FLASH_RANGE_PROGRAM },
+    { 'F', 'C', ROM_FLASH_FLUSH_CACHE },
+    { 'C', 'X', ROM_FLASH_ENTER_CMD_XIP }
+};
+
+static const struct {
+    char c1, c2;
+    uint32_t addr;
+} RP2040_ROM_FUNCS[] = {
+    { 'R', '3', ROM_REVERSE32 },
+    { 'P', '3', ROM_POPCOUNT32 },
+    { 'L', '3', ROM_CLZ32 },
+    { 'T', '3', ROM_CTZ32 }
+};
+
+static const struct {
+    char c1, c2;
+    uint32_t addr;
+} RP2350_ROM_FUNCS[] = {
+    { 'S', 'R', ROM_BOOTROM_STATE_RESET },
+    { 'R', 'A', ROM_FLASH_RESET_ADDRESS_TRANS }
+};
+
+// The flagged table. Each function also gets a RISC-V and a Non-secure
+// entry point, at addresses that aren't functions here, so taking the
+// wrong one of the three shows up as a bad call.
+static const uint8_t ROM_FORMAT_FLAGGED = 0x02;
+static const uint16_t RT_FLAG_FUNC_RISCV = 0x0001;
+static const uint16_t RT_FLAG_FUNC_ARM_SEC = 0x0004;
+static const uint16_t RT_FLAG_FUNC_ARM_NONSEC = 0x0010;
+static const uint16_t RT_FLAG_DATA = 0x0040;
+static const uint32_t ROM_RISCV_OFFSET = 0x1000;
+static const uint32_t ROM_NONSEC_OFFSET = 0x2000;
+
+// Entry points of loader.s, from where it was started
+static const uint32_t STUB_HASH = 2;
+static const uint32_t STUB_UNPACK = 4;
+static const uint32_t STUB_BLANK = 6;
+// Mailbox slots, see loader.s
+static const unsigned SLOT_COUNT = 8;
+static const uint32_t SLOT_SIZE = 32;
+static const uint32_t SLOT_ARGS = 4;
+static const uint32_t SLOT_RESULT = 20;
+static const uint32_t STOP_CALL = 1;
+// caller-batch.s table entries
+static const uint32_t BATCH_ENTRY_SIZE = 24;
+static const uint32_t BATCH_ARGS = 4;
+static const uint32_t BATCH_RESULT = 20;
+
+static const uint32_t BLOCK32_ERASE_CMD = 0x52;
+static const uint32_t BLOCK64_ERASE_CMD = 0xd8;
+
+// ----- Debug registers -----
+static const uint32_t DHCSR = 0xe000edf0;
+static const uint32_t DCRSR = 0xe000edf4;
+static const uint32_t DCRDR = 0xe000edf8;
+static const uint32_t DEMCR = 0xe000edfc;
+static const uint32_t DSCSR = 0xe000ee08;
+static const uint32_t DHCSR_DBGKEY = 0xa05f0000;
+static const uint32_t DHCSR_C_DEBUGEN = 0x00000001;
+static const uint32_t DHCSR_C_HALT = 0x00000002;
+static const uint32_t DHCSR_CONTROL = 0x0000000f;
+static const uint32_t DHCSR_S_REGRDY = 0x00010000;
+static const uint32_t DHCSR_S_HALT = 0x00020000;
+static const uint32_t DCRSR_REGSEL = 0x0000007f;
+static const uint32_t DCRSR_REGWNR = 0x00010000;
+static const uint32_t DSCSR_CDS = 0x00010000;
+static const unsigned REG_R4 = 4;
+static const unsigned REG_R5 = 5;
+static const unsigned REG_R8 = 8;
+static const unsigned REG_PC = 15;
+static const unsigned REG_XPSR = 16;
+static const unsigned CORE_REG_COUNT = 21;
+static const uint32_t XPSR_T = 0x01000000;
+
+// ----- RESETS, with the atomic aliases -----
+static const uint32_t RESETS_SIZE = 0x4000;
+static const uint32_t RESETS_ALIAS_MASK = 0x3000;
+static const uint32_t RESETS_XOR = 0x1000;
+static const uint32_t RESETS_SET = 0x2000;
+static const uint32_t RESETS_CLR = 0x3000;
+static const uint32_t RESETS_RESET = 0x00;
+static const uint32_t RESETS_RESET_DONE = 0x08;
+static const uint32_t RESETS_ALL = 0x01ffffff;
+
+// ----- DMA channel 0 and the sniffer -----
+static const uint32_t DMA_READ_ADDR = 0x00;
+static const uint32_t DMA_WRITE_ADDR = 0x04;
+static const uint32_t DMA_TRANS_COUNT = 0x08;
+static const uint32_t DMA_CTRL_TRIG = 0x0c;
+static const uint32_t DMA_CTRL_EN = 0x00000001;
+static const uint32_t DMA_CTRL_DATA_SIZE = 0x0000000c;
+static const uint32_t DMA_CTRL_SIZE_WORD = 0x00000008;
+static const uint32_t DMA_CTRL_INCR_READ = 0x00000010;
+static const uint32_t DMA_TREQ_UNPACED = 0x3f;
+static const uint32_t SNIFF_EN = 0x00000001;
+static const uint32_t SNIFF_DMACH = 0x0000001e;
+static const uint32_t SNIFF_CALC_SHIFT = 5;
+static const uint32_t SNIFF_CALC_CRC32 = 0x0;
+static const uint32_t SNIFF_CALC_CRC32_REV = 0x1;
+static const uint32_t SNIFF_BSWAP = 0x00000200;
+static const uint32_t SNIFF_OUT_REV = 0x00000400;
+static const uint32_t SNIFF_OUT_INV = 0x00000800;
+
+static const uint32_t FNV_OFFSET = 2166136261;
+static const uint32_t FNV_PRIME = 16777619;
+
+const TargetSystem::Config TargetSystem::RP2040 = {
+    // B2
+    .chipId = 0x20002927,
+    .romMagic = 0x0301754d,
+    .romSize = 0x4000,
+    .ramSize = 0x42000,
+    .flashSize = 2 * 1024 * 1024,
+    .xipNoCacheBase = 0x13000000,
+    .resetsBase = 0x4000c000,
+    .resetsDma = 0x00000004,
+    .dmaSniffCtrl = 0x50000434,
+    .dmaIncrWrite = 0x00000020,
+    .dmaChainToShift = 11,
+    .dmaTreqShift = 15,
+    .dmaSniffEn = 0x00800000,
+    .dmaBusy = 0x01000000,
+    .secure = false
+};
+
+// A Pico 2. DMA CTRL has the reversed increment bits after INCR_READ 
+// and INCR_WRITE, which moves everything above them up by two.
+const TargetSystem::Config TargetSystem::RP2350 = {
+    // A2
+    .chipId = 0x20004927,
+    .romMagic = 0x0202754d,
+    .romSize = 0x8000,
+    .ramSize = 0x82000,
+    .flashSize = 4 * 1024 * 1024,
+    .xipNoCacheBase = 0x1c000000,
+    .resetsBase = 0x40020000,
+    .resetsDma = 0x00000004,
+    .dmaSniffCtrl = 0x50000454,
+    .dmaIncrWrite = 0x00000040,
+    .dmaChainToShift = 13,
+    .dmaTreqShift = 17,
+    .dmaSniffEn = 0x02000000,
+    .dmaBusy = 0x04000000,
+    .secure = true
+};
+
+static std::string hex(uint32_t v) {
+    char s[16];
+    snprintf(s, sizeof(s), "%08x", v);
+    return s;
+}
+
+static uint32_t bitReverse(uint32_t v) {
+    uint32_t r = 0;
+    for (unsigned i = 0; i < 32; i++, v >>= 1)
+        r = (r << 1) | (v & 1);
+    return r;
+}
+
+/**
+ * The sniffer's CRC-32: the IEEE 802.3 polynomial, MSB first, with no
+ * reflection of its own.
+ */
+static uint32_t crc32Word(uint32_t crc, uint32_t data) {
+    for (unsigned i = 0; i < 32; i++, data <<= 1)
+        crc = (crc << 1) ^ (((crc ^ data) & 0x80000000) ? 0x04c11db7 : 0);
+    return crc;
+}
+
+TargetSystem::TargetSystem(const Config& config)
+:   _config(config),
+    _ram(config.ramSize, 0),
+    _rom(config.romSize, 0),
+    _flash(config.flashSize, 0xff) {
+
+    const auto put16 = [this](uint32_t addr, uint16_t v) {
+        _rom[addr] = v & 0xff;
+        _rom[addr + 1] = v >> 8;
+    };
+    put16(ROM_MAGIC_ADDR, config.romMagic & 0xffff);
+    put16(ROM_MAGIC_ADDR + 2, config.romMagic >> 16);
+    put16(ROM_FUNC_TABLE_PTR, ROM_FUNC_TABLE);
+    uint32_t p = ROM_FUNC_TABLE;
+    if (((config.romMagic >> 16) & 0xff) != ROM_FORMAT_FLAGGED) {
+        // (code, address) pairs, ending with a zero code
+        for (const auto& f : ROM_FUNCS) {
+            put16(p, f.c1 | (f.c2 << 8));
+            put16(p + 2, f.addr);
+            p += 4;
+        }
+        for (const auto& f : RP2040_ROM_FUNCS) {
+            put16(p, f.c1 | (f.c2 << 8));
+            put16(p + 2, f.addr);
+            p += 4;
+        }
+        return;
+    }
+
+    // A code, its flags and a halfword for each flag, lowest first
+    const auto putFunc = [&](char c1, char c2, uint32_t addr) {
+        put16(p, c1 | (c2 << 8));
+        put16(p + 2, RT_FLAG_FUNC_RISCV | RT_FLAG_FUNC_ARM_SEC | RT_FLAG_FUNC_ARM_NONSEC);
+        put16(p + 4, addr + ROM_RISCV_OFFSET);
+        put16(p + 6, addr);
+        put16(p + 8, addr + ROM_NONSEC_OFFSET);
+        p += 10;
+    };
+    for (const auto& f : ROM_FUNCS)
+        putFunc(f.c1, f.c2, f.addr);
+    // Entries with nothing to keep: data, and a Non-secure only function
+    put16(p, 'X' | ('D' << 8));
+    put16(p + 2, RT_FLAG_DATA);
+    put16(p + 4, 0x0400);
+    put16(p + 6, 'X' | ('N' << 8));
+    put16(p + 8, RT_FLAG_FUNC_ARM_NONSEC);
+    put16(p + 10, 0x0281 + ROM_NONSEC_OFFSET);
+    p += 12;
+    for (const auto& f : RP2350_ROM_FUNCS)
+        putFunc(f.c1, f.c2, f.addr);
+    // As if a partition had been booted
+    _addrTrans = true;
+}
+
+void TargetSystem::_error(const std::string& what) {
+    _errors.push_back(what);
+}
+
+bool TargetSystem::_inRam(uint32_t addr, uint32_t len) const {
+    return addr >= RAM_BASE && addr - RAM_BASE <= _config.ramSize &&
+        len <= _config.ramSize - (addr - RAM_BASE);
+}
+
+uint8_t TargetSystem::_ramByte(uint32_t addr) {
+    if (!_inRam(addr, 1)) {
+        _error("stub read from " + hex(addr));
+        return 0;
+    }
+    return _ram[addr - RAM_BASE];
+}
+
+void TargetSystem::_setRamByte(uint32_t addr, uint8_t b) {
+    if (!_inRam(addr, 1)) {
+        _error("stub write to " + hex(addr));
+        return;
+    }
+    _ram[addr - RAM_BASE] = b;
+}
+
+bool TargetSystem::read(uint32_t addr, uint32_t& data) {
+    if (addr < _config.romSize)
+        return _readRom(addr, data);
+    if (addr >= FLASH_BASE && addr - FLASH_BASE < _config.flashSize)
+        return _readFlash(addr - FLASH_BASE, true, data);
+    if (addr >= _config.xipNoCacheBase && addr - _config.xipNoCacheBase < _config.flashSize)
+        return _readFlash(addr - _config.xipNoCacheBase, false, data);
+    if (_inRam(addr, 4)) {
+        memcpy(&data, &_ram[addr - RAM_BASE], 4);
+        return true;
+    }
+    if (addr == SYSINFO_CHIP_ID) {
+        data = _config.chipId;
+        return true;
+    }
+    if (addr >= _config.resetsBase && addr - _config.resetsBase < RESETS_SIZE)
+        return _readResets(addr - _config.resetsBase, data);
+    if (addr >= DMA_BASE_ADDR && addr <= _config.dmaSniffCtrl + 4)
+        return _readDma(addr - DMA_BASE_ADDR, data);
+    if (addr >= SCS_BASE && addr - SCS_BASE < SCS_SIZE)
+        return _readScs(addr, data);
+    _error("read from " + hex(addr) + ", which isn't modelled");
+    return false;
+}
+
+bool TargetSystem::write(uint32_t addr, uint32_t data) {
+    if (_inRam(addr, 4)) {
+        // Handing the stub a slot that it still has
+        if (_stub && addr >= _mailbox && addr < _mailbox + SLOT_COUNT * SLOT_SIZE &&
+            (addr - _mailbox) % SLOT_SIZE == 0 && data != 0) {
+            uint32_t old = 0;
+            memcpy(&old, &_ram[addr - RAM_BASE], 4);
+            if (old != 0)
+                _error("slot at " + hex(addr) + " posted before the stub was done with it");
+        }
+        memcpy(&_ram[addr - RAM_BASE], &data, 4);
+        return true;
+    }
+    if (addr >= _config.resetsBase && addr - _config.resetsBase < RESETS_SIZE)
+        return _writeResets(addr - _config.resetsBase, data);
+    if (addr >= DMA_BASE_ADDR && addr <= _config.dmaSniffCtrl + 4)
+        return _writeDma(addr - DMA_BASE_ADDR, data);
+    if (addr >= SCS_BASE && addr - SCS_BASE < SCS_SIZE)
+        return _writeScs(addr, data);
+    _error("write to " + hex(addr) + ", which isn't modelled");
+    return false;
+}
+
+bool TargetSystem::_readRom(uint32_t addr, uint32_t& data) {
+    addr &= ~3u;
+    memcpy(&data, &_rom[addr], 4);
+    return true;
+}
+
+bool TargetSystem::_readFlash(uint32_t offset, bool cached, uint32_t& data) {
+    if (!_xip) {
+        _error("XIP read of flash offset " + hex(offset) + " with the flash out of XIP mode");
+        return false;
+    }
+    if (cached && _cacheStale) {
+        _error("XIP read of flash offset " + hex(offset) +
+            " through a cache that wasn't flushed after the flash changed");
+        return false;
+    }
+    memcpy(&data, &_flash[offset & ~3u], 4);
+    return true;
+}
+
+bool TargetSystem::_readScs(uint32_t addr, uint32_t& data) {
+    if (_regBusy && sim::nowNs() >= _regDoneNs)
+        _completeRegister();
+    switch (addr) {
+    case DHCSR:
+        data = (_dhcsr & DHCSR_CONTROL) | (_regBusy ? 0 : DHCSR_S_REGRDY) |
+            (_halted ? DHCSR_S_HALT : 0);
+        return true;
+    case DCRSR:
+        data = 0;
+        return true;
+    case DCRDR:
+        data = _dcrdr;
+        return true;
+    case DEMCR:
+        data = _demcr;
+        return true;
+    case DSCSR:
+        if (!_config.secure)
+            break;
+        data = _dscsr;
+        return true;
+    }
+    _error("read from " + hex(addr) + ", which isn't modelled");
+    return false;
+}
+
+bool TargetSystem::_writeScs(uint32_t addr, uint32_t data) {
+    if (_regBusy && sim::nowNs() >= _regDoneNs)
+        _completeRegister();
+    switch (addr) {
+    case DHCSR:
+        // Ignored without the key
+        if ((data & 0xffff0000) != DHCSR_DBGKEY)
+            return true;
+        _dhcsr = data & DHCSR_CONTROL;
+        if ((_dhcsr & DHCSR_C_DEBUGEN) && (_dhcsr & DHCSR_C_HALT))
+            _halted = true;
+        else if (_halted) {
+            _halted = false;
+            _resume();
+        }
+        return true;
+    case DCRSR:
+        if (!_halted)
+            _error("DCRSR written with the core running");
+        if (_regBusy)
+            _error("DCRSR written before the last transfer had finished");
+        _dcrsr = data;
+        _regBusy = true;
+        _regDoneNs = sim::nowNs() + REGRDY_NS;
+        return true;
+    case DCRDR:
+        _dcrdr = data;
+        return true;
+    case DEMCR:
+        _demcr = data;
+        return true;
+    case DSCSR:
+        if (!_config.secure)
+            break;
+        if (!_halted)
+            _error("DSCSR written with the core running");
+        _dscsr = data & DSCSR_CDS;
+        return true;
+    }
+    _error("write to " + hex(addr) + ", which isn't modelled");
+    return false;
+}
+
+bool TargetSystem::_readResets(uint32_t reg, uint32_t& data) {
+    switch (reg & ~RESETS_ALIAS_MASK) {
+    case RESETS_RESET:
+        data = _resets;
+        return true;
+    case RESETS_RESET_DONE:
+        data = ~_resets & RESETS_ALL;
+        return true;
+    }
+    data = 0;
+    return true;
+}
+
+bool TargetSystem::_writeResets(uint32_t reg, uint32_t data) {
+    if ((reg & ~RESETS_ALIAS_MASK) != RESETS_RESET)
+        return true;
+    switch (reg & RESETS_ALIAS_MASK) {
+    case RESETS_XOR: _resets ^= data; break;
+    case RESETS_SET: _resets |= data; break;
+    case RESETS_CLR: _resets &= ~data; break;
+    default: _resets = data; break;
+    }
+    _resets &= RESETS_ALL;
+    return true;
+}
+
+bool TargetSystem::_readDma(uint32_t reg, uint32_t& data) {
+    if (_resets & _config.resetsDma) {
+        _error("DMA read with DMA held in reset");
+        return false;
+    }
+    const bool busy = sim::nowNs() < _dmaDoneNs;
+    if (reg == _config.dmaSniffCtrl - DMA_BASE_ADDR)
+        data = _sniffCtrl;
+    else if (reg == _config.dmaSniffCtrl + 4 - DMA_BASE_ADDR)
+        data = _sniffOut();
+    else if (reg == DMA_READ_ADDR)
+        data = _dmaRead;
+    else if (reg == DMA_WRITE_ADDR)
+        data = _dmaWrite;
+    else if (reg == DMA_TRANS_COUNT)
+        data = busy ? _dmaCount : 0;
+    else if (reg == DMA_CTRL_TRIG)
+        data = _dmaCtrl | (busy ? _config.dmaBusy : 0);
+    else {
+        _error("DMA read at " + hex(DMA_BASE_ADDR + reg) + ", which isn't modelled");
+        return false;
+    }
+    return true;
+}
+
+bool TargetSystem::_writeDma(uint32_t reg, uint32_t data) {
+    if (_resets & _config.resetsDma) {
+        _error("DMA write with DMA held in reset");
+        return false;
+    }
+    if (reg == _config.dmaSniffCtrl - DMA_BASE_ADDR)
+        _sniffCtrl = data;
+    else if (reg == _config.dmaSniffCtrl + 4 - DMA_BASE_ADDR)
+        _sniffData = data;
+    else if (reg == DMA_READ_ADDR)
+        _dmaRead = data;
+    else if (reg == DMA_WRITE_ADDR)
+        _dmaWrite = data;
+    else if (reg == DMA_TRANS_COUNT)
+        _dmaCount = data;
+    else if (reg == DMA_CTRL_TRIG) {
+        _dmaCtrl = data;
+        if (data & DMA_CTRL_EN)
+            _startDma(data);
+    }
+    else {
+        _error("DMA write at " + hex(DMA_BASE_ADDR + reg) + ", which isn't modelled");
+        return false;
+    }
+    return true;
+}
+
+uint32_t TargetSystem::_sniffOut() const {
+    uint32_t v = _sniffData;
+    if (_sniffCtrl & SNIFF_OUT_REV)
+        v = bitReverse(v);
+    if (_sniffCtrl & SNIFF_OUT_INV)
+        v = ~v;
+    return v;
+}
+
+void TargetSystem::_startDma(uint32_t ctrl) {
+    if (sim::nowNs() < _dmaDoneNs)
+        _error("DMA channel 0 triggered while busy");
+    if ((ctrl & DMA_CTRL_DATA_SIZE) != DMA_CTRL_SIZE_WORD)
+        _error("DMA transfer size isn't a word");
+    if (((ctrl >> _config.dmaChainToShift) & 0xf) != 0)
+        _error("DMA channel 0 chains to another channel");
+    if (((ctrl >> _config.dmaTreqShift) & 0x3f) != DMA_TREQ_UNPACED)
+        _error("DMA channel 0 is paced by a DREQ that never comes");
+
+    const bool sniff = (ctrl & _config.dmaSniffEn) && (_sniffCtrl & SNIFF_EN) &&
+        (_sniffCtrl & SNIFF_DMACH) == 0;
+    const uint32_t calc = (_sniffCtrl >> SNIFF_CALC_SHIFT) & 0xf;
+    if (sniff && ((calc != SNIFF_CALC_CRC32 && calc != SNIFF_CALC_CRC32_REV) ||
+        (_sniffCtrl & SNIFF_BSWAP)))
+        _error("sniffer mode " + hex(_sniffCtrl) + " isn't modelled");
+
+    for (uint32_t i = 0; i < _dmaCount; i++) {
+        const uint32_t from = _dmaRead + ((ctrl & DMA_CTRL_INCR_READ) ? i * 4 : 0);
+        const uint32_t to = _dmaWrite + ((ctrl & _config.dmaIncrWrite) ? i * 4 : 0);
+        uint32_t data = 0;
+        if (!read(from, data) || !write(to, data)) {
+            _error("DMA bus error");
+            break;
+        }
+        if (sniff)
+            _sniffData = crc32Word(_sniffData, calc == SNIFF_CALC_CRC32_REV ? bitReverse(data) : data);
+    }
+    _dmaDoneNs = sim::nowNs() + _dmaCount * WORD_NS;
+    _stats.dmaTransfers++;
+}
+
+void TargetSystem::_completeRegister() {
+    _regBusy = false;
+    const unsigned sel = _dcrsr & DCRSR_REGSEL;
+    if (sel >= CORE_REG_COUNT) {
+        _error("DCRSR.REGSEL " + std::to_string(sel) + " isn't modelled");
+        return;
+    }
+    if (_dcrsr & DCRSR_REGWNR)
+        _regs[sel] = _dcrdr;
+    else
+        _dcrdr = _regs[sel];
+}
+
+void TargetSystem::_resume() {
+    _stub = false;
+    _batch = false;
+    _inCall = false;
+    const uint32_t pc = _regs[REG_PC] & ~1u;
+    const auto isAt = [&](const unsigned char* code, unsigned len) {
+        return _inRam(pc, len) && memcmp(&_ram[pc - RAM_BASE], code, len) == 0;
+    };
+    const bool batch = isAt(caller_batch_bin, caller_batch_bin_len);
+    if (!batch && !isAt(loader_bin, loader_bin_len)) {
+        _error("core started at " + hex(pc) + ", which isn't loader.s or caller-batch.s");
+        return;
+    }
+    if (!(_regs[REG_XPSR] & XPSR_T)) {
+        _error("core started with xPSR.T clear");
+        return;
+    }
+    if (_config.secure && !(_dscsr & DSCSR_CDS)) {
+        _error("core started in Non-secure state, where the ROM's flash functions fault");
+        return;
+    }
+    if (batch) {
+        if (!_inRam(_regs[REG_R4], _regs[REG_R5] * BATCH_ENTRY_SIZE)) {
+            _error("batch table at " + hex(_regs[REG_R4]) + " isn't in RAM");
+            return;
+        }
+        _batch = true;
+        _batchEntry = _regs[REG_R4];
+        _batchLeft = _regs[REG_R5];
+        _batchStop = _regs[REG_R8] != 0;
+        // None of the stub's entry points
+        _stubBase = 0;
+        return;
+    }
+    const uint32_t mailbox = _regs[REG_R4];
+    if (!_inRam(mailbox, SLOT_COUNT * SLOT_SIZE)) {
+        _error("mailbox at " + hex(mailbox) + " isn't in RAM");
+        return;
+    }
+    _stub = true;
+    _stubBase = pc;
+    _mailbox = mailbox;
+    _slot = 0;
+}
+
+void TargetSystem::clock() {
+    const double now = sim::nowNs();
+    if (_regBusy && now >= _regDoneNs)
+        _completeRegister();
+    if (_halted || !(_stub || _batch))
+        return;
+    if (_inCall) {
+        if (now < _callDoneNs)
+            return;
+        if (_batch)
+            _completeBatch();
+        else
+            _complete();
+    }
+    if (_batch)
+        _dispatchBatch();
+    else if (_stub)
+        _dispatch();
+}
+
+void TargetSystem::_dispatch() {
+    const uint32_t slot = _mailbox + _slot * SLOT_SIZE;
+    uint32_t func = 0;
+    read(slot, func);
+    if (func == 0)
+        return;
+    if (func == STOP_CALL) {
+        write(slot, 0);
+        _halted = true;
+        _slot = 0;
+        return;
+    }
+    _current.func = func | 1;
+    for (unsigned i = 0; i < 4; i++)
+        read(slot + SLOT_ARGS + i * 4, _current.r[i]);
+    uint32_t ignored = 0;
+    _callDoneNs = sim::nowNs() + _call(_current, false, ignored);
+    _inCall = true;
+}
+
+void TargetSystem::_complete() {
+    _inCall = false;
+    uint32_t result = 0;
+    if (_call(_current, true, result) < 0) {
+        // A real core would have locked up or faulted
+        _stub = false;
+        return;
+    }
+    _stats.calls++;
+    const uint32_t slot = _mailbox + _slot * SLOT_SIZE;
+    write(slot + SLOT_RESULT, result);
+    write(slot, 0);
+    _slot = (_slot + 1) % SLOT_COUNT;
+}
+
+void TargetSystem::_dispatchBatch() {
+    if (_batchLeft == 0) {
+        _haltBatch();
+        return;
+    }
+    read(_batchEntry, _current.func);
+    _current.func |= 1;
+    for (unsigned i = 0; i < 4; i++)
+        read(_batchEntry + BATCH_ARGS + i * 4, _current.r[i]);
+    uint32_t ignored = 0;
+    _callDoneNs = sim::nowNs() + _call(_current, false, ignored);
+    _inCall = true;
+}
+
+void TargetSystem::_completeBatch() {
+    _inCall = false;
+    uint32_t result = 0;
+    if (_call(_current, true, result) < 0) {
+        _batch = false;
+        return;
+    }
+    _stats.calls++;
+    write(_batchEntry + BATCH_RESULT, result);
+    _batchEntry += BATCH_ENTRY_SIZE;
+    _batchLeft--;
+    if (_batchStop && (int32_t)result < 0)
+        _haltBatch();
+}
+
+void TargetSystem::_haltBatch() {
+    // The BKPT, with r4 and r5 where the trampoline leaves them
+    _batch = false;
+    _halted = true;
+    _regs[REG_R4] = _batchEntry;
+    _regs[REG_R5] = _batchLeft;
+}
+
+double TargetSystem::_call(const Call& c, bool apply, uint32_t& result) {
+
+    result = 0;
+    switch (c.func) {
+    case ROM_CONNECT_INTERNAL_FLASH:
+        return CALL_NS;
+    case ROM_FLASH_EXIT_XIP:
+        if (apply)
+            _xip = false;
+        return CALL_NS;
+    case ROM_FLASH_RANGE_ERASE:
+        return _erase(c.r[0], c.r[1], c.r[2], c.r[3], apply);
+    case ROM_FLASH_RANGE_PROGRAM:
+        if (apply)
+            _program(c.r[0], c.r[1], c.r[2]);
+        return (c.r[2] / FLASH_PAGE) * PAGE_PROGRAM_NS;
+    case ROM_FLASH_FLUSH_CACHE:
+        if (apply)
+            _cacheStale = false;
+        return CALL_NS;
+    case ROM_FLASH_ENTER_CMD_XIP:
+        if (apply)
+            _xip = true;
+        return CALL_NS;
+    case ROM_REVERSE32:
+        result = bitReverse(c.r[0]);
+        return CALL_NS;
+    case ROM_POPCOUNT32:
+        result = __builtin_popcount(c.r[0]);
+        return CALL_NS;
+    case ROM_CLZ32:
+        result = c.r[0] == 0 ? 32 : __builtin_clz(c.r[0]);
+        return CALL_NS;
+    case ROM_CTZ32:
+        result = c.r[0] == 0 ? 32 : __builtin_ctz(c.r[0]);
+        return CALL_NS;
+    case ROM_BOOTROM_STATE_RESET:
+        return CALL_NS;
+    case ROM_FLASH_RESET_ADDRESS_TRANS:
+        if (apply)
+            _addrTrans = false;
+        return CALL_NS;
+    }
+
+    const uint32_t hashFunc = (_stubBase + STUB_HASH) | 1;
+    const uint32_t unpackFunc = (_stubBase + STUB_UNPACK) | 1;
+    const uint32_t blankFunc = (_stubBase + STUB_BLANK) | 1;
+    if (c.func == hashFunc || c.func == blankFunc) {
+        const bool hash = c.func == hashFunc;
+        if (c.r[1] == 0) {
+            if (apply)
+                _error("hash/blank of 0 words, which runs through all of memory");
+            return -1;
+        }
+        if (apply) {
+            result = hash ? FNV_OFFSET : 0xffffffff;
+            for (uint32_t i = 0; i < c.r[1]; i++) {
+                uint32_t w = 0;
+                if (!read(c.r[0] + i * 4, w))
+                    return -1;
+                result = hash ? (result ^ w) * FNV_PRIME : result & w;
+            }
+        }
+        return CALL_NS + c.r[1] * WORD_NS;
+    }
+    if (c.func == unpackFunc) {
+        if (apply) {
+            result = _unpack(c.r[0], c.r[1], c.r[2]);
+            _stats.unpacks++;
+        }
+        return CALL_NS + c.r[2] * WORD_NS;
+    }
+
+    if (apply)
+        _error("call to " + hex(c.func) + ", which isn't a function");
+    return -1;
+}
+
+double TargetSystem::_erase(uint32_t offset, uint32_t count, uint32_t blockSize,
+    uint32_t blockCmd, bool apply) {
+
+    if (apply) {
+        if (_xip)
+            _error("flash_range_erase with the flash in XIP mode");
+        if (_addrTrans)
+            _error("flash_range_erase with a partition's address translation still set up");
+        if (offset % FLASH_SECTOR != 0 || count % FLASH_SECTOR != 0 ||
+            offset + count > _config.flashSize)
+            _error("flash_range_erase(" + hex(offset) + ", " + hex(count) + ") isn't whole sectors of the flash");
+        if ((blockCmd == BLOCK64_ERASE_CMD && blockSize != 65536) ||
+            (blockCmd == BLOCK32_ERASE_CMD && blockSize != 32768))
+            _error("flash_range_erase block size " + hex(blockSize) + " doesn't go with command " + hex(blockCmd));
+        if (offset + count > _config.flashSize)
+            return CALL_NS;
+    }
+
+    // The boot ROM uses the block command where a whole, aligned block
+    // fits and 4K sector erases for the rest
+    double ns = 0;
+    while (count >= FLASH_SECTOR) {
+        uint32_t n = FLASH_SECTOR;
+        if (blockSize > FLASH_SECTOR && offset % blockSize == 0 && count >= blockSize) {
+            n = blockSize;
+            if (blockCmd == BLOCK64_ERASE_CMD) {
+                ns += BLOCK64_ERASE_NS;
+                if (apply)
+                    _stats.block64Erases++;
+            }
+            else {
+                ns += BLOCK32_ERASE_NS;
+                if (apply)
+                    _stats.block32Erases++;
+            }
+        }
+        else {
+            ns += SECTOR_ERASE_NS;
+            if (apply)
+                _stats.sectorErases++;
+        }
+        if (apply) {
+            memset(&_flash[offset], 0xff, n);
+            _cacheStale = true;
+        }
+        offset += n;
+        count -= n;
+    }
+    return ns;
+}
+
+void TargetSystem::_program(uint32_t offset, uint32_t src, uint32_t count) {
+    if (_xip)
+        _error("flash_range_program with the flash in XIP mode");
+    if (_addrTrans)
+        _error("flash_range_program with a partition's address translation still set up");
+    if (offset % FLASH_PAGE != 0 || count % FLASH_PAGE != 0 || offset + count > _config.flashSize) {
+        _error("flash_range_program(" + hex(offset) + ", " + hex(count) + ") isn't whole pages of the flash");
+        return;
+    }
+    if (!_inRam(src, count)) {
+        _error("flash_range_program from " + hex(src) + ", which isn't RAM");
+        return;
+    }
+    bool unerased = false;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t b = _ram[src - RAM_BASE + i];
+        if ((_flash[offset + i] & b) != b)
+            unerased = true;
+        // Programming only ever clears bits
+        _flash[offset + i] &= b;
+    }
+    if (unerased)
+        _error("flash_range_program over data that wasn't erased at " + hex(offset));
+    _stats.pagesProgrammed += count / FLASH_PAGE;
+    _cacheStale = true;
+}
+
+uint32_t TargetSystem::_unpack(uint32_t src, uint32_t dst, uint32_t len) {
+    // As loader.s does it, with no checks
+    const uint32_t end = src + len;
+    uint32_t out = dst;
+    while (src < end) {
+        const uint8_t c = _ramByte(src++);
+        if (c < 0x80) {
+            for (unsigned n = c + 1; n > 0; n--)
+                _setRamByte(out++, _ramByte(src++));
+        }
+        else {
+            const uint32_t dist = _ramByte(src) | (_ramByte(src + 1) << 8);
+            src += 2;
+            uint32_t from = out - dist;
+            for (unsigned n = c - 0x80 + 3; n > 0; n--)
+                _setRamByte(out++, _ramByte(from++));
+        }
+    }
+    return out - dst;
+}
+
+}
@@ -0,0 +1,212 @@
+/**
+ * A model of what the MEM-AP of an RP2040 or RP2350 reaches: enough of
+ * the chip for FlashLoader to run against, with loader.s running in it.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SwdTarget.h"
+
+namespace kc1fsz {
+
+/**
+ * RAM, the boot ROM's magic and function table, SYSINFO, the flash
+ * (through XIP and through the ROM's flash functions), RESETS, DMA
+ * channel 0 and its sniffer, and the debug registers of a core.
+ *
+ * The core is never run as such. When it is started at a copy of
+ * loader.s the model works through the mailbox the way the stub does,
+ * and at a copy of caller-batch.s through the table of calls, and the
+ * ROM functions and the stub's entry points are done here instead. Each call takes as long as the flash datasheet (or a guess,
+ * for the short ones) says, in simulated time, and its effects land
+ * when it completes, so anything the host does too early shows up.
+ *
+ * Things the real chip wouldn't put up with (flash programmed over
+ * data that wasn't erased, XIP reads with the flash out of XIP mode,
+ * reads through the cache before it has been flushed, a slot reused
+ * while the stub still has it) are noted in getErrors().
+ *
+ * The RP2350 has the flagged ROM table, with different addresses for
+ * the Secure, Non-secure and RISC-V entry points of each function, and
+ * only the Secure ones work. Its core starts out halted in Non-secure
+ * state, which begin() has to switch out of, and its ROM has the flash
+ * address translation of a partition set up until 
+ * flash_reset_address_trans() is called.
+ */
+class TargetSystem : public MemoryBus {
+public:
+
+    struct Config {
+        // SYSINFO CHIP_ID
+        uint32_t chipId;
+        // The word at 0x10 of the boot ROM: 'M', 'u', format, version.
+        // Format 2 is the RP2350's flagged table.
+        uint32_t romMagic;
+        uint32_t romSize;
+        uint32_t ramSize;
+        uint32_t flashSize;
+        uint32_t xipNoCacheBase;
+        uint32_t resetsBase;
+        uint32_t resetsDma;
+        uint32_t dmaSniffCtrl;
+        uint32_t dmaIncrWrite;
+        uint8_t dmaChainToShift;
+        uint8_t dmaTreqShift;
+        uint32_t dmaSniffEn;
+        uint32_t dmaBusy;
+        // ARMv8-M with the Security Extension, so DSCSR is there
+        bool secure;
+    };
+
+    static const Config RP2040;
+    static const Config RP2350;
+
+    static constexpr uint32_t RAM_BASE = 0x20000000;
+    static constexpr uint32_t FLASH_BASE = 0x10000000;
+    static constexpr uint32_t FLASH_PAGE = 256;
+    static constexpr uint32_t FLASH_SECTOR = 4096;
+
+    // How long a DCRSR transfer takes to finish
+    static constexpr double REGRDY_NS = 100;
+    // W25Q16JV typical figures
+    static constexpr double SECTOR_ERASE_NS = 45e6;
+    static constexpr double BLOCK32_ERASE_NS = 120e6;
+    static constexpr double BLOCK64_ERASE_NS = 150e6;
+    static constexpr double PAGE_PROGRAM_NS = 0.4e6;
+    // Anything else the stub calls, and the XIP reads of a DMA transfer
+    static constexpr double CALL_NS = 2000;
+    static constexpr double WORD_NS = 50;
+
+    struct Stats {
+        // Calls made by the stub
+        uint32_t calls = 0;
+        uint32_t sectorErases = 0;
+        uint32_t block32Erases = 0;
+        uint32_t block64Erases = 0;
+        uint32_t pagesProgrammed = 0;
+        uint32_t unpacks = 0;
+        uint32_t dmaTransfers = 0;
+    };
+
+    /**
+     * Flash starts out erased and the core halted, as if the debugger
+     * had caught it coming out of reset.
+     */
+    TargetSystem(const Config& config = RP2040);
+
+    bool read(uint32_t addr, uint32_t& data) override;
+    bool write(uint32_t addr, uint32_t data) override;
+    void clock() override;
+
+    uint8_t* ram() { return _ram.data(); }
+    uint8_t* flash() { return _flash.data(); }
+    uint32_t getFlashSize() const { return _config.flashSize; }
+
+    bool isHalted() const { return _halted; }
+    bool isXipMode() const { return _xip; }
+
+    const Stats& getStats() const { return _stats; }
+    const std::vector<std::string>& getErrors() const { return _errors; }
+
+private:
+
+    struct Call {
+        uint32_t func;
+        uint32_t r[4];
+    };
+
+    bool _readRom(uint32_t addr, uint32_t& data);
+    bool _readFlash(uint32_t offset, bool cached, uint32_t& data);
+    bool _readScs(uint32_t addr, uint32_t& data);
+    bool _writeScs(uint32_t addr, uint32_t data);
+    bool _readResets(uint32_t reg, uint32_t& data);
+    bool _writeResets(uint32_t reg, uint32_t data);
+    bool _readDma(uint32_t reg, uint32_t& data);
+    bool _writeDma(uint32_t reg, uint32_t data);
+    uint32_t _sniffOut() const;
+
+    void _resume();
+    void _completeRegister();
+    void _dispatch();
+    void _complete();
+    void _dispatchBatch();
+    void _completeBatch();
+    void _haltBatch();
+    /**
+     * How long the call takes or, with apply set, makes it and sets the
+     * result. Returns a negative time if the core would have crashed.
+     */
+    double _call(const Call& call, bool apply, uint32_t& result);
+    double _erase(uint32_t offset, uint32_t count, uint32_t blockSize, uint32_t blockCmd, 
+        bool apply);
+    void _program(uint32_t offset, uint32_t src, uint32_t count);
+    uint32_t _unpack(uint32_t src, uint32_t dst, uint32_t len);
+    void _startDma(uint32_t ctrl);
+
+    uint8_t _ramByte(uint32_t addr);
+    void _setRamByte(uint32_t addr, uint8_t b);
+    bool _inRam(uint32_t addr, uint32_t len) const;
+    void _error(const std::string& what);
+
+    const Config _config;
+    std::vector<uint8_t> _ram;
+    std::vector<uint8_t> _rom;
+    std::vector<uint8_t> _flash;
+
+    // Flash state, as the ROM functions leave it
+    bool _xip = true;
+    // Flash offsets go through a partition's address translation
+    bool _addrTrans = false;
+    // The XIP cache may hold flash contents that have since changed
+    bool _cacheStale = false;
+
+    // Core and debug state
+    bool _halted = true;
+    uint32_t _dhcsr = 0;
+    uint32_t _demcr = 0;
+    uint32_t _dscsr = 0;
+    uint32_t _regs[21] = { };
+    uint32_t _dcrdr = 0;
+    // A DCRSR transfer in progress, finishing at _regDoneNs
+    bool _regBusy = false;
+    uint32_t _dcrsr = 0;
+    double _regDoneNs = 0;
+
+    // The stub: the mailbox, the slot it's on and the call in progress
+    bool _stub = false;
+    uint32_t _stubBase = 0;
+    uint32_t _mailbox = 0;
+    unsigned _slot = 0;
+    bool _inCall = false;
+    Call _current = { };
+    double _callDoneNs = 0;
+
+    // caller-batch.s: the next table entry, the calls left and whether
+    // a negative result stops it
+    bool _batch = false;
+    uint32_t _batchEntry = 0;
+    uint32_t _batchLeft = 0;
+    bool _batchStop = false;
+
+    // RESETS.RESET, everything held in reset
+    uint32_t _resets = 0x01ffffff;
+
+    // DMA channel 0 and the sniffer
+    uint32_t _dmaRead = 0;
+    uint32_t _dmaWrite = 0;
+    uint32_t _dmaCount = 0;
+    uint32_t _dmaCtrl = 0;
+    double _dmaDoneNs = 0;
+    uint32_t _sniffCtrl = 0;
+    uint32_t _sniffData = 0;
+
+    Stats _stats;
+    std::vector<std::string> _errors;
+};
+
+}
@@ -0,0 +1,158 @@
+/**
+ * The RP2040 and RP2350 differences: which chip Chip::connect() finds on
+ * each model (and Chip::forChipId() from its CHIP_ID), the two ROM table
+ * formats, and FlashLoader programming and verifying an RP2350, which 
+ * has to be switched to Secure state and have its address translation 
+ * reset first.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Chip.h"
+#include "RomTable.h"
+#include "FlashLoader.h"
+#include "SystemBench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t SECTOR_SIZE = FlashLoader::SECTOR_SIZE;
+
+static std::vector<uint8_t> image(unsigned len, uint32_t seed) {
+    std::vector<uint8_t> data(len);
+    uint32_t x = seed;
+    for (unsigned i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = x & 0xff;
+    }
+    return data;
+}
+
+static void connectEither() {
+
+    const struct {
+        const TargetSystem::Config& system;
+        const SwdTarget::Config& dp;
+        const Chip* chip;
+    } cases[] = {
+        { TargetSystem::RP2040, SwdTarget::RP2040_CORE0, &Chip::RP2040 },
+        { TargetSystem::RP2350, SwdTarget::RP2350, &Chip::RP2350 }
+    };
+    for (const auto& c : cases) {
+        SystemBench b(c.system, c.dp);
+        CHECK(Chip::connect(b.swd) == c.chip);
+        // And the same chip again from its CHIP_ID
+        const auto chipId = b.swd.readWordViaAP(Chip::CHIP_ID_ADDR);
+        CHECK(chipId.has_value());
+        CHECK(Chip::forChipId(chipId.value_or(0)) == c.chip);
+        CHECK(b.system.getErrors().empty());
+    }
+    // An RP2040 with some other part number
+    CHECK(Chip::forChipId(0x20003927) == nullptr);
+}
+
+static void romTables() {
+
+    // The flagged table, where only the Secure entry points are kept
+    // and the data and Non-secure only entries are passed over
+    {
+        SystemBench b(TargetSystem::RP2350, SwdTarget::RP2350);
+        CHECK(Chip::connect(b.swd) == &Chip::RP2350);
+        const RomTable::Table* t = RomTable::get(b.swd);
+        CHECK(t != nullptr);
+        if (t != nullptr) {
+            CHECK_EQ(t->count, 8);
+            CHECK_EQ(t->find('I', 'F').value_or(0), 0x0201);
+            CHECK_EQ(t->find('C', 'X').value_or(0), 0x0251);
+            CHECK_EQ(t->find('S', 'R').value_or(0), 0x0261);
+            CHECK_EQ(t->find('R', 'A').value_or(0), 0x0271);
+            CHECK(!t->find('X', 'D').has_value());
+            CHECK(!t->find('X', 'N').has_value());
+        }
+        CHECK(b.system.getErrors().empty());
+    }
+
+    // And the RP2040's pairs, walked again since the chip is different
+    {
+        const unsigned walks = RomTable::getWalks();
+        SystemBench b(TargetSystem::RP2040, SwdTarget::RP2040_CORE0);
+        CHECK(Chip::connect(b.swd) == &Chip::RP2040);
+        const RomTable::Table* t = RomTable::get(b.swd);
+        CHECK(t != nullptr);
+        if (t != nullptr) {
+            CHECK_EQ(t->count, 10);
+            CHECK_EQ(t->find('R', 'P').value_or(0), 0x0231);
+            CHECK(!t->find('S', 'R').has_value());
+        }
+        CHECK_EQ(RomTable::getWalks(), walks + 1);
+        CHECK(b.system.getErrors().empty());
+    }
+}
+
+static void backAndForth() {
+
+    // Both tables are held after romTables(), so switching chips costs 
+    // neither a ROM read nor a flash write
+    const unsigned walks = RomTable::getWalks();
+    const unsigned persists = RomTable::getPersists();
+    for (unsigned i = 0; i < 4; i++) {
+        const bool rp2350 = i % 2 == 0;
+        SystemBench b(rp2350 ? TargetSystem::RP2350 : TargetSystem::RP2040,
+            rp2350 ? SwdTarget::RP2350 : SwdTarget::RP2040_CORE0);
+        CHECK(Chip::connect(b.swd) != nullptr);
+        const RomTable::Table* t = RomTable::get(b.swd);
+        CHECK(t != nullptr);
+        if (t != nullptr)
+            CHECK_EQ(t->count, rp2350 ? 8u : 10u);
+        CHECK(b.system.getErrors().empty());
+    }
+    CHECK_EQ(RomTable::getWalks(), walks);
+    CHECK_EQ(RomTable::getPersists(), persists);
+}
+
+static void programRp2350() {
+
+    SystemBench b(TargetSystem::RP2350, SwdTarget::RP2350);
+    const Chip* chip = Chip::connect(b.swd);
+    CHECK(chip == &Chip::RP2350);
+    if (chip == nullptr)
+        return;
+    FlashLoader loader(b.swd);
+    loader.setChip(*chip);
+    CHECK_EQ(loader.begin(), 0);
+
+    // Past the first 2MB, which is all an RP2040 board has
+    const uint32_t offset = 0x200000;
+    const auto data = image(5 * SECTOR_SIZE, 0x2350);
+    CHECK_EQ(loader.program(offset, data.data(), data.size()), 0);
+    CHECK_EQ(loader.verify(offset, data.data(), data.size()), 0);
+    CHECK_EQ(loader.verifyCrc(offset, data.size(), FlashLoader::crc32(data.data(), data.size())), 0);
+
+    // One bad byte in the flash
+    b.settle();
+    b.system.flash()[offset + 3 * SECTOR_SIZE + 100] ^= 0x10;
+    CHECK_EQ(loader.verify(offset, data.data(), data.size()), FlashLoader::ERR_VERIFY);
+    b.system.flash()[offset + 3 * SECTOR_SIZE + 100] ^= 0x10;
+
+    CHECK_EQ(loader.end(), 0);
+    b.settle();
+
+    CHECK(memcmp(b.system.flash() + offset, data.data(), data.size()) == 0);
+    CHECK(b.system.isHalted());
+    CHECK(b.system.isXipMode());
+    CHECK_EQ(b.system.getStats().pagesProgrammed, data.size() / FlashLoader::PAGE_SIZE);
+    CHECK(b.system.getErrors().empty());
+}
+
+int main(int, const char**) {
+    connectEither();
+    romTables();
+    backAndForth();
+    programRp2350();
+    return check::result();
+}
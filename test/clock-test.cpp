@@ -0,0 +1,170 @@
+/**
+ * SWCLK against the model DAP: the rate that the PIO divider actually
+ * gives, trainClock() settling one step below the fastest rate the link
+ * takes, and the runtime back-off on wire errors and on WAITs.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+#include "Bench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t RAM_BASE = Bench::RAM_BASE;
+
+// Where the model link starts to fail, between the 12 and 15 MHz steps
+static const double LINK_LIMIT_HZ = 13000000;
+
+/**
+ * The PIO divider has eight fractional bits, so most steps come out a 
+ * little under.
+ */
+static bool near(unsigned hz, unsigned step) {
+    return hz <= step && hz > step - step / 200;
+}
+
+/**
+ * Reads until at least this many packets have gone out, so the back-off
+ * window has closed.
+ */
+static void traffic(Bench& b, unsigned packets) {
+    uint32_t data[64];
+    const uint32_t start = b.swd.getCounters().packets;
+    while (b.swd.getCounters().packets - start < packets)
+        b.swd.readBlockViaAP(RAM_BASE, data, 64);
+}
+
+static void achievedRate() {
+
+    Bench b;
+    // A whole divider
+    b.swd.setClockHz(10000000);
+    CHECK_EQ(b.swd.getClockHz(), 10000000);
+
+    // A fractional one is rounded up, so the rate is never above the
+    // one asked for
+    b.swd.setClockHz(12000000);
+    CHECK(near(b.swd.getClockHz(), 12000000));
+    CHECK_EQ(b.swd.getClockHz(), (unsigned)(PioModel::get().getSwclkHz() + 0.5));
+
+    // Past a quarter of the system clock the divider is pinned at 1
+    b.swd.setClockHz(50000000);
+    CHECK_EQ(b.swd.getClockHz(), PioModel::SYS_CLOCK_HZ / 4);
+    CHECK_EQ(b.swd.getClockHz(), (unsigned)PioModel::get().getSwclkHz());
+}
+
+static void trainSettles() {
+
+    // One step below the fastest that worked
+    {
+        Bench b;
+        CHECK_EQ(b.swd.connect(), 0);
+        b.swdTarget.setMaxClockHz(LINK_LIMIT_HZ);
+        CHECK_EQ(b.swd.trainClock(RAM_BASE), 0);
+        CHECK_EQ(b.swd.getClockHz(), 10000000);
+        CHECK_EQ(b.swd.getCounters().clockBackoffs, 0);
+        // And it works there
+        CHECK(b.swd.readWordViaAP(RAM_BASE).has_value());
+    }
+
+    // A clean link goes up to the top of the table, capped by maxHz
+    {
+        Bench b;
+        CHECK_EQ(b.swd.connect(), 0);
+        CHECK_EQ(b.swd.trainClock(RAM_BASE), 0);
+        CHECK_EQ(b.swd.getClockHz(), 20000000);
+        CHECK_EQ(b.swd.trainClock(RAM_BASE, 6000000), 0);
+        CHECK_EQ(b.swd.getClockHz(), 4000000);
+    }
+
+    // Nothing works, so the slowest rate and an error
+    {
+        Bench b;
+        CHECK_EQ(b.swd.connect(), 0);
+        b.swdTarget.setMaxClockHz(100000);
+        CHECK_EQ(b.swd.trainClock(RAM_BASE), PioSWDDriver::ERR_PARITY);
+        CHECK_EQ(b.swd.getClockHz(), 500000);
+    }
+}
+
+static void backoffOnErrors() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    b.swdTarget.setMaxClockHz(LINK_LIMIT_HZ);
+    CHECK_EQ(b.swd.trainClock(RAM_BASE), 0);
+    CHECK_EQ(b.swd.getClockHz(), 10000000);
+    b.swd.resetCounters();
+
+    // A few parity errors in a window are put up with
+    b.swdTarget.injectParityErrors(3);
+    traffic(b, 300);
+    CHECK_EQ(b.swd.getCounters().parityErrors, 3);
+    CHECK_EQ(b.swd.getCounters().clockBackoffs, 0);
+    CHECK_EQ(b.swd.getClockHz(), 10000000);
+
+    // One more is a step down
+    traffic(b, 300);
+    b.swdTarget.injectParityErrors(4);
+    traffic(b, 300);
+    CHECK_EQ(b.swd.getCounters().clockBackoffs, 1);
+    CHECK_EQ(b.swd.getClockHz(), 8000000);
+
+    // And garbled ACKs count the same way
+    traffic(b, 300);
+    b.swdTarget.injectNoAcks(4);
+    traffic(b, 300);
+    CHECK_EQ(b.swd.getCounters().clockBackoffs, 2);
+    CHECK(near(b.swd.getClockHz(), 6000000));
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+static void backoffOnWaits() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    CHECK_EQ(b.swd.trainClock(RAM_BASE), 0);
+    CHECK_EQ(b.swd.getClockHz(), 20000000);
+    b.swd.resetCounters();
+
+    // A stall now and then is the normal thing
+    b.swdTarget.injectWaits(30);
+    traffic(b, 300);
+    CHECK_EQ(b.swd.getCounters().waits, 30);
+    CHECK_EQ(b.swd.getCounters().clockBackoffs, 0);
+
+    // A quarter of the window is too many
+    traffic(b, 300);
+    b.swdTarget.injectWaits(70);
+    traffic(b, 300);
+    CHECK_EQ(b.swd.getCounters().clockBackoffs, 1);
+    CHECK(near(b.swd.getClockHz(), 15000000));
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+static void untrainedStays() {
+
+    // The rate the caller set is left alone, whatever happens
+    Bench b;
+    b.swd.setClockHz(8000000);
+    CHECK_EQ(b.swd.connect(), 0);
+    b.swdTarget.injectParityErrors(10);
+    b.swdTarget.injectWaits(100, 20);
+    traffic(b, 600);
+    CHECK_EQ(b.swd.getCounters().clockBackoffs, 0);
+    CHECK_EQ(b.swd.getClockHz(), 8000000);
+}
+
+int main(int, const char**) {
+    achievedRate();
+    trainSettles();
+    backoffOnErrors();
+    backoffOnWaits();
+    untrainedStays();
+    return check::result();
+}
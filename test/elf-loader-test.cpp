@@ -0,0 +1,151 @@
+/**
+ * FlashLoader::programElf() against the model chip, with ELF files
+ * made up here: the two-segment layout of program.txt, and segments
+ * with whole pages of nothing between them inside one sector.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "FlashLoader.h"
+#include "SystemBench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t FLASH_BASE = FlashLoader::FLASH_XIP_BASE;
+static const uint32_t PAGE_SIZE = FlashLoader::PAGE_SIZE;
+
+struct Segment {
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+};
+
+static void put16(std::vector<uint8_t>& v, unsigned at, uint16_t x) {
+    v[at] = x & 0xff;
+    v[at + 1] = x >> 8;
+}
+
+static void put32(std::vector<uint8_t>& v, unsigned at, uint32_t x) {
+    put16(v, at, x & 0xffff);
+    put16(v, at + 2, x >> 16);
+}
+
+/**
+ * An ELF32 with a PT_LOAD for each segment, the contents of each one
+ * made from its address.
+ */
+static std::vector<uint8_t> makeElf(const std::vector<Segment>& segments) {
+    const unsigned phoff = 52;
+    unsigned dataOff = phoff + 32 * segments.size();
+    unsigned size = dataOff;
+    for (const auto& s : segments)
+        size += s.filesz;
+    std::vector<uint8_t> elf(size, 0);
+    memcpy(elf.data(), "\x7f" "ELF\x01\x01\x01", 7);
+    // ET_EXEC, EM_ARM
+    put16(elf, 16, 2);
+    put16(elf, 18, 40);
+    put32(elf, 28, phoff);
+    put16(elf, 40, 52);
+    put16(elf, 42, 32);
+    put16(elf, 44, segments.size());
+    for (unsigned i = 0; i < segments.size(); i++) {
+        const Segment& s = segments[i];
+        const unsigned ph = phoff + i * 32;
+        // PT_LOAD
+        put32(elf, ph, 1);
+        put32(elf, ph + 4, dataOff);
+        put32(elf, ph + 8, s.paddr);
+        put32(elf, ph + 12, s.paddr);
+        put32(elf, ph + 16, s.filesz);
+        put32(elf, ph + 20, s.memsz);
+        for (unsigned k = 0; k < s.filesz; k++)
+            elf[dataOff + k] = ((s.paddr + k) * 0x9e3779b1) >> 24;
+        dataOff += s.filesz;
+    }
+    return elf;
+}
+
+/**
+ * The flash holds each segment's contents.
+ */
+static bool flashHolds(SystemBench& b, const std::vector<uint8_t>& elf,
+    const std::vector<Segment>& segments) {
+    unsigned dataOff = 52 + 32 * segments.size();
+    for (const auto& s : segments) {
+        if (memcmp(b.system.flash() + (s.paddr - FLASH_BASE), elf.data() + dataOff, s.filesz) != 0)
+            return false;
+        dataOff += s.filesz;
+    }
+    return true;
+}
+
+static unsigned pagesOf(uint32_t len) {
+    return (len + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static void programTxtLayout() {
+
+    // .text and then .data right behind it, as in program.txt, and a
+    // .bss with nothing in the file
+    const std::vector<Segment> segments = {
+        { FLASH_BASE, 0x8060, 0x8060 },
+        { FLASH_BASE + 0x8060, 0xfc8, 0xfc8 },
+        { 0x20000000 + 0xfc8, 0, 0x400 }
+    };
+    const auto elf = makeElf(segments);
+
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    FlashLoader loader(b.swd);
+    CHECK_EQ(loader.begin(), 0);
+    CHECK_EQ(loader.programElf(elf.data(), elf.size()), 0);
+    CHECK_EQ(loader.end(), 0);
+    b.settle();
+
+    CHECK(flashHolds(b, elf, segments));
+    CHECK_EQ(b.system.getStats().pagesProgrammed, pagesOf(0x8060 + 0xfc8));
+    CHECK_EQ(loader.getStats().bytesSent, pagesOf(0x8060 + 0xfc8) * PAGE_SIZE);
+    CHECK(b.system.getErrors().empty());
+}
+
+static void gapsInASector() {
+
+    // Pages 0, 5-6 and 15 of one sector, then the first two pages of the
+    // sector after it. The pages in between are never sent.
+    const uint32_t base = FLASH_BASE + 0x20000;
+    const std::vector<Segment> segments = {
+        { base, 0x100, 0x100 },
+        { base + 0x520, 0x180, 0x180 },
+        { base + 0xf00, 0x40, 0x40 },
+        { base + 0x1000, 0x200, 0x200 }
+    };
+    const auto elf = makeElf(segments);
+
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    FlashLoader loader(b.swd);
+    CHECK_EQ(loader.begin(), 0);
+    CHECK_EQ(loader.programElf(elf.data(), elf.size()), 0);
+    CHECK_EQ(loader.end(), 0);
+    b.settle();
+
+    CHECK(flashHolds(b, elf, segments));
+    const unsigned pages = 1 + 2 + 1 + 2;
+    CHECK_EQ(b.system.getStats().pagesProgrammed, pages);
+    CHECK_EQ(loader.getStats().bytesSent, pages * PAGE_SIZE);
+    CHECK_EQ(loader.getStats().bytesProgrammed, pages * PAGE_SIZE);
+    // One erase for each of the two sectors
+    CHECK_EQ(b.system.getStats().sectorErases, 2);
+    CHECK(b.system.getErrors().empty());
+}
+
+int main(int, const char**) {
+    programTxtLayout();
+    gapsInASector();
+    return check::result();
+}
@@ -0,0 +1,174 @@
+/**
+ * FlashLoader against the model chip, with the stub's calls done by the
+ * model: plain and packed images programmed and verified, and packed
+ * sectors that the stub unpacks to the wrong length.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "FlashLoader.h"
+#include "SystemBench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t SECTOR_SIZE = FlashLoader::SECTOR_SIZE;
+static const uint32_t IMAGE_OFFSET = 0x10000;
+
+static std::vector<uint8_t> image(unsigned len, uint32_t seed) {
+    // Random words with runs of 0xff in between, like code and padding
+    std::vector<uint8_t> data(len, 0xff);
+    uint32_t x = seed;
+    for (unsigned i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if ((i / 512) % 3 != 2)
+            data[i] = x & 0xff;
+    }
+    return data;
+}
+
+/**
+ * One sector in pack-image.py's format: literal runs, and a one-byte
+ * literal followed by a copy from a distance of one for each run of a
+ * repeated byte.
+ *
+ * @param len The unpacked length the header claims.
+ */
+static void packSector(std::vector<uint8_t>& out, const uint8_t* data, unsigned dataLen,
+    unsigned len) {
+
+    std::vector<uint8_t> tokens;
+    unsigned literal = 0;
+    const auto flush = [&](unsigned end) {
+        while (literal < end) {
+            const unsigned n = std::min(end - literal, 128u);
+            tokens.push_back(n - 1);
+            tokens.insert(tokens.end(), data + literal, data + literal + n);
+            literal += n;
+        }
+    };
+    for (unsigned i = 0; i < dataLen; ) {
+        unsigned run = 1;
+        while (i + run < dataLen && data[i + run] == data[i] && run < 1 + 130)
+            run++;
+        if (run < 4) {
+            i += run;
+            continue;
+        }
+        flush(i + 1);
+        tokens.push_back(0x80 + (run - 1 - 3));
+        tokens.push_back(1);
+        tokens.push_back(0);
+        i += run;
+        literal = i;
+    }
+    flush(dataLen);
+
+    out.push_back(tokens.size() & 0xff);
+    out.push_back(tokens.size() >> 8);
+    out.push_back(len & 0xff);
+    out.push_back(len >> 8);
+    out.insert(out.end(), tokens.begin(), tokens.end());
+    while (out.size() % 4 != 0)
+        out.push_back(0);
+}
+
+static std::vector<uint8_t> pack(const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> out;
+    for (unsigned pos = 0; pos < data.size(); pos += SECTOR_SIZE) {
+        const unsigned n = std::min((unsigned)data.size() - pos, SECTOR_SIZE);
+        packSector(out, data.data() + pos, n, n);
+    }
+    return out;
+}
+
+static bool flashHolds(SystemBench& b, uint32_t offset, const std::vector<uint8_t>& data) {
+    return memcmp(b.system.flash() + offset, data.data(), data.size()) == 0;
+}
+
+static void programAndVerify() {
+
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    FlashLoader loader(b.swd);
+    CHECK_EQ(loader.begin(), 0);
+
+    const auto data = image(5 * SECTOR_SIZE, 0x1234567);
+    CHECK_EQ(loader.program(IMAGE_OFFSET, data.data(), data.size()), 0);
+    CHECK_EQ(loader.verify(IMAGE_OFFSET, data.data(), data.size()), 0);
+    CHECK_EQ(loader.end(), 0);
+    b.settle();
+
+    CHECK(flashHolds(b, IMAGE_OFFSET, data));
+    CHECK(b.system.isHalted());
+    CHECK(b.system.isXipMode());
+    CHECK_EQ(b.system.getStats().pagesProgrammed, data.size() / FlashLoader::PAGE_SIZE);
+    CHECK_EQ(b.system.getStats().dmaTransfers, 1);
+    CHECK(b.system.getErrors().empty());
+}
+
+static void programPacked() {
+
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    FlashLoader loader(b.swd);
+    CHECK_EQ(loader.begin(), 0);
+
+    const auto data = image(6 * SECTOR_SIZE, 0x7654321);
+    const auto packed = pack(data);
+    CHECK_EQ(loader.programPacked(IMAGE_OFFSET, packed.data(), packed.size()), 0);
+    CHECK_EQ(loader.verify(IMAGE_OFFSET, data.data(), data.size()), 0);
+    CHECK_EQ(loader.end(), 0);
+    b.settle();
+
+    CHECK(flashHolds(b, IMAGE_OFFSET, data));
+    CHECK_EQ(b.system.getStats().unpacks, 6);
+    CHECK(loader.getStats().bytesSent < data.size());
+    CHECK(b.system.getErrors().empty());
+}
+
+static void shortUnpack() {
+
+    // A sector whose tokens only come to half of what its header says,
+    // first with sectors after it, so the short count turns up while
+    // the rest are still going out, and then as the last sector, where
+    // it turns up when the loader next waits
+    const unsigned shortSectors[] = { 0, 3 };
+    for (unsigned bad : shortSectors) {
+        SystemBench b;
+        CHECK_EQ(b.swd.connect(), 0);
+        FlashLoader loader(b.swd);
+        CHECK_EQ(loader.begin(), 0);
+
+        const auto data = image(4 * SECTOR_SIZE, 0x600d + bad);
+        std::vector<uint8_t> packed;
+        for (unsigned s = 0; s < 4; s++) {
+            const uint8_t* sector = data.data() + s * SECTOR_SIZE;
+            packSector(packed, sector, s == bad ? SECTOR_SIZE / 2 : SECTOR_SIZE, SECTOR_SIZE);
+        }
+
+        const int rc = loader.programPacked(IMAGE_OFFSET, packed.data(), packed.size());
+        if (bad == 0)
+            CHECK_EQ(rc, FlashLoader::ERR_UNPACK);
+        else {
+            CHECK_EQ(rc, 0);
+            CHECK_EQ(loader.waitIdle(), FlashLoader::ERR_UNPACK);
+        }
+        // Only reported once
+        CHECK_EQ(loader.waitIdle(), 0);
+        CHECK(b.system.getErrors().empty());
+    }
+}
+
+int main(int, const char**) {
+    programAndVerify();
+    programPacked();
+    shortUnpack();
+    return check::result();
+}
@@ -0,0 +1,111 @@
+/**
+ * The request header and parity encoding from before SWDProtocol.h (bits
+ * worked out on every transfer, parity with __builtin_parity) against
+ * the table lookup and the nibble fold. Checks that the two give the
+ * same bits and prints the time per packet for each.
+ *
+ * The times are for the host CPU. On x86 __builtin_parity is an
+ * instruction, on the Cortex-M0+ it's a libgcc call that does the same
+ * fold as swd::parity(), so the parity column says little about the
+ * Pico. Headers for the registers named by a DPReg<>/APReg<> are
+ * constants and don't show up here at all.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <chrono>
+#include <vector>
+
+#include "SWDProtocol.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const unsigned OPS = 4096;
+static const unsigned ROUNDS = 2000;
+
+/**
+ * PioSWDDriver::_header() as it was.
+ */
+static uint32_t oldHeader(bool apNdp, bool read, uint8_t addr) {
+    const uint32_t a2 = (addr >> 2) & 1;
+    const uint32_t a3 = (addr >> 3) & 1;
+    const uint32_t p = (apNdp ? 1 : 0) ^ (read ? 1 : 0) ^ a2 ^ a3;
+    // Start, APnDP, RnW, A[2:3], parity, stop, park
+    return 1 |
+        ((apNdp ? 1 : 0) << 1) |
+        ((read ? 1 : 0) << 2) |
+        (a2 << 3) |
+        (a3 << 4) |
+        (p << 5) |
+        (1 << 7);
+}
+
+static bool oldParity(uint32_t v) {
+    return __builtin_parity(v);
+}
+
+struct Op {
+    bool apNdp;
+    bool read;
+    uint8_t addr;
+    uint32_t data;
+};
+
+// Keeps the loops from being thrown away
+static volatile uint32_t sink;
+
+template<typename F> static double nsPerOp(const std::vector<Op>& ops, F encode) {
+    const auto start = std::chrono::steady_clock::now();
+    uint32_t sum = 0;
+    for (unsigned r = 0; r < ROUNDS; r++)
+        for (const Op& op : ops)
+            sum += encode(op);
+    sink = sum;
+    const std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+    return ns.count() / ((double)ROUNDS * ops.size());
+}
+
+int main(int, const char**) {
+
+    // Every header the table can give
+    for (unsigned i = 0; i < 16; i++) {
+        const bool apNdp = i & 1, read = i & 2;
+        const uint8_t addr = i & 0xc;
+        CHECK_EQ(swd::lookupHeader(apNdp, read, addr), oldHeader(apNdp, read, addr));
+    }
+
+    // A spread of data words, made at run time so nothing gets folded
+    std::vector<Op> ops(OPS);
+    uint32_t x = 0x2545f491;
+    for (Op& op : ops) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        op.apNdp = x & 1;
+        op.read = x & 2;
+        op.addr = x & 0xc;
+        op.data = x;
+        CHECK_EQ(swd::parity(op.data), oldParity(op.data));
+    }
+
+    const double oldHeaderNs = nsPerOp(ops, [](const Op& op) {
+        return oldHeader(op.apNdp, op.read, op.addr);
+    });
+    const double newHeaderNs = nsPerOp(ops, [](const Op& op) {
+        return (uint32_t)swd::lookupHeader(op.apNdp, op.read, op.addr);
+    });
+    const double oldParityNs = nsPerOp(ops, [](const Op& op) {
+        return (uint32_t)oldParity(op.data);
+    });
+    const double newParityNs = nsPerOp(ops, [](const Op& op) {
+        return (uint32_t)swd::parity(op.data);
+    });
+
+    printf("%u packets x %u:\n", OPS, ROUNDS);
+    printf("  %-8s %12s %12s\n", "", "computed", "SWDProtocol");
+    printf("  %-8s %9.2f ns %9.2f ns\n", "header", oldHeaderNs, newHeaderNs);
+    printf("  %-8s %9.2f ns %9.2f ns\n", "parity", oldParityNs, newParityNs);
+
+    return check::result();
+}
@@ -0,0 +1,151 @@
+/**
+ * ImageReceiver's framing, with the replies it prints taken from stdout
+ * and a FlashLoader behind it on the model chip.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "FlashLoader.h"
+#include "Uf2Decoder.h"
+#include "ImageReceiver.h"
+#include "SystemBench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t IMAGE_OFFSET = 0x40000;
+
+static std::vector<uint8_t> frame(char type, uint8_t seq, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> f = { ImageReceiver::SYNC_0, ImageReceiver::SYNC_1, (uint8_t)type, seq,
+        (uint8_t)(payload.size() & 0xff), (uint8_t)(payload.size() >> 8) };
+    for (uint8_t b : payload)
+        f.push_back(b);
+    const uint32_t crc = FlashLoader::crc32(f.data() + 2, f.size() - 2);
+    for (unsigned i = 0; i < 4; i++)
+        f.push_back(crc >> (i * 8));
+    return f;
+}
+
+static std::vector<uint8_t> le32(std::initializer_list<uint32_t> words) {
+    std::vector<uint8_t> v;
+    for (uint32_t w : words)
+        for (unsigned i = 0; i < 4; i++)
+            v.push_back(w >> (i * 8));
+    return v;
+}
+
+/**
+ * A header that claims a payload of len bytes, followed by some of it.
+ */
+static std::vector<uint8_t> oversized(char type, uint8_t seq, unsigned len) {
+    std::vector<uint8_t> f = { ImageReceiver::SYNC_0, ImageReceiver::SYNC_1,
+        (uint8_t)type, seq, (uint8_t)(len & 0xff), (uint8_t)(len >> 8) };
+    f.resize(f.size() + 64, 0x11);
+    return f;
+}
+
+/**
+ * What the receiver prints while it takes the bytes.
+ */
+static std::string put(ImageReceiver& rx, const std::vector<uint8_t>& bytes) {
+    fflush(stdout);
+    FILE* capture = tmpfile();
+    const int saved = dup(STDOUT_FILENO);
+    dup2(fileno(capture), STDOUT_FILENO);
+    rx.put(bytes.data(), bytes.size());
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    rewind(capture);
+    std::string out;
+    for (int c; (c = fgetc(capture)) != EOF; )
+        out += (char)c;
+    fclose(capture);
+    return out;
+}
+
+static void oversizedLength() {
+
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    FlashLoader loader(b.swd);
+    CHECK_EQ(loader.begin(), 0);
+    Uf2Decoder uf2(loader);
+    ImageReceiver rx(loader, uf2, Uf2Family::RP2040);
+
+    // Before a session the length isn't trusted either, but there is no
+    // one to tell
+    CHECK_STR(put(rx, oversized('D', 7, 0x8000)), "");
+    CHECK(!rx.isDone());
+
+    // In a session, the sender hears about it straight away
+    const auto begin = frame('B', 0, le32({ IMAGE_OFFSET, 0x1000, 0 }));
+    CHECK_STR(put(rx, begin), "OK 0\n");
+    CHECK_STR(put(rx, oversized('D', 1, ImageReceiver::MAX_PAYLOAD + 1)), "ERR 1 103\n");
+    CHECK(rx.isDone());
+    CHECK_EQ(rx.getResult(), ImageReceiver::ERR_FRAME);
+
+    // A session that starts with one
+    rx.reset();
+    CHECK_STR(put(rx, oversized('B', 0, 0xffff)), "ERR 0 103\n");
+    CHECK(rx.isDone());
+    rx.reset();
+    CHECK_STR(put(rx, oversized('U', 0, 0x0800)), "ERR 0 103\n");
+    CHECK(rx.isDone());
+
+    // And the next session is fine
+    rx.reset();
+    std::vector<uint8_t> data(600);
+    for (unsigned i = 0; i < data.size(); i++)
+        data[i] = i * 7;
+    std::vector<uint8_t> padded = data;
+    padded.resize((data.size() + 3) & ~3u, 0xff);
+    const uint32_t crc = FlashLoader::crc32(padded.data(), padded.size());
+    CHECK_STR(put(rx, frame('B', 0, le32({ IMAGE_OFFSET, (uint32_t)data.size(), crc }))), "OK 0\n");
+    CHECK_STR(put(rx, frame('D', 1, data)), "OK 1\n");
+    CHECK_STR(put(rx, frame('E', 2, { })), "OK 2\n");
+    CHECK(rx.isDone());
+    CHECK_EQ(rx.getResult(), 0);
+    CHECK(b.system.getErrors().empty());
+}
+
+static void loaderFault() {
+
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    FlashLoader loader(b.swd);
+    CHECK_EQ(loader.begin(), 0);
+    Uf2Decoder uf2(loader);
+    ImageReceiver rx(loader, uf2, Uf2Family::RP2040);
+
+    const auto data = std::vector<uint8_t>(2 * FlashLoader::SECTOR_SIZE, 0x5a);
+    CHECK_STR(put(rx, frame('B', 0, le32({ IMAGE_OFFSET, (uint32_t)data.size(), 0 }))), "OK 0\n");
+    const unsigned frames = FlashLoader::SECTOR_SIZE / ImageReceiver::MAX_PAYLOAD;
+    for (unsigned i = 0; i < frames - 1; i++) {
+        const std::vector<uint8_t> payload(data.begin() + i * ImageReceiver::MAX_PAYLOAD,
+            data.begin() + (i + 1) * ImageReceiver::MAX_PAYLOAD);
+        CHECK_STR(put(rx, frame('D', i + 1, payload)), "OK " + std::to_string(i + 1) + "\n");
+    }
+
+    // The frame that completes the first sector sends it to the target,
+    // where the AP fails. The driver's code is passed on as it is, and
+    // mustn't be taken for one of the receiver's own.
+    b.swdTarget.injectFault();
+    const std::vector<uint8_t> last(data.begin() + (frames - 1) * ImageReceiver::MAX_PAYLOAD,
+        data.begin() + frames * ImageReceiver::MAX_PAYLOAD);
+    CHECK_STR(put(rx, frame('D', frames, last)),
+        "ERR " + std::to_string(frames) + " " + std::to_string(PioSWDDriver::ERR_FAULT) + "\n");
+    CHECK(rx.isDone());
+    CHECK_EQ(rx.getResult(), PioSWDDriver::ERR_FAULT);
+    CHECK(rx.getResult() != ImageReceiver::ERR_SEQ);
+}
+
+int main(int, const char**) {
+    oversizedLength();
+    loaderFault();
+    return check::result();
+}
@@ -0,0 +1,222 @@
+/**
+ * send-image.py talking to an ImageReceiver through a pty, standing in
+ * for prog-3's USB CDC port, with a FlashLoader on the model chip
+ * behind it, for plain and UF2 images. The bytes are taken from the pty
+ * a chunk at a time and the replies go back the same way, as in prog-3.
+ *
+ * image-stream-test <python> <send-image.py>
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "FlashLoader.h"
+#include "Uf2Decoder.h"
+#include "ImageReceiver.h"
+#include "SystemBench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const char* python;
+static const char* sendImage;
+
+// As in prog-3
+static const unsigned CHUNK_SIZE = 1024;
+
+static std::vector<uint8_t> image(unsigned len, uint32_t seed) {
+    std::vector<uint8_t> data(len);
+    uint32_t x = seed;
+    for (unsigned i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = x & 0xff;
+    }
+    return data;
+}
+
+/**
+ * Runs send-image.py with the image against a receiver on the model
+ * chip.
+ *
+ * @param corruptAt If not zero, the byte of the stream that is flipped
+ *   on the way in.
+ * @returns send-image.py's exit status.
+ */
+static int stream(SystemBench& b, const std::vector<uint8_t>& data, uint32_t offset,
+    unsigned corruptAt = 0) {
+
+    char path[] = "/tmp/image-stream-XXXXXX";
+    const int file = mkstemp(path);
+    CHECK(write(file, data.data(), data.size()) == (ssize_t)data.size());
+    close(file);
+
+    const int master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(master >= 0);
+    grantpt(master);
+    unlockpt(master);
+    const std::string slavePath = ptsname(master);
+    // Held open here too, so the master doesn't see a hangup before
+    // send-image.py has opened its end
+    const int slave = open(slavePath.c_str(), O_RDWR | O_NOCTTY);
+
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(master);
+        close(slave);
+        const std::string offsetArg = std::to_string(offset);
+        execlp(python, python, sendImage, slavePath.c_str(), path, offsetArg.c_str(),
+            (char*)nullptr);
+        _exit(127);
+    }
+
+    FlashLoader loader(b.swd);
+    CHECK_EQ(loader.begin(), 0);
+    Uf2Decoder uf2(loader);
+    ImageReceiver rx(loader, uf2, Uf2Family::RP2040);
+    rx.reset();
+
+    // The replies go to the pty
+    const int savedStdout = dup(STDOUT_FILENO);
+    uint8_t chunk[CHUNK_SIZE];
+    unsigned received = 0;
+    int status = -1;
+    while (!rx.isDone()) {
+        pollfd p = { master, POLLIN, 0 };
+        if (poll(&p, 1, 100) <= 0) {
+            // Gave up without an answer
+            if (waitpid(pid, &status, WNOHANG) == pid)
+                break;
+            continue;
+        }
+        const ssize_t len = read(master, chunk, sizeof(chunk));
+        if (len <= 0)
+            break;
+        if (corruptAt != 0 && corruptAt >= received && corruptAt < received + len)
+            chunk[corruptAt - received] ^= 0x40;
+        received += len;
+        dup2(master, STDOUT_FILENO);
+        rx.put(chunk, len);
+        fflush(stdout);
+        dup2(savedStdout, STDOUT_FILENO);
+    }
+    close(savedStdout);
+    if (rx.isDone() && rx.getResult() == 0)
+        CHECK_EQ(loader.end(), 0);
+    b.settle();
+
+    // send-image.py reads whatever else the programmer has to say until
+    // it goes quiet, so the pty stays open until it's gone
+    if (status == -1)
+        waitpid(pid, &status, 0);
+    close(slave);
+    close(master);
+    unlink(path);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * A UF2 file for the data at the offset, with its blocks shuffled and
+ * a block for another family after each one of ours.
+ */
+static std::vector<uint8_t> shuffledUf2(const std::vector<uint8_t>& data, uint32_t offset) {
+    const unsigned pages = data.size() / FlashLoader::PAGE_SIZE;
+    std::vector<std::vector<uint8_t>> blocks;
+    for (unsigned i = 0; i < pages; i++) {
+        for (uint32_t family : { Uf2Family::RP2040, Uf2Family::RP2350_ARM_S }) {
+            std::vector<uint8_t> block(Uf2Decoder::BLOCK_SIZE, 0);
+            const uint32_t header[] = { 0x0a324655, 0x9e5d5157, 0x00002000,
+                FlashLoader::FLASH_XIP_BASE + offset + i * FlashLoader::PAGE_SIZE,
+                FlashLoader::PAGE_SIZE, i, pages, family };
+            memcpy(block.data(), header, sizeof(header));
+            memcpy(block.data() + sizeof(header), data.data() + i * FlashLoader::PAGE_SIZE,
+                FlashLoader::PAGE_SIZE);
+            const uint32_t end = 0x0ab16f30;
+            memcpy(block.data() + Uf2Decoder::BLOCK_SIZE - 4, &end, 4);
+            blocks.push_back(block);
+        }
+    }
+    // Pairs stay together, so the first block is still one of ours
+    uint32_t x = 0x5eed;
+    for (unsigned i = pages - 1; i > 0; i--) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        const unsigned k = x % (i + 1);
+        std::swap(blocks[2 * i], blocks[2 * k]);
+        std::swap(blocks[2 * i + 1], blocks[2 * k + 1]);
+    }
+    std::vector<uint8_t> uf2;
+    for (const auto& block : blocks)
+        uf2.insert(uf2.end(), block.begin(), block.end());
+    return uf2;
+}
+
+static bool flashHolds(SystemBench& b, uint32_t offset, const std::vector<uint8_t>& data) {
+    return memcmp(b.system.flash() + offset, data.data(), data.size()) == 0;
+}
+
+static void twoOffsets() {
+
+    // Not a whole number of frames or sectors, and the second one in
+    // the middle of a 64K block
+    const auto data = image(3 * FlashLoader::SECTOR_SIZE + 1000, 0x2468ace);
+    const uint32_t offsets[] = { 0x40000, 0x123000 };
+    for (uint32_t offset : offsets) {
+        SystemBench b;
+        CHECK_EQ(b.swd.connect(), 0);
+        CHECK_EQ(stream(b, data, offset), 0);
+        CHECK(flashHolds(b, offset, data));
+        CHECK(b.system.isXipMode());
+        CHECK(b.system.getErrors().empty());
+    }
+}
+
+static void shuffledUf2() {
+
+    // More sectors than Uf2Decoder has buffers, so some are programmed
+    // a page at a time after they have been erased
+    const uint32_t offset = 0x60000;
+    const auto data = image(10 * FlashLoader::SECTOR_SIZE, 0xf2f2f2f);
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    CHECK_EQ(stream(b, shuffledUf2(data, offset), 0), 0);
+    CHECK(flashHolds(b, offset, data));
+    CHECK(b.system.getErrors().empty());
+}
+
+static void corruptFrame() {
+
+    // A byte in the middle of the second DATA frame's payload
+    const auto data = image(4 * FlashLoader::SECTOR_SIZE, 0x1357bdf);
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    const unsigned beginFrame = 6 + 12 + 4;
+    const unsigned dataFrame = 6 + ImageReceiver::MAX_PAYLOAD + 4;
+    CHECK_EQ(stream(b, data, 0x40000, beginFrame + dataFrame + 6 + 500), 1);
+    CHECK(b.system.getErrors().empty());
+}
+
+int main(int argc, const char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: image-stream-test <python> <send-image.py>\n");
+        return 1;
+    }
+    python = argv[1];
+    sendImage = argv[2];
+    twoOffsets();
+    shuffledUf2();
+    corruptFrame();
+    return check::result();
+}
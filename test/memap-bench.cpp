@@ -0,0 +1,140 @@
+/**
+ * MEM-AP throughput against the model target: a 4K block moved one word
+ * per call and with the block calls, with the packets per word and the
+ * rate in simulated time (the SWCLK the driver asked for, with the
+ * PIO's per-command overhead included).
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <vector>
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+#include "SimClock.h"
+#include "Bench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t RAM_BASE = Bench::RAM_BASE;
+static const unsigned WORDS = 1024;
+// Not 1K aligned, so the first TAR auto-increment boundary comes a few
+// words in
+static const uint32_t BLOCK_ADDR = RAM_BASE + 0x3f0;
+
+// SwdTarget::Transfer addresses
+static const uint32_t AP_TAR = 0x04;
+
+struct Result {
+    double packetsPerWord;
+    double kbPerSecond;
+    unsigned tarWrites;
+};
+
+enum class Method { SINGLE_READ, SINGLE_WRITE, BLOCK_READ, BLOCK_WRITE, STREAM_WRITE };
+
+static const char* const METHOD_NAMES[] = {
+    "readWordViaAP", "writeWordViaAP", "readBlockViaAP", "writeBlockViaAP",
+    "writeBlockViaAP (streamed)"
+};
+
+static Result run(Method method, unsigned hz) {
+
+    Bench b(SwdTarget::RP2040_CORE0, 0x2000);
+    b.swd.setClockHz(hz);
+    CHECK_EQ(b.swd.connect(), 0);
+    b.settle();
+    std::vector<SwdTarget::Transfer> log;
+    b.swdTarget.setLog(&log);
+
+    std::vector<uint32_t> out(WORDS), in(WORDS, 0);
+    for (unsigned i = 0; i < WORDS; i++) {
+        out[i] = 0x9e3779b9 * (i + 1);
+        if (method == Method::SINGLE_READ || method == Method::BLOCK_READ)
+            b.ram.at(BLOCK_ADDR + i * 4) = out[i];
+    }
+
+    b.swd.resetCounters();
+    const double start = sim::nowNs();
+    switch (method) {
+    case Method::SINGLE_READ:
+        for (unsigned i = 0; i < WORDS; i++)
+            in[i] = b.swd.readWordViaAP(BLOCK_ADDR + i * 4).value_or(0);
+        break;
+    case Method::SINGLE_WRITE:
+        for (unsigned i = 0; i < WORDS; i++)
+            CHECK_EQ(b.swd.writeWordViaAP(BLOCK_ADDR + i * 4, out[i]), 0);
+        break;
+    case Method::BLOCK_READ:
+        CHECK_EQ(b.swd.readBlockViaAP(BLOCK_ADDR, in.data(), WORDS), 0);
+        break;
+    case Method::BLOCK_WRITE:
+        CHECK_EQ(b.swd.writeBlockViaAP(BLOCK_ADDR, out.data(), WORDS), 0);
+        break;
+    case Method::STREAM_WRITE:
+        b.swd.setStreamingWrites(true);
+        CHECK_EQ(b.swd.writeBlockViaAP(BLOCK_ADDR, out.data(), WORDS), 0);
+        break;
+    }
+    b.settle();
+    const double ns = sim::nowNs() - start;
+
+    for (unsigned i = 0; i < WORDS; i++) {
+        const uint32_t got = (method == Method::SINGLE_READ || method == Method::BLOCK_READ) ?
+            in[i] : b.ram.at(BLOCK_ADDR + i * 4);
+        if (got != out[i]) {
+            CHECK_EQ(got, out[i]);
+            break;
+        }
+    }
+    CHECK(b.swdTarget.getErrors().empty());
+
+    Result r;
+    r.packetsPerWord = (double)b.swd.getCounters().packets / WORDS;
+    r.kbPerSecond = (WORDS * 4 / 1024.0) / (ns / 1e9);
+    r.tarWrites = 0;
+    for (const auto& t : log)
+        if (t.ap && !t.read && t.addr == AP_TAR)
+            r.tarWrites++;
+    return r;
+}
+
+int main(int, const char**) {
+
+    const unsigned rates[] = { PioSWDDriver::DEFAULT_CLOCK_HZ, 10000000 };
+    for (unsigned hz : rates) {
+        printf("%u words at %.1f MHz SWCLK:\n", WORDS, hz / 1e6);
+        printf("  %-28s %12s %10s %10s\n", "", "packets/word", "KB/s", "TAR writes");
+        Result results[5];
+        for (unsigned m = 0; m < 5; m++) {
+            results[m] = run((Method)m, hz);
+            printf("  %-28s %12.2f %10.1f %10u\n", METHOD_NAMES[m],
+                results[m].packetsPerWord, results[m].kbPerSecond, results[m].tarWrites);
+        }
+
+        const Result& singleRead = results[(int)Method::SINGLE_READ];
+        const Result& singleWrite = results[(int)Method::SINGLE_WRITE];
+        const Result& blockRead = results[(int)Method::BLOCK_READ];
+        const Result& blockWrite = results[(int)Method::BLOCK_WRITE];
+
+        // A single word is a TAR write and a DRW access, plus the RDBUFF
+        // read that collects a posted read
+        CHECK(singleRead.packetsPerWord >= 3.0);
+        CHECK(singleWrite.packetsPerWord >= 2.0);
+        // A block is about one packet per word, with TAR written at the
+        // start and at each 1K boundary. A read also pays for an RDBUFF
+        // read each time the run of DRW reads is broken, by a TAR write
+        // or by an implicit flush of a full queue.
+        const unsigned tarWrites = 1 + (BLOCK_ADDR + WORDS * 4 - 1) / 1024 - BLOCK_ADDR / 1024;
+        CHECK(blockRead.packetsPerWord < 1.05);
+        CHECK(blockWrite.packetsPerWord < 1.02);
+        CHECK_EQ(blockRead.tarWrites, tarWrites);
+        CHECK_EQ(blockWrite.tarWrites, tarWrites);
+        CHECK(blockRead.kbPerSecond > 2.5 * singleRead.kbPerSecond);
+        CHECK(blockWrite.kbPerSecond > 1.8 * singleWrite.kbPerSecond);
+    }
+
+    return check::result();
+}
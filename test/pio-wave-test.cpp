@@ -0,0 +1,375 @@
+/**
+ * Runs the driver through the PIO model and compares what comes out on
+ * the wire with waveforms built up bit by bit from the SWD spec (ADIv5.2
+ * B4.2), so the PIO program, the command words and the packet sequencing
+ * are all checked together.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <string>
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+#include "Bench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t RAM_BASE = Bench::RAM_BASE;
+
+static const uint32_t SELECTION_ALERT[4] = {
+    0x6209f392, 0x86852d95, 0xe3ddafe9, 0x19bc0ea2
+};
+
+// ----- Waveforms, one character per rising SWCLK edge (see traceEdges()) ----
+
+static unsigned parity(uint32_t v) {
+    return __builtin_parity(v);
+}
+
+static std::string repeat(char c, unsigned n) {
+    return std::string(n, c);
+}
+
+/**
+ * Bits driven by the host, LSB first.
+ */
+static std::string host(uint32_t v, unsigned bits) {
+    std::string s;
+    for (unsigned i = 0; i < bits; i++)
+        s += (v >> i) & 1 ? '1' : '0';
+    return s;
+}
+
+/**
+ * Bits driven by the target, LSB first.
+ */
+static std::string target(uint32_t v, unsigned bits) {
+    std::string s;
+    for (unsigned i = 0; i < bits; i++)
+        s += (v >> i) & 1 ? 'H' : 'L';
+    return s;
+}
+
+static const uint32_t ACK_OK = 0b001;
+static const uint32_t ACK_WAIT = 0b010;
+
+// Start, APnDP, RnW, A[2:3], parity, stop, park
+static std::string header(bool ap, bool read, unsigned a) {
+    const uint32_t bits = (ap ? 1 : 0) | (read ? 2 : 0) | (((a >> 2) & 3) << 2);
+    return "1" + host(bits, 4) + host(parity(bits), 1) + "01";
+}
+
+// Turnaround, ACK, data, parity and turnaround back to the host
+static std::string readPacket(bool ap, unsigned a, uint32_t data) {
+    return header(ap, true, a) + "z" + target(ACK_OK, 3) + target(data, 32) +
+        target(parity(data), 1) + "z";
+}
+
+// Turnaround, ACK, turnaround, data, parity and two idle cycles
+static std::string writePacket(bool ap, unsigned a, uint32_t data) {
+    return header(ap, false, a) + "z" + target(ACK_OK, 3) + "z" + host(data, 32) +
+        host(parity(data), 1) + "00";
+}
+
+// A WAIT with overrun detection off has no data phase
+static std::string waitPacket(bool ap, bool read, unsigned a) {
+    return header(ap, read, a) + "z" + target(ACK_WAIT, 3) + "z";
+}
+
+// Nobody answers, so the host waits out a data phase
+static std::string noAckPacket(bool ap, bool read, unsigned a) {
+    return header(ap, read, a) + "z" + repeat('z', 3) + repeat('z', 34);
+}
+
+// The ACK phase of TARGETSEL isn't driven by anybody
+static std::string targetSelPacket(uint32_t data) {
+    return header(false, false, 0xc) + repeat('z', 5) + host(data, 32) +
+        host(parity(data), 1) + "00";
+}
+
+static std::string lineReset() {
+    return repeat('1', 64) + repeat('0', 8);
+}
+
+static std::string dormantToSwd() {
+    std::string s = host(0xff, 8);
+    for (unsigned i = 0; i < 4; i++)
+        s += host(SELECTION_ALERT[i], 32);
+    return s + host(0, 4) + host(0x1a, 8);
+}
+
+// DP and AP register addresses (A[3:2])
+static const unsigned DP_ABORT = 0x0;
+static const unsigned DP_DPIDR = 0x0;
+static const unsigned DP_CTRL_STAT = 0x4;
+static const unsigned DP_SELECT = 0x8;
+static const unsigned DP_RDBUFF = 0xc;
+static const unsigned AP_CSW = 0x0;
+static const unsigned AP_TAR = 0x4;
+static const unsigned AP_DRW = 0xc;
+static const unsigned AP_IDR = 0xc;
+
+static const uint32_t CSW_WORD = 0x23000002;
+
+// ----- Tests ---------------------------------------------------------------
+
+static void connectSequence() {
+
+    Bench b;
+    b.trace();
+    CHECK_EQ(b.swd.connect(), 0);
+
+    const uint32_t dpidr = SwdTarget::RP2040_CORE0.dpidr;
+    const uint32_t targetId = SwdTarget::RP2040_CORE0.targetId;
+    const uint32_t apIdr = SwdTarget::RP2040_CORE0.apIdr;
+
+    const std::string expected =
+        dormantToSwd() +
+        lineReset() +
+        targetSelPacket(SwdTarget::RP2040_CORE0.targetSel) +
+        readPacket(false, DP_DPIDR, dpidr) +
+        // Clear the sticky flags
+        writePacket(false, DP_ABORT, 0x1e) +
+        // TARGETID is in DP bank 2
+        writePacket(false, DP_SELECT, 2) +
+        readPacket(false, DP_CTRL_STAT, targetId) +
+        writePacket(false, DP_SELECT, 0) +
+        // Power-up, with the ACKs showing up on the first read
+        writePacket(false, DP_CTRL_STAT, 0x50000000) +
+        readPacket(false, DP_CTRL_STAT, 0xf0000000) +
+        // IDR is in AP bank 0xf, its (posted) value comes from RDBUFF
+        writePacket(false, DP_SELECT, 0xf0) +
+        readPacket(true, AP_IDR, 0) +
+        readPacket(false, DP_RDBUFF, apIdr) +
+        writePacket(false, DP_SELECT, 0) +
+        writePacket(true, AP_CSW, CSW_WORD);
+
+    CHECK_STR(b.take(), expected);
+    CHECK_EQ(b.swd.getIDCODE(), dpidr);
+    CHECK_EQ(b.swd.getTARGETID(), targetId);
+    CHECK_EQ(b.swd.getAPID(), apIdr);
+    CHECK(b.swdTarget.getErrors().empty());
+    CHECK_EQ(PioModel::get().getContention(), 0);
+}
+
+static void wordAccess() {
+
+    Bench b;
+    b.trace();
+    CHECK_EQ(b.swd.connect(), 0);
+    b.take();
+
+    b.ram.at(RAM_BASE + 0x10) = 0xcafef00d;
+    const auto r = b.swd.readWordViaAP(RAM_BASE + 0x10);
+    CHECK(r.has_value() && *r == 0xcafef00d);
+    // CSW and SELECT are already in place. The DRW read returns the
+    // previous AP read's result (IDR, from connect()).
+    CHECK_STR(b.take(),
+        writePacket(true, AP_TAR, RAM_BASE + 0x10) +
+        readPacket(true, AP_DRW, SwdTarget::RP2040_CORE0.apIdr) +
+        readPacket(false, DP_RDBUFF, 0xcafef00d));
+
+    CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE + 0x14, 0x12345678), 0);
+    CHECK_STR(b.take(),
+        writePacket(true, AP_TAR, RAM_BASE + 0x14) +
+        writePacket(true, AP_DRW, 0x12345678));
+    CHECK_EQ(b.ram.at(RAM_BASE + 0x14), 0x12345678);
+
+    CHECK(b.swdTarget.getErrors().empty());
+    CHECK_EQ(PioModel::get().getContention(), 0);
+}
+
+static void waitRetry() {
+
+    Bench b;
+    b.trace();
+    CHECK_EQ(b.swd.connect(), 0);
+    b.take();
+
+    b.swdTarget.injectWaits(2);
+    CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE, 0x55aa55aa), 0);
+    CHECK_STR(b.take(),
+        waitPacket(true, false, AP_TAR) +
+        waitPacket(true, false, AP_TAR) +
+        writePacket(true, AP_TAR, RAM_BASE) +
+        writePacket(true, AP_DRW, 0x55aa55aa));
+    CHECK_EQ(b.swd.getCounters().waits, 2);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+static void protocolErrorRecovery() {
+
+    Bench b;
+    b.trace();
+    CHECK_EQ(b.swd.connect(), 0);
+    b.take();
+
+    // The target loses the header, so nothing answers and the driver
+    // starts over from a line reset
+    b.swdTarget.injectNoAcks(1);
+    CHECK(!b.swd.readDP(PioSWDDriver::DP_CTRL_STAT).has_value());
+    CHECK_STR(b.take(),
+        noAckPacket(false, true, DP_CTRL_STAT) +
+        lineReset() +
+        targetSelPacket(SwdTarget::RP2040_CORE0.targetSel) +
+        readPacket(false, DP_DPIDR, SwdTarget::RP2040_CORE0.dpidr) +
+        writePacket(false, DP_ABORT, 0x1e));
+    CHECK_EQ(b.swd.getCounters().protocolErrors, 1);
+
+    // And everything works again, with SELECT re-established
+    const auto r = b.swd.readDP(PioSWDDriver::DP_CTRL_STAT);
+    CHECK(r.has_value() && *r == 0xf0000000);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+static void wrongTarget() {
+
+    // An RP2040 driver talking to an RP2350: the TARGETSEL doesn't match
+    // so the DPIDR read goes unanswered
+    Bench b(SwdTarget::RP2350);
+    b.trace();
+    CHECK(b.swd.connect() != 0);
+    const std::string s = b.take();
+    const std::string prefix = dormantToSwd() + lineReset() +
+        targetSelPacket(SwdTarget::RP2040_CORE0.targetSel) +
+        noAckPacket(false, true, DP_DPIDR);
+    CHECK_STR(s.substr(0, prefix.size()), prefix);
+    CHECK_EQ(PioModel::get().getContention(), 0);
+}
+
+/**
+ * What each PIO cycle looks like, for one DP write packet: the four
+ * cycles of get_next_cmd with SWCLK low at the start of every command,
+ * the extra cycle for the data PULL, two low and two high cycles per
+ * bit, and the extra high cycle at the end of a turnaround or a read
+ * (the JMP back, the PUSH).
+ */
+static void cycleTiming() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    b.take();
+
+    std::string clk, dio;
+    PioModel::get().traceCycles(&clk, &dio);
+    CHECK_EQ(b.swd.writeDP(PioSWDDriver::DP_SELECT, 0x000000f0), 0);
+    b.take();
+    PioModel::get().traceCycles(nullptr, nullptr);
+
+    // One bit: the value goes out with SWCLK low and is held through the
+    // high half
+    auto bits = [](const std::string& values, std::string& c, std::string& d) {
+        for (char v : values) {
+            c += "__^^";
+            d += std::string(4, v);
+        }
+    };
+
+    std::string expClk, expDio;
+    // The header. Whatever was on SWDIO is held until the first OUT (the
+    // previous packet ended with idle zeros).
+    expClk += "_____";
+    expDio += "00000";
+    bits(header(false, false, DP_SELECT), expClk, expDio);
+    // Turnaround. The host lets go of SWDIO in the third cycle of
+    // get_next_cmd and the pull-up takes over until the target starts
+    // driving the first ACK bit on the rising edge.
+    expClk += "____" "__^^" "^";
+    expDio += "11zz" "zzHH" "H";
+    // ACK, sampled in the low half of each bit. The target moves on to
+    // the next bit on each rising edge and lets go after the last one.
+    expClk += "____" "__^^" "__^^" "__^^" "^";
+    expDio += "HHHH" "HHLL" "LLLL" "LLzz" "z";
+    // Turnaround
+    expClk += "____" "__^^" "^";
+    expDio += "zzzz" "zzzz" "z";
+    // Data, then the parity and idle bits, each a write command. The
+    // host takes the line back with the last level it drove (park).
+    expClk += "_____";
+    expDio += "zz111";
+    bits(host(0xf0, 32), expClk, expDio);
+    expClk += "_____";
+    expDio += "00000";
+    bits(host(0, 3), expClk, expDio);
+    // Waiting for the next command
+    expClk += "_";
+    expDio += "0";
+
+    CHECK_STR(clk, expClk);
+    CHECK_STR(dio, expDio);
+}
+
+/**
+ * Checks the host timing rules over a whole connect and some traffic:
+ * SWDIO only changes while SWCLK is low and settles at least one PIO
+ * cycle before the rising edge, SWCLK is high for two cycles and low for
+ * at least two, and nobody fights over the line.
+ */
+static void timingRules(unsigned hz) {
+
+    Bench b;
+    b.swd.setClockHz(hz);
+    std::string clk, dio;
+    PioModel::get().traceCycles(&clk, &dio);
+    CHECK_EQ(b.swd.connect(), 0);
+    uint32_t block[16];
+    for (unsigned i = 0; i < 16; i++)
+        block[i] = 0x01010101 * i;
+    CHECK_EQ(b.swd.writeBlockViaAP(RAM_BASE, block, 16), 0);
+    CHECK_EQ(b.swd.readBlockViaAP(RAM_BASE, block, 16), 0);
+    b.take();
+    PioModel::get().traceCycles(nullptr, nullptr);
+
+    unsigned highRun = 0, lowRun = 0;
+    unsigned badHigh = 0, badLow = 0, badSetup = 0, changedHigh = 0;
+    for (size_t i = 1; i < clk.size(); i++) {
+        const bool hostNow = dio[i] == '0' || dio[i] == '1';
+        if (clk[i] == '^') {
+            if (clk[i - 1] == '_') {
+                // Rising edge: the host's level has been there a cycle
+                if (hostNow && dio[i - 1] != dio[i])
+                    badSetup++;
+                if (lowRun < 2)
+                    badLow++;
+                lowRun = 0;
+            }
+            else if (hostNow && dio[i - 1] != dio[i]) {
+                changedHigh++;
+            }
+            highRun++;
+        }
+        else {
+            if (clk[i - 1] == '^') {
+                if (highRun < 2)
+                    badHigh++;
+                highRun = 0;
+            }
+            lowRun++;
+        }
+    }
+    CHECK_EQ(badSetup, 0);
+    CHECK_EQ(badLow, 0);
+    CHECK_EQ(badHigh, 0);
+    CHECK_EQ(changedHigh, 0);
+    CHECK_EQ(PioModel::get().getContention(), 0);
+    CHECK(b.swdTarget.getErrors().empty());
+
+    // Four cycles a bit at the requested rate
+    CHECK(PioModel::get().getSwclkHz() <= hz);
+    CHECK(PioModel::get().getSwclkHz() > hz * 0.9);
+}
+
+int main(int, const char**) {
+    connectSequence();
+    wordAccess();
+    waitRetry();
+    protocolErrorRecovery();
+    wrongTarget();
+    cycleTiming();
+    timingRules(PioSWDDriver::DEFAULT_CLOCK_HZ);
+    timingRules(25000000);
+    return check::result();
+}
@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+#
+# Assembles a PIO program into the same C header that the SDK's pioasm
+# makes, for the host tests where the SDK isn't around. Only the part
+# of the language that swd.pio uses is handled: one program, side-set,
+# delays, labels, .wrap_target/.wrap and the jmp, in, out, push, pull,
+# mov, set and nop instructions. Anything else is an error rather than
+# a guess.
+#
+# The encodings are from the RP2040 datasheet (3.4 Instruction Set).
+#
+# python3 pioasm.py ../swd.pio swd.pio.h
+#
+import re
+import sys
+
+JMP_CONDITIONS = { '': 0, '!x': 1, 'x--': 2, '!y': 3, 'y--': 4, 'x!=y': 5, 'pin': 6, '!osre': 7 }
+IN_SOURCES = { 'pins': 0, 'x': 1, 'y': 2, 'null': 3, 'isr': 6, 'osr': 7 }
+OUT_DESTINATIONS = { 'pins': 0, 'x': 1, 'y': 2, 'null': 3, 'pindirs': 4, 'pc': 5, 'isr': 6, 'exec': 7 }
+MOV_DESTINATIONS = { 'pins': 0, 'x': 1, 'y': 2, 'exec': 4, 'pc': 5, 'isr': 6, 'osr': 7 }
+MOV_SOURCES = { 'pins': 0, 'x': 1, 'y': 2, 'null': 3, 'status': 5, 'isr': 6, 'osr': 7 }
+SET_DESTINATIONS = { 'pins': 0, 'x': 1, 'y': 2, 'pindirs': 4 }
+
+class AsmError(Exception):
+    pass
+
+def number(text):
+    try:
+        return int(text, 0)
+    except ValueError:
+        raise AsmError("bad number '%s'" % text)
+
+def bit_count(text):
+    n = number(text)
+    if n < 1 or n > 32:
+        raise AsmError("bit count %d out of range" % n)
+    return n & 0x1f
+
+def encode(op, args, labels):
+    if op == 'jmp':
+        cond = args[0] if len(args) == 2 else ''
+        target = args[-1]
+        if cond not in JMP_CONDITIONS:
+            raise AsmError("bad jmp condition '%s'" % cond)
+        addr = labels[target] if target in labels else number(target)
+        return (0 << 13) | (JMP_CONDITIONS[cond] << 5) | addr
+    if op == 'in':
+        return (2 << 13) | (IN_SOURCES[args[0]] << 5) | bit_count(args[1])
+    if op == 'out':
+        return (3 << 13) | (OUT_DESTINATIONS[args[0]] << 5) | bit_count(args[1])
+    if op in ('push', 'pull'):
+        block = 1
+        if_flag = 0
+        for a in args:
+            if a in ('iffull', 'ifempty'):
+                if_flag = 1
+            elif a == 'noblock':
+                block = 0
+            elif a != 'block':
+                raise AsmError("bad %s option '%s'" % (op, a))
+        return (4 << 13) | ((1 if op == 'pull' else 0) << 7) | (if_flag << 6) | (block << 5)
+    if op == 'mov':
+        src = args[1]
+        mov_op = 0
+        if src.startswith('!') or src.startswith('~'):
+            mov_op = 1
+            src = src[1:]
+        elif src.startswith('::'):
+            mov_op = 2
+            src = src[2:]
+        return (5 << 13) | (MOV_DESTINATIONS[args[0]] << 5) | (mov_op << 3) | MOV_SOURCES[src]
+    if op == 'nop':
+        # mov y, y
+        return (5 << 13) | (2 << 5) | 2
+    if op == 'set':
+        return (7 << 13) | (SET_DESTINATIONS[args[0]] << 5) | (number(args[1]) & 0x1f)
+    raise AsmError("unsupported instruction '%s'" % op)
+
+def assemble(lines):
+    name = None
+    side_bits = 0
+    side_opt = False
+    wrap_target = None
+    wrap = None
+    labels = {}
+    public = []
+    body = []
+
+    # First pass: directives and label addresses
+    for number_, raw in enumerate(lines, 1):
+        line = re.split(r';|//', raw)[0].strip()
+        if not line:
+            continue
+        try:
+            if line.startswith('.'):
+                words = line.split()
+                if words[0] == '.program':
+                    if name is not None:
+                        raise AsmError("only one program is supported")
+                    name = words[1]
+                elif words[0] == '.side_set':
+                    side_bits = number(words[1])
+                    side_opt = 'opt' in words[2:]
+                    if 'pindirs' in words[2:]:
+                        raise AsmError("side-set pindirs is not supported")
+                elif words[0] == '.wrap_target':
+                    wrap_target = len(body)
+                elif words[0] == '.wrap':
+                    wrap = len(body) - 1
+                else:
+                    raise AsmError("unsupported directive '%s'" % words[0])
+                continue
+            m = re.match(r'(public\s+)?([A-Za-z_]\w*):$', line)
+            if m:
+                labels[m.group(2)] = len(body)
+                if m.group(1):
+                    public.append(m.group(2))
+                continue
+            body.append((number_, line))
+        except AsmError as e:
+            raise AsmError("line %d: %s" % (number_, e))
+
+    if name is None:
+        raise AsmError("no .program")
+    if wrap_target is None:
+        wrap_target = 0
+    if wrap is None:
+        wrap = len(body) - 1
+
+    # The side-set bits (with the enable bit when optional) come out of
+    # the top of the 5-bit delay/side-set field
+    side_field = side_bits + (1 if side_opt else 0)
+    delay_bits = 5 - side_field
+
+    code = []
+    for number_, line in body:
+        try:
+            delay = 0
+            m = re.search(r'\[\s*(\w+)\s*\]\s*$', line)
+            if m:
+                delay = number(m.group(1))
+                line = line[:m.start()].strip()
+            side = None
+            m = re.search(r'\bside\s+(\w+)\s*$', line)
+            if m:
+                side = number(m.group(1))
+                line = line[:m.start()].strip()
+            if delay >= (1 << delay_bits):
+                raise AsmError("delay %d is too long" % delay)
+            if side is not None and side_bits == 0:
+                raise AsmError("side-set without .side_set")
+            if side is None and side_bits > 0 and not side_opt:
+                raise AsmError("side-set is not optional")
+
+            words = line.replace(',', ' ').split()
+            op = words[0]
+            args = words[1:]
+            if op == 'jmp' and len(args) == 2 and args[0] not in JMP_CONDITIONS:
+                raise AsmError("bad jmp condition '%s'" % args[0])
+            instr = encode(op, args, labels)
+
+            field = delay
+            if side is not None:
+                field |= side << delay_bits
+                if side_opt:
+                    field |= 1 << 4
+            code.append((instr | (field << 8), line))
+        except (AsmError, KeyError, IndexError) as e:
+            raise AsmError("line %d: %s" % (number_, e))
+
+    return name, code, labels, public, wrap_target, wrap, side_field, side_opt
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage: pioasm.py <program.pio> <header.h>", file=sys.stderr)
+        sys.exit(1)
+    with open(sys.argv[1]) as f:
+        lines = f.readlines()
+    try:
+        name, code, labels, public, wrap_target, wrap, side_field, side_opt = assemble(lines)
+    except AsmError as e:
+        print("%s: %s" % (sys.argv[1], e), file=sys.stderr)
+        sys.exit(1)
+
+    out = []
+    out.append("// %s, made by test/pioasm.py" % sys.argv[1].split('/')[-1])
+    out.append("#pragma once")
+    out.append("")
+    out.append('#include "hardware/pio.h"')
+    out.append("")
+    out.append("#define %s_wrap_target %d" % (name, wrap_target))
+    out.append("#define %s_wrap %d" % (name, wrap))
+    out.append("")
+    for label in public:
+        out.append("#define %s_offset_%s %du" % (name, label, labels[label]))
+    out.append("")
+    out.append("static const uint16_t %s_program_instructions[] = {" % name)
+    for i, (instr, text) in enumerate(code):
+        out.append("    0x%04x, // %2d: %s" % (instr, i, text))
+    out.append("};")
+    out.append("")
+    out.append("static const struct pio_program %s_program = {" % name)
+    out.append("    .instructions = %s_program_instructions," % name)
+    out.append("    .length = %d," % len(code))
+    out.append("    .origin = -1,")
+    out.append("};")
+    out.append("")
+    out.append("static inline pio_sm_config %s_program_get_default_config(uint offset) {" % name)
+    out.append("    pio_sm_config c = pio_get_default_sm_config();")
+    out.append("    sm_config_set_wrap(&c, offset + %s_wrap_target, offset + %s_wrap);" % (name, name))
+    if side_field:
+        out.append("    sm_config_set_sideset(&c, %d, %s, false);" % (side_field, 'true' if side_opt else 'false'))
+    out.append("    return c;")
+    out.append("}")
+
+    with open(sys.argv[2], 'w') as f:
+        f.write("\n".join(out) + "\n")
+
+if __name__ == '__main__':
+    main()
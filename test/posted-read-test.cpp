@@ -0,0 +1,188 @@
+/**
+ * Pipelined AP reads against the model DP, which posts AP reads the way
+ * ADIv5 says: each DRW read's data phase carries the previous AP read's
+ * result, and RDBUFF the last one.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <vector>
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+#include "SWDProtocol.h"
+#include "Bench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t RAM_BASE = Bench::RAM_BASE;
+static const uint32_t RAM_SIZE = 0x1000;
+
+static const uint8_t ACK_OK = 0b001;
+static const uint8_t ACK_WAIT = 0b010;
+static const uint8_t ACK_FAULT = 0b100;
+
+// SwdTarget::Transfer addresses
+static const uint32_t DP_CTRL_STAT = 0x4;
+static const uint32_t DP_RDBUFF = 0xc;
+static const uint32_t AP_DRW = 0x0c;
+
+static const uint32_t CSW_WORD_INC = 0x23000012;
+
+static bool isDrwRead(const SwdTarget::Transfer& t) {
+    return t.ap && t.read && t.addr == AP_DRW;
+}
+
+static bool isRdbuffRead(const SwdTarget::Transfer& t) {
+    return !t.ap && t.read && t.addr == DP_RDBUFF;
+}
+
+static void fill(Bench& b) {
+    for (uint32_t a = 0; a < RAM_SIZE; a += 4)
+        b.ram.at(RAM_BASE + a) = 0xa0000000 | a;
+}
+
+static void oneRdbuffPerBurst() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    b.settle();
+    fill(b);
+    std::vector<SwdTarget::Transfer> log;
+    b.swdTarget.setLog(&log);
+    b.swdTarget.resetStats();
+
+    uint32_t data[8] = { };
+    CHECK_EQ(b.swd.readBlockViaAP(RAM_BASE + 0x40, data, 8), 0);
+    for (unsigned i = 0; i < 8; i++)
+        CHECK_EQ(data[i], 0xa0000040 + i * 4);
+
+    // The eight DRW reads go back to back and each one's data phase has
+    // the word before it. One RDBUFF read collects the last word.
+    std::vector<SwdTarget::Transfer> reads;
+    for (const auto& t : log)
+        if (t.read)
+            reads.push_back(t);
+    CHECK_EQ(reads.size(), 9);
+    for (unsigned i = 1; i < 8; i++) {
+        CHECK(isDrwRead(reads[i]));
+        CHECK_EQ(reads[i].data, 0xa0000040 + (i - 1) * 4);
+    }
+    CHECK(isRdbuffRead(reads[8]));
+    CHECK_EQ(reads[8].data, 0xa0000040 + 7 * 4);
+    CHECK_EQ(b.swdTarget.getStats().rdbuffReads, 1);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+static void dpAccessEndsTheRun() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    fill(b);
+    CHECK_EQ(b.swd.write<swd::APReg<swd::CSW>>(CSW_WORD_INC), 0);
+    CHECK_EQ(b.swd.write<swd::APReg<swd::TAR>>(RAM_BASE), 0);
+    b.settle();
+    std::vector<SwdTarget::Transfer> log;
+    b.swdTarget.setLog(&log);
+    b.swdTarget.resetStats();
+
+    // The SELECT writes that go with each AP read are dropped by the
+    // shadow, so they don't break the run. The CTRL/STAT read does.
+    uint32_t d[4] = { }, stat = 0;
+    b.swd.queueReadAP(PioSWDDriver::AP_DRW, &d[0]);
+    b.swd.queueReadAP(PioSWDDriver::AP_DRW, &d[1]);
+    b.swd.queueReadDP(PioSWDDriver::DP_CTRL_STAT, &stat);
+    b.swd.queueReadAP(PioSWDDriver::AP_DRW, &d[2]);
+    b.swd.queueReadAP(PioSWDDriver::AP_DRW, &d[3]);
+    CHECK_EQ(b.swd.flush(), 0);
+    b.settle();
+
+    for (unsigned i = 0; i < 4; i++)
+        CHECK_EQ(d[i], 0xa0000000 + i * 4);
+    CHECK_EQ(stat, 0xf0000000);
+
+    CHECK_EQ(log.size(), 7);
+    if (log.size() == 7) {
+        CHECK(isDrwRead(log[0]));
+        CHECK(isDrwRead(log[1]));
+        CHECK(isRdbuffRead(log[2]));
+        CHECK(!log[3].ap && log[3].read && log[3].addr == DP_CTRL_STAT);
+        CHECK(isDrwRead(log[4]));
+        CHECK(isDrwRead(log[5]));
+        CHECK(isRdbuffRead(log[6]));
+    }
+}
+
+static void waitsInTheBurst() {
+
+    // WAITs on a DRW read in the middle of the burst and on the RDBUFF
+    // read at the end. The retried read mustn't lose or repeat a word.
+    const unsigned afters[] = { 3, 8 };
+    for (unsigned after : afters) {
+        Bench b;
+        CHECK_EQ(b.swd.connect(), 0);
+        b.settle();
+        fill(b);
+        std::vector<SwdTarget::Transfer> log;
+        b.swdTarget.setLog(&log);
+        b.swdTarget.resetStats();
+
+        // After the TAR write, so the count is in DRW reads
+        b.swdTarget.injectWaits(2, after + 1);
+        uint32_t data[8] = { };
+        CHECK_EQ(b.swd.readBlockViaAP(RAM_BASE + 0x100, data, 8), 0);
+        for (unsigned i = 0; i < 8; i++)
+            CHECK_EQ(data[i], 0xa0000100 + i * 4);
+        CHECK_EQ(b.swdTarget.getStats().waits, 2);
+        CHECK_EQ(b.swd.getCounters().waits, 2);
+
+        unsigned waited = 0;
+        for (const auto& t : log)
+            if (t.ack == ACK_WAIT)
+                waited++;
+        CHECK_EQ(waited, 2);
+    }
+}
+
+static void faultInTheBurst() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    b.settle();
+    fill(b);
+    std::vector<SwdTarget::Transfer> log;
+    b.swdTarget.setLog(&log);
+    b.swdTarget.resetStats();
+
+    // The end of RAM is on a 1K boundary, so the TAR re-arm there ends the
+    // first run with an RDBUFF read. The third read then runs off the end
+    // of RAM and the fourth gets FAULT.
+    uint32_t data[4] = { 1, 2, 3, 4 };
+    CHECK_EQ(b.swd.readBlockViaAP(RAM_BASE + RAM_SIZE - 8, data, 4), PioSWDDriver::ERR_FAULT);
+    CHECK_EQ(data[0], 0xa0000000 + RAM_SIZE - 8);
+    CHECK_EQ(data[1], 0xa0000000 + RAM_SIZE - 4);
+    CHECK_EQ(data[2], 3);
+    CHECK_EQ(data[3], 4);
+
+    unsigned faults = 0;
+    for (const auto& t : log)
+        if (t.ack == ACK_FAULT)
+            faults++;
+    CHECK_EQ(faults, 1);
+    CHECK_EQ(b.swdTarget.getStats().rdbuffReads, 1);
+
+    // The sticky flag was cleared on the way out
+    b.settle();
+    CHECK_EQ(b.swdTarget.getCtrlStat() & 0x20, 0);
+    CHECK_EQ(b.swd.readWordViaAP(RAM_BASE).value_or(0), 0xa0000000);
+}
+
+int main(int, const char**) {
+    oneRdbuffPerBurst();
+    dpAccessEndsTheRun();
+    waitsInTheBurst();
+    faultInTheBurst();
+    return check::result();
+}
@@ -0,0 +1,206 @@
+/**
+ * The deferred transaction queue against the model DAP: nothing goes out
+ * before flush(), results land where the caller said, the first failure
+ * stops the batch, a full queue flushes itself and holds on to any error,
+ * and the shadow registers drop the writes that change nothing.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <vector>
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+#include "Bench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t RAM_BASE = Bench::RAM_BASE;
+// Past the end of the model RAM, so a bus error
+static const uint32_t BAD_ADDR = RAM_BASE + 0x10000;
+
+static const uint8_t ACK_OK = 0b001;
+static const uint8_t ACK_FAULT = 0b100;
+
+// SwdTarget::Transfer addresses
+static const uint32_t DP_ABORT = 0x0;
+static const uint32_t AP_CSW = 0x00;
+static const uint32_t AP_TAR = 0x04;
+static const uint32_t AP_DRW = 0x0c;
+
+static unsigned count(const std::vector<SwdTarget::Transfer>& log, bool ap, bool read, uint32_t addr) {
+    unsigned n = 0;
+    for (const auto& t : log)
+        if (t.ap == ap && t.read == read && t.addr == addr)
+            n++;
+    return n;
+}
+
+static void nothingBeforeFlush() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    b.settle();
+
+    for (unsigned i = 0; i < 3; i++)
+        b.ram.at(RAM_BASE + i * 4) = 0x1000 + i;
+
+    uint32_t results[3] = { 0xdeadbeef, 0xdeadbeef, 0xdeadbeef };
+    const uint64_t edges = PioModel::get().getRisingEdges();
+    for (unsigned i = 0; i < 3; i++)
+        b.swd.queueReadWordViaAP(RAM_BASE + i * 4, &results[i]);
+    b.swd.queueWriteWordViaAP(RAM_BASE + 0x10, 0xa5a5a5a5);
+    PioModel::get().drain();
+
+    CHECK_EQ(PioModel::get().getRisingEdges(), edges);
+    CHECK_EQ(results[0], 0xdeadbeef);
+    CHECK_EQ(b.word(RAM_BASE + 0x10), 0);
+
+    CHECK_EQ(b.swd.flush(), 0);
+    for (unsigned i = 0; i < 3; i++)
+        CHECK_EQ(results[i], 0x1000 + i);
+    CHECK_EQ(b.word(RAM_BASE + 0x10), 0xa5a5a5a5);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+static void firstFailureStops() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    b.settle();
+    std::vector<SwdTarget::Transfer> log;
+    b.swdTarget.setLog(&log);
+
+    // The bus error leaves STICKYERR set, so the next AP access FAULTs
+    uint32_t result = 0xdeadbeef;
+    b.swd.queueWriteWordViaAP(RAM_BASE, 1);
+    b.swd.queueWriteWordViaAP(BAD_ADDR, 2);
+    b.swd.queueWriteWordViaAP(RAM_BASE + 4, 3);
+    b.swd.queueReadWordViaAP(RAM_BASE, &result);
+    b.swd.queueWriteWordViaAP(RAM_BASE + 8, 4);
+    CHECK_EQ(b.swd.flush(), PioSWDDriver::ERR_FAULT);
+
+    CHECK_EQ(b.word(RAM_BASE), 1);
+    CHECK_EQ(b.word(RAM_BASE + 4), 0);
+    CHECK_EQ(b.word(RAM_BASE + 8), 0);
+    CHECK_EQ(result, 0xdeadbeef);
+    b.settle();
+
+    // The FAULT is followed by the ABORT that clears it, and nothing else
+    CHECK(log.size() >= 2);
+    const auto& fault = log[log.size() - 2];
+    CHECK(fault.ap && !fault.read && fault.addr == AP_TAR && fault.ack == ACK_FAULT);
+    const auto& abort = log.back();
+    CHECK(!abort.ap && !abort.read && abort.addr == DP_ABORT && abort.ack == ACK_OK);
+    CHECK_EQ(count(log, true, true, AP_DRW), 0);
+
+    // The shadows were dropped, so the next access sets CSW up again
+    log.clear();
+    CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE + 8, 4), 0);
+    CHECK_EQ(b.word(RAM_BASE + 8), 4);
+    CHECK_EQ(count(log, true, false, AP_CSW), 1);
+}
+
+static void implicitFlush() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+
+    // Each single-word write queues SELECT, CSW, TAR and DRW writes (the
+    // shadows drop the first two at flush time). The first QUEUE_SIZE 
+    // go out when the next one is queued.
+    const unsigned words = PioSWDDriver::QUEUE_SIZE / 4 + 1;
+    for (unsigned i = 0; i < words; i++)
+        b.swd.queueWriteWordViaAP(RAM_BASE + i * 4, 0x100 + i);
+    CHECK_EQ(b.word(RAM_BASE + (words - 2) * 4), 0x100 + words - 2);
+    CHECK_EQ(b.word(RAM_BASE + (words - 1) * 4), 0);
+    CHECK_EQ(b.swd.flush(), 0);
+    CHECK_EQ(b.word(RAM_BASE + (words - 1) * 4), 0x100 + words - 1);
+}
+
+static void implicitFlushHoldsError() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    b.settle();
+    std::vector<SwdTarget::Transfer> log;
+    b.swdTarget.setLog(&log);
+
+    b.swd.queueWriteWordViaAP(BAD_ADDR, 0);
+    const unsigned words = PioSWDDriver::QUEUE_SIZE / 4 + 4;
+    for (unsigned i = 1; i < words; i++)
+        b.swd.queueWriteWordViaAP(RAM_BASE + i * 4, 0x100 + i);
+
+    // The implicit flush failed on the first write after the bus error
+    // and everything queued since has been dropped
+    b.settle();
+    const size_t sent = log.size();
+    CHECK(sent > 0 && log[sent - 2].ack == ACK_FAULT);
+    CHECK_EQ(b.swd.flush(), PioSWDDriver::ERR_FAULT);
+    CHECK_EQ(log.size(), sent);
+    for (unsigned i = 1; i < words; i++)
+        CHECK_EQ(b.word(RAM_BASE + i * 4), 0);
+
+    // The error is only reported once
+    CHECK_EQ(b.swd.flush(), 0);
+    CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE + 4, 1), 0);
+    CHECK_EQ(b.word(RAM_BASE + 4), 1);
+
+    // A lost packet in an implicit flush is recovered from there, and 
+    // not again when the held error comes out
+    const uint32_t resets = b.swdTarget.getStats().lineResets;
+    b.swdTarget.injectNoAcks(1);
+    uint32_t data[PioSWDDriver::QUEUE_SIZE];
+    CHECK_EQ(b.swd.readBlockViaAP(RAM_BASE, data, PioSWDDriver::QUEUE_SIZE), 
+        PioSWDDriver::ERR_PROTOCOL);
+    b.settle();
+    CHECK_EQ(b.swdTarget.getStats().lineResets, resets + 1);
+    CHECK_EQ(b.swd.readWordViaAP(RAM_BASE + 4).value_or(0), 1);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+static void shadowSkipping() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    b.settle();
+    std::vector<SwdTarget::Transfer> log;
+    b.swdTarget.setLog(&log);
+
+    // CSW is set by connect(), TAR by the first read. Without
+    // auto-increment TAR stays put.
+    b.ram.at(RAM_BASE + 0x20) = 77;
+    CHECK_EQ(b.swd.readWordViaAP(RAM_BASE + 0x20).value_or(0), 77);
+    CHECK_EQ(b.swd.readWordViaAP(RAM_BASE + 0x20).value_or(0), 77);
+    CHECK_EQ(count(log, true, false, AP_CSW), 0);
+    CHECK_EQ(count(log, true, false, AP_TAR), 1);
+    CHECK_EQ(count(log, true, true, AP_DRW), 2);
+    CHECK_EQ(b.swd.getCounters().skippedCsw, 2);
+    CHECK_EQ(b.swd.getCounters().skippedTar, 1);
+
+    // The AP bank for IDR only needs selecting once
+    const uint32_t selects = b.swd.getCounters().skippedSelect;
+    CHECK_EQ(b.swd.readAP(PioSWDDriver::AP_IDR).value_or(0), SwdTarget::RP2040_CORE0.apIdr);
+    CHECK_EQ(b.swd.readAP(PioSWDDriver::AP_IDR).value_or(0), SwdTarget::RP2040_CORE0.apIdr);
+    CHECK_EQ(b.swd.getCounters().skippedSelect, selects + 1);
+
+    // A line reset (here, through a lost packet) forgets all of them
+    b.swdTarget.injectNoAcks(1);
+    CHECK(!b.swd.readWordViaAP(RAM_BASE + 0x20).has_value());
+    log.clear();
+    CHECK_EQ(b.swd.readWordViaAP(RAM_BASE + 0x20).value_or(0), 77);
+    CHECK_EQ(count(log, true, false, AP_CSW), 1);
+    CHECK_EQ(count(log, true, false, AP_TAR), 1);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+int main(int, const char**) {
+    nothingBeforeFlush();
+    firstFailureStops();
+    implicitFlush();
+    implicitFlushHoldsError();
+    shadowSkipping();
+    return check::result();
+}
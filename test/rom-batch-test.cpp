@@ -0,0 +1,103 @@
+/**
+ * RomCallBatch and caller-batch.s against the model chip: a batch of
+ * ROM calls made in one resume, each with its own result, and a batch
+ * that stops at the first call that fails.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+
+#include "RomTable.h"
+#include "RomCallBatch.h"
+#include "SystemBench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+// Where prog-2 puts them
+static const uint32_t BATCH_ADDR = 0x20040900;
+static const uint32_t STACK_TOP = 0x20041000;
+
+static uint32_t lookup(SystemBench& b, char c1, char c2) {
+    const auto func = RomTable::lookup(b.swd, c1, c2);
+    CHECK(func.has_value());
+    return func.value_or(0);
+}
+
+static void eachResult() {
+
+    SystemBench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    const uint32_t reverse32 = lookup(b, 'R', '3');
+    const uint32_t popcount32 = lookup(b, 'P', '3');
+    const uint32_t clz32 = lookup(b, 'L', '3');
+    const uint32_t ctz32 = lookup(b, 'T', '3');
+
+    RomCallBatch batch(BATCH_ADDR, STACK_TOP);
+    const struct {
+        uint32_t func;
+        uint32_t arg;
+        uint32_t result;
+    } calls[] = {
+        { reverse32, 0x00f0f000, 0x000f0f00 },
+        { popcount32, 0x00f0f000, 8 },
+        { clz32, 0x00f0f000, 8 },
+        { ctz32, 0x00f0f000, 12 },
+        { popcount32, 0xffffffff, 32 },
+        { clz32, 0, 32 }
+    };
+    for (const auto& c : calls)
+        CHECK(batch.add(c.func, c.arg));
+    CHECK_EQ(batch.run(b.swd), 0);
+
+    CHECK_EQ(batch.made(), batch.size());
+    for (unsigned i = 0; i < batch.size(); i++)
+        CHECK_EQ(batch.result(i), calls[i].result);
+    CHECK_EQ(b.system.getStats().calls, batch.size());
+    CHECK(b.system.isHalted());
+    CHECK(b.system.getErrors().empty());
+
+    // The same object again, with a different batch
+    batch.clear();
+    CHECK(batch.add(ctz32, 0x80000000));
+    CHECK_EQ(batch.run(b.swd), 0);
+    CHECK_EQ(batch.result(0), 31);
+    CHECK(b.system.getErrors().empty());
+}
+
+static void stopOnFailure() {
+
+    // reverse32(1) has the top bit set, so it reads as a failure
+    for (bool stop : { false, true }) {
+        SystemBench b;
+        CHECK_EQ(b.swd.connect(), 0);
+        RomCallBatch batch(BATCH_ADDR, STACK_TOP);
+        batch.setStopOnFailure(stop);
+        batch.add(lookup(b, 'P', '3'), 0xff);
+        batch.add(lookup(b, 'R', '3'), 1);
+        batch.add(lookup(b, 'T', '3'), 0x10);
+        CHECK_EQ(batch.run(b.swd), 0);
+
+        CHECK_EQ(batch.result(0), 8);
+        CHECK_EQ(batch.result(1), 0x80000000);
+        if (stop) {
+            CHECK_EQ(batch.made(), 2);
+            CHECK_EQ(b.system.getStats().calls, 2);
+            // Never made, so still what went over
+            CHECK_EQ(batch.result(2), 0);
+        }
+        else {
+            CHECK_EQ(batch.made(), 3);
+            CHECK_EQ(b.system.getStats().calls, 3);
+            CHECK_EQ(batch.result(2), 4);
+        }
+        CHECK(b.system.isHalted());
+        CHECK(b.system.getErrors().empty());
+    }
+}
+
+int main(int, const char**) {
+    eachResult();
+    stopOnFailure();
+    return check::result();
+}
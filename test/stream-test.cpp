@@ -0,0 +1,139 @@
+/**
+ * Streamed block writes (ORUNDETECT, no ACKs looked at) against the
+ * model DAP when something goes wrong part way: a WAIT or a bus fault in
+ * the middle of a chunk has that chunk replayed from its start and the
+ * target RAM ends up right, and a chunk that keeps failing gives up
+ * with overrun detection turned off again.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <vector>
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+#include "Bench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t RAM_BASE = Bench::RAM_BASE;
+static const uint32_t RAM_SIZE = 0x1000;
+
+// Three chunks: up to the first 1K boundary, and two whole ones
+static const uint32_t BLOCK_ADDR = RAM_BASE + 0x300;
+static const unsigned WORDS = 0x900 / 4;
+static const uint32_t CHUNK_ADDRS[] = { BLOCK_ADDR, RAM_BASE + 0x400, RAM_BASE + 0x800 };
+// Past the first chunk's AP accesses and well inside the second's
+static const unsigned FAIL_AFTER = 200;
+
+static const uint32_t CTRL_STAT_ORUNDETECT = 0x00000001;
+static const uint32_t CTRL_STAT_STICKY = 0x000000b2;
+
+// SwdTarget::Transfer addresses
+static const uint32_t AP_TAR = 0x04;
+static const uint32_t AP_DRW = 0x0c;
+
+static std::vector<uint32_t> pattern() {
+    std::vector<uint32_t> data(WORDS);
+    for (unsigned i = 0; i < WORDS; i++)
+        data[i] = 0x5a000000 + i * 0x10101;
+    return data;
+}
+
+/**
+ * @returns How many times TAR was pointed at the address.
+ */
+static unsigned tarWrites(const std::vector<SwdTarget::Transfer>& log, uint32_t addr) {
+    unsigned n = 0;
+    for (const auto& t : log)
+        if (t.ap && !t.read && t.addr == AP_TAR && t.data == addr && t.ack == 1)
+            n++;
+    return n;
+}
+
+static unsigned drwWrites(const std::vector<SwdTarget::Transfer>& log) {
+    unsigned n = 0;
+    for (const auto& t : log)
+        if (t.ap && !t.read && t.addr == AP_DRW && t.ack == 1)
+            n++;
+    return n;
+}
+
+static bool ramHolds(Bench& b, const std::vector<uint32_t>& data) {
+    for (unsigned i = 0; i < WORDS; i++)
+        if (b.word(BLOCK_ADDR + i * 4) != data[i])
+            return false;
+    return true;
+}
+
+/**
+ * Streams the pattern over RAM that holds something else, with the
+ * failure set up by the caller.
+ */
+template<typename Inject> static void replayed(Inject inject) {
+
+    Bench b(SwdTarget::RP2040_CORE0, RAM_SIZE);
+    CHECK_EQ(b.swd.connect(), 0);
+    for (uint32_t a = RAM_BASE; a < RAM_BASE + RAM_SIZE; a += 4)
+        b.ram.at(a) = 0xdeadbeef;
+    std::vector<SwdTarget::Transfer> log;
+    b.swdTarget.setLog(&log);
+    b.swd.setStreamingWrites(true);
+
+    inject(b.swdTarget);
+    const auto data = pattern();
+    CHECK_EQ(b.swd.writeBlockViaAP(BLOCK_ADDR, data.data(), WORDS), 0);
+    b.settle();
+
+    CHECK(ramHolds(b, data));
+    CHECK_EQ(b.ram.at(BLOCK_ADDR - 4), 0xdeadbeef);
+    CHECK_EQ(b.ram.at(BLOCK_ADDR + WORDS * 4), 0xdeadbeef);
+    CHECK_EQ(b.swd.getCounters().overruns, 1);
+
+    // The second chunk went again from its start, and only it
+    CHECK_EQ(tarWrites(log, CHUNK_ADDRS[0]), 1);
+    CHECK_EQ(tarWrites(log, CHUNK_ADDRS[1]), 2);
+    CHECK_EQ(tarWrites(log, CHUNK_ADDRS[2]), 1);
+    // Every word once, and the words of the second chunk that got in
+    // before the failure a second time
+    const unsigned writes = drwWrites(log);
+    CHECK(writes > WORDS && writes < WORDS + 256);
+
+    CHECK_EQ(b.swdTarget.getCtrlStat() & (CTRL_STAT_ORUNDETECT | CTRL_STAT_STICKY), 0);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+static void keepsFailing() {
+
+    Bench b(SwdTarget::RP2040_CORE0, RAM_SIZE);
+    CHECK_EQ(b.swd.connect(), 0);
+    b.swd.setStreamingWrites(true);
+
+    // Every AP access from the second chunk on stalls
+    b.swdTarget.injectWaits(100000, FAIL_AFTER);
+    const auto data = pattern();
+    CHECK(b.swd.writeBlockViaAP(BLOCK_ADDR, data.data(), WORDS) != 0);
+    b.settle();
+    // The first try and three replays
+    CHECK_EQ(b.swd.getCounters().overruns, 4);
+    CHECK_EQ(b.swdTarget.getCtrlStat() & (CTRL_STAT_ORUNDETECT | CTRL_STAT_STICKY), 0);
+
+    // The first chunk is in, and the DAP works once the stall is over
+    for (unsigned i = 0; i < (CHUNK_ADDRS[1] - BLOCK_ADDR) / 4; i++)
+        CHECK_EQ(b.ram.at(BLOCK_ADDR + i * 4), data[i]);
+    b.swdTarget.injectWaits(0);
+    CHECK_EQ(b.swd.writeBlockViaAP(BLOCK_ADDR, data.data(), WORDS), 0);
+    CHECK(ramHolds(b, data));
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+int main(int, const char**) {
+    // An overrun: one WAIT, which ORUNDETECT makes sticky
+    replayed([](SwdTarget& t) { t.injectWaits(1, FAIL_AFTER); });
+    // And a write that fails on the bus
+    replayed([](SwdTarget& t) { t.injectFault(FAIL_AFTER); });
+    keepsFailing();
+    return check::result();
+}
@@ -0,0 +1,18 @@
+/**
+ * Host stand-in for the Pico SDK header of the same name.
+ */
+#pragma once
+
+#include "pico/types.h"
+
+enum clock_index { clk_sys };
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,22 @@
+/**
+ * Host stand-in for the Pico SDK header of the same name. The 
+ * programmer's own flash is a host mapping at XIP_BASE so that code 
+ * reading it through a pointer works unchanged.
+ */
+#pragma once
+
+#include "pico/types.h"
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,23 @@
+/**
+ * Host stand-in for the Pico SDK header of the same name. The pins do
+ * nothing, the SWD pins are modelled by the PIO model.
+ */
+#pragma once
+
+#include "pico/types.h"
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+void gpio_pull_up(uint gpio);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,68 @@
+/**
+ * Host stand-in for the Pico SDK header of the same name. The calls go
+ * to the PIO model (test/PioModel.h), which runs the assembled program.
+ */
+#pragma once
+
+#include "pico/types.h"
+#include "hardware/regs/addressmap.h"
+
+typedef struct pio_hw_t pio_hw_t;
+typedef pio_hw_t* PIO;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern pio_hw_t* const pio0_hw;
+#define pio0 pio0_hw
+
+typedef struct {
+    float clkdiv;
+    uint wrap_target;
+    uint wrap;
+    // Including the enable bit when optional
+    uint sideset_bit_count;
+    bool sideset_optional;
+    bool sideset_pindirs;
+    uint sideset_base;
+    uint out_base;
+    uint out_count;
+    uint in_base;
+    bool out_shift_right;
+    bool autopull;
+    uint pull_threshold;
+    bool in_shift_right;
+    bool autopush;
+    uint push_threshold;
+} pio_sm_config;
+
+typedef struct pio_program {
+    const uint16_t* instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_wrap(pio_sm_config* c, uint wrap_target, uint wrap);
+void sm_config_set_sideset(pio_sm_config* c, uint bit_count, bool optional, bool pindirs);
+void sm_config_set_sideset_pins(pio_sm_config* c, uint sideset_base);
+void sm_config_set_out_pins(pio_sm_config* c, uint out_base, uint out_count);
+void sm_config_set_in_pins(pio_sm_config* c, uint in_base);
+void sm_config_set_out_shift(pio_sm_config* c, bool shift_right, bool autopull, uint pull_threshold);
+void sm_config_set_in_shift(pio_sm_config* c, bool shift_right, bool autopush, uint push_threshold);
+void sm_config_set_clkdiv(pio_sm_config* c, float div);
+
+uint pio_add_program(PIO pio, const pio_program_t* program);
+void pio_gpio_init(PIO pio, uint pin);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask);
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config* config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+
+#ifdef __cplusplus
+}
+#endif
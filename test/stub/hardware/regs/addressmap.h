@@ -0,0 +1,44 @@
+/**
+ * Host stand-in for the Pico SDK (RP2040) header of the same name, with
+ * the same macros, so that a clash with one of them shows up here too.
+ */
+#pragma once
+#define _u(x) x##u
+#define XIP_BASE _u(0x10000000)
+#define DMA_BASE _u(0x50000000)
+#define SYSINFO_BASE _u(0x40000000)
+#define RESETS_BASE _u(0x4000c000)
+#define ROM_BASE _u(0x00000000)
+#define SRAM_BASE _u(0x20000000)
+#define XIP_NOCACHE_BASE _u(0x11000000)
+#define XIP_NOALLOC_BASE _u(0x12000000)
+#define XIP_NOCACHE_NOALLOC_BASE _u(0x13000000)
+#define XIP_CTRL_BASE _u(0x14000000)
+#define XIP_SSI_BASE _u(0x18000000)
+#define SRAM_STRIPED_BASE _u(0x20000000)
+#define SRAM4_BASE _u(0x20040000)
+#define SRAM5_BASE _u(0x20041000)
+#define SRAM_END _u(0x20042000)
+#define SYSCFG_BASE _u(0x40004000)
+#define CLOCKS_BASE _u(0x40008000)
+#define PSM_BASE _u(0x40010000)
+#define IO_BANK0_BASE _u(0x40014000)
+#define PADS_BANK0_BASE _u(0x4001c000)
+#define XOSC_BASE _u(0x40024000)
+#define PLL_SYS_BASE _u(0x40028000)
+#define BUSCTRL_BASE _u(0x40030000)
+#define UART0_BASE _u(0x40034000)
+#define SPI0_BASE _u(0x4003c000)
+#define I2C0_BASE _u(0x40044000)
+#define ADC_BASE _u(0x4004c000)
+#define PWM_BASE _u(0x40050000)
+#define TIMER_BASE _u(0x40054000)
+#define WATCHDOG_BASE _u(0x40058000)
+#define RTC_BASE _u(0x4005c000)
+#define ROSC_BASE _u(0x40060000)
+#define TBMAN_BASE _u(0x4006c000)
+#define USBCTRL_BASE _u(0x50100000)
+#define PIO0_BASE _u(0x50200000)
+#define PIO1_BASE _u(0x50300000)
+#define SIO_BASE _u(0xd0000000)
+#define PPB_BASE _u(0xe0000000)
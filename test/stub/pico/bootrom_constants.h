@@ -0,0 +1,8 @@
+/**
+ * Host stand-in for the Pico SDK header of the same name.
+ */
+#pragma once
+
+#define BOOTROM_STATE_RESET_CURRENT_CORE 0x01
+#define BOOTROM_STATE_RESET_OTHER_CORE 0x02
+#define BOOTROM_STATE_RESET_GLOBAL_STATE 0x04
@@ -0,0 +1,19 @@
+/**
+ * Host stand-in for the Pico SDK header of the same name.
+ */
+#pragma once
+
+#include "pico/types.h"
+
+#define PICO_ERROR_NOT_PERMITTED -4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms);
+bool flash_safe_execute_core_init(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,28 @@
+/**
+ * Host stand-in for the Pico SDK header of the same name. Time is the
+ * simulated time of the PIO model (see SimClock.h), so timeouts and 
+ * throughput come out as they would on the wire.
+ */
+#pragma once
+
+#include <stdio.h>
+
+#include "pico/types.h"
+#include "hardware/regs/addressmap.h"
+#include "pico/bootrom_constants.h"
+#include "hardware/gpio.h"
+
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,11 @@
+/**
+ * Host stand-in for the Pico SDK header of the same name. The stand-ins
+ * only have what the sources under test use.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
@@ -0,0 +1,120 @@
+/**
+ * The host side of the Pico SDK stand-ins: simulated time, the pins and
+ * the programmer's own flash. The PIO calls are in PioModel.cpp.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+
+#include "PioModel.h"
+#include "SimClock.h"
+
+using kc1fsz::PioModel;
+
+namespace kc1fsz::sim {
+
+static double now = 0;
+
+double nowNs() {
+    return now;
+}
+
+void advanceNs(double ns) {
+    now += ns;
+}
+
+}
+
+// The flash is mapped where the code under test expects to find it,
+// erased, before anything runs
+static uint8_t* ownFlash() {
+    static uint8_t* flash = nullptr;
+    if (flash == nullptr) {
+        void* p = mmap((void*)XIP_BASE, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (p != (void*)XIP_BASE) {
+            fprintf(stderr, "can't map the flash at %08x\n", XIP_BASE);
+            abort();
+        }
+        flash = (uint8_t*)p;
+        memset(flash, 0xff, PICO_FLASH_SIZE_BYTES);
+    }
+    return flash;
+}
+
+[[maybe_unused]] static const bool flashMapped = ownFlash() != nullptr;
+
+static void checkFlashRange(uint32_t offs, size_t count, uint32_t align) {
+    if (offs % align != 0 || count % align != 0 || offs + count > PICO_FLASH_SIZE_BYTES) {
+        fprintf(stderr, "bad flash range %08x+%zx\n", offs, count);
+        abort();
+    }
+}
+
+extern "C" {
+
+uint64_t time_us_64(void) {
+    return (uint64_t)(kc1fsz::sim::nowNs() / 1000.0);
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+void sleep_us(uint64_t us) {
+    // The state machine keeps going (or sits waiting for a command)
+    // while the CPU sleeps
+    const double end = kc1fsz::sim::nowNs() + us * 1000.0;
+    PioModel::get().runUntil(end);
+    if (kc1fsz::sim::nowNs() < end)
+        kc1fsz::sim::advanceNs(end - kc1fsz::sim::nowNs());
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_us((uint64_t)ms * 1000);
+}
+
+void gpio_init(uint) {
+}
+
+void gpio_set_dir(uint, bool) {
+}
+
+void gpio_put(uint, bool) {
+}
+
+void gpio_pull_up(uint gpio) {
+    PioModel::get().pullUp(gpio);
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    checkFlashRange(flash_offs, count, FLASH_SECTOR_SIZE);
+    memset(ownFlash() + flash_offs, 0xff, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count) {
+    checkFlashRange(flash_offs, count, FLASH_PAGE_SIZE);
+    // Programming can only clear bits
+    uint8_t* flash = ownFlash() + flash_offs;
+    for (size_t i = 0; i < count; i++)
+        flash[i] &= data[i];
+}
+
+int flash_safe_execute(void (*func)(void*), void* param, uint32_t) {
+    // There is no other core or interrupt to keep out of the way
+    func(param);
+    return 0;
+}
+
+bool flash_safe_execute_core_init(void) {
+    return true;
+}
+
+}
@@ -0,0 +1,156 @@
+/**
+ * WAIT handling against the model DAP: the WaitPolicy's retry count,
+ * its delay and the doubling of it, and the statistics kept for each
+ * call site through a WaitScope.
+ *
+ * Copyright (C) Bruce MacKinnon, 2025
+ */
+#include <cstdio>
+
+#include "PioSWDDriver.h"
+#include "PioModel.h"
+#include "SwdTarget.h"
+#include "Bench.h"
+#include "Check.h"
+
+using namespace kc1fsz;
+
+static const uint32_t RAM_BASE = Bench::RAM_BASE;
+
+static void retryCount() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE, 0x1234), 0);
+
+    PioSWDDriver::WaitPolicy policy;
+    policy.maxRetries = 5;
+    PioSWDDriver::WaitStats stats;
+    PioSWDDriver::WaitScope scope(b.swd, stats, policy);
+
+    // The first try and five retries, the last of which gets through
+    b.swdTarget.injectWaits(5);
+    CHECK_EQ(b.swd.readWordViaAP(RAM_BASE).value_or(0), 0x1234);
+    CHECK_EQ(stats.stalled, 1);
+    CHECK_EQ(stats.waits, 5);
+    CHECK_EQ(stats.exhausted, 0);
+
+    // One more is too many
+    b.swdTarget.injectWaits(6);
+    CHECK(!b.swd.readWordViaAP(RAM_BASE).has_value());
+    CHECK_EQ(stats.stalled, 2);
+    CHECK_EQ(stats.waits, 11);
+    CHECK_EQ(stats.exhausted, 1);
+    CHECK_EQ(b.swdTarget.getStats().waits, 11);
+
+    // And nothing is left over
+    CHECK_EQ(b.swd.readWordViaAP(RAM_BASE).value_or(0), 0x1234);
+    CHECK_EQ(stats.stalled, 2);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+/**
+ * @returns The time spent stalled on a transfer that gets n WAITs under
+ *   the policy.
+ */
+static uint32_t stallUs(const PioSWDDriver::WaitPolicy& policy, unsigned n) {
+    Bench b;
+    b.swd.setClockHz(10000000);
+    CHECK_EQ(b.swd.connect(), 0);
+    PioSWDDriver::WaitStats stats;
+    PioSWDDriver::WaitScope scope(b.swd, stats, policy);
+    b.swdTarget.injectWaits(n);
+    b.swd.readWordViaAP(RAM_BASE);
+    CHECK_EQ(stats.stalled, 1);
+    CHECK_EQ(stats.waits, n);
+    return stats.stallUs;
+}
+
+static void delayAndBackoff() {
+
+    PioSWDDriver::WaitPolicy policy;
+    policy.maxRetries = 10;
+
+    // Spinning, the stall is only the packets: seven of them at 10 MHz
+    // are well under 10us each
+    const uint32_t spin = stallUs(policy, 6);
+    CHECK(spin < 70);
+
+    // A delay before each of the six retries: 10, 20, 40 and then held
+    // at 40. The packets go on while the CPU sleeps, so a couple of 
+    // microseconds either way.
+    policy.delayUs = 10;
+    policy.maxDelayUs = 40;
+    const uint32_t delayed = stallUs(policy, 6);
+    CHECK(delayed + 5 >= spin + 190);
+    CHECK(delayed <= spin + 190 + 5);
+
+    // Without the cap it keeps doubling: 10 + 20 + 40 + 80 + 160 + 320
+    policy.maxDelayUs = 1000;
+    const uint32_t doubled = stallUs(policy, 6);
+    CHECK(doubled + 5 >= spin + 630);
+    CHECK(doubled <= spin + 630 + 5);
+}
+
+static void perCallSite() {
+
+    Bench b;
+    CHECK_EQ(b.swd.connect(), 0);
+    PioSWDDriver::WaitPolicy policy;
+    policy.maxRetries = 200;
+    const PioSWDDriver::WaitStats before = b.swd.getWaitStats();
+
+    PioSWDDriver::WaitStats site1, site2;
+    {
+        PioSWDDriver::WaitScope scope(b.swd, site1, policy);
+        CHECK_EQ(b.swd.getWaitPolicy().maxRetries, 200);
+        for (unsigned n : { 1, 2, 3, 5, 100 }) {
+            b.swdTarget.injectWaits(n);
+            CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE, n), 0);
+        }
+        // A scope inside another one takes over until it ends
+        {
+            PioSWDDriver::WaitScope inner(b.swd, site2, policy);
+            b.swdTarget.injectWaits(8);
+            CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE, 8), 0);
+        }
+        b.swdTarget.injectWaits(1);
+        CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE, 1), 0);
+    }
+    // The policy goes back with the scope
+    CHECK_EQ(b.swd.getWaitPolicy().maxRetries, PioSWDDriver::WaitPolicy().maxRetries);
+
+    // [0] = 1, [1] = 2-3, [2] = 4-7, [3] = 8-15 ... [6] = 64-127
+    const uint32_t expected1[PioSWDDriver::WaitStats::BUCKETS] = { 2, 2, 1, 0, 0, 0, 1, 0 };
+    for (unsigned i = 0; i < PioSWDDriver::WaitStats::BUCKETS; i++)
+        CHECK_EQ(site1.histogram[i], expected1[i]);
+    CHECK_EQ(site1.stalled, 6);
+    CHECK_EQ(site1.waits, 112);
+    CHECK(site1.transfers > site1.stalled);
+
+    const uint32_t expected2[PioSWDDriver::WaitStats::BUCKETS] = { 0, 0, 0, 1, 0, 0, 0, 0 };
+    for (unsigned i = 0; i < PioSWDDriver::WaitStats::BUCKETS; i++)
+        CHECK_EQ(site2.histogram[i], expected2[i]);
+    CHECK_EQ(site2.stalled, 1);
+    CHECK_EQ(site2.waits, 8);
+
+    // None of it went to the statistics outside of any scope
+    CHECK_EQ(b.swd.getWaitStats().stalled, before.stalled);
+    CHECK_EQ(b.swd.getWaitStats().waits, before.waits);
+
+    // The last bucket takes everything from 128 up
+    b.swd.setWaitPolicy(policy);
+    b.swdTarget.injectWaits(150);
+    CHECK_EQ(b.swd.writeWordViaAP(RAM_BASE, 0), 0);
+    CHECK_EQ(b.swd.getWaitStats().histogram[PioSWDDriver::WaitStats::BUCKETS - 1],
+        before.histogram[PioSWDDriver::WaitStats::BUCKETS - 1] + 1);
+    CHECK_EQ(b.swd.getWaitStats().waits, before.waits + 150);
+    CHECK(b.swdTarget.getErrors().empty());
+}
+
+int main(int, const char**) {
+    retryCount();
+    delayAndBackoff();
+    perCallSite();
+    return check::result();
+}